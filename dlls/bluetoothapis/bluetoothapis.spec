@@ -40,10 +40,10 @@
 @ stub BluetoothGATTGetDescriptors
 @ stub BluetoothGATTGetIncludedServices
 @ stdcall BluetoothGATTGetServices(ptr long ptr ptr long)
-@ stub BluetoothGATTRegisterEvent
+@ stdcall BluetoothGATTRegisterEvent(ptr long ptr ptr ptr ptr long)
 @ stdcall BluetoothGATTSetCharacteristicValue(ptr ptr ptr int64 long)
 @ stub BluetoothGATTSetDescriptorValue
-@ stub BluetoothGATTUnregisterEvent
+@ stdcall BluetoothGATTUnregisterEvent(ptr long)
 @ stdcall BluetoothGetDeviceInfo(ptr long)
 @ stub BluetoothGetLocalServiceInfo
 @ stdcall BluetoothGetRadioInfo(ptr ptr)
@@ -52,11 +52,60 @@ static const char *debugstr_BTH_LE_GATT_SERVICE( const BTH_LE_GATT_SERVICE *svc
     return wine_dbg_sprintf( "{ %s %#x }", debugstr_BTH_LE_UUID( &svc->ServiceUuid ), svc->AttributeHandle );
 }
 
+static void le_uuid_to_guid( const BTH_LE_UUID *uuid, GUID *guid )
+{
+    static const GUID base = { 0, 0, 0x1000, { 0x80, 0x00, 0x00, 0x80, 0x5f, 0x9b, 0x34, 0xfb } };
+
+    if (!uuid->IsShortUuid)
+    {
+        *guid = uuid->Value.LongUuid;
+        return;
+    }
+    *guid = base;
+    guid->Data1 = uuid->Value.ShortUuid;
+}
+
+/* Fetches all services and characteristics of the device with a single request. */
+static HRESULT get_gatt_database( HANDLE le_device, struct winebth_gatt_database **out )
+{
+    SIZE_T size = WINEBTH_GATT_DATABASE_SIZE( 8, 32 );
+    struct winebth_gatt_database *db;
+
+    for (;;)
+    {
+        DWORD bytes, err;
+
+        if (!(db = calloc( 1, size )))
+            return HRESULT_FROM_WIN32( ERROR_NO_SYSTEM_RESOURCES );
+        if (DeviceIoControl( le_device, IOCTL_WINEBTH_LE_DEVICE_GET_GATT_DATABASE, NULL, 0, db, size, &bytes, NULL ))
+            break;
+        if ((err = GetLastError()) != ERROR_MORE_DATA)
+        {
+            free( db );
+            return HRESULT_FROM_WIN32( err );
+        }
+        /* Only the header was returned, try again with the size it asks for. */
+        size = WINEBTH_GATT_DATABASE_SIZE( db->services_count, db->characteristics_count );
+        free( db );
+    }
+
+    if (db->version != WINEBTH_GATT_DATABASE_VERSION)
+    {
+        ERR( "Unsupported GATT database version %lu\n", db->version );
+        free( db );
+        return HRESULT_FROM_WIN32( ERROR_NOT_SUPPORTED );
+    }
+    *out = db;
+    return S_OK;
+}
+
 HRESULT WINAPI BluetoothGATTGetServices( HANDLE le_device, USHORT count, BTH_LE_GATT_SERVICE *buf,
                                          USHORT *actual, ULONG flags )
 {
-    struct winebth_le_device_get_gatt_services_params *services;
-    SIZE_T services_count = 1;
+    struct winebth_gatt_database *db;
+    SIZE_T services_count = 0;
+    HRESULT hr;
+    ULONG i;
 
     TRACE( "(%p, %u, %p, %p, %#lx)\n", le_device, count, buf, actual, flags );
 
@@ -66,44 +115,23 @@ HRESULT WINAPI BluetoothGATTGetServices( HANDLE le_device, USHORT count, BTH_LE_
     if ((!buf && count) || (buf && !count))
         return E_INVALIDARG;
 
-    for (;;)
+    if (FAILED( hr = get_gatt_database( le_device, &db ) ))
+        return hr;
+    for (i = 0; i < db->services_count; i++)
     {
-        DWORD size, bytes;
-
-        size = offsetof( struct winebth_le_device_get_gatt_services_params, services[services_count] );
-        services = calloc( 1, size );
-        if (!services)
-            return HRESULT_FROM_WIN32( ERROR_NO_SYSTEM_RESOURCES );
-        if (!DeviceIoControl( le_device, IOCTL_WINEBTH_LE_DEVICE_GET_GATT_SERVICES, NULL, 0, services, size, &bytes, NULL )
-            && GetLastError() != ERROR_MORE_DATA)
-        {
-            free( services );
-            return HRESULT_FROM_WIN32( GetLastError() );
-        }
-        if (!services->count)
-        {
-            *actual = 0;
-            free( services );
-            return S_OK;
-        }
-        if (services_count != services->count)
-        {
-            services_count = services->count;
-            free( services );
+        if (!db->services[i].primary)
             continue;
-        }
-        break;
+        if (services_count < count)
+            buf[services_count] = db->services[i].service;
+        services_count++;
     }
+    free( db );
 
     *actual = services_count;
+    if (!services_count)
+        return S_OK;
     if (!buf)
-    {
-        free( services );
         return HRESULT_FROM_WIN32( ERROR_MORE_DATA );
-    }
-
-    memcpy( buf, services->services, min( services_count, count ) * sizeof( *buf ) );
-    free( services );
     if (count < services_count)
         return HRESULT_FROM_WIN32( ERROR_INVALID_USER_BUFFER );
 
@@ -113,8 +141,12 @@ HRESULT WINAPI BluetoothGATTGetServices( HANDLE le_device, USHORT count, BTH_LE_
 HRESULT WINAPI BluetoothGATTGetCharacteristics( HANDLE device, BTH_LE_GATT_SERVICE *service, USHORT count,
                                                 BTH_LE_GATT_CHARACTERISTIC *buf, USHORT *actual, ULONG flags )
 {
-    struct winebth_le_device_get_gatt_characteristics_params *chars;
-    DWORD size, bytes;
+    const struct winebth_gatt_database_service *entry = NULL;
+    const BTH_LE_GATT_CHARACTERISTIC *chars;
+    struct winebth_gatt_database *db;
+    GUID uuid, cur;
+    HRESULT hr;
+    ULONG i;
 
     TRACE( "(%p, %s, %u, %p, %p, %#lx)\n", device, debugstr_BTH_LE_GATT_SERVICE( service ), count, buf, actual, flags );
 
@@ -127,31 +159,38 @@ HRESULT WINAPI BluetoothGATTGetCharacteristics( HANDLE device, BTH_LE_GATT_SERVI
     if ((buf && !count) || !service)
         return E_INVALIDARG;
 
-    size = offsetof( struct winebth_le_device_get_gatt_characteristics_params, characteristics[count] );
-    chars = calloc( 1, size );
-    if (!chars)
-        return HRESULT_FROM_WIN32( ERROR_NO_SYSTEM_RESOURCES );
-    chars->service = *service;
-    if (!DeviceIoControl( device, IOCTL_WINEBTH_LE_DEVICE_GET_GATT_CHARACTERISTICS, chars, size, chars,
-                               size, &bytes, NULL ) && GetLastError() != ERROR_MORE_DATA)
+    if (FAILED( hr = get_gatt_database( device, &db ) ))
+        return hr;
+    le_uuid_to_guid( &service->ServiceUuid, &uuid );
+    for (i = 0; i < db->services_count; i++)
     {
-        free( chars );
-        return HRESULT_FROM_WIN32( GetLastError() );
+        le_uuid_to_guid( &db->services[i].service.ServiceUuid, &cur );
+        if (IsEqualGUID( &cur, &uuid ) && db->services[i].service.AttributeHandle == service->AttributeHandle)
+        {
+            entry = &db->services[i];
+            break;
+        }
+    }
+    if (!entry)
+    {
+        free( db );
+        return HRESULT_FROM_WIN32( ERROR_INVALID_PARAMETER );
     }
 
-    *actual = chars->count;
-    if (!chars->count)
+    *actual = entry->characteristics_count;
+    if (!entry->characteristics_count)
     {
-        free( chars );
+        free( db );
         return S_OK;
     }
     if (!buf)
     {
-        free( chars );
+        free( db );
         return HRESULT_FROM_WIN32( ERROR_MORE_DATA );
     }
-    memcpy( buf, chars->characteristics, min( count, chars->count ) * sizeof( *buf ) );
-    free( chars );
+    chars = (const BTH_LE_GATT_CHARACTERISTIC *)&db->services[db->services_count];
+    memcpy( buf, chars + entry->first_characteristic, min( count, entry->characteristics_count ) * sizeof( *buf ) );
+    free( db );
     if (count < *actual)
         return HRESULT_FROM_WIN32( ERROR_INVALID_USER_BUFFER );
     return S_OK;
@@ -166,7 +205,7 @@ HRESULT WINAPI BluetoothGATTGetCharacteristicValue( HANDLE device, PBTH_LE_GATT_
 
     TRACE( "(%p, %p, %lu, %p, %p, %#lx)\n", device, characteristic, value_size, value, value_size_required, flags );
 
-    if (flags)
+    if (flags & ~(BLUETOOTH_GATT_FLAG_FORCE_READ_FROM_DEVICE | BLUETOOTH_GATT_FLAG_FORCE_READ_FROM_CACHE))
         FIXME( "Unsupported flags: %#lx\n", flags );
 
     if (!characteristic)
@@ -182,6 +221,10 @@ HRESULT WINAPI BluetoothGATTGetCharacteristicValue( HANDLE device, PBTH_LE_GATT_
 
     memset( &params->service, 0, sizeof(params->service) );
     params->characteristic = *characteristic;
+    if (flags & BLUETOOTH_GATT_FLAG_FORCE_READ_FROM_CACHE)
+        params->flags = WINEBTH_READ_CHARACTERISTIC_CACHED_ONLY;
+    else if (!(flags & BLUETOOTH_GATT_FLAG_FORCE_READ_FROM_DEVICE))
+        params->flags = WINEBTH_READ_CHARACTERISTIC_CACHED;
     if (!DeviceIoControl( device, IOCTL_WINEBTH_LE_DEVICE_READ_CHARACTERISTIC, params, size, params, size, &bytes, NULL ))
     {
         HRESULT hr = HRESULT_FROM_WIN32( GetLastError() );
@@ -251,3 +294,255 @@ HRESULT WINAPI BluetoothGATTSetCharacteristicValue( HANDLE device, PBTH_LE_GATT_
     free( params );
     return S_OK;
 }
+
+/* Every registered characteristic keeps one READ_NOTIFICATIONS request pending, all on the same overlapped handle.
+ * Their completions go to a single threadpool I/O object, so a registration doesn't need a thread of its own no matter
+ * how many characteristics it covers, and every completion delivers all values queued since the previous one. */
+#define GATT_EVENT_BUFFER_SIZE 4096
+
+struct gatt_event_registration;
+
+struct gatt_event_characteristic
+{
+    OVERLAPPED ovl;
+    struct gatt_event_registration *registration;
+    BTH_LE_GATT_CHARACTERISTIC characteristic;
+    DWORD dispatch_thread; /* The thread running the callback for this characteristic, if any. */
+    ULONG last_overflow_count;
+    struct winebth_le_device_read_notifications_params *params;
+};
+
+struct gatt_event_registration
+{
+    LONG refcount; /* One for the owner, one per pending request. */
+    LONG stopping;
+    HANDLE io_handle;
+    TP_IO *io;
+    HANDLE idle_event;
+    PFNBLUETOOTH_GATT_EVENT_CALLBACK callback;
+    void *context;
+    USHORT count;
+    struct gatt_event_characteristic chars[];
+};
+
+#define GATT_EVENT_PARAMS_SIZE \
+    offsetof( struct winebth_le_device_read_notifications_params, data[GATT_EVENT_BUFFER_SIZE] )
+
+/* Values are handed to the callback straight from the request buffer. */
+C_ASSERT( offsetof( struct winebth_gatt_notification_record, data ) -
+          offsetof( struct winebth_gatt_notification_record, size ) == offsetof( BTH_LE_GATT_CHARACTERISTIC_VALUE, Data ) );
+
+static void gatt_event_registration_free( struct gatt_event_registration *reg )
+{
+    USHORT i;
+
+    /* The callback that dropped the last reference may still be running, the object gets closed once it returns. */
+    if (reg->io) CloseThreadpoolIo( reg->io );
+    if (reg->io_handle != INVALID_HANDLE_VALUE) CloseHandle( reg->io_handle );
+    if (reg->idle_event) CloseHandle( reg->idle_event );
+    for (i = 0; i < reg->count; i++)
+        free( reg->chars[i].params );
+    free( reg );
+}
+
+static void gatt_event_registration_release( struct gatt_event_registration *reg )
+{
+    LONG ref = InterlockedDecrement( &reg->refcount );
+
+    /* BluetoothGATTUnregisterEvent may be waiting for the last request to finish. */
+    if (ref == 1 && ReadAcquire( &reg->stopping )) SetEvent( reg->idle_event );
+    else if (!ref) gatt_event_registration_free( reg );
+}
+
+/* Takes over a reference to the registration, which is released once the request is done. */
+static void gatt_event_characteristic_submit( struct gatt_event_characteristic *chrc )
+{
+    struct gatt_event_registration *reg = chrc->registration;
+
+    memset( chrc->params, 0, offsetof( struct winebth_le_device_read_notifications_params, data[0] ) );
+    chrc->params->characteristic = chrc->characteristic;
+
+    StartThreadpoolIo( reg->io );
+    if (!DeviceIoControl( reg->io_handle, IOCTL_WINEBTH_LE_DEVICE_READ_NOTIFICATIONS, chrc->params,
+                          GATT_EVENT_PARAMS_SIZE, chrc->params, GATT_EVENT_PARAMS_SIZE, NULL, &chrc->ovl )
+        && GetLastError() != ERROR_IO_PENDING)
+    {
+        WARN( "Failed to read values of characteristic %#x: %lu\n", chrc->characteristic.AttributeHandle,
+              GetLastError() );
+        CancelThreadpoolIo( reg->io );
+        gatt_event_registration_release( reg );
+        return;
+    }
+    /* BluetoothGATTUnregisterEvent may have tried to cancel the previous request after it had completed. */
+    if (ReadAcquire( &reg->stopping )) CancelIoEx( reg->io_handle, &chrc->ovl );
+}
+
+static void gatt_event_characteristic_dispatch( struct gatt_event_characteristic *chrc )
+{
+    struct winebth_le_device_read_notifications_params *params = chrc->params;
+    struct gatt_event_registration *reg = chrc->registration;
+    UCHAR *ptr = params->data, *end = params->data + min( params->data_size, GATT_EVENT_BUFFER_SIZE );
+    BLUETOOTH_GATT_VALUE_CHANGED_EVENT event;
+
+    if (params->overflow_count != chrc->last_overflow_count)
+    {
+        WARN( "Notification queue overflowed, %lu values dropped\n",
+              params->overflow_count - chrc->last_overflow_count );
+        chrc->last_overflow_count = params->overflow_count;
+    }
+
+    event.ChangedAttributeHandle = chrc->characteristic.CharacteristicValueHandle;
+    WriteRelease( (LONG *)&chrc->dispatch_thread, GetCurrentThreadId() );
+    while (end - ptr >= sizeof(struct winebth_gatt_notification_record) && !ReadAcquire( &reg->stopping ))
+    {
+        struct winebth_gatt_notification_record *record = (void *)ptr;
+
+        if (record->size > end - ptr - sizeof(*record)) break;
+        event.CharacteristicValueDataSize = offsetof( BTH_LE_GATT_CHARACTERISTIC_VALUE, Data ) + record->size;
+        event.CharacteristicValue = (BTH_LE_GATT_CHARACTERISTIC_VALUE *)&record->size;
+        reg->callback( CharacteristicValueChangedEvent, &event, reg->context );
+        ptr += sizeof(*record) + record->size;
+    }
+    WriteRelease( (LONG *)&chrc->dispatch_thread, 0 );
+}
+
+static void CALLBACK gatt_event_io_callback( TP_CALLBACK_INSTANCE *instance, void *context, void *overlapped,
+                                             ULONG result, ULONG_PTR bytes, TP_IO *io )
+{
+    struct gatt_event_characteristic *chrc = CONTAINING_RECORD( overlapped, struct gatt_event_characteristic, ovl );
+    struct gatt_event_registration *reg = context;
+
+    if (result)
+    {
+        /* Notifications were disabled, or the device is gone. */
+        if (result != ERROR_OPERATION_ABORTED)
+            WARN( "Failed to read values of characteristic %#x: %lu\n", chrc->characteristic.AttributeHandle, result );
+    }
+    else if (!ReadAcquire( &reg->stopping ))
+    {
+        gatt_event_characteristic_dispatch( chrc );
+        if (!ReadAcquire( &reg->stopping ))
+        {
+            gatt_event_characteristic_submit( chrc );
+            return;
+        }
+    }
+    gatt_event_registration_release( reg );
+}
+
+static HRESULT gatt_event_enable_notifications( HANDLE device, const BTH_LE_GATT_CHARACTERISTIC *characteristic )
+{
+    struct winebth_le_device_set_notify_params params = {0};
+    DWORD bytes;
+
+    params.characteristic = *characteristic;
+    params.enable = TRUE;
+    params.overflow_policy = WINEBTH_NOTIFICATION_OVERFLOW_DROP_OLDEST;
+    if (!DeviceIoControl( device, IOCTL_WINEBTH_LE_DEVICE_SET_NOTIFY, &params, sizeof(params), NULL, 0, &bytes, NULL ))
+        return HRESULT_FROM_WIN32( GetLastError() );
+    return S_OK;
+}
+
+HRESULT WINAPI BluetoothGATTRegisterEvent( HANDLE device, BTH_LE_GATT_EVENT_TYPE type, void *param,
+                                           PFNBLUETOOTH_GATT_EVENT_CALLBACK callback, void *context,
+                                           BLUETOOTH_GATT_EVENT_HANDLE *handle, ULONG flags )
+{
+    const BLUETOOTH_GATT_VALUE_CHANGED_EVENT_REGISTRATION *registration = param;
+    struct gatt_event_registration *reg;
+    HRESULT hr;
+    USHORT i;
+
+    TRACE( "(%p, %d, %p, %p, %p, %p, %#lx)\n", device, type, param, callback, context, handle, flags );
+
+    if (flags)
+        FIXME( "Unsupported flags: %#lx\n", flags );
+
+    if (!handle)
+        return E_POINTER;
+    if (type != CharacteristicValueChangedEvent || !registration || !registration->NumCharacteristics || !callback)
+        return E_INVALIDARG;
+    if (!device || device == INVALID_HANDLE_VALUE)
+        return E_HANDLE;
+
+    if (!(reg = calloc( 1, offsetof( struct gatt_event_registration, chars[registration->NumCharacteristics] ) )))
+        return HRESULT_FROM_WIN32( ERROR_NO_SYSTEM_RESOURCES );
+    reg->refcount = 1;
+    reg->io_handle = INVALID_HANDLE_VALUE;
+    reg->callback = callback;
+    reg->context = context;
+    reg->count = registration->NumCharacteristics;
+    for (i = 0; i < reg->count; i++)
+    {
+        reg->chars[i].registration = reg;
+        reg->chars[i].characteristic = registration->Characteristics[i];
+        if (!(reg->chars[i].params = calloc( 1, GATT_EVENT_PARAMS_SIZE )))
+        {
+            gatt_event_registration_free( reg );
+            return HRESULT_FROM_WIN32( ERROR_NO_SYSTEM_RESOURCES );
+        }
+    }
+
+    /* The caller's handle may have been opened for synchronous I/O. */
+    reg->io_handle = ReOpenFile( device, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                 FILE_FLAG_OVERLAPPED );
+    if (reg->io_handle == INVALID_HANDLE_VALUE)
+    {
+        hr = HRESULT_FROM_WIN32( GetLastError() );
+        gatt_event_registration_free( reg );
+        return hr;
+    }
+    if (!(reg->io = CreateThreadpoolIo( reg->io_handle, gatt_event_io_callback, reg, NULL )) ||
+        !(reg->idle_event = CreateEventW( NULL, FALSE, FALSE, NULL )))
+    {
+        hr = HRESULT_FROM_WIN32( GetLastError() );
+        gatt_event_registration_free( reg );
+        return hr;
+    }
+
+    /* Native expects the client characteristic configuration descriptor to be written by the caller. That isn't
+     * supported yet, so notifications get enabled here instead. */
+    for (i = 0; i < reg->count; i++)
+    {
+        if (FAILED( hr = gatt_event_enable_notifications( device, &reg->chars[i].characteristic ) ))
+        {
+            gatt_event_registration_free( reg );
+            return hr;
+        }
+    }
+
+    for (i = 0; i < reg->count; i++)
+    {
+        InterlockedIncrement( &reg->refcount );
+        gatt_event_characteristic_submit( &reg->chars[i] );
+    }
+
+    *handle = reg;
+    return S_OK;
+}
+
+HRESULT WINAPI BluetoothGATTUnregisterEvent( BLUETOOTH_GATT_EVENT_HANDLE handle, ULONG flags )
+{
+    struct gatt_event_registration *reg = handle;
+    BOOL from_callback = FALSE;
+    USHORT i;
+
+    TRACE( "(%p, %#lx)\n", handle, flags );
+
+    if (flags)
+        FIXME( "Unsupported flags: %#lx\n", flags );
+
+    if (!reg)
+        return E_INVALIDARG;
+
+    InterlockedExchange( &reg->stopping, TRUE );
+    CancelIoEx( reg->io_handle, NULL );
+    for (i = 0; i < reg->count; i++)
+        if (ReadAcquire( (LONG *)&reg->chars[i].dispatch_thread ) == GetCurrentThreadId()) from_callback = TRUE;
+
+    /* Once this returns, the callback doesn't get called again, unless this was called from the callback itself, in
+     * which case it may still be running on behalf of other characteristics. */
+    if (!from_callback && ReadAcquire( &reg->refcount ) > 1)
+        WaitForSingleObject( reg->idle_event, INFINITE );
+    gatt_event_registration_release( reg );
+    return S_OK;
+}
@@ -55,11 +55,33 @@ struct bluetooth_find_radio_handle
     DWORD idx;
 };
 
+/* A radio taking part in an inquiry. It keeps a WAIT_DEVICE_CHANGES request pending on a handle of its own, so that
+ * devices can be reported as soon as they are seen. */
+struct bluetooth_find_radio
+{
+    HANDLE radio;
+    HANDLE io; /* The same radio, opened for overlapped I/O. */
+    OVERLAPPED ovl;
+    BOOL pending;
+    BOOL discovering;
+    struct winebth_radio_get_device_changes_params *changes;
+};
+
 struct bluetooth_find_device
 {
     BLUETOOTH_DEVICE_SEARCH_PARAMS params;
-    BTH_DEVICE_INFO_LIST *device_list;
+    /* Devices that haven't been looked at yet. */
+    BTH_DEVICE_INFO *devices;
+    SIZE_T count;
+    SIZE_T capacity;
     SIZE_T idx;
+    /* For inquiries, every device is only returned once, and new ones are waited for until the deadline. */
+    BTH_ADDR *returned;
+    SIZE_T returned_count;
+    SIZE_T returned_capacity;
+    ULONGLONG deadline;
+    SIZE_T radios_count;
+    struct bluetooth_find_radio *radios;
 };
 
 static const char *debugstr_BLUETOOTH_DEVICE_SEARCH_PARAMS( const BLUETOOTH_DEVICE_SEARCH_PARAMS *params )
@@ -88,43 +110,153 @@ static BOOL radio_set_inquiry( HANDLE radio, BOOL enable )
                             NULL, 0, NULL, 0, &bytes, NULL );
 }
 
-static BTH_DEVICE_INFO_LIST *radio_get_devices( HANDLE radio )
+/* The device list of every recently used radio handle, kept up to date with IOCTL_WINEBTH_RADIO_GET_DEVICE_CHANGES
+ * so that each lookup only transfers the devices that changed since the last one. If a handle gets reused for
+ * another radio, the driver notices the epoch mismatch and sends the whole list again. */
+#define DEVICE_CACHE_SLOTS 4
+#define DEVICE_CHANGES_PER_CALL 64
+
+struct radio_device_cache
 {
-    DWORD num_devices = 1;
+    HANDLE radio;
+    ULONGLONG epoch;
+    ULONGLONG generation;
+    SIZE_T count;
+    SIZE_T capacity;
+    BTH_DEVICE_INFO *devices;
+};
 
-    for (;;)
-    {
-        BTH_DEVICE_INFO_LIST *list;
-        DWORD size, bytes;
+static CRITICAL_SECTION device_cache_cs;
+static CRITICAL_SECTION_DEBUG device_cache_cs_debug =
+{
+    0, 0, &device_cache_cs,
+    { &device_cache_cs_debug.ProcessLocksList, &device_cache_cs_debug.ProcessLocksList },
+      0, 0, { (DWORD_PTR)(__FILE__ ": device_cache_cs") }
+};
+static CRITICAL_SECTION device_cache_cs = { &device_cache_cs_debug, -1, 0, 0, 0, 0 };
+
+static struct radio_device_cache device_caches[DEVICE_CACHE_SLOTS]; /* Guarded by device_cache_cs */
+static unsigned int device_cache_next; /* Guarded by device_cache_cs */
 
-        size = sizeof( *list ) + (num_devices - 1) * sizeof( list->deviceList[0] );
-        list = calloc( 1, size );
-        if (!list)
+static struct radio_device_cache *device_cache_get( HANDLE radio )
+{
+    struct radio_device_cache *cache;
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE( device_caches ); i++)
+        if (device_caches[i].radio == radio) return &device_caches[i];
+
+    cache = &device_caches[device_cache_next++ % ARRAY_SIZE( device_caches )];
+    cache->radio = radio;
+    cache->epoch = cache->generation = 0;
+    cache->count = 0;
+    return cache;
+}
+
+static BOOL device_cache_apply( struct radio_device_cache *cache, const struct winebth_device_change *change )
+{
+    SIZE_T i;
+
+    for (i = 0; i < cache->count; i++)
+        if (cache->devices[i].address == change->info.address) break;
+
+    if (change->type == WINEBTH_DEVICE_CHANGE_REMOVED)
+    {
+        if (i < cache->count)
         {
-            SetLastError( ERROR_OUTOFMEMORY );
-            return NULL;
+            memmove( &cache->devices[i], &cache->devices[i + 1], (cache->count - i - 1) * sizeof( *cache->devices ) );
+            cache->count--;
         }
-        if (!DeviceIoControl( radio, IOCTL_BTH_GET_DEVICE_INFO, NULL, 0, list, size, &bytes, NULL )
-            && GetLastError() != ERROR_INVALID_USER_BUFFER)
+        return TRUE;
+    }
+    if (i == cache->count)
+    {
+        if (cache->count == cache->capacity)
         {
-            free( list );
-            return NULL;
+            SIZE_T capacity = max( cache->capacity * 2, 8 );
+            BTH_DEVICE_INFO *devices;
+
+            if (!(devices = realloc( cache->devices, capacity * sizeof( *devices ) ))) return FALSE;
+            cache->devices = devices;
+            cache->capacity = capacity;
         }
-        if (!list->numOfDevices)
+        cache->count++;
+    }
+    cache->devices[i] = change->info;
+    return TRUE;
+}
+
+static BOOL device_cache_update( struct radio_device_cache *cache )
+{
+    const SIZE_T size = offsetof( struct winebth_radio_get_device_changes_params, changes[DEVICE_CHANGES_PER_CALL] );
+    struct winebth_radio_get_device_changes_params *params;
+    BOOL ret = TRUE;
+
+    if (!(params = malloc( size )))
+    {
+        SetLastError( ERROR_OUTOFMEMORY );
+        return FALSE;
+    }
+
+    do
+    {
+        DWORD bytes, i;
+
+        params->epoch = cache->epoch;
+        params->generation = cache->generation;
+        if (!DeviceIoControl( cache->radio, IOCTL_WINEBTH_RADIO_GET_DEVICE_CHANGES, params, size, params, size,
+                              &bytes, NULL ))
         {
-            free( list );
-            SetLastError( ERROR_NO_MORE_ITEMS );
-            return NULL;
+            ret = FALSE;
+            break;
         }
-        if (num_devices != list->numOfDevices)
+        if (params->flags & WINEBTH_DEVICE_CHANGES_RESET)
+            cache->count = 0;
+        for (i = 0; i < params->count; i++)
         {
-            /* The buffer is incorrectly sized, try again. */
-            num_devices = list->numOfDevices;
-            free( list );
-            continue;
+            if (!device_cache_apply( cache, &params->changes[i] ))
+            {
+                SetLastError( ERROR_OUTOFMEMORY );
+                ret = FALSE;
+                break;
+            }
         }
-        return list;
+        if (!ret) break;
+        cache->epoch = params->epoch;
+        cache->generation = params->generation;
+    } while (params->flags & WINEBTH_DEVICE_CHANGES_MORE);
+
+    /* Whatever got applied can't be trusted to match any generation, start over next time. */
+    if (!ret) cache->epoch = cache->generation = 0;
+    free( params );
+    return ret;
+}
+
+static BTH_DEVICE_INFO_LIST *radio_get_devices( HANDLE radio )
+{
+    struct radio_device_cache *cache;
+    BTH_DEVICE_INFO_LIST *list = NULL;
+
+    EnterCriticalSection( &device_cache_cs );
+    cache = device_cache_get( radio );
+    if (!device_cache_update( cache ))
+        goto done;
+    if (!cache->count)
+    {
+        SetLastError( ERROR_NO_MORE_ITEMS );
+        goto done;
     }
+    if (!(list = calloc( 1, offsetof( BTH_DEVICE_INFO_LIST, deviceList[cache->count] ) )))
+    {
+        SetLastError( ERROR_OUTOFMEMORY );
+        goto done;
+    }
+    list->numOfDevices = cache->count;
+    memcpy( list->deviceList, cache->devices, cache->count * sizeof( *cache->devices ) );
+
+done:
+    LeaveCriticalSection( &device_cache_cs );
+    return list;
 }
 
 static void device_info_from_bth_info( BLUETOOTH_DEVICE_INFO *info, const BTH_DEVICE_INFO *bth_info )
@@ -143,14 +275,57 @@ static void device_info_from_bth_info( BLUETOOTH_DEVICE_INFO *info, const BTH_DE
         MultiByteToWideChar( CP_ACP, 0, bth_info->name, -1, info->szName, ARRAY_SIZE( info->szName ) );
 }
 
+static BOOL device_find_add_device( struct bluetooth_find_device *find, const BTH_DEVICE_INFO *bth_info )
+{
+    if (find->idx == find->count)
+        find->idx = find->count = 0;
+    if (find->count == find->capacity)
+    {
+        SIZE_T capacity = max( find->capacity * 2, 8 );
+        BTH_DEVICE_INFO *devices;
+
+        if (!(devices = realloc( find->devices, capacity * sizeof( *devices ) )))
+        {
+            SetLastError( ERROR_OUTOFMEMORY );
+            return FALSE;
+        }
+        find->devices = devices;
+        find->capacity = capacity;
+    }
+    find->devices[find->count++] = *bth_info;
+    return TRUE;
+}
+
+/* Returns FALSE if the device has already been returned by this inquiry, otherwise remembers it. */
+static BOOL device_find_mark_returned( struct bluetooth_find_device *find, BTH_ADDR address )
+{
+    SIZE_T i;
+
+    for (i = 0; i < find->returned_count; i++)
+        if (find->returned[i] == address) return FALSE;
+
+    if (find->returned_count == find->returned_capacity)
+    {
+        SIZE_T capacity = max( find->returned_capacity * 2, 8 );
+        BTH_ADDR *returned;
+
+        /* At worst, the device gets returned again. */
+        if (!(returned = realloc( find->returned, capacity * sizeof( *returned ) ))) return TRUE;
+        find->returned = returned;
+        find->returned_capacity = capacity;
+    }
+    find->returned[find->returned_count++] = address;
+    return TRUE;
+}
+
 static BOOL device_find_next( struct bluetooth_find_device *find, BLUETOOTH_DEVICE_INFO *info )
 {
-    while (find->idx < find->device_list->numOfDevices)
+    while (find->idx < find->count)
     {
         const BTH_DEVICE_INFO *bth_info;
         BOOL matches;
 
-        bth_info = &find->device_list->deviceList[find->idx++];
+        bth_info = &find->devices[find->idx++];
         matches = (find->params.fReturnAuthenticated && bth_info->flags & BDIF_PAIRED) ||
             (find->params.fReturnRemembered && bth_info->flags & BDIF_PERSONAL) ||
             (find->params.fReturnUnknown && !(bth_info->flags & BDIF_PERSONAL)) ||
@@ -158,6 +333,9 @@ static BOOL device_find_next( struct bluetooth_find_device *find, BLUETOOTH_DEVI
 
         if (!matches)
             continue;
+        /* A device may be reported several times while inquiring, either by another radio or because it changed. */
+        if (find->params.fIssueInquiry && !device_find_mark_returned( find, bth_info->address ))
+            continue;
 
         device_info_from_bth_info( info, bth_info );
         /* If the user is looking for unknown devices as part of device inquiry, or wants connected devices,
@@ -173,6 +351,192 @@ static BOOL device_find_next( struct bluetooth_find_device *find, BLUETOOTH_DEVI
     return FALSE;
 }
 
+/* Snapshots the devices known to the radio. */
+static BOOL device_find_add_radio_devices( struct bluetooth_find_device *find, HANDLE radio )
+{
+    BTH_DEVICE_INFO_LIST *device_list;
+    BOOL ret = TRUE;
+    ULONG i;
+
+    if (!(device_list = radio_get_devices( radio )))
+        return GetLastError() == ERROR_NO_MORE_ITEMS;
+    for (i = 0; i < device_list->numOfDevices && ret; i++)
+        ret = device_find_add_device( find, &device_list->deviceList[i] );
+    free( device_list );
+    return ret;
+}
+
+static BOOL device_find_snapshot( struct bluetooth_find_device *find )
+{
+    BLUETOOTH_FIND_RADIO_PARAMS find_params = {.dwSize = sizeof( find_params )};
+    HBLUETOOTH_RADIO_FIND radio_find;
+    HANDLE radio;
+    BOOL ret;
+
+    if (find->params.hRadio)
+        return device_find_add_radio_devices( find, find->params.hRadio );
+
+    if (!(radio_find = BluetoothFindFirstRadio( &find_params, &radio )))
+        return FALSE;
+    do
+    {
+        ret = device_find_add_radio_devices( find, radio );
+        CloseHandle( radio );
+    } while (ret && BluetoothFindNextRadio( radio_find, &radio ));
+    BluetoothFindRadioClose( radio_find );
+    return ret;
+}
+
+/* Waits for devices to be added or changed after the ones returned by the previous request. The first request returns
+ * every device the radio already knows about. */
+static BOOL device_find_radio_wait( struct bluetooth_find_radio *radio )
+{
+    const SIZE_T size = offsetof( struct winebth_radio_get_device_changes_params, changes[DEVICE_CHANGES_PER_CALL] );
+
+    /* The epoch and generation to wait from are the ones returned by the previous request. */
+    if (!DeviceIoControl( radio->io, IOCTL_WINEBTH_RADIO_WAIT_DEVICE_CHANGES, radio->changes, size, radio->changes,
+                          size, NULL, &radio->ovl ) && GetLastError() != ERROR_IO_PENDING)
+    {
+        WARN( "Failed to wait for device changes: %lu\n", GetLastError() );
+        return FALSE;
+    }
+    radio->pending = TRUE;
+    return TRUE;
+}
+
+static BOOL device_find_radio_read( struct bluetooth_find_device *find, struct bluetooth_find_radio *radio, BOOL wait )
+{
+    DWORD bytes, i;
+
+    radio->pending = FALSE;
+    if (!GetOverlappedResult( radio->io, &radio->ovl, &bytes, wait ))
+        return FALSE;
+    for (i = 0; i < radio->changes->count; i++)
+    {
+        if (radio->changes->changes[i].type == WINEBTH_DEVICE_CHANGE_REMOVED) continue;
+        if (!device_find_add_device( find, &radio->changes->changes[i].info )) return FALSE;
+    }
+    return TRUE;
+}
+
+/* Takes over the radio handle. */
+static BOOL device_find_add_inquiry_radio( struct bluetooth_find_device *find, HANDLE handle )
+{
+    const SIZE_T size = offsetof( struct winebth_radio_get_device_changes_params, changes[DEVICE_CHANGES_PER_CALL] );
+    struct bluetooth_find_radio *radios, *radio;
+
+    if (!(radios = realloc( find->radios, (find->radios_count + 1) * sizeof( *radios ) )))
+    {
+        CloseHandle( handle );
+        SetLastError( ERROR_OUTOFMEMORY );
+        return FALSE;
+    }
+    find->radios = radios;
+    radio = &radios[find->radios_count++];
+    memset( radio, 0, sizeof( *radio ) );
+    radio->radio = handle;
+    radio->io = ReOpenFile( handle, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                            FILE_FLAG_OVERLAPPED );
+    if (radio->io == INVALID_HANDLE_VALUE)
+        return FALSE;
+    if (!(radio->ovl.hEvent = CreateEventW( NULL, TRUE, FALSE, NULL )))
+        return FALSE;
+    if (!(radio->changes = calloc( 1, size )))
+    {
+        SetLastError( ERROR_OUTOFMEMORY );
+        return FALSE;
+    }
+
+    if (!radio_set_inquiry( radio->radio, TRUE ))
+        return FALSE;
+    radio->discovering = TRUE;
+    return device_find_radio_wait( radio );
+}
+
+static BOOL device_find_start_inquiry( struct bluetooth_find_device *find )
+{
+    BLUETOOTH_FIND_RADIO_PARAMS find_params = {.dwSize = sizeof( find_params )};
+    HBLUETOOTH_RADIO_FIND radio_find;
+    BOOL started = FALSE;
+    DWORD err = ERROR_NO_MORE_ITEMS;
+    HANDLE radio;
+
+    find->deadline = GetTickCount64() + find->params.cTimeoutMultiplier * 1280;
+    if (find->params.hRadio)
+    {
+        if (!DuplicateHandle( GetCurrentProcess(), find->params.hRadio, GetCurrentProcess(), &radio, 0, FALSE,
+                              DUPLICATE_SAME_ACCESS ))
+            return FALSE;
+        return device_find_add_inquiry_radio( find, radio );
+    }
+
+    if (!(radio_find = BluetoothFindFirstRadio( &find_params, &radio )))
+        return FALSE;
+    /* Radios that can't inquire, for instance because they are powered off, are left out. */
+    do
+    {
+        if (device_find_add_inquiry_radio( find, radio ))
+            started = TRUE;
+        else
+            WARN( "Failed to start inquiry on radio %p: %lu\n", radio, (err = GetLastError()) );
+    } while (BluetoothFindNextRadio( radio_find, &radio ));
+    BluetoothFindRadioClose( radio_find );
+
+    if (!started) SetLastError( err );
+    return started;
+}
+
+/* Stops inquiring, but still takes the devices reported by requests that completed in the meantime. */
+static void device_find_stop_inquiry( struct bluetooth_find_device *find )
+{
+    SIZE_T i;
+
+    for (i = 0; i < find->radios_count; i++)
+    {
+        struct bluetooth_find_radio *radio = &find->radios[i];
+
+        if (radio->pending)
+        {
+            CancelIoEx( radio->io, &radio->ovl );
+            device_find_radio_read( find, radio, TRUE );
+        }
+        if (radio->discovering)
+        {
+            radio_set_inquiry( radio->radio, FALSE );
+            radio->discovering = FALSE;
+        }
+    }
+    find->deadline = 0;
+}
+
+/* Waits until one of the radios reports new devices, or the inquiry times out. */
+static BOOL device_find_wait( struct bluetooth_find_device *find )
+{
+    HANDLE events[MAXIMUM_WAIT_OBJECTS];
+    SIZE_T indices[MAXIMUM_WAIT_OBJECTS], i;
+    ULONGLONG now = GetTickCount64();
+    DWORD count = 0, ret;
+
+    if (now >= find->deadline)
+        return FALSE;
+    for (i = 0; i < find->radios_count && count < ARRAY_SIZE( events ); i++)
+    {
+        if (!find->radios[i].pending) continue;
+        indices[count] = i;
+        events[count++] = find->radios[i].ovl.hEvent;
+    }
+    if (!count)
+        return FALSE;
+
+    ret = WaitForMultipleObjects( count, events, FALSE, find->deadline - now );
+    if (ret >= WAIT_OBJECT_0 + count)
+        return FALSE;
+    /* A radio that failed, for instance because it got removed, just stops taking part in the inquiry. */
+    if (device_find_radio_read( find, &find->radios[indices[ret - WAIT_OBJECT_0]], FALSE ))
+        device_find_radio_wait( &find->radios[indices[ret - WAIT_OBJECT_0]] );
+    return TRUE;
+}
+
 /*********************************************************************
  *  BluetoothFindFirstDevice
  */
@@ -180,7 +544,7 @@ HBLUETOOTH_DEVICE_FIND WINAPI BluetoothFindFirstDevice( BLUETOOTH_DEVICE_SEARCH_
                                                         BLUETOOTH_DEVICE_INFO *info )
 {
     struct bluetooth_find_device *hfind;
-    BTH_DEVICE_INFO_LIST *device_list;
+    BOOL ret;
 
     TRACE( "(%s %p)\n", debugstr_BLUETOOTH_DEVICE_SEARCH_PARAMS( params ), info );
 
@@ -199,40 +563,31 @@ HBLUETOOTH_DEVICE_FIND WINAPI BluetoothFindFirstDevice( BLUETOOTH_DEVICE_SEARCH_
         SetLastError( ERROR_INVALID_PARAMETER );
         return NULL;
     }
-    if (!params->hRadio)
+
+    if (!(hfind = calloc( 1, sizeof( *hfind ) )))
     {
-        /* TODO: Perform device inquiry on all local radios */
-        FIXME( "semi-stub!\n" );
-        SetLastError( ERROR_INVALID_PARAMETER );
+        SetLastError( ERROR_OUTOFMEMORY );
         return NULL;
     }
+    hfind->params = *params;
 
+    /* Inquiries don't wait for the timeout before returning anything. Devices are returned as soon as any radio
+     * reports them, and BluetoothFindNextDevice only blocks until the next one shows up, or the timeout expires. */
     if (params->fIssueInquiry)
+        ret = device_find_start_inquiry( hfind );
+    else
+        ret = device_find_snapshot( hfind );
+    if (!ret)
     {
-        if (!radio_set_inquiry( params->hRadio, TRUE ))
-            return NULL;
-        Sleep( params->cTimeoutMultiplier * 1280 );
-        radio_set_inquiry( params->hRadio, FALSE );
-    }
-
-    if (!(device_list = radio_get_devices( params->hRadio )))
-        return NULL;
-
-    hfind = malloc( sizeof( *hfind ) );
-    if (!hfind)
-    {
-        free( device_list );
-        SetLastError( ERROR_OUTOFMEMORY );
+        DWORD err = GetLastError();
+        BluetoothFindDeviceClose( hfind );
+        SetLastError( err );
         return NULL;
     }
 
-    hfind->params = *params;
-    hfind->device_list = device_list;
-    hfind->idx = 0;
     if (!BluetoothFindNextDevice( hfind, info ))
     {
-        free( hfind->device_list );
-        free( hfind );
+        BluetoothFindDeviceClose( hfind );
         SetLastError( ERROR_NO_MORE_ITEMS );
         return NULL;
     }
@@ -314,6 +669,7 @@ BOOL WINAPI BluetoothFindRadioClose( HBLUETOOTH_RADIO_FIND find_handle )
 BOOL WINAPI BluetoothFindDeviceClose( HBLUETOOTH_DEVICE_FIND find_handle )
 {
     struct bluetooth_find_device *find = find_handle;
+    SIZE_T i;
 
     TRACE( "(%p)\n", find_handle );
 
@@ -323,7 +679,17 @@ BOOL WINAPI BluetoothFindDeviceClose( HBLUETOOTH_DEVICE_FIND find_handle )
         return FALSE;
     }
 
-    free( find->device_list );
+    device_find_stop_inquiry( find );
+    for (i = 0; i < find->radios_count; i++)
+    {
+        if (find->radios[i].io && find->radios[i].io != INVALID_HANDLE_VALUE) CloseHandle( find->radios[i].io );
+        if (find->radios[i].ovl.hEvent) CloseHandle( find->radios[i].ovl.hEvent );
+        CloseHandle( find->radios[i].radio );
+        free( find->radios[i].changes );
+    }
+    free( find->radios );
+    free( find->returned );
+    free( find->devices );
     free( find );
     SetLastError( ERROR_SUCCESS );
     return TRUE;
@@ -642,20 +1008,27 @@ BOOL WINAPI BluetoothEnableDiscovery( HANDLE radio, BOOL enabled )
 /*********************************************************************
  *  BluetoothFindNextDevice
  */
-BOOL WINAPI BluetoothFindNextDevice( HBLUETOOTH_DEVICE_FIND find, BLUETOOTH_DEVICE_INFO *info )
+BOOL WINAPI BluetoothFindNextDevice( HBLUETOOTH_DEVICE_FIND find_handle, BLUETOOTH_DEVICE_INFO *info )
 {
+    struct bluetooth_find_device *find = find_handle;
     BOOL success;
 
-    TRACE( "(%p, %p)\n", find, info );
+    TRACE( "(%p, %p)\n", find_handle, info );
 
     /* This method doesn't perform any validation for info, for some reason. */
-    if (!find)
+    if (!find_handle)
     {
         SetLastError( ERROR_INVALID_HANDLE );
         return FALSE;
     }
 
-    success = device_find_next( find, info );
+    while (!(success = device_find_next( find, info )))
+    {
+        if (device_find_wait( find )) continue;
+        if (!find->deadline) break;
+        /* The inquiry timed out, but some devices may have been reported right before it did. */
+        device_find_stop_inquiry( find );
+    }
     if (!success)
         SetLastError( ERROR_NO_MORE_ITEMS );
     else
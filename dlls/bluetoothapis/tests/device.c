@@ -86,7 +86,7 @@ void test_radio_BluetoothFindFirstDevice( HANDLE radio, void *data )
     hfind = BluetoothFindFirstDevice( &search_params, &device_info );
     err = GetLastError();
     exp = hfind ? ERROR_SUCCESS : ERROR_NO_MORE_ITEMS;
-    todo_wine_if( !radio ) ok( err == exp, "%lu != %lu\n", err, exp );
+    ok( err == exp, "%lu != %lu\n", err, exp );
 
     if (hfind)
     {
@@ -95,6 +95,63 @@ void test_radio_BluetoothFindFirstDevice( HANDLE radio, void *data )
     }
 }
 
+/* An inquiry on every local radio, which returns each device it finds once, and gives up after the timeout. */
+static void test_BluetoothFindFirstDevice_inquiry( void )
+{
+    BLUETOOTH_DEVICE_SEARCH_PARAMS search_params = {0};
+    BLUETOOTH_ADDRESS seen[64];
+    BLUETOOTH_DEVICE_INFO info;
+    HBLUETOOTH_DEVICE_FIND hfind;
+    DWORD err, count = 0, i;
+    ULONGLONG start, elapsed;
+    BOOL success;
+
+    search_params.dwSize = sizeof( search_params );
+    search_params.fReturnUnknown = TRUE;
+    search_params.fReturnRemembered = TRUE;
+    search_params.fIssueInquiry = TRUE;
+    search_params.cTimeoutMultiplier = 1;
+    search_params.hRadio = NULL;
+    memset( &info, 0, sizeof( info ) );
+    info.dwSize = sizeof( info );
+
+    start = GetTickCount64();
+    SetLastError( 0xdeadbeef );
+    hfind = BluetoothFindFirstDevice( &search_params, &info );
+    err = GetLastError();
+    if (!hfind)
+    {
+        ok( err == ERROR_NO_MORE_ITEMS, "%lu != %d\n", err, ERROR_NO_MORE_ITEMS );
+        elapsed = GetTickCount64() - start;
+        ok( elapsed < 1280 + 2000, "BluetoothFindFirstDevice took %I64u ms\n", elapsed );
+        return;
+    }
+    ok( err == ERROR_SUCCESS, "%lu != %d\n", err, ERROR_SUCCESS );
+
+    do
+    {
+        trace( "device %lu: %s\n", count, debugstr_BLUETOOTH_DEVICE_INFO( &info ) );
+        for (i = 0; i < min( count, ARRAY_SIZE( seen ) ); i++)
+            ok( seen[i].ullLong != info.Address.ullLong, "device %s returned twice\n",
+                debugstr_bluetooth_address( info.Address.rgBytes ) );
+        if (count < ARRAY_SIZE( seen )) seen[count] = info.Address;
+        count++;
+
+        memset( &info, 0, sizeof( info ) );
+        info.dwSize = sizeof( info );
+        SetLastError( 0xdeadbeef );
+        success = BluetoothFindNextDevice( hfind, &info );
+        err = GetLastError();
+        ok( success || err == ERROR_NO_MORE_ITEMS, "BluetoothFindNextDevice failed: %lu\n", err );
+    } while (success);
+
+    elapsed = GetTickCount64() - start;
+    ok( elapsed < 1280 + 2000, "inquiry took %I64u ms\n", elapsed );
+
+    success = BluetoothFindDeviceClose( hfind );
+    ok( success, "BluetoothFindDeviceClose failed: %lu\n", GetLastError() );
+}
+
 void test_BluetoothFindFirstDevice( void )
 {
     BLUETOOTH_DEVICE_SEARCH_PARAMS search_params = {0};
@@ -121,6 +178,7 @@ void test_BluetoothFindFirstDevice( void )
     ok( err == ERROR_REVISION_MISMATCH, "%lu != %d\n", err, ERROR_REVISION_MISMATCH );
 
     test_for_all_radios( __FILE__, __LINE__, test_radio_BluetoothFindFirstDevice, NULL );
+    test_BluetoothFindFirstDevice_inquiry();
 }
 
 void test_radio_BluetoothFindNextDevice( HANDLE radio, void *data )
@@ -229,8 +229,149 @@ static void test_BluetoothGATTGetCharacteristic( void )
     test_for_all_le_devices( __LINE__, test_device_BluetoothGATTGetCharacteristics, NULL );
 }
 
+struct gatt_event_test
+{
+    const BLUETOOTH_GATT_VALUE_CHANGED_EVENT_REGISTRATION *registration;
+    LONG values;
+    LONG unregistered;
+};
+
+static void CALLBACK gatt_event_callback( BTH_LE_GATT_EVENT_TYPE type, void *param, void *context )
+{
+    BLUETOOTH_GATT_VALUE_CHANGED_EVENT *event = param;
+    struct gatt_event_test *test = context;
+    BOOL found = FALSE;
+    USHORT i;
+
+    ok( !ReadAcquire( &test->unregistered ), "got a callback after BluetoothGATTUnregisterEvent returned\n" );
+    ok( type == CharacteristicValueChangedEvent, "got type %d\n", type );
+    ok( !!event->CharacteristicValue, "got CharacteristicValue %p\n", event->CharacteristicValue );
+    if (event->CharacteristicValue)
+        ok( event->CharacteristicValueDataSize ==
+            offsetof( BTH_LE_GATT_CHARACTERISTIC_VALUE, Data[event->CharacteristicValue->DataSize] ),
+            "got CharacteristicValueDataSize %Iu, DataSize %lu\n", event->CharacteristicValueDataSize,
+            event->CharacteristicValue->DataSize );
+    for (i = 0; i < test->registration->NumCharacteristics; i++)
+        if (test->registration->Characteristics[i].CharacteristicValueHandle == event->ChangedAttributeHandle)
+            found = TRUE;
+    ok( found, "got unexpected ChangedAttributeHandle %#x\n", event->ChangedAttributeHandle );
+    InterlockedIncrement( &test->values );
+}
+
+static void test_device_BluetoothGATTRegisterEvent( HANDLE device, void *data )
+{
+    BLUETOOTH_GATT_VALUE_CHANGED_EVENT_REGISTRATION *registration;
+    struct gatt_event_test test = {0};
+    BTH_LE_GATT_CHARACTERISTIC *chars;
+    BLUETOOTH_GATT_EVENT_HANDLE handle;
+    BTH_LE_GATT_SERVICE *services;
+    USHORT services_count = 0, chars_count, i, j;
+    LONG values;
+    HRESULT ret;
+
+    ret = BluetoothGATTGetServices( device, 0, NULL, &services_count, 0 );
+    if (!services_count)
+    {
+        skip( "No services found.\n" );
+        return;
+    }
+    services = calloc( services_count, sizeof( *services ) );
+    ret = BluetoothGATTGetServices( device, services_count, services, &services_count, 0 );
+    ok( ret == S_OK, "BluetoothGATTGetServices failed: %#lx\n", ret );
+
+    registration = calloc( 1, offsetof( BLUETOOTH_GATT_VALUE_CHANGED_EVENT_REGISTRATION, Characteristics[64] ) );
+    chars = calloc( 64, sizeof( *chars ) );
+    for (i = 0; i < services_count; i++)
+    {
+        chars_count = 0;
+        ret = BluetoothGATTGetCharacteristics( device, &services[i], 64, chars, &chars_count, 0 );
+        if (FAILED( ret )) continue;
+        for (j = 0; j < chars_count && registration->NumCharacteristics < 64; j++)
+        {
+            if (chars[j].IsNotifiable || chars[j].IsIndicatable)
+                registration->Characteristics[registration->NumCharacteristics++] = chars[j];
+        }
+    }
+    free( chars );
+    free( services );
+
+    if (!registration->NumCharacteristics)
+    {
+        skip( "No notifiable characteristics found.\n" );
+        free( registration );
+        return;
+    }
+    test.registration = registration;
+
+    handle = (void *)0xdeadbeef;
+    ret = BluetoothGATTRegisterEvent( device, CharacteristicValueChangedEvent + 1, registration, gatt_event_callback,
+                                      &test, &handle, 0 );
+    ok( ret == E_INVALIDARG, "got ret %#lx\n", ret );
+    ok( handle == (void *)0xdeadbeef, "got handle %p\n", handle );
+
+    ret = BluetoothGATTRegisterEvent( device, CharacteristicValueChangedEvent, registration, gatt_event_callback,
+                                      &test, NULL, 0 );
+    ok( ret == E_POINTER, "got ret %#lx\n", ret );
+
+    ret = BluetoothGATTRegisterEvent( device, CharacteristicValueChangedEvent, registration, NULL, &test, &handle,
+                                      0 );
+    ok( ret == E_INVALIDARG, "got ret %#lx\n", ret );
+
+    ret = BluetoothGATTRegisterEvent( device, CharacteristicValueChangedEvent, registration, gatt_event_callback,
+                                      &test, &handle, 0 );
+    ok( ret == S_OK, "BluetoothGATTRegisterEvent failed: %#lx\n", ret );
+    if (SUCCEEDED( ret ))
+    {
+        Sleep( 500 );
+        ret = BluetoothGATTUnregisterEvent( handle, 0 );
+        ok( ret == S_OK, "BluetoothGATTUnregisterEvent failed: %#lx\n", ret );
+        WriteRelease( &test.unregistered, TRUE );
+        values = ReadAcquire( &test.values );
+        trace( "%ld values from %u characteristics\n", values, registration->NumCharacteristics );
+
+        /* Give any callback that would still be delivered the time to show up. */
+        Sleep( 200 );
+        ok( ReadAcquire( &test.values ) == values, "got %ld values after unregistering\n",
+            ReadAcquire( &test.values ) - values );
+    }
+    free( registration );
+}
+
+static void test_BluetoothGATTRegisterEvent( void )
+{
+    BLUETOOTH_GATT_VALUE_CHANGED_EVENT_REGISTRATION registration = {0};
+    struct gatt_event_test test = {0};
+    BLUETOOTH_GATT_EVENT_HANDLE handle;
+    HRESULT ret;
+
+    test.registration = &registration;
+
+    ret = BluetoothGATTRegisterEvent( NULL, CharacteristicValueChangedEvent, NULL, NULL, NULL, NULL, 0 );
+    ok( ret == E_POINTER, "got ret %#lx\n", ret );
+
+    ret = BluetoothGATTRegisterEvent( NULL, CharacteristicValueChangedEvent, NULL, gatt_event_callback, &test,
+                                      &handle, 0 );
+    ok( ret == E_INVALIDARG, "got ret %#lx\n", ret );
+
+    ret = BluetoothGATTRegisterEvent( NULL, CharacteristicValueChangedEvent, &registration, gatt_event_callback,
+                                      &test, &handle, 0 );
+    ok( ret == E_INVALIDARG, "got ret %#lx\n", ret );
+
+    registration.NumCharacteristics = 1;
+    registration.Characteristics[0].CharacteristicValueHandle = 0x2a;
+    ret = BluetoothGATTRegisterEvent( NULL, CharacteristicValueChangedEvent, &registration, gatt_event_callback,
+                                      &test, &handle, 0 );
+    ok( ret == E_HANDLE, "got ret %#lx\n", ret );
+
+    ret = BluetoothGATTUnregisterEvent( NULL, 0 );
+    ok( ret == E_INVALIDARG, "got ret %#lx\n", ret );
+
+    test_for_all_le_devices( __LINE__, test_device_BluetoothGATTRegisterEvent, NULL );
+}
+
 START_TEST( gatt )
 {
     test_BluetoothGATTGetServices();
     test_BluetoothGATTGetCharacteristic();
+    test_BluetoothGATTRegisterEvent();
 }
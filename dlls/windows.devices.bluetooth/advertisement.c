@@ -33,15 +33,17 @@
 #include <winreg.h>
 #include <winternl.h>
 #undef INITGUID
+#include <bthledef.h>
+#include <wine/winebth.h>
 
 #include "wine/debug.h"
 
-#define IOCTL_WINEBTH_RADIO_START_DISCOVERY CTL_CODE(FILE_DEVICE_BLUETOOTH, 0xa6, METHOD_BUFFERED, FILE_ANY_ACCESS)
-#define IOCTL_WINEBTH_RADIO_STOP_DISCOVERY  CTL_CODE(FILE_DEVICE_BLUETOOTH, 0xa7, METHOD_BUFFERED, FILE_ANY_ACCESS)
-
 #define SHADOW_HASH_BUCKETS 256
 #define SHADOW_TTL_MS       30000
 
+/* Size of the buffer for the advertisement records returned by IOCTL_WINEBTH_RADIO_READ_ADVERTISEMENTS. */
+#define ADV_RECORD_BUFFER_SIZE 0x8000
+
 WINE_DEFAULT_DEBUG_CHANNEL( bluetooth );
 
 static HRESULT ble_adv_create( IBluetoothLEAdvertisement **adv );
@@ -85,6 +87,7 @@ struct adv_watcher
 
     HANDLE radio;
     HANDLE event_thread;
+    HANDLE stop_event;
     volatile BOOL running;
 
     ITypedEventHandler_BluetoothLEAdvertisementWatcher_BluetoothLEAdvertisementReceivedEventArgs *received_handler;
@@ -95,6 +98,7 @@ struct adv_watcher
     EventRegistrationToken stopped_token;
 
     IBluetoothLEAdvertisementFilter *filter;
+    IBluetoothSignalStrengthFilter *signal_filter;
 
     struct shadow_table shadow;
 
@@ -642,63 +646,6 @@ static inline struct adv_watcher *impl_from_IBluetoothLEAdvertisementWatcher2( I
     return CONTAINING_RECORD( iface, struct adv_watcher, IBluetoothLEAdvertisementWatcher2_iface );
 }
 
-static const GUID my_GUID_BTHPORT_DEVICE_INTERFACE = { 0x850302a, 0xb344, 0x4fda, { 0x9b, 0xe9, 0x90, 0x57, 0x6b, 0x8d, 0x46, 0xf0 } };
-
-static HANDLE open_first_radio( void )
-{
-    char buffer[sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA_W) + MAX_PATH * sizeof( WCHAR )];
-    SP_DEVICE_INTERFACE_DETAIL_DATA_W *iface_detail = (SP_DEVICE_INTERFACE_DETAIL_DATA_W *)buffer;
-    SP_DEVICE_INTERFACE_DATA iface_data;
-    HDEVINFO devinfo;
-    HANDLE radio = INVALID_HANDLE_VALUE;
-    DWORD idx = 0;
-
-    TRACE( " open_first_radio CALLED ===\n" );
-
-    devinfo = SetupDiGetClassDevsW( &my_GUID_BTHPORT_DEVICE_INTERFACE, NULL, NULL,
-                                    DIGCF_PRESENT | DIGCF_DEVICEINTERFACE );
-    if (devinfo == INVALID_HANDLE_VALUE)
-    {
-        WARN( "SetupDiGetClassDevsW failed: %lu\n", GetLastError() );
-    }
-    else
-    {
-        iface_detail->cbSize = sizeof( *iface_detail );
-        iface_data.cbSize = sizeof( iface_data );
-
-        while (SetupDiEnumDeviceInterfaces( devinfo, NULL, &my_GUID_BTHPORT_DEVICE_INTERFACE, idx++, &iface_data ))
-        {
-            if (!SetupDiGetDeviceInterfaceDetailW( devinfo, &iface_data, iface_detail, sizeof( buffer ), NULL, NULL ))
-                continue;
-            radio = CreateFileW( iface_detail->DevicePath, GENERIC_READ | GENERIC_WRITE,
-                                 FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL );
-            if (radio != INVALID_HANDLE_VALUE)
-            {
-                TRACE( "Opened radio device: %s\n", debugstr_w( iface_detail->DevicePath ) );
-                break;
-            }
-        }
-        SetupDiDestroyDeviceInfoList( devinfo );
-    }
-
-    if (radio == INVALID_HANDLE_VALUE)
-    {
-        WCHAR direct_path[64];
-        int i;
-        for (i = 0; i < 4 && radio == INVALID_HANDLE_VALUE; i++)
-        {
-            swprintf( direct_path, ARRAY_SIZE( direct_path ), L"\\\\?\\GLOBALROOT\\Device\\WINEBTH-RADIO-%d", i );
-            radio = CreateFileW( direct_path, GENERIC_READ | GENERIC_WRITE,
-                                 FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL );
-            if (radio != INVALID_HANDLE_VALUE)
-                TRACE( "Opened radio via direct path: %s\n", debugstr_w( direct_path ) );
-        }
-    }
-
-    TRACE( "open_first_radio returning radio=%p\n", radio );
-    return radio;
-}
-
 static const GUID GUID_BLUETOOTHLE_DEVICE_INTERFACE = { 0x781aee18, 0x7733, 0x4ce4, { 0xad, 0xd0, 0x91, 0xf4, 0x1c, 0x67, 0xb5, 0x92 } };
 
 struct device_name_cache_entry
@@ -938,147 +885,136 @@ static BOOL get_cached_device_name( UINT64 address, WCHAR *out, DWORD out_len )
     return FALSE;
 }
 
+/* Records the device in the shadow table and queues a Received event for it. */
+static void adv_watcher_handle_record( struct adv_watcher *watcher, const struct winebth_advertisement_record *record,
+                                       ULONGLONG now )
+{
+    const BTH_DEVICE_INFO *info = &record->info;
+    struct shadow_entry *entry;
+    WCHAR device_name[256];
+    UINT64 addr_proper;
+
+    if (!info->address) return;
+
+    /* Convert address: driver uses LSB-first, WinRT expects MSB-first */
+    addr_proper = RtlUlonglongByteSwap( info->address ) >> 16;
+
+    entry = shadow_get_or_create( &watcher->shadow, info->address );
+    if (!entry) return;
+
+    device_name[0] = 0;
+    if (info->flags & BDIF_NAME && info->name[0])
+        MultiByteToWideChar( CP_UTF8, 0, info->name, -1, device_name, ARRAY_SIZE( device_name ) );
+
+    /* Skip generic "BLE Device" names */
+    if (device_name[0] && !wcscmp( device_name, L"BLE Device" ))
+        device_name[0] = 0;
+
+    /* Keep the last name we got, since the name may only be in scan responses. */
+    if (device_name[0] && wcscmp( device_name, entry->name ))
+    {
+        lstrcpynW( entry->name, device_name, ARRAY_SIZE( entry->name ) );
+        cache_device_name( info->address, entry->name );
+    }
+    if (info->flags & WINEBTH_ADVERTISEMENT_RSSI)
+        entry->rssi = record->rssi;
+    entry->last_seen = now;
+
+    TRACE( "advertisement: addr=0x%I64x name=%s rssi=%d\n", addr_proper, debugstr_w( entry->name ), entry->rssi );
+    enqueue_pending_event( watcher, addr_proper, entry->rssi, entry->name[0] ? entry->name : NULL );
+}
+
 static DWORD WINAPI adv_watcher_event_thread( void *param )
 {
+    const SIZE_T params_size = offsetof( struct winebth_radio_read_advertisements_params, data[ADV_RECORD_BUFFER_SIZE] );
+    struct winebth_radio_read_advertisements_params *params;
     struct adv_watcher *watcher = param;
-    BTH_DEVICE_INFO_LIST *list;
-    BYTE *buffer = NULL;
-    SIZE_T buffer_size;
+    ULONG last_overflow_count = 0;
+    HANDLE io_handle, wait_handles[2];
     DWORD bytes_returned;
-    DWORD i;
+    OVERLAPPED ovl;
 
     CoInitializeEx( NULL, COINIT_MULTITHREADED );
     init_device_name_cache();
 
-    TRACE( " Event thread STARTED for watcher %p (COM initialized) ===\n", watcher );
+    TRACE( "Event thread started for watcher %p\n", watcher );
 
-    while (watcher->running)
+    if (!(params = malloc( params_size )))
     {
-        ULONGLONG now = GetTickCount64();
-        DWORD device_count = 0;
-
-        shadow_prune( &watcher->shadow, now );
-
-        /* Query driver directly for all known BLE devices via IOCTL.
-         * This is MUCH faster than waiting for PnP enumeration via SetupDi.
-         * The driver knows about devices as soon as CoreBluetooth discovers them. */
-        if (watcher->radio == INVALID_HANDLE_VALUE)
-            goto sleep_and_continue;
+        CoUninitialize();
+        return 1;
+    }
 
-        /* First call to get device count */
-        buffer_size = sizeof(BTH_DEVICE_INFO_LIST);
-        buffer = malloc( buffer_size );
-        if (!buffer) goto sleep_and_continue;
-        memset( buffer, 0, buffer_size );
-        list = (BTH_DEVICE_INFO_LIST *)buffer;
+    /* The driver streams the devices it sees or updates while discovering, and keeps READ_ADVERTISEMENTS requests
+     * pending until there is one, so issue them overlapped and wait for either the completion or the stop event.
+     * If the radio handle can't be reopened for overlapped I/O, DeviceIoControl blocks on it instead, and
+     * adv_watcher_Stop cancels it with CancelIoEx. */
+    io_handle = ReOpenFile( watcher->radio, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                            FILE_FLAG_OVERLAPPED );
+    if (io_handle == INVALID_HANDLE_VALUE)
+    {
+        WARN( "Failed to reopen radio handle for overlapped I/O: %lu\n", GetLastError() );
+        io_handle = watcher->radio;
+    }
+    memset( &ovl, 0, sizeof(ovl) );
+    ovl.hEvent = CreateEventW( NULL, TRUE, FALSE, NULL );
+    wait_handles[0] = ovl.hEvent;
+    wait_handles[1] = watcher->stop_event;
 
-        if (!DeviceIoControl( watcher->radio, IOCTL_BTH_GET_DEVICE_INFO, NULL, 0,
-                              list, buffer_size, &bytes_returned, NULL ))
+    while (watcher->running && ovl.hEvent)
+    {
+        const UCHAR *record_ptr, *end;
+        ULONGLONG now;
+        BOOL ret;
+
+        bytes_returned = 0;
+        ret = DeviceIoControl( io_handle, IOCTL_WINEBTH_RADIO_READ_ADVERTISEMENTS, NULL, 0, params, params_size,
+                               &bytes_returned, &ovl );
+        if (!ret && GetLastError() == ERROR_IO_PENDING)
         {
-            free( buffer );
-            buffer = NULL;
-            goto sleep_and_continue;
+            if (WaitForMultipleObjects( 2, wait_handles, FALSE, INFINITE ) != WAIT_OBJECT_0)
+            {
+                CancelIoEx( io_handle, &ovl );
+                GetOverlappedResult( io_handle, &ovl, &bytes_returned, TRUE );
+                break;
+            }
+            ret = GetOverlappedResult( io_handle, &ovl, &bytes_returned, FALSE );
         }
-
-        device_count = list->numOfDevices;
-        if (device_count == 0)
+        if (!ret)
         {
-            free( buffer );
-            buffer = NULL;
-            goto sleep_and_continue;
+            /* Discovery was stopped from elsewhere, or the radio is going away. Back off until we get stopped. */
+            TRACE( "IOCTL_WINEBTH_RADIO_READ_ADVERTISEMENTS failed: %lu\n", GetLastError() );
+            if (WaitForSingleObject( watcher->stop_event, 100 ) != WAIT_TIMEOUT) break;
+            continue;
         }
 
-        /* Reallocate for full device list */
-        free( buffer );
-        if (device_count == 1)
-            buffer_size = sizeof(BTH_DEVICE_INFO_LIST);
-        else
-            buffer_size = sizeof(BTH_DEVICE_INFO_LIST) + sizeof(BTH_DEVICE_INFO) * (device_count - 1);
-
-        buffer = malloc( buffer_size );
-        if (!buffer) goto sleep_and_continue;
-        memset( buffer, 0, buffer_size );
-        list = (BTH_DEVICE_INFO_LIST *)buffer;
-        list->numOfDevices = device_count;
-
-        if (!DeviceIoControl( watcher->radio, IOCTL_BTH_GET_DEVICE_INFO, NULL, 0,
-                              list, buffer_size, &bytes_returned, NULL ))
+        if (params->overflow_count != last_overflow_count)
         {
-            free( buffer );
-            buffer = NULL;
-            goto sleep_and_continue;
+            WARN( "Advertisement queue overflowed, %lu records dropped\n", params->overflow_count - last_overflow_count );
+            last_overflow_count = params->overflow_count;
         }
 
-        /* Iterate over ALL devices from the driver - no PnP dependency */
-        for (i = 0; i < device_count && watcher->running; i++)
-        {
-            BTH_DEVICE_INFO *info = &list->deviceList[i];
-            UINT64 addr = info->address;
-            WCHAR device_name[256];
-            struct shadow_entry *entry;
-            BOOL should_notify = FALSE;
-            UINT64 addr_proper;
-
-            if (!addr) continue;
-
-            /* Convert address: driver uses LSB-first, WinRT expects MSB-first */
-            addr_proper = RtlUlonglongByteSwap(addr) >> 16;
-
-            entry = shadow_get_or_create( &watcher->shadow, addr );
-            if (!entry) continue;
-
-            /* Get device name from driver info */
-            device_name[0] = 0;
-            if (info->flags & BDIF_NAME && info->name[0])
-            {
-                MultiByteToWideChar( CP_UTF8, 0, info->name, -1, device_name, ARRAY_SIZE( device_name ) );
-            }
-
-            /* Skip generic "BLE Device" names */
-            if (device_name[0] && !wcscmp( device_name, L"BLE Device" ))
-                device_name[0] = 0;
-
-            /* Check if this is a new device or name changed */
-            if (entry->last_seen == 0)
-            {
-                /* First time seeing this device */
-                if (device_name[0])
-                {
-                    lstrcpynW( entry->name, device_name, ARRAY_SIZE( entry->name ) );
-                    cache_device_name( addr, entry->name );
-                }
-                should_notify = TRUE;
-            }
-            else if (device_name[0] && wcscmp( device_name, entry->name ))
-            {
-                /* Name changed (e.g., scan response arrived with LocalName) */
-                lstrcpynW( entry->name, device_name, ARRAY_SIZE( entry->name ) );
-                cache_device_name( addr, entry->name );
-                should_notify = TRUE;
-            }
+        now = GetTickCount64();
+        shadow_prune( &watcher->shadow, now );
 
-            entry->last_seen = now;
+        record_ptr = params->data;
+        end = params->data + min( params->data_size, ADV_RECORD_BUFFER_SIZE );
+        while (end - record_ptr >= sizeof(struct winebth_advertisement_record))
+        {
+            const struct winebth_advertisement_record *record = (const void *)record_ptr;
+            SIZE_T size = sizeof(*record) + record->manufacturer_data_size + record->service_data_size;
 
-            if (should_notify)
-            {
-                TRACE( " IOCTL advertisement: addr=0x%I64x name='%s' ===\n",
-                       addr_proper, debugstr_w( entry->name ) );
-                enqueue_pending_event( watcher, addr_proper, entry->rssi,
-                                       entry->name[0] ? entry->name : NULL );
-            }
+            if (size > end - record_ptr) break;
+            adv_watcher_handle_record( watcher, record, now );
+            record_ptr += size;
         }
 
-        free( buffer );
-        buffer = NULL;
-
-sleep_and_continue:
-        if (watcher->running)
-            process_pending_events( watcher );
-        if (watcher->running)
-            Sleep( 100 );
+        process_pending_events( watcher );
     }
 
-    if (buffer) free( buffer );
+    if (ovl.hEvent) CloseHandle( ovl.hEvent );
+    if (io_handle != watcher->radio) CloseHandle( io_handle );
+    free( params );
     TRACE( "Event thread exiting for watcher %p\n", watcher );
     CoUninitialize();
     return 0;
@@ -1129,6 +1065,7 @@ static ULONG WINAPI adv_watcher_Release( IBluetoothLEAdvertisementWatcher *iface
         if (impl->running)
         {
             impl->running = FALSE;
+            SetEvent( impl->stop_event );
             impl->event_head = NULL;
             impl->event_tail = NULL;
             was_running = TRUE;
@@ -1153,6 +1090,10 @@ static ULONG WINAPI adv_watcher_Release( IBluetoothLEAdvertisementWatcher *iface
                 impl->stopped_handler );
         if (impl->filter)
             IBluetoothLEAdvertisementFilter_Release( impl->filter );
+        if (impl->signal_filter)
+            IBluetoothSignalStrengthFilter_Release( impl->signal_filter );
+        if (impl->stop_event)
+            CloseHandle( impl->stop_event );
         while (impl->event_head)
         {
             struct pending_event *next = impl->event_head->next;
@@ -1270,17 +1211,30 @@ static HRESULT WINAPI adv_watcher_put_ScanningMode( IBluetoothLEAdvertisementWat
 static HRESULT WINAPI adv_watcher_get_SignalStrengthFilter( IBluetoothLEAdvertisementWatcher *iface,
                                                             IBluetoothSignalStrengthFilter **filter )
 {
-    TRACE( " get_SignalStrengthFilter CALLED === iface=%p filter=%p\n", iface, filter );
+    struct adv_watcher *impl = impl_from_IBluetoothLEAdvertisementWatcher( iface );
+
     TRACE( "(%p, %p)\n", iface, filter );
     if (!filter) return E_POINTER;
-    *filter = NULL;
+
+    EnterCriticalSection( &impl->cs );
+    *filter = impl->signal_filter;
+    if (*filter) IBluetoothSignalStrengthFilter_AddRef( *filter );
+    LeaveCriticalSection( &impl->cs );
     return S_OK;
 }
 
 static HRESULT WINAPI adv_watcher_put_SignalStrengthFilter( IBluetoothLEAdvertisementWatcher *iface,
                                                             IBluetoothSignalStrengthFilter *filter )
 {
+    struct adv_watcher *impl = impl_from_IBluetoothLEAdvertisementWatcher( iface );
+
     TRACE( "(%p, %p)\n", iface, filter );
+
+    EnterCriticalSection( &impl->cs );
+    if (impl->signal_filter) IBluetoothSignalStrengthFilter_Release( impl->signal_filter );
+    impl->signal_filter = filter;
+    if (filter) IBluetoothSignalStrengthFilter_AddRef( filter );
+    LeaveCriticalSection( &impl->cs );
     return S_OK;
 }
 
@@ -1317,6 +1271,63 @@ static HRESULT WINAPI adv_watcher_put_AdvertisementFilter( IBluetoothLEAdvertise
     return S_OK;
 }
 
+/* Pushes the service UUIDs of the advertisement filter and the in-range threshold of the signal strength filter down
+ * to the driver, so that the devices they exclude never get reported to us. The local name is still matched in
+ * process_pending_events. Caller should hold the watcher's cs. */
+static void adv_watcher_push_filter( struct adv_watcher *watcher )
+{
+    struct winebth_radio_set_discovery_filter_params params = {0};
+    IBluetoothLEAdvertisement *adv = NULL;
+    IReference_INT16 *threshold = NULL;
+    IVector_GUID *uuids = NULL;
+    INT16 rssi;
+    DWORD bytes;
+
+    params.transport = WINEBTH_DISCOVERY_TRANSPORT_LE;
+    params.flags = WINEBTH_DISCOVERY_FILTER_DUPLICATE_DATA;
+
+    if (watcher->signal_filter &&
+        SUCCEEDED( IBluetoothSignalStrengthFilter_get_InRangeThresholdInDBm( watcher->signal_filter, &threshold ) ) &&
+        threshold)
+    {
+        if (SUCCEEDED( IReference_INT16_get_Value( threshold, &rssi ) ))
+        {
+            params.rssi = rssi;
+            params.flags |= WINEBTH_DISCOVERY_FILTER_RSSI;
+        }
+        IReference_INT16_Release( threshold );
+    }
+
+    if (watcher->filter && SUCCEEDED( IBluetoothLEAdvertisementFilter_get_Advertisement( watcher->filter, &adv ) ) &&
+        adv)
+    {
+        if (SUCCEEDED( IBluetoothLEAdvertisement_get_ServiceUuids( adv, &uuids ) ) && uuids)
+        {
+            UINT32 count = 0, i;
+
+            /* Only push complete lists down, a partial one would hide devices the filter accepts. */
+            if (SUCCEEDED( IVector_GUID_get_Size( uuids, &count ) ) && count <= ARRAY_SIZE( params.uuids ))
+            {
+                for (i = 0; i < count; i++)
+                {
+                    GUID uuid;
+
+                    if (FAILED( IVector_GUID_GetAt( uuids, i, &uuid ) )) break;
+                    params.uuids[i] = uuid;
+                }
+                if (i == count) params.uuids_count = count;
+            }
+            IVector_GUID_Release( uuids );
+        }
+        IBluetoothLEAdvertisement_Release( adv );
+    }
+
+    TRACE( "flags %#lx, rssi %d, %lu UUIDs\n", params.flags, params.rssi, params.uuids_count );
+    if (!DeviceIoControl( watcher->radio, IOCTL_WINEBTH_RADIO_SET_DISCOVERY_FILTER, &params, sizeof(params), NULL, 0,
+                          &bytes, NULL ))
+        WARN( "IOCTL_WINEBTH_RADIO_SET_DISCOVERY_FILTER failed: %lu\n", GetLastError() );
+}
+
 static HRESULT WINAPI adv_watcher_Start( IBluetoothLEAdvertisementWatcher *iface )
 {
     struct adv_watcher *impl = impl_from_IBluetoothLEAdvertisementWatcher( iface );
@@ -1345,6 +1356,7 @@ static HRESULT WINAPI adv_watcher_Start( IBluetoothLEAdvertisementWatcher *iface
         }
     }
 
+    adv_watcher_push_filter( impl );
     if (!DeviceIoControl( impl->radio, IOCTL_WINEBTH_RADIO_START_DISCOVERY, NULL, 0, NULL, 0, &bytes, NULL ))
     {
         DWORD err = GetLastError();
@@ -1355,6 +1367,7 @@ static HRESULT WINAPI adv_watcher_Start( IBluetoothLEAdvertisementWatcher *iface
     }
 
     impl->running = TRUE;
+    ResetEvent( impl->stop_event );
     impl->event_thread = CreateThread( NULL, 0, adv_watcher_event_thread, impl, 0, NULL );
     if (!impl->event_thread)
     {
@@ -1390,6 +1403,9 @@ static HRESULT WINAPI adv_watcher_Stop( IBluetoothLEAdvertisementWatcher *iface
     }
 
     impl->running = FALSE;
+    SetEvent( impl->stop_event );
+    /* In case the event thread is blocked on the radio handle itself. */
+    CancelIoEx( impl->radio, NULL );
     LeaveCriticalSection( &impl->cs );
 
     if (impl->event_thread)
@@ -1638,6 +1654,11 @@ static HRESULT adv_watcher_create( IBluetoothLEAdvertisementWatcher **watcher )
     impl->status = BluetoothLEAdvertisementWatcherStatus_Created;
     impl->scanning_mode = BluetoothLEScanningMode_Passive;
     impl->allow_extended_advertisements = FALSE;
+    if (!(impl->stop_event = CreateEventW( NULL, TRUE, FALSE, NULL )))
+    {
+        free( impl );
+        return HRESULT_FROM_WIN32( GetLastError() );
+    }
     InitializeCriticalSectionEx( &impl->cs, 0, RTL_CRITICAL_SECTION_FLAG_FORCE_DEBUG_INFO );
     impl->cs.DebugInfo->Spare[0] = (DWORD_PTR)(__FILE__ ": adv_watcher.cs");
 
@@ -18,6 +18,7 @@
  */
 
 #include "private.h"
+#include "objpool.h"
 #include <stdio.h>
 
 #include <assert.h>
@@ -69,51 +70,6 @@ DEFINE_GUID(IID___x_ABI_CWindows_CStorage_CStreams_CIBufferByteAccess, 0x905a0fe
 
 WINE_DEFAULT_DEBUG_CHANNEL( bluetooth );
 
-static const GUID my_GUID_BTHPORT_DEVICE_INTERFACE = { 0x850302a, 0xb344, 0x4fda, { 0x9b, 0xe9, 0x90, 0x57, 0x6b, 0x8d, 0x46, 0xf0 } };
-
-static HANDLE open_first_radio( void )
-{
-    char buffer[sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA_W) + MAX_PATH * sizeof( WCHAR )];
-    SP_DEVICE_INTERFACE_DETAIL_DATA_W *iface_detail = (SP_DEVICE_INTERFACE_DETAIL_DATA_W *)buffer;
-    SP_DEVICE_INTERFACE_DATA iface_data;
-    HDEVINFO devinfo;
-    HANDLE radio = INVALID_HANDLE_VALUE;
-    DWORD idx = 0;
-
-    devinfo = SetupDiGetClassDevsW( &my_GUID_BTHPORT_DEVICE_INTERFACE, NULL, NULL,
-                                    DIGCF_PRESENT | DIGCF_DEVICEINTERFACE );
-    if (devinfo != INVALID_HANDLE_VALUE)
-    {
-        iface_detail->cbSize = sizeof( *iface_detail );
-        iface_data.cbSize = sizeof( iface_data );
-
-        while (SetupDiEnumDeviceInterfaces( devinfo, NULL, &my_GUID_BTHPORT_DEVICE_INTERFACE, idx++, &iface_data ))
-        {
-            if (!SetupDiGetDeviceInterfaceDetailW( devinfo, &iface_data, iface_detail, sizeof( buffer ), NULL, NULL ))
-                continue;
-            radio = CreateFileW( iface_detail->DevicePath, GENERIC_READ | GENERIC_WRITE,
-                                 FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL );
-            if (radio != INVALID_HANDLE_VALUE)
-                break;
-        }
-        SetupDiDestroyDeviceInfoList( devinfo );
-    }
-
-    if (radio == INVALID_HANDLE_VALUE)
-    {
-        WCHAR direct_path[64];
-        int i;
-        for (i = 0; i < 4 && radio == INVALID_HANDLE_VALUE; i++)
-        {
-            swprintf( direct_path, ARRAY_SIZE( direct_path ), L"\\\\?\\GLOBALROOT\\Device\\WINEBTH-RADIO-%d", i );
-            radio = CreateFileW( direct_path, GENERIC_READ | GENERIC_WRITE,
-                                 FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL );
-        }
-    }
-    return radio;
-}
-
-
 struct handler_entry
 {
     struct list entry;
@@ -145,6 +101,29 @@ typedef enum __x_ABI_CWindows_CDevices_CBluetooth_CGenericAttributeProfile_CGatt
 static const GUID btle_device_interface_guid = { 0x781aee18, 0x7733, 0x4ce4, { 0xad, 0xd0, 0x91, 0xf4, 0x1c, 0x67, 0xb5, 0x92 } };
 static const GUID btle_att_base_guid = { 0, 0, 0x1000, { 0x80, 0x00, 0x00, 0x80, 0x5f, 0x9b, 0x34, 0xfb } };
 
+/* The output buffer of a READ_NOTIFICATIONS request. Values are handed out as buffers pointing into it, so it can only
+ * be reused for the next request once all of them have been released. */
+struct gatt_notify_batch
+{
+    LONG ref;
+    BYTE params[];
+};
+
+static struct gatt_notify_batch *gatt_notify_batch_create( ULONG size )
+{
+    struct gatt_notify_batch *batch;
+
+    if (!(batch = object_pool_alloc( offsetof( struct gatt_notify_batch, params[size] ) ))) return NULL;
+    batch->ref = 1;
+    memset( batch->params, 0, size );
+    return batch;
+}
+
+static void gatt_notify_batch_release( struct gatt_notify_batch *batch )
+{
+    if (!InterlockedDecrement( &batch->ref )) object_pool_free( batch );
+}
+
 /* Internal IBuffer implementation for GATT data */
 struct gatt_buffer
 {
@@ -153,7 +132,9 @@ struct gatt_buffer
     LONG ref;
     UINT32 capacity;
     UINT32 length;
-    BYTE data[];
+    BYTE *data;                        /* Either inline_data, or points into batch */
+    struct gatt_notify_batch *batch;
+    BYTE inline_data[];
 };
 
 static inline struct gatt_buffer *impl_from_IBuffer( IBuffer *iface )
@@ -191,7 +172,11 @@ static ULONG WINAPI gatt_buffer_Release( IBuffer *iface )
 {
     struct gatt_buffer *impl = impl_from_IBuffer( iface );
     ULONG ref = InterlockedDecrement( &impl->ref );
-    if (!ref) free( impl );
+    if (!ref)
+    {
+        if (impl->batch) gatt_notify_batch_release( impl->batch );
+        object_pool_free( impl );
+    }
     return ref;
 }
 
@@ -295,18 +280,38 @@ static const IBufferByteAccessVtbl gatt_buffer_byte_access_vtbl =
 static HRESULT gatt_buffer_create( const BYTE *data, UINT32 size, IBuffer **out )
 {
     struct gatt_buffer *impl;
-    if (!(impl = malloc( offsetof( struct gatt_buffer, data[size] ) ))) return E_OUTOFMEMORY;
+    if (!(impl = object_pool_alloc( offsetof( struct gatt_buffer, inline_data[size] ) ))) return E_OUTOFMEMORY;
     impl->IBuffer_iface.lpVtbl = &gatt_buffer_vtbl;
     impl->IBufferByteAccess_iface.lpVtbl = &gatt_buffer_byte_access_vtbl;
     impl->ref = 1;
     impl->capacity = size;
     impl->length = size;
+    impl->data = impl->inline_data;
+    impl->batch = NULL;
     if (data && size > 0)
         memcpy( impl->data, data, size );
     *out = &impl->IBuffer_iface;
     return S_OK;
 }
 
+/* Wraps a value in a notification batch without copying it. Each value gets its own range of the batch, so writes
+ * through IBufferByteAccess don't show up in the other ones. */
+static HRESULT gatt_buffer_create_from_batch( struct gatt_notify_batch *batch, BYTE *data, UINT32 size, IBuffer **out )
+{
+    struct gatt_buffer *impl;
+    if (!(impl = object_pool_alloc( sizeof(*impl) ))) return E_OUTOFMEMORY;
+    impl->IBuffer_iface.lpVtbl = &gatt_buffer_vtbl;
+    impl->IBufferByteAccess_iface.lpVtbl = &gatt_buffer_byte_access_vtbl;
+    impl->ref = 1;
+    impl->capacity = size;
+    impl->length = size;
+    impl->data = data;
+    impl->batch = batch;
+    InterlockedIncrement( &batch->ref );
+    *out = &impl->IBuffer_iface;
+    return S_OK;
+}
+
 struct bluetoothdevice_statics
 {
     IActivationFactory IActivationFactory_iface;
@@ -416,7 +421,8 @@ DEFINE_IINSPECTABLE( bluetoothdevice_statics, IBluetoothDeviceStatics, struct bl
 
 static HRESULT bluetooth_device_create( HSTRING id, UINT64 address, IBluetoothDevice **out );
 static HRESULT async_bt_device_op_create( IBluetoothDevice *device, IAsyncOperation_BluetoothDevice **out );
-static HRESULT gatt_services_vector_create( BTH_LE_GATT_SERVICE *services, ULONG count, HANDLE device_handle, BOOL is_radio_handle, const WCHAR *device_id, UINT64 device_address, IVectorView_GattDeviceService **out );
+struct gatt_database_snapshot;
+static HRESULT gatt_services_vector_create( BTH_LE_GATT_SERVICE *services, ULONG count, HANDLE device_handle, BOOL is_radio_handle, const WCHAR *device_id, UINT64 device_address, struct gatt_database_snapshot *snapshot, IVectorView_GattDeviceService **out );
 
 static BOOL get_device_name_from_id( const WCHAR *device_id, UINT64 address, WCHAR *name, DWORD name_len )
 {
@@ -1330,11 +1336,13 @@ struct bluetooth_le_device
     struct list name_changed_handlers;
     struct list connection_status_changed_handlers;
     struct list gatt_services_changed_handlers;
-    HANDLE connection_monitor_thread;
-    BOOL connection_monitor_running;
+    struct list connection_watch_entry;  /* Entry in connection_watch_devices. Guarded by connection_watch_cs */
+    BOOL connection_watched;
     BluetoothConnectionStatus last_connection_status;
 };
 
+static void connection_watch_remove( struct bluetooth_le_device *impl );
+
 static inline struct bluetooth_le_device *impl_from_IBluetoothLEDevice( IBluetoothLEDevice *iface )
 {
     return CONTAINING_RECORD( iface, struct bluetooth_le_device, IBluetoothLEDevice_iface );
@@ -1389,12 +1397,7 @@ static ULONG WINAPI le_device_Release( IBluetoothLEDevice *iface )
     {
         struct handler_entry *entry, *next;
 
-        if (impl->connection_monitor_thread)
-        {
-            impl->connection_monitor_running = FALSE;
-            WaitForSingleObject( impl->connection_monitor_thread, 1000 );
-            CloseHandle( impl->connection_monitor_thread );
-        }
+        connection_watch_remove( impl );
 
         if (impl->id) WindowsDeleteString( impl->id );
         if (impl->device_handle != INVALID_HANDLE_VALUE)
@@ -1509,7 +1512,7 @@ static HRESULT WINAPI le_device_get_GattServices( IBluetoothLEDevice *iface, IVe
             ERR( "Found %lu GATT services, creating vector for synchronous property\n", params->count );
             hr = gatt_services_vector_create( params->services, params->count,
                                                impl->device_handle, FALSE, WindowsGetStringRawBuffer( impl->id, NULL ),
-                                               impl->address, value );
+                                               impl->address, NULL, value );
         }
         else
         {
@@ -1737,75 +1740,206 @@ static HRESULT WINAPI le_device_remove_GattServicesChanged( IBluetoothLEDevice *
     return S_OK;
 }
 
-static DWORD WINAPI connection_status_monitor_thread( void *arg )
+/* ConnectionStatusChanged is served by a single thread for every device in the process. It keeps an
+ * IOCTL_WINEBTH_RADIO_WAIT_CONNECTION_CHANGES request pending on the first radio, which the driver completes when a
+ * remote device connects or disconnects, and invokes the handlers of the devices that were reported. */
+static CRITICAL_SECTION connection_watch_cs;
+static CRITICAL_SECTION_DEBUG connection_watch_cs_debug =
 {
-    struct bluetooth_le_device *impl = arg;
-    BluetoothConnectionStatus current_status;
-    struct handler_entry *entry;
+    0, 0, &connection_watch_cs,
+    { &connection_watch_cs_debug.ProcessLocksList, &connection_watch_cs_debug.ProcessLocksList },
+      0, 0, { (DWORD_PTR)(__FILE__ ": connection_watch_cs") }
+};
+static CRITICAL_SECTION connection_watch_cs = { &connection_watch_cs_debug, -1, 0, 0, 0, 0 };
+
+static struct list connection_watch_devices = LIST_INIT( connection_watch_devices );
+static HANDLE connection_watch_thread;
+/* Set when the last device stops being watched, to make the thread check whether it should exit. */
+static HANDLE connection_watch_stop_event;
+
+#define CONNECTION_WATCH_MAX_CHANGES 64
+
+/* Takes a reference on a watched device, unless its last one is already being released, in which case it is about
+ * to remove itself from connection_watch_devices. Caller should hold connection_watch_cs. */
+static BOOL le_device_try_addref( struct bluetooth_le_device *impl )
+{
+    LONG ref = ReadNoFence( &impl->ref ), prev;
+
+    while (ref)
+    {
+        if ((prev = InterlockedCompareExchange( &impl->ref, ref + 1, ref )) == ref) return TRUE;
+        ref = prev;
+    }
+    return FALSE;
+}
+
+static void connection_watch_dispatch( const struct winebth_radio_wait_connection_changes_params *params )
+{
+    struct connection_watch_target
+    {
+        struct bluetooth_le_device *device;
+        const struct winebth_connection_change *change; /* NULL if the connection state has to be queried. */
+    } *targets;
+    struct bluetooth_le_device *impl;
+    SIZE_T count = 0, i;
+    ULONG j;
+
+    EnterCriticalSection( &connection_watch_cs );
+    if (!(targets = malloc( list_count( &connection_watch_devices ) * sizeof( *targets ) )))
+    {
+        LeaveCriticalSection( &connection_watch_cs );
+        return;
+    }
+    LIST_FOR_EACH_ENTRY( impl, &connection_watch_devices, struct bluetooth_le_device, connection_watch_entry )
+    {
+        const struct winebth_connection_change *change = NULL;
+
+        for (j = 0; j < params->count && !change; j++)
+            if (params->changes[j].address == impl->address) change = &params->changes[j];
+        if (!change && !(params->flags & WINEBTH_CONNECTION_CHANGES_OVERFLOW)) continue;
+        if (!le_device_try_addref( impl )) continue;
+        targets[count].device = impl;
+        targets[count++].change = change;
+    }
+    LeaveCriticalSection( &connection_watch_cs );
+
+    for (i = 0; i < count; i++)
+    {
+        BluetoothConnectionStatus status;
+        struct handler_entry *entry;
+
+        impl = targets[i].device;
+        if (targets[i].change)
+            status = targets[i].change->connected ? BluetoothConnectionStatus_Connected
+                                                  : BluetoothConnectionStatus_Disconnected;
+        else
+            le_device_get_ConnectionStatus( &impl->IBluetoothLEDevice_iface, &status );
+
+        if (status != impl->last_connection_status)
+        {
+            TRACE( "device %p connection status %d -> %d\n", impl, impl->last_connection_status, status );
+            impl->last_connection_status = status;
+            LIST_FOR_EACH_ENTRY( entry, &impl->connection_status_changed_handlers, struct handler_entry, entry )
+                ITypedEventHandler_BluetoothLEDevice_IInspectable_Invoke( entry->handler, &impl->IBluetoothLEDevice_iface,
+                                                                          NULL );
+        }
+        le_device_Release( &impl->IBluetoothLEDevice_iface );
+    }
+    free( targets );
+}
+
+static DWORD WINAPI connection_watch_thread_proc( void *arg )
+{
+    const DWORD params_size =
+        offsetof( struct winebth_radio_wait_connection_changes_params, changes[CONNECTION_WATCH_MAX_CHANGES] );
+    struct winebth_radio_wait_connection_changes_params *params;
+    HANDLE radio = INVALID_HANDLE_VALUE, wait_handles[2];
+    ULONGLONG generation = 0;
     DWORD bytes_returned;
-    HRESULT hr;
-    HANDLE radio_handle = INVALID_HANDLE_VALUE;
-    struct winebth_radio_get_device_connection_status_params params;
+    OVERLAPPED ovl;
 
     CoInitializeEx( NULL, COINIT_MULTITHREADED );
-    TRACE( "Connection monitor thread started for device %p address=%I64x\n", impl, impl->address );
+    TRACE( "Connection watch thread started\n" );
+
+    params = malloc( params_size );
+    memset( &ovl, 0, sizeof(ovl) );
+    ovl.hEvent = CreateEventW( NULL, TRUE, FALSE, NULL );
+    wait_handles[0] = ovl.hEvent;
+    wait_handles[1] = connection_watch_stop_event;
 
-    while (impl->connection_monitor_running)
+    for (;;)
     {
-        current_status = BluetoothConnectionStatus_Disconnected;
+        BOOL ret;
 
-        if (impl->device_handle != INVALID_HANDLE_VALUE)
+        EnterCriticalSection( &connection_watch_cs );
+        ResetEvent( connection_watch_stop_event );
+        if (list_empty( &connection_watch_devices ) || !params || !ovl.hEvent)
         {
-            BOOL connected = FALSE;
-            if (DeviceIoControl( impl->device_handle, IOCTL_WINEBTH_LE_DEVICE_GET_CONNECTION_STATUS,
-                                NULL, 0, &connected, sizeof(connected), &bytes_returned, NULL ))
-            {
-                current_status = connected ? BluetoothConnectionStatus_Connected : BluetoothConnectionStatus_Disconnected;
-            }
+            CloseHandle( connection_watch_thread );
+            connection_watch_thread = NULL;
+            LeaveCriticalSection( &connection_watch_cs );
+            break;
         }
-        else
-        {
-            if (radio_handle == INVALID_HANDLE_VALUE)
-                radio_handle = open_first_radio();
+        LeaveCriticalSection( &connection_watch_cs );
 
-            if (radio_handle != INVALID_HANDLE_VALUE)
+        if (radio == INVALID_HANDLE_VALUE)
+        {
+            if ((radio = open_first_radio_ex( FILE_FLAG_OVERLAPPED )) == INVALID_HANDLE_VALUE)
             {
-                params.address = impl->address;
-                params.connected = FALSE;
-                if (DeviceIoControl( radio_handle, IOCTL_WINEBTH_RADIO_GET_DEVICE_CONNECTION_STATUS,
-                                    &params, sizeof(params), &params, sizeof(params), &bytes_returned, NULL ))
-                {
-                    current_status = params.connected ? BluetoothConnectionStatus_Connected : BluetoothConnectionStatus_Disconnected;
-                }
+                WaitForSingleObject( connection_watch_stop_event, 1000 );
+                continue;
             }
+            /* Generations are per radio. */
+            generation = 0;
         }
 
-        if (current_status != impl->last_connection_status)
+        params->generation = generation;
+        bytes_returned = 0;
+        ret = DeviceIoControl( radio, IOCTL_WINEBTH_RADIO_WAIT_CONNECTION_CHANGES, params, params_size, params,
+                               params_size, &bytes_returned, &ovl );
+        if (!ret && GetLastError() == ERROR_IO_PENDING)
         {
-            TRACE( "Connection status CHANGED: %d -> %d, firing %d handlers\n",
-                   impl->last_connection_status, current_status,
-                   list_count( &impl->connection_status_changed_handlers ) );
-            impl->last_connection_status = current_status;
-
-            LIST_FOR_EACH_ENTRY( entry, &impl->connection_status_changed_handlers, struct handler_entry, entry )
+            if (WaitForMultipleObjects( 2, wait_handles, FALSE, INFINITE ) != WAIT_OBJECT_0)
             {
-                hr = ITypedEventHandler_BluetoothLEDevice_IInspectable_Invoke(
-                    entry->handler, &impl->IBluetoothLEDevice_iface, NULL );
-                TRACE( "Invoked ConnectionStatusChanged handler %p, hr=%#lx\n", entry->handler, hr );
+                CancelIoEx( radio, &ovl );
+                GetOverlappedResult( radio, &ovl, &bytes_returned, TRUE );
+                continue;
             }
+            ret = GetOverlappedResult( radio, &ovl, &bytes_returned, FALSE );
+        }
+        if (!ret)
+        {
+            /* The radio is going away. Back off, then look for it again. */
+            WARN( "IOCTL_WINEBTH_RADIO_WAIT_CONNECTION_CHANGES failed: %lu\n", GetLastError() );
+            CloseHandle( radio );
+            radio = INVALID_HANDLE_VALUE;
+            WaitForSingleObject( connection_watch_stop_event, 1000 );
+            continue;
         }
 
-        Sleep( 100 );
+        generation = params->generation;
+        connection_watch_dispatch( params );
     }
 
-    if (radio_handle != INVALID_HANDLE_VALUE)
-        CloseHandle( radio_handle );
-
-    TRACE( "Connection monitor thread exiting for device %p\n", impl );
+    if (radio != INVALID_HANDLE_VALUE) CloseHandle( radio );
+    if (ovl.hEvent) CloseHandle( ovl.hEvent );
+    free( params );
+    TRACE( "Connection watch thread exiting\n" );
     CoUninitialize();
     return 0;
 }
 
+static void connection_watch_add( struct bluetooth_le_device *impl )
+{
+    EnterCriticalSection( &connection_watch_cs );
+    if (!impl->connection_watched)
+    {
+        list_add_tail( &connection_watch_devices, &impl->connection_watch_entry );
+        impl->connection_watched = TRUE;
+    }
+    if (!connection_watch_stop_event)
+        connection_watch_stop_event = CreateEventW( NULL, TRUE, FALSE, NULL );
+    if (!connection_watch_thread && connection_watch_stop_event)
+        connection_watch_thread = CreateThread( NULL, 0, connection_watch_thread_proc, NULL, 0, NULL );
+    LeaveCriticalSection( &connection_watch_cs );
+
+    /* Only changes from here on get reported. */
+    le_device_get_ConnectionStatus( &impl->IBluetoothLEDevice_iface, &impl->last_connection_status );
+}
+
+static void connection_watch_remove( struct bluetooth_le_device *impl )
+{
+    EnterCriticalSection( &connection_watch_cs );
+    if (impl->connection_watched)
+    {
+        list_remove( &impl->connection_watch_entry );
+        impl->connection_watched = FALSE;
+        if (list_empty( &connection_watch_devices ) && connection_watch_stop_event)
+            SetEvent( connection_watch_stop_event );
+    }
+    LeaveCriticalSection( &connection_watch_cs );
+}
+
 static HRESULT WINAPI le_device_add_ConnectionStatusChanged( IBluetoothLEDevice *iface, ITypedEventHandler_BluetoothLEDevice_IInspectable *handler, EventRegistrationToken *token )
 {
     struct bluetooth_le_device *impl = impl_from_IBluetoothLEDevice( iface );
@@ -1826,14 +1960,7 @@ static HRESULT WINAPI le_device_add_ConnectionStatusChanged( IBluetoothLEDevice
     *token = entry->token;
 
     list_add_tail( &impl->connection_status_changed_handlers, &entry->entry );
-
-    /* Start monitoring thread if not already running */
-    if (!impl->connection_monitor_thread)
-    {
-        impl->connection_monitor_running = TRUE;
-        impl->connection_monitor_thread = CreateThread( NULL, 0, connection_status_monitor_thread, impl, 0, NULL );
-        TRACE( "Started connection status monitor thread %p\n", impl->connection_monitor_thread );
-    }
+    connection_watch_add( impl );
 
     /* Trigger connection if not already connected */
     if (impl->device_handle != INVALID_HANDLE_VALUE)
@@ -1861,6 +1988,7 @@ static HRESULT WINAPI le_device_remove_ConnectionStatusChanged( IBluetoothLEDevi
             list_remove( &entry->entry );
             ITypedEventHandler_BluetoothLEDevice_IInspectable_Release( entry->handler );
             free( entry );
+            if (list_empty( &impl->connection_status_changed_handlers )) connection_watch_remove( impl );
             return S_OK;
         }
     }
@@ -2011,7 +2139,7 @@ static const IGattSessionVtbl gatt_session_vtbl;
 static const IAsyncOperation_GattOpenStatusVtbl async_gatt_open_op_vtbl;
 static const IAsyncInfoVtbl async_gatt_open_info_vtbl;
 
-static HRESULT gatt_session_create( IGattSession **out );
+static HRESULT gatt_session_create( UINT16 max_pdu_size, IGattSession **out );
 static HRESULT async_gatt_open_op_create( GattOpenStatus status, IAsyncOperation_GattOpenStatus **operation );
 
 static CRITICAL_SECTION timestamp_cs;
@@ -2145,9 +2273,142 @@ static HRESULT device_access_info_create( IDeviceAccessInformation **out )
 
 static HRESULT gatt_read_result_create( GattCommunicationStatus status, IBuffer *value, IGattReadResult **out );
 static HRESULT async_gatt_read_op_create( IGattReadResult *result, IAsyncOperation_GattReadResult **out );
+static HRESULT async_gatt_read_op_create_pending( IAsyncOperation_GattReadResult **out );
+static void async_gatt_read_op_complete( IAsyncOperation_GattReadResult *iface, IGattReadResult *result );
 static HRESULT async_gatt_comm_status_op_create( GattCommunicationStatus result, IAsyncOperation_GattCommunicationStatus **out );
+static HRESULT async_gatt_comm_status_op_create_pending( IAsyncOperation_GattCommunicationStatus **out );
+static void async_gatt_comm_status_op_complete( IAsyncOperation_GattCommunicationStatus *iface,
+                                                GattCommunicationStatus result );
 static HRESULT gatt_char_write_value_impl( IGattCharacteristic *iface, IBuffer *value, GattWriteOption option, IAsyncOperation_GattCommunicationStatus **operation );
 
+/* The services and characteristics of a device, fetched with a single IOCTL_WINEBTH_*_GET_GATT_DATABASE request.
+ * It is shared by the services vector and the services created from it, so that enumerating the characteristics
+ * of every service doesn't take another round trip to the driver. */
+struct gatt_database_snapshot
+{
+    LONG ref;
+    void *buffer;
+    const struct winebth_gatt_database *db;
+};
+
+static struct gatt_database_snapshot *gatt_database_snapshot_addref( struct gatt_database_snapshot *snapshot )
+{
+    if (snapshot) InterlockedIncrement( &snapshot->ref );
+    return snapshot;
+}
+
+static void gatt_database_snapshot_release( struct gatt_database_snapshot *snapshot )
+{
+    if (snapshot && !InterlockedDecrement( &snapshot->ref ))
+    {
+        free( snapshot->buffer );
+        free( snapshot );
+    }
+}
+
+static HRESULT gatt_database_snapshot_fetch( HANDLE handle, BOOL is_radio_handle, UINT64 address,
+                                             struct gatt_database_snapshot **out )
+{
+    const SIZE_T header_size = is_radio_handle ? offsetof( struct winebth_radio_get_le_device_gatt_database_params, database ) : 0;
+    SIZE_T size = header_size + WINEBTH_GATT_DATABASE_SIZE( 8, 32 );
+    struct gatt_database_snapshot *snapshot;
+    struct winebth_gatt_database *db;
+    void *buffer;
+
+    for (;;)
+    {
+        DWORD bytes, err;
+        BOOL ret;
+
+        if (!(buffer = calloc( 1, size ))) return E_OUTOFMEMORY;
+        db = (struct winebth_gatt_database *)((BYTE *)buffer + header_size);
+        if (is_radio_handle)
+        {
+            ((struct winebth_radio_get_le_device_gatt_database_params *)buffer)->address = address;
+            ret = DeviceIoControl( handle, IOCTL_WINEBTH_RADIO_GET_LE_DEVICE_GATT_DATABASE, buffer, size,
+                                   buffer, size, &bytes, NULL );
+        }
+        else
+            ret = DeviceIoControl( handle, IOCTL_WINEBTH_LE_DEVICE_GET_GATT_DATABASE, NULL, 0, buffer, size,
+                                   &bytes, NULL );
+        if (ret) break;
+        if ((err = GetLastError()) != ERROR_MORE_DATA)
+        {
+            WARN( "IOCTL_WINEBTH_*_GET_GATT_DATABASE failed: %lu\n", err );
+            free( buffer );
+            return HRESULT_FROM_WIN32( err );
+        }
+        /* Only the header was returned, try again with the size it asks for. */
+        size = header_size + WINEBTH_GATT_DATABASE_SIZE( db->services_count, db->characteristics_count );
+        free( buffer );
+    }
+
+    if (db->version != WINEBTH_GATT_DATABASE_VERSION)
+    {
+        ERR( "Unsupported GATT database version %lu\n", db->version );
+        free( buffer );
+        return HRESULT_FROM_WIN32( ERROR_NOT_SUPPORTED );
+    }
+    if (!(snapshot = calloc( 1, sizeof( *snapshot ) )))
+    {
+        free( buffer );
+        return E_OUTOFMEMORY;
+    }
+    snapshot->ref = 1;
+    snapshot->buffer = buffer;
+    snapshot->db = db;
+    TRACE( "Fetched GATT database: %lu services, %lu characteristics\n", db->services_count,
+           db->characteristics_count );
+    *out = snapshot;
+    return S_OK;
+}
+
+/* Returns the primary services in the snapshot, only those with the given UUID if there is one. */
+static HRESULT gatt_database_snapshot_get_services( const struct gatt_database_snapshot *snapshot, const GUID *uuid,
+                                                    BTH_LE_GATT_SERVICE **services, ULONG *count )
+{
+    const struct winebth_gatt_database *db = snapshot->db;
+    ULONG i;
+
+    *count = 0;
+    if (!(*services = malloc( max( db->services_count, 1 ) * sizeof( **services ) ))) return E_OUTOFMEMORY;
+    for (i = 0; i < db->services_count; i++)
+    {
+        GUID guid;
+
+        if (!db->services[i].primary) continue;
+        bth_le_uuid_to_guid( &db->services[i].service.ServiceUuid, &guid );
+        if (uuid && !IsEqualGUID( &guid, uuid )) continue;
+        (*services)[(*count)++] = db->services[i].service;
+    }
+    return S_OK;
+}
+
+/* Finds the characteristics of a service in the snapshot. Returns FALSE if the snapshot doesn't have any. */
+static BOOL gatt_database_snapshot_get_characteristics( const struct gatt_database_snapshot *snapshot,
+                                                        const BTH_LE_GATT_SERVICE *service,
+                                                        const BTH_LE_GATT_CHARACTERISTIC **chars, ULONG *count )
+{
+    const struct winebth_gatt_database *db = snapshot->db;
+    GUID uuid, guid;
+    ULONG i;
+
+    bth_le_uuid_to_guid( &service->ServiceUuid, &uuid );
+    for (i = 0; i < db->services_count; i++)
+    {
+        const struct winebth_gatt_database_service *entry = &db->services[i];
+
+        if (entry->service.AttributeHandle != service->AttributeHandle) continue;
+        bth_le_uuid_to_guid( &entry->service.ServiceUuid, &guid );
+        if (!IsEqualGUID( &guid, &uuid )) continue;
+        if (!entry->characteristics_count) return FALSE;
+        *chars = (const BTH_LE_GATT_CHARACTERISTIC *)&db->services[db->services_count] + entry->first_characteristic;
+        *count = entry->characteristics_count;
+        return TRUE;
+    }
+    return FALSE;
+}
+
 struct gatt_device_service
 {
     IGattDeviceService IGattDeviceService_iface;
@@ -2162,6 +2423,7 @@ struct gatt_device_service
     IGattCharacteristic **cached_chars;
     UINT32 cached_chars_count;
     CRITICAL_SECTION cache_cs;
+    struct gatt_database_snapshot *snapshot;
 };
 
 static inline struct gatt_device_service *impl_from_IGattDeviceService( IGattDeviceService *iface )
@@ -2228,6 +2490,7 @@ static ULONG WINAPI gatt_service_Release( IGattDeviceService *iface )
         }
         LeaveCriticalSection( &impl->cache_cs );
         DeleteCriticalSection( &impl->cache_cs );
+        gatt_database_snapshot_release( impl->snapshot );
         free( impl->device_id );
         free( impl );
     }
@@ -2389,9 +2652,12 @@ struct gatt_characteristic
     ITypedEventHandler_GattCharacteristic_GattValueChangedEventArgs *value_changed_handler;
     EventRegistrationToken value_changed_token;
     LONG next_token;
-    HANDLE notification_thread;
-    volatile BOOL notification_thread_stop;
+    struct gatt_char_subscription *subscription; /* Guarded by handler_cs */
     CRITICAL_SECTION handler_cs;
+    /* Overlapped handle for reads and writes, created on first use. Guarded by handler_cs. */
+    HANDLE io_handle;
+    TP_IO *io;
+    BOOL io_failed;
 };
 
 static inline struct gatt_characteristic *impl_from_IGattCharacteristic( IGattCharacteristic *iface )
@@ -2427,6 +2693,10 @@ static ULONG WINAPI gatt_char_AddRef( IGattCharacteristic *iface )
 
 static void gatt_char_free( struct gatt_characteristic *impl )
 {
+    /* Every request holds a reference, so there is no I/O left to wait for. This can run from the I/O callback of
+     * the last request, where waiting for callbacks isn't allowed anyway. */
+    if (impl->io) CloseThreadpoolIo( impl->io );
+    if (impl->io_handle != INVALID_HANDLE_VALUE) CloseHandle( impl->io_handle );
     if (impl->device_handle != INVALID_HANDLE_VALUE) CloseHandle( impl->device_handle );
     if (impl->value_changed_handler) ITypedEventHandler_GattCharacteristic_GattValueChangedEventArgs_Release( impl->value_changed_handler );
     DeleteCriticalSection( &impl->handler_cs );
@@ -2440,16 +2710,8 @@ static ULONG WINAPI gatt_char_Release( IGattCharacteristic *iface )
 
     TRACE( "gatt_char_Release: %p uuid=%s ref=%lu\n", iface, debugstr_guid( &impl->char_info.CharacteristicUuid.Value.LongUuid ), ref );
 
-    if (!ref)
-    {
-        if (impl->notification_thread)
-        {
-            impl->notification_thread_stop = TRUE;
-            /* We don't Wait here to avoid deadlock. The thread holds a ref. */
-            CancelIoEx( impl->device_handle, NULL );
-        }
-        gatt_char_free( impl );
-    }
+    /* A ValueChanged subscription holds a reference, so it is gone by now. */
+    if (!ref) gatt_char_free( impl );
     return ref;
 }
 
@@ -2544,20 +2806,158 @@ static HRESULT WINAPI gatt_char_get_PresentationFormats( IGattCharacteristic *if
     ERR("!!! E_NOTIMPL - STUB!\n"); return E_NOTIMPL;
 }
 
-static HRESULT gatt_char_read_value_impl( IGattCharacteristic *iface, IAsyncOperation_GattReadResult **value )
+/* A read or write IOCTL sent to winebth.sys. The driver keeps these pending until the device answers, so they are
+ * issued overlapped and the operation is completed from a threadpool I/O callback, without blocking a thread. */
+struct gatt_char_request
+{
+    OVERLAPPED ovl;
+    struct gatt_characteristic *characteristic;
+    DWORD ioctl;
+    DWORD in_size;
+    DWORD out_size;
+    void *params;
+    IAsyncOperation_GattReadResult *read_op;
+    IAsyncOperation_GattCommunicationStatus *write_op;
+};
+
+static struct gatt_char_request *gatt_char_request_create( struct gatt_characteristic *impl, DWORD ioctl,
+                                                           DWORD in_size, DWORD out_size )
+{
+    struct gatt_char_request *request;
+
+    if (!(request = calloc( 1, sizeof( *request ) ))) return NULL;
+    if (!(request->params = calloc( 1, in_size )))
+    {
+        free( request );
+        return NULL;
+    }
+    request->characteristic = impl;
+    request->ioctl = ioctl;
+    request->in_size = in_size;
+    request->out_size = out_size;
+    IGattCharacteristic_AddRef( &impl->IGattCharacteristic_iface );
+    return request;
+}
+
+static void gatt_char_request_free( struct gatt_char_request *request )
+{
+    if (request->read_op) IAsyncOperation_GattReadResult_Release( request->read_op );
+    if (request->write_op) IAsyncOperation_GattCommunicationStatus_Release( request->write_op );
+    IGattCharacteristic_Release( &request->characteristic->IGattCharacteristic_iface );
+    free( request->params );
+    free( request );
+}
+
+static void gatt_char_request_complete( struct gatt_char_request *request, DWORD error )
+{
+    struct gatt_characteristic *impl = request->characteristic;
+    GattCommunicationStatus status = GattCommunicationStatus_Success;
+
+    TRACE( " GATT request %p: ioctl=%#lx error=%lu ===\n", request, request->ioctl, error );
+
+    if (error) status = GattCommunicationStatus_Unreachable;
+    if (request->read_op)
+    {
+        IGattReadResult *result = NULL;
+        IBuffer *buffer = NULL;
+        const UCHAR *data;
+        ULONG data_size;
+
+        if (impl->is_radio_handle)
+        {
+            struct winebth_radio_read_characteristic_params *params = request->params;
+            data = params->data;
+            data_size = params->data_size;
+        }
+        else
+        {
+            struct winebth_le_device_read_characteristic_params *params = request->params;
+            data = params->data;
+            data_size = params->data_size;
+        }
+        if (!error && data_size > 0 && FAILED(gatt_buffer_create( data, data_size, &buffer )))
+            status = GattCommunicationStatus_Unreachable;
+        if (FAILED(gatt_read_result_create( status, buffer, &result )))
+            WARN( "Failed to create read result\n" );
+        if (buffer) IBuffer_Release( buffer );
+        async_gatt_read_op_complete( request->read_op, result );
+        if (result) IGattReadResult_Release( result );
+    }
+    else
+        async_gatt_comm_status_op_complete( request->write_op, status );
+
+    gatt_char_request_free( request );
+}
+
+static void CALLBACK gatt_char_io_callback( TP_CALLBACK_INSTANCE *instance, void *context, void *overlapped,
+                                            ULONG result, ULONG_PTR bytes, TP_IO *io )
+{
+    struct gatt_char_request *request = CONTAINING_RECORD( overlapped, struct gatt_char_request, ovl );
+    gatt_char_request_complete( request, result );
+}
+
+static TP_IO *gatt_char_get_io( struct gatt_characteristic *impl )
+{
+    TP_IO *io;
+
+    EnterCriticalSection( &impl->handler_cs );
+    if (!impl->io && !impl->io_failed)
+    {
+        /* The shared device handle was opened for synchronous I/O. */
+        impl->io_handle = ReOpenFile( impl->device_handle, GENERIC_READ | GENERIC_WRITE,
+                                      FILE_SHARE_READ | FILE_SHARE_WRITE, FILE_FLAG_OVERLAPPED );
+        if (impl->io_handle == INVALID_HANDLE_VALUE)
+            WARN( "Failed to reopen device handle for overlapped I/O: %lu\n", GetLastError() );
+        else if (!(impl->io = CreateThreadpoolIo( impl->io_handle, gatt_char_io_callback, NULL, NULL )))
+        {
+            WARN( "Failed to create threadpool I/O: %lu\n", GetLastError() );
+            CloseHandle( impl->io_handle );
+            impl->io_handle = INVALID_HANDLE_VALUE;
+        }
+        impl->io_failed = !impl->io;
+    }
+    io = impl->io;
+    LeaveCriticalSection( &impl->handler_cs );
+    return io;
+}
+
+/* Sends the request, which is completed either from the threadpool, or before this returns. */
+static void gatt_char_request_submit( struct gatt_char_request *request )
+{
+    struct gatt_characteristic *impl = request->characteristic;
+    void *out = request->out_size ? request->params : NULL;
+    TP_IO *io = gatt_char_get_io( impl );
+    DWORD bytes_returned, error;
+
+    if (!io)
+    {
+        /* Fall back to blocking on the shared handle. */
+        if (DeviceIoControl( impl->device_handle, request->ioctl, request->params, request->in_size, out,
+                             request->out_size, &bytes_returned, NULL ))
+            error = ERROR_SUCCESS;
+        else
+            error = GetLastError();
+        gatt_char_request_complete( request, error );
+        return;
+    }
+
+    StartThreadpoolIo( io );
+    if (DeviceIoControl( impl->io_handle, request->ioctl, request->params, request->in_size, out,
+                         request->out_size, NULL, &request->ovl ))
+        return;
+    if ((error = GetLastError()) == ERROR_IO_PENDING) return;
+    CancelThreadpoolIo( io );
+    gatt_char_request_complete( request, error );
+}
+
+static HRESULT gatt_char_read_value_impl( IGattCharacteristic *iface, BluetoothCacheMode mode,
+                                          IAsyncOperation_GattReadResult **value )
 {
     struct gatt_characteristic *impl = impl_from_IGattCharacteristic( iface );
-    struct winebth_le_device_read_characteristic_params *device_params = NULL;
-    struct winebth_radio_read_characteristic_params *radio_params = NULL;
-    GattCommunicationStatus status;
+    struct gatt_char_request *request;
     IGattReadResult *result;
-    IBuffer *buffer = NULL;
-    DWORD bytes_returned;
     SIZE_T buffer_size;
     HRESULT hr;
-    BOOL ioctl_success;
-    ULONG data_size;
-    UCHAR *data_ptr;
 
     TRACE( " gatt_char_read_value_impl called: iface=%p device_handle=%p is_radio=%d char_handle=%u ===\n",
          iface, impl->device_handle, impl->is_radio_handle, impl->char_info.AttributeHandle );
@@ -2567,8 +2967,7 @@ static HRESULT gatt_char_read_value_impl( IGattCharacteristic *iface, IAsyncOper
     if (impl->device_handle == INVALID_HANDLE_VALUE)
     {
         TRACE( " Device handle is invalid ===\n" );
-        status = GattCommunicationStatus_Unreachable;
-        hr = gatt_read_result_create( status, NULL, &result );
+        hr = gatt_read_result_create( GattCommunicationStatus_Unreachable, NULL, &result );
         if (FAILED( hr )) return hr;
         hr = async_gatt_read_op_create( result, value );
         IGattReadResult_Release( result );
@@ -2577,102 +2976,70 @@ static HRESULT gatt_char_read_value_impl( IGattCharacteristic *iface, IAsyncOper
 
     if (impl->is_radio_handle)
     {
+        struct winebth_radio_read_characteristic_params *radio_params;
+
         buffer_size = offsetof( struct winebth_radio_read_characteristic_params, data[512] );
-        radio_params = malloc( buffer_size );
-        if (!radio_params) return E_OUTOFMEMORY;
+        request = gatt_char_request_create( impl, IOCTL_WINEBTH_RADIO_READ_CHARACTERISTIC, buffer_size, buffer_size );
+        if (!request) return E_OUTOFMEMORY;
 
-        memset( radio_params, 0, buffer_size );
+        radio_params = request->params;
         radio_params->address = impl->device_address;
         radio_params->service = impl->service_info;
         radio_params->characteristic = impl->char_info;
-        radio_params->data_size = 0;
+        radio_params->flags = mode == BluetoothCacheMode_Cached ? WINEBTH_READ_CHARACTERISTIC_CACHED : 0;
 
         TRACE( " Calling IOCTL_WINEBTH_RADIO_READ_CHARACTERISTIC for char uuid=%s addr=%I64x ===\n",
              debugstr_guid( &impl->char_info.CharacteristicUuid.Value.LongUuid ), impl->device_address );
-
-        ioctl_success = DeviceIoControl( impl->device_handle, IOCTL_WINEBTH_RADIO_READ_CHARACTERISTIC,
-                                          radio_params, buffer_size, radio_params, buffer_size, &bytes_returned, NULL );
-        data_size = radio_params->data_size;
-        data_ptr = radio_params->data;
     }
     else
     {
+        struct winebth_le_device_read_characteristic_params *device_params;
+
         buffer_size = offsetof( struct winebth_le_device_read_characteristic_params, data[512] );
-        device_params = malloc( buffer_size );
-        if (!device_params) return E_OUTOFMEMORY;
+        request = gatt_char_request_create( impl, IOCTL_WINEBTH_LE_DEVICE_READ_CHARACTERISTIC, buffer_size,
+                                            buffer_size );
+        if (!request) return E_OUTOFMEMORY;
 
-        memset( device_params, 0, buffer_size );
+        device_params = request->params;
         device_params->service = impl->service_info;
         device_params->characteristic = impl->char_info;
-        device_params->data_size = 0;
+        device_params->flags = mode == BluetoothCacheMode_Cached ? WINEBTH_READ_CHARACTERISTIC_CACHED : 0;
 
         TRACE( " Calling IOCTL_WINEBTH_LE_DEVICE_READ_CHARACTERISTIC for char uuid=%s ===\n",
              debugstr_guid( &impl->char_info.CharacteristicUuid.Value.LongUuid ) );
-
-        ioctl_success = DeviceIoControl( impl->device_handle, IOCTL_WINEBTH_LE_DEVICE_READ_CHARACTERISTIC,
-                                          device_params, buffer_size, device_params, buffer_size, &bytes_returned, NULL );
-        data_size = device_params->data_size;
-        data_ptr = device_params->data;
     }
 
-    if (ioctl_success)
+    if (FAILED(hr = async_gatt_read_op_create_pending( &request->read_op )))
     {
-        TRACE( " IOCTL succeeded: data_size=%lu bytes_returned=%lu ===\n", data_size, bytes_returned );
-        status = GattCommunicationStatus_Success;
-        if (data_size > 0)
-        {
-            hr = gatt_buffer_create( data_ptr, data_size, &buffer );
-            if (FAILED( hr ))
-            {
-                TRACE( " Failed to create buffer: hr=0x%lx ===\n", hr );
-                free( device_params );
-                free( radio_params );
-                return hr;
-            }
-        }
-    }
-    else
-    {
-        DWORD err = GetLastError();
-        TRACE( " IOCTL failed: error=%lu ===\n", err );
-        status = GattCommunicationStatus_Unreachable;
+        gatt_char_request_free( request );
+        return hr;
     }
-
-    free( device_params );
-    free( radio_params );
-
-    hr = gatt_read_result_create( status, buffer, &result );
-    if (buffer) IBuffer_Release( buffer );
-    if (FAILED( hr )) return hr;
-
-    hr = async_gatt_read_op_create( result, value );
-    IGattReadResult_Release( result );
-    return hr;
+    *value = request->read_op;
+    IAsyncOperation_GattReadResult_AddRef( *value );
+    gatt_char_request_submit( request );
+    return S_OK;
 }
 
 static HRESULT WINAPI gatt_char_ReadValueAsync( IGattCharacteristic *iface, IAsyncOperation_GattReadResult **value )
 {
     TRACE( "(%p, %p)\n", iface, value );
-    return gatt_char_read_value_impl( iface, value );
+    /* Like on Windows, this is served from the cache if possible. */
+    return gatt_char_read_value_impl( iface, BluetoothCacheMode_Cached, value );
 }
 
 static HRESULT WINAPI gatt_char_ReadValueWithCacheModeAsync( IGattCharacteristic *iface, BluetoothCacheMode mode,
                                                               IAsyncOperation_GattReadResult **value )
 {
     TRACE( "(%p, %d, %p)\n", iface, mode, value );
-    return gatt_char_read_value_impl( iface, value );
+    return gatt_char_read_value_impl( iface, mode, value );
 }
 
 static HRESULT gatt_char_write_value_impl( IGattCharacteristic *iface, IBuffer *value, GattWriteOption opt,
                                             IAsyncOperation_GattCommunicationStatus **async )
 {
     struct gatt_characteristic *impl = impl_from_IGattCharacteristic( iface );
-    struct winebth_le_device_write_characteristic_params *device_params = NULL;
-    struct winebth_radio_write_characteristic_params *radio_params = NULL;
     IBufferByteAccess *byte_access = NULL;
-    GattCommunicationStatus status;
-    BOOL ioctl_success;
-    DWORD bytes_returned;
+    struct gatt_char_request *request;
     SIZE_T buffer_size;
     UINT32 data_len;
     BYTE *data_ptr;
@@ -2722,11 +3089,13 @@ static HRESULT gatt_char_write_value_impl( IGattCharacteristic *iface, IBuffer *
 
     if (impl->is_radio_handle)
     {
+        struct winebth_radio_write_characteristic_params *radio_params;
+
         buffer_size = offsetof( struct winebth_radio_write_characteristic_params, data[data_len] );
-        radio_params = malloc( buffer_size );
-        if (!radio_params) return E_OUTOFMEMORY;
+        request = gatt_char_request_create( impl, IOCTL_WINEBTH_RADIO_WRITE_CHARACTERISTIC, buffer_size, 0 );
+        if (!request) return E_OUTOFMEMORY;
 
-        memset( radio_params, 0, buffer_size );
+        radio_params = request->params;
         radio_params->address = impl->device_address;
         radio_params->service = impl->service_info;
         radio_params->characteristic = impl->char_info;
@@ -2737,18 +3106,16 @@ static HRESULT gatt_char_write_value_impl( IGattCharacteristic *iface, IBuffer *
 
         TRACE( " Calling IOCTL_WINEBTH_RADIO_WRITE_CHARACTERISTIC for char uuid=%s data_size=%lu write_type=%lu ===\n",
              debugstr_guid( &impl->char_info.CharacteristicUuid.Value.LongUuid ), radio_params->data_size, radio_params->write_type );
-
-        ioctl_success = DeviceIoControl( impl->device_handle, IOCTL_WINEBTH_RADIO_WRITE_CHARACTERISTIC,
-                                          radio_params, buffer_size, NULL, 0, &bytes_returned, NULL );
-        free( radio_params );
     }
     else
     {
+        struct winebth_le_device_write_characteristic_params *device_params;
+
         buffer_size = offsetof( struct winebth_le_device_write_characteristic_params, data[data_len] );
-        device_params = malloc( buffer_size );
-        if (!device_params) return E_OUTOFMEMORY;
+        request = gatt_char_request_create( impl, IOCTL_WINEBTH_LE_DEVICE_WRITE_CHARACTERISTIC, buffer_size, 0 );
+        if (!request) return E_OUTOFMEMORY;
 
-        memset( device_params, 0, buffer_size );
+        device_params = request->params;
         device_params->service = impl->service_info;
         device_params->characteristic = impl->char_info;
         device_params->write_type = (opt == GattWriteOption_WriteWithoutResponse) ? 1 : 0;
@@ -2758,25 +3125,17 @@ static HRESULT gatt_char_write_value_impl( IGattCharacteristic *iface, IBuffer *
 
         TRACE( " Calling IOCTL_WINEBTH_LE_DEVICE_WRITE_CHARACTERISTIC for char uuid=%s data_size=%lu write_type=%lu ===\n",
              debugstr_guid( &impl->char_info.CharacteristicUuid.Value.LongUuid ), device_params->data_size, device_params->write_type );
-
-        ioctl_success = DeviceIoControl( impl->device_handle, IOCTL_WINEBTH_LE_DEVICE_WRITE_CHARACTERISTIC,
-                                          device_params, buffer_size, NULL, 0, &bytes_returned, NULL );
-        free( device_params );
     }
 
-    if (ioctl_success)
+    if (FAILED(hr = async_gatt_comm_status_op_create_pending( &request->write_op )))
     {
-        TRACE( " IOCTL succeeded ===\n" );
-        status = GattCommunicationStatus_Success;
-    }
-    else
-    {
-        DWORD err = GetLastError();
-        TRACE( " IOCTL failed: error=%lu ===\n", err );
-        status = GattCommunicationStatus_Unreachable;
+        gatt_char_request_free( request );
+        return hr;
     }
-
-    return async_gatt_comm_status_op_create( status, async );
+    *async = request->write_op;
+    IAsyncOperation_GattCommunicationStatus_AddRef( *async );
+    gatt_char_request_submit( request );
+    return S_OK;
 }
 
 static HRESULT WINAPI gatt_char_WriteValueAsync( IGattCharacteristic *iface, IBuffer *value,
@@ -2836,6 +3195,7 @@ static HRESULT WINAPI gatt_char_WriteClientCharacteristicConfigurationDescriptor
         radio_params.service = impl->service_info;
         radio_params.characteristic = impl->char_info;
         radio_params.enable = enable;
+        radio_params.overflow_policy = WINEBTH_NOTIFICATION_OVERFLOW_DROP_OLDEST;
 
         TRACE( " Calling IOCTL_WINEBTH_RADIO_SET_NOTIFY enable=%d ===\n", radio_params.enable );
 
@@ -2848,6 +3208,7 @@ static HRESULT WINAPI gatt_char_WriteClientCharacteristicConfigurationDescriptor
         device_params.service = impl->service_info;
         device_params.characteristic = impl->char_info;
         device_params.enable = enable;
+        device_params.overflow_policy = WINEBTH_NOTIFICATION_OVERFLOW_DROP_OLDEST;
 
         TRACE( " Calling IOCTL_WINEBTH_LE_DEVICE_SET_NOTIFY enable=%d ===\n", device_params.enable );
 
@@ -2869,207 +3230,291 @@ static HRESULT WINAPI gatt_char_WriteClientCharacteristicConfigurationDescriptor
     return async_gatt_comm_status_op_create( status, async );
 }
 
-static HRESULT gatt_value_changed_event_args_create( IBuffer *value, IGattValueChangedEventArgs **out );
+static HRESULT gatt_value_changed_event_args_create( IBuffer *value, ULONGLONG timestamp,
+                                                     IGattValueChangedEventArgs **out );
 
 static HRESULT WINAPI gatt_value_changed_args_get_Timestamp( IGattValueChangedEventArgs *iface, DateTime *value );
 
-static DWORD WINAPI gatt_char_notification_thread( void *arg )
+/* Large enough for a few dozen full-size ATT values, and a lot more of the small ones that high-rate sensors send. */
+#define GATT_NOTIFICATION_BUFFER_SIZE 16384
+
+static void gatt_char_dispatch_notification( struct gatt_characteristic *impl,
+                                             ITypedEventHandler_GattCharacteristic_GattValueChangedEventArgs *handler,
+                                             struct gatt_notify_batch *batch,
+                                             struct winebth_gatt_notification_record *record )
 {
-    struct gatt_characteristic *impl = arg;
-    unsigned char buffer[256];
-    unsigned int data_size;
-    struct winebth_le_device_read_notification_params *device_params = NULL;
-    struct winebth_radio_read_notification_params *radio_params = NULL;
-    void *params;
+    IGattValueChangedEventArgs *event_args;
+    IBuffer *buffer;
+
+    if (FAILED(gatt_buffer_create_from_batch( batch, record->data, record->size, &buffer ))) return;
+    if (SUCCEEDED(gatt_value_changed_event_args_create( buffer, record->timestamp, &event_args )))
+    {
+        ITypedEventHandler_GattCharacteristic_GattValueChangedEventArgs_Invoke( handler, &impl->IGattCharacteristic_iface, event_args );
+        IGattValueChangedEventArgs_Release( event_args );
+    }
+    IBuffer_Release( buffer );
+}
+
+/* ValueChanged subscriptions are multiplexed onto a single threadpool per process, capped at the number of
+ * processors, instead of each getting a thread of its own. Every subscription keeps one READ_NOTIFICATIONS request
+ * pending on its own overlapped handle, and only issues the next one once the handler has seen the values returned
+ * by the previous one, which keeps them in order. */
+struct gatt_char_subscription
+{
+    OVERLAPPED ovl;
+    LONG refcount;                               /* One for the pending request or retry, one per stopper */
+    LONG stopping;
+    struct gatt_characteristic *characteristic;  /* Holds a reference */
+    HANDLE io_handle;
+    TP_IO *io;
+    TP_TIMER *retry_timer;
+    DWORD ioctl;
     ULONG params_size;
-    ULONG bytes_returned;
-    HRESULT hr;
-    HANDLE device_handle;
-    BOOL is_radio_handle;
-    UINT64 device_address;
-    BTH_LE_GATT_SERVICE service_info;
-    BTH_LE_GATT_CHARACTERISTIC char_info;
-    DWORD ioctl_code;
+    ULONG last_overflow_count;
+    struct gatt_notify_batch *batch;             /* The request buffer, shared with the values handed out from it */
+};
 
-    CoInitializeEx( NULL, COINIT_MULTITHREADED );
-    TRACE( " gatt_char_notification_thread: STARTED for char_handle=%u is_radio=%d (COM initialized) ===\n",
-         impl->char_info.AttributeHandle, impl->is_radio_handle );
+static TP_CALLBACK_ENVIRON gatt_notify_environment;
+static INIT_ONCE gatt_notify_init_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL WINAPI gatt_notify_pool_init( INIT_ONCE *once, void *param, void **context )
+{
+    SYSTEM_INFO info;
+    TP_POOL *pool;
 
-    device_handle = impl->device_handle;
-    is_radio_handle = impl->is_radio_handle;
-    device_address = impl->device_address;
-    service_info = impl->service_info;
-    char_info = impl->char_info;
+    if (!(pool = CreateThreadpool( NULL ))) return FALSE;
+    GetSystemInfo( &info );
+    SetThreadpoolThreadMaximum( pool, max( 2, info.dwNumberOfProcessors ) );
+    memset( &gatt_notify_environment, 0, sizeof(gatt_notify_environment) );
+    gatt_notify_environment.Version = 1;
+    gatt_notify_environment.Pool = pool;
+    return TRUE;
+}
 
-    if (is_radio_handle)
+static void gatt_char_subscription_decref( struct gatt_char_subscription *sub )
+{
+    if (InterlockedDecrement( &sub->refcount )) return;
+
+    /* Both may still be running the callback that dropped the last reference, they get closed once it returns. */
+    if (sub->io) CloseThreadpoolIo( sub->io );
+    if (sub->retry_timer)
     {
-        params_size = sizeof(*radio_params) + sizeof(buffer);
-        radio_params = malloc( params_size );
-        if (!radio_params)
-        {
-            TRACE( " gatt_char_notification_thread: malloc failed ===\n" );
-            impl->IGattCharacteristic_iface.lpVtbl->Release( &impl->IGattCharacteristic_iface );
-            return 1;
-        }
-        radio_params->address = device_address;
-        radio_params->service = service_info;
-        radio_params->characteristic = char_info;
-        params = radio_params;
-        ioctl_code = IOCTL_WINEBTH_RADIO_READ_NOTIFICATION;
+        SetThreadpoolTimer( sub->retry_timer, NULL, 0, 0 );
+        CloseThreadpoolTimer( sub->retry_timer );
+    }
+    if (sub->io_handle != INVALID_HANDLE_VALUE) CloseHandle( sub->io_handle );
+    IGattCharacteristic_Release( &sub->characteristic->IGattCharacteristic_iface );
+    if (sub->batch) gatt_notify_batch_release( sub->batch );
+    free( sub );
+}
+
+static void gatt_char_subscription_retry( struct gatt_char_subscription *sub )
+{
+    LARGE_INTEGER due;
+    FILETIME ft;
+
+    due.QuadPart = -100 * 10000; /* 100ms */
+    ft.dwLowDateTime = due.u.LowPart;
+    ft.dwHighDateTime = due.u.HighPart;
+    SetThreadpoolTimer( sub->retry_timer, &ft, 0, 0 );
+}
+
+static BOOL gatt_char_subscription_init_batch( struct gatt_char_subscription *sub )
+{
+    struct gatt_characteristic *impl = sub->characteristic;
+    struct gatt_notify_batch *batch;
+
+    if (!(batch = gatt_notify_batch_create( sub->params_size ))) return FALSE;
+    if (impl->is_radio_handle)
+    {
+        struct winebth_radio_read_notifications_params *params = (void *)batch->params;
+        params->address = impl->device_address;
+        params->service = impl->service_info;
+        params->characteristic = impl->char_info;
     }
     else
     {
-        params_size = sizeof(*device_params) + sizeof(buffer);
-        device_params = malloc( params_size );
-        if (!device_params)
-        {
-            TRACE( " gatt_char_notification_thread: malloc failed ===\n" );
-            impl->IGattCharacteristic_iface.lpVtbl->Release( &impl->IGattCharacteristic_iface );
-            return 1;
-        }
-        device_params->service = service_info;
-        device_params->characteristic = char_info;
-        params = device_params;
-        ioctl_code = IOCTL_WINEBTH_LE_DEVICE_READ_NOTIFICATION;
+        struct winebth_le_device_read_notifications_params *params = (void *)batch->params;
+        params->service = impl->service_info;
+        params->characteristic = impl->char_info;
     }
+    if (sub->batch) gatt_notify_batch_release( sub->batch );
+    sub->batch = batch;
+    return TRUE;
+}
 
-    while (1)
+static void gatt_char_subscription_submit( struct gatt_char_subscription *sub )
+{
+    /* Handlers may still hold on to values from the last batch, in which case the next request needs a fresh one. */
+    if (ReadAcquire( &sub->batch->ref ) > 1 && !gatt_char_subscription_init_batch( sub ))
     {
-        BOOL should_stop;
-        ITypedEventHandler_GattCharacteristic_GattValueChangedEventArgs *handler;
+        gatt_char_subscription_retry( sub );
+        return;
+    }
 
-        EnterCriticalSection( &impl->handler_cs );
-        should_stop = impl->notification_thread_stop;
-        handler = impl->value_changed_handler;
-        if (handler) ITypedEventHandler_GattCharacteristic_GattValueChangedEventArgs_AddRef( handler );
-        LeaveCriticalSection( &impl->handler_cs );
+    StartThreadpoolIo( sub->io );
+    if (!DeviceIoControl( sub->io_handle, sub->ioctl, sub->batch->params, sub->params_size, sub->batch->params,
+                          sub->params_size, NULL, &sub->ovl ) && GetLastError() != ERROR_IO_PENDING)
+    {
+        TRACE( "subscription %p: IOCTL failed, err=%lu\n", sub, GetLastError() );
+        CancelThreadpoolIo( sub->io );
+        gatt_char_subscription_retry( sub );
+        return;
+    }
+    /* gatt_char_remove_ValueChanged may have tried to cancel the previous request after it had already completed. */
+    if (ReadAcquire( &sub->stopping )) CancelIoEx( sub->io_handle, &sub->ovl );
+}
 
-        if (should_stop) break;
+static void gatt_char_subscription_dispatch( struct gatt_char_subscription *sub )
+{
+    ITypedEventHandler_GattCharacteristic_GattValueChangedEventArgs *handler;
+    struct gatt_characteristic *impl = sub->characteristic;
+    struct gatt_notify_batch *batch = sub->batch;
+    ULONG count, overflow_count, data_size;
+    UCHAR *data, *record_ptr, *end;
 
-        bytes_returned = 0;
+    if (impl->is_radio_handle)
+    {
+        struct winebth_radio_read_notifications_params *params = (void *)batch->params;
+        count = params->count;
+        overflow_count = params->overflow_count;
+        data_size = params->data_size;
+        data = params->data;
+    }
+    else
+    {
+        struct winebth_le_device_read_notifications_params *params = (void *)batch->params;
+        count = params->count;
+        overflow_count = params->overflow_count;
+        data_size = params->data_size;
+        data = params->data;
+    }
 
-        if (DeviceIoControl( device_handle, ioctl_code,
-                            params, params_size,
-                            params, params_size,
-                            &bytes_returned, NULL ))
-        {
-            ULONG header_size;
-            UCHAR *notification_data;
+    TRACE( "subscription %p: count=%lu data_size=%lu\n", sub, count, data_size );
+    if (overflow_count != sub->last_overflow_count)
+    {
+        WARN( "Notification queue overflowed, %lu values dropped\n", overflow_count - sub->last_overflow_count );
+        sub->last_overflow_count = overflow_count;
+    }
 
-            TRACE( " gatt_char_notification_thread: IOCTL succeeded, bytes_returned=%lu ===\n", bytes_returned );
+    EnterCriticalSection( &impl->handler_cs );
+    handler = impl->subscription == sub ? impl->value_changed_handler : NULL;
+    if (handler) ITypedEventHandler_GattCharacteristic_GattValueChangedEventArgs_AddRef( handler );
+    LeaveCriticalSection( &impl->handler_cs );
+    if (!handler) return;
 
-            if (is_radio_handle)
-            {
-                header_size = offsetof( struct winebth_radio_read_notification_params, data );
-                notification_data = radio_params->data;
-            }
-            else
-            {
-                header_size = offsetof( struct winebth_le_device_read_notification_params, data );
-                notification_data = device_params->data;
-            }
+    record_ptr = data;
+    end = data + min( data_size, GATT_NOTIFICATION_BUFFER_SIZE );
+    while (end - record_ptr >= sizeof(struct winebth_gatt_notification_record))
+    {
+        struct winebth_gatt_notification_record *record = (void *)record_ptr;
 
-            /* Fix busy loop: If driver returns success but no data (e.g. timeout treated as success), sleep */
-            if (bytes_returned <= header_size)
-            {
-                TRACE( " gatt_char_notification_thread: success but no data (timeout?), sleeping 50ms ===\n" );
-                Sleep( 50 );
-                continue;
-            }
+        if (record->size > end - record_ptr - sizeof(*record)) break;
+        gatt_char_dispatch_notification( impl, handler, batch, record );
+        record_ptr += sizeof(*record) + record->size;
+    }
+    ITypedEventHandler_GattCharacteristic_GattValueChangedEventArgs_Release( handler );
+}
 
-            if (bytes_returned > header_size)
-            {
-                data_size = bytes_returned - header_size;
-                TRACE( " gatt_char_notification_thread: data_size=%u ===\n", data_size );
+static void CALLBACK gatt_char_subscription_io_callback( TP_CALLBACK_INSTANCE *instance, void *context,
+                                                         void *overlapped, ULONG result, ULONG_PTR bytes, TP_IO *io )
+{
+    struct gatt_char_subscription *sub = context;
 
-                if (data_size > 0 && data_size <= sizeof(buffer) && handler)
-                {
-                    struct gatt_buffer *gatt_buf;
-                    IGattValueChangedEventArgs *event_args;
-                    IBuffer *ibuf;
+    if (ReadAcquire( &sub->stopping ))
+        gatt_char_subscription_decref( sub );
+    else if (result)
+    {
+        /* Notifications were disabled, or the characteristic is gone. Keep trying until the handler is removed, in
+         * case notifications get enabled again. */
+        TRACE( "subscription %p: IOCTL failed, err=%lu\n", sub, result );
+        gatt_char_subscription_retry( sub );
+    }
+    else
+    {
+        gatt_char_subscription_dispatch( sub );
+        gatt_char_subscription_submit( sub );
+    }
+}
 
-                    gatt_buf = calloc( 1, sizeof(*gatt_buf) + data_size );
-                    if (gatt_buf)
-                    {
-                        gatt_buf->IBuffer_iface.lpVtbl = &gatt_buffer_vtbl;
-                        gatt_buf->IBufferByteAccess_iface.lpVtbl = &gatt_buffer_byte_access_vtbl;
-                        gatt_buf->ref = 1;
-                        gatt_buf->capacity = data_size;
-                        gatt_buf->length = data_size;
-                        memcpy( gatt_buf->data, notification_data, data_size );
-                        
-                        hr = gatt_value_changed_event_args_create( &gatt_buf->IBuffer_iface, &event_args );
-
-                        if (SUCCEEDED(hr))
-                        {
-                            EnterCriticalSection( &impl->handler_cs );
-                            handler = impl->value_changed_handler;
-                            if (handler)
-                            {
-                                ITypedEventHandler_GattCharacteristic_GattValueChangedEventArgs_AddRef( handler );
-                                ITypedEventHandler_GattCharacteristic_GattValueChangedEventArgs_Invoke( handler, &impl->IGattCharacteristic_iface, event_args );
-                                ITypedEventHandler_GattCharacteristic_GattValueChangedEventArgs_Release( handler );
-                            }
-                            LeaveCriticalSection( &impl->handler_cs );
-                            IGattValueChangedEventArgs_Release( event_args );
-                        }
-                        IBuffer_Release( &gatt_buf->IBuffer_iface );
-                    }
-                }
-            }
-        }
-        else
-        {
-            DWORD err = GetLastError();
+static void CALLBACK gatt_char_subscription_retry_callback( TP_CALLBACK_INSTANCE *instance, void *context,
+                                                            TP_TIMER *timer )
+{
+    struct gatt_char_subscription *sub = context;
+
+    if (ReadAcquire( &sub->stopping )) gatt_char_subscription_decref( sub );
+    else gatt_char_subscription_submit( sub );
+}
+
+/* Every request drains as many queued values as fit into the buffer, so a burst of notifications only costs a single
+ * round trip to the driver. */
+static struct gatt_char_subscription *gatt_char_subscription_create( struct gatt_characteristic *impl )
+{
+    struct gatt_char_subscription *sub;
 
-            if (err == ERROR_NO_DATA || err == 0xC00000BB)
-            {
-                
-                if (handler) ITypedEventHandler_GattCharacteristic_GattValueChangedEventArgs_Release( handler );
-                handler = NULL;
-                Sleep( 50 );
-                EnterCriticalSection( &impl->handler_cs );
-                should_stop = impl->notification_thread_stop;
-                LeaveCriticalSection( &impl->handler_cs );
-                if (should_stop) break;
-                continue;
-            }
-            else
-            {
-                TRACE( " gatt_char_notification_thread: IOCTL failed, err=%lu ===\n", err );
-                
-                if (handler) ITypedEventHandler_GattCharacteristic_GattValueChangedEventArgs_Release( handler );
-                handler = NULL;
-                Sleep( 100 );
-                EnterCriticalSection( &impl->handler_cs );
-                should_stop = impl->notification_thread_stop;
-                LeaveCriticalSection( &impl->handler_cs );
-                if (should_stop) break;
-                continue;
-            }
-        }
-        
-        if (handler) ITypedEventHandler_GattCharacteristic_GattValueChangedEventArgs_Release( handler );
+    if (!InitOnceExecuteOnce( &gatt_notify_init_once, gatt_notify_pool_init, NULL, NULL )) return NULL;
+    if (!(sub = calloc( 1, sizeof(*sub) ))) return NULL;
+    sub->refcount = 1;
+    sub->characteristic = impl;
+    IGattCharacteristic_AddRef( &impl->IGattCharacteristic_iface );
+
+    if (impl->is_radio_handle)
+    {
+        sub->ioctl = IOCTL_WINEBTH_RADIO_READ_NOTIFICATIONS;
+        sub->params_size = offsetof( struct winebth_radio_read_notifications_params, data[GATT_NOTIFICATION_BUFFER_SIZE] );
     }
+    else
+    {
+        sub->ioctl = IOCTL_WINEBTH_LE_DEVICE_READ_NOTIFICATIONS;
+        sub->params_size = offsetof( struct winebth_le_device_read_notifications_params, data[GATT_NOTIFICATION_BUFFER_SIZE] );
+    }
+    gatt_char_subscription_init_batch( sub );
 
-    free( params );
-    TRACE( " gatt_char_notification_thread: EXITING ===\n" );
-    impl->IGattCharacteristic_iface.lpVtbl->Release( &impl->IGattCharacteristic_iface );
-    CoUninitialize();
-    return 0;
+    /* The handle shared with the characteristic was opened for synchronous I/O. */
+    sub->io_handle = ReOpenFile( impl->device_handle, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                 FILE_FLAG_OVERLAPPED );
+    if (sub->io_handle == INVALID_HANDLE_VALUE)
+        WARN( "Failed to reopen device handle for overlapped I/O: %lu\n", GetLastError() );
+    else if ((sub->io = CreateThreadpoolIo( sub->io_handle, gatt_char_subscription_io_callback, sub,
+                                            &gatt_notify_environment )))
+        sub->retry_timer = CreateThreadpoolTimer( gatt_char_subscription_retry_callback, sub,
+                                                  &gatt_notify_environment );
+
+    if (!sub->batch || !sub->retry_timer)
+    {
+        gatt_char_subscription_decref( sub );
+        return NULL;
+    }
+    return sub;
+}
+
+/* Makes the subscription go away once its request completes. Caller should hold a reference to it. */
+static void gatt_char_subscription_stop( struct gatt_char_subscription *sub )
+{
+    WriteRelease( &sub->stopping, TRUE );
+    CancelIoEx( sub->io_handle, &sub->ovl );
 }
 
 static HRESULT WINAPI gatt_char_add_ValueChanged( IGattCharacteristic *iface, ITypedEventHandler_GattCharacteristic_GattValueChangedEventArgs *handler,
                                                    EventRegistrationToken *token )
 {
     struct gatt_characteristic *impl = impl_from_IGattCharacteristic( iface );
-    DWORD thread_id;
+    struct gatt_char_subscription *sub = NULL;
 
     TRACE( "gatt_char_add_ValueChanged: iface=%p handler=%p token=%p\n", iface, handler, token );
     if (!token) return E_POINTER;
     if (!handler) return E_INVALIDARG;
 
     EnterCriticalSection( &impl->handler_cs );
+    if (!impl->subscription)
+    {
+        if (!(sub = gatt_char_subscription_create( impl )))
+        {
+            LeaveCriticalSection( &impl->handler_cs );
+            return E_OUTOFMEMORY;
+        }
+        impl->subscription = sub;
+    }
     if (impl->value_changed_handler) ITypedEventHandler_GattCharacteristic_GattValueChangedEventArgs_Release( impl->value_changed_handler );
     impl->value_changed_handler = handler;
     ITypedEventHandler_GattCharacteristic_GattValueChangedEventArgs_AddRef( handler );
@@ -3077,25 +3522,14 @@ static HRESULT WINAPI gatt_char_add_ValueChanged( IGattCharacteristic *iface, IT
     impl->value_changed_token = *token;
     LeaveCriticalSection( &impl->handler_cs );
 
-    if (!impl->notification_thread)
-    {
-        IUnknown_AddRef( iface );
-        impl->notification_thread_stop = FALSE;
-        impl->notification_thread = CreateThread( NULL, 0, gatt_char_notification_thread, impl, 0, &thread_id );
-        if (!impl->notification_thread)
-        {
-            IUnknown_Release( iface );
-            return HRESULT_FROM_WIN32( GetLastError() );
-        }
-    }
-
+    if (sub) gatt_char_subscription_submit( sub );
     return S_OK;
 }
 
 static HRESULT WINAPI gatt_char_remove_ValueChanged( IGattCharacteristic *iface, EventRegistrationToken token )
 {
     struct gatt_characteristic *impl = impl_from_IGattCharacteristic( iface );
-    HANDLE thread_to_wait = NULL;
+    struct gatt_char_subscription *sub = NULL;
 
     TRACE( " gatt_char_remove_ValueChanged: iface=%p token=%I64d ===\n", iface, token.value );
 
@@ -3105,21 +3539,17 @@ static HRESULT WINAPI gatt_char_remove_ValueChanged( IGattCharacteristic *iface,
         ITypedEventHandler_GattCharacteristic_GattValueChangedEventArgs_Release( impl->value_changed_handler );
         impl->value_changed_handler = NULL;
         impl->value_changed_token.value = 0;
-        if (impl->notification_thread)
-        {
-            impl->notification_thread_stop = TRUE;
-            CancelIoEx( impl->device_handle, NULL );
-            thread_to_wait = impl->notification_thread;
-            impl->notification_thread = NULL;
-        }
+        if ((sub = impl->subscription)) InterlockedIncrement( &sub->refcount );
+        impl->subscription = NULL;
     }
     LeaveCriticalSection( &impl->handler_cs );
 
-    /* Wait outside critical section to avoid deadlock */
-    if (thread_to_wait)
+    /* This doesn't wait for the subscription to go away, so that handlers can remove themselves. They won't get
+     * called again once this returns, unless they already are. */
+    if (sub)
     {
-        WaitForSingleObject( thread_to_wait, INFINITE );
-        CloseHandle( thread_to_wait );
+        gatt_char_subscription_stop( sub );
+        gatt_char_subscription_decref( sub );
     }
     return S_OK;
 }
@@ -3177,6 +3607,7 @@ static HRESULT gatt_characteristic_create( HANDLE device_handle, BOOL is_radio_h
     impl->IGattCharacteristic_iface.lpVtbl = &gatt_characteristic_vtbl;
     impl->ref = 1;
     impl->device_handle = dup_handle;
+    impl->io_handle = INVALID_HANDLE_VALUE;
     impl->is_radio_handle = is_radio_handle;
     impl->device_address = device_address;
     impl->service_info = *service;
@@ -4372,7 +4803,7 @@ static ULONG WINAPI gatt_value_changed_args_Release( IGattValueChangedEventArgs
     if (!ref)
     {
         if (impl->value) IBuffer_Release( impl->value );
-        free( impl );
+        object_pool_free( impl );
     }
     return ref;
 }
@@ -4435,22 +4866,30 @@ static const IGattValueChangedEventArgsVtbl gatt_value_changed_event_args_vtbl =
     gatt_value_changed_args_get_Timestamp
 };
 
-static HRESULT gatt_value_changed_event_args_create( IBuffer *value, IGattValueChangedEventArgs **out )
+/* timestamp is when the value was received by the driver, or 0 to use the current time. */
+static HRESULT gatt_value_changed_event_args_create( IBuffer *value, ULONGLONG timestamp,
+                                                     IGattValueChangedEventArgs **out )
 {
     struct gatt_value_changed_event_args *impl;
     FILETIME ft;
     static ULONGLONG last_ts = 0;
     ULONGLONG ts;
 
-    if (!(impl = calloc( 1, sizeof( *impl ) ))) return E_OUTOFMEMORY;
+    if (!(impl = object_pool_alloc( sizeof( *impl ) ))) return E_OUTOFMEMORY;
+    memset( impl, 0, sizeof( *impl ) );
     impl->IGattValueChangedEventArgs_iface.lpVtbl = &gatt_value_changed_event_args_vtbl;
     impl->ref = 1;
     impl->value = value;
     if (value) IBuffer_AddRef( value );
 
-    GetSystemTimePreciseAsFileTime( &ft );
-    ts = ((ULONGLONG)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
-    
+    if (timestamp)
+        ts = timestamp;
+    else
+    {
+        GetSystemTimePreciseAsFileTime( &ft );
+        ts = ((ULONGLONG)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    }
+
     /* Ensure monotonic and non-zero deltas for app logic - thread safe */
     EnterCriticalSection( &timestamp_cs );
     if (ts <= last_ts) ts = last_ts + 1;
@@ -4472,6 +4911,7 @@ struct async_gatt_read_op
     IAsyncOperationCompletedHandler_GattReadResult *handler;
     IGattReadResult *result;
     AsyncStatus status;
+    CRITICAL_SECTION cs;
 };
 
 static inline struct async_gatt_read_op *impl_from_IAsyncOperation_GattReadResult( IAsyncOperation_GattReadResult *iface )
@@ -4518,6 +4958,8 @@ static ULONG WINAPI async_gatt_read_op_Release( IAsyncOperation_GattReadResult *
     {
         if (impl->handler) IAsyncOperationCompletedHandler_GattReadResult_Release( impl->handler );
         if (impl->result) IGattReadResult_Release( impl->result );
+        impl->cs.DebugInfo->Spare[0] = 0;
+        DeleteCriticalSection( &impl->cs );
         free( impl );
     }
     return ref;
@@ -4547,12 +4989,17 @@ static HRESULT WINAPI async_gatt_read_op_put_Completed( IAsyncOperation_GattRead
                                                          IAsyncOperationCompletedHandler_GattReadResult *handler )
 {
     struct async_gatt_read_op *impl = impl_from_IAsyncOperation_GattReadResult( iface );
+    BOOL completed;
+
     TRACE( "(%p, %p)\n", iface, handler );
+    EnterCriticalSection( &impl->cs );
     if (impl->handler) IAsyncOperationCompletedHandler_GattReadResult_Release( impl->handler );
     impl->handler = handler;
     if (handler) IAsyncOperationCompletedHandler_GattReadResult_AddRef( handler );
-    if (impl->status == Completed && handler)
-        IAsyncOperationCompletedHandler_GattReadResult_Invoke( handler, iface, impl->status );
+    completed = impl->status == Completed;
+    LeaveCriticalSection( &impl->cs );
+    if (completed && handler)
+        IAsyncOperationCompletedHandler_GattReadResult_Invoke( handler, iface, Completed );
     return S_OK;
 }
 
@@ -4562,19 +5009,30 @@ static HRESULT WINAPI async_gatt_read_op_get_Completed( IAsyncOperation_GattRead
     struct async_gatt_read_op *impl = impl_from_IAsyncOperation_GattReadResult( iface );
     TRACE( "(%p, %p)\n", iface, handler );
     if (!handler) return E_POINTER;
+    EnterCriticalSection( &impl->cs );
     *handler = impl->handler;
     if (*handler) IAsyncOperationCompletedHandler_GattReadResult_AddRef( *handler );
+    LeaveCriticalSection( &impl->cs );
     return S_OK;
 }
 
 static HRESULT WINAPI async_gatt_read_op_GetResults( IAsyncOperation_GattReadResult *iface, IGattReadResult **result )
 {
     struct async_gatt_read_op *impl = impl_from_IAsyncOperation_GattReadResult( iface );
+    HRESULT hr = S_OK;
+
     TRACE( "(%p, %p)\n", iface, result );
     if (!result) return E_POINTER;
-    *result = impl->result;
-    if (*result) IGattReadResult_AddRef( *result );
-    return S_OK;
+    EnterCriticalSection( &impl->cs );
+    if (impl->status != Completed)
+    {
+        *result = NULL;
+        hr = E_ILLEGAL_METHOD_CALL;
+    }
+    else if ((*result = impl->result))
+        IGattReadResult_AddRef( *result );
+    LeaveCriticalSection( &impl->cs );
+    return hr;
 }
 
 static const IAsyncOperation_GattReadResultVtbl async_gatt_read_op_vtbl =
@@ -4642,7 +5100,9 @@ static HRESULT WINAPI async_gatt_read_info_get_Status( IAsyncInfo *iface, AsyncS
     struct async_gatt_read_op *impl = impl_from_read_IAsyncInfo( iface );
     TRACE( "(%p, %p)\n", iface, status );
     if (!status) return E_POINTER;
+    EnterCriticalSection( &impl->cs );
     *status = impl->status;
+    LeaveCriticalSection( &impl->cs );
     return S_OK;
 }
 
@@ -4679,17 +5139,46 @@ static const IAsyncInfoVtbl async_gatt_read_info_vtbl =
     async_gatt_read_info_Close
 };
 
-static HRESULT async_gatt_read_op_create( IGattReadResult *result, IAsyncOperation_GattReadResult **out )
+/* Creates an operation that is still running, it is finished with async_gatt_read_op_complete. */
+static HRESULT async_gatt_read_op_create_pending( IAsyncOperation_GattReadResult **out )
 {
     struct async_gatt_read_op *impl;
     if (!(impl = calloc( 1, sizeof( *impl ) ))) return E_OUTOFMEMORY;
     impl->IAsyncOperation_GattReadResult_iface.lpVtbl = &async_gatt_read_op_vtbl;
     impl->IAsyncInfo_iface.lpVtbl = &async_gatt_read_info_vtbl;
     impl->ref = 1;
+    impl->status = Started;
+    InitializeCriticalSection( &impl->cs );
+    impl->cs.DebugInfo->Spare[0] = (DWORD_PTR)(__FILE__ ": async_gatt_read_op.cs");
+    *out = &impl->IAsyncOperation_GattReadResult_iface;
+    return S_OK;
+}
+
+static void async_gatt_read_op_complete( IAsyncOperation_GattReadResult *iface, IGattReadResult *result )
+{
+    struct async_gatt_read_op *impl = impl_from_IAsyncOperation_GattReadResult( iface );
+    IAsyncOperationCompletedHandler_GattReadResult *handler;
+
+    EnterCriticalSection( &impl->cs );
     impl->result = result;
-    impl->status = Completed;
     if (result) IGattReadResult_AddRef( result );
-    *out = &impl->IAsyncOperation_GattReadResult_iface;
+    impl->status = Completed;
+    if ((handler = impl->handler)) IAsyncOperationCompletedHandler_GattReadResult_AddRef( handler );
+    LeaveCriticalSection( &impl->cs );
+
+    if (handler)
+    {
+        IAsyncOperationCompletedHandler_GattReadResult_Invoke( handler, iface, Completed );
+        IAsyncOperationCompletedHandler_GattReadResult_Release( handler );
+    }
+}
+
+static HRESULT async_gatt_read_op_create( IGattReadResult *result, IAsyncOperation_GattReadResult **out )
+{
+    HRESULT hr;
+
+    if (FAILED(hr = async_gatt_read_op_create_pending( out ))) return hr;
+    async_gatt_read_op_complete( *out, result );
     return S_OK;
 }
 
@@ -4702,6 +5191,7 @@ struct async_gatt_comm_status_op
     IAsyncOperationCompletedHandler_GattCommunicationStatus *handler;
     GattCommunicationStatus result;
     AsyncStatus status;
+    CRITICAL_SECTION cs;
 };
 
 static inline struct async_gatt_comm_status_op *impl_from_IAsyncOperation_GattCommunicationStatus( IAsyncOperation_GattCommunicationStatus *iface )
@@ -4747,6 +5237,8 @@ static ULONG WINAPI async_gatt_comm_status_op_Release( IAsyncOperation_GattCommu
     if (!ref)
     {
         if (impl->handler) IAsyncOperationCompletedHandler_GattCommunicationStatus_Release( impl->handler );
+        impl->cs.DebugInfo->Spare[0] = 0;
+        DeleteCriticalSection( &impl->cs );
         free( impl );
     }
     return ref;
@@ -4776,12 +5268,17 @@ static HRESULT WINAPI async_gatt_comm_status_op_put_Completed( IAsyncOperation_G
                                                                 IAsyncOperationCompletedHandler_GattCommunicationStatus *handler )
 {
     struct async_gatt_comm_status_op *impl = impl_from_IAsyncOperation_GattCommunicationStatus( iface );
+    BOOL completed;
+
     TRACE( "(%p, %p)\n", iface, handler );
+    EnterCriticalSection( &impl->cs );
     if (impl->handler) IAsyncOperationCompletedHandler_GattCommunicationStatus_Release( impl->handler );
     impl->handler = handler;
     if (handler) IAsyncOperationCompletedHandler_GattCommunicationStatus_AddRef( handler );
-    if (impl->status == Completed && handler)
-        IAsyncOperationCompletedHandler_GattCommunicationStatus_Invoke( handler, iface, impl->status );
+    completed = impl->status == Completed;
+    LeaveCriticalSection( &impl->cs );
+    if (completed && handler)
+        IAsyncOperationCompletedHandler_GattCommunicationStatus_Invoke( handler, iface, Completed );
     return S_OK;
 }
 
@@ -4791,18 +5288,25 @@ static HRESULT WINAPI async_gatt_comm_status_op_get_Completed( IAsyncOperation_G
     struct async_gatt_comm_status_op *impl = impl_from_IAsyncOperation_GattCommunicationStatus( iface );
     TRACE( "(%p, %p)\n", iface, handler );
     if (!handler) return E_POINTER;
+    EnterCriticalSection( &impl->cs );
     *handler = impl->handler;
     if (*handler) IAsyncOperationCompletedHandler_GattCommunicationStatus_AddRef( *handler );
+    LeaveCriticalSection( &impl->cs );
     return S_OK;
 }
 
 static HRESULT WINAPI async_gatt_comm_status_op_GetResults( IAsyncOperation_GattCommunicationStatus *iface, GattCommunicationStatus *result )
 {
     struct async_gatt_comm_status_op *impl = impl_from_IAsyncOperation_GattCommunicationStatus( iface );
+    HRESULT hr = S_OK;
+
     TRACE( "(%p, %p)\n", iface, result );
     if (!result) return E_POINTER;
-    *result = impl->result;
-    return S_OK;
+    EnterCriticalSection( &impl->cs );
+    if (impl->status != Completed) hr = E_ILLEGAL_METHOD_CALL;
+    else *result = impl->result;
+    LeaveCriticalSection( &impl->cs );
+    return hr;
 }
 
 static const IAsyncOperation_GattCommunicationStatusVtbl async_gatt_comm_status_op_vtbl =
@@ -4870,7 +5374,9 @@ static HRESULT WINAPI async_gatt_comm_status_info_get_Status( IAsyncInfo *iface,
     struct async_gatt_comm_status_op *impl = impl_from_comm_status_IAsyncInfo( iface );
     TRACE( "(%p, %p)\n", iface, status );
     if (!status) return E_POINTER;
+    EnterCriticalSection( &impl->cs );
     *status = impl->status;
+    LeaveCriticalSection( &impl->cs );
     return S_OK;
 }
 
@@ -4907,16 +5413,46 @@ static const IAsyncInfoVtbl async_gatt_comm_status_info_vtbl =
     async_gatt_comm_status_info_Close
 };
 
-static HRESULT async_gatt_comm_status_op_create( GattCommunicationStatus result, IAsyncOperation_GattCommunicationStatus **out )
+/* Creates an operation that is still running, it is finished with async_gatt_comm_status_op_complete. */
+static HRESULT async_gatt_comm_status_op_create_pending( IAsyncOperation_GattCommunicationStatus **out )
 {
     struct async_gatt_comm_status_op *impl;
     if (!(impl = calloc( 1, sizeof( *impl ) ))) return E_OUTOFMEMORY;
     impl->IAsyncOperation_GattCommunicationStatus_iface.lpVtbl = &async_gatt_comm_status_op_vtbl;
     impl->IAsyncInfo_iface.lpVtbl = &async_gatt_comm_status_info_vtbl;
     impl->ref = 1;
+    impl->status = Started;
+    InitializeCriticalSection( &impl->cs );
+    impl->cs.DebugInfo->Spare[0] = (DWORD_PTR)(__FILE__ ": async_gatt_comm_status_op.cs");
+    *out = &impl->IAsyncOperation_GattCommunicationStatus_iface;
+    return S_OK;
+}
+
+static void async_gatt_comm_status_op_complete( IAsyncOperation_GattCommunicationStatus *iface,
+                                                GattCommunicationStatus result )
+{
+    struct async_gatt_comm_status_op *impl = impl_from_IAsyncOperation_GattCommunicationStatus( iface );
+    IAsyncOperationCompletedHandler_GattCommunicationStatus *handler;
+
+    EnterCriticalSection( &impl->cs );
     impl->result = result;
     impl->status = Completed;
-    *out = &impl->IAsyncOperation_GattCommunicationStatus_iface;
+    if ((handler = impl->handler)) IAsyncOperationCompletedHandler_GattCommunicationStatus_AddRef( handler );
+    LeaveCriticalSection( &impl->cs );
+
+    if (handler)
+    {
+        IAsyncOperationCompletedHandler_GattCommunicationStatus_Invoke( handler, iface, Completed );
+        IAsyncOperationCompletedHandler_GattCommunicationStatus_Release( handler );
+    }
+}
+
+static HRESULT async_gatt_comm_status_op_create( GattCommunicationStatus result, IAsyncOperation_GattCommunicationStatus **out )
+{
+    HRESULT hr;
+
+    if (FAILED(hr = async_gatt_comm_status_op_create_pending( out ))) return hr;
+    async_gatt_comm_status_op_complete( *out, result );
     return S_OK;
 }
 
@@ -4925,7 +5461,7 @@ static const IGattSessionVtbl gatt_session_vtbl;
 static const IAsyncOperation_GattOpenStatusVtbl async_gatt_open_op_vtbl;
 static const IAsyncInfoVtbl async_gatt_open_info_vtbl;
 
-static HRESULT gatt_session_create( IGattSession **out );
+static HRESULT gatt_session_create( UINT16 max_pdu_size, IGattSession **out );
 static HRESULT async_gatt_open_op_create( GattOpenStatus status, IAsyncOperation_GattOpenStatus **operation );
 
 /* IGattSession implementation */
@@ -4933,6 +5469,7 @@ struct gatt_session
 {
     IGattSession IGattSession_iface;
     LONG ref;
+    UINT16 max_pdu_size;
 };
 
 static inline struct gatt_session *impl_from_IGattSession( IGattSession *iface )
@@ -5026,9 +5563,11 @@ static HRESULT WINAPI gatt_session_get_MaintainConnection( IGattSession *iface,
 
 static HRESULT WINAPI gatt_session_get_MaxPduSize( IGattSession *iface, UINT16 *value )
 {
-    FIXME( "(%p, %p): stub!\n", iface, value );
+    struct gatt_session *impl = impl_from_IGattSession( iface );
+
+    TRACE( "(%p, %p)\n", iface, value );
     if (!value) return E_POINTER;
-    *value = 23;
+    *value = impl->max_pdu_size;
     return S_OK;
 }
 
@@ -5084,12 +5623,13 @@ static const IGattSessionVtbl gatt_session_vtbl =
     gatt_session_remove_SessionStatusChanged,
 };
 
-static HRESULT gatt_session_create( IGattSession **out )
+static HRESULT gatt_session_create( UINT16 max_pdu_size, IGattSession **out )
 {
     struct gatt_session *impl;
     if (!(impl = calloc( 1, sizeof( *impl ) ))) return E_OUTOFMEMORY;
     impl->IGattSession_iface.lpVtbl = &gatt_session_vtbl;
     impl->ref = 1;
+    impl->max_pdu_size = max_pdu_size;
     *out = &impl->IGattSession_iface;
     return S_OK;
 }
@@ -5371,11 +5911,41 @@ static HRESULT WINAPI gatt_service3_get_DeviceAccessInformation( IGattDeviceServ
 }
 
 
+/* Asks the driver for the ATT MTU negotiated with the device, falling back to the default one. */
+static UINT16 gatt_device_service_get_att_mtu( struct gatt_device_service *impl )
+{
+    DWORD bytes;
+
+    if (impl->is_radio_handle)
+    {
+        struct winebth_radio_get_le_device_att_mtu_params params = {0};
+
+        params.address = impl->device_address;
+        params.service = impl->service_info;
+        if (DeviceIoControl( impl->device_handle, IOCTL_WINEBTH_RADIO_GET_LE_DEVICE_ATT_MTU, &params,
+                             sizeof( params ), &params, sizeof( params ), &bytes, NULL ))
+            return min( params.mtu, 0xffff );
+    }
+    else
+    {
+        struct winebth_le_device_get_att_mtu_params params = {0};
+
+        params.service = impl->service_info;
+        if (DeviceIoControl( impl->device_handle, IOCTL_WINEBTH_LE_DEVICE_GET_ATT_MTU, &params, sizeof( params ),
+                             &params, sizeof( params ), &bytes, NULL ))
+            return min( params.mtu, 0xffff );
+    }
+    WARN( "Could not get the ATT MTU: %lu\n", GetLastError() );
+    return 23;
+}
+
 static HRESULT WINAPI gatt_service3_get_Session( IGattDeviceService3 *iface, IGattSession **value )
 {
+    struct gatt_device_service *impl = impl_from_IGattDeviceService3( iface );
+
     TRACE( "(%p, %p)\n", iface, value );
     if (!value) return E_POINTER;
-    return gatt_session_create( value );
+    return gatt_session_create( gatt_device_service_get_att_mtu( impl ), value );
 }
 
 static HRESULT WINAPI gatt_service3_get_SharingMode( IGattDeviceService3 *iface, GattSharingMode *value )
@@ -5400,6 +5970,35 @@ static HRESULT WINAPI gatt_service3_OpenAsync( IGattDeviceService3 *iface, GattS
     return async_gatt_open_op_create( GattOpenStatus_Success, async );
 }
 
+static void gatt_device_service_cache_characteristics( struct gatt_device_service *impl,
+                                                       IVectorView_GattCharacteristic *chars_vector )
+{
+    EnterCriticalSection( &impl->cache_cs );
+    if (!impl->cached_chars)
+    {
+        UINT32 i_idx;
+        UINT32 vec_size = 0;
+        IVectorView_GattCharacteristic_get_Size( chars_vector, &vec_size );
+
+        impl->cached_chars = calloc( vec_size, sizeof(IGattCharacteristic*) );
+        if (impl->cached_chars)
+        {
+            TRACE( " Caching %u characteristics in service ===\n", vec_size );
+            for (i_idx = 0; i_idx < vec_size; i_idx++)
+            {
+                IGattCharacteristic *chr = NULL;
+                if (SUCCEEDED( IVectorView_GattCharacteristic_GetAt( chars_vector, i_idx, &chr ) ))
+                {
+                    impl->cached_chars[i_idx] = chr;
+                    impl->cached_chars_count = i_idx + 1;
+                }
+            }
+            TRACE( " Cached %u characteristics ===\n", impl->cached_chars_count );
+        }
+    }
+    LeaveCriticalSection( &impl->cache_cs );
+}
+
 static HRESULT get_characteristics_async_helper( IGattDeviceService3 *iface,
                                                  BluetoothCacheMode mode,
                                                  const GUID *filter_uuid,
@@ -5509,6 +6108,31 @@ static HRESULT get_characteristics_async_helper( IGattDeviceService3 *iface,
         }
     }
 
+    /* The services were enumerated along with their characteristics, unless they are wanted from the device. */
+    if (impl->snapshot && mode != BluetoothCacheMode_Uncached && impl->device_handle != INVALID_HANDLE_VALUE)
+    {
+        const BTH_LE_GATT_CHARACTERISTIC *characteristics;
+        ULONG char_count;
+
+        if (gatt_database_snapshot_get_characteristics( impl->snapshot, &impl->service_info, &characteristics,
+                                                        &char_count ))
+        {
+            TRACE( " Serving %lu characteristics from the GATT database snapshot ===\n", char_count );
+            hr = gatt_characteristics_vector_create( characteristics, char_count, &impl->service_info,
+                                                     impl->device_handle, impl->is_radio_handle,
+                                                     impl->device_address, filter_uuid, &chars_vector );
+            if (FAILED( hr )) return hr;
+            if (!filter_uuid)
+                gatt_device_service_cache_characteristics( impl, chars_vector );
+            hr = gatt_characteristics_result_create( GattCommunicationStatus_Success, chars_vector, &result );
+            IVectorView_GattCharacteristic_Release( chars_vector );
+            if (FAILED( hr )) return hr;
+            hr = async_gatt_chars_op_create( result, operation );
+            IGattCharacteristicsResult_Release( result );
+            return hr;
+        }
+    }
+
     /* Start IOCTL path */
     if (impl->device_handle == INVALID_HANDLE_VALUE)
     {
@@ -5607,32 +6231,7 @@ static HRESULT get_characteristics_async_helper( IGattDeviceService3 *iface,
 
                 /* Only cache if we did a FULL query (no filter) */
                 if (!filter_uuid)
-                {
-                    EnterCriticalSection( &impl->cache_cs );
-                    if (!impl->cached_chars)
-                    {
-                        UINT32 i_idx;
-                        UINT32 vec_size = 0;
-                        IVectorView_GattCharacteristic_get_Size( chars_vector, &vec_size );
-                        
-                        impl->cached_chars = calloc( vec_size, sizeof(IGattCharacteristic*) );
-                        if (impl->cached_chars)
-                        {
-                            TRACE( " Caching %u characteristics in service ===\n", vec_size );
-                            for (i_idx = 0; i_idx < vec_size; i_idx++)
-                            {
-                                IGattCharacteristic *chr = NULL;
-                                if (SUCCEEDED( IVectorView_GattCharacteristic_GetAt( chars_vector, i_idx, &chr ) ))
-                                {
-                                    impl->cached_chars[i_idx] = chr;
-                                    impl->cached_chars_count = i_idx + 1;
-                                }
-                            }
-                            TRACE( " Cached %u characteristics ===\n", impl->cached_chars_count );
-                        }
-                    }
-                    LeaveCriticalSection( &impl->cache_cs );
-                }
+                    gatt_device_service_cache_characteristics( impl, chars_vector );
 
                 break;
             }
@@ -5751,6 +6350,7 @@ static const IGattDeviceService3Vtbl gatt_device_service3_vtbl =
 static HRESULT gatt_device_service_create( HANDLE device_handle, BOOL is_radio_handle,
                                             const BTH_LE_GATT_SERVICE *service_info,
                                             const WCHAR *device_id, UINT64 device_address,
+                                            struct gatt_database_snapshot *snapshot,
                                             IGattDeviceService **out )
 {
     struct gatt_device_service *impl;
@@ -5792,6 +6392,7 @@ static HRESULT gatt_device_service_create( HANDLE device_handle, BOOL is_radio_h
             return E_OUTOFMEMORY;
         }
     }
+    impl->snapshot = gatt_database_snapshot_addref( snapshot );
     TRACE( " Created IGattDeviceService: uuid=%s handle=%u ===\n",
          debugstr_guid( &service_info->ServiceUuid.Value.LongUuid ), service_info->AttributeHandle );
     *out = &impl->IGattDeviceService_iface;
@@ -5935,6 +6536,7 @@ struct gatt_services_vector
     BOOL is_radio_handle;
     WCHAR *device_id;
     UINT64 device_address;
+    struct gatt_database_snapshot *snapshot;
 };
 
 static inline struct gatt_services_vector *impl_from_IVectorView_GattDeviceService( IVectorView_GattDeviceService *iface )
@@ -6058,6 +6660,7 @@ static ULONG WINAPI gatt_services_vector_Release( IVectorView_GattDeviceService
     {
         if (impl->device_handle != INVALID_HANDLE_VALUE)
             CloseHandle( impl->device_handle );
+        gatt_database_snapshot_release( impl->snapshot );
         free( impl->services );
         free( impl->device_id );
         free( impl );
@@ -6097,7 +6700,7 @@ static HRESULT WINAPI gatt_services_vector_GetAt( IVectorView_GattDeviceService
         TRACE( " gatt_services_vector_GetAt: index %u >= count %lu, returning E_BOUNDS ===\n", index, impl->count );
         return E_BOUNDS;
     }
-    hr = gatt_device_service_create( impl->device_handle, impl->is_radio_handle, &impl->services[index], impl->device_id, impl->device_address, value );
+    hr = gatt_device_service_create( impl->device_handle, impl->is_radio_handle, &impl->services[index], impl->device_id, impl->device_address, impl->snapshot, value );
     TRACE( " gatt_services_vector_GetAt: created service, hr=0x%08lx ===\n", hr );
     return hr;
 }
@@ -6142,7 +6745,7 @@ static HRESULT WINAPI gatt_services_vector_GetMany( IVectorView_GattDeviceServic
 
     for (i = 0; i < to_copy; i++)
     {
-        hr = gatt_device_service_create( impl->device_handle, impl->is_radio_handle, &impl->services[start_index + i], impl->device_id, impl->device_address, &items[i] );
+        hr = gatt_device_service_create( impl->device_handle, impl->is_radio_handle, &impl->services[start_index + i], impl->device_id, impl->device_address, impl->snapshot, &items[i] );
         if (FAILED( hr ))
         {
             while (i > 0)
@@ -6177,6 +6780,7 @@ static const struct IVectorView_GattDeviceServiceVtbl gatt_services_vector_vtbl
 static HRESULT gatt_services_vector_create( BTH_LE_GATT_SERVICE *services, ULONG count,
                                              HANDLE device_handle, BOOL is_radio_handle,
                                              const WCHAR *device_id, UINT64 device_address,
+                                             struct gatt_database_snapshot *snapshot,
                                              IVectorView_GattDeviceService **out )
 {
     struct gatt_services_vector *impl;
@@ -6232,6 +6836,7 @@ static HRESULT gatt_services_vector_create( BTH_LE_GATT_SERVICE *services, ULONG
             TRACE( "  Service[%lu]: handle=%u, uuid=%s\n", i, services[i].AttributeHandle, debugstr_guid(&guid) );
         }
     }
+    impl->snapshot = gatt_database_snapshot_addref( snapshot );
     *out = &impl->IVectorView_GattDeviceService_iface;
     return S_OK;
 }
@@ -7075,7 +7680,7 @@ retry:
                 if (filtered_count > 0)
                 {
                     hr = gatt_services_vector_create( filtered_services, filtered_count, handle_for_services,
-                                                       use_radio_fallback, WindowsGetStringRawBuffer( impl->id, NULL ), impl->address, &services_vector );
+                                                       use_radio_fallback, WindowsGetStringRawBuffer( impl->id, NULL ), impl->address, NULL, &services_vector );
                 }
                 else
                 {
@@ -7085,7 +7690,7 @@ retry:
             else
             {
                 hr = gatt_services_vector_create( services, svc_count, handle_for_services,
-                                                   use_radio_fallback, WindowsGetStringRawBuffer( impl->id, NULL ), impl->address, &services_vector );
+                                                   use_radio_fallback, WindowsGetStringRawBuffer( impl->id, NULL ), impl->address, NULL, &services_vector );
             }
             if (FAILED( hr ))
             {
@@ -7145,21 +7750,56 @@ done:
     return 0;
 }
 
+/* Enumerates the primary services of the device, with their characteristics, in a single request. Returns NULL if
+ * there are none or the request failed. */
+static IVectorView_GattDeviceService *le_device_get_gatt_services_vector( struct bluetooth_le_device *impl, HANDLE handle,
+                                                                          BOOL is_radio_handle, const GUID *uuid,
+                                                                          GattCommunicationStatus *status,
+                                                                          ULONG *service_count )
+{
+    IVectorView_GattDeviceService *services_vector = NULL;
+    struct gatt_database_snapshot *snapshot;
+    BTH_LE_GATT_SERVICE *services;
+    HRESULT hr;
+
+    *status = GattCommunicationStatus_Unreachable;
+    *service_count = 0;
+    if (FAILED( hr = gatt_database_snapshot_fetch( handle, is_radio_handle, impl->address, &snapshot ) ))
+    {
+        ERR( "Failed to fetch GATT database: hr=0x%lx\n", hr );
+        return NULL;
+    }
+
+    *status = GattCommunicationStatus_Success;
+    if (SUCCEEDED( hr = gatt_database_snapshot_get_services( snapshot, uuid, &services, service_count ) ))
+    {
+        TRACE( "=== %lu services (filter=%s) ===\n", *service_count, debugstr_guid( uuid ) );
+        if (*service_count > 0)
+            hr = gatt_services_vector_create( services, *service_count, handle, is_radio_handle,
+                                              WindowsGetStringRawBuffer( impl->id, NULL ), impl->address, snapshot,
+                                              &services_vector );
+        free( services );
+    }
+    if (FAILED( hr ))
+    {
+        ERR( "Failed to create services vector: hr=0x%lx\n", hr );
+        *status = GattCommunicationStatus_Unreachable;
+    }
+    gatt_database_snapshot_release( snapshot );
+    return services_vector;
+}
+
 static HRESULT WINAPI le_device3_GetGattServicesWithCacheModeAsync( IBluetoothLEDevice3 *iface,
                                                                     BluetoothCacheMode cacheMode,
                                                                     IAsyncOperation_GattDeviceServicesResult **operation )
 {
     struct bluetooth_le_device *impl = impl_from_IBluetoothLEDevice3( iface );
-    struct winebth_le_device_get_gatt_services_params *params = NULL;
-    struct winebth_radio_get_le_device_gatt_services_params *radio_params = NULL;
     IVectorView_GattDeviceService *services_vector = NULL;
     IGattDeviceServicesResult *result = NULL;
     GattCommunicationStatus status = GattCommunicationStatus_Unreachable;
     struct async_gatt_services_op *op_impl;
     HANDLE radio_handle = INVALID_HANDLE_VALUE;
     BOOL use_radio_fallback = FALSE;
-    DWORD bytes_returned;
-    SIZE_T buffer_size;
     HRESULT hr;
     ULONG service_count = 0;
 
@@ -7183,83 +7823,9 @@ static HRESULT WINAPI le_device3_GetGattServicesWithCacheModeAsync( IBluetoothLE
         use_radio_fallback = TRUE;
     }
 
-    if (use_radio_fallback)
-    {
-        buffer_size = offsetof( struct winebth_radio_get_le_device_gatt_services_params, services[16] );
-        radio_params = malloc( buffer_size );
-        if (!radio_params)
-        {
-            CloseHandle( radio_handle );
-            return E_OUTOFMEMORY;
-        }
-        memset( radio_params, 0, buffer_size );
-        radio_params->address = impl->address;
-        radio_params->count = 0;
-
-        TRACE( "=== Calling IOCTL_WINEBTH_RADIO_GET_LE_DEVICE_GATT_SERVICES (addr=%I64x)... ===\n", impl->address );
-        if (DeviceIoControl( radio_handle, IOCTL_WINEBTH_RADIO_GET_LE_DEVICE_GATT_SERVICES,
-                             radio_params, buffer_size, radio_params, buffer_size, &bytes_returned, NULL ))
-        {
-            TRACE( "=== IOCTL OK, count=%lu ===\n", radio_params->count );
-            status = GattCommunicationStatus_Success;
-            service_count = radio_params->count;
-
-            if (radio_params->count > 0)
-            {
-                hr = gatt_services_vector_create( radio_params->services, radio_params->count, radio_handle,
-                                                   TRUE, WindowsGetStringRawBuffer( impl->id, NULL ), impl->address, &services_vector );
-                if (FAILED( hr ))
-                {
-                    ERR( "Failed to create services vector: hr=0x%lx\n", hr );
-                    status = GattCommunicationStatus_Unreachable;
-                }
-            }
-        }
-        else
-        {
-            DWORD err = GetLastError();
-            ERR( "IOCTL failed: error=%lu\n", err );
-        }
-
-        free( radio_params );
-        CloseHandle( radio_handle );
-    }
-    else
-    {
-        buffer_size = offsetof( struct winebth_le_device_get_gatt_services_params, services[16] );
-        params = malloc( buffer_size );
-        if (!params) return E_OUTOFMEMORY;
-
-        memset( params, 0, buffer_size );
-        params->count = 0;
-
-        TRACE( "=== Calling IOCTL_WINEBTH_LE_DEVICE_GET_GATT_SERVICES... ===\n" );
-        if (DeviceIoControl( impl->device_handle, IOCTL_WINEBTH_LE_DEVICE_GET_GATT_SERVICES, NULL, 0,
-                             params, buffer_size, &bytes_returned, NULL ))
-        {
-            TRACE( "=== IOCTL OK, count=%lu ===\n", params->count );
-            status = GattCommunicationStatus_Success;
-            service_count = params->count;
-
-            if (params->count > 0)
-            {
-                hr = gatt_services_vector_create( params->services, params->count, impl->device_handle,
-                                                   FALSE, WindowsGetStringRawBuffer( impl->id, NULL ), impl->address, &services_vector );
-                if (FAILED( hr ))
-                {
-                    ERR( "Failed to create services vector: hr=0x%lx\n", hr );
-                    status = GattCommunicationStatus_Unreachable;
-                }
-            }
-        }
-        else
-        {
-            DWORD err = GetLastError();
-            ERR( "IOCTL failed: error=%lu\n", err );
-        }
-
-        free( params );
-    }
+    services_vector = le_device_get_gatt_services_vector( impl, use_radio_fallback ? radio_handle : impl->device_handle,
+                                                          use_radio_fallback, NULL, &status, &service_count );
+    if (use_radio_fallback) CloseHandle( radio_handle );
 
 create_failed_operation:
 
@@ -7316,16 +7882,12 @@ static HRESULT WINAPI le_device3_GetGattServicesForUuidWithCacheModeAsync( IBlue
                                                                            IAsyncOperation_GattDeviceServicesResult **operation )
 {
     struct bluetooth_le_device *impl = impl_from_IBluetoothLEDevice3( iface );
-    struct winebth_le_device_get_gatt_services_params *params = NULL;
-    struct winebth_radio_get_le_device_gatt_services_params *radio_params = NULL;
     IVectorView_GattDeviceService *services_vector = NULL;
     IGattDeviceServicesResult *result = NULL;
     GattCommunicationStatus status = GattCommunicationStatus_Unreachable;
     struct async_gatt_services_op *op_impl;
     HANDLE radio_handle = INVALID_HANDLE_VALUE;
     BOOL use_radio_fallback = FALSE;
-    DWORD bytes_returned;
-    SIZE_T buffer_size;
     HRESULT hr;
     ULONG service_count = 0;
 
@@ -7339,62 +7901,10 @@ static HRESULT WINAPI le_device3_GetGattServicesForUuidWithCacheModeAsync( IBlue
         if (radio_handle != INVALID_HANDLE_VALUE) use_radio_fallback = TRUE;
     }
 
-    if (use_radio_fallback)
-    {
-        buffer_size = offsetof( struct winebth_radio_get_le_device_gatt_services_params, services[16] );
-        radio_params = malloc( buffer_size );
-        if (radio_params)
-        {
-            memset( radio_params, 0, buffer_size );
-            radio_params->address = impl->address;
-            if (DeviceIoControl( radio_handle, IOCTL_WINEBTH_RADIO_GET_LE_DEVICE_GATT_SERVICES,
-                                 radio_params, buffer_size, radio_params, buffer_size, &bytes_returned, NULL ))
-            {
-                BTH_LE_GATT_SERVICE filtered[16];
-                ULONG filtered_count = 0, i;
-                status = GattCommunicationStatus_Success;
-                for (i = 0; i < radio_params->count && filtered_count < 16; i++)
-                {
-                    GUID svc_guid;
-                    bth_le_uuid_to_guid( &radio_params->services[i].ServiceUuid, &svc_guid );
-                    if (IsEqualGUID( &svc_guid, &serviceUuid )) filtered[filtered_count++] = radio_params->services[i];
-                }
-                service_count = filtered_count;
-                if (filtered_count > 0)
-                    gatt_services_vector_create( filtered, filtered_count, radio_handle, TRUE,
-                                                 WindowsGetStringRawBuffer( impl->id, NULL ), impl->address, &services_vector );
-            }
-            free( radio_params );
-        }
-        CloseHandle( radio_handle );
-    }
-    else
-    {
-        buffer_size = offsetof( struct winebth_le_device_get_gatt_services_params, services[16] );
-        params = malloc( buffer_size );
-        if (params)
-        {
-            memset( params, 0, buffer_size );
-            if (DeviceIoControl( impl->device_handle, IOCTL_WINEBTH_LE_DEVICE_GET_GATT_SERVICES, NULL, 0,
-                                 params, buffer_size, &bytes_returned, NULL ))
-            {
-                BTH_LE_GATT_SERVICE filtered[16];
-                ULONG filtered_count = 0, i;
-                status = GattCommunicationStatus_Success;
-                for (i = 0; i < params->count && filtered_count < 16; i++)
-                {
-                    GUID svc_guid;
-                    bth_le_uuid_to_guid( &params->services[i].ServiceUuid, &svc_guid );
-                    if (IsEqualGUID( &svc_guid, &serviceUuid )) filtered[filtered_count++] = params->services[i];
-                }
-                service_count = filtered_count;
-                if (filtered_count > 0)
-                    gatt_services_vector_create( filtered, filtered_count, impl->device_handle, FALSE,
-                                                 WindowsGetStringRawBuffer( impl->id, NULL ), impl->address, &services_vector );
-            }
-            free( params );
-        }
-    }
+    if (use_radio_fallback || impl->device_handle != INVALID_HANDLE_VALUE)
+        services_vector = le_device_get_gatt_services_vector( impl, use_radio_fallback ? radio_handle : impl->device_handle,
+                                                              use_radio_fallback, &serviceUuid, &status, &service_count );
+    if (use_radio_fallback) CloseHandle( radio_handle );
 
     hr = async_gatt_services_op_create( NULL, operation );
     if (FAILED(hr)) {
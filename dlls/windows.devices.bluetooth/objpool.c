@@ -0,0 +1,107 @@
+/*
+ * Free lists for small, short-lived objects
+ *
+ * Copyright 2026 agent
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/* Every notification delivered to a ValueChanged handler needs an IBuffer and an event args object, and every
+ * READ_NOTIFICATIONS request an output buffer. At high notification rates, getting these from the heap each time
+ * shows up, so freed blocks are kept on lock-free lists by size class instead. */
+
+#include <stdarg.h>
+#include <stdlib.h>
+
+#include "windef.h"
+#include "winbase.h"
+
+#include "objpool.h"
+
+#define OBJECT_POOL_MIN_SHIFT   6  /* 64 bytes */
+#define OBJECT_POOL_CLASS_COUNT 10 /* Up to 32KB */
+/* How much memory each size class may keep around. */
+#define OBJECT_POOL_MAX_CACHED  (256 * 1024)
+#define OBJECT_POOL_MIN_DEPTH   4
+
+#define OBJECT_POOL_HEAP_CLASS  (~0u)
+
+struct object_pool_block
+{
+    SLIST_ENTRY entry;      /* While on a free list */
+    UINT size_class;
+};
+
+/* Keeps the objects aligned like the blocks themselves. */
+#define OBJECT_POOL_HEADER_SIZE \
+    ((sizeof(struct object_pool_block) + MEMORY_ALLOCATION_ALIGNMENT - 1) & ~(MEMORY_ALLOCATION_ALIGNMENT - 1))
+
+static SLIST_HEADER free_lists[OBJECT_POOL_CLASS_COUNT];
+static struct object_pool_stats stats;
+
+static inline SIZE_T class_size( UINT size_class )
+{
+    return (SIZE_T)1 << (size_class + OBJECT_POOL_MIN_SHIFT);
+}
+
+static inline USHORT class_max_depth( UINT size_class )
+{
+    return max( OBJECT_POOL_MIN_DEPTH, OBJECT_POOL_MAX_CACHED / class_size( size_class ) );
+}
+
+void *object_pool_alloc( SIZE_T size )
+{
+    struct object_pool_block *block = NULL;
+    UINT size_class = 0;
+
+    while (size_class < OBJECT_POOL_CLASS_COUNT && size > class_size( size_class )) size_class++;
+    if (size_class < OBJECT_POOL_CLASS_COUNT)
+        block = (struct object_pool_block *)InterlockedPopEntrySList( &free_lists[size_class] );
+    else
+        size_class = OBJECT_POOL_HEAP_CLASS;
+
+    if (!block)
+    {
+        SIZE_T block_size = size_class == OBJECT_POOL_HEAP_CLASS ? size : class_size( size_class );
+
+        if (!(block = malloc( OBJECT_POOL_HEADER_SIZE + block_size ))) return NULL;
+        InterlockedIncrement64( &stats.heap_allocs );
+        block->size_class = size_class;
+    }
+    return (BYTE *)block + OBJECT_POOL_HEADER_SIZE;
+}
+
+void object_pool_free( void *ptr )
+{
+    struct object_pool_block *block;
+
+    if (!ptr) return;
+    block = (struct object_pool_block *)((BYTE *)ptr - OBJECT_POOL_HEADER_SIZE);
+    /* The depth check races with other threads, which only means a list may get a few blocks too many. */
+    if (block->size_class != OBJECT_POOL_HEAP_CLASS &&
+        QueryDepthSList( &free_lists[block->size_class] ) < class_max_depth( block->size_class ))
+    {
+        InterlockedPushEntrySList( &free_lists[block->size_class], &block->entry );
+        return;
+    }
+    InterlockedIncrement64( &stats.heap_frees );
+    free( block );
+}
+
+void object_pool_get_stats( struct object_pool_stats *out )
+{
+    out->heap_allocs = ReadNoFence64( &stats.heap_allocs );
+    out->heap_frees = ReadNoFence64( &stats.heap_frees );
+}
@@ -0,0 +1,40 @@
+/*
+ * Free lists for small, short-lived objects
+ *
+ * Copyright 2026 agent
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __WINE_WINDOWS_DEVICES_BLUETOOTH_OBJPOOL_H
+#define __WINE_WINDOWS_DEVICES_BLUETOOTH_OBJPOOL_H
+
+#include <windef.h>
+#include <winbase.h>
+
+struct object_pool_stats
+{
+    /* How many blocks had to come from, or went back to, the heap. */
+    LONG64 heap_allocs;
+    LONG64 heap_frees;
+};
+
+/* Returns uninitialized memory. Blocks are recycled in size classes of powers of two, from 64 bytes up to 32KB, and
+ * larger ones come straight from the heap. */
+extern void *object_pool_alloc( SIZE_T size );
+extern void object_pool_free( void *ptr );
+extern void object_pool_get_stats( struct object_pool_stats *stats );
+
+#endif /* __WINE_WINDOWS_DEVICES_BLUETOOTH_OBJPOOL_H */
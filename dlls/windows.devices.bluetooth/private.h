@@ -52,6 +52,10 @@ extern IActivationFactory *advertisement_watcher_factory;
 extern IActivationFactory *advertisement_filter_factory;
 extern IActivationFactory *advertisement_factory;
 
+/* Radio handles are cached for as long as the radio is present, these return a duplicate the caller has to close. */
+extern HANDLE open_first_radio( void );
+extern HANDLE open_first_radio_ex( DWORD flags );
+
 #define DEFINE_IINSPECTABLE_( pfx, iface_type, impl_type, impl_from, iface_mem, expr )             \
     static inline impl_type *impl_from( iface_type *iface )                                        \
     {                                                                                              \
@@ -0,0 +1,300 @@
+/* Bluetooth radio handle cache
+ *
+ * Copyright 2026 agent
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include "private.h"
+
+#include <stdio.h>
+#include <wctype.h>
+
+#include <setupapi.h>
+#include <cfgmgr32.h>
+
+#include "wine/debug.h"
+#include "wine/list.h"
+
+WINE_DEFAULT_DEBUG_CHANNEL( bluetooth );
+
+static const GUID my_GUID_BTHPORT_DEVICE_INTERFACE = { 0x850302a, 0xb344, 0x4fda, { 0x9b, 0xe9, 0x90, 0x57, 0x6b, 0x8d, 0x46, 0xf0 } };
+
+#define RADIO_CACHE_BUCKETS 16
+
+/* A radio handle that stays open for as long as the radio is present. The cache holds a reference to every radio in
+ * it, and lookups take one for as long as they use the handle, so removal never has to wait for them. */
+struct radio_entry
+{
+    struct list entry;                          /* Entry in radios, in the order the radios arrived */
+    struct list bucket_entry;                   /* Entry in radio_buckets, by interface path */
+    LONG refcount;
+    HANDLE handle;
+    WCHAR path[];
+};
+
+static SRWLOCK radio_cache_lock = SRWLOCK_INIT;
+static struct list radios = LIST_INIT( radios );
+static struct list radio_buckets[RADIO_CACHE_BUCKETS];
+static HCMNOTIFICATION radio_notify;
+static INIT_ONCE radio_cache_once = INIT_ONCE_STATIC_INIT;
+
+/* Interface paths are case insensitive, and the ones reported by CM_Register_Notification don't always use the same
+ * case as the ones from setupapi. */
+static unsigned int radio_path_hash( const WCHAR *path )
+{
+    unsigned int hash = 0;
+
+    while (*path) hash = hash * 31 + towupper( *path++ );
+    return hash % RADIO_CACHE_BUCKETS;
+}
+
+static void radio_entry_release( struct radio_entry *radio )
+{
+    if (InterlockedDecrement( &radio->refcount )) return;
+    CloseHandle( radio->handle );
+    free( radio );
+}
+
+/* Caller should hold radio_cache_lock. */
+static struct radio_entry *radio_cache_find( const WCHAR *path )
+{
+    struct radio_entry *radio;
+
+    LIST_FOR_EACH_ENTRY( radio, &radio_buckets[radio_path_hash( path )], struct radio_entry, bucket_entry )
+        if (!_wcsicmp( radio->path, path )) return radio;
+    return NULL;
+}
+
+static void radio_cache_add( const WCHAR *path )
+{
+    struct radio_entry *radio;
+    SIZE_T len = wcslen( path ) + 1;
+    HANDLE handle;
+
+    AcquireSRWLockShared( &radio_cache_lock );
+    radio = radio_cache_find( path );
+    ReleaseSRWLockShared( &radio_cache_lock );
+    if (radio) return;
+
+    handle = CreateFileW( path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0,
+                          NULL );
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        WARN( "Failed to open radio %s: %lu\n", debugstr_w( path ), GetLastError() );
+        return;
+    }
+    if (!(radio = malloc( offsetof( struct radio_entry, path[len] ) )))
+    {
+        CloseHandle( handle );
+        return;
+    }
+    radio->refcount = 1;
+    radio->handle = handle;
+    memcpy( radio->path, path, len * sizeof( WCHAR ) );
+
+    AcquireSRWLockExclusive( &radio_cache_lock );
+    /* The arrival notification and the initial enumeration can both see the same radio. */
+    if (radio_cache_find( path ))
+    {
+        ReleaseSRWLockExclusive( &radio_cache_lock );
+        radio_entry_release( radio );
+        return;
+    }
+    list_add_tail( &radios, &radio->entry );
+    list_add_tail( &radio_buckets[radio_path_hash( path )], &radio->bucket_entry );
+    ReleaseSRWLockExclusive( &radio_cache_lock );
+    TRACE( "Added radio %s, handle %p\n", debugstr_w( path ), handle );
+}
+
+static void radio_cache_remove( const WCHAR *path )
+{
+    struct radio_entry *radio;
+
+    AcquireSRWLockExclusive( &radio_cache_lock );
+    if ((radio = radio_cache_find( path )))
+    {
+        list_remove( &radio->entry );
+        list_remove( &radio->bucket_entry );
+    }
+    ReleaseSRWLockExclusive( &radio_cache_lock );
+
+    if (!radio) return;
+    TRACE( "Removed radio %s\n", debugstr_w( path ) );
+    radio_entry_release( radio );
+}
+
+static void radio_cache_enumerate( void )
+{
+    char buffer[sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA_W) + MAX_PATH * sizeof( WCHAR )];
+    SP_DEVICE_INTERFACE_DETAIL_DATA_W *iface_detail = (SP_DEVICE_INTERFACE_DETAIL_DATA_W *)buffer;
+    SP_DEVICE_INTERFACE_DATA iface_data;
+    HDEVINFO devinfo;
+    DWORD idx = 0;
+
+    devinfo = SetupDiGetClassDevsW( &my_GUID_BTHPORT_DEVICE_INTERFACE, NULL, NULL,
+                                    DIGCF_PRESENT | DIGCF_DEVICEINTERFACE );
+    if (devinfo == INVALID_HANDLE_VALUE)
+    {
+        WARN( "SetupDiGetClassDevsW failed: %lu\n", GetLastError() );
+        return;
+    }
+
+    iface_detail->cbSize = sizeof( *iface_detail );
+    iface_data.cbSize = sizeof( iface_data );
+    while (SetupDiEnumDeviceInterfaces( devinfo, NULL, &my_GUID_BTHPORT_DEVICE_INTERFACE, idx++, &iface_data ))
+    {
+        if (SetupDiGetDeviceInterfaceDetailW( devinfo, &iface_data, iface_detail, sizeof( buffer ), NULL, NULL ))
+            radio_cache_add( iface_detail->DevicePath );
+    }
+    SetupDiDestroyDeviceInfoList( devinfo );
+}
+
+static DWORD CALLBACK radio_cache_notify_callback( HCMNOTIFICATION notify, void *ctx, CM_NOTIFY_ACTION action,
+                                                   CM_NOTIFY_EVENT_DATA *event_data, DWORD size )
+{
+    TRACE( "(%p, %p, %d, %p, %lu)\n", notify, ctx, action, event_data, size );
+
+    switch (action)
+    {
+    case CM_NOTIFY_ACTION_DEVICEINTERFACEARRIVAL:
+        radio_cache_add( event_data->u.DeviceInterface.SymbolicLink );
+        break;
+    case CM_NOTIFY_ACTION_DEVICEINTERFACEREMOVAL:
+        radio_cache_remove( event_data->u.DeviceInterface.SymbolicLink );
+        break;
+    default:
+        break;
+    }
+    return ERROR_SUCCESS;
+}
+
+static BOOL WINAPI radio_cache_init( INIT_ONCE *once, void *param, void **context )
+{
+    CM_NOTIFY_FILTER filter = {0};
+    CONFIGRET ret;
+    unsigned int i;
+
+    for (i = 0; i < RADIO_CACHE_BUCKETS; i++)
+        list_init( &radio_buckets[i] );
+
+    /* Register first, so that no radio arriving during the enumeration below is missed. The registration is kept for
+     * the lifetime of the process. */
+    filter.cbSize = sizeof( filter );
+    filter.FilterType = CM_NOTIFY_FILTER_TYPE_DEVICEINTERFACE;
+    filter.u.DeviceInterface.ClassGuid = my_GUID_BTHPORT_DEVICE_INTERFACE;
+    if ((ret = CM_Register_Notification( &filter, NULL, radio_cache_notify_callback, &radio_notify )))
+    {
+        ERR( "CM_Register_Notification failed: %#lx\n", ret );
+        radio_notify = NULL;
+        return TRUE;
+    }
+    radio_cache_enumerate();
+    return TRUE;
+}
+
+/* Returns a new reference to the radio that arrived first, if there is one. */
+static struct radio_entry *radio_cache_get_first( void )
+{
+    struct radio_entry *radio = NULL;
+
+    AcquireSRWLockShared( &radio_cache_lock );
+    if (!list_empty( &radios ))
+    {
+        radio = LIST_ENTRY( list_head( &radios ), struct radio_entry, entry );
+        InterlockedIncrement( &radio->refcount );
+    }
+    ReleaseSRWLockShared( &radio_cache_lock );
+    return radio;
+}
+
+/* Opens the radio without the cache, for when radios can't be tracked, and for the radios that don't have an
+ * interface. */
+static HANDLE open_first_radio_uncached( DWORD flags )
+{
+    char buffer[sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA_W) + MAX_PATH * sizeof( WCHAR )];
+    SP_DEVICE_INTERFACE_DETAIL_DATA_W *iface_detail = (SP_DEVICE_INTERFACE_DETAIL_DATA_W *)buffer;
+    SP_DEVICE_INTERFACE_DATA iface_data;
+    HANDLE radio = INVALID_HANDLE_VALUE;
+    HDEVINFO devinfo;
+    DWORD idx = 0;
+    int i;
+
+    if (!radio_notify)
+    {
+        devinfo = SetupDiGetClassDevsW( &my_GUID_BTHPORT_DEVICE_INTERFACE, NULL, NULL,
+                                        DIGCF_PRESENT | DIGCF_DEVICEINTERFACE );
+        if (devinfo != INVALID_HANDLE_VALUE)
+        {
+            iface_detail->cbSize = sizeof( *iface_detail );
+            iface_data.cbSize = sizeof( iface_data );
+
+            while (SetupDiEnumDeviceInterfaces( devinfo, NULL, &my_GUID_BTHPORT_DEVICE_INTERFACE, idx++, &iface_data ))
+            {
+                if (!SetupDiGetDeviceInterfaceDetailW( devinfo, &iface_data, iface_detail, sizeof( buffer ), NULL,
+                                                       NULL ))
+                    continue;
+                radio = CreateFileW( iface_detail->DevicePath, GENERIC_READ | GENERIC_WRITE,
+                                     FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, flags, NULL );
+                if (radio != INVALID_HANDLE_VALUE)
+                    break;
+            }
+            SetupDiDestroyDeviceInfoList( devinfo );
+        }
+    }
+
+    for (i = 0; i < 4 && radio == INVALID_HANDLE_VALUE; i++)
+    {
+        WCHAR direct_path[64];
+
+        swprintf( direct_path, ARRAY_SIZE( direct_path ), L"\\\\?\\GLOBALROOT\\Device\\WINEBTH-RADIO-%d", i );
+        radio = CreateFileW( direct_path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                             OPEN_EXISTING, flags, NULL );
+        if (radio != INVALID_HANDLE_VALUE)
+            TRACE( "Opened radio via direct path: %s\n", debugstr_w( direct_path ) );
+    }
+    return radio;
+}
+
+/* Returns a handle to the first radio, which the caller needs to close. Handles are duplicated from the cached one
+ * rather than shared, so that callers can still close them, or cancel their own requests with CancelIoEx. */
+HANDLE open_first_radio_ex( DWORD flags )
+{
+    HANDLE handle = INVALID_HANDLE_VALUE;
+    struct radio_entry *radio;
+
+    InitOnceExecuteOnce( &radio_cache_once, radio_cache_init, NULL, NULL );
+
+    if ((radio = radio_cache_get_first()))
+    {
+        /* Overlapped handles need a file object of their own. */
+        if (flags & FILE_FLAG_OVERLAPPED)
+            handle = ReOpenFile( radio->handle, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                 flags );
+        else if (!DuplicateHandle( GetCurrentProcess(), radio->handle, GetCurrentProcess(), &handle, 0, FALSE,
+                                   DUPLICATE_SAME_ACCESS ))
+            handle = INVALID_HANDLE_VALUE;
+        radio_entry_release( radio );
+    }
+    if (handle == INVALID_HANDLE_VALUE)
+        handle = open_first_radio_uncached( flags );
+    TRACE( "Returning radio %p\n", handle );
+    return handle;
+}
+
+HANDLE open_first_radio( void )
+{
+    return open_first_radio_ex( 0 );
+}
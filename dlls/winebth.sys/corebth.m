@@ -79,6 +79,8 @@ typedef int WINE_BOOL;
 #include "winebth_priv.h"
 #include "unixlib_priv.h"
 
+WINE_DEFAULT_DEBUG_CHANNEL(winebth);
+
 typedef int32_t corebth_status;
 #define COREBTH_SUCCESS            0
 #define COREBTH_NOT_SUPPORTED      ((corebth_status)0xC00000BB)
@@ -117,12 +119,13 @@ typedef int32_t corebth_status;
 #define WINEBLUETOOTH_DEVICE_PROPERTY_LEGACY_PAIRING (1 << 4)
 #define WINEBLUETOOTH_DEVICE_PROPERTY_TRUSTED        (1 << 5)
 #define WINEBLUETOOTH_DEVICE_PROPERTY_CLASS          (1 << 6)
+#define WINEBLUETOOTH_DEVICE_PROPERTY_SERVICES_RESOLVED (1 << 7)
 
 #define WINEBLUETOOTH_DEVICE_ALL_PROPERTIES \
     ( WINEBLUETOOTH_DEVICE_PROPERTY_NAME | WINEBLUETOOTH_DEVICE_PROPERTY_ADDRESS | \
       WINEBLUETOOTH_DEVICE_PROPERTY_CONNECTED | WINEBLUETOOTH_DEVICE_PROPERTY_PAIRED | \
       WINEBLUETOOTH_DEVICE_PROPERTY_LEGACY_PAIRING | WINEBLUETOOTH_DEVICE_PROPERTY_TRUSTED | \
-      WINEBLUETOOTH_DEVICE_PROPERTY_CLASS )
+      WINEBLUETOOTH_DEVICE_PROPERTY_CLASS | WINEBLUETOOTH_DEVICE_PROPERTY_SERVICES_RESOLVED )
 #endif
 
 enum corebth_watcher_event_type
@@ -138,6 +141,8 @@ enum corebth_watcher_event_type
     COREBTH_EVENT_GATT_SERVICE_REMOVED,
     COREBTH_EVENT_GATT_CHAR_ADDED,
     COREBTH_EVENT_GATT_CHAR_REMOVED,
+    COREBTH_EVENT_GATT_CHAR_VALUE_CHANGED,
+    COREBTH_EVENT_GATT_CHAR_IO_FINISHED,
 };
 
 enum corebth_event_type
@@ -190,6 +195,12 @@ struct corebth_device_props
     int32_t legacy_pairing;
     int32_t trusted;
     uint32_t device_class;
+    int32_t services_resolved;
+    int16_t rssi;
+    uint16_t manufacturer_data_size;
+    uint16_t service_data_size;
+    uint8_t manufacturer_data[WINEBLUETOOTH_MAX_ADVERTISEMENT_DATA_SIZE];
+    uint8_t service_data[WINEBLUETOOTH_MAX_ADVERTISEMENT_DATA_SIZE];
 };
 
 struct corebth_device_added_event
@@ -250,6 +261,15 @@ struct corebth_gatt_char_removed_event
     struct corebth_gatt_characteristic characteristic;
 };
 
+struct corebth_gatt_char_io_finished_event
+{
+    struct corebth_gatt_characteristic characteristic;
+    void *irp;
+    int32_t result;
+    uint32_t size;
+    uint8_t value[512];
+};
+
 struct corebth_watcher_event
 {
     enum corebth_watcher_event_type event_type;
@@ -263,6 +283,8 @@ struct corebth_watcher_event
         struct corebth_gatt_service_removed_event gatt_service_removed;
         struct corebth_gatt_char_added_event gatt_char_added;
         struct corebth_gatt_char_removed_event gatt_char_removed;
+        struct corebth_gatt_characteristic gatt_char_value_changed;
+        struct corebth_gatt_char_io_finished_event gatt_char_io_finished;
     } data;
 };
 
@@ -294,6 +316,8 @@ struct corebth_peripheral_entry
     uint16_t next_service_handle;
     void *peripheral_delegate;
     dispatch_semaphore_t services_discovered;
+    /* Signalled when CoreBluetooth can take write-without-response requests again. */
+    dispatch_semaphore_t write_ready;
     int services_discovery_complete;
     int pending_char_discovery_count;  /* Number of services awaiting char discovery */
     int char_discovery_started;  /* Guard against duplicate didDiscoverServices callbacks */
@@ -315,17 +339,25 @@ struct corebth_service_entry
     uint16_t next_char_handle;
 };
 
-struct corebth_notification_entry
+#define COREBTH_MAX_CHAR_VALUE_SIZE 512
+#define COREBTH_DEVICE_DISCONNECTED ((corebth_status)0xC000020B)
+#define COREBTH_CANCELLED           ((corebth_status)0xC0000120)
+#define COREBTH_IO_TIMEOUT          ((corebth_status)0xC00000B5)
+
+/* A read or write request from winebth.sys waiting for its CoreBluetooth callback. CoreBluetooth answers the
+ * requests for a characteristic in the order they were made, so these are kept in a FIFO. */
+struct corebth_gatt_io
 {
-    struct corebth_notification_entry *next;
-    unsigned char *data;
-    unsigned int data_len;
+    struct corebth_gatt_io *next;
+    void *irp;
 };
 
-#define COREBTH_MAX_CHAR_VALUE_SIZE 512
-#define COREBTH_IDLE               ((corebth_status)0)
-#define COREBTH_CANCELLED          ((corebth_status)0xC0000120)
-#define COREBTH_DEVICE_DISCONNECTED ((corebth_status)0xC000020B)
+struct corebth_gatt_io_queue
+{
+    struct corebth_gatt_io *head;
+    struct corebth_gatt_io *tail;
+    unsigned int in_flight;  /* Requests that have been handed to CoreBluetooth, i.e. sent on bt_queue */
+};
 
 struct corebth_char_entry
 {
@@ -335,26 +367,12 @@ struct corebth_char_entry
     CBCharacteristic *characteristic;
     struct unix_name *path;
     BTH_LE_GATT_CHARACTERISTIC props;
-    dispatch_semaphore_t pending_read;
-    dispatch_semaphore_t pending_write;
-    unsigned char *pending_read_buffer;
-    unsigned int pending_read_size;
-    unsigned int *pending_read_len;
-    _Atomic corebth_status pending_read_status;
-    _Atomic corebth_status pending_write_status;
     _Atomic BOOL invalidated;
-    _Atomic unsigned int pending_read_actual_len;
-    unsigned char pending_read_internal_buffer[COREBTH_MAX_CHAR_VALUE_SIZE];
-    uint32_t read_generation;
-    uint32_t read_completed_gen;
-    uint32_t write_generation;
-    uint32_t write_completed_gen;
+    struct corebth_gatt_io_queue reads;   /* Guarded by service_list_mutex */
+    struct corebth_gatt_io_queue writes;  /* Write requests with response, guarded by service_list_mutex */
     BOOL notifications_enabled;
-    BOOL read_awaiting_response;  /* Set on bt_queue right before readValueForCharacteristic */
     pthread_mutex_t notification_mutex;
-    dispatch_semaphore_t notification_semaphore;
-    struct corebth_notification_entry *notification_queue_head;
-    struct corebth_notification_entry *notification_queue_tail;
+    struct notification_ring *notifications;  /* Guarded by notification_mutex */
     int ref_count;
     unsigned char *cached_value;
     unsigned int cached_value_len;
@@ -368,6 +386,8 @@ struct corebth_context
     dispatch_queue_t bt_queue;
 
     pthread_mutex_t event_mutex;
+    /* Signalled when an event gets queued, or when the context gets closed. */
+    pthread_cond_t event_cond;
     struct corebth_event_entry *event_head;
     struct corebth_event_entry *event_tail;
 
@@ -383,32 +403,15 @@ struct corebth_context
     int initialized;
     int radio_added;
     int discovering;
+    /* Applied to the next scan, as well as to the one in progress. Guarded by peripheral_mutex. */
+    struct winebluetooth_discovery_filter discovery_filter;
     CBManagerState state;
     CBManagerState last_state;
 
-    uintptr_t radio_handle;
+    /* There is only ever the one radio, so its name is created along with the context. */
+    struct unix_name *radio_name;
 };
 
-static inline void char_set_read_status(struct corebth_char_entry *ch, corebth_status status)
-{
-    atomic_store_explicit(&ch->pending_read_status, status, memory_order_release);
-}
-
-static inline corebth_status char_get_read_status(struct corebth_char_entry *ch)
-{
-    return atomic_load_explicit(&ch->pending_read_status, memory_order_acquire);
-}
-
-static inline void char_set_write_status(struct corebth_char_entry *ch, corebth_status status)
-{
-    atomic_store_explicit(&ch->pending_write_status, status, memory_order_release);
-}
-
-static inline corebth_status char_get_write_status(struct corebth_char_entry *ch)
-{
-    return atomic_load_explicit(&ch->pending_write_status, memory_order_acquire);
-}
-
 static inline void char_set_invalidated(struct corebth_char_entry *ch)
 {
     atomic_store_explicit(&ch->invalidated, YES, memory_order_release);
@@ -436,14 +439,16 @@ static void corebth_queue_event(struct corebth_context *ctx, struct corebth_watc
         ctx->event_head = entry;
     }
     ctx->event_tail = entry;
+    bluetooth_stats_event_queued();
+    pthread_cond_signal(&ctx->event_cond);
     pthread_mutex_unlock(&ctx->event_mutex);
 }
 
+/* Needs to be called with event_mutex held. */
 static int corebth_dequeue_event(struct corebth_context *ctx, struct corebth_watcher_event *event)
 {
     struct corebth_event_entry *entry;
 
-    pthread_mutex_lock(&ctx->event_mutex);
     entry = ctx->event_head;
     if (entry) {
         ctx->event_head = entry->next;
@@ -451,11 +456,11 @@ static int corebth_dequeue_event(struct corebth_context *ctx, struct corebth_wat
             ctx->event_tail = NULL;
         }
     }
-    pthread_mutex_unlock(&ctx->event_mutex);
 
     if (entry) {
         *event = entry->event;
         free(entry);
+        bluetooth_stats_event_dequeued();
         return 1;
     }
     return 0;
@@ -511,8 +516,7 @@ static void corebth_queue_radio_added(struct corebth_context *ctx)
     radio_added->props.manufacturer = 0x004C;
     radio_added->props.version = 0x09;
 
-    ctx->radio_handle = (uintptr_t)ctx;
-    radio_added->radio.handle = ctx->radio_handle;
+    radio_added->radio.handle = unix_name_dup(ctx->radio_name)->handle;
 
     corebth_queue_event(ctx, &event);
     ctx->radio_added = 1;
@@ -524,7 +528,7 @@ static void corebth_queue_radio_removed(struct corebth_context *ctx)
 
     memset(&event, 0, sizeof(event));
     event.event_type = COREBTH_EVENT_RADIO_REMOVED;
-    event.data.radio_removed.handle = ctx->radio_handle;
+    event.data.radio_removed.handle = unix_name_dup(ctx->radio_name)->handle;
 
     corebth_queue_event(ctx, &event);
     ctx->radio_added = 0;
@@ -596,6 +600,7 @@ static struct corebth_peripheral_entry *corebth_add_peripheral(struct corebth_co
     entry->peripheral = (CBPeripheral *)CFBridgingRetain(peripheral);
     entry->next_service_handle = 1;
     entry->services_discovered = dispatch_semaphore_create(0);
+    entry->write_ready = dispatch_semaphore_create(0);
     entry->services_discovery_complete = 0;
     entry->pending_char_discovery_count = 0;
     entry->char_discovery_started = 0;
@@ -608,11 +613,13 @@ static struct corebth_peripheral_entry *corebth_add_peripheral(struct corebth_co
     if (!entry->name)
     {
         dispatch_release(entry->services_discovered);
+        dispatch_release(entry->write_ready);
         free(entry);
         return NULL;
     }
 
-    entry->handle = (uintptr_t)entry->name;
+    entry->handle = entry->name->handle;
+    entry->name->object = entry;
 
     entry->next = ctx->peripherals;
     ctx->peripherals = entry;
@@ -712,21 +719,11 @@ static void corebth_cbuuid_to_bthle(CBUUID *uuid, BTH_LE_UUID *out)
     corebth_cbuuid_to_guid(uuid, &out->Value.LongUuid);
 }
 
+/* Needs to be called with peripheral_mutex held. */
 static struct corebth_peripheral_entry *corebth_find_peripheral_by_name(struct corebth_context *ctx,
                                                                         struct unix_name *name)
 {
-    struct corebth_peripheral_entry *entry;
-
-    if (!name || !name->str)
-        return NULL;
-
-    for (entry = ctx->peripherals; entry; entry = entry->next)
-    {
-        if (entry->name && entry->name->str && strcmp(entry->name->str, name->str) == 0)
-            return entry;
-    }
-
-    return NULL;
+    return name->object;
 }
 
 static struct corebth_peripheral_entry *corebth_find_peripheral_by_object(struct corebth_context *ctx,
@@ -779,16 +776,16 @@ static struct corebth_char_entry *corebth_find_char_by_cb(struct corebth_context
     return NULL;
 }
 
-static struct corebth_char_entry *corebth_find_char_by_path(struct corebth_context *ctx, const char *path)
+/* Needs to be called with service_list_mutex held. The entry is set as the object of its name for as long as it's
+ * linked into ctx->characteristics. */
+static struct corebth_char_entry *corebth_find_char_by_name(struct corebth_context *ctx, struct unix_name *name)
 {
-    struct corebth_char_entry *entry;
+    return name->object;
+}
 
-    for (entry = ctx->characteristics; entry; entry = entry->next_global)
-    {
-        if (entry->path && entry->path->str && !strcmp(entry->path->str, path))
-            return entry;
-    }
-    return NULL;
+static void corebth_unlink_char(struct corebth_char_entry *ch)
+{
+    if (ch->path && ch->path->object == ch) ch->path->object = NULL;
 }
 
 static void corebth_queue_service_added(struct corebth_context *ctx, struct corebth_service_entry *svc)
@@ -798,7 +795,7 @@ static void corebth_queue_service_added(struct corebth_context *ctx, struct core
     event.event_type = COREBTH_EVENT_GATT_SERVICE_ADDED;
     event.data.gatt_service_added.device.handle = svc->peripheral->handle;
     /* Duplicate unix_name references so winebth.sys takes ownership */
-    event.data.gatt_service_added.service.handle = (uintptr_t)unix_name_dup(svc->path);
+    event.data.gatt_service_added.service.handle = unix_name_dup(svc->path)->handle;
     event.data.gatt_service_added.attr_handle = svc->attr_handle;
     event.data.gatt_service_added.is_primary = svc->is_primary;
     event.data.gatt_service_added.uuid = svc->uuid;
@@ -811,27 +808,102 @@ static void corebth_queue_char_added(struct corebth_context *ctx, struct corebth
     memset(&event, 0, sizeof(event));
     event.event_type = COREBTH_EVENT_GATT_CHAR_ADDED;
     /* Duplicate unix_name references so winebth.sys takes ownership */
-    event.data.gatt_char_added.characteristic.handle = (uintptr_t)unix_name_dup(ch->path);
-    event.data.gatt_char_added.service.handle = (uintptr_t)unix_name_dup(ch->service->path);
+    event.data.gatt_char_added.characteristic.handle = unix_name_dup(ch->path)->handle;
+    event.data.gatt_char_added.service.handle = unix_name_dup(ch->service->path)->handle;
     event.data.gatt_char_added.props = ch->props;
     corebth_queue_event(ctx, &event);
 }
 
+/* Queued once discovery has finished and all GATT_CHAR_ADDED events for the peripheral are queued, so that
+ * winebth.sys can complete the GATT requests waiting for the device. */
+static void corebth_services_resolved_event(struct corebth_peripheral_entry *periph, struct corebth_watcher_event *event)
+{
+    struct corebth_device_props_changed_event *props_changed = &event->data.device_props_changed;
+
+    memset(event, 0, sizeof(*event));
+    event->event_type = COREBTH_EVENT_DEVICE_PROPS_CHANGED;
+    props_changed->changed_props_mask = WINEBLUETOOTH_DEVICE_PROPERTY_SERVICES_RESOLVED;
+    props_changed->props.services_resolved = 1;
+    corebth_uuid_to_address(periph->uuid_string, &props_changed->props.address);
+    props_changed->device.handle = periph->handle;
+}
+
+static void corebth_queue_char_value_changed(struct corebth_context *ctx, struct corebth_char_entry *ch)
+{
+    struct corebth_watcher_event event;
+    memset(&event, 0, sizeof(event));
+    event.event_type = COREBTH_EVENT_GATT_CHAR_VALUE_CHANGED;
+    /* Duplicate unix_name references so winebth.sys takes ownership */
+    event.data.gatt_char_value_changed.handle = unix_name_dup(ch->path)->handle;
+    corebth_queue_event(ctx, &event);
+}
+
+static void corebth_gatt_io_push(struct corebth_gatt_io_queue *queue, struct corebth_gatt_io *io)
+{
+    io->next = NULL;
+    if (queue->tail)
+        queue->tail->next = io;
+    else
+        queue->head = io;
+    queue->tail = io;
+}
+
+static struct corebth_gatt_io *corebth_gatt_io_pop(struct corebth_gatt_io_queue *queue)
+{
+    struct corebth_gatt_io *io = queue->head;
+
+    if (io) {
+        queue->head = io->next;
+        if (!queue->head) queue->tail = NULL;
+    }
+    return io;
+}
+
+static corebth_status corebth_error_to_status(NSError *error)
+{
+    if (!error) return COREBTH_SUCCESS;
+    /* CBATTErrorInvalidAttributeValueLength */
+    return error.code == 13 ? COREBTH_INVALID_PARAMETER : COREBTH_INTERNAL_ERROR;
+}
+
+static void corebth_queue_char_io_finished(struct corebth_context *ctx, struct corebth_char_entry *ch, void *irp,
+                                           corebth_status result, const void *value, unsigned int size)
+{
+    struct corebth_watcher_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.event_type = COREBTH_EVENT_GATT_CHAR_IO_FINISHED;
+    event.data.gatt_char_io_finished.characteristic.handle = unix_name_dup(ch->path)->handle;
+    event.data.gatt_char_io_finished.irp = irp;
+    event.data.gatt_char_io_finished.result = result;
+    if (value) {
+        event.data.gatt_char_io_finished.size = MIN(size, COREBTH_MAX_CHAR_VALUE_SIZE);
+        memcpy(event.data.gatt_char_io_finished.value, value, event.data.gatt_char_io_finished.size);
+    }
+    corebth_queue_event(ctx, &event);
+}
+
+/* Needs to be called with service_list_mutex held. */
+static void corebth_gatt_io_fail_all(struct corebth_context *ctx, struct corebth_char_entry *ch,
+                                     struct corebth_gatt_io_queue *queue, corebth_status status)
+{
+    struct corebth_gatt_io *io;
+
+    while ((io = corebth_gatt_io_pop(queue))) {
+        if (ctx) corebth_queue_char_io_finished(ctx, ch, io->irp, status, NULL, 0);
+        free(io);
+    }
+    queue->in_flight = 0;
+}
+
 static void corebth_free_char(struct corebth_char_entry *ch)
 {
+    /* winebth.sys fails the requests of removed characteristics itself. */
+    corebth_gatt_io_fail_all(NULL, ch, &ch->reads, COREBTH_DEVICE_DISCONNECTED);
+    corebth_gatt_io_fail_all(NULL, ch, &ch->writes, COREBTH_DEVICE_DISCONNECTED);
     if (ch->path) unix_name_free(ch->path);
-    if (ch->pending_read) dispatch_release(ch->pending_read);
-    if (ch->pending_write) dispatch_release(ch->pending_write);
-    if (ch->notification_semaphore) dispatch_release(ch->notification_semaphore);
     pthread_mutex_destroy(&ch->notification_mutex);
-
-    struct corebth_notification_entry *n = ch->notification_queue_head;
-    while (n) {
-        struct corebth_notification_entry *next = n->next;
-        free(n->data);
-        free(n);
-        n = next;
-    }
+    if (ch->notifications) notification_ring_destroy(ch->notifications);
     free(ch->cached_value);
     if (ch->characteristic) CFBridgingRelease(ch->characteristic);
     free(ch);
@@ -899,7 +971,7 @@ static void corebth_queue_service_removed(struct corebth_context *ctx, struct co
     struct corebth_watcher_event event;
     memset(&event, 0, sizeof(event));
     event.event_type = COREBTH_EVENT_GATT_SERVICE_REMOVED;
-    event.data.gatt_service_removed.service.handle = (uintptr_t)svc->path;
+    event.data.gatt_service_removed.service.handle = unix_name_dup(svc->path)->handle;
     corebth_queue_event(ctx, &event);
 }
 
@@ -931,6 +1003,7 @@ static void corebth_clear_peripheral_services(struct corebth_context *ctx, struc
             if (*prev_char)
                 *prev_char = ch->next_global;
 
+            corebth_unlink_char(ch);
             corebth_char_release(ch);
         }
 
@@ -941,7 +1014,7 @@ static void corebth_clear_peripheral_services(struct corebth_context *ctx, struc
     periph->services = NULL;
 }
 
-static void corebth_invalidate_peripheral_chars(struct corebth_peripheral_entry *periph)
+static void corebth_invalidate_peripheral_chars(struct corebth_context *ctx, struct corebth_peripheral_entry *periph)
 {
     struct corebth_service_entry *svc;
     struct corebth_char_entry *ch;
@@ -952,11 +1025,8 @@ static void corebth_invalidate_peripheral_chars(struct corebth_peripheral_entry
         for (ch = svc->chars; ch; ch = ch->next)
         {
             char_set_invalidated(ch);
-            char_set_read_status(ch, COREBTH_DEVICE_DISCONNECTED);
-            char_set_write_status(ch, COREBTH_DEVICE_DISCONNECTED);
-            ch->read_awaiting_response = NO;  /* Clear flag to prevent stale state */
-            dispatch_semaphore_signal(ch->pending_read);
-            dispatch_semaphore_signal(ch->pending_write);
+            corebth_gatt_io_fail_all(ctx, ch, &ch->reads, COREBTH_DEVICE_DISCONNECTED);
+            corebth_gatt_io_fail_all(ctx, ch, &ch->writes, COREBTH_DEVICE_DISCONNECTED);
         }
     }
 }
@@ -995,17 +1065,10 @@ static struct corebth_char_entry *corebth_add_char(struct corebth_context *ctx,
 
     entry->service = svc;
     entry->characteristic = (CBCharacteristic *)CFBridgingRetain(characteristic);
-    entry->pending_read = dispatch_semaphore_create(0);
-    entry->pending_write = dispatch_semaphore_create(0);
-    char_set_read_status(entry, COREBTH_IDLE);
-    char_set_write_status(entry, COREBTH_IDLE);
     atomic_store_explicit(&entry->invalidated, NO, memory_order_release);
     entry->notifications_enabled = FALSE;
-    entry->read_awaiting_response = NO;
     pthread_mutex_init(&entry->notification_mutex, NULL);
-    entry->notification_semaphore = dispatch_semaphore_create(0);
-    entry->notification_queue_head = NULL;
-    entry->notification_queue_tail = NULL;
+    entry->notifications = NULL;
     entry->ref_count = 1;
 
     uint16_t char_handle = svc->next_char_handle++;
@@ -1015,8 +1078,6 @@ static struct corebth_char_entry *corebth_add_char(struct corebth_context *ctx,
     entry->path = unix_name_get_or_create(path);
     if (!entry->path)
     {
-        if (entry->pending_read) dispatch_release(entry->pending_read);
-        if (entry->pending_write) dispatch_release(entry->pending_write);
         free(entry);
         return NULL;
     }
@@ -1025,6 +1086,7 @@ static struct corebth_char_entry *corebth_add_char(struct corebth_context *ctx,
     svc->chars = entry;
     entry->next_global = ctx->characteristics;
     ctx->characteristics = entry;
+    entry->path->object = entry;
     return entry;
 }
 
@@ -1082,8 +1144,8 @@ static void corebth_queue_device_added(struct corebth_context *ctx,
                 device_added->props.trusted = 0;
                 device_added->props.device_class = 0;
                 /* Duplicate unix_name references so winebth.sys takes ownership */
-                device_added->device.handle = (uintptr_t)unix_name_dup(entry->name);
-                device_added->radio.handle = ctx->radio_handle;
+                device_added->device.handle = unix_name_dup(entry->name)->handle;
+                device_added->radio.handle = unix_name_dup(ctx->radio_name)->handle;
                 device_added->init_entry = 0;
 
                 goto send_device_added;
@@ -1153,7 +1215,7 @@ static void corebth_queue_device_added(struct corebth_context *ctx,
 
     unix_name_dup(entry->name);
     device_added->device.handle = entry->handle;
-    device_added->radio.handle = ctx->radio_handle;
+    device_added->radio.handle = unix_name_dup(ctx->radio_name)->handle;
     device_added->init_entry = 0;
 
     if (is_cached_name) {
@@ -1162,6 +1224,11 @@ static void corebth_queue_device_added(struct corebth_context *ctx,
     }
 
 send_device_added:
+    /* CoreBluetooth reports 127 when it couldn't measure the signal strength. */
+    if ([rssi intValue] != 127)
+        device_added->props.rssi = [rssi intValue];
+    else
+        device_added->known_props_mask &= ~WINEBLUETOOTH_DEVICE_PROPERTY_RSSI;
     entry->device_added = 1;
 
     pthread_mutex_unlock(&ctx->peripheral_mutex);
@@ -1206,7 +1273,15 @@ send_device_added:
     /* NSLog(@"Wine: discovered peripheral: %@ name: %@", [peripheral.identifier UUIDString], peripheral.name); */
 
     if (self.ctx && self.ctx->discovering) {
-        corebth_queue_device_added(self.ctx, peripheral, advertisementData, RSSI);
+        BOOL too_weak;
+
+        /* CoreBluetooth can't filter on signal strength itself, so do it before anything gets queued. */
+        pthread_mutex_lock(&self.ctx->peripheral_mutex);
+        too_weak = (self.ctx->discovery_filter.flags & BLUETOOTH_DISCOVERY_FILTER_RSSI) &&
+                   [RSSI intValue] != 127 && [RSSI intValue] < self.ctx->discovery_filter.rssi;
+        pthread_mutex_unlock(&self.ctx->peripheral_mutex);
+        if (!too_weak)
+            corebth_queue_device_added(self.ctx, peripheral, advertisementData, RSSI);
     }
 }
 
@@ -1262,15 +1337,17 @@ send_device_added:
             }
 
             pthread_mutex_lock(&self.ctx->service_list_mutex);
-            corebth_invalidate_peripheral_chars(entry);
+            corebth_invalidate_peripheral_chars(self.ctx, entry);
             corebth_clear_peripheral_services(self.ctx, entry);
             pthread_mutex_unlock(&self.ctx->service_list_mutex);
 
             memset(&props_event, 0, sizeof(props_event));
             props_event.event_type = COREBTH_EVENT_DEVICE_PROPS_CHANGED;
-            props_changed->changed_props_mask = WINEBLUETOOTH_DEVICE_PROPERTY_CONNECTED;
+            props_changed->changed_props_mask = WINEBLUETOOTH_DEVICE_PROPERTY_CONNECTED |
+                                                WINEBLUETOOTH_DEVICE_PROPERTY_SERVICES_RESOLVED;
             props_changed->invalid_props_mask = 0;
             props_changed->props.connected = 0;
+            props_changed->props.services_resolved = 0;
             corebth_uuid_to_address(entry->uuid_string, &props_changed->props.address);
             props_changed->device.handle = entry->handle;
             pthread_mutex_unlock(&self.ctx->peripheral_mutex);
@@ -1359,8 +1436,12 @@ send_device_added:
 
 
         if (service_count == 0) {
+            struct corebth_watcher_event resolved_event;
+
             self.periph->services_discovery_complete = 1;
             dispatch_semaphore_signal(self.periph->services_discovered);
+            corebth_services_resolved_event(self.periph, &resolved_event);
+            corebth_queue_event(self.ctx, &resolved_event);
         } else {
             for (CBService *service in peripheral.services) {
                 @try {
@@ -1405,34 +1486,33 @@ done:
     if (self.periph) {
         int remaining = __sync_sub_and_fetch(&self.periph->pending_char_discovery_count, 1);
         if (remaining == 0) {
+            struct corebth_watcher_event resolved_event;
+
             self.periph->services_discovery_complete = 1;
 
             dispatch_semaphore_signal(self.periph->services_discovered);
+            corebth_services_resolved_event(self.periph, &resolved_event);
+            corebth_queue_event(self.ctx, &resolved_event);
         }
     }
 }
 
 - (void)peripheral:(CBPeripheral *)peripheral didUpdateValueForCharacteristic:(CBCharacteristic *)characteristic error:(NSError *)error
 {
-    NSLog(@"didUpdateValueForCharacteristic FIRED: char=%p uuid=%@ error=%@",
-        characteristic,
-        [characteristic.UUID UUIDString],
-        error ? [error description] : @"nil");
+    TRACE("char=%p uuid=%s error=%s\n", characteristic, [[characteristic.UUID UUIDString] UTF8String],
+          error ? [[error description] UTF8String] : "nil");
 
-    if (!self.ctx) {
-        NSLog(@"didUpdateValueForCharacteristic: self.ctx is nil!");
-        return;
-    }
+    if (!self.ctx) return;
 
     pthread_mutex_lock(&self.ctx->service_list_mutex);
     struct corebth_char_entry *ch = corebth_find_char_by_cb(self.ctx, characteristic);
     if (!ch) {
         pthread_mutex_unlock(&self.ctx->service_list_mutex);
-        NSLog(@"didUpdateValueForCharacteristic: corebth_find_char_by_cb returned NULL for char=%p", characteristic);
+        TRACE("unknown characteristic %p\n", characteristic);
         return;
     }
     corebth_char_retain(ch);
-    NSLog(@"didUpdateValueForCharacteristic: found ch=%p read_awaiting_response=%d", ch, ch->read_awaiting_response);
+    TRACE("ch=%p reads in flight=%u\n", ch, ch->reads.in_flight);
 
     if (char_is_invalidated(ch)) {
         pthread_mutex_unlock(&self.ctx->service_list_mutex);
@@ -1441,66 +1521,38 @@ done:
         return;
     }
 
-    uint32_t current_gen = ch->read_generation;
-    BOOL is_read_response = ch->read_awaiting_response;
-
-    /* CRITICAL: Check read_awaiting_response first. This flag is set ON bt_queue
-     * right before readValueForCharacteristic is called. Since bt_queue is serial,
-     * if this flag is YES, this callback MUST be the response to that read request,
-     * not a notification. This avoids the race condition where a notification
-     * arriving during a pending read was incorrectly processed as the read response. */
-    if (is_read_response)
+    /* Reads are only counted as in flight once they have been sent on bt_queue. Since bt_queue is serial, a
+     * callback that arrives while a read is in flight must be its response, not a notification. */
+    if (ch->reads.in_flight)
     {
-        /* Clear the flag immediately - we're handling the read response now */
-        ch->read_awaiting_response = NO;
-
+        struct corebth_gatt_io *io = corebth_gatt_io_pop(&ch->reads);
         NSData *data = characteristic.value;
-        if (error || !data) {
-
-            char_set_read_status(ch, COREBTH_INTERNAL_ERROR);
-            ch->pending_read_actual_len = 0;
-        } else {
-            uint32_t to_copy = MIN(COREBTH_MAX_CHAR_VALUE_SIZE, (uint32_t)data.length);
 
-            if (to_copy > 0 && data.bytes) {
-                memcpy(ch->pending_read_internal_buffer, data.bytes, to_copy);
-            }
-            ch->pending_read_actual_len = to_copy;
-            char_set_read_status(ch, COREBTH_SUCCESS);
+        ch->reads.in_flight--;
+        if (io) {
+            if (error || !data)
+                corebth_queue_char_io_finished(self.ctx, ch, io->irp, COREBTH_INTERNAL_ERROR, NULL, 0);
+            else
+                corebth_queue_char_io_finished(self.ctx, ch, io->irp, COREBTH_SUCCESS, data.bytes,
+                                               (unsigned int)data.length);
+            free(io);
         }
-        ch->read_completed_gen = current_gen;
-        dispatch_semaphore_signal(ch->pending_read);
     }
     else if (ch->notifications_enabled && !error)
     {
 
         NSData *data = characteristic.value;
-        struct corebth_notification_entry *notif_entry = calloc(1, sizeof(*notif_entry));
-        if (notif_entry && data.length > 0) {
-            notif_entry->data_len = (unsigned int)data.length;
-            notif_entry->data = malloc(notif_entry->data_len);
-            if (notif_entry->data) {
-                memcpy(notif_entry->data, data.bytes, notif_entry->data_len);
-                notif_entry->next = NULL;
-
-
-                pthread_mutex_lock(&ch->notification_mutex);
-
-                if (ch->notification_queue_tail) {
-                    ch->notification_queue_tail->next = notif_entry;
-                } else {
-                    ch->notification_queue_head = notif_entry;
-                }
-                ch->notification_queue_tail = notif_entry;
-                pthread_mutex_unlock(&ch->notification_mutex);
-
+        BOOL queued = FALSE;
 
-                dispatch_semaphore_signal(ch->notification_semaphore);
-
-            } else {
-                free(notif_entry);
-            }
+        if (data.length > 0) {
+            pthread_mutex_lock(&ch->notification_mutex);
+            if (ch->notifications)
+                queued = notification_ring_push(ch->notifications, data.bytes, (UINT32)data.length);
+            pthread_mutex_unlock(&ch->notification_mutex);
         }
+        /* Let the driver know, so that it can complete any pending READ_NOTIFICATION IRPs. */
+        if (queued)
+            corebth_queue_char_value_changed(self.ctx, ch);
 
     }
     else if (!error)
@@ -1542,26 +1594,29 @@ done:
         return;
     }
 
-    if (char_get_write_status(ch) == COREBTH_PENDING)
+    if (ch->writes.in_flight)
     {
-        if (error) {
-            long error_code = error.code;
-            if (error_code == 13) {
-                char_set_write_status(ch, COREBTH_INVALID_PARAMETER);
-            } else {
-                char_set_write_status(ch, COREBTH_INTERNAL_ERROR);
-            }
-        } else {
-            char_set_write_status(ch, COREBTH_SUCCESS);
+        struct corebth_gatt_io *io = corebth_gatt_io_pop(&ch->writes);
+
+        ch->writes.in_flight--;
+        if (io) {
+            corebth_queue_char_io_finished(self.ctx, ch, io->irp, corebth_error_to_status(error), NULL, 0);
+            free(io);
         }
-        ch->write_completed_gen = ch->write_generation;
-        dispatch_semaphore_signal(ch->pending_write);
     }
 
     pthread_mutex_unlock(&self.ctx->service_list_mutex);
     corebth_char_release(ch);
 }
 
+- (void)peripheralIsReadyToSendWriteWithoutResponse:(CBPeripheral *)peripheral
+{
+    if (!self.ctx || !self.periph)
+        return;
+
+    dispatch_semaphore_signal(self.periph->write_ready);
+}
+
 - (void)peripheral:(CBPeripheral *)peripheral didUpdateNotificationStateForCharacteristic:(CBCharacteristic *)characteristic error:(NSError *)error
 {
     if (!self.ctx) return;
@@ -1580,21 +1635,9 @@ done:
         return;
     }
 
-    if (char_get_write_status(ch) == COREBTH_PENDING)
-    {
-        if (error) {
-            long error_code = error.code;
-            if (error_code == 13) {
-                char_set_write_status(ch, COREBTH_INVALID_PARAMETER);
-            } else {
-                char_set_write_status(ch, COREBTH_INTERNAL_ERROR);
-            }
-        } else {
-            char_set_write_status(ch, COREBTH_SUCCESS);
-        }
-        ch->write_completed_gen = ch->write_generation;
-        dispatch_semaphore_signal(ch->pending_write);
-    }
+    /* corebth_characteristic_set_notify doesn't wait for this, so there is nobody to report errors to. */
+    if (error)
+        WARN("char=%p error=%s\n", characteristic, [[error description] UTF8String]);
 
     pthread_mutex_unlock(&self.ctx->service_list_mutex);
     corebth_char_release(ch);
@@ -1611,6 +1654,7 @@ void *corebth_init( void )
     if (!ctx) return NULL;
 
     pthread_mutex_init( &ctx->event_mutex, NULL );
+    pthread_cond_init( &ctx->event_cond, NULL );
     pthread_mutex_init( &ctx->peripheral_mutex, NULL );
     pthread_mutex_init( &ctx->service_list_mutex, NULL );
     ctx->event_head = NULL;
@@ -1621,11 +1665,20 @@ void *corebth_init( void )
     ctx->next_peripheral_handle = 0;
     ctx->radio_added = 0;
     ctx->discovering = 0;
+    memset( &ctx->discovery_filter, 0, sizeof(ctx->discovery_filter) );
+    ctx->discovery_filter.flags = BLUETOOTH_DISCOVERY_FILTER_DUPLICATE_DATA;
     ctx->last_state = CBManagerStateUnknown;
 
+    if (!(ctx->radio_name = unix_name_get_or_create( "/org/wine/corebth/hci0" )))
+    {
+        free( ctx );
+        return NULL;
+    }
+
     ctx->bt_queue = dispatch_queue_create( "org.winehq.bluetooth", DISPATCH_QUEUE_SERIAL );
     if (!ctx->bt_queue)
     {
+        unix_name_free( ctx->radio_name );
         free( ctx );
         return NULL;
     }
@@ -1642,6 +1695,7 @@ void *corebth_init( void )
     if (!ctx->central_manager)
     {
         dispatch_release( ctx->bt_queue );
+        unix_name_free( ctx->radio_name );
         free( ctx );
         return NULL;
     }
@@ -1664,7 +1718,10 @@ void corebth_close( void *connection )
         ctx->central_manager = nil;
     }
 
+    pthread_mutex_lock(&ctx->event_mutex);
     ctx->initialized = 0;
+    pthread_cond_broadcast(&ctx->event_cond);
+    pthread_mutex_unlock(&ctx->event_mutex);
 }
 
 void corebth_free( void *connection )
@@ -1696,7 +1753,13 @@ void corebth_free( void *connection )
             CFRelease(peripheral->peripheral_delegate);
         if (peripheral->services_discovered)
             dispatch_release(peripheral->services_discovered);
-        if (peripheral->name) unix_name_free(peripheral->name);
+        if (peripheral->write_ready)
+            dispatch_release(peripheral->write_ready);
+        if (peripheral->name)
+        {
+            peripheral->name->object = NULL;
+            unix_name_free(peripheral->name);
+        }
         free(peripheral);
         peripheral = next_peripheral;
     }
@@ -1716,6 +1779,7 @@ void corebth_free( void *connection )
     struct corebth_char_entry *ch = ctx->characteristics;
     while (ch) {
         struct corebth_char_entry *next = ch->next_global;
+        corebth_unlink_char(ch);
         corebth_char_release(ch);
         ch = next;
     }
@@ -1737,6 +1801,7 @@ void corebth_free( void *connection )
     if (ctx->central_delegate)
         CFRelease((__bridge CFTypeRef)ctx->central_delegate);
 
+    pthread_cond_destroy( &ctx->event_cond );
     pthread_mutex_destroy( &ctx->event_mutex );
     pthread_mutex_destroy( &ctx->peripheral_mutex );
     pthread_mutex_destroy( &ctx->service_list_mutex );
@@ -1744,29 +1809,33 @@ void corebth_free( void *connection )
     if (global_context == ctx)
         global_context = NULL;
 
+    unix_name_free( ctx->radio_name );
     free( ctx );
 }
 
+/* struct corebth_event mirrors struct winebluetooth_event, so events is an array of max_count of them. */
 corebth_status corebth_loop( void *connection, void *watcher_ctx, void *auth_agent,
-                             void *result )
+                             void *events, UINT32 max_count, UINT32 *count )
 {
     struct corebth_context *ctx = connection;
-    struct corebth_event *evt = (struct corebth_event *)result;
+    struct corebth_event *evt = (struct corebth_event *)events;
     struct corebth_watcher_event watcher_event;
 
-    if (!ctx || !ctx->initialized)
+    *count = 0;
+    if (!ctx)
         return COREBTH_NOT_SUPPORTED;
 
-    while (1)
-    {
-        if (corebth_dequeue_event(ctx, &watcher_event)) {
-            evt->status = COREBTH_EVENT_WATCHER;
-            memcpy(&evt->data.watcher_event, &watcher_event, sizeof(watcher_event));
-            return COREBTH_PENDING;
-        }
-
-        usleep(100000);
+    pthread_mutex_lock(&ctx->event_mutex);
+    while (!ctx->event_head && ctx->initialized)
+        pthread_cond_wait(&ctx->event_cond, &ctx->event_mutex);
+    while (*count < max_count && corebth_dequeue_event(ctx, &watcher_event)) {
+        evt[*count].status = COREBTH_EVENT_WATCHER;
+        memcpy(&evt[*count].data.watcher_event, &watcher_event, sizeof(watcher_event));
+        (*count)++;
     }
+    pthread_mutex_unlock(&ctx->event_mutex);
+
+    return *count ? COREBTH_PENDING : COREBTH_SUCCESS;
 }
 
 corebth_status corebth_adapter_set_prop( void *connection, void *params )
@@ -1774,6 +1843,56 @@ corebth_status corebth_adapter_set_prop( void *connection, void *params )
     return COREBTH_NOT_SUPPORTED;
 }
 
+/* Starts scanning with the current discovery filter. If a scan is already in progress, CoreBluetooth replaces it.
+ * Transport is ignored, since CoreBluetooth only scans for LE devices. */
+static void corebth_scan_with_filter(struct corebth_context *ctx)
+{
+    struct winebluetooth_discovery_filter filter;
+
+    pthread_mutex_lock(&ctx->peripheral_mutex);
+    filter = ctx->discovery_filter;
+    pthread_mutex_unlock(&ctx->peripheral_mutex);
+
+    @autoreleasepool {
+        NSMutableArray<CBUUID *> *services = nil;
+        UINT32 i;
+
+        if (filter.uuids_count)
+        {
+            services = [NSMutableArray arrayWithCapacity:filter.uuids_count];
+            for (i = 0; i < filter.uuids_count && i < BLUETOOTH_DISCOVERY_FILTER_MAX_UUIDS; i++)
+            {
+                const GUID *uuid = &filter.uuids[i];
+                NSString *str = [NSString stringWithFormat:@"%08X-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X",
+                                 (unsigned int)uuid->Data1, uuid->Data2, uuid->Data3, uuid->Data4[0],
+                                 uuid->Data4[1], uuid->Data4[2], uuid->Data4[3], uuid->Data4[4],
+                                 uuid->Data4[5], uuid->Data4[6], uuid->Data4[7]];
+                [services addObject:[CBUUID UUIDWithString:str]];
+            }
+        }
+        [ctx->central_manager scanForPeripheralsWithServices:services
+                                                     options:@{CBCentralManagerScanOptionAllowDuplicatesKey:
+                                                               @(!!(filter.flags & BLUETOOTH_DISCOVERY_FILTER_DUPLICATE_DATA))}];
+    }
+}
+
+corebth_status corebth_adapter_set_discovery_filter( void *connection, const char *adapter_path,
+                                                     const struct winebluetooth_discovery_filter *filter )
+{
+    struct corebth_context *ctx = connection;
+
+    if (!ctx || !ctx->central_manager)
+        return COREBTH_NOT_SUPPORTED;
+
+    pthread_mutex_lock(&ctx->peripheral_mutex);
+    ctx->discovery_filter = *filter;
+    pthread_mutex_unlock(&ctx->peripheral_mutex);
+
+    if (ctx->discovering && ctx->state == CBManagerStatePoweredOn)
+        corebth_scan_with_filter(ctx);
+    return COREBTH_SUCCESS;
+}
+
 corebth_status corebth_adapter_start_discovery( void *connection, const char *adapter_path )
 {
     struct corebth_context *ctx = connection;
@@ -1785,10 +1904,7 @@ corebth_status corebth_adapter_start_discovery( void *connection, const char *ad
         return COREBTH_DEVICE_NOT_READY;
 
     ctx->discovering = 1;
-    @autoreleasepool {
-        [ctx->central_manager scanForPeripheralsWithServices:nil
-                                                     options:@{CBCentralManagerScanOptionAllowDuplicatesKey: @YES}];
-    }
+    corebth_scan_with_filter(ctx);
 
     return COREBTH_SUCCESS;
 }
@@ -1843,17 +1959,17 @@ corebth_status corebth_device_disconnect( void *connection, const char *device_p
     return COREBTH_NOT_SUPPORTED;
 }
 
-corebth_status corebth_device_start_pairing( void *connection, void *watcher_ctx,
-                                             void *device, void *irp )
+/* Connects to the peripheral, or rediscovers its services if it is connected already. services_sem is set to the
+ * semaphore that gets signalled once discovery finishes, or to NULL if the services are known already. */
+static corebth_status corebth_peripheral_connect( struct corebth_context *ctx, struct unix_name *device_name,
+                                                  dispatch_semaphore_t *services_sem )
 {
-    struct corebth_context *ctx = connection;
-    struct unix_name *device_name = (struct unix_name *)device;
+    struct corebth_watcher_event resolved_event;
     struct corebth_peripheral_entry *entry;
-    dispatch_semaphore_t services_sem;
     CBPeripheral *peripheral_to_connect;
-    BOOL already_discovered;
     CBPeripheralState peripheral_state;
 
+    *services_sem = NULL;
     if (!ctx || !device_name || !device_name->str)
         return COREBTH_NOT_SUPPORTED;
 
@@ -1866,17 +1982,19 @@ corebth_status corebth_device_start_pairing( void *connection, void *watcher_ctx
         return COREBTH_NOT_SUPPORTED;
     }
 
-    peripheral_to_connect = entry->peripheral;
-    services_sem = entry->services_discovered;
-    already_discovered = entry->services_discovery_complete;
-    peripheral_state = peripheral_to_connect.state;
-
-    if (already_discovered)
+    if (entry->services_discovery_complete)
     {
+        /* Report it again, winebth.sys may not have seen the device resolve its services. */
+        corebth_services_resolved_event(entry, &resolved_event);
         pthread_mutex_unlock(&ctx->peripheral_mutex);
+        corebth_queue_event(ctx, &resolved_event);
         return COREBTH_SUCCESS;
     }
 
+    peripheral_to_connect = entry->peripheral;
+    *services_sem = entry->services_discovered;
+    peripheral_state = peripheral_to_connect.state;
+
     entry->services_discovery_complete = 0;
     entry->char_discovery_started = 0;
 
@@ -1888,6 +2006,26 @@ corebth_status corebth_device_start_pairing( void *connection, void *watcher_ctx
     }
 
     pthread_mutex_unlock(&ctx->peripheral_mutex);
+    return COREBTH_SUCCESS;
+}
+
+/* Completion is reported through the CONNECTED and SERVICES_RESOLVED device properties. */
+corebth_status corebth_device_connect( void *connection, void *device )
+{
+    dispatch_semaphore_t services_sem;
+
+    return corebth_peripheral_connect(connection, device, &services_sem);
+}
+
+corebth_status corebth_device_start_pairing( void *connection, void *watcher_ctx,
+                                             void *device, void *irp )
+{
+    dispatch_semaphore_t services_sem;
+    corebth_status status;
+
+    status = corebth_peripheral_connect(connection, device, &services_sem);
+    if (status || !services_sem)
+        return status;
 
     /* Wait for service discovery to complete (max 10 seconds - some services may not respond) */
 
@@ -1908,307 +2046,303 @@ void corebth_watcher_close( void *connection, void *ctx )
 {
 }
 
-corebth_status corebth_characteristic_read( void *connection, const char *char_path,
-                                            unsigned char *buffer, unsigned int buffer_size,
-                                            unsigned int *len )
+/* Starts reading the characteristic's value, the result is reported through a COREBTH_EVENT_GATT_CHAR_IO_FINISHED
+ * event for irp once didUpdateValueForCharacteristic fires. */
+corebth_status corebth_characteristic_read( void *connection, void *watcher_ctx, struct unix_name *char_name,
+                                            void *irp )
 {
     struct corebth_context *ctx = connection;
     struct corebth_char_entry *ch;
-    dispatch_time_t timeout;
-    dispatch_semaphore_t sem;
-    corebth_status status;
+    struct corebth_gatt_io *io;
     CBPeripheral *peripheral;
     CBCharacteristic *characteristic;
 
-
-
-    if (!ctx || !buffer || !len) {
-
-        return COREBTH_NOT_SUPPORTED;
-    }
-
+    if (!ctx || !ctx->bt_queue) return COREBTH_NOT_SUPPORTED;
 
     pthread_mutex_lock(&ctx->service_list_mutex);
-
-    ch = corebth_find_char_by_path(ctx, char_path);
-
-    if (!ch) {
-
+    ch = corebth_find_char_by_name(ctx, char_name);
+    if (!ch || !ch->service || !ch->service->peripheral || !ch->service->peripheral->peripheral ||
+        !ch->characteristic) {
         pthread_mutex_unlock(&ctx->service_list_mutex);
         return COREBTH_NOT_SUPPORTED;
     }
 
+    peripheral = ch->service->peripheral->peripheral;
+    characteristic = ch->characteristic;
 
-    if (!ch->service) {
-
+    if (char_is_invalidated(ch) || peripheral.state != CBPeripheralStateConnected) {
         pthread_mutex_unlock(&ctx->service_list_mutex);
-        return COREBTH_NOT_SUPPORTED;
+        return COREBTH_DEVICE_NOT_READY;
     }
 
-    if (!ch->service->peripheral) {
-
+    /* A value that arrived without being asked for, and without notifications being enabled. */
+    if (ch->cached_value_valid && ch->cached_value && ch->cached_value_len > 0) {
+        corebth_queue_char_io_finished(ctx, ch, irp, COREBTH_SUCCESS, ch->cached_value, ch->cached_value_len);
+        ch->cached_value_valid = FALSE;
         pthread_mutex_unlock(&ctx->service_list_mutex);
-        return COREBTH_NOT_SUPPORTED;
+        return COREBTH_PENDING;
     }
 
-    if (!ch->service->peripheral->peripheral) {
-
+    if (!(io = calloc(1, sizeof(*io)))) {
         pthread_mutex_unlock(&ctx->service_list_mutex);
-        return COREBTH_NOT_SUPPORTED;
+        return COREBTH_INTERNAL_ERROR;
     }
+    io->irp = irp;
+    corebth_gatt_io_push(&ch->reads, io);
+    corebth_char_retain(ch);
+    pthread_mutex_unlock(&ctx->service_list_mutex);
 
-    if (!ch->characteristic) {
-
+    /* IMPORTANT: CoreBluetooth requires peripheral methods to be called from the same queue
+     * that the CBCentralManager was created with. Dispatch to bt_queue. */
+    dispatch_async(ctx->bt_queue, ^{
+        pthread_mutex_lock(&ctx->service_list_mutex);
+        /* The request has already been failed if the device got disconnected in the meantime. */
+        if (char_is_invalidated(ch)) {
+            pthread_mutex_unlock(&ctx->service_list_mutex);
+            corebth_char_release(ch);
+            return;
+        }
+        ch->reads.in_flight++;
         pthread_mutex_unlock(&ctx->service_list_mutex);
-        return COREBTH_NOT_SUPPORTED;
-    }
 
-    if (!ch->pending_read) {
+        @try {
+            [peripheral readValueForCharacteristic:characteristic];
+        }
+        @catch (NSException *exception) {
+            struct corebth_gatt_io *failed;
+
+            NSLog(@"corebth_characteristic_read: exception: %@", [exception description]);
+            pthread_mutex_lock(&ctx->service_list_mutex);
+            ch->reads.in_flight--;
+            if ((failed = corebth_gatt_io_pop(&ch->reads))) {
+                corebth_queue_char_io_finished(ctx, ch, failed->irp, COREBTH_INTERNAL_ERROR, NULL, 0);
+                free(failed);
+            }
+            pthread_mutex_unlock(&ctx->service_list_mutex);
+        }
+        corebth_char_release(ch);
+    });
+
+    return COREBTH_PENDING;
+}
 
+/* Writes without response succeed as soon as they have been handed to CoreBluetooth. Writes with response are
+ * reported through a COREBTH_EVENT_GATT_CHAR_IO_FINISHED event for irp once didWriteValueForCharacteristic fires. */
+corebth_status corebth_characteristic_write( void *connection, void *watcher_ctx, struct unix_name *char_name,
+                                             const unsigned char *value, unsigned int len,
+                                             int write_type, void *irp )
+{
+    struct corebth_context *ctx = connection;
+    struct corebth_char_entry *ch;
+    struct corebth_gatt_io *io = NULL;
+    CBCharacteristicWriteType cb_type = (write_type == 0) ? CBCharacteristicWriteWithResponse
+                                                          : CBCharacteristicWriteWithoutResponse;
+    CBPeripheral *peripheral;
+    CBCharacteristic *characteristic;
+    NSData *data;
+
+    if (!ctx || !ctx->bt_queue || (!value && len)) return COREBTH_NOT_SUPPORTED;
+
+    pthread_mutex_lock(&ctx->service_list_mutex);
+    ch = corebth_find_char_by_name(ctx, char_name);
+    if (!ch || !ch->service || !ch->service->peripheral || !ch->service->peripheral->peripheral ||
+        !ch->characteristic) {
         pthread_mutex_unlock(&ctx->service_list_mutex);
-        return COREBTH_INTERNAL_ERROR;
+        return COREBTH_NOT_SUPPORTED;
     }
 
     peripheral = ch->service->peripheral->peripheral;
     characteristic = ch->characteristic;
 
-    if (peripheral.state != CBPeripheralStateConnected) {
-
+    if (char_is_invalidated(ch) || !peripheral.delegate || peripheral.state != CBPeripheralStateConnected) {
         pthread_mutex_unlock(&ctx->service_list_mutex);
         return COREBTH_DEVICE_NOT_READY;
     }
-
-    if (ch->cached_value_valid && ch->cached_value && ch->cached_value_len > 0) {
-        unsigned int to_copy = MIN(buffer_size, ch->cached_value_len);
-
-        memcpy(buffer, ch->cached_value, to_copy);
-        *len = to_copy;
-        ch->cached_value_valid = FALSE;
+    if (len > [peripheral maximumWriteValueLengthForType:cb_type] ||
+        ((characteristic.properties & CBCharacteristicPropertyWrite) == 0 &&
+         (characteristic.properties & CBCharacteristicPropertyWriteWithoutResponse) == 0)) {
         pthread_mutex_unlock(&ctx->service_list_mutex);
-        return COREBTH_SUCCESS;
+        return COREBTH_INVALID_PARAMETER;
     }
 
-    uint32_t my_gen = ++ch->read_generation;
-    ch->read_completed_gen = 0;
-    char_set_read_status(ch, COREBTH_PENDING);
-    ch->pending_read_actual_len = 0;
-    sem = ch->pending_read;
+    if (cb_type == CBCharacteristicWriteWithResponse) {
+        if (!(io = calloc(1, sizeof(*io)))) {
+            pthread_mutex_unlock(&ctx->service_list_mutex);
+            return COREBTH_INTERNAL_ERROR;
+        }
+        io->irp = irp;
+        corebth_gatt_io_push(&ch->writes, io);
+    }
     corebth_char_retain(ch);
-
     pthread_mutex_unlock(&ctx->service_list_mutex);
 
     @autoreleasepool {
+        data = [NSData dataWithBytes:value length:len];
+
         /* IMPORTANT: CoreBluetooth requires peripheral methods to be called from the same queue
          * that the CBCentralManager was created with. Dispatch to bt_queue. */
-        if (!ctx->bt_queue) {
-            NSLog(@"corebth_characteristic_read: bt_queue is NULL!");
-            corebth_char_release(ch);
-            return COREBTH_INTERNAL_ERROR;
-        }
-
-        if (!peripheral.delegate) {
-            NSLog(@"corebth_characteristic_read: peripheral.delegate is nil!");
-            corebth_char_release(ch);
-            return COREBTH_INTERNAL_ERROR;
-        }
-
-        if (peripheral.state != CBPeripheralStateConnected) {
-            NSLog(@"corebth_characteristic_read: peripheral not connected (state=%ld)!",
-                (long)peripheral.state);
-            corebth_char_release(ch);
-            return COREBTH_DEVICE_NOT_READY;
-        }
-
-        NSLog(@"corebth_characteristic_read: calling readValueForCharacteristic for char=%p peripheral=%p delegate=%p",
-            (__bridge void *)characteristic, (__bridge void *)peripheral, (__bridge void *)peripheral.delegate);
+        dispatch_async(ctx->bt_queue, ^{
+            if (cb_type == CBCharacteristicWriteWithResponse) {
+                pthread_mutex_lock(&ctx->service_list_mutex);
+                if (char_is_invalidated(ch)) {
+                    pthread_mutex_unlock(&ctx->service_list_mutex);
+                    corebth_char_release(ch);
+                    return;
+                }
+                ch->writes.in_flight++;
+                pthread_mutex_unlock(&ctx->service_list_mutex);
+            }
 
-        dispatch_sync(ctx->bt_queue, ^{
             @try {
-                /* CRITICAL: Set this flag ON bt_queue right before the read call.
-                 * Since bt_queue is serial, the callback cannot run until this block completes.
-                 * This ensures the callback will see read_awaiting_response=YES and know
-                 * this is a read response, not a notification. */
-                ch->read_awaiting_response = YES;
-                NSLog(@"corebth_characteristic_read: dispatched to bt_queue, calling read NOW");
-                [peripheral readValueForCharacteristic:characteristic];
-                NSLog(@"corebth_characteristic_read: readValueForCharacteristic returned");
+                [peripheral writeValue:data
+                      forCharacteristic:characteristic
+                                   type:cb_type];
             }
             @catch (NSException *exception) {
-                NSLog(@"corebth_characteristic_read: exception: %@", [exception description]);
-                ch->read_awaiting_response = NO;
-                pthread_mutex_lock(&ctx->service_list_mutex);
-                char_set_read_status(ch, COREBTH_INTERNAL_ERROR);
-                ch->read_completed_gen = my_gen;
-                pthread_mutex_unlock(&ctx->service_list_mutex);
-                dispatch_semaphore_signal(sem);
+                struct corebth_gatt_io *failed;
+
+                NSLog(@"corebth_characteristic_write: exception: %@", [exception description]);
+                if (cb_type == CBCharacteristicWriteWithResponse) {
+                    pthread_mutex_lock(&ctx->service_list_mutex);
+                    ch->writes.in_flight--;
+                    if ((failed = corebth_gatt_io_pop(&ch->writes))) {
+                        corebth_queue_char_io_finished(ctx, ch, failed->irp, COREBTH_INTERNAL_ERROR, NULL, 0);
+                        free(failed);
+                    }
+                    pthread_mutex_unlock(&ctx->service_list_mutex);
+                }
             }
-        });
-    }
-
-
-    timeout = dispatch_time(DISPATCH_TIME_NOW, 5 * NSEC_PER_SEC);
-    dispatch_semaphore_wait(sem, timeout);
-
-    pthread_mutex_lock(&ctx->service_list_mutex);
-
-    if (ch->read_completed_gen == my_gen) {
-        uint32_t result_len = ch->pending_read_actual_len;
-
-        if (result_len > 0 && result_len <= buffer_size) {
-            memcpy(buffer, ch->pending_read_internal_buffer, result_len);
-            *len = result_len;
-        } else if (result_len > buffer_size) {
-            /* Data larger than buffer - copy what fits */
-            memcpy(buffer, ch->pending_read_internal_buffer, buffer_size);
-            *len = buffer_size;
-        } else {
-            *len = 0;
-        }
-        status = char_get_read_status(ch);
-    } else {
-        /* Clear the read_awaiting_response flag on bt_queue since the callback
-         * never processed our read request. We dispatch_async because we're not
-         * on bt_queue here, and the flag must only be accessed from bt_queue. */
-        corebth_char_retain(ch);  /* prevent ch from being freed before block runs */
-        dispatch_async(ctx->bt_queue, ^{
-            ch->read_awaiting_response = NO;
             corebth_char_release(ch);
         });
-
-        NSData *cachedData = characteristic.value;
-        if (cachedData && cachedData.length > 0) {
-            unsigned int to_copy = MIN(buffer_size, (unsigned int)cachedData.length);
-
-            memcpy(buffer, cachedData.bytes, to_copy);
-            *len = to_copy;
-            status = COREBTH_SUCCESS;
-        } else {
-            *len = 0;
-            status = COREBTH_TIMEOUT;
-        }
     }
 
-    pthread_mutex_unlock(&ctx->service_list_mutex);
-    corebth_char_release(ch);
-    return status;
+    return io ? COREBTH_PENDING : COREBTH_SUCCESS;
 }
 
-corebth_status corebth_characteristic_write( void *connection, const char *char_path,
-                                             const unsigned char *value, unsigned int len,
-                                             int write_type )
+/* How often a blocked stream checks whether it got cancelled, and how long it may go without making any progress,
+ * both in milliseconds. */
+#define COREBTH_WRITE_POLL_INTERVAL 100
+#define COREBTH_WRITE_STALL_TIMEOUT 5000
+
+/* CoreBluetooth queues write-without-response requests internally, and only reports how much room is left through
+ * canSendWriteWithoutResponse. Once that is false, the stream waits for peripheralIsReadyToSendWriteWithoutResponse:
+ * before handing it the next packet. */
+corebth_status corebth_characteristic_write_stream( void *connection, struct unix_name *char_name,
+                                                    const unsigned char *value, unsigned int len,
+                                                    const volatile BOOLEAN *cancel, unsigned int *mtu,
+                                                    unsigned int *packets, unsigned int *written )
 {
     struct corebth_context *ctx = connection;
     struct corebth_char_entry *ch;
-    dispatch_time_t timeout;
-    dispatch_semaphore_t sem;
-    CBCharacteristicWriteType cb_type = (write_type == 0) ? CBCharacteristicWriteWithResponse
-                                                          : CBCharacteristicWriteWithoutResponse;
-    CBPeripheral *peripheral;
+    dispatch_semaphore_t write_ready;
     CBCharacteristic *characteristic;
-    NSUInteger max_write_len;
-    long wait_result;
-    corebth_status status;
-    BOOL write_without_response = NO;
+    CBPeripheral *peripheral;
+    __block corebth_status status = COREBTH_SUCCESS;
+    unsigned int chunk, stalled = 0;
 
-    if (!ctx || !value) {
-        return COREBTH_NOT_SUPPORTED;
-    }
+    if (!ctx || !ctx->bt_queue || (!value && len)) return COREBTH_NOT_SUPPORTED;
 
     pthread_mutex_lock(&ctx->service_list_mutex);
-    ch = corebth_find_char_by_path(ctx, char_path);
-    if (!ch || !ch->service || !ch->service->peripheral || !ch->service->peripheral->peripheral) {
+    ch = corebth_find_char_by_name(ctx, char_name);
+    if (!ch || !ch->service || !ch->service->peripheral || !ch->service->peripheral->peripheral ||
+        !ch->characteristic) {
         pthread_mutex_unlock(&ctx->service_list_mutex);
         return COREBTH_NOT_SUPPORTED;
     }
 
     peripheral = ch->service->peripheral->peripheral;
     characteristic = ch->characteristic;
+    write_ready = ch->service->peripheral->write_ready;
 
-    uint32_t my_gen = ++ch->write_generation;
-    ch->write_completed_gen = 0;
-    char_set_write_status(ch, COREBTH_PENDING);
-    sem = ch->pending_write;
+    if (char_is_invalidated(ch) || !peripheral.delegate || peripheral.state != CBPeripheralStateConnected) {
+        pthread_mutex_unlock(&ctx->service_list_mutex);
+        return COREBTH_DEVICE_NOT_READY;
+    }
+    if (!(characteristic.properties & CBCharacteristicPropertyWriteWithoutResponse)) {
+        pthread_mutex_unlock(&ctx->service_list_mutex);
+        return COREBTH_INVALID_PARAMETER;
+    }
+    chunk = [peripheral maximumWriteValueLengthForType:CBCharacteristicWriteWithoutResponse];
     corebth_char_retain(ch);
     pthread_mutex_unlock(&ctx->service_list_mutex);
 
-    @autoreleasepool {
-        NSData *data = [NSData dataWithBytes:value length:len];
+    *mtu = chunk + 3;
+    while (*written < len && !status) {
+        unsigned int size = MIN(chunk, len - *written);
+        __block BOOL sent = FALSE;
 
-        if (!peripheral.delegate) {
-            char_set_write_status(ch, COREBTH_INTERNAL_ERROR);
-            dispatch_semaphore_signal(sem);
-            corebth_char_release(ch);
-            return COREBTH_INTERNAL_ERROR;
+        if (*cancel) {
+            status = COREBTH_CANCELLED;
+            break;
         }
-        if (peripheral.state != CBPeripheralStateConnected) {
-            char_set_write_status(ch, COREBTH_DEVICE_NOT_READY);
-            dispatch_semaphore_signal(sem);
-            corebth_char_release(ch);
-            return COREBTH_DEVICE_NOT_READY;
-        }
-        max_write_len = [peripheral maximumWriteValueLengthForType:cb_type];
-
-        if (len > max_write_len) {
-            char_set_write_status(ch, COREBTH_INVALID_PARAMETER);
-            dispatch_semaphore_signal(sem);
-            corebth_char_release(ch);
-            return COREBTH_INVALID_PARAMETER;
-        }
-        if ((characteristic.properties & CBCharacteristicPropertyWrite) == 0 &&
-            (characteristic.properties & CBCharacteristicPropertyWriteWithoutResponse) == 0) {
-            char_set_write_status(ch, COREBTH_INVALID_PARAMETER);
-            dispatch_semaphore_signal(sem);
-            corebth_char_release(ch);
-            return COREBTH_INVALID_PARAMETER;
-        }
-
-        /* IMPORTANT: CoreBluetooth requires peripheral methods to be called from the same queue
-         * that the CBCentralManager was created with. Dispatch to bt_queue. */
-        CBCharacteristic *char_to_write = characteristic;
-        dispatch_async(ctx->bt_queue, ^{
-            @try {
-                [peripheral writeValue:data
-                      forCharacteristic:char_to_write
-                                   type:cb_type];
 
-            }
-            @catch (NSException *exception) {
+        @autoreleasepool {
+            NSData *data = [NSData dataWithBytes:value + *written length:size];
 
-                pthread_mutex_lock(&ctx->service_list_mutex);
-                char_set_write_status(ch, COREBTH_INTERNAL_ERROR);
-                ch->write_completed_gen = my_gen;
-                pthread_mutex_unlock(&ctx->service_list_mutex);
-                dispatch_semaphore_signal(sem);
-            }
-        });
+            /* Peripheral methods have to be called on bt_queue, see corebth_characteristic_write. */
+            dispatch_sync(ctx->bt_queue, ^{
+                if (char_is_invalidated(ch) || peripheral.state != CBPeripheralStateConnected) {
+                    status = COREBTH_DEVICE_DISCONNECTED;
+                    return;
+                }
+                if (!peripheral.canSendWriteWithoutResponse)
+                    return;
+                @try {
+                    [peripheral writeValue:data
+                          forCharacteristic:characteristic
+                                       type:CBCharacteristicWriteWithoutResponse];
+                    sent = TRUE;
+                }
+                @catch (NSException *exception) {
+                    NSLog(@"corebth_characteristic_write_stream: exception: %@", [exception description]);
+                    status = COREBTH_INTERNAL_ERROR;
+                }
+            });
+        }
 
-        if (cb_type == CBCharacteristicWriteWithoutResponse) {
-            write_without_response = YES;
+        if (sent) {
+            stalled = 0;
+            *written += size;
+            (*packets)++;
+        }
+        else if (!status && dispatch_semaphore_wait(write_ready, dispatch_time(DISPATCH_TIME_NOW,
+                                                    COREBTH_WRITE_POLL_INTERVAL * NSEC_PER_MSEC)) &&
+                 (stalled += COREBTH_WRITE_POLL_INTERVAL) >= COREBTH_WRITE_STALL_TIMEOUT) {
+            status = COREBTH_IO_TIMEOUT;
         }
     }
 
-    if (write_without_response) {
-        corebth_char_release(ch);
-        return COREBTH_SUCCESS;
-    }
+    corebth_char_release(ch);
+    return status;
+}
 
-    timeout = dispatch_time(DISPATCH_TIME_NOW, 5 * NSEC_PER_SEC);
-    wait_result = dispatch_semaphore_wait(sem, timeout);
+corebth_status corebth_characteristic_get_mtu( void *connection, struct unix_name *char_name, unsigned int *mtu )
+{
+    struct corebth_context *ctx = connection;
+    struct corebth_char_entry *ch;
+    CBPeripheral *peripheral;
+    corebth_status status = COREBTH_SUCCESS;
+
+    if (!ctx) return COREBTH_NOT_SUPPORTED;
 
     pthread_mutex_lock(&ctx->service_list_mutex);
-    if (ch->write_completed_gen == my_gen) {
-        status = char_get_write_status(ch);
-    } else {
-        status = COREBTH_TIMEOUT;
+    ch = corebth_find_char_by_name(ctx, char_name);
+    if (!ch || !ch->service || !ch->service->peripheral || !ch->service->peripheral->peripheral) {
+        pthread_mutex_unlock(&ctx->service_list_mutex);
+        return COREBTH_NOT_SUPPORTED;
     }
+    peripheral = ch->service->peripheral->peripheral;
+    /* CoreBluetooth doesn't tell the MTU itself, only the largest value that fits into a write command. */
+    if (peripheral.state != CBPeripheralStateConnected)
+        status = COREBTH_DEVICE_NOT_READY;
+    else
+        *mtu = [peripheral maximumWriteValueLengthForType:CBCharacteristicWriteWithoutResponse] + 3;
     pthread_mutex_unlock(&ctx->service_list_mutex);
-
-    corebth_char_release(ch);
     return status;
 }
 
-corebth_status corebth_characteristic_set_notify( void *connection, const char *char_path,
-                                                  int enable )
+corebth_status corebth_characteristic_set_notify( void *connection, struct unix_name *char_name,
+                                                  int enable, unsigned int overflow_policy )
 {
     struct corebth_context *ctx = connection;
     struct corebth_char_entry *ch;
@@ -2218,7 +2352,7 @@ corebth_status corebth_characteristic_set_notify( void *connection, const char *
     if (!ctx) return COREBTH_NOT_SUPPORTED;
 
     pthread_mutex_lock(&ctx->service_list_mutex);
-    ch = corebth_find_char_by_path(ctx, char_path);
+    ch = corebth_find_char_by_name(ctx, char_name);
     if (!ch || !ch->service || !ch->service->peripheral || !ch->service->peripheral->peripheral) {
         pthread_mutex_unlock(&ctx->service_list_mutex);
         return COREBTH_NOT_SUPPORTED;
@@ -2231,6 +2365,21 @@ corebth_status corebth_characteristic_set_notify( void *connection, const char *
     corebth_char_retain(ch);
     pthread_mutex_unlock(&ctx->service_list_mutex);
 
+    /* Values that were queued before notifications got disabled can still be read, the queue is only freed along
+     * with the characteristic. */
+    if (enable) {
+        pthread_mutex_lock(&ch->notification_mutex);
+        if (ch->notifications)
+            notification_ring_set_policy(ch->notifications, overflow_policy);
+        else
+            ch->notifications = notification_ring_create(overflow_policy);
+        pthread_mutex_unlock(&ch->notification_mutex);
+        if (!ch->notifications) {
+            corebth_char_release(ch);
+            return COREBTH_INTERNAL_ERROR;
+        }
+    }
+
     /* IMPORTANT: CoreBluetooth requires peripheral methods to be called from the same queue
      * that the CBCentralManager was created with. Dispatch to bt_queue. */
     @autoreleasepool {
@@ -2246,70 +2395,95 @@ corebth_status corebth_characteristic_set_notify( void *connection, const char *
     return COREBTH_SUCCESS;
 }
 
-corebth_status corebth_characteristic_read_notification( void *connection, const char *char_path,
+corebth_status corebth_characteristic_read_notification( void *connection, struct unix_name *char_name,
                                                          unsigned char *buffer, unsigned int buffer_size,
                                                          unsigned int *size )
 {
     struct corebth_context *ctx = connection;
     struct corebth_char_entry *ch;
-    struct corebth_notification_entry *notif_entry;
-    dispatch_time_t timeout;
-    long wait_result;
+    NTSTATUS status = STATUS_TIMEOUT;
 
     if (!ctx) return COREBTH_NOT_SUPPORTED;
     if (!buffer || !size) return COREBTH_INVALID_PARAMETER;
 
-
     pthread_mutex_lock(&ctx->service_list_mutex);
-
-    ch = corebth_find_char_by_path(ctx, char_path);
+    ch = corebth_find_char_by_name(ctx, char_name);
     if (!ch) {
         pthread_mutex_unlock(&ctx->service_list_mutex);
-
         return COREBTH_NOT_SUPPORTED;
     }
     corebth_char_retain(ch);
     pthread_mutex_unlock(&ctx->service_list_mutex);
 
+    /* Don't block, winebth.sys waits for a COREBTH_EVENT_GATT_CHAR_VALUE_CHANGED event instead. */
+    *size = 0;
+    pthread_mutex_lock(&ch->notification_mutex);
+    if (ch->notifications)
+        status = notification_ring_pop(ch->notifications, buffer, buffer_size, size);
+    pthread_mutex_unlock(&ch->notification_mutex);
 
-    timeout = dispatch_time(DISPATCH_TIME_NOW, 5LL * NSEC_PER_SEC);
-    wait_result = dispatch_semaphore_wait(ch->notification_semaphore, timeout);
+    corebth_char_release(ch);
+    return status == STATUS_SUCCESS ? COREBTH_SUCCESS : COREBTH_TIMEOUT;
+}
 
-    if (wait_result != 0) {
-        
-        *size = 0;
-        corebth_char_release(ch);
-        return COREBTH_TIMEOUT;
+corebth_status corebth_characteristic_read_notifications( void *connection, struct unix_name *char_name,
+                                                          unsigned char *buffer, unsigned int buffer_size,
+                                                          unsigned int max_count, unsigned int *count,
+                                                          unsigned int *size, unsigned int *overflow_count )
+{
+    struct corebth_context *ctx = connection;
+    struct corebth_char_entry *ch;
+    NTSTATUS status = STATUS_TIMEOUT;
+
+    if (!ctx) return COREBTH_NOT_SUPPORTED;
+    if (!buffer || !count || !size || !overflow_count) return COREBTH_INVALID_PARAMETER;
+
+    pthread_mutex_lock(&ctx->service_list_mutex);
+    ch = corebth_find_char_by_name(ctx, char_name);
+    if (!ch) {
+        pthread_mutex_unlock(&ctx->service_list_mutex);
+        return COREBTH_NOT_SUPPORTED;
     }
+    corebth_char_retain(ch);
+    pthread_mutex_unlock(&ctx->service_list_mutex);
 
+    *count = *size = *overflow_count = 0;
     pthread_mutex_lock(&ch->notification_mutex);
-    notif_entry = ch->notification_queue_head;
-    if (notif_entry) {
-        ch->notification_queue_head = notif_entry->next;
-        if (!ch->notification_queue_head) {
-            ch->notification_queue_tail = NULL;
-        }
-    }
+    if (ch->notifications)
+        status = notification_ring_drain(ch->notifications, buffer, buffer_size, max_count, count, size,
+                                         overflow_count);
     pthread_mutex_unlock(&ch->notification_mutex);
 
-    if (notif_entry) {
-        unsigned int to_copy = MIN(buffer_size, notif_entry->data_len);
-
-        memcpy(buffer, notif_entry->data, to_copy);
+    corebth_char_release(ch);
+    if (status == STATUS_SUCCESS) return COREBTH_SUCCESS;
+    if (status == STATUS_BUFFER_TOO_SMALL) return COREBTH_BUFFER_TOO_SMALL;
+    return COREBTH_TIMEOUT;
+}
 
-        *size = to_copy;
+corebth_status corebth_characteristic_get_notification_stats( void *connection, struct unix_name *char_name,
+                                                              struct bluetooth_gatt_notification_stats *stats )
+{
+    struct corebth_context *ctx = connection;
+    struct corebth_char_entry *ch;
 
-        free(notif_entry->data);
+    if (!ctx) return COREBTH_NOT_SUPPORTED;
 
-        free(notif_entry);
-        corebth_char_release(ch);
-        return COREBTH_SUCCESS;
+    pthread_mutex_lock(&ctx->service_list_mutex);
+    ch = corebth_find_char_by_name(ctx, char_name);
+    if (!ch) {
+        pthread_mutex_unlock(&ctx->service_list_mutex);
+        return COREBTH_NOT_SUPPORTED;
     }
+    corebth_char_retain(ch);
+    pthread_mutex_unlock(&ctx->service_list_mutex);
+
+    pthread_mutex_lock(&ch->notification_mutex);
+    if (ch->notifications)
+        notification_ring_get_stats(ch->notifications, stats);
+    pthread_mutex_unlock(&ch->notification_mutex);
 
-    
     corebth_char_release(ch);
-    *size = 0;
-    return COREBTH_NOT_SUPPORTED;
+    return COREBTH_SUCCESS;
 }
 
 #endif /* __APPLE__ */
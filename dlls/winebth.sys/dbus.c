@@ -27,12 +27,21 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <limits.h>
 #include <dlfcn.h>
 #include <assert.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <errno.h>
 #include <string.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 
 #ifdef SONAME_LIBDBUS_1
 #include <dbus/dbus.h>
@@ -165,6 +174,8 @@ static NTSTATUS bluez_dbus_error_to_ntstatus( const DBusError *error )
     DBUS_ERROR_CASE( "org.bluez.Error.ConnectionAttemptFailed", STATUS_DEVICE_NOT_CONNECTED);
     DBUS_ERROR_CASE( "org.bluez.Error.NotConnected", STATUS_DEVICE_NOT_CONNECTED );
     DBUS_ERROR_CASE( "org.bluez.Error.InProgress", STATUS_OPERATION_IN_PROGRESS );
+    DBUS_ERROR_CASE( "org.bluez.Error.NotSupported", STATUS_NOT_SUPPORTED );
+    DBUS_ERROR_CASE( "org.bluez.Error.NotPermitted", STATUS_ACCESS_DENIED );
     DBUS_ERROR_CASE( DBUS_ERROR_UNKNOWN_OBJECT, STATUS_INVALID_PARAMETER );
     DBUS_ERROR_CASE( DBUS_ERROR_NO_MEMORY, STATUS_NO_MEMORY );
     DBUS_ERROR_CASE( DBUS_ERROR_NOT_SUPPORTED, STATUS_NOT_SUPPORTED );
@@ -381,15 +392,84 @@ static NTSTATUS bluez_dbus_send_and_wait_for_reply( DBusConnection *connection,
     return bluez_dbus_pending_call_wait( pending_call, reply, error );
 }
 
-static NTSTATUS bluez_adapter_set_discovery_filter( void *connection, const char *adapter_path,
-                                                    const char *transport_str )
+static BOOL bluez_variant_dict_add_uuids( DBusMessageIter *dict, const char *key, const GUID *uuids, UINT32 count )
+{
+    DBusMessageIter entry, variant, array;
+    char buf[37];
+    UINT32 i;
+
+    if (!p_dbus_message_iter_open_container( dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry )) return FALSE;
+    if (!p_dbus_message_iter_append_basic( &entry, DBUS_TYPE_STRING, &key ))
+    {
+        p_dbus_message_iter_abandon_container( dict, &entry );
+        return FALSE;
+    }
+    if (!p_dbus_message_iter_open_container( &entry, DBUS_TYPE_VARIANT, "as", &variant ))
+    {
+        p_dbus_message_iter_abandon_container( dict, &entry );
+        return FALSE;
+    }
+    if (!p_dbus_message_iter_open_container( &variant, DBUS_TYPE_ARRAY, DBUS_TYPE_STRING_AS_STRING, &array ))
+    {
+        p_dbus_message_iter_abandon_container( &entry, &variant );
+        p_dbus_message_iter_abandon_container( dict, &entry );
+        return FALSE;
+    }
+    for (i = 0; i < count; i++)
+    {
+        const GUID *uuid = &uuids[i];
+        const char *str = buf;
+
+        snprintf( buf, sizeof( buf ), "%08x-%04x-%04x-%02x%02x-%02x%02x%02x%02x%02x%02x", (unsigned int)uuid->Data1,
+                  uuid->Data2, uuid->Data3, uuid->Data4[0], uuid->Data4[1], uuid->Data4[2], uuid->Data4[3],
+                  uuid->Data4[4], uuid->Data4[5], uuid->Data4[6], uuid->Data4[7] );
+        if (!p_dbus_message_iter_append_basic( &array, DBUS_TYPE_STRING, &str ))
+        {
+            p_dbus_message_iter_abandon_container( &variant, &array );
+            p_dbus_message_iter_abandon_container( &entry, &variant );
+            p_dbus_message_iter_abandon_container( dict, &entry );
+            return FALSE;
+        }
+    }
+    if (!p_dbus_message_iter_close_container( &variant, &array ))
+    {
+        p_dbus_message_iter_abandon_container( &entry, &variant );
+        p_dbus_message_iter_abandon_container( dict, &entry );
+        return FALSE;
+    }
+    if (!p_dbus_message_iter_close_container( &entry, &variant ))
+    {
+        p_dbus_message_iter_abandon_container( dict, &entry );
+        return FALSE;
+    }
+
+    return !!p_dbus_message_iter_close_container( dict, &entry );
+}
+
+static const char *bluez_discovery_transport_str( UINT32 transport )
+{
+    switch (transport)
+    {
+    case BLUETOOTH_DISCOVERY_TRANSPORT_BREDR: return "bredr";
+    case BLUETOOTH_DISCOVERY_TRANSPORT_LE: return "le";
+    default: return "auto";
+    }
+}
+
+/* Pushes the filter down to BlueZ, so that devices it excludes don't generate any InterfacesAdded or
+ * PropertiesChanged traffic for us to process. */
+NTSTATUS bluez_adapter_set_discovery_filter( void *connection, const char *adapter_path,
+                                             const struct winebluetooth_discovery_filter *filter )
 {
+    const char *transport_str = bluez_discovery_transport_str( filter->transport );
+    dbus_bool_t duplicate_data = !!(filter->flags & BLUETOOTH_DISCOVERY_FILTER_DUPLICATE_DATA);
     DBusMessage *request, *reply;
     DBusMessageIter iter, dict_iter;
     DBusError error;
     NTSTATUS status;
+    BOOL success;
 
-    TRACE( "(%p, %s, %s)\n", connection, debugstr_a( adapter_path ), debugstr_a( transport_str ) );
+    TRACE( "(%p, %s, %p)\n", connection, debugstr_a( adapter_path ), filter );
 
     request = p_dbus_message_new_method_call( BLUEZ_DEST, adapter_path, BLUEZ_INTERFACE_ADAPTER,
                                               "SetDiscoveryFilter" );
@@ -401,8 +481,17 @@ static NTSTATUS bluez_adapter_set_discovery_filter( void *connection, const char
         p_dbus_message_unref( request );
         return STATUS_NO_MEMORY;
     }
-    if (!bluez_variant_dict_add_entry( &dict_iter, "Transport", DBUS_TYPE_STRING,
-                                       DBUS_TYPE_STRING_AS_STRING, &transport_str ))
+    success = bluez_variant_dict_add_entry( &dict_iter, "Transport", DBUS_TYPE_STRING,
+                                            DBUS_TYPE_STRING_AS_STRING, &transport_str ) &&
+              bluez_variant_dict_add_entry( &dict_iter, "DuplicateData", DBUS_TYPE_BOOLEAN,
+                                            DBUS_TYPE_BOOLEAN_AS_STRING, &duplicate_data );
+    if (success && filter->flags & BLUETOOTH_DISCOVERY_FILTER_RSSI)
+        success = bluez_variant_dict_add_entry( &dict_iter, "RSSI", DBUS_TYPE_INT16, DBUS_TYPE_INT16_AS_STRING,
+                                                &filter->rssi );
+    if (success && filter->uuids_count)
+        success = bluez_variant_dict_add_uuids( &dict_iter, "UUIDs", filter->uuids,
+                                                min( filter->uuids_count, ARRAY_SIZE( filter->uuids ) ) );
+    if (!success)
     {
         p_dbus_message_iter_abandon_container( &iter, &dict_iter );
         p_dbus_message_unref( request );
@@ -416,8 +505,9 @@ static NTSTATUS bluez_adapter_set_discovery_filter( void *connection, const char
 
     p_dbus_error_init ( &error );
 
-    TRACE( "Setting discovery filter on %s to use transport %s\n", debugstr_a( adapter_path ),
-           debugstr_a( transport_str ) );
+    TRACE( "Setting discovery filter on %s: transport %s, flags %#x, rssi %d, %u UUIDs\n",
+           debugstr_a( adapter_path ), debugstr_a( transport_str ), filter->flags, filter->rssi,
+           filter->uuids_count );
     status = bluez_dbus_send_and_wait_for_reply( connection, request, &reply, &error );
     if (status)
     {
@@ -446,9 +536,6 @@ NTSTATUS bluez_adapter_start_discovery( void *connection, const char *adapter_pa
 
     TRACE( "(%p, %s)\n", connection, debugstr_a( adapter_path ) );
 
-    status = bluez_adapter_set_discovery_filter( connection, adapter_path, "bredr" );
-    if (status != STATUS_SUCCESS) return status;
-
     request = p_dbus_message_new_method_call( BLUEZ_DEST, adapter_path, BLUEZ_INTERFACE_ADAPTER,
                                               "StartDiscovery" );
     if (!request) return STATUS_NO_MEMORY;
@@ -546,7 +633,8 @@ NTSTATUS bluez_adapter_remove_device( void *connection, const char *adapter_path
     return STATUS_SUCCESS;
 }
 
-NTSTATUS bluez_adapter_set_prop( void *connection, struct bluetooth_adapter_set_prop_params *params )
+NTSTATUS bluez_adapter_set_prop( void *connection, struct unix_name *adapter,
+                                 struct bluetooth_adapter_set_prop_params *params )
 {
     DBusMessage *request, *reply;
     DBusMessageIter iter, sub_iter;
@@ -575,8 +663,8 @@ NTSTATUS bluez_adapter_set_prop( void *connection, struct bluetooth_adapter_set_
         return STATUS_INVALID_PARAMETER;
     }
 
-    TRACE( "Setting property %s for adapter %s\n", debugstr_a( prop_name ), debugstr_a( params->adapter->str ) );
-    request = p_dbus_message_new_method_call( BLUEZ_DEST, params->adapter->str,
+    TRACE( "Setting property %s for adapter %s\n", debugstr_a( prop_name ), debugstr_a( adapter->str ) );
+    request = p_dbus_message_new_method_call( BLUEZ_DEST, adapter->str,
                                               DBUS_INTERFACE_PROPERTIES, "Set" );
     if (!request) return STATUS_NO_MEMORY;
 
@@ -618,7 +706,7 @@ NTSTATUS bluez_adapter_set_prop( void *connection, struct bluetooth_adapter_set_
     if (!reply)
     {
         ERR( "Failed to set property %s for adapter %s: %s: %s\n", debugstr_a( prop_name ),
-             debugstr_a( params->adapter->str ), debugstr_a( error.name ), debugstr_a( error.message ) );
+             debugstr_a( adapter->str ), debugstr_a( error.name ), debugstr_a( error.message ) );
         status = bluez_dbus_error_to_ntstatus( &error );
         p_dbus_error_free( &error );
         return status;
@@ -721,6 +809,64 @@ static void bluez_radio_prop_from_dict_entry( const char *prop_name, DBusMessage
     }
 }
 
+/* Encodes the a{qv} ManufacturerData or a{sv} ServiceData property of a device like the data following a
+ * struct winebth_advertisement_record, and returns its size. Entries that don't fit get dropped. */
+static UINT16 bluez_advertisement_data_from_variant( DBusMessageIter *variant, BYTE *buffer, BOOL service_data )
+{
+    const SIZE_T key_size = service_data ? sizeof( GUID ) : sizeof( USHORT );
+    DBusMessageIter dict;
+    UINT16 size = 0;
+
+    if (p_dbus_message_iter_get_arg_type( variant ) != DBUS_TYPE_ARRAY) return 0;
+    for (p_dbus_message_iter_recurse( variant, &dict );
+         p_dbus_message_iter_get_arg_type( &dict ) == DBUS_TYPE_DICT_ENTRY;
+         p_dbus_message_iter_next( &dict ))
+    {
+        DBusMessageIter entry, value, bytes;
+        BYTE key[sizeof( GUID )];
+        const BYTE *data;
+        int data_size;
+
+        p_dbus_message_iter_recurse( &dict, &entry );
+        if (service_data)
+        {
+            const char *uuid_str;
+            GUID uuid;
+
+            if (p_dbus_message_iter_get_arg_type( &entry ) != DBUS_TYPE_STRING) continue;
+            p_dbus_message_iter_get_basic( &entry, &uuid_str );
+            if (!parse_uuid( &uuid, uuid_str )) continue;
+            memcpy( key, &uuid, sizeof( uuid ) );
+        }
+        else
+        {
+            dbus_uint16_t company_id;
+
+            if (p_dbus_message_iter_get_arg_type( &entry ) != DBUS_TYPE_UINT16) continue;
+            p_dbus_message_iter_get_basic( &entry, &company_id );
+            memcpy( key, &company_id, sizeof( company_id ) );
+        }
+        p_dbus_message_iter_next( &entry );
+        if (p_dbus_message_iter_get_arg_type( &entry ) != DBUS_TYPE_VARIANT) continue;
+        p_dbus_message_iter_recurse( &entry, &value );
+        if (p_dbus_message_iter_get_arg_type( &value ) != DBUS_TYPE_ARRAY ||
+            p_dbus_message_iter_get_element_type( &value ) != DBUS_TYPE_BYTE)
+            continue;
+        p_dbus_message_iter_recurse( &value, &bytes );
+        p_dbus_message_iter_get_fixed_array( &bytes, &data, &data_size );
+        if (data_size > UCHAR_MAX || size + key_size + 1 + data_size > WINEBLUETOOTH_MAX_ADVERTISEMENT_DATA_SIZE)
+        {
+            WARN( "Dropping %d bytes of %s data\n", data_size, service_data ? "service" : "manufacturer" );
+            continue;
+        }
+        memcpy( buffer + size, key, key_size );
+        buffer[size + key_size] = data_size;
+        memcpy( buffer + size + key_size + 1, data, data_size );
+        size += key_size + 1 + data_size;
+    }
+    return size;
+}
+
 static void bluez_device_prop_from_dict_entry( const char *prop_name, DBusMessageIter *variant,
                                                struct winebluetooth_device_properties *props,
                                                winebluetooth_device_props_mask_t *props_mask,
@@ -793,6 +939,16 @@ static void bluez_device_prop_from_dict_entry( const char *prop_name, DBusMessag
         props->trusted = !!trusted;
         *props_mask |= WINEBLUETOOTH_DEVICE_PROPERTY_TRUSTED;
     }
+    else if (wanted_props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_SERVICES_RESOLVED &&
+             !strcmp( prop_name, "ServicesResolved" ) &&
+             p_dbus_message_iter_get_arg_type( variant ) == DBUS_TYPE_BOOLEAN)
+    {
+        dbus_bool_t resolved;
+
+        p_dbus_message_iter_get_basic( variant, &resolved );
+        props->services_resolved = !!resolved;
+        *props_mask |= WINEBLUETOOTH_DEVICE_PROPERTY_SERVICES_RESOLVED;
+    }
     else if (wanted_props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_CLASS &&
              !strcmp( prop_name, "Class" ) &&
              p_dbus_message_iter_get_arg_type( variant ) == DBUS_TYPE_UINT32)
@@ -800,6 +956,29 @@ static void bluez_device_prop_from_dict_entry( const char *prop_name, DBusMessag
         p_dbus_message_iter_get_basic( variant, &props->class );
         *props_mask |= WINEBLUETOOTH_DEVICE_PROPERTY_CLASS;
     }
+    else if (wanted_props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_RSSI &&
+             !strcmp( prop_name, "RSSI" ) &&
+             p_dbus_message_iter_get_arg_type( variant ) == DBUS_TYPE_INT16)
+    {
+        dbus_int16_t rssi;
+
+        p_dbus_message_iter_get_basic( variant, &rssi );
+        props->rssi = rssi;
+        *props_mask |= WINEBLUETOOTH_DEVICE_PROPERTY_RSSI;
+    }
+    else if (wanted_props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_MANUFACTURER_DATA &&
+             !strcmp( prop_name, "ManufacturerData" ))
+    {
+        props->manufacturer_data_size = bluez_advertisement_data_from_variant( variant, props->manufacturer_data,
+                                                                               FALSE );
+        *props_mask |= WINEBLUETOOTH_DEVICE_PROPERTY_MANUFACTURER_DATA;
+    }
+    else if (wanted_props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_SERVICE_DATA &&
+             !strcmp( prop_name, "ServiceData" ))
+    {
+        props->service_data_size = bluez_advertisement_data_from_variant( variant, props->service_data, TRUE );
+        *props_mask |= WINEBLUETOOTH_DEVICE_PROPERTY_SERVICE_DATA;
+    }
 }
 
 static NTSTATUS bluez_adapter_get_props_async( void *connection, const char *radio_object_path,
@@ -863,6 +1042,13 @@ struct bluez_watcher_ctx
 
     /* struct bluez_watcher_event */
     struct list event_list;
+
+    /* struct bluez_device_props_update, by device */
+    struct rb_tree props_updates;
+    /* struct bluez_device_props_update, by deadline */
+    struct list props_update_timers;
+    /* In milliseconds, 0 if property changes are handed out as they come. */
+    UINT32 props_interval;
 };
 
 struct bluez_init_entry
@@ -904,6 +1090,77 @@ struct bluez_auth_agent_ctx
     DBusConnection *connection;
 };
 
+/* Wakes up bluez_dbus_loop when it is blocked in poll, and something it can't see on the DBus socket happened: an
+ * event got queued from another thread, a new AcquireNotify socket needs to be polled, or libdbus has messages to
+ * dispatch that were read by another thread. This is an eventfd where available, and a pipe otherwise.
+ * bluez_wakeup_fds[0] is read from, and bluez_wakeup_fds[1] is written to. */
+static int bluez_wakeup_fds[2] = { -1, -1 };
+static pthread_t bluez_loop_thread;
+static BOOL bluez_loop_thread_set;
+
+static BOOL bluez_wakeup_init( void )
+{
+#ifdef __linux__
+    int fd = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+
+    if (fd == -1) return FALSE;
+    bluez_wakeup_fds[0] = bluez_wakeup_fds[1] = fd;
+#else
+    int fds[2], i;
+
+    if (pipe( fds ) == -1) return FALSE;
+    for (i = 0; i < 2; i++)
+    {
+        fcntl( fds[i], F_SETFD, FD_CLOEXEC );
+        fcntl( fds[i], F_SETFL, fcntl( fds[i], F_GETFL ) | O_NONBLOCK );
+    }
+    bluez_wakeup_fds[0] = fds[0];
+    bluez_wakeup_fds[1] = fds[1];
+#endif
+    return TRUE;
+}
+
+static void bluez_wakeup_signal( void )
+{
+    UINT64 value = 1;
+    int fd = bluez_wakeup_fds[1];
+
+    /* No need to wake ourselves up, the loop checks the event queues before it waits again. */
+    if (fd == -1 || (bluez_loop_thread_set && pthread_equal( pthread_self(), bluez_loop_thread ))) return;
+#ifdef __linux__
+    write( fd, &value, sizeof( value ) );
+#else
+    write( fd, &value, 1 );
+#endif
+}
+
+static void bluez_wakeup_drain( void )
+{
+    UINT64 buffer[8];
+
+    while (read( bluez_wakeup_fds[0], buffer, sizeof( buffer ) ) > 0);
+}
+
+static void bluez_wakeup_free( void )
+{
+    int fds[2] = { bluez_wakeup_fds[0], bluez_wakeup_fds[1] };
+
+    bluez_wakeup_fds[0] = bluez_wakeup_fds[1] = -1;
+    close( fds[0] );
+    if (fds[1] != fds[0]) close( fds[1] );
+}
+
+static void bluez_dbus_wakeup_main( void *data )
+{
+    bluez_wakeup_signal();
+}
+
+static void bluez_dbus_dispatch_status_changed( DBusConnection *connection, DBusDispatchStatus status, void *data )
+{
+    if (status == DBUS_DISPATCH_DATA_REMAINS)
+        bluez_wakeup_signal();
+}
+
 void *bluez_dbus_init( void )
 {
     DBusError error;
@@ -922,6 +1179,14 @@ void *bluez_dbus_init( void )
         return NULL;
     }
 
+    if (bluez_wakeup_init())
+    {
+        p_dbus_connection_set_wakeup_main_function( connection, bluez_dbus_wakeup_main, NULL, NULL );
+        p_dbus_connection_set_dispatch_status_function( connection, bluez_dbus_dispatch_status_changed, NULL, NULL );
+    }
+    else
+        WARN( "Failed to create wakeup descriptor: %s\n", strerror( errno ) );
+
     return connection;
 }
 
@@ -931,6 +1196,8 @@ void bluez_dbus_close( void *connection )
 
     p_dbus_connection_flush( connection );
     p_dbus_connection_close( connection );
+    /* Make sure bluez_dbus_loop notices the disconnect. */
+    bluez_wakeup_signal();
 }
 
 void bluez_dbus_free( void *connection )
@@ -1288,187 +1555,1413 @@ NTSTATUS bluez_device_disconnect( void *connection, const char *device_path )
     return STATUS_SUCCESS;
 }
 
+/* Connecting can take as long as the device takes to show up, so don't wait for the reply. BlueZ resolves the
+ * services once connected, which gets reported through the Connected and ServicesResolved properties. */
+NTSTATUS bluez_device_connect( void *connection, const char *device_path )
+{
+    DBusMessage *request;
+    dbus_bool_t success;
+
+    TRACE( "(%p, %s)\n", connection, debugstr_a( device_path ) );
+
+    request = p_dbus_message_new_method_call( BLUEZ_DEST, device_path, BLUEZ_INTERFACE_DEVICE, "Connect" );
+    if (!request)
+        return STATUS_NO_MEMORY;
+
+    success = p_dbus_connection_send( connection, request, NULL );
+    p_dbus_message_unref( request );
+    return success ? STATUS_SUCCESS : STATUS_NO_MEMORY;
+}
+
 static BOOL bluez_event_list_queue_new_event( struct list *event_list,
                                               enum winebluetooth_watcher_event_type event_type,
                                               union winebluetooth_watcher_event_data event );
-struct bluez_device_pair_data
+
+/* GATT characteristic values can be exchanged with BlueZ in two ways. The DBus methods ReadValue, WriteValue and
+ * StartNotify send every value through bluetoothd as a DBus message, with notifications being delivered as
+ * PropertiesChanged signals for the "Value" property. Alternatively, AcquireNotify and AcquireWrite hand us a
+ * SOCK_SEQPACKET socket connected directly to the ATT channel, where every packet carries exactly one value. As the
+ * latter skips the bus entirely, it is much cheaper for high-rate notifications and write-without-response commands,
+ * so we prefer it and only fall back to the DBus methods if BlueZ refuses (e.g, if another client has already
+ * acquired the characteristic, or the characteristic does not support it).
+ *
+ * Either way, incoming values are only ever read on the bluez_dbus_loop thread: the notification sockets are polled
+ * alongside the DBus connection, and PropertiesChanged signals are handled in bluez_filter. Every value gets queued
+ * to the characteristic, followed by a BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_VALUE_CHANGED event, which
+ * lets the driver complete any READ_NOTIFICATION IRPs it has pending for the characteristic. */
+
+/* The ATT header for Handle Value Notifications and Write Commands is 3 bytes. */
+#define BLUEZ_GATT_ATT_HEADER_SIZE 3
+
+struct bluez_gatt_char_io
 {
-    IRP *irp;
-    struct bluez_watcher_ctx *watcher_ctx;
+    struct list entry;
+    LONG refcnt;
+    struct unix_name *characteristic;
+
+    /* All fields below are guarded by bluez_gatt_io_lock. */
+    BOOL detached;
+    /* The socket returned by AcquireNotify, or -1. */
+    int notify_fd;
+    /* Notifications were enabled using StartNotify, and are delivered through bluez_filter. */
+    BOOL notifying;
+    /* Allocated when notifications are enabled for the first time. */
+    struct notification_ring *notifications;
+    /* The socket returned by AcquireWrite, or -1. */
+    int write_fd;
+    UINT16 write_mtu;
+    /* BlueZ does not support AcquireWrite for this characteristic, don't bother calling it again. */
+    BOOL write_fd_unavailable;
 };
 
-static void bluez_device_pair_callback( DBusPendingCall *pending, void *param )
+static pthread_mutex_t bluez_gatt_io_lock = PTHREAD_MUTEX_INITIALIZER;
+/* struct bluez_gatt_char_io */
+static struct list bluez_gatt_io_list = LIST_INIT( bluez_gatt_io_list );
+
+/* Needs to be called with bluez_gatt_io_lock held. Only used for paths we get from BlueZ, requests from the driver
+ * find the I/O state through the object pointer of the characteristic's name. */
+static struct bluez_gatt_char_io *bluez_gatt_char_io_find( const char *path )
 {
-    struct bluez_device_pair_data *data = param;
-    DBusMessage *reply;
-    DBusError error;
-    union winebluetooth_watcher_event_data event = {0};
+    struct bluez_gatt_char_io *io;
 
-    event.pairing_finished.irp = data->irp;
-    reply = p_dbus_pending_call_steal_reply( pending );
-    p_dbus_error_init( &error );
-    if (p_dbus_set_error_from_message( &error, reply ))
+    LIST_FOR_EACH_ENTRY( io, &bluez_gatt_io_list, struct bluez_gatt_char_io, entry )
+        if (!strcmp( io->characteristic->str, path )) return io;
+    return NULL;
+}
+
+/* Returns a new reference to the I/O state for the characteristic, creating it if necessary. */
+static struct bluez_gatt_char_io *bluez_gatt_char_io_get( struct unix_name *characteristic, BOOL create )
+{
+    struct bluez_gatt_char_io *io;
+
+    pthread_mutex_lock( &bluez_gatt_io_lock );
+    if ((io = characteristic->object))
+        io->refcnt++;
+    else if (create && (io = calloc( 1, sizeof( *io ) )))
     {
-        event.pairing_finished.result = bluez_dbus_error_to_ntstatus( &error );
-        ERR( "Failed to pair: %s: %s\n", debugstr_a( error.name ), debugstr_a( error.message ) );
+        /* One reference for bluez_gatt_io_list, one for the caller. */
+        io->refcnt = 2;
+        io->characteristic = unix_name_dup( characteristic );
+        io->notify_fd = -1;
+        io->write_fd = -1;
+        list_add_tail( &bluez_gatt_io_list, &io->entry );
+        characteristic->object = io;
     }
-    p_dbus_error_free( &error );
-
-    bluez_event_list_queue_new_event( &data->watcher_ctx->event_list,
-                                      BLUETOOTH_WATCHER_EVENT_TYPE_PAIRING_FINISHED, event );
-    p_dbus_message_unref( reply );
+    pthread_mutex_unlock( &bluez_gatt_io_lock );
+    return io;
 }
 
-NTSTATUS bluez_device_start_pairing( void *connection, void *watcher_ctx, struct unix_name *device, IRP *irp )
+static void bluez_gatt_char_io_release( struct bluez_gatt_char_io *io )
 {
-    DBusMessage *request;
-    DBusPendingCall *pending_call = NULL;
-    struct bluez_device_pair_data *data;
-    dbus_bool_t success;
+    LONG refcnt;
 
-    TRACE( "(%p, %p, %s, %p)\n", connection, watcher_ctx, debugstr_a( device->str ), irp );
+    pthread_mutex_lock( &bluez_gatt_io_lock );
+    refcnt = --io->refcnt;
+    pthread_mutex_unlock( &bluez_gatt_io_lock );
+    if (refcnt) return;
+
+    /* Closing the sockets also lets BlueZ know that we are done with them. */
+    if (io->notify_fd != -1) close( io->notify_fd );
+    if (io->write_fd != -1) close( io->write_fd );
+    if (io->notifications) notification_ring_destroy( io->notifications );
+    unix_name_free( io->characteristic );
+    free( io );
+}
 
-    request = p_dbus_message_new_method_call( BLUEZ_DEST, device->str, BLUEZ_INTERFACE_DEVICE, "Pair" );
-    if (!request)
-        return STATUS_NO_MEMORY;
+/* Removes the I/O state from bluez_gatt_io_list. The sockets are shut down right away, but only get closed once the
+ * last reference is released, so that the descriptors can't get reused while bluez_dbus_loop is still polling them.
+ * Needs to be called with bluez_gatt_io_lock held, and the caller needs to call bluez_gatt_char_io_release afterwards
+ * to drop the reference held by the list. */
+static void bluez_gatt_char_io_detach( struct bluez_gatt_char_io *io )
+{
+    if (io->detached) return;
+    io->detached = TRUE;
+    list_remove( &io->entry );
+    io->characteristic->object = NULL;
+    if (io->notify_fd != -1) shutdown( io->notify_fd, SHUT_RDWR );
+    if (io->write_fd != -1) shutdown( io->write_fd, SHUT_RDWR );
+}
 
-    data = malloc( sizeof( *data ) );
-    if (!data)
-    {
-        p_dbus_message_unref( request );
-        return STATUS_NO_MEMORY;
-    }
-    data->irp = irp;
-    data->watcher_ctx = watcher_ctx;
-    success = p_dbus_connection_send_with_reply( connection, request, &pending_call, bluez_timeout );
-    p_dbus_message_unref( request );
-    if (!success)
-        return STATUS_NO_MEMORY;
-    if (!pending_call)
-        return STATUS_INTERNAL_ERROR;
-    if (!p_dbus_pending_call_set_notify( pending_call, bluez_device_pair_callback, data, free ))
-    {
-        p_dbus_pending_call_cancel( pending_call );
-        p_dbus_pending_call_unref( pending_call );
-        return STATUS_NO_MEMORY;
-    }
+static void bluez_gatt_char_io_remove( struct bluez_gatt_char_io *io )
+{
+    BOOL release;
 
-    p_dbus_pending_call_unref( pending_call );
-    return STATUS_PENDING;
+    pthread_mutex_lock( &bluez_gatt_io_lock );
+    release = !io->detached;
+    bluez_gatt_char_io_detach( io );
+    pthread_mutex_unlock( &bluez_gatt_io_lock );
+    if (release) bluez_gatt_char_io_release( io );
 }
 
-struct bluez_watcher_event
+/* Called from bluez_filter when BlueZ removes a characteristic object. */
+static void bluez_gatt_char_io_remove_by_path( const char *path )
 {
-    struct list entry;
-    enum winebluetooth_watcher_event_type event_type;
-    union winebluetooth_watcher_event_data event;
+    struct bluez_gatt_char_io *io;
 
-    /* Some DBus signals, like PropertiesChanged in org.freedesktop.DBus.Properties, require us to
-     * perform an additional call to get the complete state of the object (in this instance, call
-     * Get/GetAll to get the values of invalidated properties). The event is queued out only once
-     * this call completes. */
-    DBusPendingCall *pending_call;
-};
+    pthread_mutex_lock( &bluez_gatt_io_lock );
+    if ((io = bluez_gatt_char_io_find( path )))
+        bluez_gatt_char_io_detach( io );
+    pthread_mutex_unlock( &bluez_gatt_io_lock );
+    if (io) bluez_gatt_char_io_release( io );
+}
 
-static BOOL bluez_event_list_queue_new_event_with_call(
-    struct list *event_list, enum winebluetooth_watcher_event_type event_type,
-    union winebluetooth_watcher_event_data event, DBusPendingCall *call,
-    DBusPendingCallNotifyFunction callback )
+static void bluez_gatt_char_io_remove_all( void )
 {
-    struct bluez_watcher_event *event_entry;
+    struct bluez_gatt_char_io *io;
 
-    if (!(event_entry = calloc(1, sizeof( *event_entry ) )))
+    pthread_mutex_lock( &bluez_gatt_io_lock );
+    while (!list_empty( &bluez_gatt_io_list ))
     {
-        ERR( "Could not allocate memory for DBus event.\n" );
-        return FALSE;
+        io = LIST_ENTRY( list_head( &bluez_gatt_io_list ), struct bluez_gatt_char_io, entry );
+        bluez_gatt_char_io_detach( io );
+        pthread_mutex_unlock( &bluez_gatt_io_lock );
+        bluez_gatt_char_io_release( io );
+        pthread_mutex_lock( &bluez_gatt_io_lock );
     }
+    pthread_mutex_unlock( &bluez_gatt_io_lock );
+}
 
-    event_entry->event_type = event_type;
-    event_entry->event = event;
-    event_entry->pending_call = call;
-    if (call && callback)
-        p_dbus_pending_call_set_notify( call, callback, &event_entry->event, NULL );
-    list_add_tail( event_list, &event_entry->entry );
+static void bluez_gatt_char_io_queue_value_changed( struct list *event_list, struct bluez_gatt_char_io *io )
+{
+    union winebluetooth_watcher_event_data event = {0};
+    struct unix_name *characteristic = unix_name_dup( io->characteristic );
 
-    return TRUE;
+    event.gatt_characteristic_value_changed.handle = characteristic->handle;
+    if (!bluez_event_list_queue_new_event( event_list, BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_VALUE_CHANGED,
+                                           event ))
+        unix_name_free( characteristic );
 }
 
-static BOOL bluez_event_list_queue_new_event( struct list *event_list,
-                                              enum winebluetooth_watcher_event_type event_type,
-                                              union winebluetooth_watcher_event_data event )
+/* Needs to be called with bluez_gatt_io_lock held. Returns FALSE if the value was dropped. */
+static BOOL bluez_gatt_char_io_queue_notification( struct bluez_gatt_char_io *io, const unsigned char *data,
+                                                   int size )
 {
-    return bluez_event_list_queue_new_event_with_call( event_list, event_type, event, NULL, NULL );
+    if (!io->notifications) return FALSE;
+    if (!notification_ring_push( io->notifications, data, size ))
+    {
+        WARN( "Notification queue for %s is full, dropping value\n", debugstr_a( io->characteristic->str ) );
+        return FALSE;
+    }
+    return TRUE;
 }
 
-static void bluez_filter_radio_props_changed_callback( DBusPendingCall *call, void *user_data )
+/* Called from bluez_filter when the "Value" property of a characteristic using StartNotify changes. */
+static void bluez_gatt_char_io_value_changed( struct list *event_list, const char *path, const unsigned char *data,
+                                              int size )
 {
-    union winebluetooth_watcher_event_data *event = user_data;
-    struct winebluetooth_watcher_event_radio_props_changed *changed = &event->radio_props_changed;
-    const struct unix_name *radio = (struct unix_name *)event->radio_props_changed.radio.handle;
-    DBusMessage *reply;
-    DBusMessageIter dict, prop_iter, variant;
-    const char *prop_name;
-    DBusError error;
+    struct bluez_gatt_char_io *io;
 
-    TRACE( "call %p, radio %s\n", call, debugstr_a( radio->str ) );
-
-    reply = p_dbus_pending_call_steal_reply( call );
-    p_dbus_error_init( &error );
-    if (p_dbus_set_error_from_message( &error, reply ))
+    pthread_mutex_lock( &bluez_gatt_io_lock );
+    io = bluez_gatt_char_io_find( path );
+    if (!io || !io->notifying)
     {
-        ERR( "Failed to get adapter properties for %s: %s: %s\n", debugstr_a( radio->str ),
-             debugstr_a( error.name ), debugstr_a( error.message ) );
-        p_dbus_error_free( &error );
-        p_dbus_message_unref( reply );
+        pthread_mutex_unlock( &bluez_gatt_io_lock );
         return;
     }
-    p_dbus_error_free( &error );
+    if (bluez_gatt_char_io_queue_notification( io, data, size ))
+        bluez_gatt_char_io_queue_value_changed( event_list, io );
+    pthread_mutex_unlock( &bluez_gatt_io_lock );
+}
 
-    p_dbus_message_iter_init( reply, &dict );
-    p_dbus_message_iter_recurse( &dict, &prop_iter );
-    while((prop_name = bluez_next_dict_entry( &prop_iter, &variant )))
-    {
-        bluez_radio_prop_from_dict_entry( prop_name, &variant, &changed->props,
-                                          &changed->changed_props_mask, changed->invalid_props_mask );
-    }
-    changed->invalid_props_mask &= ~changed->changed_props_mask;
-    p_dbus_message_unref( reply );
+/* The pollfd array bluez_dbus_loop waits on, and the I/O state for each AcquireNotify socket in it, starting at
+ * index 2 of bluez_poll_fds. Only used by the bluez_dbus_loop thread, and grown as more characteristics get one. */
+static struct pollfd *bluez_poll_fds;
+static struct bluez_gatt_char_io **bluez_poll_ios;
+static SIZE_T bluez_poll_size;
+
+static void bluez_gatt_char_io_poll_free( void )
+{
+    free( bluez_poll_fds );
+    free( bluez_poll_ios );
+    bluez_poll_fds = NULL;
+    bluez_poll_ios = NULL;
+    bluez_poll_size = 0;
 }
 
-static void bluez_filter_device_props_changed_callback( DBusPendingCall *call, void *user_data )
+/* Makes sure that bluez_poll_fds has room for the DBus connection, the wakeup pipe and count AcquireNotify sockets. */
+static BOOL bluez_gatt_char_io_poll_reserve( SIZE_T count )
 {
-    union winebluetooth_watcher_event_data *event = user_data;
+    struct bluez_gatt_char_io **ios;
+    struct pollfd *fds;
+    SIZE_T size;
+
+    if (count + 2 <= bluez_poll_size) return TRUE;
+    size = max( max( bluez_poll_size * 2, count + 2 ), 16 );
+    if (!(fds = realloc( bluez_poll_fds, size * sizeof( *fds ) ))) return FALSE;
+    bluez_poll_fds = fds;
+    if (!(ios = realloc( bluez_poll_ios, (size - 2) * sizeof( *ios ) ))) return FALSE;
+    bluez_poll_ios = ios;
+    bluez_poll_size = size;
+    return TRUE;
+}
+
+/* Fills in the pollfd entries bluez_dbus_loop should wait on for AcquireNotify sockets, after the first two in
+ * bluez_poll_fds, and returns their count. The sockets are kept open by the reference added to each entry in
+ * bluez_poll_ios, which gets released in bluez_gatt_char_io_poll_done. */
+static SIZE_T bluez_gatt_char_io_poll_fds( void )
+{
+    struct bluez_gatt_char_io *io;
+    SIZE_T count = 0, max;
+
+    pthread_mutex_lock( &bluez_gatt_io_lock );
+    LIST_FOR_EACH_ENTRY( io, &bluez_gatt_io_list, struct bluez_gatt_char_io, entry )
+        if (io->notify_fd != -1) count++;
+    if (!bluez_gatt_char_io_poll_reserve( count ))
+        ERR( "Failed to allocate pollfd entries for %lu notification sockets\n", (unsigned long)count );
+    max = bluez_poll_size - 2;
+
+    count = 0;
+    LIST_FOR_EACH_ENTRY( io, &bluez_gatt_io_list, struct bluez_gatt_char_io, entry )
+    {
+        struct pollfd *fd = &bluez_poll_fds[count + 2];
+
+        if (io->notify_fd == -1) continue;
+        if (count == max) break;
+        io->refcnt++;
+        bluez_poll_ios[count] = io;
+        fd->fd = io->notify_fd;
+        fd->events = POLLIN;
+        fd->revents = 0;
+        count++;
+    }
+    pthread_mutex_unlock( &bluez_gatt_io_lock );
+    return count;
+}
+
+/* Reads all values that are ready on the AcquireNotify sockets polled by bluez_dbus_loop. */
+static void bluez_gatt_char_io_poll_done( struct list *event_list, struct pollfd *fds, struct bluez_gatt_char_io **ios,
+                                          SIZE_T count )
+{
+    unsigned char buffer[512];
+    SIZE_T i;
+
+    for (i = 0; i < count; i++)
+    {
+        struct bluez_gatt_char_io *io = ios[i];
+        BOOL queued = FALSE, closed = FALSE;
+
+        if (fds[i].revents & POLLIN)
+        {
+            for (;;)
+            {
+                ssize_t ret = recv( fds[i].fd, buffer, sizeof( buffer ), MSG_DONTWAIT );
+
+                if (ret == -1 && errno == EINTR) continue;
+                if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+                if (ret <= 0)
+                {
+                    closed = TRUE;
+                    break;
+                }
+                pthread_mutex_lock( &bluez_gatt_io_lock );
+                if (bluez_gatt_char_io_queue_notification( io, buffer, ret )) queued = TRUE;
+                pthread_mutex_unlock( &bluez_gatt_io_lock );
+            }
+        }
+        else if (fds[i].revents & (POLLHUP | POLLERR | POLLNVAL))
+            closed = TRUE;
+
+        if (queued)
+            bluez_gatt_char_io_queue_value_changed( event_list, io );
+        if (closed)
+        {
+            /* BlueZ closes the socket if the device disconnects. Keep the I/O state around, so that the values
+             * queued above can still be read, and so that notifications can be enabled again later. */
+            TRACE( "Notification socket for %s was closed\n", debugstr_a( io->characteristic->str ) );
+            pthread_mutex_lock( &bluez_gatt_io_lock );
+            if (io->notify_fd == fds[i].fd)
+            {
+                close( io->notify_fd );
+                io->notify_fd = -1;
+            }
+            pthread_mutex_unlock( &bluez_gatt_io_lock );
+        }
+        bluez_gatt_char_io_release( io );
+    }
+}
+
+/* Creates a method call on org.bluez.GattCharacteristic1 with an optional byte array argument followed by an options
+ * dictionary, which only contains the "type" key if write_type is not NULL. */
+static DBusMessage *bluez_gatt_characteristic_new_call( const char *path, const char *method,
+                                                        const unsigned char *data, unsigned int size,
+                                                        const char *write_type )
+{
+    DBusMessageIter iter, dict_iter;
+    DBusMessage *request;
+
+    request = p_dbus_message_new_method_call( BLUEZ_DEST, path, BLUEZ_INTERFACE_GATT_CHARACTERISTICS, method );
+    if (!request) return NULL;
+
+    if (data && !p_dbus_message_append_args( request, DBUS_TYPE_ARRAY, DBUS_TYPE_BYTE, &data, size,
+                                             DBUS_TYPE_INVALID ))
+    {
+        p_dbus_message_unref( request );
+        return NULL;
+    }
+    p_dbus_message_iter_init_append( request, &iter );
+    if (!p_dbus_message_iter_open_container( &iter, DBUS_TYPE_ARRAY, "{sv}", &dict_iter ))
+    {
+        p_dbus_message_unref( request );
+        return NULL;
+    }
+    if (write_type && !bluez_variant_dict_add_entry( &dict_iter, "type", DBUS_TYPE_STRING,
+                                                     DBUS_TYPE_STRING_AS_STRING, &write_type ))
+    {
+        p_dbus_message_iter_abandon_container( &iter, &dict_iter );
+        p_dbus_message_unref( request );
+        return NULL;
+    }
+    if (!p_dbus_message_iter_close_container( &iter, &dict_iter ))
+    {
+        p_dbus_message_unref( request );
+        return NULL;
+    }
+    return request;
+}
+
+/* Same as above, but also sends the call and waits for the reply. */
+static NTSTATUS bluez_gatt_characteristic_call( DBusConnection *connection, const char *path, const char *method,
+                                                const unsigned char *data, unsigned int size,
+                                                const char *write_type, DBusMessage **reply )
+{
+    DBusMessage *request;
+    DBusError error;
+    NTSTATUS status;
+
+    if (!(request = bluez_gatt_characteristic_new_call( path, method, data, size, write_type )))
+        return STATUS_NO_MEMORY;
+
+    p_dbus_error_init( &error );
+    status = bluez_dbus_send_and_wait_for_reply( connection, request, reply, &error );
+    if (status)
+    {
+        p_dbus_error_free( &error );
+        return status;
+    }
+    if (!*reply)
+    {
+        WARN( "%s failed for %s: %s: %s\n", method, debugstr_a( path ), debugstr_a( error.name ),
+              debugstr_a( error.message ) );
+        status = bluez_dbus_error_to_ntstatus( &error );
+        p_dbus_error_free( &error );
+        return status;
+    }
+    p_dbus_error_free( &error );
+    return STATUS_SUCCESS;
+}
+
+/* Calls AcquireNotify or AcquireWrite, returning the socket and the negotiated ATT MTU. */
+static NTSTATUS bluez_gatt_characteristic_acquire( DBusConnection *connection, const char *path, const char *method,
+                                                   int *fd, UINT16 *mtu )
+{
+    DBusMessage *reply;
+    DBusError error;
+    NTSTATUS status;
+
+    status = bluez_gatt_characteristic_call( connection, path, method, NULL, 0, NULL, &reply );
+    if (status) return status;
+
+    p_dbus_error_init( &error );
+    if (!p_dbus_message_get_args( reply, &error, DBUS_TYPE_UNIX_FD, fd, DBUS_TYPE_UINT16, mtu, DBUS_TYPE_INVALID ))
+    {
+        ERR( "Could not get arguments from %s reply: %s: %s\n", method, debugstr_a( error.name ),
+             debugstr_a( error.message ) );
+        p_dbus_error_free( &error );
+        p_dbus_message_unref( reply );
+        return STATUS_INTERNAL_ERROR;
+    }
+    p_dbus_error_free( &error );
+    p_dbus_message_unref( reply );
+    TRACE( "%s for %s returned fd %d, MTU %u\n", method, debugstr_a( path ), *fd, *mtu );
+    return STATUS_SUCCESS;
+}
+
+struct bluez_gatt_characteristic_io_data
+{
+    IRP *irp;
+    struct unix_name *characteristic;
+    struct bluez_watcher_ctx *watcher_ctx;
+    BOOL read;
+};
+
+static void bluez_gatt_characteristic_io_data_free( void *param )
+{
+    struct bluez_gatt_characteristic_io_data *data = param;
+
+    unix_name_free( data->characteristic );
+    free( data );
+}
+
+static void bluez_gatt_characteristic_io_callback( DBusPendingCall *pending, void *param )
+{
+    struct bluez_gatt_characteristic_io_data *data = param;
+    struct winebluetooth_watcher_event_gatt_characteristic_io_finished *finished;
+    union winebluetooth_watcher_event_data event = {0};
+    DBusMessage *reply;
+    DBusError error;
+
+    finished = &event.gatt_characteristic_io_finished;
+    finished->characteristic.handle = unix_name_dup( data->characteristic )->handle;
+    finished->irp = data->irp;
+    reply = p_dbus_pending_call_steal_reply( pending );
+    p_dbus_error_init( &error );
+    if (p_dbus_set_error_from_message( &error, reply ))
+    {
+        finished->result = bluez_dbus_error_to_ntstatus( &error );
+        WARN( "%s failed for %s: %s: %s\n", data->read ? "ReadValue" : "WriteValue",
+              debugstr_a( data->characteristic->str ), debugstr_a( error.name ), debugstr_a( error.message ) );
+    }
+    else if (data->read)
+    {
+        DBusMessageIter iter, array_iter;
+        const unsigned char *value;
+        int len;
+
+        if (p_dbus_message_has_signature( reply, DBUS_TYPE_ARRAY_AS_STRING DBUS_TYPE_BYTE_AS_STRING ))
+        {
+            p_dbus_message_iter_init( reply, &iter );
+            p_dbus_message_iter_recurse( &iter, &array_iter );
+            p_dbus_message_iter_get_fixed_array( &array_iter, &value, &len );
+            finished->size = min( len, sizeof( finished->value ) );
+            memcpy( finished->value, value, finished->size );
+        }
+        else
+        {
+            ERR( "Unexpected signature in ReadValue reply: %s\n",
+                 debugstr_a( p_dbus_message_get_signature( reply ) ) );
+            finished->result = STATUS_INTERNAL_ERROR;
+        }
+    }
+    p_dbus_error_free( &error );
+
+    if (!bluez_event_list_queue_new_event( &data->watcher_ctx->event_list,
+                                           BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_IO_FINISHED, event ))
+        unix_name_free_handle( finished->characteristic.handle );
+    p_dbus_message_unref( reply );
+}
+
+/* Sends ReadValue or WriteValue without waiting for the reply, which gets reported through an IO_FINISHED event
+ * for irp instead. BlueZ sends ATT requests for a device in the order the calls were made. */
+static NTSTATUS bluez_gatt_characteristic_start_io( DBusConnection *connection, struct bluez_watcher_ctx *watcher_ctx,
+                                                    struct unix_name *characteristic, const unsigned char *data,
+                                                    unsigned int size, const char *write_type, IRP *irp )
+{
+    struct bluez_gatt_characteristic_io_data *io_data;
+    DBusPendingCall *pending_call = NULL;
+    DBusMessage *request;
+    dbus_bool_t success;
+
+    request = bluez_gatt_characteristic_new_call( characteristic->str, data ? "WriteValue" : "ReadValue", data,
+                                                  size, write_type );
+    if (!request) return STATUS_NO_MEMORY;
+
+    if (!(io_data = malloc( sizeof( *io_data ) )))
+    {
+        p_dbus_message_unref( request );
+        return STATUS_NO_MEMORY;
+    }
+    io_data->irp = irp;
+    io_data->characteristic = unix_name_dup( characteristic );
+    io_data->watcher_ctx = watcher_ctx;
+    io_data->read = !data;
+    success = p_dbus_connection_send_with_reply( connection, request, &pending_call, bluez_timeout );
+    p_dbus_message_unref( request );
+    if (!success || !pending_call)
+    {
+        bluez_gatt_characteristic_io_data_free( io_data );
+        return success ? STATUS_INTERNAL_ERROR : STATUS_NO_MEMORY;
+    }
+    if (!p_dbus_pending_call_set_notify( pending_call, bluez_gatt_characteristic_io_callback, io_data,
+                                         bluez_gatt_characteristic_io_data_free ))
+    {
+        p_dbus_pending_call_cancel( pending_call );
+        p_dbus_pending_call_unref( pending_call );
+        bluez_gatt_characteristic_io_data_free( io_data );
+        return STATUS_NO_MEMORY;
+    }
+
+    p_dbus_pending_call_unref( pending_call );
+    return STATUS_PENDING;
+}
+
+/* Calls AcquireWrite for the characteristic, unless it has a socket for write commands already, or BlueZ has said
+ * that it will never hand one out for it. Other failures (e.g, the device being disconnected at the time) are
+ * transient, and the next write command tries again. */
+static void bluez_gatt_char_io_acquire_write( DBusConnection *connection, struct bluez_gatt_char_io *io )
+{
+    NTSTATUS status;
+    BOOL acquire;
+    UINT16 mtu;
+    int fd;
+
+    pthread_mutex_lock( &bluez_gatt_io_lock );
+    acquire = io->write_fd == -1 && !io->write_fd_unavailable;
+    pthread_mutex_unlock( &bluez_gatt_io_lock );
+    if (!acquire) return;
+
+    status = bluez_gatt_characteristic_acquire( connection, io->characteristic->str, "AcquireWrite", &fd, &mtu );
+    if (!status)
+    {
+        pthread_mutex_lock( &bluez_gatt_io_lock );
+        if (io->write_fd == -1 && !io->detached)
+        {
+            io->write_fd = fd;
+            io->write_mtu = mtu;
+            fd = -1;
+        }
+        pthread_mutex_unlock( &bluez_gatt_io_lock );
+        if (fd != -1) close( fd );
+    }
+    else if (status == STATUS_NOT_SUPPORTED || status == STATUS_ACCESS_DENIED)
+    {
+        pthread_mutex_lock( &bluez_gatt_io_lock );
+        io->write_fd_unavailable = TRUE;
+        pthread_mutex_unlock( &bluez_gatt_io_lock );
+    }
+}
+
+NTSTATUS bluez_gatt_characteristic_read( void *connection, void *watcher_ctx, struct unix_name *characteristic,
+                                         IRP *irp )
+{
+    TRACE( "(%p, %p, %s, %p)\n", connection, watcher_ctx, debugstr_a( characteristic->str ), irp );
+
+    return bluez_gatt_characteristic_start_io( connection, watcher_ctx, characteristic, NULL, 0, NULL, irp );
+}
+
+NTSTATUS bluez_gatt_characteristic_write( void *connection, void *watcher_ctx, struct unix_name *characteristic,
+                                          const unsigned char *data, unsigned int size, int write_type, IRP *irp )
+{
+    static const unsigned char empty;
+
+    TRACE( "(%p, %p, %s, %p, %u, %d, %p)\n", connection, watcher_ctx, debugstr_a( characteristic->str ), data,
+           size, write_type, irp );
+
+    /* Write commands (i.e, write-without-response) can go through the socket from AcquireWrite, as long as the
+     * value fits into a single ATT PDU. */
+    if (write_type == 1)
+    {
+        struct bluez_gatt_char_io *io = bluez_gatt_char_io_get( characteristic, TRUE );
+        UINT16 mtu;
+        int fd;
+
+        if (!io) return STATUS_NO_MEMORY;
+
+        bluez_gatt_char_io_acquire_write( connection, io );
+        pthread_mutex_lock( &bluez_gatt_io_lock );
+        fd = io->write_fd;
+        mtu = io->write_mtu;
+        pthread_mutex_unlock( &bluez_gatt_io_lock );
+        if (fd != -1 && size + BLUEZ_GATT_ATT_HEADER_SIZE <= mtu)
+        {
+            ssize_t ret;
+
+            do { ret = send( fd, data, size, MSG_NOSIGNAL ); } while (ret == -1 && errno == EINTR);
+            if (ret == size)
+            {
+                bluez_gatt_char_io_release( io );
+                return STATUS_SUCCESS;
+            }
+            /* BlueZ closes the socket when the device disconnects. Drop it, and let WriteValue report the error. */
+            WARN( "Failed to write to AcquireWrite socket for %s: %s\n", debugstr_a( characteristic->str ),
+                  debugstr_a( strerror( errno ) ) );
+            bluez_gatt_char_io_remove( io );
+        }
+        bluez_gatt_char_io_release( io );
+    }
+
+    return bluez_gatt_characteristic_start_io( connection, watcher_ctx, characteristic, data ? data : &empty, size,
+                                               write_type == 1 ? "command" : "request", irp );
+}
+
+/* The ATT MTU every LE link starts out with, before a larger one has been negotiated. */
+#define BLUEZ_GATT_DEFAULT_MTU 23
+
+/* GattCharacteristic1.MTU only exists since BlueZ 5.62. */
+static NTSTATUS bluez_gatt_characteristic_get_mtu_property( DBusConnection *connection, const char *path,
+                                                            UINT16 *mtu )
+{
+    static const char *iface = BLUEZ_INTERFACE_GATT_CHARACTERISTICS, *name = "MTU";
+    DBusMessageIter iter, variant;
+    DBusMessage *request, *reply;
+    DBusError error;
+    NTSTATUS status;
+
+    request = p_dbus_message_new_method_call( BLUEZ_DEST, path, DBUS_INTERFACE_PROPERTIES, "Get" );
+    if (!request) return STATUS_NO_MEMORY;
+    if (!p_dbus_message_append_args( request, DBUS_TYPE_STRING, &iface, DBUS_TYPE_STRING, &name,
+                                     DBUS_TYPE_INVALID ))
+    {
+        p_dbus_message_unref( request );
+        return STATUS_NO_MEMORY;
+    }
+
+    p_dbus_error_init( &error );
+    status = bluez_dbus_send_and_wait_for_reply( connection, request, &reply, &error );
+    if (!status && !reply)
+    {
+        TRACE( "Could not get the MTU of %s: %s: %s\n", debugstr_a( path ), debugstr_a( error.name ),
+               debugstr_a( error.message ) );
+        status = bluez_dbus_error_to_ntstatus( &error );
+    }
+    p_dbus_error_free( &error );
+    if (status) return status;
+
+    status = STATUS_NOT_SUPPORTED;
+    if (p_dbus_message_has_signature( reply, DBUS_TYPE_VARIANT_AS_STRING ))
+    {
+        p_dbus_message_iter_init( reply, &iter );
+        p_dbus_message_iter_recurse( &iter, &variant );
+        if (p_dbus_message_iter_get_arg_type( &variant ) == DBUS_TYPE_UINT16)
+        {
+            p_dbus_message_iter_get_basic( &variant, mtu );
+            status = STATUS_SUCCESS;
+        }
+    }
+    p_dbus_message_unref( reply );
+    return status;
+}
+
+NTSTATUS bluez_gatt_characteristic_get_mtu( void *connection, struct unix_name *characteristic, unsigned int *mtu )
+{
+    struct bluez_gatt_char_io *io;
+    UINT16 value = 0;
+
+    TRACE( "(%p, %s, %p)\n", connection, debugstr_a( characteristic->str ), mtu );
+
+    if ((io = bluez_gatt_char_io_get( characteristic, FALSE )))
+    {
+        pthread_mutex_lock( &bluez_gatt_io_lock );
+        if (io->write_fd != -1) value = io->write_mtu;
+        pthread_mutex_unlock( &bluez_gatt_io_lock );
+        bluez_gatt_char_io_release( io );
+    }
+    if (!value && bluez_gatt_characteristic_get_mtu_property( connection, characteristic->str, &value ))
+        value = BLUEZ_GATT_DEFAULT_MTU;
+    *mtu = max( value, BLUEZ_GATT_DEFAULT_MTU );
+    return STATUS_SUCCESS;
+}
+
+/* Write commands don't get a response, so streams are paced by whatever backpressure BlueZ offers for them. BlueZ
+ * stops reading from the socket returned by AcquireWrite while the controller is out of buffers for the connection,
+ * which eventually fills up the socket's send buffer. Without the socket, WriteValue calls are pipelined instead,
+ * keeping up to BLUEZ_GATT_WRITE_WINDOW of them in flight, as BlueZ only replies to them once the command has been
+ * queued for the controller. */
+#define BLUEZ_GATT_WRITE_WINDOW 8
+/* How often a blocked stream checks whether it got cancelled, and how long it may go without making any progress,
+ * both in milliseconds. */
+#define BLUEZ_GATT_WRITE_POLL_INTERVAL 100
+#define BLUEZ_GATT_WRITE_STALL_TIMEOUT 5000
+
+static NTSTATUS bluez_gatt_write_stream_socket( int fd, UINT16 mtu, const unsigned char *data, unsigned int size,
+                                                const volatile BOOLEAN *cancel, unsigned int *packets,
+                                                unsigned int *written )
+{
+    unsigned int chunk = mtu - BLUEZ_GATT_ATT_HEADER_SIZE, stalled = 0;
+
+    while (*written < size)
+    {
+        unsigned int len = min( chunk, size - *written );
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        ssize_t ret;
+
+        if (*cancel) return STATUS_CANCELLED;
+        if ((ret = poll( &pfd, 1, BLUEZ_GATT_WRITE_POLL_INTERVAL )) <= 0)
+        {
+            if (ret == -1 && errno != EINTR)
+            {
+                ERR( "poll failed: %s\n", debugstr_a( strerror( errno ) ) );
+                return STATUS_INTERNAL_ERROR;
+            }
+            if (!ret && (stalled += BLUEZ_GATT_WRITE_POLL_INTERVAL) >= BLUEZ_GATT_WRITE_STALL_TIMEOUT)
+                return STATUS_IO_TIMEOUT;
+            continue;
+        }
+        if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) return STATUS_DEVICE_NOT_CONNECTED;
+
+        ret = send( fd, data + *written, len, MSG_NOSIGNAL | MSG_DONTWAIT );
+        if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) continue;
+        if (ret != len)
+        {
+            WARN( "Failed to write to AcquireWrite socket: %s\n", debugstr_a( strerror( errno ) ) );
+            return STATUS_DEVICE_NOT_CONNECTED;
+        }
+        stalled = 0;
+        *written += len;
+        (*packets)++;
+    }
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS bluez_gatt_write_stream_calls( DBusConnection *connection, const char *path, UINT16 mtu,
+                                               const unsigned char *data, unsigned int size,
+                                               const volatile BOOLEAN *cancel, unsigned int *packets,
+                                               unsigned int *written )
+{
+    unsigned int chunk = mtu - BLUEZ_GATT_ATT_HEADER_SIZE, sent = 0, first = 0, count = 0;
+    DBusPendingCall *calls[BLUEZ_GATT_WRITE_WINDOW];
+    unsigned int sizes[BLUEZ_GATT_WRITE_WINDOW];
+    NTSTATUS status = STATUS_SUCCESS;
+
+    while (count || (sent < size && !status))
+    {
+        DBusMessage *request, *reply;
+        DBusError error;
+        NTSTATUS ret;
+
+        if (sent < size && !status && count < BLUEZ_GATT_WRITE_WINDOW)
+        {
+            unsigned int idx = (first + count) % BLUEZ_GATT_WRITE_WINDOW, len = min( chunk, size - sent );
+
+            if (*cancel)
+            {
+                status = STATUS_CANCELLED;
+                continue;
+            }
+            if (!(request = bluez_gatt_characteristic_new_call( path, "WriteValue", data + sent, len, "command" )))
+            {
+                status = STATUS_NO_MEMORY;
+                continue;
+            }
+            calls[idx] = NULL;
+            if (!p_dbus_connection_send_with_reply( connection, request, &calls[idx], bluez_timeout ) || !calls[idx])
+                status = STATUS_NO_MEMORY;
+            else
+            {
+                sizes[idx] = len;
+                sent += len;
+                count++;
+            }
+            p_dbus_message_unref( request );
+            continue;
+        }
+
+        /* The window is full, or there is nothing left to send. Either way, wait for the oldest call. */
+        p_dbus_error_init( &error );
+        if (!(ret = bluez_dbus_pending_call_wait( calls[first], &reply, &error )) && !reply)
+        {
+            WARN( "WriteValue failed for %s: %s: %s\n", debugstr_a( path ), debugstr_a( error.name ),
+                  debugstr_a( error.message ) );
+            ret = bluez_dbus_error_to_ntstatus( &error );
+        }
+        else if (!ret)
+        {
+            p_dbus_message_unref( reply );
+            *written += sizes[first];
+            (*packets)++;
+        }
+        p_dbus_error_free( &error );
+        if (ret && !status) status = ret;
+        first = (first + 1) % BLUEZ_GATT_WRITE_WINDOW;
+        count--;
+    }
+    return status;
+}
+
+NTSTATUS bluez_gatt_characteristic_write_stream( void *connection, struct unix_name *characteristic,
+                                                 const unsigned char *data, unsigned int size,
+                                                 const volatile BOOLEAN *cancel, unsigned int *mtu,
+                                                 unsigned int *packets, unsigned int *written )
+{
+    UINT16 att_mtu = BLUEZ_GATT_DEFAULT_MTU;
+    struct bluez_gatt_char_io *io;
+    NTSTATUS status;
+    int fd;
+
+    TRACE( "(%p, %s, %p, %u, %p)\n", connection, debugstr_a( characteristic->str ), data, size, cancel );
+
+    if (!(io = bluez_gatt_char_io_get( characteristic, TRUE ))) return STATUS_NO_MEMORY;
+
+    /* The socket only gets closed once the last reference to io is released, so it stays valid until then. */
+    bluez_gatt_char_io_acquire_write( connection, io );
+    pthread_mutex_lock( &bluez_gatt_io_lock );
+    if ((fd = io->write_fd) != -1)
+        att_mtu = io->write_mtu;
+    pthread_mutex_unlock( &bluez_gatt_io_lock );
+
+    if (fd == -1) bluez_gatt_characteristic_get_mtu_property( connection, characteristic->str, &att_mtu );
+    *mtu = att_mtu = max( att_mtu, BLUEZ_GATT_DEFAULT_MTU );
+
+    if (fd != -1)
+    {
+        status = bluez_gatt_write_stream_socket( fd, att_mtu, data, size, cancel, packets, written );
+        /* BlueZ closes the socket when the device disconnects. */
+        if (status == STATUS_DEVICE_NOT_CONNECTED) bluez_gatt_char_io_remove( io );
+    }
+    else
+        status = bluez_gatt_write_stream_calls( connection, characteristic->str, att_mtu, data, size, cancel,
+                                                packets, written );
+    bluez_gatt_char_io_release( io );
+    return status;
+}
+
+NTSTATUS bluez_gatt_characteristic_set_notify( void *connection, struct unix_name *characteristic, BOOL enable,
+                                               UINT32 overflow_policy )
+{
+    struct bluez_gatt_char_io *io;
+    DBusMessage *reply;
+    NTSTATUS status;
+    UINT16 mtu;
+    int fd;
+
+    TRACE( "(%p, %s, %d, %u)\n", connection, debugstr_a( characteristic->str ), enable, overflow_policy );
+
+    if (!enable)
+    {
+        BOOL notifying;
+
+        if (!(io = bluez_gatt_char_io_get( characteristic, FALSE ))) return STATUS_SUCCESS;
+        pthread_mutex_lock( &bluez_gatt_io_lock );
+        notifying = io->notifying;
+        io->notifying = FALSE;
+        pthread_mutex_unlock( &bluez_gatt_io_lock );
+        /* For AcquireNotify, closing the socket is what stops the notifications. */
+        bluez_gatt_char_io_remove( io );
+        bluez_gatt_char_io_release( io );
+
+        if (!notifying) return STATUS_SUCCESS;
+        status = bluez_gatt_characteristic_call( connection, characteristic->str, "StopNotify", NULL, 0, NULL,
+                                                 &reply );
+        if (status) return status;
+        p_dbus_message_unref( reply );
+        return STATUS_SUCCESS;
+    }
+
+    if (!(io = bluez_gatt_char_io_get( characteristic, TRUE ))) return STATUS_NO_MEMORY;
+    pthread_mutex_lock( &bluez_gatt_io_lock );
+    if (io->notifications)
+        notification_ring_set_policy( io->notifications, overflow_policy );
+    else if (!(io->notifications = notification_ring_create( overflow_policy )))
+    {
+        pthread_mutex_unlock( &bluez_gatt_io_lock );
+        bluez_gatt_char_io_release( io );
+        return STATUS_NO_MEMORY;
+    }
+    if (io->notify_fd != -1 || io->notifying)
+    {
+        pthread_mutex_unlock( &bluez_gatt_io_lock );
+        bluez_gatt_char_io_release( io );
+        return STATUS_SUCCESS;
+    }
+    pthread_mutex_unlock( &bluez_gatt_io_lock );
+
+    if (!bluez_gatt_characteristic_acquire( connection, characteristic->str, "AcquireNotify", &fd, &mtu ))
+    {
+        pthread_mutex_lock( &bluez_gatt_io_lock );
+        if (io->notify_fd == -1 && !io->detached)
+        {
+            io->notify_fd = fd;
+            fd = -1;
+            bluez_wakeup_signal();
+        }
+        pthread_mutex_unlock( &bluez_gatt_io_lock );
+        if (fd != -1) close( fd );
+        bluez_gatt_char_io_release( io );
+        return STATUS_SUCCESS;
+    }
+
+    /* Mark the characteristic as notifying before calling StartNotify, so that bluez_filter doesn't drop any values
+     * that arrive before the reply. */
+    pthread_mutex_lock( &bluez_gatt_io_lock );
+    io->notifying = TRUE;
+    pthread_mutex_unlock( &bluez_gatt_io_lock );
+    status = bluez_gatt_characteristic_call( connection, characteristic->str, "StartNotify", NULL, 0, NULL, &reply );
+    if (status)
+    {
+        pthread_mutex_lock( &bluez_gatt_io_lock );
+        io->notifying = FALSE;
+        pthread_mutex_unlock( &bluez_gatt_io_lock );
+        bluez_gatt_char_io_release( io );
+        return status;
+    }
+    p_dbus_message_unref( reply );
+    bluez_gatt_char_io_release( io );
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS bluez_gatt_characteristic_read_notification( void *connection, struct unix_name *characteristic,
+                                                      unsigned char *buffer, unsigned int buffer_size,
+                                                      unsigned int *size )
+{
+    struct bluez_gatt_char_io *io;
+    NTSTATUS status;
+
+    TRACE( "(%p, %s, %p, %u, %p)\n", connection, debugstr_a( characteristic->str ), buffer, buffer_size, size );
+
+    /* This never blocks, the driver waits for a BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_VALUE_CHANGED
+     * event instead. That includes the case where notifications haven't been enabled yet. */
+    *size = 0;
+    if (!(io = bluez_gatt_char_io_get( characteristic, FALSE ))) return STATUS_TIMEOUT;
+
+    pthread_mutex_lock( &bluez_gatt_io_lock );
+    if (io->notifications)
+        status = notification_ring_pop( io->notifications, buffer, buffer_size, size );
+    else
+        status = STATUS_TIMEOUT;
+    pthread_mutex_unlock( &bluez_gatt_io_lock );
+    bluez_gatt_char_io_release( io );
+    return status;
+}
+
+NTSTATUS bluez_gatt_characteristic_read_notifications( void *connection, struct unix_name *characteristic,
+                                                       unsigned char *buffer, unsigned int buffer_size,
+                                                       unsigned int max_count, unsigned int *count,
+                                                       unsigned int *size, unsigned int *overflow_count )
+{
+    struct bluez_gatt_char_io *io;
+    NTSTATUS status;
+
+    TRACE( "(%p, %s, %p, %u, %u, %p, %p, %p)\n", connection, debugstr_a( characteristic->str ), buffer, buffer_size,
+           max_count, count, size, overflow_count );
+
+    *count = *size = *overflow_count = 0;
+    if (!(io = bluez_gatt_char_io_get( characteristic, FALSE ))) return STATUS_TIMEOUT;
+
+    pthread_mutex_lock( &bluez_gatt_io_lock );
+    if (io->notifications)
+        status = notification_ring_drain( io->notifications, buffer, buffer_size, max_count, count, size,
+                                          overflow_count );
+    else
+        status = STATUS_TIMEOUT;
+    pthread_mutex_unlock( &bluez_gatt_io_lock );
+    bluez_gatt_char_io_release( io );
+    return status;
+}
+
+NTSTATUS bluez_gatt_characteristic_get_notification_stats( void *connection, struct unix_name *characteristic,
+                                                           struct bluetooth_gatt_notification_stats *stats )
+{
+    struct bluez_gatt_char_io *io;
+
+    TRACE( "(%p, %s, %p)\n", connection, debugstr_a( characteristic->str ), stats );
+
+    if (!(io = bluez_gatt_char_io_get( characteristic, FALSE ))) return STATUS_SUCCESS;
+
+    pthread_mutex_lock( &bluez_gatt_io_lock );
+    if (io->notifications)
+        notification_ring_get_stats( io->notifications, stats );
+    pthread_mutex_unlock( &bluez_gatt_io_lock );
+    bluez_gatt_char_io_release( io );
+    return STATUS_SUCCESS;
+}
+
+struct bluez_device_pair_data
+{
+    IRP *irp;
+    struct bluez_watcher_ctx *watcher_ctx;
+};
+
+static void bluez_device_pair_callback( DBusPendingCall *pending, void *param )
+{
+    struct bluez_device_pair_data *data = param;
+    DBusMessage *reply;
+    DBusError error;
+    union winebluetooth_watcher_event_data event = {0};
+
+    event.pairing_finished.irp = data->irp;
+    reply = p_dbus_pending_call_steal_reply( pending );
+    p_dbus_error_init( &error );
+    if (p_dbus_set_error_from_message( &error, reply ))
+    {
+        event.pairing_finished.result = bluez_dbus_error_to_ntstatus( &error );
+        ERR( "Failed to pair: %s: %s\n", debugstr_a( error.name ), debugstr_a( error.message ) );
+    }
+    p_dbus_error_free( &error );
+
+    bluez_event_list_queue_new_event( &data->watcher_ctx->event_list,
+                                      BLUETOOTH_WATCHER_EVENT_TYPE_PAIRING_FINISHED, event );
+    p_dbus_message_unref( reply );
+}
+
+NTSTATUS bluez_device_start_pairing( void *connection, void *watcher_ctx, struct unix_name *device, IRP *irp )
+{
+    DBusMessage *request;
+    DBusPendingCall *pending_call = NULL;
+    struct bluez_device_pair_data *data;
+    dbus_bool_t success;
+
+    TRACE( "(%p, %p, %s, %p)\n", connection, watcher_ctx, debugstr_a( device->str ), irp );
+
+    request = p_dbus_message_new_method_call( BLUEZ_DEST, device->str, BLUEZ_INTERFACE_DEVICE, "Pair" );
+    if (!request)
+        return STATUS_NO_MEMORY;
+
+    data = malloc( sizeof( *data ) );
+    if (!data)
+    {
+        p_dbus_message_unref( request );
+        return STATUS_NO_MEMORY;
+    }
+    data->irp = irp;
+    data->watcher_ctx = watcher_ctx;
+    success = p_dbus_connection_send_with_reply( connection, request, &pending_call, bluez_timeout );
+    p_dbus_message_unref( request );
+    if (!success)
+        return STATUS_NO_MEMORY;
+    if (!pending_call)
+        return STATUS_INTERNAL_ERROR;
+    if (!p_dbus_pending_call_set_notify( pending_call, bluez_device_pair_callback, data, free ))
+    {
+        p_dbus_pending_call_cancel( pending_call );
+        p_dbus_pending_call_unref( pending_call );
+        return STATUS_NO_MEMORY;
+    }
+
+    p_dbus_pending_call_unref( pending_call );
+    return STATUS_PENDING;
+}
+
+struct bluez_watcher_event
+{
+    struct list entry;
+    enum winebluetooth_watcher_event_type event_type;
+    union winebluetooth_watcher_event_data event;
+
+    /* Some DBus signals, like PropertiesChanged in org.freedesktop.DBus.Properties, require us to
+     * perform an additional call to get the complete state of the object (in this instance, call
+     * Get/GetAll to get the values of invalidated properties). The event is queued out only once
+     * this call completes. */
+    DBusPendingCall *pending_call;
+};
+
+static BOOL bluez_event_list_queue_new_event_with_call(
+    struct list *event_list, enum winebluetooth_watcher_event_type event_type,
+    union winebluetooth_watcher_event_data event, DBusPendingCall *call,
+    DBusPendingCallNotifyFunction callback )
+{
+    struct bluez_watcher_event *event_entry;
+
+    if (!(event_entry = calloc(1, sizeof( *event_entry ) )))
+    {
+        ERR( "Could not allocate memory for DBus event.\n" );
+        return FALSE;
+    }
+
+    event_entry->event_type = event_type;
+    event_entry->event = event;
+    event_entry->pending_call = call;
+    if (call && callback)
+        p_dbus_pending_call_set_notify( call, callback, &event_entry->event, NULL );
+    list_add_tail( event_list, &event_entry->entry );
+    bluetooth_stats_event_queued();
+    bluez_wakeup_signal();
+
+    return TRUE;
+}
+
+static BOOL bluez_event_list_queue_new_event( struct list *event_list,
+                                              enum winebluetooth_watcher_event_type event_type,
+                                              union winebluetooth_watcher_event_data event )
+{
+    return bluez_event_list_queue_new_event_with_call( event_list, event_type, event, NULL, NULL );
+}
+
+static void bluez_filter_radio_props_changed_callback( DBusPendingCall *call, void *user_data )
+{
+    union winebluetooth_watcher_event_data *event = user_data;
+    struct winebluetooth_watcher_event_radio_props_changed *changed = &event->radio_props_changed;
+    const struct unix_name *radio = unix_name_from_handle( event->radio_props_changed.radio.handle );
+    DBusMessage *reply;
+    DBusMessageIter dict, prop_iter, variant;
+    const char *prop_name;
+    DBusError error;
+
+    TRACE( "call %p, radio %s\n", call, debugstr_a( radio->str ) );
+
+    reply = p_dbus_pending_call_steal_reply( call );
+    p_dbus_error_init( &error );
+    if (p_dbus_set_error_from_message( &error, reply ))
+    {
+        ERR( "Failed to get adapter properties for %s: %s: %s\n", debugstr_a( radio->str ),
+             debugstr_a( error.name ), debugstr_a( error.message ) );
+        p_dbus_error_free( &error );
+        p_dbus_message_unref( reply );
+        bluez_wakeup_signal();
+        return;
+    }
+    p_dbus_error_free( &error );
+
+    p_dbus_message_iter_init( reply, &dict );
+    p_dbus_message_iter_recurse( &dict, &prop_iter );
+    while((prop_name = bluez_next_dict_entry( &prop_iter, &variant )))
+    {
+        bluez_radio_prop_from_dict_entry( prop_name, &variant, &changed->props,
+                                          &changed->changed_props_mask, changed->invalid_props_mask );
+    }
+    changed->invalid_props_mask &= ~changed->changed_props_mask;
+    p_dbus_message_unref( reply );
+    /* The event queued with this call is ready to be handed out now. */
+    bluez_wakeup_signal();
+}
+
+static void bluez_filter_device_props_changed_callback( DBusPendingCall *call, void *user_data )
+{
+    union winebluetooth_watcher_event_data *event = user_data;
     struct winebluetooth_watcher_event_device_props_changed *changed = &event->device_props_changed;
-    const struct unix_name *device = (struct unix_name *)event->device_props_changed.device.handle;
+    const struct unix_name *device = unix_name_from_handle( event->device_props_changed.device.handle );
     DBusMessage *reply;
     DBusMessageIter dict, prop_iter, variant;
     const char *prop_name;
     DBusError error;
 
-    TRACE( "call %p, device %s\n", call, debugstr_a( device->str ) );
+    TRACE( "call %p, device %s\n", call, debugstr_a( device->str ) );
+
+    reply = p_dbus_pending_call_steal_reply( call );
+    p_dbus_error_init( &error );
+    if (p_dbus_set_error_from_message( &error, reply ))
+    {
+        ERR( "Failed to get device properties for %s: %s: %s\n", debugstr_a( device->str ), debugstr_a( error.name ),
+             debugstr_a( error.message ) );
+        p_dbus_error_free( &error );
+        p_dbus_message_unref( reply );
+        bluez_wakeup_signal();
+        return;
+    }
+    p_dbus_error_free( &error );
+
+    p_dbus_message_iter_init( reply, &dict );
+    p_dbus_message_iter_recurse( &dict, &prop_iter );
+    while((prop_name = bluez_next_dict_entry( &prop_iter, &variant )))
+    {
+        bluez_device_prop_from_dict_entry( prop_name, &variant, &changed->props,
+                                           &changed->changed_props_mask,
+                                           changed->invalid_props_mask );
+    }
+    changed->invalid_props_mask &= ~changed->changed_props_mask;
+    p_dbus_message_unref( reply );
+    bluez_wakeup_signal();
+}
+
+/* How long the changes to the properties of a device get held back after some were handed out, in milliseconds.
+ * WINEBTH_PROPS_INTERVAL overrides it, and setting it to 0 hands every change out as it comes. */
+#define BLUEZ_DEFAULT_PROPS_INTERVAL 100
+
+/* Every device whose properties changed during the last interval has one of these. Changes that only touch the
+ * properties taken from advertisements are merged into the pending event, with the latest value of each property
+ * winning, and are handed out once the interval is over. Any other change goes out right away, together with what
+ * was held back so far. */
+struct bluez_device_props_update
+{
+    struct rb_entry entry;
+    struct list timer_entry;
+    struct unix_name *device;
+    UINT64 deadline;
+    struct winebluetooth_watcher_event_device_props_changed pending;
+
+    /* The last event queued for this device along with a GetAll call. Until the call completes, later changes can
+     * still be merged into it. */
+    struct bluez_watcher_event *get_all_event;
+    DBusPendingCall *get_all_call;
+};
+
+static int bluez_device_props_update_compare( const void *key, const struct rb_entry *entry )
+{
+    const struct bluez_device_props_update *update = RB_ENTRY_VALUE( entry, struct bluez_device_props_update, entry );
+    const struct unix_name *device = key;
+
+    if (device == update->device) return 0;
+    return device < update->device ? -1 : 1;
+}
+
+static UINT64 bluez_now_ms( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (UINT64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Applies the changes in src on top of the ones in dst. */
+static void bluez_device_props_changed_merge( struct winebluetooth_watcher_event_device_props_changed *dst,
+                                              const struct winebluetooth_watcher_event_device_props_changed *src )
+{
+    winebluetooth_device_props_mask_t mask = src->changed_props_mask;
+
+    if (mask & WINEBLUETOOTH_DEVICE_PROPERTY_NAME)
+        memcpy( dst->props.name, src->props.name, sizeof( dst->props.name ) );
+    if (mask & WINEBLUETOOTH_DEVICE_PROPERTY_ADDRESS)
+        dst->props.address = src->props.address;
+    if (mask & WINEBLUETOOTH_DEVICE_PROPERTY_CONNECTED)
+        dst->props.connected = src->props.connected;
+    if (mask & WINEBLUETOOTH_DEVICE_PROPERTY_PAIRED)
+        dst->props.paired = src->props.paired;
+    if (mask & WINEBLUETOOTH_DEVICE_PROPERTY_LEGACY_PAIRING)
+        dst->props.legacy_pairing = src->props.legacy_pairing;
+    if (mask & WINEBLUETOOTH_DEVICE_PROPERTY_TRUSTED)
+        dst->props.trusted = src->props.trusted;
+    if (mask & WINEBLUETOOTH_DEVICE_PROPERTY_CLASS)
+        dst->props.class = src->props.class;
+    if (mask & WINEBLUETOOTH_DEVICE_PROPERTY_SERVICES_RESOLVED)
+        dst->props.services_resolved = src->props.services_resolved;
+    if (mask & WINEBLUETOOTH_DEVICE_PROPERTY_RSSI)
+        dst->props.rssi = src->props.rssi;
+    if (mask & WINEBLUETOOTH_DEVICE_PROPERTY_MANUFACTURER_DATA)
+    {
+        dst->props.manufacturer_data_size = src->props.manufacturer_data_size;
+        memcpy( dst->props.manufacturer_data, src->props.manufacturer_data, src->props.manufacturer_data_size );
+    }
+    if (mask & WINEBLUETOOTH_DEVICE_PROPERTY_SERVICE_DATA)
+    {
+        dst->props.service_data_size = src->props.service_data_size;
+        memcpy( dst->props.service_data, src->props.service_data, src->props.service_data_size );
+    }
+    dst->changed_props_mask = (dst->changed_props_mask & ~src->invalid_props_mask) | mask;
+    dst->invalid_props_mask = (dst->invalid_props_mask & ~mask) | src->invalid_props_mask;
+}
+
+static void bluez_device_props_update_free( struct bluez_watcher_ctx *ctx, struct bluez_device_props_update *update )
+{
+    rb_remove( &ctx->props_updates, &update->entry );
+    list_remove( &update->timer_entry );
+    if (update->get_all_call) p_dbus_pending_call_unref( update->get_all_call );
+    unix_name_free( update->device );
+    free( update );
+}
+
+/* Drops the changes held back for a device that is going away. */
+static void bluez_watcher_forget_device( struct bluez_watcher_ctx *ctx, struct unix_name *device )
+{
+    struct rb_entry *entry;
 
-    reply = p_dbus_pending_call_steal_reply( call );
-    p_dbus_error_init( &error );
-    if (p_dbus_set_error_from_message( &error, reply ))
+    if ((entry = rb_get( &ctx->props_updates, device )))
+        bluez_device_props_update_free( ctx, RB_ENTRY_VALUE( entry, struct bluez_device_props_update, entry ) );
+}
+
+/* Queues a device properties changed event, or holds it back if the device already had one handed out during the
+ * current interval. Takes ownership of the device name. */
+static BOOL bluez_watcher_queue_device_props_changed( DBusConnection *conn, struct bluez_watcher_ctx *ctx,
+                                                      struct unix_name *device,
+                                                      struct winebluetooth_watcher_event_device_props_changed *changed )
+{
+    const winebluetooth_device_props_mask_t adv_props = WINEBLUETOOTH_DEVICE_ADVERTISEMENT_PROPERTIES;
+    /* The advertisement properties only get invalidated once the device isn't in range anymore, so there is nothing
+     * to fetch for them. */
+    BOOL need_get_all = !!(changed->invalid_props_mask & ~adv_props);
+    struct bluez_device_props_update *update = NULL;
+    union winebluetooth_watcher_event_data event;
+    struct rb_entry *entry;
+
+    if (ctx->props_interval && (entry = rb_get( &ctx->props_updates, device )))
     {
-        ERR( "Failed to get device properties for %s: %s: %s\n", debugstr_a( device->str ), debugstr_a( error.name ),
-             debugstr_a( error.message ) );
-        p_dbus_error_free( &error );
-        p_dbus_message_unref( reply );
-        return;
+        update = RB_ENTRY_VALUE( entry, struct bluez_device_props_update, entry );
+        if (!need_get_all && update->get_all_call && !p_dbus_pending_call_get_completed( update->get_all_call ))
+        {
+            struct winebluetooth_watcher_event_device_props_changed *queued =
+                &update->get_all_event->event.device_props_changed;
+
+            bluez_device_props_changed_merge( queued, &update->pending );
+            bluez_device_props_changed_merge( queued, changed );
+            memset( &update->pending, 0, sizeof( update->pending ) );
+            unix_name_free( device );
+            return TRUE;
+        }
+        if (!need_get_all && !(changed->changed_props_mask & ~adv_props))
+        {
+            bluez_device_props_changed_merge( &update->pending, changed );
+            unix_name_free( device );
+            return TRUE;
+        }
+        bluez_device_props_changed_merge( &update->pending, changed );
+        *changed = update->pending;
+        memset( &update->pending, 0, sizeof( update->pending ) );
     }
-    p_dbus_error_free( &error );
 
-    p_dbus_message_iter_init( reply, &dict );
-    p_dbus_message_iter_recurse( &dict, &prop_iter );
-    while((prop_name = bluez_next_dict_entry( &prop_iter, &variant )))
+    changed->device.handle = device->handle;
+    event.device_props_changed = *changed;
+    if (need_get_all)
     {
-        bluez_device_prop_from_dict_entry( prop_name, &variant, &changed->props,
-                                           &changed->changed_props_mask,
-                                           changed->invalid_props_mask );
+        DBusPendingCall *pending_call = NULL;
+        NTSTATUS status;
+
+        status = bluez_device_get_props_by_path_async( conn, device->str, &pending_call );
+        if (status)
+        {
+            ERR( "Failed to create async call to get device properties: %#x\n", status );
+            unix_name_free( device );
+            return FALSE;
+        }
+
+        if (!bluez_event_list_queue_new_event_with_call( &ctx->event_list,
+                                                         BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_PROPERTIES_CHANGED,
+                                                         event, pending_call,
+                                                         bluez_filter_device_props_changed_callback ))
+        {
+            unix_name_free( device );
+            p_dbus_pending_call_cancel( pending_call );
+            p_dbus_pending_call_unref( pending_call );
+            return FALSE;
+        }
+        if (update)
+        {
+            if (update->get_all_call) p_dbus_pending_call_unref( update->get_all_call );
+            update->get_all_event = LIST_ENTRY( list_tail( &ctx->event_list ), struct bluez_watcher_event, entry );
+            update->get_all_call = p_dbus_pending_call_ref( pending_call );
+        }
     }
-    changed->invalid_props_mask &= ~changed->changed_props_mask;
-    p_dbus_message_unref( reply );
+    else if (!bluez_event_list_queue_new_event( &ctx->event_list, BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_PROPERTIES_CHANGED,
+                                                event ))
+    {
+        unix_name_free( device );
+        return FALSE;
+    }
+
+    /* Start holding back changes to the advertisement properties for the next interval. */
+    if (ctx->props_interval && !update && (update = calloc( 1, sizeof( *update ) )))
+    {
+        update->device = unix_name_dup( device );
+        update->deadline = bluez_now_ms() + ctx->props_interval;
+        if (need_get_all)
+        {
+            update->get_all_event = LIST_ENTRY( list_tail( &ctx->event_list ), struct bluez_watcher_event, entry );
+            update->get_all_call = p_dbus_pending_call_ref( update->get_all_event->pending_call );
+        }
+        rb_put( &ctx->props_updates, device, &update->entry );
+        list_add_tail( &ctx->props_update_timers, &update->timer_entry );
+    }
+    return TRUE;
+}
+
+/* Hands out the changes that were held back for the devices whose interval is over. */
+static void bluez_watcher_flush_props_updates( struct bluez_watcher_ctx *ctx )
+{
+    struct bluez_device_props_update *update, *next;
+    UINT64 now;
+
+    if (list_empty( &ctx->props_update_timers )) return;
+    now = bluez_now_ms();
+    LIST_FOR_EACH_ENTRY_SAFE( update, next, &ctx->props_update_timers, struct bluez_device_props_update, timer_entry )
+    {
+        union winebluetooth_watcher_event_data event;
+
+        if (update->deadline > now) break;
+        if (!update->pending.changed_props_mask && !update->pending.invalid_props_mask)
+        {
+            bluez_device_props_update_free( ctx, update );
+            continue;
+        }
+
+        event.device_props_changed = update->pending;
+        event.device_props_changed.device.handle = unix_name_dup( update->device )->handle;
+        if (!bluez_event_list_queue_new_event( &ctx->event_list, BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_PROPERTIES_CHANGED,
+                                               event ))
+            unix_name_free( update->device );
+        memset( &update->pending, 0, sizeof( update->pending ) );
+        /* Intervals all have the same length, so the list stays sorted by deadline. */
+        update->deadline = now + ctx->props_interval;
+        list_remove( &update->timer_entry );
+        list_add_tail( &ctx->props_update_timers, &update->timer_entry );
+    }
+}
+
+/* Returns how long until the next interval is over in milliseconds, or -1 if there is none. */
+static int bluez_watcher_props_update_timeout( struct bluez_watcher_ctx *ctx )
+{
+    struct bluez_device_props_update *update;
+    UINT64 now;
+
+    if (list_empty( &ctx->props_update_timers )) return -1;
+    update = LIST_ENTRY( list_head( &ctx->props_update_timers ), struct bluez_device_props_update, timer_entry );
+    now = bluez_now_ms();
+    return update->deadline > now ? min( update->deadline - now, INT_MAX ) : 0;
 }
 
 struct bluez_object_property_masks
@@ -1502,14 +2995,168 @@ static UINT16 bluez_dbus_get_invalidated_properties_from_iter(
     return mask;
 }
 
+/* Parses the properties of an org.bluez.GattService1 object. On success, the caller owns the references to the
+ * service and device names. */
+static NTSTATUS bluez_gatt_service_from_props( const char *path, DBusMessageIter *prop_iter,
+                                               struct winebluetooth_watcher_event_gatt_service_added *service )
+{
+    struct unix_name *service_name, *device_name = NULL;
+    DBusMessageIter variant;
+    const char *prop_name;
+
+    service_name = unix_name_get_or_create( path );
+    if (!service_name)
+    {
+        ERR( "Failed to allocate memory for service path %s\n", debugstr_a( path ) );
+        return STATUS_NO_MEMORY;
+    }
+
+    while ((prop_name = bluez_next_dict_entry( prop_iter, &variant )))
+    {
+        if (!strcmp( prop_name, "Device" )
+            && p_dbus_message_iter_get_arg_type( &variant ) == DBUS_TYPE_OBJECT_PATH )
+        {
+            const char *device_path;
+
+            p_dbus_message_iter_get_basic( &variant, &device_path );
+            device_name = unix_name_get_or_create( device_path );
+            if (!device_name)
+            {
+                unix_name_free( service_name );
+                ERR( "Failed to allocate memory for device path %s\n", debugstr_a( device_path ));
+                return STATUS_NO_MEMORY;
+            }
+        }
+        else if (!strcmp( prop_name, "Handle" )
+                 && p_dbus_message_iter_get_arg_type( &variant ) == DBUS_TYPE_UINT16)
+            p_dbus_message_iter_get_basic( &variant, &service->attr_handle );
+        else if (!strcmp( prop_name, "Primary" )
+                 && p_dbus_message_iter_get_arg_type( &variant ) == DBUS_TYPE_BOOLEAN)
+        {
+            dbus_bool_t primary;
+            p_dbus_message_iter_get_basic( &variant, &primary );
+            service->is_primary = !!primary;
+        }
+        else if (!strcmp( prop_name, "UUID" )
+                 && p_dbus_message_iter_get_arg_type( &variant ) == DBUS_TYPE_STRING)
+        {
+            const char *uuid_str;
+            p_dbus_message_iter_get_basic( &variant, &uuid_str );
+            if (!parse_uuid( &service->uuid, uuid_str ))
+                ERR("Failed to parse UUID %s for GATT service %s\n", debugstr_a( uuid_str ), path );
+        }
+    }
+    if (!device_name)
+    {
+        unix_name_free( service_name );
+        ERR( "Could not find the associated device for the GATT service %s\n", debugstr_a( path ) );
+        return STATUS_NOT_FOUND;
+    }
+
+    service->service.handle = service_name->handle;
+    service->device.handle = device_name->handle;
+    return STATUS_SUCCESS;
+}
+
+/* Parses the properties of an org.bluez.GattCharacteristic1 object. On success, the caller owns the references to
+ * the characteristic and service names. */
+static NTSTATUS bluez_gatt_characteristic_from_props(
+    const char *path, DBusMessageIter *prop_iter,
+    struct winebluetooth_watcher_event_gatt_characteristic_added *characteristic )
+{
+    struct unix_name *service_name = NULL, *char_name;
+    BTH_LE_GATT_CHARACTERISTIC *props = &characteristic->props;
+    DBusMessageIter variant;
+    const char *prop_name;
+
+    char_name = unix_name_get_or_create( path );
+    if (!char_name)
+    {
+        ERR("Failed to allocate memory for characteristic path %s\n", debugstr_a( path ));
+        return STATUS_NO_MEMORY;
+    }
+
+    while ((prop_name = bluez_next_dict_entry( prop_iter, &variant )))
+    {
+        if (!strcmp( prop_name, "Flags" )
+            && p_dbus_message_iter_get_arg_type ( &variant ) == DBUS_TYPE_ARRAY
+            && p_dbus_message_iter_get_element_type ( &variant ) == DBUS_TYPE_STRING)
+        {
+            DBusMessageIter flags_iter;
+            const struct {
+                const char *name;
+                BOOLEAN *flag;
+            } flags[] = {
+                { "broadcast", &props->IsBroadcastable },
+                { "read", &props->IsReadable },
+                { "write", &props->IsWritable },
+                { "write-without-response", &props->IsWritableWithoutResponse },
+                { "authenticate-signed-writes", &props->IsSignedWritable },
+                { "notify", &props->IsNotifiable },
+                { "indicate", &props->IsIndicatable },
+                { "extended-properties", &props->HasExtendedProperties },
+            };
+
+            p_dbus_message_iter_recurse( &variant, &flags_iter );
+            while (p_dbus_message_iter_get_arg_type( &flags_iter ) != DBUS_TYPE_INVALID)
+            {
+                const char *flag_name;
+                SIZE_T i;
+
+                p_dbus_message_iter_get_basic( &flags_iter, &flag_name );
+                for (i = 0; i < ARRAY_SIZE( flags ); i++)
+                {
+                    if (!strcmp( flags[i].name, flag_name ))
+                        *flags[i].flag = TRUE;
+                }
+                p_dbus_message_iter_next( &flags_iter );
+            }
+        }
+        else if (!strcmp( prop_name, "Service" )
+                 && p_dbus_message_iter_get_arg_type( &variant ) == DBUS_TYPE_OBJECT_PATH)
+        {
+            const char *path;
+
+            p_dbus_message_iter_get_basic( &variant, &path );
+            service_name = unix_name_get_or_create( path );
+        }
+        else if (!strcmp( prop_name, "UUID" )
+                 && p_dbus_message_iter_get_arg_type( &variant ) == DBUS_TYPE_STRING)
+        {
+            const char *uuid_str;
+            GUID uuid;
+
+            p_dbus_message_iter_get_basic( &variant, &uuid_str );
+            if (parse_uuid( &uuid, uuid_str ))
+                uuid_to_le( &uuid, &props->CharacteristicUuid );
+            else
+                ERR( "Failed to parse UUID %s for GATT characteristic %s\n", debugstr_a( uuid_str ), path );
+        }
+        else if (!strcmp( prop_name, "Handle" )
+                 && p_dbus_message_iter_get_arg_type( &variant ) == DBUS_TYPE_UINT16)
+            p_dbus_message_iter_get_basic( &variant, &props->AttributeHandle );
+    }
+    if (!service_name)
+    {
+        unix_name_free( char_name );
+        ERR( "Could not find the associated service for the GATT charcteristic %s\n", debugstr_a( path ) );
+        return STATUS_NOT_FOUND;
+    }
+
+    characteristic->characteristic.handle = char_name->handle;
+    characteristic->service.handle = service_name->handle;
+    return STATUS_SUCCESS;
+}
+
 static DBusHandlerResult bluez_filter( DBusConnection *conn, DBusMessage *msg, void *user_data )
 {
+    struct bluez_watcher_ctx *watcher_ctx = user_data;
     struct list *event_list;
 
     if (TRACE_ON( dbus ))
         TRACE_( dbus )( "(%s, %s, %p)\n", dbgstr_dbus_connection( conn ), dbgstr_dbus_message( msg ), user_data );
 
-    event_list = &((struct bluez_watcher_ctx *)user_data)->event_list;
+    event_list = &watcher_ctx->event_list;
 
     if (p_dbus_message_is_signal( msg, DBUS_INTERFACE_OBJECTMANAGER, DBUS_OBJECTMANAGER_SIGNAL_INTERFACESADDED )
         && p_dbus_message_has_signature( msg, DBUS_INTERFACES_ADDED_SIGNATURE ))
@@ -1546,14 +3193,14 @@ static DBusHandlerResult bluez_filter( DBusConnection *conn, DBusMessage *msg, v
                 }
 
                 radio = unix_name_get_or_create( object_path );
-                radio_added.radio.handle = (UINT_PTR)radio;
-                if (!radio_added.radio.handle)
+                if (!radio)
                 {
                     ERR( "failed to allocate memory for adapter path %s\n", debugstr_a( object_path ) );
                     break;
                 }
                 else
                 {
+                    radio_added.radio.handle = radio->handle;
                     union winebluetooth_watcher_event_data event = { .radio_added = radio_added };
                     TRACE( "New BlueZ org.bluez.Adapter1 object added at %s: %p\n",
                            debugstr_a( object_path ), radio );
@@ -1570,12 +3217,12 @@ static DBusHandlerResult bluez_filter( DBusConnection *conn, DBusMessage *msg, v
                 const char *prop_name;
 
                 device_name = unix_name_get_or_create( object_path );
-                device_added.device.handle = (UINT_PTR)device_name;
                 if (!device_name)
                 {
                     ERR("Failed to allocate memory for device path %s\n", debugstr_a( object_path ));
                     break;
                 }
+                device_added.device.handle = device_name->handle;
                 p_dbus_message_iter_next( &iface_entry );
                 p_dbus_message_iter_recurse( &iface_entry, &props_iter );
 
@@ -1594,7 +3241,7 @@ static DBusHandlerResult bluez_filter( DBusConnection *conn, DBusMessage *msg, v
                             ERR("Failed to allocate memory for radio path %s\n", debugstr_a( path ));
                             break;
                         }
-                        device_added.radio.handle = (UINT_PTR)radio_name;
+                        device_added.radio.handle = radio_name->handle;
                     }
                     else
                         bluez_device_prop_from_dict_entry( prop_name, &variant, &device_added.props,
@@ -1620,6 +3267,47 @@ static DBusHandlerResult bluez_filter( DBusConnection *conn, DBusMessage *msg, v
                     }
                 }
             }
+            else if (!strcmp( iface_name, BLUEZ_INTERFACE_GATT_SERVICE ))
+            {
+                union winebluetooth_watcher_event_data event = {0};
+                DBusMessageIter props_iter;
+
+                p_dbus_message_iter_next( &iface_entry );
+                p_dbus_message_iter_recurse( &iface_entry, &props_iter );
+                if (!bluez_gatt_service_from_props( object_path, &props_iter, &event.gatt_service_added ))
+                {
+                    TRACE( "New BlueZ org.bluez.GattService1 object added at %s: %p\n", debugstr_a( object_path ),
+                           (void *)event.gatt_service_added.service.handle );
+                    if (!bluez_event_list_queue_new_event( event_list,
+                                                           BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_GATT_SERVICE_ADDED,
+                                                           event ))
+                    {
+                        unix_name_free_handle( event.gatt_service_added.service.handle );
+                        unix_name_free_handle( event.gatt_service_added.device.handle );
+                    }
+                }
+            }
+            else if (!strcmp( iface_name, BLUEZ_INTERFACE_GATT_CHARACTERISTICS ))
+            {
+                union winebluetooth_watcher_event_data event = {0};
+                DBusMessageIter props_iter;
+
+                p_dbus_message_iter_next( &iface_entry );
+                p_dbus_message_iter_recurse( &iface_entry, &props_iter );
+                if (!bluez_gatt_characteristic_from_props( object_path, &props_iter,
+                                                           &event.gatt_characteristic_added ))
+                {
+                    TRACE( "New BlueZ org.bluez.GattCharacteristic1 object added at %s: %p\n",
+                           debugstr_a( object_path ), (void *)event.gatt_characteristic_added.characteristic.handle );
+                    if (!bluez_event_list_queue_new_event( event_list,
+                                                           BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_ADDED,
+                                                           event ))
+                    {
+                        unix_name_free_handle( event.gatt_characteristic_added.characteristic.handle );
+                        unix_name_free_handle( event.gatt_characteristic_added.service.handle );
+                    }
+                }
+            }
             p_dbus_message_iter_next( &ifaces_iter );
         }
     }
@@ -1659,7 +3347,7 @@ static DBusHandlerResult bluez_filter( DBusConnection *conn, DBusMessage *msg, v
                     ERR( "failed to allocate memory for adapter path %s\n", object_path );
                     continue;
                 }
-                radio.handle = (UINT_PTR)radio_name;
+                radio.handle = radio_name->handle;
                 event.radio_removed = radio;
                 if (!bluez_event_list_queue_new_event(
                         event_list, BLUETOOTH_WATCHER_EVENT_TYPE_RADIO_REMOVED, event ))
@@ -1676,7 +3364,8 @@ static DBusHandlerResult bluez_filter( DBusConnection *conn, DBusMessage *msg, v
                     ERR( "Failed to allocate memory for adapter path %s\n", object_path );
                     continue;
                 }
-                event.device_removed.device.handle = (UINT_PTR)device;
+                bluez_watcher_forget_device( watcher_ctx, device );
+                event.device_removed.device.handle = device->handle;
                 if (!bluez_event_list_queue_new_event( event_list, BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_REMOVED,
                                                        event ))
                     unix_name_free( device );
@@ -1692,7 +3381,7 @@ static DBusHandlerResult bluez_filter( DBusConnection *conn, DBusMessage *msg, v
                     ERR( "Failed to allocate memory for GATT service path %s\n", debugstr_a( object_path ) );
                     continue;
                 }
-                event.gatt_service_removed.handle = (UINT_PTR)service;
+                event.gatt_service_removed.handle = service->handle;
                 if (!bluez_event_list_queue_new_event( event_list, BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_GATT_SERVICE_REMOVED,
                                                        event ))
                     unix_name_free( service );
@@ -1708,7 +3397,8 @@ static DBusHandlerResult bluez_filter( DBusConnection *conn, DBusMessage *msg, v
                     ERR( "Failed to allocate memory for GATT characteristic path %s\n", debugstr_a( object_path ) );
                     continue;
                 }
-                event.gatt_characterisic_removed.handle = (UINT_PTR)chrc;
+                bluez_gatt_char_io_remove_by_path( object_path );
+                event.gatt_characterisic_removed.handle = chrc->handle;
                 if (!bluez_event_list_queue_new_event( event_list, BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_REMOVED,
                                                        event ))
                     unix_name_free( chrc );
@@ -1769,7 +3459,7 @@ static DBusHandlerResult bluez_filter( DBusConnection *conn, DBusMessage *msg, v
                 ERR( "failed to allocate memory for adapter path %s\n", debugstr_a( object_path ) );
                 return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
             }
-            props_changed.radio.handle = (UINT_PTR)radio;
+            props_changed.radio.handle = radio->handle;
             TRACE( "Properties changed for radio %s, changed %#x, invalid %#x\n",
                    debugstr_a( radio->str ), props_changed.changed_props_mask,
                   props_changed.invalid_props_mask );
@@ -1815,7 +3505,6 @@ static DBusHandlerResult bluez_filter( DBusConnection *conn, DBusMessage *msg, v
             struct winebluetooth_watcher_event_device_props_changed props_changed = {0};
             struct unix_name *device;
             const char *prop_name, *object_path;
-            union winebluetooth_watcher_event_data event;
             DBusMessageIter changed_props_iter, invalid_props_iter, variant;
             const static struct bluez_object_property_masks device_prop_masks[] = {
                 { "Name", WINEBLUETOOTH_DEVICE_PROPERTY_NAME },
@@ -1824,7 +3513,11 @@ static DBusHandlerResult bluez_filter( DBusConnection *conn, DBusMessage *msg, v
                 { "Paired", WINEBLUETOOTH_DEVICE_PROPERTY_PAIRED },
                 { "LegacyPairing", WINEBLUETOOTH_DEVICE_PROPERTY_LEGACY_PAIRING },
                 { "Trusted", WINEBLUETOOTH_DEVICE_PROPERTY_TRUSTED },
-                { "Class", WINEBLUETOOTH_DEVICE_PROPERTY_CLASS }
+                { "Class", WINEBLUETOOTH_DEVICE_PROPERTY_CLASS },
+                { "ServicesResolved", WINEBLUETOOTH_DEVICE_PROPERTY_SERVICES_RESOLVED },
+                { "RSSI", WINEBLUETOOTH_DEVICE_PROPERTY_RSSI },
+                { "ManufacturerData", WINEBLUETOOTH_DEVICE_PROPERTY_MANUFACTURER_DATA },
+                { "ServiceData", WINEBLUETOOTH_DEVICE_PROPERTY_SERVICE_DATA }
             };
 
             p_dbus_message_iter_next( &iter );
@@ -1853,41 +3546,32 @@ static DBusHandlerResult bluez_filter( DBusConnection *conn, DBusMessage *msg, v
                 ERR( "Failed to allocate memory for device path %s\n", object_path );
                 return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
             }
-            props_changed.device.handle = (UINT_PTR)device;
-            event.device_props_changed = props_changed;
+            if (!bluez_watcher_queue_device_props_changed( conn, watcher_ctx, device, &props_changed ))
+                return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+        }
+        else if (strcmp( iface, BLUEZ_INTERFACE_GATT_CHARACTERISTICS ) == 0)
+        {
+            DBusMessageIter changed_props_iter, variant;
+            const char *prop_name;
 
-            if (props_changed.invalid_props_mask != 0)
+            /* Values sent by the device only show up here for characteristics using StartNotify. */
+            p_dbus_message_iter_next( &iter );
+            p_dbus_message_iter_recurse( &iter, &changed_props_iter );
+            while ((prop_name = bluez_next_dict_entry( &changed_props_iter, &variant )))
             {
-                DBusPendingCall *pending_call = NULL;
-                NTSTATUS status;
-
-                status = bluez_device_get_props_by_path_async( conn, device->str, &pending_call );
-                if (status)
+                if (!strcmp( prop_name, "Value" )
+                    && p_dbus_message_iter_get_arg_type( &variant ) == DBUS_TYPE_ARRAY
+                    && p_dbus_message_iter_get_element_type( &variant ) == DBUS_TYPE_BYTE)
                 {
-                    ERR( "Failed to create async call to get device properties: %#x\n", status );
-                    unix_name_free( device );
-                    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
-                }
+                    DBusMessageIter array_iter;
+                    const unsigned char *value;
+                    int len;
 
-                if (!bluez_event_list_queue_new_event_with_call( event_list,
-                                                                 BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_PROPERTIES_CHANGED,
-                                                                 event, pending_call,
-                                                                 bluez_filter_device_props_changed_callback ))
-                {
-                    unix_name_free( device );
-                    p_dbus_pending_call_cancel( pending_call );
-                    p_dbus_pending_call_unref( pending_call );
-                    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+                    p_dbus_message_iter_recurse( &variant, &array_iter );
+                    p_dbus_message_iter_get_fixed_array( &array_iter, &value, &len );
+                    bluez_gatt_char_io_value_changed( event_list, p_dbus_message_get_path( msg ), value, len );
                 }
             }
-            else if (!bluez_event_list_queue_new_event( event_list,
-                                                        BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_PROPERTIES_CHANGED,
-                                                        event ))
-            {
-
-                unix_name_free( device );
-                return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
-            }
         }
     }
 
@@ -1908,6 +3592,7 @@ static const char *BLUEZ_MATCH_RULES[] = { BLUEZ_MATCH_OBJECTMANAGER, BLUEZ_MATC
 /* Free up the watcher alongside any remaining events and initial devices and other associated resources. */
 static void bluez_watcher_free( struct bluez_watcher_ctx *watcher )
 {
+    struct bluez_device_props_update *update1, *update2;
     struct bluez_watcher_event *event1, *event2;
     struct bluez_init_entry *entry1, *entry2;
 
@@ -1920,7 +3605,7 @@ static void bluez_watcher_free( struct bluez_watcher_ctx *watcher )
     LIST_FOR_EACH_ENTRY_SAFE( entry1, entry2, &watcher->initial_radio_list, struct bluez_init_entry, entry )
     {
         list_remove( &entry1->entry );
-        unix_name_free( (struct unix_name *)entry1->object.radio.radio.handle );
+        unix_name_free_handle( entry1->object.radio.radio.handle );
         free( entry1 );
     }
 
@@ -1930,44 +3615,55 @@ static void bluez_watcher_free( struct bluez_watcher_ctx *watcher )
         switch (event1->event_type)
         {
         case BLUETOOTH_WATCHER_EVENT_TYPE_RADIO_ADDED:
-            unix_name_free( (struct unix_name *)event1->event.radio_added.radio.handle );
+            unix_name_free_handle( event1->event.radio_added.radio.handle );
             break;
         case BLUETOOTH_WATCHER_EVENT_TYPE_RADIO_REMOVED:
-            unix_name_free( (struct unix_name *)event1->event.radio_removed.handle );
+            unix_name_free_handle( event1->event.radio_removed.handle );
             break;
         case BLUETOOTH_WATCHER_EVENT_TYPE_RADIO_PROPERTIES_CHANGED:
-            unix_name_free( (struct unix_name *)event1->event.radio_props_changed.radio.handle );
+            unix_name_free_handle( event1->event.radio_props_changed.radio.handle );
             break;
         case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_ADDED:
-            unix_name_free( (struct unix_name *)event1->event.device_added.radio.handle );
-            unix_name_free( (struct unix_name *)event1->event.device_added.device.handle );
+            unix_name_free_handle( event1->event.device_added.radio.handle );
+            unix_name_free_handle( event1->event.device_added.device.handle );
             break;
         case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_REMOVED:
-            unix_name_free( (struct unix_name *)event1->event.device_removed.device.handle );
+            unix_name_free_handle( event1->event.device_removed.device.handle );
             break;
         case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_PROPERTIES_CHANGED:
-            unix_name_free( (struct unix_name *)event1->event.device_props_changed.device.handle );
+            unix_name_free_handle( event1->event.device_props_changed.device.handle );
             break;
         case BLUETOOTH_WATCHER_EVENT_TYPE_PAIRING_FINISHED:
             break;
         case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_GATT_SERVICE_ADDED:
-            unix_name_free( (struct unix_name *)event1->event.gatt_service_added.device.handle );
-            unix_name_free( (struct unix_name *)event1->event.gatt_service_added.service.handle );
+            unix_name_free_handle( event1->event.gatt_service_added.device.handle );
+            unix_name_free_handle( event1->event.gatt_service_added.service.handle );
             break;
         case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_GATT_SERVICE_REMOVED:
-            unix_name_free( (struct unix_name *)event1->event.gatt_service_removed.handle );
+            unix_name_free_handle( event1->event.gatt_service_removed.handle );
             break;
         case BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_ADDED:
-            unix_name_free( (struct unix_name *)event1->event.gatt_characteristic_added.characteristic.handle );
-            unix_name_free( (struct unix_name *)event1->event.gatt_characteristic_added.service.handle );
+            unix_name_free_handle( event1->event.gatt_characteristic_added.characteristic.handle );
+            unix_name_free_handle( event1->event.gatt_characteristic_added.service.handle );
             break;
         case BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_REMOVED:
-            unix_name_free( (struct unix_name *)event1->event.gatt_characterisic_removed.handle );
+            unix_name_free_handle( event1->event.gatt_characterisic_removed.handle );
+            break;
+        case BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_VALUE_CHANGED:
+            unix_name_free_handle( event1->event.gatt_characteristic_value_changed.handle );
+            break;
+        case BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_IO_FINISHED:
+            unix_name_free_handle( event1->event.gatt_characteristic_io_finished.characteristic.handle );
             break;
         }
         free( event1 );
     }
 
+    LIST_FOR_EACH_ENTRY_SAFE( update1, update2, &watcher->props_update_timers, struct bluez_device_props_update,
+                              timer_entry )
+        bluez_device_props_update_free( watcher, update1 );
+
+    bluez_gatt_char_io_remove_all();
     free( watcher );
 }
 
@@ -1978,6 +3674,7 @@ NTSTATUS bluez_watcher_init( void *connection, void **ctx )
     DBusPendingCall *call;
     struct bluez_watcher_ctx *watcher_ctx =
         calloc( 1, sizeof( struct bluez_watcher_ctx ) );
+    const char *interval;
     SIZE_T i;
 
     if (watcher_ctx == NULL) return STATUS_NO_MEMORY;
@@ -1994,6 +3691,11 @@ NTSTATUS bluez_watcher_init( void *connection, void **ctx )
     list_init( &watcher_ctx->initial_gatt_service_list );
     list_init( &watcher_ctx->initial_gatt_chars_list );
     list_init( &watcher_ctx->event_list );
+    rb_init( &watcher_ctx->props_updates, bluez_device_props_update_compare );
+    list_init( &watcher_ctx->props_update_timers );
+    interval = getenv( "WINEBTH_PROPS_INTERVAL" );
+    watcher_ctx->props_interval = interval ? strtoul( interval, NULL, 10 ) : BLUEZ_DEFAULT_PROPS_INTERVAL;
+    TRACE( "Coalescing device property changes every %u ms\n", watcher_ctx->props_interval );
 
     /* The bluez_dbus_loop thread will free up the watcher when the disconnect message is processed (i.e,
      * dbus_connection_read_write_dispatch returns false). Using a free-function with dbus_connection_add_filter
@@ -2095,7 +3797,7 @@ static NTSTATUS bluez_build_initial_device_lists( DBusMessage *reply, struct lis
                         prop_name, &variant, &init_device->object.radio.props,
                         &init_device->object.radio.props_mask, WINEBLUETOOTH_RADIO_ALL_PROPERTIES );
                 }
-                init_device->object.radio.radio.handle = (UINT_PTR)radio_name;
+                init_device->object.radio.radio.handle = radio_name->handle;
                 list_add_tail( adapter_list, &init_device->entry );
                 TRACE( "Found BlueZ org.bluez.Adapter1 object %s: %p\n",
                        debugstr_a( radio_name->str ), radio_name );
@@ -2121,7 +3823,7 @@ static NTSTATUS bluez_build_initial_device_lists( DBusMessage *reply, struct lis
                     status = STATUS_NO_MEMORY;
                     goto done;
                 }
-                init_device->object.device.device.handle = (UINT_PTR)device_name;
+                init_device->object.device.device.handle = device_name->handle;
                 init_device->object.device.init_entry = TRUE;
 
                 while((prop_name = bluez_next_dict_entry( &prop_iter, &variant )))
@@ -2139,7 +3841,7 @@ static NTSTATUS bluez_build_initial_device_lists( DBusMessage *reply, struct lis
                             status = STATUS_NO_MEMORY;
                             goto done;
                         }
-                        init_device->object.device.radio.handle = (UINT_PTR)radio_name;
+                        init_device->object.device.radio.handle = radio_name->handle;
                     }
                     else
                         bluez_device_prop_from_dict_entry( prop_name, &variant, &init_device->object.device.props,
@@ -2159,10 +3861,7 @@ static NTSTATUS bluez_build_initial_device_lists( DBusMessage *reply, struct lis
             }
             else if (!strcmp( iface, BLUEZ_INTERFACE_GATT_SERVICE ))
             {
-                struct unix_name *service_name, *device_name = NULL;
                 struct bluez_init_entry *init_device;
-                DBusMessageIter variant;
-                const char *prop_name;
 
                 init_device = calloc( 1, sizeof( *init_device ) );
                 if (!init_device)
@@ -2170,71 +3869,23 @@ static NTSTATUS bluez_build_initial_device_lists( DBusMessage *reply, struct lis
                     status = STATUS_NO_MEMORY;
                     goto done;
                 }
-
-                service_name = unix_name_get_or_create( path );
-                if (!service_name)
-                {
-                    ERR( "Failed to allocate memory for service path %s\n", debugstr_a( path ) );
-                    break;
-                }
-                init_device->object.service.service.handle = (UINT_PTR)service_name;
-
-                while ((prop_name = bluez_next_dict_entry( &prop_iter, &variant )))
-                {
-                    if (!strcmp( prop_name, "Device" )
-                        && p_dbus_message_iter_get_arg_type( &variant ) == DBUS_TYPE_OBJECT_PATH )
-                    {
-                        const char *device_path;
-
-                        p_dbus_message_iter_get_basic( &variant, &device_path );
-                        device_name = unix_name_get_or_create( device_path );
-                        if (!device_name)
-                        {
-                            unix_name_free( service_name );
-                            free( init_device );
-                            ERR( "Failed to allocate memory for device path %s\n", debugstr_a( device_path ));
-                            status = STATUS_NO_MEMORY;
-                            goto done;
-                        }
-                        init_device->object.service.device.handle = (UINT_PTR)device_name;
-                    }
-                    else if (!strcmp( prop_name, "Handle" )
-                             && p_dbus_message_iter_get_arg_type( &variant ) == DBUS_TYPE_UINT16)
-                        p_dbus_message_iter_get_basic( &variant, &init_device->object.service.attr_handle );
-                    else if (!strcmp( prop_name, "Primary" )
-                             && p_dbus_message_iter_get_arg_type( &variant ) == DBUS_TYPE_BOOLEAN)
-                    {
-                        dbus_bool_t primary;
-                        p_dbus_message_iter_get_basic( &variant, &primary );
-                        init_device->object.service.is_primary = !!primary;
-                    }
-                    else if (!strcmp( prop_name, "UUID" )
-                             && p_dbus_message_iter_get_arg_type( &variant ) == DBUS_TYPE_STRING)
-                    {
-                        const char *uuid_str;
-                        p_dbus_message_iter_get_basic( &variant, &uuid_str );
-                        if (!parse_uuid( &init_device->object.service.uuid, uuid_str ))
-                            ERR("Failed to parse UUID %s for GATT service %s\n", debugstr_a( uuid_str ), path );
-                    }
-                }
-                if (!device_name)
+                status = bluez_gatt_service_from_props( path, &prop_iter, &init_device->object.service );
+                if (status)
                 {
-                    unix_name_free( service_name );
                     free( init_device );
-                    ERR( "Could not find the associated device for the GATT service %s\n", debugstr_a( path ) );
+                    if (status == STATUS_NO_MEMORY)
+                        goto done;
+                    status = STATUS_SUCCESS;
                     break;
                 }
                 list_add_tail( gatt_service_list, &init_device->entry );
-                TRACE( "Found BlueZ org.bluez.GattService1 object %s %p\n", debugstr_a( path ), service_name );
+                TRACE( "Found BlueZ org.bluez.GattService1 object %s %p\n", debugstr_a( path ),
+                       (void *)init_device->object.service.service.handle );
                 break;
             }
             else if (!strcmp( iface, BLUEZ_INTERFACE_GATT_CHARACTERISTICS ))
             {
-                struct unix_name *service_name = NULL, *char_name;
                 struct bluez_init_entry *init_entry;
-                BTH_LE_GATT_CHARACTERISTIC *props;
-                DBusMessageIter variant;
-                const char *prop_name;
 
                 init_entry = calloc( 1, sizeof( *init_entry ) );
                 if (!init_entry)
@@ -2242,87 +3893,18 @@ static NTSTATUS bluez_build_initial_device_lists( DBusMessage *reply, struct lis
                     status = STATUS_NO_MEMORY;
                     goto done;
                 }
-                char_name = unix_name_get_or_create( path );
-                if (!char_name)
-                {
-                    ERR("Failed to allocate memory for characteristic path %s\n", debugstr_a( path ));
-                    free( init_entry );
-                    goto done;
-                }
-
-                props = &init_entry->object.characteristic.props;
-                init_entry->object.characteristic.characteristic.handle = (UINT_PTR)char_name;
-                while ((prop_name = bluez_next_dict_entry( &prop_iter, &variant )))
-                {
-                    if (!strcmp( prop_name, "Flags" )
-                        && p_dbus_message_iter_get_arg_type ( &variant ) == DBUS_TYPE_ARRAY
-                        && p_dbus_message_iter_get_element_type ( &variant ) == DBUS_TYPE_STRING)
-                    {
-                        DBusMessageIter flags_iter;
-                        const struct {
-                            const char *name;
-                            BOOLEAN *flag;
-                        } flags[] = {
-                            { "broadcast", &props->IsBroadcastable },
-                            { "read", &props->IsReadable },
-                            { "write", &props->IsWritable },
-                            { "write-without-response", &props->IsWritableWithoutResponse },
-                            { "authenticate-signed-writes", &props->IsSignedWritable },
-                            { "notify", &props->IsNotifiable },
-                            { "indicate", &props->IsIndicatable },
-                            { "extended-properties", &props->HasExtendedProperties },
-                        };
-
-                        p_dbus_message_iter_recurse( &variant, &flags_iter );
-                        while (p_dbus_message_iter_get_arg_type( &flags_iter ) != DBUS_TYPE_INVALID)
-                        {
-                            const char *flag_name;
-                            SIZE_T i;
-
-                            p_dbus_message_iter_get_basic( &flags_iter, &flag_name );
-                            for (i = 0; i < ARRAY_SIZE( flags ); i++)
-                            {
-                                if (!strcmp( flags[i].name, flag_name ))
-                                    *flags[i].flag = TRUE;
-                            }
-                            p_dbus_message_iter_next( &flags_iter );
-                        }
-                    }
-                    else if (!strcmp( prop_name, "Service" )
-                             && p_dbus_message_iter_get_arg_type( &variant ) == DBUS_TYPE_OBJECT_PATH)
-                    {
-                        const char *path;
-
-                        p_dbus_message_iter_get_basic( &variant, &path );
-                        service_name = unix_name_get_or_create( path );
-                    }
-                    else if (!strcmp( prop_name, "UUID" )
-                             && p_dbus_message_iter_get_arg_type( &variant ) == DBUS_TYPE_STRING)
-                    {
-                        const char *uuid_str;
-                        GUID uuid;
-
-                        p_dbus_message_iter_get_basic( &variant, &uuid_str );
-                        if (parse_uuid( &uuid, uuid_str ))
-                            uuid_to_le( &uuid, &props->CharacteristicUuid );
-                        else
-                            ERR( "Failed to parse UUID %s for GATT characteristic %s\n", debugstr_a( uuid_str ), path );
-                    }
-                    else if (!strcmp( prop_name, "Handle" )
-                             && p_dbus_message_iter_get_arg_type( &variant ) == DBUS_TYPE_UINT16)
-                        p_dbus_message_iter_get_basic( &variant, &props->AttributeHandle );
-                }
-                if (!service_name)
+                status = bluez_gatt_characteristic_from_props( path, &prop_iter, &init_entry->object.characteristic );
+                if (status)
                 {
-                    unix_name_free( char_name );
                     free( init_entry );
-                    ERR( "Could not find the associated service for the GATT charcteristic %s\n", debugstr_a( path ) );
+                    if (status == STATUS_NO_MEMORY)
+                        goto done;
+                    status = STATUS_SUCCESS;
                     break;
                 }
-                init_entry->object.characteristic.service.handle = (UINT_PTR)service_name;
-
                 list_add_tail( gatt_chars_list, &init_entry->entry );
-                TRACE( "Found Bluez org.bluez.GattCharacteristic1 object %s %p\n", debugstr_a( path ), char_name );
+                TRACE( "Found Bluez org.bluez.GattCharacteristic1 object %s %p\n", debugstr_a( path ),
+                       (void *)init_entry->object.characteristic.characteristic.handle );
                 break;
             }
         }
@@ -2391,6 +3973,7 @@ static BOOL bluez_watcher_event_queue_ready( struct bluez_watcher_ctx *ctx, stru
         event->event_type = watcher_event->event_type;
         event->event_data = watcher_event->event;
         list_remove( &watcher_event->entry );
+        bluetooth_stats_event_dequeued();
         if (watcher_event->pending_call)
             p_dbus_pending_call_unref( watcher_event->pending_call );
         free( watcher_event );
@@ -2407,7 +3990,7 @@ static BOOL bluez_auth_agent_ctx_have_event( struct bluez_auth_agent_ctx *ctx,
     pthread_mutex_lock( &ctx->lock );
     if (ctx->status == BLUEZ_PAIRING_SESSION_INCOMING)
     {
-        event->device.handle = (UINT_PTR)unix_name_dup( ctx->device );
+        event->device.handle = unix_name_dup( ctx->device )->handle;
         event->method = ctx->method;
         event->numeric_value_or_passkey = ctx->passkey;
 
@@ -2419,37 +4002,89 @@ static BOOL bluez_auth_agent_ctx_have_event( struct bluez_auth_agent_ctx *ctx,
     return have_event;
 }
 
-NTSTATUS bluez_dbus_loop( void *c, void *watcher, void *auth_agent,
-                          struct winebluetooth_event *result )
+/* Blocks until a DBus message, a value on one of the AcquireNotify sockets, or a wakeup arrives, and dispatches
+ * whatever arrived. Returns FALSE if the connection to DBus was lost. */
+static BOOL bluez_dbus_loop_wait( DBusConnection *connection, struct bluez_watcher_ctx *watcher_ctx )
+{
+    struct pollfd *fds;
+    SIZE_T count;
+    int fd, timeout;
+
+    if (!p_dbus_connection_get_unix_fd( connection, &fd ) || !bluez_gatt_char_io_poll_reserve( 0 ))
+        return p_dbus_connection_read_write_dispatch( connection, 100 );
+
+    count = bluez_gatt_char_io_poll_fds();
+    fds = bluez_poll_fds;
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    if (p_dbus_connection_has_messages_to_send( connection ))
+        fds[0].events |= POLLOUT;
+    fds[1].fd = bluez_wakeup_fds[0];
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+    /* libdbus may have already read messages from the socket that still need dispatching. */
+    if (p_dbus_connection_get_dispatch_status( connection ) == DBUS_DISPATCH_DATA_REMAINS)
+        timeout = 0;
+    else
+    {
+        timeout = bluez_watcher_props_update_timeout( watcher_ctx );
+        if (fds[1].fd == -1 && (timeout == -1 || timeout > 100)) timeout = 100;
+    }
+    poll( fds, count + 2, timeout );
+
+    if (fds[1].revents & POLLIN) bluez_wakeup_drain();
+    bluez_gatt_char_io_poll_done( &watcher_ctx->event_list, &fds[2], bluez_poll_ios, count );
+    return p_dbus_connection_read_write_dispatch( connection, 0 );
+}
+
+NTSTATUS bluez_dbus_loop( void *c, void *watcher, void *auth_agent, struct winebluetooth_event *events,
+                          UINT32 max_count, UINT32 *count )
 {
     DBusConnection *connection;
     struct bluez_watcher_ctx *watcher_ctx = watcher;
     auth_agent = bluez_auth_agent_ctx_incref( auth_agent );
 
-    TRACE( "(%p, %p, %p)\n", c, watcher, result );
+    TRACE( "(%p, %p, %p, %u)\n", c, watcher, events, max_count );
     connection = p_dbus_connection_ref( c );
+    bluez_loop_thread = pthread_self();
+    bluez_loop_thread_set = TRUE;
 
+    *count = 0;
     while (TRUE)
     {
-        if (bluez_watcher_event_queue_ready( watcher_ctx, &result->data.watcher_event ))
+        bluez_watcher_flush_props_updates( watcher_ctx );
+        while (*count < max_count)
         {
-            result->status = WINEBLUETOOTH_EVENT_WATCHER_EVENT;
-            p_dbus_connection_unref( connection );
-            bluez_auth_agent_ctx_decref( auth_agent );
-            return STATUS_PENDING;
+            struct winebluetooth_event *result = &events[*count];
+
+            if (bluez_watcher_event_queue_ready( watcher_ctx, &result->data.watcher_event ))
+                result->status = WINEBLUETOOTH_EVENT_WATCHER_EVENT;
+            else if (bluez_auth_agent_ctx_have_event( auth_agent, &result->data.auth_event ))
+                result->status = WINEBLUETOOTH_EVENT_AUTH_EVENT;
+            else if (*count && p_dbus_connection_get_dispatch_status( connection ) == DBUS_DISPATCH_DATA_REMAINS)
+            {
+                /* Fill up the rest of the batch with whatever libdbus has already read, without blocking. */
+                p_dbus_connection_read_write_dispatch( connection, 0 );
+                continue;
+            }
+            else
+                break;
+            (*count)++;
         }
-        else if (bluez_auth_agent_ctx_have_event( auth_agent, &result->data.auth_event ))
+        if (*count)
         {
-            result->status = WINEBLUETOOTH_EVENT_AUTH_EVENT;
             p_dbus_connection_unref( connection );
             bluez_auth_agent_ctx_decref( auth_agent );
             return STATUS_PENDING;
         }
-        else if (!p_dbus_connection_read_write_dispatch( connection, 100 ))
+        if (!bluez_dbus_loop_wait( connection, watcher_ctx ))
         {
             bluez_watcher_free( watcher_ctx );
             bluez_auth_agent_ctx_decref( auth_agent );
             p_dbus_connection_unref( connection );
+            if (bluez_wakeup_fds[0] != -1) bluez_wakeup_free();
+            bluez_gatt_char_io_poll_free();
             TRACE( "Disconnected from DBus\n" );
             return STATUS_SUCCESS;
         }
@@ -2497,11 +4132,18 @@ void bluez_dbus_close( void *connection ) {}
 void bluez_dbus_free( void *connection ) {}
 NTSTATUS bluez_watcher_init( void *connection, void **ctx ) { return STATUS_NOT_SUPPORTED; }
 void bluez_watcher_close( void *connection, void *ctx ) {}
-NTSTATUS bluez_dbus_loop( void *c, void *watcher, void *auth_agent, struct winebluetooth_event *result )
+NTSTATUS bluez_dbus_loop( void *c, void *watcher, void *auth_agent, struct winebluetooth_event *events,
+                          UINT32 max_count, UINT32 *count )
+{
+    return STATUS_NOT_SUPPORTED;
+}
+NTSTATUS bluez_adapter_set_prop( void *connection, struct unix_name *adapter,
+                                 struct bluetooth_adapter_set_prop_params *params )
 {
     return STATUS_NOT_SUPPORTED;
 }
-NTSTATUS bluez_adapter_set_prop( void *connection, struct bluetooth_adapter_set_prop_params *params )
+NTSTATUS bluez_adapter_set_discovery_filter( void *connection, const char *adapter_path,
+                                             const struct winebluetooth_discovery_filter *filter )
 {
     return STATUS_NOT_SUPPORTED;
 }
@@ -2530,9 +4172,57 @@ NTSTATUS bluez_device_disconnect( void *connection, const char *device_path )
 {
     return STATUS_NOT_SUPPORTED;
 }
+NTSTATUS bluez_device_connect( void *connection, const char *device_path )
+{
+    return STATUS_NOT_SUPPORTED;
+}
 NTSTATUS bluez_device_start_pairing( void *connection, void *watcher_ctx, struct unix_name *device, IRP *irp )
 {
     return STATUS_NOT_SUPPORTED;
 }
+NTSTATUS bluez_gatt_characteristic_read( void *connection, void *watcher_ctx, struct unix_name *characteristic,
+                                         IRP *irp )
+{
+    return STATUS_NOT_SUPPORTED;
+}
+NTSTATUS bluez_gatt_characteristic_write( void *connection, void *watcher_ctx, struct unix_name *characteristic,
+                                          const unsigned char *data, unsigned int size, int write_type, IRP *irp )
+{
+    return STATUS_NOT_SUPPORTED;
+}
+NTSTATUS bluez_gatt_characteristic_write_stream( void *connection, struct unix_name *characteristic,
+                                                 const unsigned char *data, unsigned int size,
+                                                 const volatile BOOLEAN *cancel, unsigned int *mtu,
+                                                 unsigned int *packets, unsigned int *written )
+{
+    return STATUS_NOT_SUPPORTED;
+}
+NTSTATUS bluez_gatt_characteristic_get_mtu( void *connection, struct unix_name *characteristic, unsigned int *mtu )
+{
+    return STATUS_NOT_SUPPORTED;
+}
+NTSTATUS bluez_gatt_characteristic_set_notify( void *connection, struct unix_name *characteristic, BOOL enable,
+                                               UINT32 overflow_policy )
+{
+    return STATUS_NOT_SUPPORTED;
+}
+NTSTATUS bluez_gatt_characteristic_read_notification( void *connection, struct unix_name *characteristic,
+                                                      unsigned char *buffer, unsigned int buffer_size,
+                                                      unsigned int *size )
+{
+    return STATUS_NOT_SUPPORTED;
+}
+NTSTATUS bluez_gatt_characteristic_read_notifications( void *connection, struct unix_name *characteristic,
+                                                       unsigned char *buffer, unsigned int buffer_size,
+                                                       unsigned int max_count, unsigned int *count,
+                                                       unsigned int *size, unsigned int *overflow_count )
+{
+    return STATUS_NOT_SUPPORTED;
+}
+NTSTATUS bluez_gatt_characteristic_get_notification_stats( void *connection, struct unix_name *characteristic,
+                                                           struct bluetooth_gatt_notification_stats *stats )
+{
+    return STATUS_NOT_SUPPORTED;
+}
 
 #endif /* SONAME_LIBDBUS_1 */
@@ -40,6 +40,7 @@
     DO_FUNC(dbus_connection_close); \
     DO_FUNC(dbus_connection_flush); \
     DO_FUNC(dbus_connection_free_preallocated_send); \
+    DO_FUNC(dbus_connection_get_dispatch_status); \
     DO_FUNC(dbus_connection_get_is_anonymous); \
     DO_FUNC(dbus_connection_get_is_authenticated); \
     DO_FUNC(dbus_connection_get_is_connected); \
@@ -47,6 +48,7 @@
     DO_FUNC(dbus_connection_get_unix_process_id); \
     DO_FUNC(dbus_connection_get_unix_fd); \
     DO_FUNC(dbus_connection_get_unix_user); \
+    DO_FUNC(dbus_connection_has_messages_to_send); \
     DO_FUNC(dbus_connection_preallocate_send); \
     DO_FUNC(dbus_connection_read_write_dispatch); \
     DO_FUNC(dbus_connection_remove_filter); \
@@ -55,6 +57,8 @@
     DO_FUNC(dbus_connection_send_preallocated); \
     DO_FUNC(dbus_connection_send_with_reply); \
     DO_FUNC(dbus_connection_send_with_reply_and_block); \
+    DO_FUNC(dbus_connection_set_dispatch_status_function); \
+    DO_FUNC(dbus_connection_set_wakeup_main_function); \
     DO_FUNC(dbus_connection_try_register_object_path); \
     DO_FUNC(dbus_connection_unref); \
     DO_FUNC(dbus_connection_unregister_object_path); \
@@ -101,6 +105,7 @@
     DO_FUNC(dbus_pending_call_block); \
     DO_FUNC(dbus_pending_call_cancel); \
     DO_FUNC(dbus_pending_call_get_completed); \
+    DO_FUNC(dbus_pending_call_ref); \
     DO_FUNC(dbus_pending_call_set_notify); \
     DO_FUNC(dbus_pending_call_steal_reply); \
     DO_FUNC(dbus_pending_call_unref); \
@@ -0,0 +1,208 @@
+/*
+ * Fixed-capacity queue for GATT characteristic notification values
+ *
+ * Copyright 2026 agent
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#if 0
+#pragma makedep unix
+#endif
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include <ntstatus.h>
+#define WIN32_NO_STATUS
+#include <winternl.h>
+#include <windef.h>
+
+#include "unixlib.h"
+#include "unixlib_priv.h"
+
+/* Values are stored back to back as a struct bluetooth_gatt_notification_record followed by the value itself, in
+ * a single allocation that is made when notifications get enabled. Queueing and draining values therefore never
+ * allocates memory, and the records can be copied out to winebth.sys as they are. */
+#define NOTIFICATION_RING_SIZE 0x10000
+
+struct notification_ring
+{
+    UINT32 policy;
+    /* Free running byte offsets into buffer, the amount of data queued is tail - head. */
+    UINT32 head;
+    UINT32 tail;
+    UINT32 count;
+    UINT32 overflow_count;
+    UINT32 max_count;
+    UINT64 received;
+    unsigned char buffer[NOTIFICATION_RING_SIZE];
+};
+
+/* The number of 100ns intervals between 1601-01-01 and 1970-01-01. */
+#define TICKS_1601_TO_1970 ((UINT64)116444736 * 1000000000)
+
+static UINT64 notification_ring_timestamp( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_REALTIME, &ts );
+    return TICKS_1601_TO_1970 + (UINT64)ts.tv_sec * 10000000 + ts.tv_nsec / 100;
+}
+
+static void notification_ring_write( struct notification_ring *ring, UINT32 pos, const void *data, UINT32 size )
+{
+    UINT32 offset = pos % NOTIFICATION_RING_SIZE, chunk = min( size, NOTIFICATION_RING_SIZE - offset );
+
+    memcpy( ring->buffer + offset, data, chunk );
+    memcpy( ring->buffer, (const unsigned char *)data + chunk, size - chunk );
+}
+
+static void notification_ring_read( const struct notification_ring *ring, UINT32 pos, void *data, UINT32 size )
+{
+    UINT32 offset = pos % NOTIFICATION_RING_SIZE, chunk = min( size, NOTIFICATION_RING_SIZE - offset );
+
+    memcpy( data, ring->buffer + offset, chunk );
+    memcpy( (unsigned char *)data + chunk, ring->buffer, size - chunk );
+}
+
+static UINT32 notification_ring_peek_size( const struct notification_ring *ring )
+{
+    struct bluetooth_gatt_notification_record record;
+
+    notification_ring_read( ring, ring->head, &record, sizeof( record ) );
+    return record.size;
+}
+
+static void notification_ring_drop_oldest( struct notification_ring *ring )
+{
+    ring->head += sizeof( struct bluetooth_gatt_notification_record ) + notification_ring_peek_size( ring );
+    ring->count--;
+}
+
+struct notification_ring *notification_ring_create( UINT32 policy )
+{
+    struct notification_ring *ring;
+
+    if (!(ring = malloc( sizeof( *ring ) ))) return NULL;
+    ring->policy = policy;
+    ring->head = ring->tail = 0;
+    ring->count = 0;
+    ring->overflow_count = 0;
+    ring->max_count = 0;
+    ring->received = 0;
+    return ring;
+}
+
+void notification_ring_destroy( struct notification_ring *ring )
+{
+    free( ring );
+}
+
+void notification_ring_set_policy( struct notification_ring *ring, UINT32 policy )
+{
+    ring->policy = policy;
+}
+
+BOOL notification_ring_empty( const struct notification_ring *ring )
+{
+    return !ring->count;
+}
+
+BOOL notification_ring_push( struct notification_ring *ring, const unsigned char *data, UINT32 size )
+{
+    struct bluetooth_gatt_notification_record record;
+    UINT32 needed = sizeof( record ) + size;
+
+    ring->received++;
+    if (needed > NOTIFICATION_RING_SIZE)
+    {
+        ring->overflow_count++;
+        return FALSE;
+    }
+    if (ring->policy == BLUETOOTH_GATT_NOTIFICATION_OVERFLOW_DROP_NEWEST)
+    {
+        if (NOTIFICATION_RING_SIZE - (ring->tail - ring->head) < needed)
+        {
+            ring->overflow_count++;
+            return FALSE;
+        }
+    }
+    else
+    {
+        while (NOTIFICATION_RING_SIZE - (ring->tail - ring->head) < needed)
+        {
+            notification_ring_drop_oldest( ring );
+            ring->overflow_count++;
+        }
+    }
+
+    record.timestamp = notification_ring_timestamp();
+    record.size = size;
+    notification_ring_write( ring, ring->tail, &record, sizeof( record ) );
+    notification_ring_write( ring, ring->tail + sizeof( record ), data, size );
+    ring->tail += needed;
+    ring->count++;
+    ring->max_count = max( ring->max_count, ring->count );
+    return TRUE;
+}
+
+void notification_ring_get_stats( const struct notification_ring *ring, struct bluetooth_gatt_notification_stats *stats )
+{
+    stats->received = ring->received;
+    stats->queued = ring->count;
+    stats->queued_bytes = ring->tail - ring->head;
+    stats->max_queued = ring->max_count;
+    stats->overflow_count = ring->overflow_count;
+}
+
+NTSTATUS notification_ring_pop( struct notification_ring *ring, unsigned char *buffer, UINT32 buffer_size,
+                                UINT32 *size )
+{
+    UINT32 value_size;
+
+    *size = 0;
+    if (!ring->count) return STATUS_TIMEOUT;
+
+    value_size = notification_ring_peek_size( ring );
+    *size = min( value_size, buffer_size );
+    notification_ring_read( ring, ring->head + sizeof( struct bluetooth_gatt_notification_record ), buffer, *size );
+    notification_ring_drop_oldest( ring );
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS notification_ring_drain( struct notification_ring *ring, unsigned char *buffer, UINT32 buffer_size,
+                                  UINT32 max_count, UINT32 *count, UINT32 *size, UINT32 *overflow_count )
+{
+    *count = *size = 0;
+    *overflow_count = ring->overflow_count;
+    if (!ring->count) return STATUS_TIMEOUT;
+
+    while (ring->count && (!max_count || *count < max_count))
+    {
+        UINT32 record_size = sizeof( struct bluetooth_gatt_notification_record ) + notification_ring_peek_size( ring );
+
+        if (record_size > buffer_size - *size) break;
+        notification_ring_read( ring, ring->head, buffer + *size, record_size );
+        notification_ring_drop_oldest( ring );
+        *size += record_size;
+        (*count)++;
+    }
+    return *count ? STATUS_SUCCESS : STATUS_BUFFER_TOO_SMALL;
+}
@@ -0,0 +1,1610 @@
+/*
+ * Simulated Bluetooth backend
+ *
+ * Copyright 2026 agent
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#if 0
+#pragma makedep unix
+#endif
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+
+#include <ntstatus.h>
+#define WIN32_NO_STATUS
+#include <winternl.h>
+#include <windef.h>
+#include <winbase.h>
+#include <bthsdpdef.h>
+#include <bluetoothapis.h>
+#include <bthledef.h>
+#include <bthdef.h>
+#include <wine/winebth.h>
+
+#include <wine/list.h>
+#include <wine/debug.h>
+
+#include "unixlib.h"
+#include "unixlib_priv.h"
+
+WINE_DEFAULT_DEBUG_CHANNEL( winebth );
+
+/* simbth stands in for BlueZ or CoreBluetooth when the WINEBTH_SIM environment variable is set, so that the whole
+ * stack above unixlib.c can be exercised and measured without any Bluetooth hardware. WINEBTH_SIM holds a comma
+ * separated list of key=value pairs, with every key being optional:
+ *
+ *   radios           Number of local radios. (1)
+ *   devices          Number of LE peripherals advertising around each radio. (4)
+ *   services         Primary services per peripheral. (1)
+ *   characteristics  Characteristics per service, each of them readable, writable and notifiable. (2)
+ *   adv_interval     Advertising interval of every peripheral, in milliseconds. (100)
+ *   connect_time     How long connecting to a peripheral and resolving its services takes, in milliseconds. (30)
+ *   latency          Round trip time of an ATT request, in microseconds. (7500)
+ *   jitter           Up to this many microseconds get added to every delay at random. (0)
+ *   notify_rate      Notifications per second sent by every characteristic that has them enabled. (100)
+ *   payload          Size of characteristic values, in bytes. (20)
+ *   mtu              ATT MTU negotiated with every peripheral. (247)
+ *   replay           Path of a trace recorded with WINEBTH_RECORD, see trace.c. Instead of simulating radios and
+ *                    peripherals, the recorded events get played back. (none)
+ *   speed            How many times faster than recorded a trace gets played back, with 0 playing it back as fast as
+ *                    winebth.sys takes the events. (1)
+ *
+ * Peripherals only become known to winebth.sys once they have been seen during discovery, like they would with a
+ * real radio. Every notification value starts with a 32-bit little endian sequence number, so that the receiving
+ * end can tell how many values got lost.
+ *
+ * Everything runs on the thread calling simbth_loop: the other entry points only update the model and schedule
+ * timers, which simbth_loop fires once they are due, queueing the resulting events. */
+
+struct simbth_config
+{
+    UINT32 radios;
+    UINT32 devices;
+    UINT32 services;
+    UINT32 characteristics;
+    UINT32 adv_interval;
+    UINT32 connect_time;
+    UINT32 latency;
+    UINT32 jitter;
+    UINT32 notify_rate;
+    UINT32 payload;
+    UINT32 mtu;
+    UINT32 speed;
+    char *replay;
+};
+
+struct simbth_ctx;
+struct simbth_timer;
+
+typedef void (*simbth_timer_callback)( struct simbth_ctx *ctx, struct simbth_timer *timer );
+
+struct simbth_timer
+{
+    struct list entry;
+    UINT64 due;    /* In CLOCK_MONOTONIC nanoseconds. */
+    BOOL armed;
+    simbth_timer_callback callback;
+};
+
+struct simbth_characteristic
+{
+    struct list entry;
+    struct unix_name *name;
+    struct simbth_service *service;
+    BTH_LE_GATT_CHARACTERISTIC props;
+
+    UINT32 size;
+    BYTE value[WINEBLUETOOTH_GATT_MAX_VALUE_SIZE];
+
+    /* Allocated when notifications get enabled for the first time. */
+    struct notification_ring *notifications;
+    BOOL notifying;
+    UINT32 sequence;
+    struct simbth_timer notify_timer;
+};
+
+struct simbth_service
+{
+    struct list entry;
+    struct unix_name *name;
+    struct simbth_device *device;
+    UINT16 attr_handle;
+    GUID uuid;
+    struct list characteristics;
+};
+
+struct simbth_device
+{
+    struct list entry;
+    struct unix_name *name;
+    struct simbth_radio *radio;
+    struct winebluetooth_device_properties props;
+    INT16 rssi;
+
+    BOOL visible;         /* winebth.sys knows about this device. */
+    BOOL services_added;  /* winebth.sys knows about the services. */
+    BOOL connecting;
+    struct simbth_timer adv_timer;
+    struct simbth_timer connect_timer;
+
+    struct list services;
+};
+
+struct simbth_radio
+{
+    struct list entry;
+    struct unix_name *name;
+    struct winebluetooth_radio_properties props;
+    struct winebluetooth_discovery_filter filter;
+    struct list devices;
+};
+
+/* A pending characteristic read or write, or pairing request. */
+struct simbth_request
+{
+    struct simbth_timer timer;
+    IRP *irp;
+    struct simbth_characteristic *characteristic; /* NULL for pairing requests. */
+    struct simbth_device *device;
+    BOOL read;
+};
+
+struct simbth_event
+{
+    struct list entry;
+    struct winebluetooth_watcher_event event;
+};
+
+struct simbth_ctx
+{
+    struct simbth_config config;
+
+    /* Everything below is guarded by mutex. */
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    /* One reference is owned by unixlib.c, and another one by simbth_loop while it runs. */
+    LONG refcnt;
+    BOOL closed;
+    struct list radios;
+    struct list events;
+    struct list timers; /* struct simbth_timer, ordered by due time. */
+    unsigned int random_state;
+
+    /* The trace being played back, if any. Records that have been played back out of order get set to NULL. */
+    struct bluetooth_trace *replay;
+    SIZE_T replay_next;
+    UINT64 replay_start;
+    struct rb_tree replay_names; /* struct simbth_replay_name */
+    struct simbth_timer replay_timer;
+};
+
+/* Maps the handles in a trace to the names they stood for. */
+struct simbth_replay_name
+{
+    struct rb_entry entry;
+    UINT64 handle;
+    struct unix_name *name;
+};
+
+static const GUID simbth_service_uuid_base =
+    { 0x5eb70000, 0x57a7, 0x4c6d, { 0x9b, 0x1e, 0x53, 0x49, 0x4d, 0x42, 0x54, 0x48 } };
+static const GUID simbth_characteristic_uuid_base =
+    { 0x5eb71000, 0x57a7, 0x4c6d, { 0x9b, 0x1e, 0x53, 0x49, 0x4d, 0x42, 0x54, 0x48 } };
+
+static UINT64 simbth_now( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (UINT64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void simbth_parse_config( const char *str, struct simbth_config *config )
+{
+    static const struct
+    {
+        const char *key;
+        size_t offset;
+    } keys[] = {
+        { "radios", offsetof( struct simbth_config, radios ) },
+        { "devices", offsetof( struct simbth_config, devices ) },
+        { "services", offsetof( struct simbth_config, services ) },
+        { "characteristics", offsetof( struct simbth_config, characteristics ) },
+        { "adv_interval", offsetof( struct simbth_config, adv_interval ) },
+        { "connect_time", offsetof( struct simbth_config, connect_time ) },
+        { "latency", offsetof( struct simbth_config, latency ) },
+        { "jitter", offsetof( struct simbth_config, jitter ) },
+        { "notify_rate", offsetof( struct simbth_config, notify_rate ) },
+        { "payload", offsetof( struct simbth_config, payload ) },
+        { "mtu", offsetof( struct simbth_config, mtu ) },
+        { "speed", offsetof( struct simbth_config, speed ) },
+    };
+    const char *cur = str;
+
+    config->radios = 1;
+    config->devices = 4;
+    config->services = 1;
+    config->characteristics = 2;
+    config->adv_interval = 100;
+    config->connect_time = 30;
+    config->latency = 7500;
+    config->jitter = 0;
+    config->notify_rate = 100;
+    config->payload = 20;
+    config->mtu = 247;
+    config->speed = 1;
+
+    while (*cur)
+    {
+        size_t len = strcspn( cur, "," ), key_len = strcspn( cur, "=," );
+        unsigned int i;
+
+        if (key_len == 6 && !memcmp( cur, "replay", 6 ) && cur[key_len] == '=')
+        {
+            free( config->replay );
+            config->replay = strndup( cur + key_len + 1, len - key_len - 1 );
+            cur += len;
+            if (*cur == ',') cur++;
+            continue;
+        }
+        for (i = 0; i < ARRAY_SIZE( keys ); i++)
+        {
+            if (key_len != strlen( keys[i].key ) || memcmp( cur, keys[i].key, key_len )) continue;
+            if (cur[key_len] == '=')
+                *(UINT32 *)((char *)config + keys[i].offset) = strtoul( cur + key_len + 1, NULL, 0 );
+            break;
+        }
+        if (i == ARRAY_SIZE( keys ) && len)
+            WARN( "Unknown WINEBTH_SIM option %s\n", debugstr_an( cur, len ) );
+        cur += len;
+        if (*cur == ',') cur++;
+    }
+
+    config->radios = min( config->radios, 16 );
+    config->devices = min( config->devices, 0xffff );
+    config->services = min( max( config->services, 1 ), 16 );
+    config->characteristics = min( max( config->characteristics, 1 ), 64 );
+    config->payload = min( max( config->payload, sizeof( UINT32 ) ), WINEBLUETOOTH_GATT_MAX_VALUE_SIZE );
+    config->mtu = min( max( config->mtu, 23 ), 517 );
+}
+
+/* Needs to be called with ctx->mutex held. */
+static UINT64 simbth_delay( struct simbth_ctx *ctx, UINT64 usec )
+{
+    if (ctx->config.jitter)
+    {
+        ctx->random_state = ctx->random_state * 1103515245 + 12345;
+        usec += (ctx->random_state >> 8) % (ctx->config.jitter + 1);
+    }
+    return usec * 1000;
+}
+
+/* Needs to be called with ctx->mutex held. */
+static void simbth_timer_set( struct simbth_ctx *ctx, struct simbth_timer *timer, UINT64 due )
+{
+    struct simbth_timer *cur;
+
+    if (timer->armed) list_remove( &timer->entry );
+    timer->due = due;
+    timer->armed = TRUE;
+    LIST_FOR_EACH_ENTRY( cur, &ctx->timers, struct simbth_timer, entry )
+    {
+        if (cur->due > due)
+        {
+            list_add_before( &cur->entry, &timer->entry );
+            pthread_cond_signal( &ctx->cond );
+            return;
+        }
+    }
+    list_add_tail( &ctx->timers, &timer->entry );
+    pthread_cond_signal( &ctx->cond );
+}
+
+/* Needs to be called with ctx->mutex held. */
+static void simbth_timer_cancel( struct simbth_timer *timer )
+{
+    if (!timer->armed) return;
+    list_remove( &timer->entry );
+    timer->armed = FALSE;
+}
+
+/* Needs to be called with ctx->mutex held. The event's handles need to be new references. */
+static BOOL simbth_queue_event( struct simbth_ctx *ctx, enum winebluetooth_watcher_event_type type,
+                                const union winebluetooth_watcher_event_data *data )
+{
+    struct simbth_event *event;
+
+    if (!(event = malloc( sizeof( *event ) )))
+    {
+        ERR( "Failed to allocate event %d\n", type );
+        return FALSE;
+    }
+    event->event.event_type = type;
+    event->event.event_data = *data;
+    list_add_tail( &ctx->events, &event->entry );
+    bluetooth_stats_event_queued();
+    pthread_cond_signal( &ctx->cond );
+    return TRUE;
+}
+
+static void simbth_queue_device_added( struct simbth_ctx *ctx, struct simbth_device *device )
+{
+    union winebluetooth_watcher_event_data data = {0};
+
+    data.device_added.known_props_mask = WINEBLUETOOTH_DEVICE_ALL_PROPERTIES;
+    data.device_added.props = device->props;
+    data.device_added.device.handle = unix_name_dup( device->name )->handle;
+    data.device_added.radio.handle = unix_name_dup( device->radio->name )->handle;
+    if (simbth_queue_event( ctx, BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_ADDED, &data )) return;
+    unix_name_free( device->name );
+    unix_name_free( device->radio->name );
+}
+
+static void simbth_queue_device_props_changed( struct simbth_ctx *ctx, struct simbth_device *device,
+                                               winebluetooth_device_props_mask_t mask )
+{
+    union winebluetooth_watcher_event_data data = {0};
+
+    data.device_props_changed.changed_props_mask = mask;
+    data.device_props_changed.props = device->props;
+    data.device_props_changed.device.handle = unix_name_dup( device->name )->handle;
+    if (!simbth_queue_event( ctx, BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_PROPERTIES_CHANGED, &data ))
+        unix_name_free( device->name );
+}
+
+static void simbth_queue_radio_props_changed( struct simbth_ctx *ctx, struct simbth_radio *radio,
+                                              winebluetooth_radio_props_mask_t mask )
+{
+    union winebluetooth_watcher_event_data data = {0};
+
+    data.radio_props_changed.changed_props_mask = mask;
+    data.radio_props_changed.props = radio->props;
+    data.radio_props_changed.radio.handle = unix_name_dup( radio->name )->handle;
+    if (!simbth_queue_event( ctx, BLUETOOTH_WATCHER_EVENT_TYPE_RADIO_PROPERTIES_CHANGED, &data ))
+        unix_name_free( radio->name );
+}
+
+static void simbth_queue_services( struct simbth_ctx *ctx, struct simbth_device *device )
+{
+    struct simbth_service *service;
+
+    LIST_FOR_EACH_ENTRY( service, &device->services, struct simbth_service, entry )
+    {
+        union winebluetooth_watcher_event_data data = {0};
+        struct simbth_characteristic *chrc;
+
+        data.gatt_service_added.device.handle = unix_name_dup( device->name )->handle;
+        data.gatt_service_added.service.handle = unix_name_dup( service->name )->handle;
+        data.gatt_service_added.attr_handle = service->attr_handle;
+        data.gatt_service_added.is_primary = TRUE;
+        data.gatt_service_added.uuid = service->uuid;
+        if (!simbth_queue_event( ctx, BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_GATT_SERVICE_ADDED, &data ))
+        {
+            unix_name_free( device->name );
+            unix_name_free( service->name );
+            continue;
+        }
+
+        LIST_FOR_EACH_ENTRY( chrc, &service->characteristics, struct simbth_characteristic, entry )
+        {
+            memset( &data, 0, sizeof( data ) );
+            data.gatt_characteristic_added.characteristic.handle = unix_name_dup( chrc->name )->handle;
+            data.gatt_characteristic_added.service.handle = unix_name_dup( service->name )->handle;
+            data.gatt_characteristic_added.props = chrc->props;
+            if (simbth_queue_event( ctx, BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_ADDED, &data )) continue;
+            unix_name_free( chrc->name );
+            unix_name_free( service->name );
+        }
+    }
+}
+
+/* Whether the radio's discovery filter lets the device through. The transport is ignored, as the simulated
+ * peripherals are reported for both. */
+static BOOL simbth_filter_matches( const struct winebluetooth_discovery_filter *filter,
+                                   const struct simbth_device *device )
+{
+    const struct simbth_service *service;
+    UINT32 i;
+
+    if ((filter->flags & BLUETOOTH_DISCOVERY_FILTER_RSSI) && device->rssi < filter->rssi) return FALSE;
+    if (!filter->uuids_count) return TRUE;
+    LIST_FOR_EACH_ENTRY( service, &device->services, struct simbth_service, entry )
+        for (i = 0; i < filter->uuids_count; i++)
+            if (IsEqualGUID( &filter->uuids[i], &service->uuid )) return TRUE;
+    return FALSE;
+}
+
+static void simbth_device_advertise( struct simbth_ctx *ctx, struct simbth_timer *timer )
+{
+    struct simbth_device *device = CONTAINING_RECORD( timer, struct simbth_device, adv_timer );
+    struct simbth_radio *radio = device->radio;
+
+    if (!radio->props.discovering) return;
+    simbth_timer_set( ctx, timer, timer->due + simbth_delay( ctx, (UINT64)ctx->config.adv_interval * 1000 ) );
+
+    if (!simbth_filter_matches( &radio->filter, device )) return;
+    if (!device->visible)
+    {
+        device->visible = TRUE;
+        simbth_queue_device_added( ctx, device );
+    }
+    else if (radio->filter.flags & BLUETOOTH_DISCOVERY_FILTER_DUPLICATE_DATA)
+        simbth_queue_device_props_changed( ctx, device,
+                                           WINEBLUETOOTH_DEVICE_PROPERTY_NAME | WINEBLUETOOTH_DEVICE_PROPERTY_RSSI );
+}
+
+static void simbth_device_connected( struct simbth_ctx *ctx, struct simbth_timer *timer )
+{
+    struct simbth_device *device = CONTAINING_RECORD( timer, struct simbth_device, connect_timer );
+    UINT64 period = simbth_delay( ctx, 1000000 / max( ctx->config.notify_rate, 1 ) );
+    struct simbth_characteristic *chrc;
+    struct simbth_service *service;
+
+    device->connecting = FALSE;
+    if (!device->visible) return;
+    device->props.connected = TRUE;
+    device->props.services_resolved = TRUE;
+    if (!device->services_added)
+    {
+        device->services_added = TRUE;
+        simbth_queue_services( ctx, device );
+    }
+    /* Subscriptions survive reconnections. */
+    LIST_FOR_EACH_ENTRY( service, &device->services, struct simbth_service, entry )
+        LIST_FOR_EACH_ENTRY( chrc, &service->characteristics, struct simbth_characteristic, entry )
+            if (chrc->notifying && !chrc->notify_timer.armed) simbth_timer_set( ctx, &chrc->notify_timer,
+                                                                                timer->due + period );
+    simbth_queue_device_props_changed( ctx, device, WINEBLUETOOTH_DEVICE_PROPERTY_CONNECTED |
+                                                    WINEBLUETOOTH_DEVICE_PROPERTY_SERVICES_RESOLVED );
+}
+
+static void simbth_characteristic_notify( struct simbth_ctx *ctx, struct simbth_timer *timer )
+{
+    struct simbth_characteristic *chrc = CONTAINING_RECORD( timer, struct simbth_characteristic, notify_timer );
+    union winebluetooth_watcher_event_data data = {0};
+    UINT32 sequence;
+
+    if (!chrc->notifying || !chrc->service->device->props.connected) return;
+    sequence = chrc->sequence++;
+    simbth_timer_set( ctx, timer, timer->due + simbth_delay( ctx, 1000000 / max( ctx->config.notify_rate, 1 ) ) );
+
+    memcpy( chrc->value, &sequence, sizeof( sequence ) );
+    if (!notification_ring_push( chrc->notifications, chrc->value, chrc->size )) return;
+    data.gatt_characteristic_value_changed.handle = unix_name_dup( chrc->name )->handle;
+    if (!simbth_queue_event( ctx, BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_VALUE_CHANGED, &data ))
+        unix_name_free( chrc->name );
+}
+
+static void simbth_request_finished( struct simbth_ctx *ctx, struct simbth_timer *timer )
+{
+    struct simbth_request *request = CONTAINING_RECORD( timer, struct simbth_request, timer );
+    union winebluetooth_watcher_event_data data = {0};
+
+    if (!request->characteristic)
+    {
+        request->device->props.paired = TRUE;
+        simbth_queue_device_props_changed( ctx, request->device, WINEBLUETOOTH_DEVICE_PROPERTY_PAIRED );
+        data.pairing_finished.irp = request->irp;
+        data.pairing_finished.result = STATUS_SUCCESS;
+        simbth_queue_event( ctx, BLUETOOTH_WATCHER_EVENT_TYPE_PAIRING_FINISHED, &data );
+        free( request );
+        return;
+    }
+
+    data.gatt_characteristic_io_finished.characteristic.handle = unix_name_dup( request->characteristic->name )->handle;
+    data.gatt_characteristic_io_finished.irp = request->irp;
+    if (!request->device->props.connected)
+        data.gatt_characteristic_io_finished.result = STATUS_DEVICE_NOT_CONNECTED;
+    else if (request->read)
+    {
+        data.gatt_characteristic_io_finished.size = request->characteristic->size;
+        memcpy( data.gatt_characteristic_io_finished.value, request->characteristic->value,
+                request->characteristic->size );
+    }
+    if (!simbth_queue_event( ctx, BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_IO_FINISHED, &data ))
+        unix_name_free( request->characteristic->name );
+    free( request );
+}
+
+static struct simbth_characteristic *simbth_characteristic_create( struct simbth_ctx *ctx,
+                                                                   struct simbth_service *service, UINT32 index,
+                                                                   UINT16 attr_handle )
+{
+    struct simbth_characteristic *chrc;
+    char path[256];
+    GUID uuid;
+    UINT32 i;
+
+    if (!(chrc = calloc( 1, sizeof( *chrc ) ))) return NULL;
+    snprintf( path, sizeof( path ), "%s/char%04x", service->name->str, attr_handle );
+    if (!(chrc->name = unix_name_get_or_create( path )))
+    {
+        free( chrc );
+        return NULL;
+    }
+    chrc->name->object = chrc;
+    chrc->service = service;
+    chrc->notify_timer.callback = simbth_characteristic_notify;
+
+    uuid = simbth_characteristic_uuid_base;
+    uuid.Data1 += index;
+    uuid_to_le( &uuid, &chrc->props.CharacteristicUuid );
+    chrc->props.ServiceHandle = service->attr_handle;
+    chrc->props.AttributeHandle = attr_handle;
+    chrc->props.CharacteristicValueHandle = attr_handle + 1;
+    chrc->props.IsReadable = TRUE;
+    chrc->props.IsWritable = TRUE;
+    chrc->props.IsWritableWithoutResponse = TRUE;
+    chrc->props.IsNotifiable = TRUE;
+
+    chrc->size = ctx->config.payload;
+    for (i = 0; i < chrc->size; i++) chrc->value[i] = i;
+    return chrc;
+}
+
+static struct simbth_service *simbth_service_create( struct simbth_ctx *ctx, struct simbth_device *device,
+                                                     UINT32 index, UINT16 *attr_handle )
+{
+    struct simbth_service *service;
+    char path[256];
+    UINT32 i;
+
+    if (!(service = calloc( 1, sizeof( *service ) ))) return NULL;
+    snprintf( path, sizeof( path ), "%s/service%04x", device->name->str, *attr_handle );
+    if (!(service->name = unix_name_get_or_create( path )))
+    {
+        free( service );
+        return NULL;
+    }
+    service->name->object = service;
+    service->device = device;
+    service->attr_handle = (*attr_handle)++;
+    service->uuid = simbth_service_uuid_base;
+    service->uuid.Data1 += index;
+    list_init( &service->characteristics );
+
+    for (i = 0; i < ctx->config.characteristics; i++)
+    {
+        struct simbth_characteristic *chrc;
+
+        /* The declaration, the value and the Client Characteristic Configuration descriptor. */
+        if (!(chrc = simbth_characteristic_create( ctx, service, i, *attr_handle ))) break;
+        *attr_handle += 3;
+        list_add_tail( &service->characteristics, &chrc->entry );
+    }
+    return service;
+}
+
+static struct simbth_device *simbth_device_create( struct simbth_ctx *ctx, struct simbth_radio *radio, UINT32 index )
+{
+    struct simbth_device *device;
+    UINT16 attr_handle = 1;
+    char path[256];
+    UINT32 i;
+
+    if (!(device = calloc( 1, sizeof( *device ) ))) return NULL;
+    device->props.address.rgBytes[0] = 0xc0;
+    device->props.address.rgBytes[1] = 0xde;
+    device->props.address.rgBytes[2] = 0x5b;
+    device->props.address.rgBytes[3] = radio->props.address.rgBytes[5];
+    device->props.address.rgBytes[4] = index >> 8;
+    device->props.address.rgBytes[5] = index;
+    snprintf( path, sizeof( path ), "%s/dev_%02X_%02X_%02X_%02X_%02X_%02X", radio->name->str,
+              device->props.address.rgBytes[0], device->props.address.rgBytes[1], device->props.address.rgBytes[2],
+              device->props.address.rgBytes[3], device->props.address.rgBytes[4], device->props.address.rgBytes[5] );
+    if (!(device->name = unix_name_get_or_create( path )))
+    {
+        free( device );
+        return NULL;
+    }
+    device->name->object = device;
+    device->radio = radio;
+    snprintf( device->props.name, sizeof( device->props.name ), "Simulated Device %u", index );
+    device->rssi = -40 - (INT16)(index % 60);
+    device->props.rssi = device->rssi;
+    device->adv_timer.callback = simbth_device_advertise;
+    device->connect_timer.callback = simbth_device_connected;
+    list_init( &device->services );
+
+    for (i = 0; i < ctx->config.services; i++)
+    {
+        struct simbth_service *service;
+
+        if (!(service = simbth_service_create( ctx, device, i, &attr_handle ))) break;
+        list_add_tail( &device->services, &service->entry );
+    }
+    return device;
+}
+
+static struct simbth_radio *simbth_radio_create( struct simbth_ctx *ctx, UINT32 index )
+{
+    struct simbth_radio *radio;
+    char path[64];
+    UINT32 i;
+
+    if (!(radio = calloc( 1, sizeof( *radio ) ))) return NULL;
+    snprintf( path, sizeof( path ), "/org/winehq/simbth/hci%u", index );
+    if (!(radio->name = unix_name_get_or_create( path )))
+    {
+        free( radio );
+        return NULL;
+    }
+    radio->name->object = radio;
+    radio->props.address.rgBytes[0] = 0x00;
+    radio->props.address.rgBytes[1] = 0x1a;
+    radio->props.address.rgBytes[2] = 0x7d;
+    radio->props.address.rgBytes[3] = 0xda;
+    radio->props.address.rgBytes[4] = 0x71;
+    radio->props.address.rgBytes[5] = index;
+    snprintf( radio->props.name, sizeof( radio->props.name ), "Simulated Radio %u", index );
+    radio->props.connectable = TRUE;
+    radio->props.pairable = TRUE;
+    radio->props.manufacturer = 0xffff;
+    radio->props.version = 0x0b;
+    radio->filter.transport = BLUETOOTH_DISCOVERY_TRANSPORT_AUTO;
+    radio->filter.flags = BLUETOOTH_DISCOVERY_FILTER_DUPLICATE_DATA;
+    list_init( &radio->devices );
+
+    for (i = 0; i < ctx->config.devices; i++)
+    {
+        struct simbth_device *device;
+
+        if (!(device = simbth_device_create( ctx, radio, i ))) break;
+        list_add_tail( &radio->devices, &device->entry );
+    }
+    return radio;
+}
+
+static void simbth_radio_free( struct simbth_radio *radio )
+{
+    struct simbth_device *device, *next_device;
+
+    LIST_FOR_EACH_ENTRY_SAFE( device, next_device, &radio->devices, struct simbth_device, entry )
+    {
+        struct simbth_service *service, *next_service;
+
+        LIST_FOR_EACH_ENTRY_SAFE( service, next_service, &device->services, struct simbth_service, entry )
+        {
+            struct simbth_characteristic *chrc, *next_chrc;
+
+            LIST_FOR_EACH_ENTRY_SAFE( chrc, next_chrc, &service->characteristics, struct simbth_characteristic,
+                                      entry )
+            {
+                if (chrc->notifications) notification_ring_destroy( chrc->notifications );
+                chrc->name->object = NULL;
+                unix_name_free( chrc->name );
+                free( chrc );
+            }
+            service->name->object = NULL;
+            unix_name_free( service->name );
+            free( service );
+        }
+        device->name->object = NULL;
+        unix_name_free( device->name );
+        free( device );
+    }
+    radio->name->object = NULL;
+    unix_name_free( radio->name );
+    free( radio );
+}
+
+static int simbth_replay_name_compare( const void *key, const struct rb_entry *entry )
+{
+    const struct simbth_replay_name *name = RB_ENTRY_VALUE( entry, const struct simbth_replay_name, entry );
+    UINT64 handle = *(const UINT64 *)key;
+
+    return handle < name->handle ? -1 : handle > name->handle;
+}
+
+static void simbth_replay_name_free( struct rb_entry *entry, void *context )
+{
+    struct simbth_replay_name *name = RB_ENTRY_VALUE( entry, struct simbth_replay_name, entry );
+
+    unix_name_free( name->name );
+    free( name );
+}
+
+static struct unix_name *simbth_replay_find_name( struct simbth_ctx *ctx, UINT64 handle )
+{
+    struct rb_entry *entry = rb_get( &ctx->replay_names, &handle );
+    return entry ? RB_ENTRY_VALUE( entry, struct simbth_replay_name, entry )->name : NULL;
+}
+
+static void simbth_replay_add_name( struct simbth_ctx *ctx, const struct bluetooth_trace_record *record )
+{
+    struct simbth_replay_name *name;
+    UINT64 handle = record->handle;
+    char *str;
+
+    if (rb_get( &ctx->replay_names, &handle )) return;
+    if (!(name = calloc( 1, sizeof( *name ) ))) return;
+    if (!(str = strndup( (const char *)(record + 1), record->size )) || !(name->name = unix_name_get_or_create( str )))
+    {
+        free( str );
+        free( name );
+        return;
+    }
+    free( str );
+    name->handle = handle;
+    rb_put( &ctx->replay_names, &handle, &name->entry );
+}
+
+/* Needs to be called with ctx->mutex held. Objects only get created for names that don't have one yet, so a trace
+ * recorded with the simulated backend can be played back too. */
+static void simbth_replay_create_object( struct simbth_ctx *ctx, enum winebluetooth_watcher_event_type type,
+                                         const union winebluetooth_watcher_event_data *data, struct unix_name **names )
+{
+    switch (type)
+    {
+    case BLUETOOTH_WATCHER_EVENT_TYPE_RADIO_ADDED:
+    {
+        struct simbth_radio *radio;
+
+        if (names[0]->object || !(radio = calloc( 1, sizeof( *radio ) ))) return;
+        radio->name = unix_name_dup( names[0] );
+        radio->name->object = radio;
+        radio->props = data->radio_added.props;
+        radio->filter.transport = BLUETOOTH_DISCOVERY_TRANSPORT_AUTO;
+        list_init( &radio->devices );
+        list_add_tail( &ctx->radios, &radio->entry );
+        return;
+    }
+    case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_ADDED:
+    {
+        struct simbth_radio *radio = names[1]->object;
+        struct simbth_device *device;
+
+        if (!(device = names[0]->object))
+        {
+            if (!radio || !(device = calloc( 1, sizeof( *device ) ))) return;
+            device->name = unix_name_dup( names[0] );
+            device->name->object = device;
+            device->radio = radio;
+            device->adv_timer.callback = simbth_device_advertise;
+            device->connect_timer.callback = simbth_device_connected;
+            list_init( &device->services );
+            list_add_tail( &radio->devices, &device->entry );
+        }
+        device->props = data->device_added.props;
+        device->rssi = device->props.rssi;
+        device->visible = TRUE;
+        return;
+    }
+    case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_GATT_SERVICE_ADDED:
+    {
+        struct simbth_device *device = names[1]->object;
+        struct simbth_service *service;
+
+        if (names[0]->object || !device || !(service = calloc( 1, sizeof( *service ) ))) return;
+        service->name = unix_name_dup( names[0] );
+        service->name->object = service;
+        service->device = device;
+        service->attr_handle = data->gatt_service_added.attr_handle;
+        service->uuid = data->gatt_service_added.uuid;
+        list_init( &service->characteristics );
+        list_add_tail( &device->services, &service->entry );
+        device->services_added = TRUE;
+        return;
+    }
+    case BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_ADDED:
+    {
+        struct simbth_service *service = names[1]->object;
+        struct simbth_characteristic *chrc;
+
+        if (names[0]->object || !service || !(chrc = calloc( 1, sizeof( *chrc ) ))) return;
+        chrc->name = unix_name_dup( names[0] );
+        chrc->name->object = chrc;
+        chrc->service = service;
+        chrc->props = data->gatt_characteristic_added.props;
+        chrc->notify_timer.callback = simbth_characteristic_notify;
+        list_add_tail( &service->characteristics, &chrc->entry );
+        return;
+    }
+    default:
+        return;
+    }
+}
+
+/* Needs to be called with ctx->mutex held. Returns whether a value got queued. */
+static BOOL simbth_replay_push_value( struct simbth_characteristic *chrc, const struct bluetooth_trace_record *record )
+{
+    UINT32 size = min( record->size, sizeof( chrc->value ) );
+
+    chrc->size = size;
+    memcpy( chrc->value, record + 1, size );
+    return chrc->notifications && notification_ring_push( chrc->notifications, chrc->value, size );
+}
+
+/* Needs to be called with ctx->mutex held. Values are recorded when winebth.sys reads them, which happens after the
+ * event telling it about them. Queue the values it read in response to this event along with it, so that they are
+ * there when it reads them again. */
+static BOOL simbth_replay_push_values( struct simbth_ctx *ctx, struct simbth_characteristic *chrc, UINT64 handle )
+{
+    BOOL pushed = FALSE;
+    SIZE_T i;
+
+    for (i = ctx->replay_next; i < ctx->replay->count; i++)
+    {
+        const struct bluetooth_trace_record *record = ctx->replay->records[i];
+
+        if (!record) continue;
+        if (record->type == BLUETOOTH_TRACE_RECORD_EVENT
+            && record->handle == BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_VALUE_CHANGED
+            && record->size >= sizeof( UINT_PTR ) && *(const UINT_PTR *)(record + 1) == handle)
+            break;
+        if (record->type != BLUETOOTH_TRACE_RECORD_VALUE || record->handle != handle) continue;
+        pushed |= simbth_replay_push_value( chrc, record );
+        ctx->replay->records[i] = NULL;
+    }
+    return pushed;
+}
+
+/* Needs to be called with ctx->mutex held. */
+static void simbth_replay_event( struct simbth_ctx *ctx, const struct bluetooth_trace_record *record )
+{
+    enum winebluetooth_watcher_event_type type = record->handle;
+    union winebluetooth_watcher_event_data data = {0};
+    struct unix_name *names[2] = {0};
+    struct simbth_characteristic *chrc;
+    struct simbth_device *device;
+    UINT32 i, count;
+    UINT_PTR *handles[2];
+
+    memcpy( &data, record + 1, min( record->size, sizeof( data ) ) );
+    count = bluetooth_trace_event_handles( type, &data, handles );
+    for (i = 0; i < count; i++)
+    {
+        if (!(names[i] = simbth_replay_find_name( ctx, *handles[i] )))
+        {
+            WARN( "Skipping event %d for unknown handle %#lx\n", type, (unsigned long)*handles[i] );
+            return;
+        }
+    }
+
+    simbth_replay_create_object( ctx, type, &data, names );
+    switch (type)
+    {
+    case BLUETOOTH_WATCHER_EVENT_TYPE_RADIO_ADDED:
+    case BLUETOOTH_WATCHER_EVENT_TYPE_RADIO_REMOVED:
+    case BLUETOOTH_WATCHER_EVENT_TYPE_RADIO_PROPERTIES_CHANGED:
+    case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_ADDED:
+    case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_GATT_SERVICE_ADDED:
+    case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_GATT_SERVICE_REMOVED:
+    case BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_ADDED:
+    case BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_REMOVED:
+        break;
+    case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_REMOVED:
+        if ((device = names[0]->object)) device->visible = FALSE;
+        break;
+    case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_PROPERTIES_CHANGED:
+        if (!(device = names[0]->object)) break;
+        if (data.device_props_changed.changed_props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_CONNECTED)
+            device->props.connected = data.device_props_changed.props.connected;
+        if (data.device_props_changed.changed_props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_PAIRED)
+            device->props.paired = data.device_props_changed.props.paired;
+        break;
+    case BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_VALUE_CHANGED:
+        if (!(chrc = names[0]->object) || !simbth_replay_push_values( ctx, chrc, *handles[0] )) return;
+        break;
+    case BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_IO_FINISHED:
+        /* The request it answered was made by the recording process, only keep the value around for later reads. */
+        if ((chrc = names[0]->object) && !data.gatt_characteristic_io_finished.result
+            && data.gatt_characteristic_io_finished.size)
+        {
+            chrc->size = min( data.gatt_characteristic_io_finished.size, sizeof( chrc->value ) );
+            memcpy( chrc->value, data.gatt_characteristic_io_finished.value, chrc->size );
+        }
+        return;
+    case BLUETOOTH_WATCHER_EVENT_TYPE_PAIRING_FINISHED:
+        return;
+    default:
+        WARN( "Skipping unknown event %d\n", type );
+        return;
+    }
+
+    for (i = 0; i < count; i++)
+        *handles[i] = unix_name_dup( names[i] )->handle;
+    if (simbth_queue_event( ctx, type, &data )) return;
+    for (i = 0; i < count; i++)
+        unix_name_free( names[i] );
+}
+
+/* Needs to be called with ctx->mutex held. */
+static void simbth_replay_value( struct simbth_ctx *ctx, const struct bluetooth_trace_record *record )
+{
+    union winebluetooth_watcher_event_data data = {0};
+    struct simbth_characteristic *chrc;
+    struct unix_name *name;
+
+    if (!(name = simbth_replay_find_name( ctx, record->handle )) || !(chrc = name->object)) return;
+    if (!simbth_replay_push_value( chrc, record )) return;
+    data.gatt_characteristic_value_changed.handle = unix_name_dup( name )->handle;
+    if (!simbth_queue_event( ctx, BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_VALUE_CHANGED, &data ))
+        unix_name_free( name );
+}
+
+/* Plays back the records that are due, a few at a time so that winebth.sys gets to see the events in between. */
+static void simbth_replay_next( struct simbth_ctx *ctx, struct simbth_timer *timer )
+{
+    struct bluetooth_trace *trace = ctx->replay;
+    UINT64 now = simbth_now();
+    UINT32 i;
+
+    for (i = 0; i < 64 && ctx->replay_next < trace->count; i++)
+    {
+        const struct bluetooth_trace_record *record = trace->records[ctx->replay_next];
+        UINT64 due;
+
+        if (!record)
+        {
+            ctx->replay_next++;
+            continue;
+        }
+        due = ctx->config.speed ? ctx->replay_start + record->time * 1000 / ctx->config.speed : 0;
+        if (due > now)
+        {
+            simbth_timer_set( ctx, timer, due );
+            return;
+        }
+        ctx->replay_next++;
+        switch (record->type)
+        {
+        case BLUETOOTH_TRACE_RECORD_NAME: simbth_replay_add_name( ctx, record ); break;
+        case BLUETOOTH_TRACE_RECORD_EVENT: simbth_replay_event( ctx, record ); break;
+        case BLUETOOTH_TRACE_RECORD_VALUE: simbth_replay_value( ctx, record ); break;
+        default: WARN( "Skipping unknown record type %u\n", record->type ); break;
+        }
+    }
+    if (ctx->replay_next < trace->count)
+        simbth_timer_set( ctx, timer, now );
+    else
+        MESSAGE( "winebth: Finished replaying %lu records from %s in %lu ms\n", (unsigned long)trace->count,
+                 ctx->config.replay, (unsigned long)((now - ctx->replay_start) / 1000000) );
+}
+
+BOOL simbth_enabled( void )
+{
+    const char *config = getenv( "WINEBTH_SIM" );
+    return config && *config;
+}
+
+void *simbth_init( void )
+{
+    struct simbth_ctx *ctx;
+    UINT32 i;
+
+    if (!(ctx = calloc( 1, sizeof( *ctx ) ))) return NULL;
+    simbth_parse_config( getenv( "WINEBTH_SIM" ), &ctx->config );
+    pthread_mutex_init( &ctx->mutex, NULL );
+    pthread_cond_init( &ctx->cond, NULL );
+    list_init( &ctx->radios );
+    list_init( &ctx->events );
+    list_init( &ctx->timers );
+    ctx->refcnt = 1;
+    ctx->random_state = 1;
+    rb_init( &ctx->replay_names, simbth_replay_name_compare );
+    ctx->replay_timer.callback = simbth_replay_next;
+
+    if (ctx->config.replay)
+    {
+        if (!(ctx->replay = bluetooth_trace_load( ctx->config.replay )))
+        {
+            pthread_cond_destroy( &ctx->cond );
+            pthread_mutex_destroy( &ctx->mutex );
+            free( ctx->config.replay );
+            free( ctx );
+            return NULL;
+        }
+        TRACE( "replay=%s speed=%u\n", debugstr_a( ctx->config.replay ), ctx->config.speed );
+        return ctx;
+    }
+
+    for (i = 0; i < ctx->config.radios; i++)
+    {
+        struct simbth_radio *radio;
+
+        if (!(radio = simbth_radio_create( ctx, i ))) break;
+        list_add_tail( &ctx->radios, &radio->entry );
+    }
+
+    TRACE( "radios=%u devices=%u services=%u characteristics=%u adv_interval=%u connect_time=%u latency=%u "
+           "jitter=%u notify_rate=%u payload=%u mtu=%u\n", ctx->config.radios, ctx->config.devices, ctx->config.services,
+           ctx->config.characteristics, ctx->config.adv_interval, ctx->config.connect_time, ctx->config.latency,
+           ctx->config.jitter, ctx->config.notify_rate, ctx->config.payload, ctx->config.mtu );
+    return ctx;
+}
+
+NTSTATUS simbth_watcher_init( void *connection )
+{
+    struct simbth_ctx *ctx = connection;
+    struct simbth_radio *radio;
+
+    pthread_mutex_lock( &ctx->mutex );
+    if (ctx->replay)
+    {
+        ctx->replay_start = simbth_now();
+        simbth_timer_set( ctx, &ctx->replay_timer, ctx->replay_start );
+    }
+    LIST_FOR_EACH_ENTRY( radio, &ctx->radios, struct simbth_radio, entry )
+    {
+        union winebluetooth_watcher_event_data data = {0};
+
+        data.radio_added.props_mask = WINEBLUETOOTH_RADIO_ALL_PROPERTIES;
+        data.radio_added.props = radio->props;
+        data.radio_added.radio.handle = unix_name_dup( radio->name )->handle;
+        if (!simbth_queue_event( ctx, BLUETOOTH_WATCHER_EVENT_TYPE_RADIO_ADDED, &data ))
+            unix_name_free( radio->name );
+    }
+    pthread_mutex_unlock( &ctx->mutex );
+    return STATUS_SUCCESS;
+}
+
+void simbth_close( void *connection )
+{
+    struct simbth_ctx *ctx = connection;
+
+    pthread_mutex_lock( &ctx->mutex );
+    ctx->closed = TRUE;
+    pthread_cond_broadcast( &ctx->cond );
+    pthread_mutex_unlock( &ctx->mutex );
+}
+
+static void simbth_ctx_release( struct simbth_ctx *ctx )
+{
+    struct simbth_radio *radio, *next_radio;
+    struct simbth_event *event, *next_event;
+    LONG refcnt;
+
+    pthread_mutex_lock( &ctx->mutex );
+    refcnt = --ctx->refcnt;
+    pthread_mutex_unlock( &ctx->mutex );
+    if (refcnt) return;
+
+    /* Requests that never finished own nothing but themselves. */
+    while (!list_empty( &ctx->timers ))
+    {
+        struct simbth_timer *timer = LIST_ENTRY( list_head( &ctx->timers ), struct simbth_timer, entry );
+
+        simbth_timer_cancel( timer );
+        if (timer->callback == simbth_request_finished)
+            free( CONTAINING_RECORD( timer, struct simbth_request, timer ) );
+    }
+    LIST_FOR_EACH_ENTRY_SAFE( event, next_event, &ctx->events, struct simbth_event, entry )
+    {
+        list_remove( &event->entry );
+        free( event );
+    }
+    LIST_FOR_EACH_ENTRY_SAFE( radio, next_radio, &ctx->radios, struct simbth_radio, entry )
+        simbth_radio_free( radio );
+    rb_destroy( &ctx->replay_names, simbth_replay_name_free, NULL );
+    if (ctx->replay) bluetooth_trace_free( ctx->replay );
+    free( ctx->config.replay );
+    pthread_cond_destroy( &ctx->cond );
+    pthread_mutex_destroy( &ctx->mutex );
+    free( ctx );
+}
+
+void simbth_free( void *connection )
+{
+    simbth_ctx_release( connection );
+}
+
+NTSTATUS simbth_loop( void *connection, struct winebluetooth_event *events, UINT32 max_count, UINT32 *count )
+{
+    struct simbth_ctx *ctx = connection;
+
+    *count = 0;
+    pthread_mutex_lock( &ctx->mutex );
+    ctx->refcnt++;
+    for (;;)
+    {
+        struct simbth_timer *timer;
+        struct timespec deadline;
+        UINT64 now, wait;
+
+        if (ctx->closed)
+        {
+            pthread_mutex_unlock( &ctx->mutex );
+            simbth_ctx_release( ctx );
+            return STATUS_SUCCESS;
+        }
+        while (*count < max_count && !list_empty( &ctx->events ))
+        {
+            struct simbth_event *event = LIST_ENTRY( list_head( &ctx->events ), struct simbth_event, entry );
+
+            list_remove( &event->entry );
+            bluetooth_stats_event_dequeued();
+            events[*count].status = WINEBLUETOOTH_EVENT_WATCHER_EVENT;
+            events[*count].data.watcher_event = event->event;
+            (*count)++;
+            free( event );
+        }
+        if (*count)
+        {
+            pthread_mutex_unlock( &ctx->mutex );
+            simbth_ctx_release( ctx );
+            return STATUS_PENDING;
+        }
+
+        now = simbth_now();
+        if (!list_empty( &ctx->timers ))
+        {
+            timer = LIST_ENTRY( list_head( &ctx->timers ), struct simbth_timer, entry );
+            if (timer->due <= now)
+            {
+                simbth_timer_cancel( timer );
+                timer->callback( ctx, timer );
+                continue;
+            }
+            wait = timer->due - now;
+        }
+        else
+            wait = (UINT64)60 * 1000000000;
+
+        /* Condition variables use CLOCK_REALTIME by default, and not all platforms can change that. */
+        clock_gettime( CLOCK_REALTIME, &deadline );
+        wait += deadline.tv_nsec;
+        deadline.tv_sec += wait / 1000000000;
+        deadline.tv_nsec = wait % 1000000000;
+        pthread_cond_timedwait( &ctx->cond, &ctx->mutex, &deadline );
+    }
+}
+
+/* Every simulated object is set as the object of its name when it gets created, and lives until the context is
+ * freed. */
+static struct simbth_radio *simbth_find_radio( struct simbth_ctx *ctx, const struct unix_name *name )
+{
+    return name->object;
+}
+
+static struct simbth_device *simbth_find_device( struct simbth_ctx *ctx, const struct unix_name *name )
+{
+    return name->object;
+}
+
+static struct simbth_characteristic *simbth_find_characteristic( struct simbth_ctx *ctx,
+                                                                 const struct unix_name *name )
+{
+    return name->object;
+}
+
+NTSTATUS simbth_adapter_set_prop( void *connection, struct unix_name *adapter,
+                                  struct bluetooth_adapter_set_prop_params *params )
+{
+    struct simbth_ctx *ctx = connection;
+    winebluetooth_radio_props_mask_t mask;
+    struct simbth_radio *radio;
+
+    pthread_mutex_lock( &ctx->mutex );
+    if (!(radio = simbth_find_radio( ctx, adapter )))
+    {
+        pthread_mutex_unlock( &ctx->mutex );
+        return STATUS_INVALID_PARAMETER;
+    }
+    switch (params->prop_flag)
+    {
+    case LOCAL_RADIO_CONNECTABLE:
+        radio->props.connectable = params->prop->boolean;
+        mask = WINEBLUETOOTH_RADIO_PROPERTY_CONNECTABLE;
+        break;
+    case LOCAL_RADIO_DISCOVERABLE:
+        radio->props.discoverable = params->prop->boolean;
+        mask = WINEBLUETOOTH_RADIO_PROPERTY_DISCOVERABLE;
+        break;
+    default:
+        pthread_mutex_unlock( &ctx->mutex );
+        return STATUS_INVALID_PARAMETER;
+    }
+    simbth_queue_radio_props_changed( ctx, radio, mask );
+    pthread_mutex_unlock( &ctx->mutex );
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS simbth_adapter_set_discovery_filter( void *connection, struct unix_name *adapter,
+                                              const struct winebluetooth_discovery_filter *filter )
+{
+    struct simbth_ctx *ctx = connection;
+    struct simbth_radio *radio;
+
+    pthread_mutex_lock( &ctx->mutex );
+    if ((radio = simbth_find_radio( ctx, adapter ))) radio->filter = *filter;
+    pthread_mutex_unlock( &ctx->mutex );
+    return radio ? STATUS_SUCCESS : STATUS_INVALID_PARAMETER;
+}
+
+NTSTATUS simbth_adapter_start_discovery( void *connection, struct unix_name *adapter )
+{
+    struct simbth_ctx *ctx = connection;
+    struct simbth_device *device;
+    struct simbth_radio *radio;
+    UINT64 now = simbth_now();
+
+    pthread_mutex_lock( &ctx->mutex );
+    if (!(radio = simbth_find_radio( ctx, adapter )))
+    {
+        pthread_mutex_unlock( &ctx->mutex );
+        return STATUS_INVALID_PARAMETER;
+    }
+    /* The trace already has the events for whatever the recording process did. */
+    if (ctx->replay)
+    {
+        pthread_mutex_unlock( &ctx->mutex );
+        return STATUS_SUCCESS;
+    }
+    if (!radio->props.discovering)
+    {
+        radio->props.discovering = TRUE;
+        simbth_queue_radio_props_changed( ctx, radio, WINEBLUETOOTH_RADIO_PROPERTY_DISCOVERING );
+        /* Peripherals advertise independently of each other, so spread out when they are first seen. */
+        LIST_FOR_EACH_ENTRY( device, &radio->devices, struct simbth_device, entry )
+        {
+            UINT64 offset = (UINT64)(device->props.address.rgBytes[5] % 16) * ctx->config.adv_interval * 1000 / 16;
+            simbth_timer_set( ctx, &device->adv_timer, now + simbth_delay( ctx, offset ) );
+        }
+    }
+    pthread_mutex_unlock( &ctx->mutex );
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS simbth_adapter_stop_discovery( void *connection, struct unix_name *adapter )
+{
+    struct simbth_ctx *ctx = connection;
+    struct simbth_device *device;
+    struct simbth_radio *radio;
+
+    pthread_mutex_lock( &ctx->mutex );
+    if (!(radio = simbth_find_radio( ctx, adapter )))
+    {
+        pthread_mutex_unlock( &ctx->mutex );
+        return STATUS_INVALID_PARAMETER;
+    }
+    if (ctx->replay)
+    {
+        pthread_mutex_unlock( &ctx->mutex );
+        return STATUS_SUCCESS;
+    }
+    if (radio->props.discovering)
+    {
+        radio->props.discovering = FALSE;
+        LIST_FOR_EACH_ENTRY( device, &radio->devices, struct simbth_device, entry )
+            simbth_timer_cancel( &device->adv_timer );
+        simbth_queue_radio_props_changed( ctx, radio, WINEBLUETOOTH_RADIO_PROPERTY_DISCOVERING );
+    }
+    pthread_mutex_unlock( &ctx->mutex );
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS simbth_adapter_remove_device( void *connection, struct unix_name *adapter, struct unix_name *name )
+{
+    struct simbth_ctx *ctx = connection;
+    union winebluetooth_watcher_event_data data = {0};
+    struct simbth_device *device;
+
+    pthread_mutex_lock( &ctx->mutex );
+    if (!(device = simbth_find_device( ctx, name )) || device->radio->name != adapter || !device->visible)
+    {
+        pthread_mutex_unlock( &ctx->mutex );
+        return STATUS_DEVICE_DOES_NOT_EXIST;
+    }
+    device->visible = FALSE;
+    device->services_added = FALSE;
+    device->props.connected = device->props.paired = device->props.services_resolved = FALSE;
+    simbth_timer_cancel( &device->connect_timer );
+    device->connecting = FALSE;
+    data.device_removed.device.handle = unix_name_dup( device->name )->handle;
+    if (!simbth_queue_event( ctx, BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_REMOVED, &data ))
+        unix_name_free( device->name );
+    pthread_mutex_unlock( &ctx->mutex );
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS simbth_device_connect( void *connection, struct unix_name *name )
+{
+    struct simbth_ctx *ctx = connection;
+    struct simbth_device *device;
+
+    pthread_mutex_lock( &ctx->mutex );
+    if (!(device = simbth_find_device( ctx, name )) || !device->visible)
+    {
+        pthread_mutex_unlock( &ctx->mutex );
+        return STATUS_DEVICE_DOES_NOT_EXIST;
+    }
+    if (!ctx->replay && !device->props.connected && !device->connecting)
+    {
+        device->connecting = TRUE;
+        simbth_timer_set( ctx, &device->connect_timer,
+                          simbth_now() + simbth_delay( ctx, (UINT64)ctx->config.connect_time * 1000 ) );
+    }
+    pthread_mutex_unlock( &ctx->mutex );
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS simbth_device_disconnect( void *connection, struct unix_name *name )
+{
+    struct simbth_ctx *ctx = connection;
+    struct simbth_device *device;
+
+    pthread_mutex_lock( &ctx->mutex );
+    if (!(device = simbth_find_device( ctx, name )))
+    {
+        pthread_mutex_unlock( &ctx->mutex );
+        return STATUS_DEVICE_DOES_NOT_EXIST;
+    }
+    simbth_timer_cancel( &device->connect_timer );
+    device->connecting = FALSE;
+    if (!ctx->replay && device->props.connected)
+    {
+        device->props.connected = FALSE;
+        simbth_queue_device_props_changed( ctx, device, WINEBLUETOOTH_DEVICE_PROPERTY_CONNECTED );
+    }
+    pthread_mutex_unlock( &ctx->mutex );
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS simbth_device_start_pairing( void *connection, struct unix_name *name, IRP *irp )
+{
+    struct simbth_ctx *ctx = connection;
+    struct simbth_request *request;
+    struct simbth_device *device;
+
+    pthread_mutex_lock( &ctx->mutex );
+    if (!(device = simbth_find_device( ctx, name )) || !device->visible)
+    {
+        pthread_mutex_unlock( &ctx->mutex );
+        return STATUS_DEVICE_DOES_NOT_EXIST;
+    }
+    if (device->props.paired)
+    {
+        pthread_mutex_unlock( &ctx->mutex );
+        return STATUS_DEVICE_ALREADY_ATTACHED;
+    }
+    if (!(request = calloc( 1, sizeof( *request ) )))
+    {
+        pthread_mutex_unlock( &ctx->mutex );
+        return STATUS_NO_MEMORY;
+    }
+    request->timer.callback = simbth_request_finished;
+    request->irp = irp;
+    request->device = device;
+    simbth_timer_set( ctx, &request->timer, simbth_now() + simbth_delay( ctx, ctx->config.latency * 4 ) );
+    pthread_mutex_unlock( &ctx->mutex );
+    return STATUS_PENDING;
+}
+
+static NTSTATUS simbth_characteristic_start_io( struct simbth_ctx *ctx, struct unix_name *name,
+                                                const unsigned char *data, unsigned int size, BOOL read,
+                                                BOOL response, IRP *irp )
+{
+    struct simbth_characteristic *chrc;
+    struct simbth_request *request;
+
+    pthread_mutex_lock( &ctx->mutex );
+    if (!(chrc = simbth_find_characteristic( ctx, name )))
+    {
+        pthread_mutex_unlock( &ctx->mutex );
+        return STATUS_INVALID_PARAMETER;
+    }
+    if (!chrc->service->device->props.connected)
+    {
+        pthread_mutex_unlock( &ctx->mutex );
+        return STATUS_DEVICE_NOT_CONNECTED;
+    }
+    if (!read)
+    {
+        /* The peripheral keeps the first word for the sequence numbers of its notifications. */
+        chrc->size = max( min( size, sizeof( chrc->value ) ), sizeof( UINT32 ) );
+        memcpy( chrc->value, data, min( size, sizeof( chrc->value ) ) );
+        if (!response)
+        {
+            pthread_mutex_unlock( &ctx->mutex );
+            return STATUS_SUCCESS;
+        }
+    }
+    if (!(request = calloc( 1, sizeof( *request ) )))
+    {
+        pthread_mutex_unlock( &ctx->mutex );
+        return STATUS_NO_MEMORY;
+    }
+    request->timer.callback = simbth_request_finished;
+    request->irp = irp;
+    request->characteristic = chrc;
+    request->device = chrc->service->device;
+    request->read = read;
+    simbth_timer_set( ctx, &request->timer, simbth_now() + simbth_delay( ctx, ctx->config.latency ) );
+    pthread_mutex_unlock( &ctx->mutex );
+    return STATUS_PENDING;
+}
+
+NTSTATUS simbth_characteristic_read( void *connection, struct unix_name *characteristic, IRP *irp )
+{
+    TRACE( "(%p, %s, %p)\n", connection, debugstr_a( characteristic->str ), irp );
+    return simbth_characteristic_start_io( connection, characteristic, NULL, 0, TRUE, TRUE, irp );
+}
+
+NTSTATUS simbth_characteristic_write( void *connection, struct unix_name *characteristic,
+                                      const unsigned char *data, unsigned int size, int write_type, IRP *irp )
+{
+    TRACE( "(%p, %s, %p, %u, %d, %p)\n", connection, debugstr_a( characteristic->str ), data, size, write_type,
+           irp );
+    return simbth_characteristic_start_io( connection, characteristic, data, size, FALSE, write_type != 1, irp );
+}
+
+/* The peripherals' controllers take up to this many write commands per connection event, which is taken to be half
+ * the latency apart. Streams have to wait for the next event once they have used them up. */
+#define SIMBTH_WRITE_CREDITS 8
+
+NTSTATUS simbth_characteristic_write_stream( void *connection, struct unix_name *characteristic,
+                                             const unsigned char *data, unsigned int size,
+                                             const volatile BOOLEAN *cancel, unsigned int *mtu,
+                                             unsigned int *packets, unsigned int *written )
+{
+    struct simbth_ctx *ctx = connection;
+    struct simbth_characteristic *chrc;
+    unsigned int chunk;
+
+    TRACE( "(%p, %s, %p, %u, %p)\n", connection, debugstr_a( characteristic->str ), data, size, cancel );
+
+    *mtu = ctx->config.mtu;
+    chunk = ctx->config.mtu - 3;
+    while (*written < size)
+    {
+        unsigned int i, len;
+        struct timespec ts;
+        UINT64 interval;
+
+        if (*cancel) return STATUS_CANCELLED;
+
+        pthread_mutex_lock( &ctx->mutex );
+        if (!(chrc = simbth_find_characteristic( ctx, characteristic )))
+        {
+            pthread_mutex_unlock( &ctx->mutex );
+            return STATUS_INVALID_PARAMETER;
+        }
+        if (!chrc->service->device->props.connected)
+        {
+            pthread_mutex_unlock( &ctx->mutex );
+            return STATUS_DEVICE_NOT_CONNECTED;
+        }
+        for (i = 0; i < SIMBTH_WRITE_CREDITS && *written < size; i++)
+        {
+            len = min( chunk, size - *written );
+            chrc->size = max( min( len, sizeof( chrc->value ) ), sizeof( UINT32 ) );
+            memcpy( chrc->value, data + *written, min( len, sizeof( chrc->value ) ) );
+            *written += len;
+            (*packets)++;
+        }
+        interval = simbth_delay( ctx, ctx->config.latency / 2 );
+        pthread_mutex_unlock( &ctx->mutex );
+
+        if (*written == size) break;
+        ts.tv_sec = interval / 1000000000;
+        ts.tv_nsec = interval % 1000000000;
+        while (nanosleep( &ts, &ts ) == -1 && errno == EINTR);
+    }
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS simbth_characteristic_get_mtu( void *connection, struct unix_name *characteristic, unsigned int *mtu )
+{
+    struct simbth_ctx *ctx = connection;
+    struct simbth_characteristic *chrc;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    pthread_mutex_lock( &ctx->mutex );
+    if (!(chrc = simbth_find_characteristic( ctx, characteristic )))
+        status = STATUS_INVALID_PARAMETER;
+    else if (!chrc->service->device->props.connected)
+        status = STATUS_DEVICE_NOT_CONNECTED;
+    else
+        *mtu = ctx->config.mtu;
+    pthread_mutex_unlock( &ctx->mutex );
+    return status;
+}
+
+NTSTATUS simbth_characteristic_set_notify( void *connection, struct unix_name *characteristic, BOOL enable,
+                                           UINT32 overflow_policy )
+{
+    struct simbth_ctx *ctx = connection;
+    struct simbth_characteristic *chrc;
+
+    pthread_mutex_lock( &ctx->mutex );
+    if (!(chrc = simbth_find_characteristic( ctx, characteristic )))
+    {
+        pthread_mutex_unlock( &ctx->mutex );
+        return STATUS_INVALID_PARAMETER;
+    }
+    if (!enable)
+    {
+        chrc->notifying = FALSE;
+        simbth_timer_cancel( &chrc->notify_timer );
+        pthread_mutex_unlock( &ctx->mutex );
+        return STATUS_SUCCESS;
+    }
+
+    if (chrc->notifications)
+        notification_ring_set_policy( chrc->notifications, overflow_policy );
+    else if (!(chrc->notifications = notification_ring_create( overflow_policy )))
+    {
+        pthread_mutex_unlock( &ctx->mutex );
+        return STATUS_NO_MEMORY;
+    }
+    if (!chrc->notifying)
+    {
+        chrc->notifying = TRUE;
+        /* Played back notifications come from the trace. */
+        if (!ctx->replay)
+            simbth_timer_set( ctx, &chrc->notify_timer,
+                              simbth_now() + simbth_delay( ctx, 1000000 / max( ctx->config.notify_rate, 1 ) ) );
+    }
+    pthread_mutex_unlock( &ctx->mutex );
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS simbth_characteristic_read_notification( void *connection, struct unix_name *characteristic,
+                                                  unsigned char *buffer, unsigned int buffer_size,
+                                                  unsigned int *size )
+{
+    struct simbth_ctx *ctx = connection;
+    struct simbth_characteristic *chrc;
+    NTSTATUS status = STATUS_TIMEOUT;
+
+    *size = 0;
+    pthread_mutex_lock( &ctx->mutex );
+    if ((chrc = simbth_find_characteristic( ctx, characteristic )) && chrc->notifications)
+        status = notification_ring_pop( chrc->notifications, buffer, buffer_size, size );
+    pthread_mutex_unlock( &ctx->mutex );
+    return status;
+}
+
+NTSTATUS simbth_characteristic_read_notifications( void *connection, struct unix_name *characteristic,
+                                                   unsigned char *buffer, unsigned int buffer_size,
+                                                   unsigned int max_count, unsigned int *count,
+                                                   unsigned int *size, unsigned int *overflow_count )
+{
+    struct simbth_ctx *ctx = connection;
+    struct simbth_characteristic *chrc;
+    NTSTATUS status = STATUS_TIMEOUT;
+
+    *count = *size = *overflow_count = 0;
+    pthread_mutex_lock( &ctx->mutex );
+    if ((chrc = simbth_find_characteristic( ctx, characteristic )) && chrc->notifications)
+        status = notification_ring_drain( chrc->notifications, buffer, buffer_size, max_count, count, size,
+                                          overflow_count );
+    pthread_mutex_unlock( &ctx->mutex );
+    return status;
+}
+
+NTSTATUS simbth_characteristic_get_notification_stats( void *connection, struct unix_name *characteristic,
+                                                       struct bluetooth_gatt_notification_stats *stats )
+{
+    struct simbth_ctx *ctx = connection;
+    struct simbth_characteristic *chrc;
+
+    pthread_mutex_lock( &ctx->mutex );
+    if ((chrc = simbth_find_characteristic( ctx, characteristic )) && chrc->notifications)
+        notification_ring_get_stats( chrc->notifications, stats );
+    pthread_mutex_unlock( &ctx->mutex );
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,399 @@
+/*
+ * Recording and loading traces of the events winebth.sys gets from the Bluetooth service
+ *
+ * Copyright 2026 agent
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#if 0
+#pragma makedep unix
+#endif
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <ntstatus.h>
+#define WIN32_NO_STATUS
+#include <winternl.h>
+#include <windef.h>
+#include <winbase.h>
+
+#include <wine/rbtree.h>
+#include <wine/debug.h>
+
+#include "unixlib.h"
+#include "unixlib_priv.h"
+
+WINE_DEFAULT_DEBUG_CHANNEL( winebth );
+
+/* If the WINEBTH_RECORD environment variable is set, every watcher event handed to winebth.sys, as well as every
+ * notification value it reads, gets appended to the file it names. The simulated backend can play such a trace back
+ * later on, see simbth.c.
+ *
+ * Handles only mean something to the process that created them, so the first record mentioning a handle is preceded
+ * by a BLUETOOTH_TRACE_RECORD_NAME record with the path it stands for. Events only take up as many bytes as the
+ * member of union winebluetooth_watcher_event_data for their type, and IRP pointers are recorded as they are, even
+ * though they are of no use to a replay. Every record is followed by zeros up to the next multiple of
+ * BLUETOOTH_TRACE_ALIGN bytes, so that the headers and event data can be read in place once the trace is loaded. Traces
+ * use the host's byte order, and are only meant to be played back by the same build of winebth.so that recorded
+ * them. */
+
+C_ASSERT( sizeof( struct bluetooth_trace_header ) % BLUETOOTH_TRACE_ALIGN == 0 );
+C_ASSERT( sizeof( struct bluetooth_trace_record ) % BLUETOOTH_TRACE_ALIGN == 0 );
+
+static inline UINT32 trace_padded_size( UINT32 size )
+{
+    return (size + BLUETOOTH_TRACE_ALIGN - 1) & ~(BLUETOOTH_TRACE_ALIGN - 1);
+}
+
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Guarded by trace_mutex. */
+static FILE *trace_file;
+static UINT64 trace_start;
+/* The handles that have had a name record written for them, struct trace_name_entry. */
+static struct rb_tree trace_names;
+/* Only read without holding trace_mutex to skip all of the above when not recording. */
+static BOOL trace_recording;
+
+struct trace_name_entry
+{
+    struct rb_entry entry;
+    UINT64 handle;
+};
+
+static int trace_name_compare( const void *key, const struct rb_entry *entry )
+{
+    const struct trace_name_entry *name = RB_ENTRY_VALUE( entry, const struct trace_name_entry, entry );
+    UINT64 handle = *(const UINT64 *)key;
+
+    return handle < name->handle ? -1 : handle > name->handle;
+}
+
+static void trace_name_free( struct rb_entry *entry, void *context )
+{
+    free( RB_ENTRY_VALUE( entry, struct trace_name_entry, entry ) );
+}
+
+static UINT64 trace_now( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (UINT64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+UINT32 bluetooth_trace_event_size( enum winebluetooth_watcher_event_type type,
+                                   const union winebluetooth_watcher_event_data *data )
+{
+    switch (type)
+    {
+    case BLUETOOTH_WATCHER_EVENT_TYPE_RADIO_ADDED: return sizeof( data->radio_added );
+    case BLUETOOTH_WATCHER_EVENT_TYPE_RADIO_REMOVED: return sizeof( data->radio_removed );
+    case BLUETOOTH_WATCHER_EVENT_TYPE_RADIO_PROPERTIES_CHANGED: return sizeof( data->radio_props_changed );
+    case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_ADDED: return sizeof( data->device_added );
+    case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_REMOVED: return sizeof( data->device_removed );
+    case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_PROPERTIES_CHANGED: return sizeof( data->device_props_changed );
+    case BLUETOOTH_WATCHER_EVENT_TYPE_PAIRING_FINISHED: return sizeof( data->pairing_finished );
+    case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_GATT_SERVICE_ADDED: return sizeof( data->gatt_service_added );
+    case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_GATT_SERVICE_REMOVED: return sizeof( data->gatt_service_removed );
+    case BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_ADDED: return sizeof( data->gatt_characteristic_added );
+    case BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_REMOVED: return sizeof( data->gatt_characterisic_removed );
+    case BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_VALUE_CHANGED:
+        return sizeof( data->gatt_characteristic_value_changed );
+    case BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_IO_FINISHED:
+        return offsetof( struct winebluetooth_watcher_event_gatt_characteristic_io_finished,
+                         value[min( data->gatt_characteristic_io_finished.size, WINEBLUETOOTH_GATT_MAX_VALUE_SIZE )] );
+    }
+    return 0;
+}
+
+UINT32 bluetooth_trace_event_handles( enum winebluetooth_watcher_event_type type,
+                                      union winebluetooth_watcher_event_data *data, UINT_PTR *handles[2] )
+{
+    switch (type)
+    {
+    case BLUETOOTH_WATCHER_EVENT_TYPE_RADIO_ADDED:
+        handles[0] = &data->radio_added.radio.handle;
+        return 1;
+    case BLUETOOTH_WATCHER_EVENT_TYPE_RADIO_REMOVED:
+        handles[0] = &data->radio_removed.handle;
+        return 1;
+    case BLUETOOTH_WATCHER_EVENT_TYPE_RADIO_PROPERTIES_CHANGED:
+        handles[0] = &data->radio_props_changed.radio.handle;
+        return 1;
+    case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_ADDED:
+        handles[0] = &data->device_added.device.handle;
+        handles[1] = &data->device_added.radio.handle;
+        return 2;
+    case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_REMOVED:
+        handles[0] = &data->device_removed.device.handle;
+        return 1;
+    case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_PROPERTIES_CHANGED:
+        handles[0] = &data->device_props_changed.device.handle;
+        return 1;
+    case BLUETOOTH_WATCHER_EVENT_TYPE_PAIRING_FINISHED:
+        return 0;
+    case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_GATT_SERVICE_ADDED:
+        handles[0] = &data->gatt_service_added.service.handle;
+        handles[1] = &data->gatt_service_added.device.handle;
+        return 2;
+    case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_GATT_SERVICE_REMOVED:
+        handles[0] = &data->gatt_service_removed.handle;
+        return 1;
+    case BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_ADDED:
+        handles[0] = &data->gatt_characteristic_added.characteristic.handle;
+        handles[1] = &data->gatt_characteristic_added.service.handle;
+        return 2;
+    case BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_REMOVED:
+        handles[0] = &data->gatt_characterisic_removed.handle;
+        return 1;
+    case BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_VALUE_CHANGED:
+        handles[0] = &data->gatt_characteristic_value_changed.handle;
+        return 1;
+    case BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_IO_FINISHED:
+        handles[0] = &data->gatt_characteristic_io_finished.characteristic.handle;
+        return 1;
+    }
+    return 0;
+}
+
+/* Needs to be called with trace_mutex held. */
+static BOOL trace_write_record( UINT16 type, UINT64 time, UINT64 handle, const void *data, UINT32 size )
+{
+    static const unsigned char padding[BLUETOOTH_TRACE_ALIGN];
+    struct bluetooth_trace_record record = {0};
+    UINT32 padding_size = trace_padded_size( size ) - size;
+
+    record.type = type;
+    record.size = size;
+    record.time = time;
+    record.handle = handle;
+    if (fwrite( &record, sizeof( record ), 1, trace_file ) != 1 || (size && fwrite( data, size, 1, trace_file ) != 1)
+        || (padding_size && fwrite( padding, padding_size, 1, trace_file ) != 1))
+    {
+        ERR( "Failed to write to the trace, stopping the recording\n" );
+        fclose( trace_file );
+        trace_file = NULL;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* Needs to be called with trace_mutex held. */
+static BOOL trace_write_name( UINT64 time, UINT_PTR handle )
+{
+    struct trace_name_entry *entry;
+    UINT64 key = handle;
+    struct unix_name *name;
+
+    if (rb_get( &trace_names, &key )) return TRUE;
+    /* The caller still holds a reference to every handle it passes to us. */
+    if (!(name = unix_name_from_handle( handle ))) return TRUE;
+    if (!(entry = calloc( 1, sizeof( *entry ) ))) return FALSE;
+    entry->handle = handle;
+    rb_put( &trace_names, &key, &entry->entry );
+    return trace_write_record( BLUETOOTH_TRACE_RECORD_NAME, time, handle, name->str, strlen( name->str ) );
+}
+
+void bluetooth_trace_init( void )
+{
+    struct bluetooth_trace_header header = {0};
+    const char *path = getenv( "WINEBTH_RECORD" );
+
+    if (!path || !*path) return;
+
+    pthread_mutex_lock( &trace_mutex );
+    if (!(trace_file = fopen( path, "wb" )))
+    {
+        ERR( "Failed to create trace %s\n", debugstr_a( path ) );
+        pthread_mutex_unlock( &trace_mutex );
+        return;
+    }
+    header.magic = BLUETOOTH_TRACE_MAGIC;
+    header.version = BLUETOOTH_TRACE_VERSION;
+    header.event_size = sizeof( union winebluetooth_watcher_event_data );
+    if (fwrite( &header, sizeof( header ), 1, trace_file ) != 1)
+    {
+        ERR( "Failed to write to trace %s\n", debugstr_a( path ) );
+        fclose( trace_file );
+        trace_file = NULL;
+        pthread_mutex_unlock( &trace_mutex );
+        return;
+    }
+    rb_init( &trace_names, trace_name_compare );
+    trace_start = trace_now();
+    trace_recording = TRUE;
+    pthread_mutex_unlock( &trace_mutex );
+    TRACE( "Recording events to %s\n", debugstr_a( path ) );
+}
+
+void bluetooth_trace_close( void )
+{
+    if (!trace_recording) return;
+
+    pthread_mutex_lock( &trace_mutex );
+    if (trace_file) fclose( trace_file );
+    trace_file = NULL;
+    rb_destroy( &trace_names, trace_name_free, NULL );
+    trace_recording = FALSE;
+    pthread_mutex_unlock( &trace_mutex );
+}
+
+void bluetooth_trace_events( const struct winebluetooth_event *events, UINT32 count )
+{
+    UINT64 time;
+    UINT32 i;
+
+    if (!ReadAcquire( (LONG *)&trace_recording )) return;
+
+    pthread_mutex_lock( &trace_mutex );
+    time = trace_now() - trace_start;
+    for (i = 0; i < count && trace_file; i++)
+    {
+        const struct winebluetooth_watcher_event *event = &events[i].data.watcher_event;
+        union winebluetooth_watcher_event_data data = event->event_data;
+        UINT_PTR *handles[2];
+        UINT32 j, handles_count;
+
+        /* Authentication requests need an answer from the user, and can't be replayed. */
+        if (events[i].status != WINEBLUETOOTH_EVENT_WATCHER_EVENT) continue;
+        handles_count = bluetooth_trace_event_handles( event->event_type, &data, handles );
+        for (j = 0; j < handles_count; j++)
+            if (!trace_write_name( time, *handles[j] )) break;
+        if (j < handles_count) break;
+        trace_write_record( BLUETOOTH_TRACE_RECORD_EVENT, time, event->event_type, &data,
+                            bluetooth_trace_event_size( event->event_type, &data ) );
+    }
+    if (trace_file) fflush( trace_file );
+    pthread_mutex_unlock( &trace_mutex );
+}
+
+void bluetooth_trace_notifications( UINT_PTR characteristic, const unsigned char *buffer, UINT32 count,
+                                    UINT32 size, BOOL records )
+{
+    UINT32 offset = 0;
+    UINT64 time;
+
+    if (!ReadAcquire( (LONG *)&trace_recording )) return;
+
+    pthread_mutex_lock( &trace_mutex );
+    time = trace_now() - trace_start;
+    if (trace_file && trace_write_name( time, characteristic ))
+    {
+        while (count-- && trace_file)
+        {
+            UINT32 value_size = size - offset;
+
+            if (records)
+            {
+                const struct bluetooth_gatt_notification_record *record = (const void *)(buffer + offset);
+
+                offset += sizeof( *record );
+                value_size = record->size;
+            }
+            trace_write_record( BLUETOOTH_TRACE_RECORD_VALUE, time, characteristic, buffer + offset, value_size );
+            offset += value_size;
+        }
+    }
+    pthread_mutex_unlock( &trace_mutex );
+}
+
+struct bluetooth_trace *bluetooth_trace_load( const char *path )
+{
+    const struct bluetooth_trace_header *header;
+    struct bluetooth_trace *trace;
+    SIZE_T offset, capacity = 0;
+    FILE *file;
+    long size;
+
+    if (!(file = fopen( path, "rb" )))
+    {
+        ERR( "Failed to open trace %s\n", debugstr_a( path ) );
+        return NULL;
+    }
+    if (fseek( file, 0, SEEK_END ) || (size = ftell( file )) < 0 || fseek( file, 0, SEEK_SET ))
+    {
+        fclose( file );
+        return NULL;
+    }
+    if (!(trace = calloc( 1, sizeof( *trace ) )) || !(trace->data = malloc( max( size, 1 ) )))
+    {
+        free( trace );
+        fclose( file );
+        return NULL;
+    }
+    trace->size = size;
+    if (fread( trace->data, 1, size, file ) != size)
+    {
+        ERR( "Failed to read trace %s\n", debugstr_a( path ) );
+        fclose( file );
+        bluetooth_trace_free( trace );
+        return NULL;
+    }
+    fclose( file );
+
+    header = (const struct bluetooth_trace_header *)trace->data;
+    if (trace->size < sizeof( *header ) || header->magic != BLUETOOTH_TRACE_MAGIC
+        || header->version != BLUETOOTH_TRACE_VERSION
+        || header->event_size != sizeof( union winebluetooth_watcher_event_data ))
+    {
+        ERR( "%s is not a trace recorded by this version of winebth.sys\n", debugstr_a( path ) );
+        bluetooth_trace_free( trace );
+        return NULL;
+    }
+
+    for (offset = sizeof( *header ); offset < trace->size;)
+    {
+        const struct bluetooth_trace_record *record = (const void *)(trace->data + offset);
+
+        if (trace->size - offset < sizeof( *record )
+            || trace->size - offset - sizeof( *record ) < trace_padded_size( record->size ))
+        {
+            WARN( "Trace %s is truncated, ignoring the last %lu bytes\n", debugstr_a( path ),
+                  (unsigned long)(trace->size - offset) );
+            break;
+        }
+        if (trace->count == capacity)
+        {
+            const struct bluetooth_trace_record **records;
+
+            capacity = max( capacity * 2, 256 );
+            if (!(records = realloc( trace->records, capacity * sizeof( *records ) )))
+            {
+                bluetooth_trace_free( trace );
+                return NULL;
+            }
+            trace->records = records;
+        }
+        trace->records[trace->count++] = record;
+        offset += sizeof( *record ) + trace_padded_size( record->size );
+    }
+    TRACE( "Loaded %lu records from %s\n", (unsigned long)trace->count, debugstr_a( path ) );
+    return trace;
+}
+
+void bluetooth_trace_free( struct bluetooth_trace *trace )
+{
+    free( trace->records );
+    free( trace->data );
+    free( trace );
+}
@@ -62,6 +62,91 @@ static int compare_string( const void *key, const struct wine_rb_entry *entry )
 static struct rb_tree names = { .compare = compare_string };
 static pthread_mutex_t names_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/* The PE side only ever sees names as handles into this table, made of a slot index and the generation of the slot.
+ * A slot's generation changes every time it gets freed, so a stale handle doesn't match the name that reuses it.
+ * The table grows a chunk at a time, and chunks never move or get freed, so handles can be looked up without taking
+ * names_mutex. */
+#define NAME_HANDLE_INDEX_BITS WINEBLUETOOTH_HANDLE_INDEX_BITS
+#define NAME_HANDLE_INDEX_MASK WINEBLUETOOTH_HANDLE_INDEX_MASK
+#define NAME_HANDLE_GENERATION_MASK (sizeof( UINT_PTR ) > 4 ? MAXLONG : (LONG)(~0u >> NAME_HANDLE_INDEX_BITS))
+#define NAME_SLOTS_PER_CHUNK 1024
+#define NAME_SLOT_CHUNKS ((NAME_HANDLE_INDEX_MASK + 1) / NAME_SLOTS_PER_CHUNK)
+
+struct name_slot
+{
+    struct unix_name *name;
+    LONG generation;
+    /* The index of the next free slot, if this one is free. */
+    UINT32 next_free;
+};
+
+static struct name_slot *name_slot_chunks[NAME_SLOT_CHUNKS];
+/* Guarded by names_mutex. */
+static UINT32 name_slots_used;
+static UINT32 name_slots_free = ~0u;
+
+static inline struct name_slot *name_slot_get( UINT32 index )
+{
+    struct name_slot *chunk = ReadPointerAcquire( (void **)&name_slot_chunks[index / NAME_SLOTS_PER_CHUNK] );
+    return chunk ? &chunk[index % NAME_SLOTS_PER_CHUNK] : NULL;
+}
+
+/* Needs to be called with names_mutex held. */
+static BOOL name_slot_alloc( struct unix_name *name )
+{
+    struct name_slot *slot;
+    UINT32 index;
+
+    if (name_slots_free != ~0u)
+    {
+        index = name_slots_free;
+        slot = name_slot_get( index );
+        name_slots_free = slot->next_free;
+    }
+    else
+    {
+        if (name_slots_used > NAME_HANDLE_INDEX_MASK) return FALSE;
+        index = name_slots_used;
+        if (!(slot = name_slot_get( index )))
+        {
+            struct name_slot *chunk = calloc( NAME_SLOTS_PER_CHUNK, sizeof( *chunk ) );
+
+            if (!chunk) return FALSE;
+            WritePointerRelease( (void **)&name_slot_chunks[index / NAME_SLOTS_PER_CHUNK], chunk );
+            slot = &chunk[0];
+        }
+        name_slots_used++;
+        slot->generation = 1;
+    }
+
+    name->handle = ((UINT_PTR)slot->generation << NAME_HANDLE_INDEX_BITS) | index;
+    WritePointerRelease( (void **)&slot->name, name );
+    return TRUE;
+}
+
+/* Needs to be called with names_mutex held. */
+static void name_slot_free( struct unix_name *name )
+{
+    UINT32 index = name->handle & NAME_HANDLE_INDEX_MASK;
+    struct name_slot *slot = name_slot_get( index );
+    LONG generation = ((ULONG)slot->generation + 1) & NAME_HANDLE_GENERATION_MASK;
+
+    WriteRelease( &slot->generation, generation ? generation : 1 );
+    WritePointerRelease( (void **)&slot->name, NULL );
+    slot->next_free = name_slots_free;
+    name_slots_free = index;
+}
+
+/* Doesn't take a reference, the caller needs to hold one already, usually the one the handle was handed out with. */
+struct unix_name *unix_name_from_handle( UINT_PTR handle )
+{
+    struct name_slot *slot;
+
+    if (!(slot = name_slot_get( handle & NAME_HANDLE_INDEX_MASK ))) return NULL;
+    if (ReadAcquire( &slot->generation ) != (LONG)(handle >> NAME_HANDLE_INDEX_BITS)) return NULL;
+    return ReadPointerAcquire( (void **)&slot->name );
+}
+
 struct unix_name *unix_name_dup( struct unix_name *name )
 {
     pthread_mutex_lock( &names_mutex );
@@ -79,14 +164,18 @@ struct unix_name *unix_name_get_or_create( const char *str )
     entry = rb_get( &names, str );
     if (!entry)
     {
-        struct unix_name *s = malloc( sizeof( struct unix_name ) );
-        if (!s)
+        if (!(s = calloc( 1, sizeof( struct unix_name ) )))
         {
             pthread_mutex_unlock( &names_mutex );
             return NULL;
         }
-        s->str = strdup( str );
-        s->refcnt = 0;
+        if (!(s->str = strdup( str )) || !name_slot_alloc( s ))
+        {
+            free( s->str );
+            free( s );
+            pthread_mutex_unlock( &names_mutex );
+            return NULL;
+        }
         rb_put( &names, str, &s->entry );
         entry = &s->entry;
     }
@@ -103,6 +192,8 @@ void unix_name_free( struct unix_name *name )
     if (name->refcnt == 0)
     {
         rb_remove( &names, &name->entry );
+        name_slot_free( name );
+        free( name->str );
         free( name );
     }
     pthread_mutex_unlock( &names_mutex );
@@ -111,11 +202,23 @@ void unix_name_free( struct unix_name *name )
 static void *dbus_connection;
 static void *bluetooth_watcher;
 static void *bluetooth_auth_agent;
+/* dbus_connection is a simbth context, see simbth.c. */
+static BOOL simulated;
 
 static NTSTATUS bluetooth_init ( void *params )
 {
     NTSTATUS status;
 
+    bluetooth_trace_init();
+    if ((simulated = simbth_enabled()))
+    {
+        if (!(dbus_connection = simbth_init()))
+            return STATUS_NO_MEMORY;
+        status = simbth_watcher_init( dbus_connection );
+        TRACE( "simbth_connection=%p\n", dbus_connection );
+        return status;
+    }
+
 #ifdef __APPLE__
     dbus_connection = corebth_init();
     if (!dbus_connection)
@@ -166,6 +269,13 @@ static NTSTATUS bluetooth_shutdown( void *params )
 {
     if (!dbus_connection) return STATUS_NOT_SUPPORTED;
 
+    bluetooth_trace_close();
+    if (simulated)
+    {
+        simbth_close( dbus_connection );
+        simbth_free( dbus_connection );
+        return STATUS_SUCCESS;
+    }
 #ifdef __APPLE__
     corebth_auth_agent_stop( dbus_connection, bluetooth_auth_agent );
     corebth_close( dbus_connection );
@@ -201,75 +311,118 @@ static NTSTATUS get_unique_name( const struct unix_name *name, char *buf, SIZE_T
     return STATUS_SUCCESS;
 }
 
+void unix_name_free_handle( UINT_PTR handle )
+{
+    struct unix_name *name = unix_name_from_handle( handle );
+
+    if (name) unix_name_free( name );
+    else WARN( "Invalid handle %p.\n", (void *)handle );
+}
+
+static void unix_name_dup_handle( UINT_PTR handle )
+{
+    struct unix_name *name = unix_name_from_handle( handle );
+
+    if (name) unix_name_dup( name );
+    else WARN( "Invalid handle %p.\n", (void *)handle );
+}
+
 static NTSTATUS bluetooth_adapter_get_unique_name( void *args )
 {
     struct bluetooth_adapter_get_unique_name_params *params = args;
+    struct unix_name *adapter;
+
     if (!dbus_connection) return STATUS_NOT_SUPPORTED;
+    if (!(adapter = unix_name_from_handle( params->adapter ))) return STATUS_INVALID_PARAMETER;
 
-    return get_unique_name( params->adapter, params->buf, &params->buf_size );
+    return get_unique_name( adapter, params->buf, &params->buf_size );
 }
 
 static NTSTATUS bluetooth_adapter_free( void *args )
 {
     struct bluetooth_adapter_free_params *params = args;
-    unix_name_free( params->adapter );
+    unix_name_free_handle( params->adapter );
     return STATUS_SUCCESS;
 }
 
 static NTSTATUS bluetooth_adapter_dup( void *args )
 {
     struct bluetooth_adapter_dup_params *params = args;
-    unix_name_dup( params->adapter );
+    unix_name_dup_handle( params->adapter );
     return STATUS_SUCCESS;
 }
 
 static NTSTATUS bluetooth_adapter_set_prop( void *arg )
 {
     struct bluetooth_adapter_set_prop_params *params = arg;
+    struct unix_name *adapter;
 
     if (!dbus_connection) return STATUS_NOT_SUPPORTED;
+    if (!(adapter = unix_name_from_handle( params->adapter ))) return STATUS_INVALID_PARAMETER;
+    if (simulated) return simbth_adapter_set_prop( dbus_connection, adapter, params );
 #ifdef __APPLE__
     return corebth_adapter_set_prop( dbus_connection, params );
 #else
-    return bluez_adapter_set_prop( dbus_connection, params );
+    return bluez_adapter_set_prop( dbus_connection, adapter, params );
 #endif
 }
 
 static NTSTATUS bluetooth_device_free( void *args )
 {
     struct bluetooth_device_free_params *params = args;
-    unix_name_free( params->device );
+    unix_name_free_handle( params->device );
     return STATUS_SUCCESS;
 }
 
 static NTSTATUS bluetooth_device_dup( void *args )
 {
     struct bluetooth_device_dup_params *params = args;
-    unix_name_dup( params->device );
+    unix_name_dup_handle( params->device );
     return STATUS_SUCCESS;
 }
 
+static NTSTATUS bluetooth_adapter_set_discovery_filter( void *args )
+{
+    struct bluetooth_adapter_set_discovery_filter_params *params = args;
+    struct unix_name *adapter;
+
+    if (!dbus_connection) return STATUS_NOT_SUPPORTED;
+    if (!(adapter = unix_name_from_handle( params->adapter ))) return STATUS_INVALID_PARAMETER;
+    if (simulated) return simbth_adapter_set_discovery_filter( dbus_connection, adapter, params->filter );
+#ifdef __APPLE__
+    return corebth_adapter_set_discovery_filter( dbus_connection, adapter->str, params->filter );
+#else
+    return bluez_adapter_set_discovery_filter( dbus_connection, adapter->str, params->filter );
+#endif
+}
+
 static NTSTATUS bluetooth_adapter_start_discovery( void *args )
 {
     struct bluetooth_adapter_start_discovery_params *params = args;
+    struct unix_name *adapter;
 
     if (!dbus_connection) return STATUS_NOT_SUPPORTED;
+    if (!(adapter = unix_name_from_handle( params->adapter ))) return STATUS_INVALID_PARAMETER;
+    if (simulated) return simbth_adapter_start_discovery( dbus_connection, adapter );
 #ifdef __APPLE__
-    return corebth_adapter_start_discovery( dbus_connection, params->adapter->str );
+    return corebth_adapter_start_discovery( dbus_connection, adapter->str );
 #else
-    return bluez_adapter_start_discovery( dbus_connection, params->adapter->str );
+    return bluez_adapter_start_discovery( dbus_connection, adapter->str );
 #endif
 }
 
 static NTSTATUS bluetooth_adapter_stop_discovery( void *args )
 {
     struct bluetooth_adapter_stop_discovery_params *params = args;
+    struct unix_name *adapter;
 
     if (!dbus_connection) return STATUS_NOT_SUPPORTED;
+    if (!(adapter = unix_name_from_handle( params->adapter ))) return STATUS_INVALID_PARAMETER;
+    if (simulated) return simbth_adapter_stop_discovery( dbus_connection, adapter );
 #ifdef __APPLE__
-    return corebth_adapter_stop_discovery( dbus_connection, params->adapter->str );
+    return corebth_adapter_stop_discovery( dbus_connection, adapter->str );
 #else
-    return bluez_adapter_stop_discovery( dbus_connection, params->adapter->str );
+    return bluez_adapter_stop_discovery( dbus_connection, adapter->str );
 #endif
 }
 
@@ -277,18 +430,25 @@ static NTSTATUS bluetooth_adapter_stop_discovery( void *args )
 static NTSTATUS bluetooth_adapter_remove_device( void *args )
 {
     struct bluetooth_adapter_remove_device_params *params = args;
+    struct unix_name *adapter;
+    struct unix_name *device;
 
     if (!dbus_connection) return STATUS_NOT_SUPPORTED;
+    if (!(adapter = unix_name_from_handle( params->adapter ))) return STATUS_INVALID_PARAMETER;
+    if (!(device = unix_name_from_handle( params->device ))) return STATUS_INVALID_PARAMETER;
+    if (simulated) return simbth_adapter_remove_device( dbus_connection, adapter, device );
 #ifdef __APPLE__
-    return corebth_adapter_remove_device( dbus_connection, params->adapter->str, params->device->str );
+    return corebth_adapter_remove_device( dbus_connection, adapter->str, device->str );
 #else
-    return bluez_adapter_remove_device( dbus_connection, params->adapter->str, params->device->str );
+    return bluez_adapter_remove_device( dbus_connection, adapter->str, device->str );
 #endif
 }
 
 static NTSTATUS bluetooth_auth_agent_enable_incoming( void *args )
 {
     if (!dbus_connection) return STATUS_NOT_SUPPORTED;
+    /* Simulated devices pair without asking. */
+    if (simulated) return STATUS_SUCCESS;
 #ifdef __APPLE__
     return corebth_auth_agent_request_default( dbus_connection );
 #else
@@ -299,13 +459,16 @@ static NTSTATUS bluetooth_auth_agent_enable_incoming( void *args )
 static NTSTATUS bluetooth_auth_send_response( void *args )
 {
     struct bluetooth_auth_send_response_params *params = args;
+    struct unix_name *device;
 
     if (!dbus_connection) return STATUS_NOT_SUPPORTED;
+    if (!(device = unix_name_from_handle( params->device ))) return STATUS_INVALID_PARAMETER;
+    if (simulated) return STATUS_NOT_SUPPORTED;
 #ifdef __APPLE__
-    return corebth_auth_agent_send_response( bluetooth_auth_agent, params->device, params->method,
+    return corebth_auth_agent_send_response( bluetooth_auth_agent, device, params->method,
                                              params->numeric_or_passkey, params->negative, params->authenticated );
 #else
-    return bluez_auth_agent_send_response( bluetooth_auth_agent, params->device, params->method,
+    return bluez_auth_agent_send_response( bluetooth_auth_agent, device, params->method,
                                            params->numeric_or_passkey, params->negative, params->authenticated );
 #endif
 }
@@ -313,18 +476,37 @@ static NTSTATUS bluetooth_auth_send_response( void *args )
 static NTSTATUS bluetooth_device_disconnect( void *args )
 {
     struct bluetooth_device_disconnect_params *params = args;
+    struct unix_name *device;
+
+    if (!dbus_connection) return STATUS_NOT_SUPPORTED;
+    if (!(device = unix_name_from_handle( params->device ))) return STATUS_INVALID_PARAMETER;
+    if (simulated) return simbth_device_disconnect( dbus_connection, device );
+#ifdef __APPLE__
+    return corebth_device_disconnect( dbus_connection, device->str );
+#else
+    return bluez_device_disconnect( dbus_connection, device->str );
+#endif
+}
+
+static NTSTATUS bluetooth_device_connect( void *args )
+{
+    struct bluetooth_device_connect_params *params = args;
+    struct unix_name *device;
 
     if (!dbus_connection) return STATUS_NOT_SUPPORTED;
+    if (!(device = unix_name_from_handle( params->device ))) return STATUS_INVALID_PARAMETER;
+    if (simulated) return simbth_device_connect( dbus_connection, device );
 #ifdef __APPLE__
-    return corebth_device_disconnect( dbus_connection, params->device->str );
+    return corebth_device_connect( dbus_connection, device );
 #else
-    return bluez_device_disconnect( dbus_connection, params->device->str );
+    return bluez_device_connect( dbus_connection, device->str );
 #endif
 }
 
 static NTSTATUS bluetooth_device_start_pairing( void *args )
 {
     struct bluetooth_device_start_pairing_params *params = args;
+    struct unix_name *device;
     NTSTATUS status;
 
     TRACE( "dbus_connection=%p device=%p irp=%p\n", dbus_connection, (void *)params->device, params->irp );
@@ -334,126 +516,281 @@ static NTSTATUS bluetooth_device_start_pairing( void *args )
         TRACE( "dbus_connection is NULL\n" );
         return STATUS_NOT_SUPPORTED;
     }
+    if (!(device = unix_name_from_handle( params->device ))) return STATUS_INVALID_PARAMETER;
+    if (simulated) return simbth_device_start_pairing( dbus_connection, device, params->irp );
 #ifdef __APPLE__
-    status = corebth_device_start_pairing( dbus_connection, bluetooth_watcher, params->device, params->irp );
+    status = corebth_device_start_pairing( dbus_connection, bluetooth_watcher, device, params->irp );
     TRACE( "corebth_device_start_pairing returned %#lx\n", (unsigned long)status );
     return status;
 #else
-    return bluez_device_start_pairing( dbus_connection, bluetooth_watcher, params->device, params->irp );
+    return bluez_device_start_pairing( dbus_connection, bluetooth_watcher, device, params->irp );
 #endif
 }
 
 static NTSTATUS bluetooth_gatt_service_free( void *args )
 {
     struct bluetooth_gatt_service_free_params *params = args;
-    unix_name_free( params->service );
+    unix_name_free_handle( params->service );
     return STATUS_SUCCESS;
 }
 
 static NTSTATUS bluetooth_gatt_characteristic_free( void *args )
 {
     struct bluetooth_gatt_characteristic_free_params *params = args;
-    unix_name_free( params->characteristic );
+    unix_name_free_handle( params->characteristic );
     return STATUS_SUCCESS;
 }
 
 static NTSTATUS bluetooth_gatt_characteristic_dup( void *args )
 {
     struct bluetooth_gatt_characteristic_dup_params *params = args;
-    unix_name_dup( params->characteristic );
+    unix_name_dup_handle( params->characteristic );
     return STATUS_SUCCESS;
 }
 
 static NTSTATUS bluetooth_gatt_characteristic_read( void *args )
 {
     struct bluetooth_gatt_characteristic_read_params *params = args;
+    struct unix_name *characteristic;
 
     if (!dbus_connection) return STATUS_NOT_SUPPORTED;
-    if (!params->characteristic || !params->characteristic->str)
-    {
-        ERR("bluetooth_gatt_characteristic_read: characteristic is NULL!\n");
-        return STATUS_INVALID_PARAMETER;
-    }
+    if (!(characteristic = unix_name_from_handle( params->characteristic ))) return STATUS_INVALID_PARAMETER;
+    if (simulated) return simbth_characteristic_read( dbus_connection, characteristic, params->irp );
 #ifdef __APPLE__
-    return corebth_characteristic_read( dbus_connection, params->characteristic->str,
-                                        params->buffer, params->buffer_size, params->data_len );
+    return corebth_characteristic_read( dbus_connection, bluetooth_watcher, characteristic,
+                                        params->irp );
 #else
-    return STATUS_NOT_IMPLEMENTED;
+    return bluez_gatt_characteristic_read( dbus_connection, bluetooth_watcher, characteristic,
+                                           params->irp );
 #endif
 }
 
 static NTSTATUS bluetooth_gatt_characteristic_write( void *args )
 {
     struct bluetooth_gatt_characteristic_write_params *params = args;
+    struct unix_name *characteristic;
 
     if (!dbus_connection) return STATUS_NOT_SUPPORTED;
-    if (!params->characteristic || !params->characteristic->str)
-    {
-        ERR("bluetooth_gatt_characteristic_write: characteristic is NULL!\n");
-        return STATUS_INVALID_PARAMETER;
-    }
+    if (!(characteristic = unix_name_from_handle( params->characteristic ))) return STATUS_INVALID_PARAMETER;
+    if (simulated)
+        return simbth_characteristic_write( dbus_connection, characteristic, params->data, params->size,
+                                            params->write_type, params->irp );
 #ifdef __APPLE__
-    return corebth_characteristic_write( dbus_connection, params->characteristic->str,
-                                         params->data, params->size, params->write_type );
+    return corebth_characteristic_write( dbus_connection, bluetooth_watcher, characteristic,
+                                         params->data, params->size, params->write_type, params->irp );
 #else
-    return STATUS_NOT_IMPLEMENTED;
+    return bluez_gatt_characteristic_write( dbus_connection, bluetooth_watcher, characteristic,
+                                            params->data, params->size, params->write_type, params->irp );
+#endif
+}
+
+static NTSTATUS bluetooth_gatt_characteristic_write_stream( void *args )
+{
+    struct bluetooth_gatt_characteristic_write_stream_params *params = args;
+    struct unix_name *characteristic;
+
+    params->mtu = params->packets = params->written = 0;
+    if (!dbus_connection) return STATUS_NOT_SUPPORTED;
+    if (!(characteristic = unix_name_from_handle( params->characteristic ))) return STATUS_INVALID_PARAMETER;
+    if (simulated)
+        return simbth_characteristic_write_stream( dbus_connection, characteristic, params->data,
+                                                   params->size, params->cancel, &params->mtu, &params->packets,
+                                                   &params->written );
+#ifdef __APPLE__
+    return corebth_characteristic_write_stream( dbus_connection, characteristic, params->data,
+                                                params->size, params->cancel, &params->mtu, &params->packets,
+                                                &params->written );
+#else
+    return bluez_gatt_characteristic_write_stream( dbus_connection, characteristic, params->data,
+                                                   params->size, params->cancel, &params->mtu, &params->packets,
+                                                   &params->written );
+#endif
+}
+
+static NTSTATUS bluetooth_gatt_characteristic_get_mtu( void *args )
+{
+    struct bluetooth_gatt_characteristic_get_mtu_params *params = args;
+    struct unix_name *characteristic;
+
+    params->mtu = 0;
+    if (!dbus_connection) return STATUS_NOT_SUPPORTED;
+    if (!(characteristic = unix_name_from_handle( params->characteristic ))) return STATUS_INVALID_PARAMETER;
+    if (simulated) return simbth_characteristic_get_mtu( dbus_connection, characteristic, &params->mtu );
+#ifdef __APPLE__
+    return corebth_characteristic_get_mtu( dbus_connection, characteristic, &params->mtu );
+#else
+    return bluez_gatt_characteristic_get_mtu( dbus_connection, characteristic, &params->mtu );
 #endif
 }
 
 static NTSTATUS bluetooth_gatt_characteristic_set_notify( void *args )
 {
     struct bluetooth_gatt_characteristic_set_notify_params *params = args;
+    struct unix_name *characteristic;
 
     if (!dbus_connection) return STATUS_NOT_SUPPORTED;
-    if (!params->characteristic || !params->characteristic->str)
+    if (!(characteristic = unix_name_from_handle( params->characteristic ))) return STATUS_INVALID_PARAMETER;
+    if (simulated)
+        return simbth_characteristic_set_notify( dbus_connection, characteristic, params->enable,
+                                                 params->overflow_policy );
+#ifdef __APPLE__
+    return corebth_characteristic_set_notify( dbus_connection, characteristic,
+                                             params->enable, params->overflow_policy );
+#else
+    return bluez_gatt_characteristic_set_notify( dbus_connection, characteristic, params->enable,
+                                                 params->overflow_policy );
+#endif
+}
+
+static NTSTATUS gatt_read_notification( struct unix_name *characteristic,
+                                        struct bluetooth_gatt_characteristic_read_notification_params *params )
+{
+    if (simulated)
+        return simbth_characteristic_read_notification( dbus_connection, characteristic, params->buffer,
+                                                        params->buffer_size, params->size );
+#ifdef __APPLE__
     {
-        ERR("bluetooth_gatt_characteristic_set_notify: characteristic is NULL!\n");
-        return STATUS_INVALID_PARAMETER;
+        corebth_status ret;
+        ret = corebth_characteristic_read_notification( dbus_connection, characteristic,
+                                                        params->buffer, params->buffer_size, params->size );
+        if (ret == COREBTH_SUCCESS) return STATUS_SUCCESS;
+        if (ret == COREBTH_TIMEOUT) return STATUS_TIMEOUT;
+        if (ret == COREBTH_NOT_SUPPORTED) return STATUS_NOT_SUPPORTED;
+        return STATUS_INTERNAL_ERROR;
     }
-#ifdef __APPLE__
-    return corebth_characteristic_set_notify( dbus_connection, params->characteristic->str,
-                                             params->enable );
 #else
-    return STATUS_NOT_IMPLEMENTED;
+    return bluez_gatt_characteristic_read_notification( dbus_connection, characteristic, params->buffer,
+                                                        params->buffer_size, params->size );
 #endif
 }
 
 static NTSTATUS bluetooth_gatt_characteristic_read_notification( void *args )
 {
     struct bluetooth_gatt_characteristic_read_notification_params *params = args;
+    struct unix_name *characteristic;
+    NTSTATUS status;
 
     if (!dbus_connection) return STATUS_NOT_SUPPORTED;
-    if (!params->characteristic || !params->characteristic->str)
+    if (!(characteristic = unix_name_from_handle( params->characteristic ))) return STATUS_INVALID_PARAMETER;
+    status = gatt_read_notification( characteristic, params );
+    if (!status) bluetooth_trace_notifications( params->characteristic, params->buffer, 1, *params->size, FALSE );
+    return status;
+}
+
+static NTSTATUS gatt_read_notifications( struct unix_name *characteristic,
+                                         struct bluetooth_gatt_characteristic_read_notifications_params *params )
+{
+    if (simulated)
+        return simbth_characteristic_read_notifications( dbus_connection, characteristic, params->buffer,
+                                                         params->buffer_size, params->max_count, params->count,
+                                                         params->size, params->overflow_count );
+#ifdef __APPLE__
     {
-        ERR("bluetooth_gatt_characteristic_read_notification: characteristic is NULL!\n");
-        return STATUS_INVALID_PARAMETER;
+        corebth_status ret;
+        ret = corebth_characteristic_read_notifications( dbus_connection, characteristic,
+                                                         params->buffer, params->buffer_size, params->max_count,
+                                                         params->count, params->size, params->overflow_count );
+        if (ret == COREBTH_SUCCESS) return STATUS_SUCCESS;
+        if (ret == COREBTH_TIMEOUT) return STATUS_TIMEOUT;
+        if (ret == COREBTH_NOT_SUPPORTED) return STATUS_NOT_SUPPORTED;
+        if (ret == COREBTH_BUFFER_TOO_SMALL) return STATUS_BUFFER_TOO_SMALL;
+        return STATUS_INTERNAL_ERROR;
     }
+#else
+    return bluez_gatt_characteristic_read_notifications( dbus_connection, characteristic, params->buffer,
+                                                         params->buffer_size, params->max_count, params->count,
+                                                         params->size, params->overflow_count );
+#endif
+}
+
+static NTSTATUS bluetooth_gatt_characteristic_read_notifications( void *args )
+{
+    struct bluetooth_gatt_characteristic_read_notifications_params *params = args;
+    struct unix_name *characteristic;
+    NTSTATUS status;
+
+    if (!dbus_connection) return STATUS_NOT_SUPPORTED;
+    if (!(characteristic = unix_name_from_handle( params->characteristic ))) return STATUS_INVALID_PARAMETER;
+    status = gatt_read_notifications( characteristic, params );
+    if (!status)
+        bluetooth_trace_notifications( params->characteristic, params->buffer, *params->count, *params->size, TRUE );
+    return status;
+}
+
+static NTSTATUS bluetooth_gatt_characteristic_get_notification_stats( void *args )
+{
+    struct bluetooth_gatt_characteristic_get_notification_stats_params *params = args;
+    struct unix_name *characteristic;
+
+    if (!dbus_connection) return STATUS_NOT_SUPPORTED;
+    if (!(characteristic = unix_name_from_handle( params->characteristic ))) return STATUS_INVALID_PARAMETER;
+    memset( params->stats, 0, sizeof( *params->stats ) );
+    if (simulated)
+        return simbth_characteristic_get_notification_stats( dbus_connection, characteristic,
+                                                             params->stats );
 #ifdef __APPLE__
     {
         corebth_status ret;
-        ret = corebth_characteristic_read_notification( dbus_connection, params->characteristic->str,
-                                                        params->buffer, params->buffer_size, params->size );
+        ret = corebth_characteristic_get_notification_stats( dbus_connection, characteristic,
+                                                             params->stats );
         if (ret == COREBTH_SUCCESS) return STATUS_SUCCESS;
-        if (ret == COREBTH_TIMEOUT) return STATUS_TIMEOUT;
         if (ret == COREBTH_NOT_SUPPORTED) return STATUS_NOT_SUPPORTED;
         return STATUS_INTERNAL_ERROR;
     }
 #else
-    return STATUS_NOT_IMPLEMENTED;
+    return bluez_gatt_characteristic_get_notification_stats( dbus_connection, characteristic,
+                                                             params->stats );
 #endif
 }
 
+static LONG64 events_queued;
+static LONG64 events_delivered;
+static LONG max_event_backlog;
+
+void bluetooth_stats_event_queued( void )
+{
+    LONG backlog = InterlockedIncrement64( &events_queued ) - ReadNoFence64( &events_delivered ), max;
+
+    while (backlog > (max = ReadNoFence( &max_event_backlog )))
+        if (InterlockedCompareExchange( &max_event_backlog, backlog, max ) == max) break;
+}
+
+void bluetooth_stats_event_dequeued( void )
+{
+    InterlockedIncrement64( &events_delivered );
+}
+
+static NTSTATUS bluetooth_get_event_stats( void *args )
+{
+    struct bluetooth_get_event_stats_params *params = args;
+
+    params->stats->queued = ReadNoFence64( &events_queued );
+    params->stats->delivered = ReadNoFence64( &events_delivered );
+    params->stats->max_backlog = ReadNoFence( &max_event_backlog );
+    return STATUS_SUCCESS;
+}
+
 static NTSTATUS bluetooth_get_event( void *args )
 {
     struct bluetooth_get_event_params *params = args;
+    NTSTATUS status;
 
+    params->count = 0;
     if (!dbus_connection) return STATUS_NOT_SUPPORTED;
-    memset( &params->result, 0, sizeof( params->result ) );
+    if (!params->max_count) return STATUS_INVALID_PARAMETER;
+    memset( params->events, 0, params->max_count * sizeof( *params->events ) );
+    if (simulated)
+        status = simbth_loop( dbus_connection, params->events, params->max_count, &params->count );
+    else
 #ifdef __APPLE__
-    return corebth_loop( dbus_connection, bluetooth_watcher, bluetooth_auth_agent, &params->result );
+        status = corebth_loop( dbus_connection, bluetooth_watcher, bluetooth_auth_agent, params->events,
+                               params->max_count, &params->count );
 #else
-    return bluez_dbus_loop( dbus_connection, bluetooth_watcher, bluetooth_auth_agent, &params->result );
+        status = bluez_dbus_loop( dbus_connection, bluetooth_watcher, bluetooth_auth_agent, params->events,
+                                  params->max_count, &params->count );
 #endif
+    if (params->count) bluetooth_trace_events( params->events, params->count );
+    return status;
 }
 
 const unixlib_entry_t __wine_unix_call_funcs[] = {
@@ -462,6 +799,7 @@ const unixlib_entry_t __wine_unix_call_funcs[] = {
 
     bluetooth_adapter_set_prop,
     bluetooth_adapter_get_unique_name,
+    bluetooth_adapter_set_discovery_filter,
     bluetooth_adapter_start_discovery,
     bluetooth_adapter_stop_discovery,
     bluetooth_adapter_remove_device,
@@ -471,6 +809,7 @@ const unixlib_entry_t __wine_unix_call_funcs[] = {
     bluetooth_device_free,
     bluetooth_device_dup,
     bluetooth_device_disconnect,
+    bluetooth_device_connect,
     bluetooth_device_start_pairing,
 
     bluetooth_auth_agent_enable_incoming,
@@ -482,10 +821,15 @@ const unixlib_entry_t __wine_unix_call_funcs[] = {
     bluetooth_gatt_characteristic_dup,
     bluetooth_gatt_characteristic_read,
     bluetooth_gatt_characteristic_write,
+    bluetooth_gatt_characteristic_write_stream,
+    bluetooth_gatt_characteristic_get_mtu,
     bluetooth_gatt_characteristic_set_notify,
     bluetooth_gatt_characteristic_read_notification,
+    bluetooth_gatt_characteristic_read_notifications,
+    bluetooth_gatt_characteristic_get_notification_stats,
 
     bluetooth_get_event,
+    bluetooth_get_event_stats,
 };
 
 C_ASSERT( ARRAYSIZE( __wine_unix_call_funcs ) == unix_funcs_count );
@@ -36,11 +36,11 @@
 
 #include "winebth_priv.h"
 
+/* unix_name_t values are handles that need to be resolved with unix_name_from_handle on the Unix side. */
+typedef UINT_PTR unix_name_t;
 #ifdef WINE_UNIX_LIB
-typedef struct unix_name *unix_name_t;
 typedef void *unix_handle_t;
 #else
-typedef UINT_PTR unix_name_t;
 typedef UINT_PTR unix_handle_t;
 #endif
 
@@ -82,9 +82,7 @@ struct bluetooth_gatt_characteristic_dup_params
 struct bluetooth_gatt_characteristic_read_params
 {
     unix_name_t characteristic;
-    unsigned char *buffer;
-    unsigned int buffer_size;
-    unsigned int *data_len;
+    IRP *irp;
 };
 
 struct bluetooth_gatt_characteristic_write_params
@@ -93,12 +91,34 @@ struct bluetooth_gatt_characteristic_write_params
     const unsigned char *data;
     unsigned int size;
     int write_type;
+    IRP *irp;
+};
+
+/* Writes data as a sequence of write commands, each as large as the ATT MTU allows, and returns once all of them
+ * have been handed to the controller, or *cancel is set. */
+struct bluetooth_gatt_characteristic_write_stream_params
+{
+    unix_name_t characteristic;
+    const unsigned char *data;
+    unsigned int size;
+    const volatile BOOLEAN *cancel;
+
+    unsigned int mtu;
+    unsigned int packets;
+    unsigned int written;
+};
+
+struct bluetooth_gatt_characteristic_get_mtu_params
+{
+    unix_name_t characteristic;
+    unsigned int mtu;
 };
 
 struct bluetooth_gatt_characteristic_set_notify_params
 {
     unix_name_t characteristic;
     int enable;
+    UINT32 overflow_policy;
 };
 
 struct bluetooth_gatt_characteristic_read_notification_params
@@ -109,11 +129,34 @@ struct bluetooth_gatt_characteristic_read_notification_params
     unsigned int *size;
 };
 
+struct bluetooth_gatt_characteristic_read_notifications_params
+{
+    unix_name_t characteristic;
+    unsigned char *buffer;
+    unsigned int buffer_size;
+    unsigned int max_count;
+
+    unsigned int *count;
+    unsigned int *size;
+    unsigned int *overflow_count;
+};
+
+struct bluetooth_gatt_characteristic_get_notification_stats_params
+{
+    unix_name_t characteristic;
+    struct bluetooth_gatt_notification_stats *stats;
+};
+
 struct bluetooth_device_disconnect_params
 {
     unix_name_t device;
 };
 
+struct bluetooth_device_connect_params
+{
+    unix_name_t device;
+};
+
 struct bluetooth_adapter_get_unique_name_params
 {
     unix_name_t adapter;
@@ -130,6 +173,12 @@ struct bluetooth_adapter_set_prop_params
     union winebluetooth_property *prop;
 };
 
+struct bluetooth_adapter_set_discovery_filter_params
+{
+    unix_name_t adapter;
+    const struct winebluetooth_discovery_filter *filter;
+};
+
 struct bluetooth_adapter_start_discovery_params
 {
     unix_name_t adapter;
@@ -161,9 +210,17 @@ struct bluetooth_device_start_pairing_params
     IRP *irp;
 };
 
+/* Waits until at least one event is available, and returns as many of the queued events as fit in events. */
 struct bluetooth_get_event_params
 {
-    struct winebluetooth_event result;
+    struct winebluetooth_event *events;
+    UINT32 max_count;
+    UINT32 count;
+};
+
+struct bluetooth_get_event_stats_params
+{
+    struct bluetooth_event_stats *stats;
 };
 
 enum bluetoothapis_funcs
@@ -173,6 +230,7 @@ enum bluetoothapis_funcs
 
     unix_bluetooth_adapter_set_prop,
     unix_bluetooth_adapter_get_unique_name,
+    unix_bluetooth_adapter_set_discovery_filter,
     unix_bluetooth_adapter_start_discovery,
     unix_bluetooth_adapter_stop_discovery,
     unix_bluetooth_adapter_remove_device,
@@ -182,6 +240,7 @@ enum bluetoothapis_funcs
     unix_bluetooth_device_free,
     unix_bluetooth_device_dup,
     unix_bluetooth_device_disconnect,
+    unix_bluetooth_device_connect,
     unix_bluetooth_device_start_pairing,
 
     unix_bluetooth_auth_agent_enable_incoming,
@@ -193,10 +252,15 @@ enum bluetoothapis_funcs
     unix_bluetooth_gatt_characteristic_dup,
     unix_bluetooth_gatt_characteristic_read,
     unix_bluetooth_gatt_characteristic_write,
+    unix_bluetooth_gatt_characteristic_write_stream,
+    unix_bluetooth_gatt_characteristic_get_mtu,
     unix_bluetooth_gatt_characteristic_set_notify,
     unix_bluetooth_gatt_characteristic_read_notification,
+    unix_bluetooth_gatt_characteristic_read_notifications,
+    unix_bluetooth_gatt_characteristic_get_notification_stats,
 
     unix_bluetooth_get_event,
+    unix_bluetooth_get_event_stats,
 
     unix_funcs_count
 };
@@ -37,21 +37,103 @@ struct unix_name
 {
     char *str;
     SIZE_T refcnt;
+    /* The value handed out to the PE side in place of the name, see unix_name_from_handle. */
+    UINT_PTR handle;
+    /* The backend object this name currently refers to, if the backend keeps track of one. */
+    void *object;
 
     struct wine_rb_entry entry;
 };
 
 extern struct unix_name *unix_name_get_or_create( const char *str );
+extern struct unix_name *unix_name_from_handle( UINT_PTR handle );
 extern void unix_name_free( struct unix_name *name );
 extern struct unix_name *unix_name_dup( struct unix_name *name );
+extern void unix_name_free_handle( UINT_PTR handle );
+
+struct notification_ring;
+/* The notification_ring functions don't do any locking, the caller needs to serialize access to the ring. */
+extern struct notification_ring *notification_ring_create( UINT32 policy );
+extern void notification_ring_destroy( struct notification_ring *ring );
+extern void notification_ring_set_policy( struct notification_ring *ring, UINT32 policy );
+extern BOOL notification_ring_empty( const struct notification_ring *ring );
+extern BOOL notification_ring_push( struct notification_ring *ring, const unsigned char *data, UINT32 size );
+extern NTSTATUS notification_ring_pop( struct notification_ring *ring, unsigned char *buffer, UINT32 buffer_size,
+                                       UINT32 *size );
+extern NTSTATUS notification_ring_drain( struct notification_ring *ring, unsigned char *buffer, UINT32 buffer_size,
+                                         UINT32 max_count, UINT32 *count, UINT32 *size, UINT32 *overflow_count );
+extern void notification_ring_get_stats( const struct notification_ring *ring,
+                                         struct bluetooth_gatt_notification_stats *stats );
+
+/* The backends call these whenever they queue an event for the driver, or hand one over to it. */
+extern void bluetooth_stats_event_queued( void );
+extern void bluetooth_stats_event_dequeued( void );
+
+/* Event traces, see trace.c. */
+#define BLUETOOTH_TRACE_MAGIC 0x48544257 /* "WBTH" */
+#define BLUETOOTH_TRACE_VERSION 2
+/* Every record is padded to a multiple of this, so that the records of a trace read into memory are aligned. */
+#define BLUETOOTH_TRACE_ALIGN 8
+
+enum bluetooth_trace_record_type
+{
+    /* handle is a handle seen for the first time, followed by the name it refers to. */
+    BLUETOOTH_TRACE_RECORD_NAME,
+    /* handle is an enum winebluetooth_watcher_event_type, followed by the event data for that type. */
+    BLUETOOTH_TRACE_RECORD_EVENT,
+    /* handle is a characteristic, followed by a notification value read from it. */
+    BLUETOOTH_TRACE_RECORD_VALUE,
+};
+
+struct bluetooth_trace_header
+{
+    UINT32 magic;
+    UINT32 version;
+    /* sizeof( union winebluetooth_watcher_event_data ) in the build that recorded the trace. */
+    UINT32 event_size;
+    UINT32 reserved;
+};
+
+struct bluetooth_trace_record
+{
+    UINT16 type;
+    UINT16 reserved;
+    UINT32 size;
+    /* In microseconds since the recording started. */
+    UINT64 time;
+    UINT64 handle;
+};
+
+struct bluetooth_trace
+{
+    unsigned char *data;
+    SIZE_T size;
+    /* Pointers into data. */
+    const struct bluetooth_trace_record **records;
+    SIZE_T count;
+};
+
+extern void bluetooth_trace_init( void );
+extern void bluetooth_trace_close( void );
+extern void bluetooth_trace_events( const struct winebluetooth_event *events, UINT32 count );
+extern void bluetooth_trace_notifications( UINT_PTR characteristic, const unsigned char *buffer, UINT32 count,
+                                           UINT32 size, BOOL records );
+extern UINT32 bluetooth_trace_event_size( enum winebluetooth_watcher_event_type type,
+                                          const union winebluetooth_watcher_event_data *data );
+extern UINT32 bluetooth_trace_event_handles( enum winebluetooth_watcher_event_type type,
+                                             union winebluetooth_watcher_event_data *data, UINT_PTR *handles[2] );
+extern struct bluetooth_trace *bluetooth_trace_load( const char *path );
+extern void bluetooth_trace_free( struct bluetooth_trace *trace );
 
 extern void *bluez_dbus_init( void );
 extern void bluez_dbus_close( void *connection );
 extern void bluez_dbus_free( void *connection );
 extern NTSTATUS bluez_dbus_loop( void *connection, void *watcher_ctx, void *auth_agent,
-                                 struct winebluetooth_event *result );
-extern NTSTATUS bluez_adapter_set_prop( void *connection,
+                                 struct winebluetooth_event *events, UINT32 max_count, UINT32 *count );
+extern NTSTATUS bluez_adapter_set_prop( void *connection, struct unix_name *adapter,
                                         struct bluetooth_adapter_set_prop_params *params );
+extern NTSTATUS bluez_adapter_set_discovery_filter( void *connection, const char *adapter_path,
+                                                    const struct winebluetooth_discovery_filter *filter );
 extern NTSTATUS bluez_adapter_start_discovery( void *connection, const char *adapter_path );
 extern NTSTATUS bluez_adapter_stop_discovery( void *connection, const char *adapter_path );
 extern NTSTATUS bluez_adapter_remove_device( void *connection, const char *adapter_path, const char *device_path);
@@ -62,21 +144,85 @@ extern NTSTATUS bluez_auth_agent_send_response( void *auth_agent, struct unix_na
                                                 BLUETOOTH_AUTHENTICATION_METHOD method, UINT32 numeric_or_passkey,
                                                 BOOL negative, BOOL *authenticated );
 extern NTSTATUS bluez_device_disconnect( void *connection, const char *device_path );
+extern NTSTATUS bluez_device_connect( void *connection, const char *device_path );
 extern NTSTATUS bluez_device_start_pairing( void *dbus_connection, void *watcher_ctx, struct unix_name *device, IRP *irp );
+extern NTSTATUS bluez_gatt_characteristic_read( void *connection, void *watcher_ctx, struct unix_name *characteristic,
+                                                IRP *irp );
+extern NTSTATUS bluez_gatt_characteristic_write( void *connection, void *watcher_ctx, struct unix_name *characteristic,
+                                                 const unsigned char *data, unsigned int size, int write_type,
+                                                 IRP *irp );
+extern NTSTATUS bluez_gatt_characteristic_write_stream( void *connection, struct unix_name *characteristic,
+                                                        const unsigned char *data, unsigned int size,
+                                                        const volatile BOOLEAN *cancel, unsigned int *mtu,
+                                                        unsigned int *packets, unsigned int *written );
+extern NTSTATUS bluez_gatt_characteristic_get_mtu( void *connection, struct unix_name *characteristic,
+                                                   unsigned int *mtu );
+extern NTSTATUS bluez_gatt_characteristic_set_notify( void *connection, struct unix_name *characteristic,
+                                                      BOOL enable, UINT32 overflow_policy );
+extern NTSTATUS bluez_gatt_characteristic_read_notification( void *connection, struct unix_name *characteristic,
+                                                             unsigned char *buffer, unsigned int buffer_size,
+                                                             unsigned int *size );
+extern NTSTATUS bluez_gatt_characteristic_read_notifications( void *connection, struct unix_name *characteristic,
+                                                              unsigned char *buffer, unsigned int buffer_size,
+                                                              unsigned int max_count, unsigned int *count,
+                                                              unsigned int *size, unsigned int *overflow_count );
+extern NTSTATUS bluez_gatt_characteristic_get_notification_stats( void *connection, struct unix_name *characteristic,
+                                                                  struct bluetooth_gatt_notification_stats *stats );
 extern NTSTATUS bluez_watcher_init( void *connection, void **ctx );
 extern void bluez_watcher_close( void *connection, void *ctx );
 
+/* The simulated backend in simbth.c, which takes over from the system's Bluetooth service if WINEBTH_SIM is set. */
+extern BOOL simbth_enabled( void );
+extern void *simbth_init( void );
+extern void simbth_close( void *connection );
+extern void simbth_free( void *connection );
+extern NTSTATUS simbth_watcher_init( void *connection );
+extern NTSTATUS simbth_loop( void *connection, struct winebluetooth_event *events, UINT32 max_count,
+                             UINT32 *count );
+extern NTSTATUS simbth_adapter_set_prop( void *connection, struct unix_name *adapter,
+                                         struct bluetooth_adapter_set_prop_params *params );
+extern NTSTATUS simbth_adapter_set_discovery_filter( void *connection, struct unix_name *adapter,
+                                                     const struct winebluetooth_discovery_filter *filter );
+extern NTSTATUS simbth_adapter_start_discovery( void *connection, struct unix_name *adapter );
+extern NTSTATUS simbth_adapter_stop_discovery( void *connection, struct unix_name *adapter );
+extern NTSTATUS simbth_adapter_remove_device( void *connection, struct unix_name *adapter, struct unix_name *device );
+extern NTSTATUS simbth_device_connect( void *connection, struct unix_name *device );
+extern NTSTATUS simbth_device_disconnect( void *connection, struct unix_name *device );
+extern NTSTATUS simbth_device_start_pairing( void *connection, struct unix_name *device, IRP *irp );
+extern NTSTATUS simbth_characteristic_read( void *connection, struct unix_name *characteristic, IRP *irp );
+extern NTSTATUS simbth_characteristic_write( void *connection, struct unix_name *characteristic,
+                                             const unsigned char *data, unsigned int size, int write_type, IRP *irp );
+extern NTSTATUS simbth_characteristic_write_stream( void *connection, struct unix_name *characteristic,
+                                                    const unsigned char *data, unsigned int size,
+                                                    const volatile BOOLEAN *cancel, unsigned int *mtu,
+                                                    unsigned int *packets, unsigned int *written );
+extern NTSTATUS simbth_characteristic_get_mtu( void *connection, struct unix_name *characteristic, unsigned int *mtu );
+extern NTSTATUS simbth_characteristic_set_notify( void *connection, struct unix_name *characteristic, BOOL enable,
+                                                  UINT32 overflow_policy );
+extern NTSTATUS simbth_characteristic_read_notification( void *connection, struct unix_name *characteristic,
+                                                         unsigned char *buffer, unsigned int buffer_size,
+                                                         unsigned int *size );
+extern NTSTATUS simbth_characteristic_read_notifications( void *connection, struct unix_name *characteristic,
+                                                          unsigned char *buffer, unsigned int buffer_size,
+                                                          unsigned int max_count, unsigned int *count,
+                                                          unsigned int *size, unsigned int *overflow_count );
+extern NTSTATUS simbth_characteristic_get_notification_stats( void *connection, struct unix_name *characteristic,
+                                                              struct bluetooth_gatt_notification_stats *stats );
+
 #ifdef __APPLE__
 typedef int corebth_status;
 #define COREBTH_SUCCESS            0
 #define COREBTH_NOT_SUPPORTED      ((corebth_status)0xC00000BB)
 #define COREBTH_TIMEOUT            ((corebth_status)0x00000102)
+#define COREBTH_BUFFER_TOO_SMALL   ((corebth_status)0xC0000023)
 extern void *corebth_init( void );
 extern void corebth_close( void *connection );
 extern void corebth_free( void *connection );
 extern corebth_status corebth_loop( void *connection, void *watcher_ctx, void *auth_agent,
-                                    void *result );
+                                    void *events, UINT32 max_count, UINT32 *count );
 extern corebth_status corebth_adapter_set_prop( void *connection, void *params );
+extern corebth_status corebth_adapter_set_discovery_filter( void *connection, const char *adapter_path,
+                                                            const struct winebluetooth_discovery_filter *filter );
 extern corebth_status corebth_adapter_start_discovery( void *connection, const char *adapter_path );
 extern corebth_status corebth_adapter_stop_discovery( void *connection, const char *adapter_path );
 extern corebth_status corebth_adapter_remove_device( void *connection, const char *adapter_path,
@@ -88,21 +234,33 @@ extern corebth_status corebth_auth_agent_send_response( void *auth_agent, void *
                                                         int method, unsigned int numeric_or_passkey,
                                                         int negative, int *authenticated );
 extern corebth_status corebth_device_disconnect( void *connection, const char *device_path );
+extern corebth_status corebth_device_connect( void *connection, void *device );
 extern corebth_status corebth_device_start_pairing( void *connection, void *watcher_ctx,
                                                     void *device, void *irp );
 extern corebth_status corebth_watcher_init( void *connection, void **ctx );
 extern void corebth_watcher_close( void *connection, void *ctx );
-extern corebth_status corebth_characteristic_read( void *connection, const char *char_path,
-                                                   unsigned char *buffer, unsigned int buffer_size,
-                                                   unsigned int *size );
-extern corebth_status corebth_characteristic_write( void *connection, const char *char_path,
-                                                    const unsigned char *data, unsigned int size,
-                                                    int write_type );
-extern corebth_status corebth_characteristic_set_notify( void *connection, const char *char_path,
-                                                         int enable );
-extern corebth_status corebth_characteristic_read_notification( void *connection, const char *char_path,
+extern corebth_status corebth_characteristic_read( void *connection, void *watcher_ctx,
+                                                   struct unix_name *char_name, void *irp );
+extern corebth_status corebth_characteristic_write( void *connection, void *watcher_ctx,
+                                                    struct unix_name *char_name, const unsigned char *data,
+                                                    unsigned int size, int write_type, void *irp );
+extern corebth_status corebth_characteristic_write_stream( void *connection, struct unix_name *char_name,
+                                                           const unsigned char *data, unsigned int size,
+                                                           const volatile BOOLEAN *cancel, unsigned int *mtu,
+                                                           unsigned int *packets, unsigned int *written );
+extern corebth_status corebth_characteristic_get_mtu( void *connection, struct unix_name *char_name,
+                                                      unsigned int *mtu );
+extern corebth_status corebth_characteristic_set_notify( void *connection, struct unix_name *char_name,
+                                                         int enable, unsigned int overflow_policy );
+extern corebth_status corebth_characteristic_read_notification( void *connection, struct unix_name *char_name,
                                                                 unsigned char *buffer, unsigned int buffer_size,
                                                                 unsigned int *size );
+extern corebth_status corebth_characteristic_read_notifications( void *connection, struct unix_name *char_name,
+                                                                 unsigned char *buffer, unsigned int buffer_size,
+                                                                 unsigned int max_count, unsigned int *count,
+                                                                 unsigned int *size, unsigned int *overflow_count );
+extern corebth_status corebth_characteristic_get_notification_stats( void *connection, struct unix_name *char_name,
+                                                                     struct bluetooth_gatt_notification_stats *stats );
 #endif /* __APPLE__ */
 
 #endif /* __WINE_WINEBTH_UNIXLIB_PRIV_H */
@@ -67,6 +67,18 @@ NTSTATUS winebluetooth_radio_set_property( winebluetooth_radio_t radio,
     return UNIX_BLUETOOTH_CALL( bluetooth_adapter_set_prop, &params );
 }
 
+NTSTATUS winebluetooth_radio_set_discovery_filter( winebluetooth_radio_t radio,
+                                                   const struct winebluetooth_discovery_filter *filter )
+{
+    struct bluetooth_adapter_set_discovery_filter_params params = {0};
+
+    TRACE( "(%p, %p)\n", (void *)radio.handle, filter );
+
+    params.adapter = radio.handle;
+    params.filter = filter;
+    return UNIX_BLUETOOTH_CALL( bluetooth_adapter_set_discovery_filter, &params );
+}
+
 NTSTATUS winebluetooth_radio_start_discovery( winebluetooth_radio_t radio )
 {
     struct bluetooth_adapter_start_discovery_params params = {0};
@@ -146,6 +158,15 @@ NTSTATUS winebluetooth_device_disconnect( winebluetooth_device_t device )
     return UNIX_BLUETOOTH_CALL( bluetooth_device_disconnect, &args );
 }
 
+NTSTATUS winebluetooth_device_connect( winebluetooth_device_t device )
+{
+    struct bluetooth_device_connect_params args = {0};
+    TRACE( "(%p)\n", (void *)device.handle );
+
+    args.device = device.handle;
+    return UNIX_BLUETOOTH_CALL( bluetooth_device_connect, &args );
+}
+
 void winebluetooth_device_properties_to_info( winebluetooth_device_props_mask_t props_mask,
                                               const struct winebluetooth_device_properties *props,
                                               BTH_DEVICE_INFO *info )
@@ -235,45 +256,78 @@ void winebluetooth_gatt_characteristic_dup( winebluetooth_gatt_characteristic_t
     UNIX_BLUETOOTH_CALL( bluetooth_gatt_characteristic_dup, &args );
 }
 
-NTSTATUS winebluetooth_gatt_characteristic_read( winebluetooth_gatt_characteristic_t characteristic,
-                                                  unsigned char *buffer, unsigned int buffer_size,
-                                                  unsigned int *data_len )
+NTSTATUS winebluetooth_gatt_characteristic_read( winebluetooth_gatt_characteristic_t characteristic, IRP *irp )
 {
     struct bluetooth_gatt_characteristic_read_params args = {0};
 
-    TRACE( "(%p, %p, %u, %p)\n", (void *)characteristic.handle, buffer, buffer_size, data_len );
+    TRACE( "(%p, %p)\n", (void *)characteristic.handle, irp );
 
     args.characteristic = characteristic.handle;
-    args.buffer = buffer;
-    args.buffer_size = buffer_size;
-    args.data_len = data_len;
+    args.irp = irp;
     return UNIX_BLUETOOTH_CALL( bluetooth_gatt_characteristic_read, &args );
 }
 
 NTSTATUS winebluetooth_gatt_characteristic_write( winebluetooth_gatt_characteristic_t characteristic,
                                                    const unsigned char *data, unsigned int size,
-                                                   int write_type )
+                                                   int write_type, IRP *irp )
 {
     struct bluetooth_gatt_characteristic_write_params args = {0};
 
-    TRACE( "(%p, %p, %u, %d)\n", (void *)characteristic.handle, data, size, write_type );
+    TRACE( "(%p, %p, %u, %d, %p)\n", (void *)characteristic.handle, data, size, write_type, irp );
 
     args.characteristic = characteristic.handle;
     args.data = data;
     args.size = size;
     args.write_type = write_type;
+    args.irp = irp;
     return UNIX_BLUETOOTH_CALL( bluetooth_gatt_characteristic_write, &args );
 }
 
+NTSTATUS winebluetooth_gatt_characteristic_write_stream( winebluetooth_gatt_characteristic_t characteristic,
+                                                          const unsigned char *data, unsigned int size,
+                                                          const volatile BOOLEAN *cancel, unsigned int *mtu,
+                                                          unsigned int *packets, unsigned int *written )
+{
+    struct bluetooth_gatt_characteristic_write_stream_params args = {0};
+    NTSTATUS status;
+
+    TRACE( "(%p, %p, %u, %p)\n", (void *)characteristic.handle, data, size, cancel );
+
+    args.characteristic = characteristic.handle;
+    args.data = data;
+    args.size = size;
+    args.cancel = cancel;
+    status = UNIX_BLUETOOTH_CALL( bluetooth_gatt_characteristic_write_stream, &args );
+    *mtu = args.mtu;
+    *packets = args.packets;
+    *written = args.written;
+    return status;
+}
+
+NTSTATUS winebluetooth_gatt_characteristic_get_mtu( winebluetooth_gatt_characteristic_t characteristic,
+                                                     unsigned int *mtu )
+{
+    struct bluetooth_gatt_characteristic_get_mtu_params args = {0};
+    NTSTATUS status;
+
+    TRACE( "(%p, %p)\n", (void *)characteristic.handle, mtu );
+
+    args.characteristic = characteristic.handle;
+    status = UNIX_BLUETOOTH_CALL( bluetooth_gatt_characteristic_get_mtu, &args );
+    *mtu = args.mtu;
+    return status;
+}
+
 NTSTATUS winebluetooth_gatt_characteristic_set_notify( winebluetooth_gatt_characteristic_t characteristic,
-                                                        int enable )
+                                                        int enable, UINT32 overflow_policy )
 {
     struct bluetooth_gatt_characteristic_set_notify_params args = {0};
 
-    TRACE( "(%p, %d)\n", (void *)characteristic.handle, enable );
+    TRACE( "(%p, %d, %u)\n", (void *)characteristic.handle, enable, overflow_policy );
 
     args.characteristic = characteristic.handle;
     args.enable = enable;
+    args.overflow_policy = overflow_policy;
     return UNIX_BLUETOOTH_CALL( bluetooth_gatt_characteristic_set_notify, &args );
 }
 
@@ -292,18 +346,62 @@ NTSTATUS winebluetooth_gatt_characteristic_read_notification( winebluetooth_gatt
     return UNIX_BLUETOOTH_CALL( bluetooth_gatt_characteristic_read_notification, &args );
 }
 
-NTSTATUS winebluetooth_get_event( struct winebluetooth_event *result )
+NTSTATUS winebluetooth_gatt_characteristic_read_notifications( winebluetooth_gatt_characteristic_t characteristic,
+                                                                unsigned char *buffer, unsigned int buffer_size,
+                                                                unsigned int max_count, unsigned int *count,
+                                                                unsigned int *size, unsigned int *overflow_count )
+{
+    struct bluetooth_gatt_characteristic_read_notifications_params args = {0};
+
+    TRACE( "(%p, %p, %u, %u, %p, %p, %p)\n", (void *)characteristic.handle, buffer, buffer_size, max_count, count,
+           size, overflow_count );
+
+    args.characteristic = characteristic.handle;
+    args.buffer = buffer;
+    args.buffer_size = buffer_size;
+    args.max_count = max_count;
+    args.count = count;
+    args.size = size;
+    args.overflow_count = overflow_count;
+    return UNIX_BLUETOOTH_CALL( bluetooth_gatt_characteristic_read_notifications, &args );
+}
+
+NTSTATUS winebluetooth_gatt_characteristic_get_notification_stats( winebluetooth_gatt_characteristic_t characteristic,
+                                                                    struct bluetooth_gatt_notification_stats *stats )
+{
+    struct bluetooth_gatt_characteristic_get_notification_stats_params args = {0};
+
+    TRACE( "(%p, %p)\n", (void *)characteristic.handle, stats );
+
+    args.characteristic = characteristic.handle;
+    args.stats = stats;
+    return UNIX_BLUETOOTH_CALL( bluetooth_gatt_characteristic_get_notification_stats, &args );
+}
+
+NTSTATUS winebluetooth_get_events( struct winebluetooth_event *events, UINT32 max_count, UINT32 *count )
 {
     struct bluetooth_get_event_params params = {0};
     NTSTATUS status;
 
-    TRACE( "(%p)\n", result );
+    TRACE( "(%p, %u, %p)\n", events, max_count, count );
 
+    params.events = events;
+    params.max_count = max_count;
     status = UNIX_BLUETOOTH_CALL( bluetooth_get_event, &params );
-    *result = params.result;
+    *count = params.count;
     return status;
 }
 
+NTSTATUS winebluetooth_get_event_stats( struct bluetooth_event_stats *stats )
+{
+    struct bluetooth_get_event_stats_params params = {0};
+
+    TRACE( "(%p)\n", stats );
+
+    params.stats = stats;
+    return UNIX_BLUETOOTH_CALL( bluetooth_get_event_stats, &params );
+}
+
 NTSTATUS winebluetooth_init( void )
 {
     NTSTATUS status;
@@ -71,6 +71,25 @@ DECLARE_CRITICAL_SECTION( device_list_cs );
 
 static struct list device_list = LIST_INIT( device_list );
 
+/* Bucket counts for the per-radio lookup indexes. */
+#define BLUETOOTH_DEVICE_INDEX_SIZE 256
+#define BLUETOOTH_CHAR_INDEX_SIZE   64
+
+/* How many advertisement records a radio keeps for IOCTL_WINEBTH_RADIO_READ_ADVERTISEMENTS before dropping the
+ * oldest one. */
+#define BLUETOOTH_MAX_QUEUED_ADVERTISEMENTS 1024
+
+/* How many removed remote devices a radio remembers for IOCTL_WINEBTH_RADIO_GET_DEVICE_CHANGES. Callers that are
+ * further behind than this get the full device list instead. */
+#define BLUETOOTH_MAX_REMOVED_DEVICES 256
+
+/* How long GATT requests wait for a remote device to connect and resolve its services, in milliseconds. */
+static DWORD gatt_connect_timeout = 10000;
+static TP_TIMER *gatt_irp_timer;
+DECLARE_CRITICAL_SECTION( gatt_irp_timer_cs );
+static BOOL gatt_irp_timer_set;  /* Guarded by gatt_irp_timer_cs */
+static DWORD gatt_irp_timer_due; /* Tick count the timer is set for. Guarded by gatt_irp_timer_cs */
+
 /* Object lifecycle state machine:
  *   INITIALIZING -> ACTIVE -> REMOVING
  *
@@ -105,9 +124,57 @@ struct bluetooth_radio
     UNICODE_STRING bthradio_symlink_name;
     unsigned int next_device_index;
 
-    struct list remote_devices;                 /* Guarded by device_list_cs */
+    /* Guards remote_devices and both indexes below, as well as the gatt_services, characteristics and char_index
+     * of every remote device on this radio. These are only modified with device_list_cs held and devices_lock
+     * acquired exclusive, so the event loop can walk them under device_list_cs alone, while the IOCTL handlers
+     * take devices_lock shared and don't serialize against each other.
+     * Lock order is device_list_cs, devices_lock, gatt_cs, props_cs. */
+    ERESOURCE devices_lock;
+    struct list remote_devices;
+    struct list device_index[BLUETOOTH_DEVICE_INDEX_SIZE];    /* Devices by address */
+    struct list char_handle_index[BLUETOOTH_CHAR_INDEX_SIZE]; /* Characteristics by handle */
 
     LIST_ENTRY irp_list;                        /* Guarded by device_list_cs */
+
+    /* Devices seen or updated while discovering, until they are read with IOCTL_WINEBTH_RADIO_READ_ADVERTISEMENTS.
+     * At most one record is queued per address. These are all guarded by device_list_cs. */
+    BOOL discovering;
+    struct winebluetooth_discovery_filter discovery_filter;
+    struct list advertisements;
+    unsigned int advertisements_count;
+    ULONG advertisements_overflow;
+    LIST_ENTRY advertisement_irps;
+
+    /* For IOCTL_WINEBTH_RADIO_GET_DEVICE_CHANGES and IOCTL_WINEBTH_RADIO_WAIT_DEVICE_CHANGES. generation gets
+     * bumped whenever a remote device is added, changed or removed. changed_devices holds every remote device, least
+     * recently changed first, and removed_devices the devices removed after removed_floor, oldest first. These are
+     * all guarded by device_list_cs. */
+    ULONGLONG epoch;                            /* Tells this radio's generations apart from other radios' */
+    ULONGLONG generation;
+    struct list changed_devices;
+    struct list removed_devices;
+    unsigned int removed_count;
+    ULONGLONG removed_floor;
+    LIST_ENTRY device_change_irps;
+
+    /* For IOCTL_WINEBTH_RADIO_WAIT_CONNECTION_CHANGES. connection_generation gets bumped whenever a remote device
+     * connects or disconnects. Both are guarded by device_list_cs. */
+    ULONGLONG connection_generation;
+    LIST_ENTRY connection_irps;
+};
+
+struct bluetooth_removed_device
+{
+    struct list entry;
+    BTH_ADDR address;                           /* As in BTH_DEVICE_INFO */
+    ULONGLONG generation;
+};
+
+struct bluetooth_advertisement
+{
+    struct list entry;
+    SIZE_T size;                                /* Of the record, including the data following it */
+    struct winebth_advertisement_record record;
 };
 
 struct bluetooth_remote_device
@@ -126,28 +193,66 @@ struct bluetooth_remote_device
     BOOL le;                                    /* Guarded by props_cs */
     BOOL macos_invalidated;                     /* Guarded by device_list_cs. Prevents TOCTOU races with macOS. */
     UNICODE_STRING bthle_symlink_name;          /* Guarded by props_cs */
-    struct list gatt_services;                  /* Guarded by device_list_cs (list ops) */
+    LONGLONG props_locked_at;                   /* See device_props_lock. Guarded by props_cs */
+    struct list gatt_services;                  /* Guarded by radio->devices_lock */
+    CRITICAL_SECTION gatt_cs;                   /* Protects gatt_irps, gatt_io_irps, and the cached values of the
+                                                 * device's characteristics. Taken after devices_lock */
+    LIST_ENTRY gatt_irps;                       /* GATT requests waiting for the device. Guarded by gatt_cs */
+    LIST_ENTRY gatt_io_irps;                    /* Characteristic reads and writes in progress, oldest first.
+                                                 * Guarded by gatt_cs */
+
+    struct list char_index[BLUETOOTH_CHAR_INDEX_SIZE]; /* By (service handle, attribute handle) */
+    struct list addr_entry;                     /* Entry in radio->device_index */
+    BTH_ADDR indexed_addr;                      /* The address addr_entry is hashed by, if indexed is set */
+    BOOL indexed;
+
+    struct list changed_entry;                  /* Entry in radio->changed_devices. Guarded by device_list_cs */
+    ULONGLONG generation;                       /* When the device last changed. Guarded by device_list_cs */
+    ULONGLONG connection_generation;            /* When the device last connected or disconnected.
+                                                 * Guarded by device_list_cs */
+
+    struct winebth_gatt_database *gatt_db;    /* The attribute table seen the last time the services were
+                                                 * resolved. Guarded by radio->devices_lock */
+    SIZE_T gatt_db_size;
 };
 
 struct bluetooth_gatt_service
 {
     struct list entry;
     LONG refcount;                              /* Atomic reference count */
+    struct bluetooth_remote_device *device;     /* The device this service belongs to */
 
     winebluetooth_gatt_service_t service;
     GUID uuid;
     unsigned int primary : 1;
     UINT16 handle;
 
-    struct list characteristics;                /* Immutable after service added to device */
+    struct list characteristics;                /* Guarded by the radio's devices_lock */
 };
 
 struct bluetooth_gatt_characteristic
 {
     struct list entry;
+    struct list index_entry;                    /* Entry in the device's char_index */
+    struct list handle_entry;                   /* Entry in the radio's char_handle_index */
+    struct bluetooth_gatt_service *service;     /* The service this characteristic belongs to */
 
     winebluetooth_gatt_characteristic_t characteristic;
     BTH_LE_GATT_CHARACTERISTIC props;
+
+    LIST_ENTRY notification_irps;               /* Pending READ_NOTIFICATION IRPs. Guarded by device_list_cs */
+
+    /* The last value read from the device or delivered as a notification, used for cached reads. It is stale when
+     * the backend has queued notifications that haven't been delivered yet. Guarded by the device's gatt_cs. */
+    struct bluetooth_gatt_cached_value *cached_value;
+    BOOL cached_value_stale;
+};
+
+struct bluetooth_gatt_cached_value
+{
+    ULONGLONG timestamp;
+    UINT32 size;
+    UCHAR data[];
 };
 
 enum bluetooth_pdo_ext_type
@@ -215,7 +320,7 @@ static int compare_characteristics_by_uuid( const void *a, const void *b )
     return compare_guids( &ca->CharacteristicUuid.Value.LongUuid, &cb->CharacteristicUuid.Value.LongUuid );
 }
 
-/* Caller should hold props_cs */
+/* Caller should hold radio->devices_lock */
 static struct bluetooth_gatt_service *find_gatt_service( struct list *services, const GUID *uuid, UINT16 handle )
 {
     struct bluetooth_gatt_service *service;
@@ -227,513 +332,2845 @@ static struct bluetooth_gatt_service *find_gatt_service( struct list *services,
     return NULL;
 }
 
-/* Caller should hold props_cs */
-static struct bluetooth_gatt_service *find_gatt_service_by_handle( struct list *services, UINT16 handle )
+/* ============================================================================
+ * Lock and Event Loop Statistics
+ *
+ * device_list_cs and the props_cs of every remote device are taken through
+ * the helpers below, which keep track of how often they are contended and
+ * for how long they are held, for IOCTL_WINEBTH_RADIO_GET_STATS.
+ * ============================================================================ */
+
+struct bluetooth_lock_stats
 {
-    struct bluetooth_gatt_service *service;
-    LIST_FOR_EACH_ENTRY( service, services, struct bluetooth_gatt_service, entry )
+    LONG64 acquisitions;
+    LONG64 contentions;
+    LONG64 wait_time;
+    LONG64 hold_time;
+    LONG64 max_hold_time;
+};
+
+struct bluetooth_event_type_stats
+{
+    LONG64 count;
+    LONG64 total_time;
+    LONG64 max_time;
+    LONG64 latency[WINEBTH_STATS_LATENCY_BUCKETS];
+};
+
+C_ASSERT( BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_IO_FINISHED < WINEBTH_STATS_EVENT_TYPES );
+
+/* Timing every acquisition of device_list_cs and the props_cs of every device isn't free, so lock_stats only gets
+ * updated if the LockStats driver option is set. Otherwise, the locks are taken directly. */
+static BOOL lock_stats_enabled;
+/* Only updated with interlocked operations, like ioctl_stats. */
+static struct bluetooth_lock_stats lock_stats[WINEBTH_STATS_LOCKS_COUNT];
+static struct bluetooth_event_type_stats event_type_stats[WINEBTH_STATS_EVENT_TYPES];
+static LONG64 relations_invalidated, pdos_created, pdos_deleted;
+static LARGE_INTEGER perf_frequency;
+/* When device_list_cs was last acquired, in performance counter ticks. Guarded by device_list_cs */
+static LONGLONG device_list_locked_at;
+
+static inline LONG64 perf_counter_to_100ns( LONGLONG ticks )
+{
+    return ticks * 10000000 / perf_frequency.QuadPart;
+}
+
+static inline void stats_update_max( LONG64 *max, LONG64 value )
+{
+    LONG64 cur;
+
+    while (value > (cur = ReadNoFence64( max )))
+        if (InterlockedCompareExchange64( max, value, cur ) == cur) break;
+}
+
+static void bluetooth_stats_lock( CRITICAL_SECTION *cs, LONGLONG *locked_at, enum winebth_stats_lock lock )
+{
+    struct bluetooth_lock_stats *stats = &lock_stats[lock];
+    LARGE_INTEGER start, now;
+
+    if (TryEnterCriticalSection( cs ))
     {
-        if (service->handle == handle)
-            return service;
+        if (cs->RecursionCount > 1) return;
+        QueryPerformanceCounter( &now );
     }
-    return NULL;
+    else
+    {
+        QueryPerformanceCounter( &start );
+        EnterCriticalSection( cs );
+        QueryPerformanceCounter( &now );
+        InterlockedIncrement64( &stats->contentions );
+        InterlockedExchangeAdd64( &stats->wait_time, perf_counter_to_100ns( now.QuadPart - start.QuadPart ) );
+    }
+    InterlockedIncrement64( &stats->acquisitions );
+    *locked_at = now.QuadPart;
 }
 
-/* Caller should hold props_cs. Characteristics are immutable after discovery. */
-static struct bluetooth_gatt_characteristic *find_gatt_characteristic(
-    struct bluetooth_gatt_service *service, const BTH_LE_GATT_CHARACTERISTIC *char_props )
+static void bluetooth_stats_unlock( CRITICAL_SECTION *cs, LONGLONG locked_at, enum winebth_stats_lock lock )
 {
-    struct bluetooth_gatt_characteristic *chrc;
-    GUID uuid;
+    struct bluetooth_lock_stats *stats = &lock_stats[lock];
+    LARGE_INTEGER now;
+    LONG64 held;
 
-    le_to_uuid( &char_props->CharacteristicUuid, &uuid );
-    ERR( "find_gatt_characteristic: looking for UUID=%s handle=%u svc_handle=%u\n",
-         debugstr_guid( &uuid ), char_props->AttributeHandle, char_props->ServiceHandle );
-    LIST_FOR_EACH_ENTRY( chrc, &service->characteristics, struct bluetooth_gatt_characteristic, entry )
+    if (cs->RecursionCount == 1)
     {
-        GUID chrc_uuid;
-        le_to_uuid( &chrc->props.CharacteristicUuid, &chrc_uuid );
-        ERR( "  checking: UUID=%s handle=%u\n", debugstr_guid( &chrc_uuid ), chrc->props.AttributeHandle );
-        if (IsEqualGUID( &chrc_uuid, &uuid ) &&
-            chrc->props.AttributeHandle == char_props->AttributeHandle)
-            return chrc;
+        QueryPerformanceCounter( &now );
+        held = perf_counter_to_100ns( now.QuadPart - locked_at );
+        InterlockedExchangeAdd64( &stats->hold_time, held );
+        stats_update_max( &stats->max_hold_time, held );
     }
-    ERR( "find_gatt_characteristic: NOT FOUND!\n" );
-    return NULL;
+    LeaveCriticalSection( cs );
+}
+
+static inline void device_list_lock( void )
+{
+    if (lock_stats_enabled)
+        bluetooth_stats_lock( &device_list_cs, &device_list_locked_at, WINEBTH_STATS_LOCK_DEVICE_LIST );
+    else
+        EnterCriticalSection( &device_list_cs );
+}
+
+static inline void device_list_unlock( void )
+{
+    if (lock_stats_enabled)
+        bluetooth_stats_unlock( &device_list_cs, device_list_locked_at, WINEBTH_STATS_LOCK_DEVICE_LIST );
+    else
+        LeaveCriticalSection( &device_list_cs );
+}
+
+static inline void device_props_lock( struct bluetooth_remote_device *device )
+{
+    if (lock_stats_enabled)
+        bluetooth_stats_lock( &device->props_cs, &device->props_locked_at, WINEBTH_STATS_LOCK_DEVICE_PROPS );
+    else
+        EnterCriticalSection( &device->props_cs );
+}
+
+static inline void device_props_unlock( struct bluetooth_remote_device *device )
+{
+    if (lock_stats_enabled)
+        bluetooth_stats_unlock( &device->props_cs, device->props_locked_at, WINEBTH_STATS_LOCK_DEVICE_PROPS );
+    else
+        LeaveCriticalSection( &device->props_cs );
+}
+
+static void bluetooth_stats_event_handled( enum winebluetooth_watcher_event_type type, LONG64 time )
+{
+    struct bluetooth_event_type_stats *stats;
+    unsigned int bucket = 0;
+
+    if (type >= ARRAY_SIZE( event_type_stats )) return;
+    stats = &event_type_stats[type];
+    InterlockedIncrement64( &stats->count );
+    InterlockedExchangeAdd64( &stats->total_time, time );
+    stats_update_max( &stats->max_time, time );
+    while (bucket < WINEBTH_STATS_LATENCY_BUCKETS - 1 && time / 10 >= (1ll << bucket))
+        bucket++;
+    InterlockedIncrement64( &stats->latency[bucket] );
+}
+
+static inline void bluetooth_invalidate_bus_relations( DEVICE_OBJECT *device_obj )
+{
+    InterlockedIncrement64( &relations_invalidated );
+    IoInvalidateDeviceRelations( device_obj, BusRelations );
 }
 
 /* ============================================================================
- * Reference Counting Helpers
+ * Lookup Indexes
  *
- * These helpers implement atomic reference counting for safe object access
- * after releasing device_list_cs. The pattern is:
- *   1. Acquire device_list_cs
- *   2. Find object and incref
- *   3. Release device_list_cs
- *   4. Use object (may make external calls)
- *   5. decref when done
+ * Every radio hashes its remote devices by address, and every characteristic
+ * by its handle. Every remote device also hashes its characteristics by
+ * (service handle, attribute handle), so that the IOCTL handlers find their
+ * target without walking the device, service and characteristic lists.
+ * The indexes are maintained by the event loop, under devices_lock.
  * ============================================================================ */
 
-/* Radio reference counting */
-static inline void bluetooth_radio_incref( struct bluetooth_radio *radio )
+static inline void bluetooth_radio_lock_shared( struct bluetooth_radio *radio )
 {
-    InterlockedIncrement( &radio->refcount );
+    KeEnterCriticalRegion();
+    ExAcquireResourceSharedLite( &radio->devices_lock, TRUE );
 }
 
-static inline LONG bluetooth_radio_decref( struct bluetooth_radio *radio )
+static inline void bluetooth_radio_lock_exclusive( struct bluetooth_radio *radio )
 {
-    return InterlockedDecrement( &radio->refcount );
+    KeEnterCriticalRegion();
+    ExAcquireResourceExclusiveLite( &radio->devices_lock, TRUE );
 }
 
-/* Remote device reference counting */
-static inline void bluetooth_device_incref( struct bluetooth_remote_device *device )
+static inline void bluetooth_radio_unlock( struct bluetooth_radio *radio )
 {
-    InterlockedIncrement( &device->refcount );
+    ExReleaseResourceForThreadLite( &radio->devices_lock, (ERESOURCE_THREAD)PsGetCurrentThread() );
+    KeLeaveCriticalRegion();
 }
 
-/* Forward declaration */
-static void WINAPI bluetooth_irp_cancel_routine( DEVICE_OBJECT *device, IRP *irp );
-static void remote_device_destroy( struct bluetooth_remote_device *ext );
+static inline unsigned int device_index_hash( BTH_ADDR addr )
+{
+    /* The vendor part of an address is shared by many devices, the low bytes are what tells them apart. */
+    return (addr ^ (addr >> 8) ^ (addr >> 16)) % BLUETOOTH_DEVICE_INDEX_SIZE;
+}
 
-static void bluetooth_device_async_destroy( struct bluetooth_remote_device *device )
+static inline unsigned int char_index_hash( UINT16 service_handle, UINT16 attr_handle )
 {
-    remote_device_destroy( device );
+    return (service_handle * 31 + attr_handle) % BLUETOOTH_CHAR_INDEX_SIZE;
 }
 
-static inline void bluetooth_device_decref( struct bluetooth_remote_device *device )
+static inline unsigned int char_handle_index_hash( winebluetooth_gatt_characteristic_t characteristic )
 {
-    if (InterlockedDecrement( &device->refcount ) == 0)
+    /* Slot indices get handed out densely, the generation bits above them would only add noise. */
+    return (characteristic.handle & WINEBLUETOOTH_HANDLE_INDEX_MASK) % BLUETOOTH_CHAR_INDEX_SIZE;
+}
+
+/* Adds the device to the radio's address index, or moves it to the right bucket if its address changed.
+ * Caller should hold radio->devices_lock exclusively. */
+static void bluetooth_radio_index_device( struct bluetooth_radio *radio, struct bluetooth_remote_device *device )
+{
+    BOOL has_addr;
+    BTH_ADDR addr;
+
+    device_props_lock( device );
+    has_addr = !!(device->props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_ADDRESS);
+    addr = device->props.address.ullLong;
+    device_props_unlock( device );
+
+    if (device->indexed)
     {
-        bluetooth_device_async_destroy( device );
+        if (has_addr && device->indexed_addr == addr) return;
+        list_remove( &device->addr_entry );
+        device->indexed = FALSE;
     }
+    if (!has_addr || device->state == BLUETOOTH_STATE_REMOVING) return;
+
+    device->indexed_addr = addr;
+    device->indexed = TRUE;
+    list_add_tail( &radio->device_index[device_index_hash( addr )], &device->addr_entry );
 }
 
-/* Forward declaration */
-static void bluetooth_gatt_service_async_destroy( struct bluetooth_gatt_service *service )
+/* Caller should hold radio->devices_lock exclusively. */
+static void bluetooth_radio_index_characteristic( struct bluetooth_radio *radio, struct bluetooth_remote_device *device,
+                                                  struct bluetooth_gatt_characteristic *chrc )
 {
-    struct bluetooth_gatt_characteristic *cur, *next;
+    list_add_tail( &device->char_index[char_index_hash( chrc->service->handle, chrc->props.AttributeHandle )],
+                   &chrc->index_entry );
+    list_add_tail( &radio->char_handle_index[char_handle_index_hash( chrc->characteristic )], &chrc->handle_entry );
+}
 
-    winebluetooth_gatt_service_free( service->service );
-    LIST_FOR_EACH_ENTRY_SAFE( cur, next, &service->characteristics, struct bluetooth_gatt_characteristic, entry )
+static void bluetooth_device_complete_gatt_irp( IRP *irp, NTSTATUS result );
+static void bluetooth_device_complete_gatt_irps( LIST_ENTRY *irp_list, NTSTATUS result );
+
+/* Completes the reads and writes in progress for a characteristic that can't be found anymore, as the backend's
+ * results for them can't be matched to the IRPs after that. Caller should hold device_list_cs. */
+static void bluetooth_gatt_characteristic_cancel_io( struct bluetooth_gatt_characteristic *chrc, NTSTATUS result )
+{
+    struct bluetooth_remote_device *device = chrc->service->device;
+    LIST_ENTRY *cur, *next;
+
+    EnterCriticalSection( &device->gatt_cs );
+    for (cur = device->gatt_io_irps.Flink; cur != &device->gatt_io_irps; cur = next)
     {
-        winebluetooth_gatt_characteristic_free( cur->characteristic );
-        free( cur );
+        IRP *irp = CONTAINING_RECORD( cur, IRP, Tail.Overlay.ListEntry );
+
+        next = cur->Flink;
+        if (irp->Tail.Overlay.DriverContext[0] == chrc)
+            bluetooth_device_complete_gatt_irp( irp, result );
     }
-    free( service );
+    LeaveCriticalSection( &device->gatt_cs );
 }
 
-/* GATT service reference counting */
-static inline void bluetooth_gatt_service_incref( struct bluetooth_gatt_service *service )
+/* Caller should hold device_list_cs, and radio->devices_lock exclusively. */
+static void bluetooth_radio_unindex_service( struct bluetooth_gatt_service *service )
 {
-    InterlockedIncrement( &service->refcount );
+    struct bluetooth_gatt_characteristic *chrc;
+
+    LIST_FOR_EACH_ENTRY( chrc, &service->characteristics, struct bluetooth_gatt_characteristic, entry )
+    {
+        list_remove( &chrc->index_entry );
+        list_remove( &chrc->handle_entry );
+        bluetooth_gatt_characteristic_cancel_io( chrc, STATUS_DELETE_PENDING );
+    }
 }
 
-static inline void bluetooth_gatt_service_decref( struct bluetooth_gatt_service *service )
+static void complete_pending_irps( LIST_ENTRY *irp_list, NTSTATUS result );
+static void bluetooth_radio_wake_device_change_irps( struct bluetooth_radio *radio );
+
+/* Moves the device to the end of the radio's changed_devices, with a new generation. Caller should hold
+ * device_list_cs. */
+static void bluetooth_radio_device_changed( struct bluetooth_radio *radio, struct bluetooth_remote_device *device )
 {
-    if (InterlockedDecrement( &service->refcount ) == 0)
-        bluetooth_gatt_service_async_destroy( service );
+    device->generation = ++radio->generation;
+    list_remove( &device->changed_entry );
+    list_add_tail( &radio->changed_devices, &device->changed_entry );
+    bluetooth_radio_wake_device_change_irps( radio );
 }
 
-/* State validation helpers */
-static inline BOOL bluetooth_radio_is_active( struct bluetooth_radio *radio )
+/* Caller should hold device_list_cs. */
+static void bluetooth_radio_device_removed( struct bluetooth_radio *radio, struct bluetooth_remote_device *device )
 {
-    return radio->state == BLUETOOTH_STATE_ACTIVE;
+    struct bluetooth_removed_device *removed;
+    BTH_DEVICE_INFO info = {0};
+
+    list_remove( &device->changed_entry );
+    list_init( &device->changed_entry );
+
+    device_props_lock( device );
+    winebluetooth_device_properties_to_info( device->props_mask, &device->props, &info );
+    device_props_unlock( device );
+
+    radio->generation++;
+    if (!(removed = malloc( sizeof( *removed ) )))
+    {
+        /* Nobody can be told about this removal, so everybody has to start over. */
+        radio->removed_floor = radio->generation;
+        bluetooth_radio_wake_device_change_irps( radio );
+        return;
+    }
+    removed->address = info.address;
+    removed->generation = radio->generation;
+    list_add_tail( &radio->removed_devices, &removed->entry );
+    if (++radio->removed_count > BLUETOOTH_MAX_REMOVED_DEVICES)
+    {
+        removed = LIST_ENTRY( list_head( &radio->removed_devices ), struct bluetooth_removed_device, entry );
+        radio->removed_floor = removed->generation;
+        list_remove( &removed->entry );
+        radio->removed_count--;
+        free( removed );
+    }
+    bluetooth_radio_wake_device_change_irps( radio );
 }
 
-static inline BOOL bluetooth_device_is_active( struct bluetooth_remote_device *device )
+/* Caller should hold device_list_cs. */
+static void bluetooth_radio_free_removed_devices( struct bluetooth_radio *radio )
 {
-    return device->state == BLUETOOTH_STATE_ACTIVE;
-}
+    struct bluetooth_removed_device *removed, *next;
 
+    LIST_FOR_EACH_ENTRY_SAFE( removed, next, &radio->removed_devices, struct bluetooth_removed_device, entry )
+    {
+        list_remove( &removed->entry );
+        free( removed );
+    }
+    radio->removed_count = 0;
+    radio->removed_floor = radio->generation;
+}
 
-static NTSTATUS bluetooth_remote_device_dispatch( DEVICE_OBJECT *device, struct bluetooth_remote_device *ext, IRP *irp )
+/* Fills a GET_DEVICE_CHANGES IRP with the devices added, changed or removed after the caller's generation, oldest
+ * first. Both changed_devices and removed_devices are ordered by generation, so this only ever looks at the devices
+ * that changed, walking back from the newest ones. Caller should hold device_list_cs. */
+static void bluetooth_radio_get_device_changes( struct bluetooth_radio *radio, IRP *irp )
 {
+    const SIZE_T header_size = offsetof( struct winebth_radio_get_device_changes_params, changes[0] );
     IO_STACK_LOCATION *stack = IoGetCurrentIrpStackLocation( irp );
     ULONG outsize = stack->Parameters.DeviceIoControl.OutputBufferLength;
-    ULONG code = stack->Parameters.DeviceIoControl.IoControlCode;
-    NTSTATUS status = irp->IoStatus.Status;
-
-    TRACE( "device=%p, ext=%p, irp=%p, code=%#lx\n", device, ext, irp, code );
-
-    /* State check for device-specific IOCTLs */
-    EnterCriticalSection( &device_list_cs );
-    if (ext->macos_invalidated)
+    struct winebth_radio_get_device_changes_params *params = irp->AssociatedIrp.SystemBuffer;
+    SIZE_T max_count = (outsize - header_size) / sizeof( params->changes[0] );
+    struct bluetooth_remote_device *device = NULL;
+    struct bluetooth_removed_device *removed = NULL;
+    ULONGLONG since = params->generation, last = params->generation;
+    struct list *cur;
+    BOOL reset;
+    ULONG count = 0;
+
+    /* If the caller may have missed removals, or isn't talking about this radio, have it start from scratch. */
+    reset = params->epoch != radio->epoch || since < radio->removed_floor || since > radio->generation;
+    if (reset) since = last = 0;
+
+    for (cur = list_tail( &radio->changed_devices ); cur; cur = list_prev( &radio->changed_devices, cur ))
     {
-        LeaveCriticalSection( &device_list_cs );
-        status = STATUS_DEVICE_NOT_CONNECTED;
-        irp->IoStatus.Status = status;
-        IoCompleteRequest( irp, IO_NO_INCREMENT );
-        return status;
+        struct bluetooth_remote_device *entry = LIST_ENTRY( cur, struct bluetooth_remote_device, changed_entry );
+        if (entry->generation <= since) break;
+        device = entry;
     }
-    if (ext->state != BLUETOOTH_STATE_ACTIVE)
+    for (cur = list_tail( &radio->removed_devices ); cur && !reset; cur = list_prev( &radio->removed_devices, cur ))
     {
-        LeaveCriticalSection( &device_list_cs );
-        status = STATUS_DEVICE_NOT_CONNECTED;
-        irp->IoStatus.Status = status;
-        IoCompleteRequest( irp, IO_NO_INCREMENT );
-        return status;
+        struct bluetooth_removed_device *entry = LIST_ENTRY( cur, struct bluetooth_removed_device, entry );
+        if (entry->generation <= since) break;
+        removed = entry;
     }
-    LeaveCriticalSection( &device_list_cs );
 
-    switch (code)
-    {
-    case IOCTL_WINEBTH_LE_DEVICE_GET_GATT_SERVICES:
+    while ((device || removed) && count < max_count)
     {
-        const SIZE_T min_size = offsetof( struct winebth_le_device_get_gatt_services_params, services[0] );
-        struct winebth_le_device_get_gatt_services_params *services = irp->AssociatedIrp.SystemBuffer;
-        struct bluetooth_gatt_service *svc;
-        SIZE_T rem;
-        BOOL need_connect = FALSE;
-        BOOL connected = FALSE;
+        struct winebth_device_change *change = &params->changes[count++];
 
-        if (!services || outsize < min_size)
+        memset( change, 0, sizeof( *change ) );
+        if (device && (!removed || device->generation < removed->generation))
         {
-            status = STATUS_INVALID_USER_BUFFER;
-            break;
+            change->type = WINEBTH_DEVICE_CHANGE_UPDATED;
+            device_props_lock( device );
+            winebluetooth_device_properties_to_info( device->props_mask, &device->props, &change->info );
+            device_props_unlock( device );
+            last = device->generation;
+            cur = list_next( &radio->changed_devices, &device->changed_entry );
+            device = cur ? LIST_ENTRY( cur, struct bluetooth_remote_device, changed_entry ) : NULL;
         }
-
-        rem = (outsize - min_size)/sizeof( *services->services );
-        status = STATUS_SUCCESS;
-        services->count = 0;
-
-        EnterCriticalSection( &device_list_cs );
-        if (ext->macos_invalidated || ext->state != BLUETOOTH_STATE_ACTIVE)
+        else
         {
-            LeaveCriticalSection( &device_list_cs );
-            status = STATUS_DEVICE_NOT_CONNECTED;
-            break;
+            change->type = WINEBTH_DEVICE_CHANGE_REMOVED;
+            change->info.flags = BDIF_ADDRESS;
+            change->info.address = removed->address;
+            last = removed->generation;
+            cur = list_next( &radio->removed_devices, &removed->entry );
+            removed = cur ? LIST_ENTRY( cur, struct bluetooth_removed_device, entry ) : NULL;
         }
+    }
 
-        EnterCriticalSection( &ext->props_cs );
-        connected = ext->props.connected;
-        LeaveCriticalSection( &ext->props_cs );
+    params->epoch = radio->epoch;
+    params->flags = reset ? WINEBTH_DEVICE_CHANGES_RESET : 0;
+    if (device || removed)
+    {
+        /* Let the caller pick up where this left off. */
+        params->flags |= WINEBTH_DEVICE_CHANGES_MORE;
+        params->generation = last;
+    }
+    else
+        params->generation = radio->generation;
+    params->count = count;
+    irp->IoStatus.Information = header_size + count * sizeof( params->changes[0] );
+}
 
-        TRACE( "GET_GATT_SERVICES: device=%p device.handle=%p name='%s' gatt_empty=%d connected=%d\n",
-               ext, (void*)ext->device.handle, ext->props.name,
-               list_empty( &ext->gatt_services ), connected );
-        if (list_empty( &ext->gatt_services ) && !connected)
-        {
-            need_connect = TRUE;
-            TRACE( "GATT services requested but device not connected, triggering connect\n" );
-        }
-        LIST_FOR_EACH_ENTRY( svc, &ext->gatt_services, struct bluetooth_gatt_service, entry )
-        {
-            if (!svc->primary)
-                continue;
-            services->count++;
-            if (rem)
-            {
-                BTH_LE_GATT_SERVICE *info;
+/* Removes the device from the radio's remote_devices list and indexes, once it is marked as being removed. Its
+ * services are kept until the device is destroyed, but can't be found through the radio anymore.
+ * Caller should hold device_list_cs, and radio->devices_lock exclusively. */
+static void bluetooth_radio_unlink_device( struct bluetooth_remote_device *device )
+{
+    struct bluetooth_gatt_service *svc;
 
-                info = &services->services[services->count - 1];
-                memset( info, 0, sizeof( *info ) );
-                uuid_to_le( &svc->uuid, &info->ServiceUuid );
-                info->AttributeHandle = svc->handle;
-                rem--;
-            }
-        }
-        LeaveCriticalSection( &device_list_cs );
+    list_remove( &device->entry );
+    if (device->indexed)
+    {
+        list_remove( &device->addr_entry );
+        device->indexed = FALSE;
+    }
+    bluetooth_radio_device_removed( device->radio, device );
+    EnterCriticalSection( &device->gatt_cs );
+    bluetooth_device_complete_gatt_irps( &device->gatt_io_irps, STATUS_DEVICE_NOT_CONNECTED );
+    bluetooth_device_complete_gatt_irps( &device->gatt_irps, STATUS_DEVICE_NOT_CONNECTED );
+    LeaveCriticalSection( &device->gatt_cs );
+    LIST_FOR_EACH_ENTRY( svc, &device->gatt_services, struct bluetooth_gatt_service, entry )
+        bluetooth_radio_unindex_service( svc );
+}
 
-        if (need_connect)
-        {
-            NTSTATUS pair_status = winebluetooth_device_start_pairing( ext->device, NULL );
-            (void)pair_status;
-        }
+/* Caller should hold radio->devices_lock. */
+static struct bluetooth_remote_device *bluetooth_radio_find_device( struct bluetooth_radio *radio, BTH_ADDR addr )
+{
+    struct bluetooth_remote_device *device;
 
-        irp->IoStatus.Information = offsetof( struct winebth_le_device_get_gatt_services_params, services[services->count] );
-        if (services->count > rem)
-            status = STATUS_MORE_ENTRIES;
-        break;
-    }
-    case IOCTL_WINEBTH_LE_DEVICE_GET_GATT_CHARACTERISTICS:
+    LIST_FOR_EACH_ENTRY( device, &radio->device_index[device_index_hash( addr )], struct bluetooth_remote_device,
+                         addr_entry )
     {
-        const SIZE_T min_size = offsetof( struct winebth_le_device_get_gatt_characteristics_params, characteristics[0] );
-        struct winebth_le_device_get_gatt_characteristics_params *chars = irp->AssociatedIrp.SystemBuffer;
-        struct bluetooth_gatt_characteristic *chrc;
-        struct bluetooth_gatt_service *service = NULL;
-        SIZE_T rem;
-        GUID uuid;
+        if (device->indexed_addr == addr)
+            return device;
+    }
+    return NULL;
+}
 
-        if (!chars || outsize < min_size)
-        {
-            status = STATUS_INVALID_USER_BUFFER;
-            break;
-        }
+/* Looks up a characteristic by the service and characteristic passed to the GATT IOCTLs. The service is matched by
+ * handle and UUID, or by the characteristic's ServiceHandle alone if no service UUID was given.
+ * Caller should hold radio->devices_lock. */
+static struct bluetooth_gatt_characteristic *bluetooth_device_find_characteristic(
+    struct bluetooth_remote_device *device, const BTH_LE_GATT_SERVICE *service,
+    const BTH_LE_GATT_CHARACTERISTIC *char_props )
+{
+    struct bluetooth_gatt_characteristic *chrc;
+    GUID svc_uuid, uuid;
+    UINT16 svc_handle;
+    BOOL any_service;
+
+    le_to_uuid( &service->ServiceUuid, &svc_uuid );
+    le_to_uuid( &char_props->CharacteristicUuid, &uuid );
+    any_service = IsEqualGUID( &svc_uuid, &GUID_NULL );
+    svc_handle = any_service ? char_props->ServiceHandle : service->AttributeHandle;
+
+    LIST_FOR_EACH_ENTRY( chrc, &device->char_index[char_index_hash( svc_handle, char_props->AttributeHandle )],
+                         struct bluetooth_gatt_characteristic, index_entry )
+    {
+        GUID chrc_uuid;
+
+        if (chrc->service->handle != svc_handle || chrc->props.AttributeHandle != char_props->AttributeHandle)
+            continue;
+        if (!any_service && !IsEqualGUID( &chrc->service->uuid, &svc_uuid ))
+            continue;
+        le_to_uuid( &chrc->props.CharacteristicUuid, &chrc_uuid );
+        if (IsEqualGUID( &chrc_uuid, &uuid ))
+            return chrc;
+    }
+    TRACE( "characteristic %s handle %u not found in service %s handle %u\n", debugstr_guid( &uuid ),
+           char_props->AttributeHandle, debugstr_guid( &svc_uuid ), svc_handle );
+    return NULL;
+}
+
+/* Looks up the characteristic to ask the backend for the ATT MTU of a device. If the AttributeHandle of char_props is
+ * 0, any characteristic of the device will do, preferably one that takes write commands, as that is what BlueZ can
+ * tell the MTU for without support for the MTU property. Caller should hold radio->devices_lock. */
+static struct bluetooth_gatt_characteristic *bluetooth_device_find_mtu_characteristic(
+    struct bluetooth_remote_device *device, const BTH_LE_GATT_SERVICE *service,
+    const BTH_LE_GATT_CHARACTERISTIC *char_props )
+{
+    struct bluetooth_gatt_characteristic *chrc, *found = NULL;
+    struct bluetooth_gatt_service *svc;
+
+    if (char_props->AttributeHandle)
+        return bluetooth_device_find_characteristic( device, service, char_props );
+
+    LIST_FOR_EACH_ENTRY( svc, &device->gatt_services, struct bluetooth_gatt_service, entry )
+    {
+        LIST_FOR_EACH_ENTRY( chrc, &svc->characteristics, struct bluetooth_gatt_characteristic, entry )
+        {
+            if (chrc->props.IsWritableWithoutResponse) return chrc;
+            if (!found) found = chrc;
+        }
+    }
+    return found;
+}
+
+/* Caller should hold radio->devices_lock. */
+static struct bluetooth_gatt_characteristic *bluetooth_radio_find_characteristic(
+    struct bluetooth_radio *radio, winebluetooth_gatt_characteristic_t handle )
+{
+    struct bluetooth_gatt_characteristic *chrc;
+
+    LIST_FOR_EACH_ENTRY( chrc, &radio->char_handle_index[char_handle_index_hash( handle )],
+                         struct bluetooth_gatt_characteristic, handle_entry )
+    {
+        if (winebluetooth_gatt_characteristic_equal( chrc->characteristic, handle ))
+            return chrc;
+    }
+    return NULL;
+}
+
+/* ============================================================================
+ * Persisted Attribute Tables
+ *
+ * Whenever the backend resolves the services of a device, a copy of its
+ * attribute table is stored in the GattDatabase value of the device's key.
+ * Until the services are resolved again after a reconnect or restart, the
+ * service and characteristic lists are answered from that copy, and requests
+ * for characteristics in it wait for the backend to find them.
+ * ============================================================================ */
+
+/* The table has the same layout as the replies to IOCTL_WINEBTH_LE_DEVICE_GET_GATT_DATABASE. */
+
+static BTH_LE_GATT_CHARACTERISTIC *bluetooth_gatt_database_characteristics( const struct winebth_gatt_database *db )
+{
+    return (BTH_LE_GATT_CHARACTERISTIC *)&db->services[db->services_count];
+}
+
+static BOOL bluetooth_gatt_database_valid( const struct winebth_gatt_database *db, SIZE_T size )
+{
+    ULONG i;
+
+    if (size < WINEBTH_GATT_DATABASE_SIZE( 0, 0 )) return FALSE;
+    if (db->version != WINEBTH_GATT_DATABASE_VERSION) return FALSE;
+    if (db->services_count > size / sizeof( db->services[0] ) ||
+        db->characteristics_count > size / sizeof( BTH_LE_GATT_CHARACTERISTIC ))
+        return FALSE;
+    if (size != WINEBTH_GATT_DATABASE_SIZE( db->services_count, db->characteristics_count )) return FALSE;
+    for (i = 0; i < db->services_count; i++)
+    {
+        const struct winebth_gatt_database_service *service = &db->services[i];
+
+        if (service->characteristics_count > db->characteristics_count ||
+            service->first_characteristic > db->characteristics_count - service->characteristics_count)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static const struct winebth_gatt_database_service *
+bluetooth_gatt_database_find_service( const struct winebth_gatt_database *db, const BTH_LE_GATT_SERVICE *info )
+{
+    GUID uuid, cur;
+    ULONG i;
+
+    le_to_uuid( &info->ServiceUuid, &uuid );
+    for (i = 0; i < db->services_count; i++)
+    {
+        le_to_uuid( &db->services[i].service.ServiceUuid, &cur );
+        if (IsEqualGUID( &cur, &uuid ) && db->services[i].service.AttributeHandle == info->AttributeHandle)
+            return &db->services[i];
+    }
+    return NULL;
+}
+
+/* Matches the service like bluetooth_device_find_characteristic does. */
+static BOOL bluetooth_gatt_database_has_characteristic( const struct winebth_gatt_database *db,
+                                                        const BTH_LE_GATT_SERVICE *service,
+                                                        const BTH_LE_GATT_CHARACTERISTIC *char_props )
+{
+    const BTH_LE_GATT_CHARACTERISTIC *chars = bluetooth_gatt_database_characteristics( db );
+    GUID svc_uuid, uuid, cur;
+    BOOL any_service;
+    ULONG i, j;
+
+    le_to_uuid( &service->ServiceUuid, &svc_uuid );
+    le_to_uuid( &char_props->CharacteristicUuid, &uuid );
+    any_service = IsEqualGUID( &svc_uuid, &GUID_NULL );
+
+    for (i = 0; i < db->services_count; i++)
+    {
+        const struct winebth_gatt_database_service *entry = &db->services[i];
+
+        if (any_service ? entry->service.AttributeHandle != char_props->ServiceHandle
+                        : entry->service.AttributeHandle != service->AttributeHandle)
+            continue;
+        le_to_uuid( &entry->service.ServiceUuid, &cur );
+        if (!any_service && !IsEqualGUID( &cur, &svc_uuid )) continue;
+
+        for (j = entry->first_characteristic; j < entry->first_characteristic + entry->characteristics_count; j++)
+        {
+            if (chars[j].AttributeHandle != char_props->AttributeHandle) continue;
+            le_to_uuid( &chars[j].CharacteristicUuid, &cur );
+            if (IsEqualGUID( &cur, &uuid )) return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* Copies up to max primary services, and returns how many there are. */
+static ULONG bluetooth_gatt_database_get_services( const struct winebth_gatt_database *db,
+                                                   BTH_LE_GATT_SERVICE *services, SIZE_T max )
+{
+    ULONG i, count = 0;
+
+    for (i = 0; i < db->services_count; i++)
+    {
+        if (!db->services[i].primary) continue;
+        if (count < max) services[count] = db->services[i].service;
+        count++;
+    }
+    return count;
+}
+
+/* Copies up to max characteristics of a service, and returns how many there are. */
+static ULONG bluetooth_gatt_database_get_characteristics( const struct winebth_gatt_database_service *service,
+                                                          const BTH_LE_GATT_CHARACTERISTIC *chars,
+                                                          BTH_LE_GATT_CHARACTERISTIC *out, SIZE_T max )
+{
+    memcpy( out, chars + service->first_characteristic,
+            min( max, service->characteristics_count ) * sizeof( *out ) );
+    return service->characteristics_count;
+}
+
+/* Returns NULL if the device has no services. Caller should hold radio->devices_lock. */
+static struct winebth_gatt_database *bluetooth_device_build_gatt_database( struct bluetooth_remote_device *device,
+                                                                             SIZE_T *size )
+{
+    ULONG services_count = 0, characteristics_count = 0, i = 0, j = 0;
+    struct winebth_gatt_database *db;
+    struct bluetooth_gatt_service *svc;
+    BTH_LE_GATT_CHARACTERISTIC *chars;
+
+    LIST_FOR_EACH_ENTRY( svc, &device->gatt_services, struct bluetooth_gatt_service, entry )
+    {
+        services_count++;
+        characteristics_count += list_count( &svc->characteristics );
+    }
+    if (!services_count) return NULL;
+
+    *size = WINEBTH_GATT_DATABASE_SIZE( services_count, characteristics_count );
+    /* Zeroed, so that tables can be compared with memcmp. */
+    if (!(db = calloc( 1, *size ))) return NULL;
+    db->version = WINEBTH_GATT_DATABASE_VERSION;
+    db->services_count = services_count;
+    db->characteristics_count = characteristics_count;
+    chars = bluetooth_gatt_database_characteristics( db );
+
+    LIST_FOR_EACH_ENTRY( svc, &device->gatt_services, struct bluetooth_gatt_service, entry )
+    {
+        struct winebth_gatt_database_service *entry = &db->services[i++];
+        struct bluetooth_gatt_characteristic *chrc;
+
+        uuid_to_le( &svc->uuid, &entry->service.ServiceUuid );
+        entry->service.AttributeHandle = svc->handle;
+        entry->primary = svc->primary;
+        entry->first_characteristic = j;
+        LIST_FOR_EACH_ENTRY( chrc, &svc->characteristics, struct bluetooth_gatt_characteristic, entry )
+            chars[j++] = chrc->props;
+        entry->characteristics_count = j - entry->first_characteristic;
+    }
+    return db;
+}
+
+/* Copies the attribute table of a device into a GET_GATT_DATABASE reply. Until the services are resolved, that is the
+ * persisted one, if there is any. Caller should hold radio->devices_lock. */
+static NTSTATUS bluetooth_device_get_gatt_database( struct bluetooth_remote_device *device, BOOL resolved,
+                                                    struct winebth_gatt_database *out, SIZE_T outsize,
+                                                    ULONG_PTR *info )
+{
+    struct winebth_gatt_database empty = { WINEBTH_GATT_DATABASE_VERSION }, *db = NULL;
+    const struct winebth_gatt_database *src = &empty;
+    SIZE_T size = WINEBTH_GATT_DATABASE_SIZE( 0, 0 );
+    BTH_LE_GATT_CHARACTERISTIC *chars;
+    ULONG i;
+
+    if (!resolved && device->gatt_db)
+    {
+        src = device->gatt_db;
+        size = device->gatt_db_size;
+    }
+    else if (!list_empty( &device->gatt_services ))
+    {
+        if (!(db = bluetooth_device_build_gatt_database( device, &size )))
+            return STATUS_NO_MEMORY;
+        src = db;
+    }
+
+    if (outsize < size)
+    {
+        out->version = src->version;
+        out->services_count = src->services_count;
+        out->characteristics_count = src->characteristics_count;
+        *info = WINEBTH_GATT_DATABASE_SIZE( 0, 0 );
+        free( db );
+        return STATUS_MORE_ENTRIES;
+    }
+
+    memcpy( out, src, size );
+    free( db );
+    /* Sorted like the replies to GET_GATT_CHARACTERISTICS. */
+    chars = bluetooth_gatt_database_characteristics( out );
+    for (i = 0; i < out->services_count; i++)
+    {
+        if (out->services[i].characteristics_count > 1)
+            qsort( chars + out->services[i].first_characteristic, out->services[i].characteristics_count,
+                   sizeof( *chars ), compare_characteristics_by_uuid );
+    }
+    *info = size;
+    return STATUS_SUCCESS;
+}
+
+/* Reads the attribute table stored for a device, once it has a device key. Returns TRUE if one was found. */
+static BOOL bluetooth_device_load_gatt_database( struct bluetooth_remote_device *device )
+{
+    UNICODE_STRING name = RTL_CONSTANT_STRING( L"GattDatabase" );
+    KEY_VALUE_PARTIAL_INFORMATION *info = NULL;
+    struct winebth_gatt_database *db = NULL;
+    ULONG size = 0;
+    NTSTATUS status;
+    HANDLE key;
+
+    if ((status = IoOpenDeviceRegistryKey( device->device_obj, PLUGPLAY_REGKEY_DEVICE, KEY_READ, &key )))
+    {
+        TRACE( "Failed to open device key: %#lx\n", status );
+        return FALSE;
+    }
+    status = NtQueryValueKey( key, &name, KeyValuePartialInformation, NULL, 0, &size );
+    if ((status == STATUS_BUFFER_TOO_SMALL || status == STATUS_BUFFER_OVERFLOW) && (info = malloc( size )) &&
+        !NtQueryValueKey( key, &name, KeyValuePartialInformation, info, size, &size ) &&
+        info->Type == REG_BINARY && (db = malloc( max( info->DataLength, 1 ) )))
+    {
+        memcpy( db, info->Data, info->DataLength );
+        if (!bluetooth_gatt_database_valid( db, info->DataLength ))
+        {
+            WARN( "Ignoring invalid attribute table for device %p\n", device );
+            free( db );
+            db = NULL;
+        }
+    }
+    NtClose( key );
+
+    if (!db)
+    {
+        free( info );
+        return FALSE;
+    }
+
+    TRACE( "Loaded attribute table for device %p: %lu services, %lu characteristics\n", device,
+           db->services_count, db->characteristics_count );
+    bluetooth_radio_lock_exclusive( device->radio );
+    /* The services may have been resolved in the meantime. */
+    if (!device->gatt_db)
+    {
+        device->gatt_db = db;
+        device->gatt_db_size = info->DataLength;
+        db = NULL;
+    }
+    bluetooth_radio_unlock( device->radio );
+    free( db );
+    free( info );
+    return TRUE;
+}
+
+/* Takes a copy of the attribute table of a device, and stores it if it differs from the last one. The device should
+ * have resolved its services. Caller should hold a reference to the device, but no locks. */
+static void bluetooth_device_update_gatt_database( struct bluetooth_remote_device *device )
+{
+    UNICODE_STRING name = RTL_CONSTANT_STRING( L"GattDatabase" );
+    struct winebth_gatt_database *db, *copy = NULL;
+    NTSTATUS status;
+    SIZE_T size;
+    HANDLE key;
+
+    bluetooth_radio_lock_exclusive( device->radio );
+    if ((db = bluetooth_device_build_gatt_database( device, &size )) &&
+        (!device->gatt_db || device->gatt_db_size != size || memcmp( device->gatt_db, db, size )) &&
+        (copy = malloc( size )))
+    {
+        memcpy( copy, db, size );
+        free( device->gatt_db );
+        device->gatt_db = copy;
+        device->gatt_db_size = size;
+    }
+    bluetooth_radio_unlock( device->radio );
+
+    if (copy)
+    {
+        TRACE( "Storing attribute table for device %p: %lu services, %lu characteristics\n", device,
+               db->services_count, db->characteristics_count );
+        if ((status = IoOpenDeviceRegistryKey( device->device_obj, PLUGPLAY_REGKEY_DEVICE, KEY_SET_VALUE, &key )))
+            TRACE( "Failed to open device key: %#lx\n", status );
+        else
+        {
+            if ((status = NtSetValueKey( key, &name, 0, REG_BINARY, db, size )))
+                WARN( "Failed to store attribute table: %#lx\n", status );
+            NtClose( key );
+        }
+    }
+    free( db );
+}
+
+/* Refreshes the stored attribute table after the backend reported a change to it, unless that is part of the
+ * device disconnecting or resolving its services. Caller should hold a reference to the device, but no locks. */
+static void bluetooth_device_gatt_database_changed( struct bluetooth_remote_device *device )
+{
+    BOOL connected, resolved;
+
+    device_props_lock( device );
+    connected = device->props.connected;
+    resolved = device->props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_SERVICES_RESOLVED && device->props.services_resolved;
+    device_props_unlock( device );
+    if (connected && resolved) bluetooth_device_update_gatt_database( device );
+}
+
+/* ============================================================================
+ * Reference Counting Helpers
+ *
+ * These helpers implement atomic reference counting for safe object access
+ * after releasing device_list_cs. The pattern is:
+ *   1. Acquire device_list_cs
+ *   2. Find object and incref
+ *   3. Release device_list_cs
+ *   4. Use object (may make external calls)
+ *   5. decref when done
+ * ============================================================================ */
+
+/* Radio reference counting */
+static inline void bluetooth_radio_incref( struct bluetooth_radio *radio )
+{
+    InterlockedIncrement( &radio->refcount );
+}
+
+static inline LONG bluetooth_radio_decref( struct bluetooth_radio *radio )
+{
+    return InterlockedDecrement( &radio->refcount );
+}
+
+/* Remote device reference counting */
+static inline void bluetooth_device_incref( struct bluetooth_remote_device *device )
+{
+    InterlockedIncrement( &device->refcount );
+}
+
+/* Forward declaration */
+static void WINAPI bluetooth_irp_cancel_routine( DEVICE_OBJECT *device, IRP *irp );
+static void remote_device_destroy( struct bluetooth_remote_device *ext );
+
+static void bluetooth_device_async_destroy( struct bluetooth_remote_device *device )
+{
+    remote_device_destroy( device );
+}
+
+static inline void bluetooth_device_decref( struct bluetooth_remote_device *device )
+{
+    if (InterlockedDecrement( &device->refcount ) == 0)
+    {
+        bluetooth_device_async_destroy( device );
+    }
+}
+
+/* Completes a WAIT_DEVICE_CHANGES IRP right away if a device was added, changed or removed since the caller's
+ * generation, otherwise marks it pending until one is. Caller should hold device_list_cs. */
+static NTSTATUS bluetooth_radio_queue_device_change_irp( struct bluetooth_radio *radio, IRP *irp )
+{
+    struct winebth_radio_get_device_changes_params *params = irp->AssociatedIrp.SystemBuffer;
+
+    if (params->epoch != radio->epoch || params->generation != radio->generation)
+    {
+        bluetooth_radio_get_device_changes( radio, irp );
+        return STATUS_SUCCESS;
+    }
+
+    IoSetCancelRoutine( irp, bluetooth_irp_cancel_routine );
+    if (irp->Cancel && IoSetCancelRoutine( irp, NULL ) != NULL)
+    {
+        irp->IoStatus.Information = 0;
+        return STATUS_CANCELLED;
+    }
+    IoMarkIrpPending( irp );
+    InsertTailList( &radio->device_change_irps, &irp->Tail.Overlay.ListEntry );
+    return STATUS_PENDING;
+}
+
+/* Completes every pending WAIT_DEVICE_CHANGES IRP, after the radio's generation got bumped. Caller should hold
+ * device_list_cs. */
+static void bluetooth_radio_wake_device_change_irps( struct bluetooth_radio *radio )
+{
+    LIST_ENTRY *entry;
+
+    while ((entry = RemoveHeadList( &radio->device_change_irps )) != &radio->device_change_irps)
+    {
+        IRP *irp = CONTAINING_RECORD( entry, IRP, Tail.Overlay.ListEntry );
+
+        /* If it is being cancelled, the cancel routine will remove it once we release device_list_cs. */
+        InitializeListHead( entry );
+        if (IoSetCancelRoutine( irp, NULL ) == NULL) continue;
+
+        bluetooth_radio_get_device_changes( radio, irp );
+        irp->IoStatus.Status = STATUS_SUCCESS;
+        IoCompleteRequest( irp, IO_NO_INCREMENT );
+    }
+}
+
+/* GATT requests parked on one of a remote device's lists hold a reference to it, which is kept in DriverContext[3].
+ * They are only ever taken off the list with the device's gatt_cs held, and whoever completes them drops the
+ * reference. */
+
+static void WINAPI bluetooth_device_gatt_irp_cancel_routine( DEVICE_OBJECT *device_obj, IRP *irp )
+{
+    struct bluetooth_remote_device *device = irp->Tail.Overlay.DriverContext[3];
+
+    IoReleaseCancelSpinLock( irp->CancelIrql );
+
+    EnterCriticalSection( &device->gatt_cs );
+    RemoveEntryList( &irp->Tail.Overlay.ListEntry );
+    LeaveCriticalSection( &device->gatt_cs );
+
+    irp->IoStatus.Status = STATUS_CANCELLED;
+    irp->IoStatus.Information = 0;
+    IoCompleteRequest( irp, IO_NO_INCREMENT );
+    bluetooth_device_decref( device );
+}
+
+/* Returns STATUS_CANCELLED if the IRP has been cancelled already. Caller should hold the device's gatt_cs. */
+static NTSTATUS bluetooth_device_park_gatt_irp( struct bluetooth_remote_device *device, LIST_ENTRY *irp_list, IRP *irp )
+{
+    bluetooth_device_incref( device );
+    irp->Tail.Overlay.DriverContext[3] = device;
+    IoSetCancelRoutine( irp, bluetooth_device_gatt_irp_cancel_routine );
+    if (irp->Cancel && IoSetCancelRoutine( irp, NULL ) != NULL)
+    {
+        bluetooth_device_decref( device );
+        irp->IoStatus.Information = 0;
+        return STATUS_CANCELLED;
+    }
+    IoMarkIrpPending( irp );
+    InsertTailList( irp_list, &irp->Tail.Overlay.ListEntry );
+    return STATUS_PENDING;
+}
+
+/* Takes a parked request off its list. Returns FALSE if the cancel routine is already running, and will complete it
+ * instead. Otherwise, the caller has to complete it, and drop the reference to the device it held.
+ * Caller should hold the device's gatt_cs. */
+static BOOL bluetooth_device_unpark_gatt_irp( IRP *irp )
+{
+    RemoveEntryList( &irp->Tail.Overlay.ListEntry );
+    /* Keep the entry valid for the cancel routine, in case it is already running. */
+    InitializeListHead( &irp->Tail.Overlay.ListEntry );
+    return IoSetCancelRoutine( irp, NULL ) != NULL;
+}
+
+/* The caller should hold a reference to the device besides the IRP's, as well as its gatt_cs. */
+static void bluetooth_device_complete_gatt_irp( IRP *irp, NTSTATUS result )
+{
+    struct bluetooth_remote_device *device = irp->Tail.Overlay.DriverContext[3];
+
+    if (!bluetooth_device_unpark_gatt_irp( irp )) return;
+    irp->IoStatus.Status = result;
+    irp->IoStatus.Information = 0;
+    IoCompleteRequest( irp, IO_NO_INCREMENT );
+    bluetooth_device_decref( device );
+}
+
+/* Same as above, for every request on the list. */
+static void bluetooth_device_complete_gatt_irps( LIST_ENTRY *irp_list, NTSTATUS result )
+{
+    while (!IsListEmpty( irp_list ))
+        bluetooth_device_complete_gatt_irp( CONTAINING_RECORD( irp_list->Flink, IRP, Tail.Overlay.ListEntry ), result );
+}
+
+/* Forward declaration */
+static void bluetooth_gatt_service_async_destroy( struct bluetooth_gatt_service *service )
+{
+    struct bluetooth_gatt_characteristic *cur, *next;
+
+    winebluetooth_gatt_service_free( service->service );
+    device_list_lock();
+    LIST_FOR_EACH_ENTRY( cur, &service->characteristics, struct bluetooth_gatt_characteristic, entry )
+        complete_pending_irps( &cur->notification_irps, STATUS_DELETE_PENDING );
+    device_list_unlock();
+    LIST_FOR_EACH_ENTRY_SAFE( cur, next, &service->characteristics, struct bluetooth_gatt_characteristic, entry )
+    {
+        winebluetooth_gatt_characteristic_free( cur->characteristic );
+        free( cur->cached_value );
+        free( cur );
+    }
+    free( service );
+}
+
+/* GATT service reference counting */
+static inline void bluetooth_gatt_service_incref( struct bluetooth_gatt_service *service )
+{
+    InterlockedIncrement( &service->refcount );
+}
+
+static inline void bluetooth_gatt_service_decref( struct bluetooth_gatt_service *service )
+{
+    if (InterlockedDecrement( &service->refcount ) == 0)
+        bluetooth_gatt_service_async_destroy( service );
+}
+
+/* State validation helpers */
+static inline BOOL bluetooth_radio_is_active( struct bluetooth_radio *radio )
+{
+    return radio->state == BLUETOOTH_STATE_ACTIVE;
+}
+
+static inline BOOL bluetooth_device_is_active( struct bluetooth_remote_device *device )
+{
+    return device->state == BLUETOOTH_STATE_ACTIVE;
+}
+
+C_ASSERT( sizeof(struct winebth_gatt_notification_record) == sizeof(struct bluetooth_gatt_notification_record) );
+C_ASSERT( offsetof( struct winebth_radio_read_notifications_params, max_count ) ==
+          offsetof( struct winebth_radio_read_notification_params, data_size ) );
+C_ASSERT( offsetof( struct winebth_le_device_read_notifications_params, max_count ) ==
+          offsetof( struct winebth_le_device_read_notification_params, data_size ) );
+
+/* Replaces the cached value of a characteristic, unless it already holds a newer one. Caller should hold the
+ * device's gatt_cs. */
+static void bluetooth_gatt_characteristic_cache_value( struct bluetooth_gatt_characteristic *chrc,
+                                                       ULONGLONG timestamp, const UCHAR *data, UINT32 size )
+{
+    struct bluetooth_gatt_cached_value *value;
+
+    if (chrc->cached_value && chrc->cached_value->timestamp > timestamp) return;
+    if (!(value = malloc( offsetof( struct bluetooth_gatt_cached_value, data[size] ) ))) return;
+    value->timestamp = timestamp;
+    value->size = size;
+    memcpy( value->data, data, size );
+    free( chrc->cached_value );
+    chrc->cached_value = value;
+}
+
+static ULONGLONG bluetooth_gatt_value_timestamp( void )
+{
+    LARGE_INTEGER now;
+
+    KeQuerySystemTime( &now );
+    return now.QuadPart;
+}
+
+/* Fills a READ_NOTIFICATIONS IRP with as many of the values queued for the characteristic as requested. */
+static NTSTATUS bluetooth_gatt_characteristic_read_notifications( struct bluetooth_gatt_characteristic *chrc,
+                                                                  IRP *irp, SIZE_T header_size, ULONG max_count,
+                                                                  ULONG *count, ULONG *overflow_count,
+                                                                  ULONG *data_size, UCHAR *data )
+{
+    IO_STACK_LOCATION *stack = IoGetCurrentIrpStackLocation( irp );
+    ULONG outsize = stack->Parameters.DeviceIoControl.OutputBufferLength;
+    struct bluetooth_remote_device *device = chrc->service->device;
+    unsigned int records = 0, size = 0, overflow = 0;
+    NTSTATUS status;
+
+    status = winebluetooth_gatt_characteristic_read_notifications( chrc->characteristic, data, outsize - header_size,
+                                                                   max_count, &records, &size, &overflow );
+    EnterCriticalSection( &device->gatt_cs );
+    if (status == STATUS_SUCCESS)
+    {
+        const struct bluetooth_gatt_notification_record *record = NULL;
+        unsigned int pos;
+
+        *count = records;
+        *overflow_count = overflow;
+        *data_size = size;
+        irp->IoStatus.Information = header_size + size;
+
+        for (pos = 0; pos + sizeof(*record) <= size; pos += sizeof(*record) + record->size)
+            record = (const struct bluetooth_gatt_notification_record *)(data + pos);
+        if (record)
+            bluetooth_gatt_characteristic_cache_value( chrc, record->timestamp, (const UCHAR *)(record + 1),
+                                                       record->size );
+        /* If the next value would have fit, and wasn't held back by max_count, there is none left. */
+        if ((!max_count || records < max_count) &&
+            outsize - header_size - size >= sizeof(*record) + WINEBLUETOOTH_GATT_MAX_VALUE_SIZE)
+            chrc->cached_value_stale = FALSE;
+    }
+    else
+    {
+        if (status == STATUS_TIMEOUT) chrc->cached_value_stale = FALSE;
+        irp->IoStatus.Information = 0;
+    }
+    LeaveCriticalSection( &device->gatt_cs );
+    return status;
+}
+
+/* Fills a READ_NOTIFICATION or READ_NOTIFICATIONS IRP with the oldest values queued for the characteristic. This
+ * never blocks, and returns STATUS_TIMEOUT if nothing has been queued yet. */
+static NTSTATUS bluetooth_gatt_characteristic_read_notification( struct bluetooth_gatt_characteristic *chrc, IRP *irp )
+{
+    IO_STACK_LOCATION *stack = IoGetCurrentIrpStackLocation( irp );
+    ULONG outsize = stack->Parameters.DeviceIoControl.OutputBufferLength;
+    unsigned int data_size = 0;
+    SIZE_T header_size;
+    ULONG *data_size_ptr;
+    UCHAR *data;
+    NTSTATUS status;
+
+    switch (stack->Parameters.DeviceIoControl.IoControlCode)
+    {
+    case IOCTL_WINEBTH_RADIO_READ_NOTIFICATIONS:
+    {
+        struct winebth_radio_read_notifications_params *params = irp->AssociatedIrp.SystemBuffer;
+
+        return bluetooth_gatt_characteristic_read_notifications(
+            chrc, irp, offsetof( struct winebth_radio_read_notifications_params, data[0] ), params->max_count,
+            &params->count, &params->overflow_count, &params->data_size, params->data );
+    }
+    case IOCTL_WINEBTH_LE_DEVICE_READ_NOTIFICATIONS:
+    {
+        struct winebth_le_device_read_notifications_params *params = irp->AssociatedIrp.SystemBuffer;
+
+        return bluetooth_gatt_characteristic_read_notifications(
+            chrc, irp, offsetof( struct winebth_le_device_read_notifications_params, data[0] ), params->max_count,
+            &params->count, &params->overflow_count, &params->data_size, params->data );
+    }
+    case IOCTL_WINEBTH_RADIO_READ_NOTIFICATION:
+    {
+        struct winebth_radio_read_notification_params *params = irp->AssociatedIrp.SystemBuffer;
+
+        header_size = offsetof( struct winebth_radio_read_notification_params, data[0] );
+        data_size_ptr = &params->data_size;
+        data = params->data;
+        break;
+    }
+    default:
+    {
+        struct winebth_le_device_read_notification_params *params = irp->AssociatedIrp.SystemBuffer;
+
+        header_size = offsetof( struct winebth_le_device_read_notification_params, data[0] );
+        data_size_ptr = &params->data_size;
+        data = params->data;
+        break;
+    }
+    }
+
+    status = winebluetooth_gatt_characteristic_read_notification( chrc->characteristic, data,
+                                                                  outsize > header_size ? outsize - header_size : 0,
+                                                                  &data_size );
+    EnterCriticalSection( &chrc->service->device->gatt_cs );
+    if (status == STATUS_SUCCESS)
+    {
+        *data_size_ptr = data_size;
+        irp->IoStatus.Information = header_size + data_size;
+        bluetooth_gatt_characteristic_cache_value( chrc, bluetooth_gatt_value_timestamp(), data, data_size );
+    }
+    else
+    {
+        if (status == STATUS_TIMEOUT) chrc->cached_value_stale = FALSE;
+        irp->IoStatus.Information = 0;
+    }
+    LeaveCriticalSection( &chrc->service->device->gatt_cs );
+    return status;
+}
+
+/* Completes a READ_NOTIFICATION IRP right away if a value is already queued for the characteristic, otherwise
+ * marks it pending until the next BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_VALUE_CHANGED event.
+ * Caller should hold device_list_cs and the radio's devices_lock. */
+static NTSTATUS bluetooth_gatt_characteristic_queue_notification_irp( struct bluetooth_gatt_characteristic *chrc,
+                                                                      IRP *irp )
+{
+    NTSTATUS status;
+
+    /* Only the oldest pending IRP may take a value, so that notifications get delivered in order. */
+    if (!IsListEmpty( &chrc->notification_irps ))
+        status = STATUS_TIMEOUT;
+    else
+        status = bluetooth_gatt_characteristic_read_notification( chrc, irp );
+    if (status != STATUS_TIMEOUT) return status;
+
+    IoSetCancelRoutine( irp, bluetooth_irp_cancel_routine );
+    if (irp->Cancel && IoSetCancelRoutine( irp, NULL ) != NULL)
+    {
+        irp->IoStatus.Information = 0;
+        return STATUS_CANCELLED;
+    }
+    IoMarkIrpPending( irp );
+    InsertTailList( &chrc->notification_irps, &irp->Tail.Overlay.ListEntry );
+    return STATUS_PENDING;
+}
+
+C_ASSERT( WINEBTH_DISCOVERY_FILTER_MAX_UUIDS == BLUETOOTH_DISCOVERY_FILTER_MAX_UUIDS );
+
+/* The filter used by inquiries that nobody set one for, which look for BR/EDR devices. */
+static void bluetooth_discovery_filter_init( struct winebluetooth_discovery_filter *filter )
+{
+    memset( filter, 0, sizeof( *filter ) );
+    filter->transport = BLUETOOTH_DISCOVERY_TRANSPORT_BREDR;
+    filter->flags = BLUETOOTH_DISCOVERY_FILTER_DUPLICATE_DATA;
+}
+
+/* Caller should hold device_list_cs. */
+static void bluetooth_radio_flush_advertisements( struct bluetooth_radio *radio )
+{
+    struct bluetooth_advertisement *adv, *next;
+
+    LIST_FOR_EACH_ENTRY_SAFE( adv, next, &radio->advertisements, struct bluetooth_advertisement, entry )
+    {
+        list_remove( &adv->entry );
+        free( adv );
+    }
+    radio->advertisements_count = 0;
+}
+
+/* Queues the current state of a remote device for IOCTL_WINEBTH_RADIO_READ_ADVERTISEMENTS, replacing the record
+ * still queued for it, if any. Caller should hold device_list_cs. */
+static void bluetooth_radio_queue_advertisement( struct bluetooth_radio *radio,
+                                                 winebluetooth_device_props_mask_t props_mask,
+                                                 const struct winebluetooth_device_properties *props )
+{
+    USHORT manufacturer_data_size = 0, service_data_size = 0;
+    struct bluetooth_advertisement *adv, *cur;
+
+    if (!radio->discovering) return;
+    if (props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_MANUFACTURER_DATA)
+        manufacturer_data_size = props->manufacturer_data_size;
+    if (props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_SERVICE_DATA)
+        service_data_size = props->service_data_size;
+    adv = calloc( 1, offsetof( struct bluetooth_advertisement,
+                               record.data[manufacturer_data_size + service_data_size] ) );
+    if (!adv) return;
+    adv->size = offsetof( struct winebth_advertisement_record, data[manufacturer_data_size + service_data_size] );
+    winebluetooth_device_properties_to_info( props_mask, props, &adv->record.info );
+    if (props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_RSSI)
+    {
+        adv->record.info.flags |= WINEBTH_ADVERTISEMENT_RSSI;
+        adv->record.rssi = props->rssi;
+    }
+    adv->record.manufacturer_data_size = manufacturer_data_size;
+    adv->record.service_data_size = service_data_size;
+    memcpy( adv->record.data, props->manufacturer_data, manufacturer_data_size );
+    memcpy( adv->record.data + manufacturer_data_size, props->service_data, service_data_size );
+
+    LIST_FOR_EACH_ENTRY( cur, &radio->advertisements, struct bluetooth_advertisement, entry )
+    {
+        if (cur->record.info.address == adv->record.info.address)
+        {
+            list_remove( &cur->entry );
+            radio->advertisements_count--;
+            free( cur );
+            break;
+        }
+    }
+    if (radio->advertisements_count == BLUETOOTH_MAX_QUEUED_ADVERTISEMENTS)
+    {
+        cur = LIST_ENTRY( list_head( &radio->advertisements ), struct bluetooth_advertisement, entry );
+        list_remove( &cur->entry );
+        radio->advertisements_count--;
+        radio->advertisements_overflow++;
+        free( cur );
+    }
+    list_add_tail( &radio->advertisements, &adv->entry );
+    radio->advertisements_count++;
+}
+
+/* Fills a READ_ADVERTISEMENTS IRP with as many of the queued records as fit, oldest first. This never blocks, and
+ * returns STATUS_TIMEOUT if nothing has been queued yet. Caller should hold device_list_cs. */
+static NTSTATUS bluetooth_radio_read_advertisements( struct bluetooth_radio *radio, IRP *irp )
+{
+    const SIZE_T header_size = offsetof( struct winebth_radio_read_advertisements_params, data[0] );
+    IO_STACK_LOCATION *stack = IoGetCurrentIrpStackLocation( irp );
+    ULONG outsize = stack->Parameters.DeviceIoControl.OutputBufferLength;
+    struct winebth_radio_read_advertisements_params *params = irp->AssociatedIrp.SystemBuffer;
+    struct bluetooth_advertisement *adv, *next;
+    ULONG count = 0, size = 0;
+
+    irp->IoStatus.Information = 0;
+    if (list_empty( &radio->advertisements )) return STATUS_TIMEOUT;
+
+    LIST_FOR_EACH_ENTRY_SAFE( adv, next, &radio->advertisements, struct bluetooth_advertisement, entry )
+    {
+        if (adv->size > outsize - header_size - size) break;
+        memcpy( params->data + size, &adv->record, adv->size );
+        size += adv->size;
+        count++;
+        list_remove( &adv->entry );
+        radio->advertisements_count--;
+        free( adv );
+    }
+    if (!count) return STATUS_BUFFER_TOO_SMALL;
+
+    params->count = count;
+    params->overflow_count = radio->advertisements_overflow;
+    params->data_size = size;
+    irp->IoStatus.Information = header_size + size;
+    return STATUS_SUCCESS;
+}
+
+/* Hands out the queued records to the pending READ_ADVERTISEMENTS IRPs, oldest first, until the queue runs dry.
+ * Caller should hold device_list_cs. */
+static void bluetooth_radio_complete_advertisement_irps( struct bluetooth_radio *radio )
+{
+    while (!IsListEmpty( &radio->advertisement_irps ) && !list_empty( &radio->advertisements ))
+    {
+        IRP *irp = CONTAINING_RECORD( radio->advertisement_irps.Flink, IRP, Tail.Overlay.ListEntry );
+
+        RemoveEntryList( &irp->Tail.Overlay.ListEntry );
+        /* If it is being cancelled, the cancel routine will remove it once we release device_list_cs. */
+        InitializeListHead( &irp->Tail.Overlay.ListEntry );
+        if (IoSetCancelRoutine( irp, NULL ) == NULL) continue;
+
+        irp->IoStatus.Status = bluetooth_radio_read_advertisements( radio, irp );
+        IoCompleteRequest( irp, IO_NO_INCREMENT );
+    }
+}
+
+/* Completes a READ_ADVERTISEMENTS IRP right away if records are already queued, otherwise marks it pending until
+ * the next device gets seen or updated. Caller should hold device_list_cs. */
+static NTSTATUS bluetooth_radio_queue_advertisement_irp( struct bluetooth_radio *radio, IRP *irp )
+{
+    NTSTATUS status;
+
+    /* Only the oldest pending IRP may take records, so that they get delivered in order. */
+    if (!IsListEmpty( &radio->advertisement_irps ))
+        status = STATUS_TIMEOUT;
+    else
+        status = bluetooth_radio_read_advertisements( radio, irp );
+    if (status != STATUS_TIMEOUT) return status;
+
+    IoSetCancelRoutine( irp, bluetooth_irp_cancel_routine );
+    if (irp->Cancel && IoSetCancelRoutine( irp, NULL ) != NULL)
+    {
+        irp->IoStatus.Information = 0;
+        return STATUS_CANCELLED;
+    }
+    IoMarkIrpPending( irp );
+    InsertTailList( &radio->advertisement_irps, &irp->Tail.Overlay.ListEntry );
+    return STATUS_PENDING;
+}
+
+/* Starts queueing advertisement records for the radio, beginning with every remote device it already knows, the
+ * same way they would have been reported had discovery been running all along. */
+static void bluetooth_radio_begin_advertisements( struct bluetooth_radio *radio )
+{
+    struct bluetooth_remote_device *device;
+
+    device_list_lock();
+    if (!radio->discovering)
+    {
+        radio->discovering = TRUE;
+        bluetooth_radio_lock_shared( radio );
+        LIST_FOR_EACH_ENTRY( device, &radio->remote_devices, struct bluetooth_remote_device, entry )
+        {
+            device_props_lock( device );
+            bluetooth_radio_queue_advertisement( radio, device->props_mask, &device->props );
+            device_props_unlock( device );
+        }
+        bluetooth_radio_unlock( radio );
+        bluetooth_radio_complete_advertisement_irps( radio );
+    }
+    device_list_unlock();
+}
+
+static void bluetooth_radio_end_advertisements( struct bluetooth_radio *radio )
+{
+    device_list_lock();
+    radio->discovering = FALSE;
+    bluetooth_discovery_filter_init( &radio->discovery_filter );
+    bluetooth_radio_flush_advertisements( radio );
+    complete_pending_irps( &radio->advertisement_irps, STATUS_CANCELLED );
+    device_list_unlock();
+}
+
+/* Fills a WAIT_CONNECTION_CHANGES IRP with the current connection state of every device that connected or
+ * disconnected after the caller's generation. Returns STATUS_PENDING if none did. Caller should hold device_list_cs. */
+static NTSTATUS bluetooth_radio_get_connection_changes( struct bluetooth_radio *radio, IRP *irp )
+{
+    const SIZE_T header_size = offsetof( struct winebth_radio_wait_connection_changes_params, changes[0] );
+    IO_STACK_LOCATION *stack = IoGetCurrentIrpStackLocation( irp );
+    ULONG outsize = stack->Parameters.DeviceIoControl.OutputBufferLength;
+    struct winebth_radio_wait_connection_changes_params *params = irp->AssociatedIrp.SystemBuffer;
+    SIZE_T max_count = (outsize - header_size) / sizeof( params->changes[0] );
+    struct bluetooth_remote_device *device;
+    ULONGLONG since = params->generation;
+    ULONG count = 0, flags = 0;
+
+    /* The generation came from a radio that has since been removed, so it means nothing here. */
+    if (since > radio->connection_generation) since = 0;
+    if (since == radio->connection_generation) return STATUS_PENDING;
+
+    LIST_FOR_EACH_ENTRY( device, &radio->remote_devices, struct bluetooth_remote_device, entry )
+    {
+        struct winebth_connection_change *change;
+
+        if (device->connection_generation <= since) continue;
+        if (count == max_count)
+        {
+            flags |= WINEBTH_CONNECTION_CHANGES_OVERFLOW;
+            break;
+        }
+        change = &params->changes[count++];
+        device_props_lock( device );
+        change->address = device->props.address.ullLong;
+        change->connected = device->props.connected;
+        device_props_unlock( device );
+    }
+
+    params->generation = radio->connection_generation;
+    params->flags = flags;
+    params->count = count;
+    irp->IoStatus.Information = header_size + count * sizeof( params->changes[0] );
+    return STATUS_SUCCESS;
+}
+
+/* Completes a WAIT_CONNECTION_CHANGES IRP right away if a device connected or disconnected since the caller's
+ * generation, otherwise marks it pending until one does. Caller should hold device_list_cs. */
+static NTSTATUS bluetooth_radio_queue_connection_irp( struct bluetooth_radio *radio, IRP *irp )
+{
+    NTSTATUS status;
+
+    if ((status = bluetooth_radio_get_connection_changes( radio, irp )) != STATUS_PENDING) return status;
+
+    IoSetCancelRoutine( irp, bluetooth_irp_cancel_routine );
+    if (irp->Cancel && IoSetCancelRoutine( irp, NULL ) != NULL)
+    {
+        irp->IoStatus.Information = 0;
+        return STATUS_CANCELLED;
+    }
+    IoMarkIrpPending( irp );
+    InsertTailList( &radio->connection_irps, &irp->Tail.Overlay.ListEntry );
+    return STATUS_PENDING;
+}
+
+/* Bumps the radio's connection generation for a device that just connected or disconnected, and wakes up every
+ * pending WAIT_CONNECTION_CHANGES IRP. Caller should hold device_list_cs. */
+static void bluetooth_radio_device_connection_changed( struct bluetooth_radio *radio,
+                                                       struct bluetooth_remote_device *device )
+{
+    LIST_ENTRY *entry;
+
+    device->connection_generation = ++radio->connection_generation;
+    while ((entry = RemoveHeadList( &radio->connection_irps )) != &radio->connection_irps)
+    {
+        IRP *irp = CONTAINING_RECORD( entry, IRP, Tail.Overlay.ListEntry );
+
+        /* If it is being cancelled, the cancel routine will remove it once we release device_list_cs. */
+        InitializeListHead( entry );
+        if (IoSetCancelRoutine( irp, NULL ) == NULL) continue;
+
+        irp->IoStatus.Status = bluetooth_radio_get_connection_changes( radio, irp );
+        IoCompleteRequest( irp, IO_NO_INCREMENT );
+    }
+}
+
+/* Characteristic reads and writes don't block the dispatch routine. They are parked on their device's gatt_io_irps
+ * while the backend performs them, and completed from the event loop once it reports their result through a
+ * BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_IO_FINISHED event. The backends send the requests for a device
+ * to it in the order they are started, and ATT handles them one at a time, so they normally finish in order as
+ * well. While parked, DriverContext[0] holds the characteristic the request is for, and DriverContext[3] the device,
+ * see bluetooth_device_park_gatt_irp. */
+
+/* Fills in the output of a characteristic read or write. */
+static void bluetooth_gatt_io_irp_set_result( IRP *irp, NTSTATUS status, const unsigned char *value, UINT32 size )
+{
+    IO_STACK_LOCATION *stack = IoGetCurrentIrpStackLocation( irp );
+    ULONG outsize = stack->Parameters.DeviceIoControl.OutputBufferLength;
+
+    irp->IoStatus.Status = status;
+    irp->IoStatus.Information = 0;
+    if (status != STATUS_SUCCESS) return;
+
+    switch (stack->Parameters.DeviceIoControl.IoControlCode)
+    {
+    case IOCTL_WINEBTH_RADIO_READ_CHARACTERISTIC:
+    {
+        const SIZE_T min_size = offsetof( struct winebth_radio_read_characteristic_params, data[0] );
+        struct winebth_radio_read_characteristic_params *params = irp->AssociatedIrp.SystemBuffer;
+
+        params->data_size = min( size, outsize - min_size );
+        memcpy( params->data, value, params->data_size );
+        irp->IoStatus.Information = min_size + params->data_size;
+        break;
+    }
+    case IOCTL_WINEBTH_LE_DEVICE_READ_CHARACTERISTIC:
+    {
+        const SIZE_T min_size = offsetof( struct winebth_le_device_read_characteristic_params, data[0] );
+        struct winebth_le_device_read_characteristic_params *params = irp->AssociatedIrp.SystemBuffer;
+
+        params->data_size = min( size, outsize - min_size );
+        memcpy( params->data, value, params->data_size );
+        irp->IoStatus.Information = min_size + params->data_size;
+        break;
+    }
+    case IOCTL_WINEBTH_RADIO_WRITE_CHARACTERISTIC:
+    {
+        const struct winebth_radio_write_characteristic_params *params = irp->AssociatedIrp.SystemBuffer;
+
+        irp->IoStatus.Information = offsetof( struct winebth_radio_write_characteristic_params, data[0] ) +
+                                    params->data_size;
+        break;
+    }
+    }
+}
+
+/* Completes a READ_CHARACTERISTIC IRP with the cached value of the characteristic, if the request allows for it.
+ * Returns STATUS_PENDING if the value has to be read from the device instead. Caller should hold the device's
+ * gatt_cs. */
+static NTSTATUS bluetooth_gatt_characteristic_read_cached( struct bluetooth_gatt_characteristic *chrc, IRP *irp,
+                                                           ULONG flags )
+{
+    const struct bluetooth_gatt_cached_value *value = chrc->cached_value;
+
+    if (!(flags & (WINEBTH_READ_CHARACTERISTIC_CACHED | WINEBTH_READ_CHARACTERISTIC_CACHED_ONLY)))
+        return STATUS_PENDING;
+    if (!value)
+        return flags & WINEBTH_READ_CHARACTERISTIC_CACHED_ONLY ? STATUS_NOT_FOUND : STATUS_PENDING;
+    if (chrc->cached_value_stale && !(flags & WINEBTH_READ_CHARACTERISTIC_CACHED_ONLY))
+        return STATUS_PENDING;
+
+    bluetooth_gatt_io_irp_set_result( irp, STATUS_SUCCESS, value->data, value->size );
+    return STATUS_SUCCESS;
+}
+
+/* Completes a parked characteristic read or write with the result from the backend, unless it has been cancelled,
+ * or completed because the characteristic or its device went away. The caller should hold a reference to the
+ * device. */
+static void bluetooth_device_gatt_io_finished( struct bluetooth_remote_device *device, IRP *irp, NTSTATUS result,
+                                               const unsigned char *value, UINT32 size )
+{
+    struct bluetooth_gatt_characteristic *chrc;
+    LIST_ENTRY *cur;
+
+    EnterCriticalSection( &device->gatt_cs );
+    /* The IRP may be gone already, so only compare its address until it is found. As requests finish in the order
+     * they were started, it is usually the first one. */
+    for (cur = device->gatt_io_irps.Flink; cur != &device->gatt_io_irps; cur = cur->Flink)
+    {
+        if (cur != &irp->Tail.Overlay.ListEntry) continue;
+
+        chrc = irp->Tail.Overlay.DriverContext[0];
+        switch (IoGetCurrentIrpStackLocation( irp )->Parameters.DeviceIoControl.IoControlCode)
+        {
+        case IOCTL_WINEBTH_RADIO_READ_CHARACTERISTIC:
+        case IOCTL_WINEBTH_LE_DEVICE_READ_CHARACTERISTIC:
+            if (result != STATUS_SUCCESS) break;
+            bluetooth_gatt_characteristic_cache_value( chrc, bluetooth_gatt_value_timestamp(), value, size );
+            chrc->cached_value_stale = FALSE;
+            break;
+        default:
+            /* Whatever the device made of a write, the cached value may not be current anymore. */
+            chrc->cached_value_stale = TRUE;
+            break;
+        }
+        if (bluetooth_device_unpark_gatt_irp( irp ))
+        {
+            bluetooth_gatt_io_irp_set_result( irp, result, value, size );
+            IoCompleteRequest( irp, IO_NO_INCREMENT );
+            bluetooth_device_decref( device );
+        }
+        break;
+    }
+    LeaveCriticalSection( &device->gatt_cs );
+}
+
+/* Called from the event loop once the backend has performed a read or write. */
+static void bluetooth_gatt_characteristic_io_finished( winebluetooth_gatt_characteristic_t handle, IRP *irp,
+                                                       NTSTATUS result, const unsigned char *value, UINT32 size )
+{
+    struct bluetooth_remote_device *device = NULL;
+    struct bluetooth_radio *radio;
+
+    device_list_lock();
+    LIST_FOR_EACH_ENTRY( radio, &device_list, struct bluetooth_radio, entry )
+    {
+        struct bluetooth_gatt_characteristic *chrc;
+
+        if (!(chrc = bluetooth_radio_find_characteristic( radio, handle ))) continue;
+        device = chrc->service->device;
+        bluetooth_device_incref( device );
+        break;
+    }
+    device_list_unlock();
+
+    if (!device) return;
+    bluetooth_device_gatt_io_finished( device, irp, result, value, size );
+    bluetooth_device_decref( device );
+}
+
+/* Parks a characteristic read or write until the backend has performed it, and returns the handle to start it on.
+ * The IRP must not be accessed after starting the operation, as it can be completed at any point from then on, so
+ * anything the backend needs from it has to be copied beforehand. The caller gets a reference to the device as well,
+ * which is dropped by bluetooth_gatt_io_irp_started.
+ * Caller should hold radio->devices_lock and the device's gatt_cs. */
+static NTSTATUS bluetooth_device_queue_gatt_io_irp( struct bluetooth_remote_device *device,
+                                                    struct bluetooth_gatt_characteristic *chrc, IRP *irp,
+                                                    winebluetooth_gatt_characteristic_t *characteristic )
+{
+    NTSTATUS status;
+
+    if (device->state == BLUETOOTH_STATE_REMOVING)
+        return STATUS_DEVICE_NOT_CONNECTED;
+
+    irp->Tail.Overlay.DriverContext[0] = chrc;
+    if ((status = bluetooth_device_park_gatt_irp( device, &device->gatt_io_irps, irp )) != STATUS_PENDING)
+        return status;
+    bluetooth_device_incref( device );
+    winebluetooth_gatt_characteristic_dup(( *characteristic = chrc->characteristic ));
+    return STATUS_PENDING;
+}
+
+/* Takes the status the backend returned when starting a parked read or write. Unless it is STATUS_PENDING, the
+ * backend won't report a result for the operation later, so the IRP gets completed with it right away. */
+static void bluetooth_gatt_io_irp_started( struct bluetooth_remote_device *device,
+                                           winebluetooth_gatt_characteristic_t characteristic, IRP *irp,
+                                           NTSTATUS status )
+{
+    if (status != STATUS_PENDING)
+        bluetooth_device_gatt_io_finished( device, irp, status, NULL, 0 );
+    winebluetooth_gatt_characteristic_free( characteristic );
+    bluetooth_device_decref( device );
+}
+
+/* A WRITE_CHARACTERISTIC_STREAM request. The backend blocks until the whole buffer has been written, so it runs on
+ * a work item, and keeps checking the Cancel flag of the IRP in between the packets. */
+struct bluetooth_gatt_write_stream
+{
+    IRP *irp;
+    PIO_WORKITEM item;
+    winebluetooth_gatt_characteristic_t characteristic;
+    const unsigned char *data;
+    ULONG size;
+    /* Points into the request's buffer, and is followed by the data. */
+    struct winebth_gatt_write_stream_result *result;
+    SIZE_T result_end;
+};
+
+static void WINAPI bluetooth_gatt_write_stream_worker( DEVICE_OBJECT *device, void *context )
+{
+    struct bluetooth_gatt_write_stream *stream = context;
+    unsigned int mtu = 0, packets = 0, written = 0;
+    IRP *irp = stream->irp;
+    LARGE_INTEGER start, end;
+    NTSTATUS status;
+
+    KeQuerySystemTime( &start );
+    status = winebluetooth_gatt_characteristic_write_stream( stream->characteristic, stream->data, stream->size,
+                                                             &irp->Cancel, &mtu, &packets, &written );
+    KeQuerySystemTime( &end );
+    TRACE( "characteristic %#Ix: %u of %lu bytes in %u packets, MTU %u: %#lx\n", stream->characteristic.handle,
+           written, stream->size, packets, mtu, status );
+
+    irp->IoStatus.Information = 0;
+    if (!status)
+    {
+        struct winebth_gatt_write_stream_result *result = stream->result;
+
+        result->mtu = mtu;
+        result->packets = packets;
+        result->bytes_written = written;
+        result->elapsed = max( end.QuadPart - start.QuadPart, 0 );
+        result->bytes_per_second = result->elapsed ? result->bytes_written * 10000000 / result->elapsed : 0;
+        irp->IoStatus.Information = stream->result_end;
+    }
+    irp->IoStatus.Status = status;
+    IoCompleteRequest( irp, IO_NO_INCREMENT );
+
+    winebluetooth_gatt_characteristic_free( stream->characteristic );
+    IoFreeWorkItem( stream->item );
+    free( stream );
+}
+
+/* Queues a WRITE_CHARACTERISTIC_STREAM request to be written out by a work item, which completes it. result_end is
+ * the offset of the data in the request's buffer. Caller should hold radio->devices_lock. */
+static NTSTATUS bluetooth_gatt_characteristic_start_write_stream( struct bluetooth_gatt_characteristic *chrc,
+                                                                  IRP *irp, const unsigned char *data, ULONG size,
+                                                                  struct winebth_gatt_write_stream_result *result,
+                                                                  SIZE_T result_end )
+{
+    struct bluetooth_gatt_write_stream *stream;
+
+    if (!chrc->props.IsWritableWithoutResponse)
+        return STATUS_INVALID_PARAMETER;
+    if (!(stream = calloc( 1, sizeof( *stream ) )))
+        return STATUS_NO_MEMORY;
+    if (!(stream->item = IoAllocateWorkItem( IoGetCurrentIrpStackLocation( irp )->DeviceObject )))
+    {
+        free( stream );
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    stream->irp = irp;
+    stream->data = data;
+    stream->size = size;
+    stream->result = result;
+    stream->result_end = result_end;
+    winebluetooth_gatt_characteristic_dup(( stream->characteristic = chrc->characteristic ));
+    IoMarkIrpPending( irp );
+    IoQueueWorkItem( stream->item, bluetooth_gatt_write_stream_worker, DelayedWorkQueue, stream );
+    return STATUS_PENDING;
+}
+
+/* Asks the backend for the ATT MTU, using the characteristic that bluetooth_device_find_mtu_characteristic picks.
+ * Caller should hold radio->devices_lock, which gets released. */
+static NTSTATUS bluetooth_device_get_att_mtu( struct bluetooth_radio *radio, struct bluetooth_remote_device *device,
+                                              const BTH_LE_GATT_SERVICE *service,
+                                              const BTH_LE_GATT_CHARACTERISTIC *char_props, ULONG *mtu )
+{
+    winebluetooth_gatt_characteristic_t characteristic;
+    struct bluetooth_gatt_characteristic *chrc;
+    unsigned int value = 0;
+    NTSTATUS status;
+
+    if (!(chrc = bluetooth_device_find_mtu_characteristic( device, service, char_props )))
+    {
+        bluetooth_radio_unlock( radio );
+        return char_props->AttributeHandle ? STATUS_INVALID_PARAMETER : STATUS_DEVICE_NOT_CONNECTED;
+    }
+    winebluetooth_gatt_characteristic_dup(( characteristic = chrc->characteristic ));
+    bluetooth_radio_unlock( radio );
+
+    status = winebluetooth_gatt_characteristic_get_mtu( characteristic, &value );
+    winebluetooth_gatt_characteristic_free( characteristic );
+    *mtu = value;
+    return status;
+}
+
+static NTSTATUS bluetooth_remote_device_gatt_request( struct bluetooth_remote_device *device, IRP *irp, BOOL wait );
+
+static NTSTATUS bluetooth_remote_device_dispatch( DEVICE_OBJECT *device, struct bluetooth_remote_device *ext, IRP *irp )
+{
+    IO_STACK_LOCATION *stack = IoGetCurrentIrpStackLocation( irp );
+    ULONG outsize = stack->Parameters.DeviceIoControl.OutputBufferLength;
+    ULONG code = stack->Parameters.DeviceIoControl.IoControlCode;
+    NTSTATUS status = irp->IoStatus.Status;
+
+    TRACE( "device=%p, ext=%p, irp=%p, code=%#lx\n", device, ext, irp, code );
+
+    /* State check for device-specific IOCTLs */
+    device_list_lock();
+    if (ext->macos_invalidated)
+    {
+        device_list_unlock();
+        status = STATUS_DEVICE_NOT_CONNECTED;
+        irp->IoStatus.Status = status;
+        IoCompleteRequest( irp, IO_NO_INCREMENT );
+        return status;
+    }
+    if (ext->state != BLUETOOTH_STATE_ACTIVE)
+    {
+        device_list_unlock();
+        status = STATUS_DEVICE_NOT_CONNECTED;
+        irp->IoStatus.Status = status;
+        IoCompleteRequest( irp, IO_NO_INCREMENT );
+        return status;
+    }
+    device_list_unlock();
+
+    switch (code)
+    {
+    case IOCTL_WINEBTH_LE_DEVICE_GET_GATT_SERVICES:
+    {
+        const SIZE_T min_size = offsetof( struct winebth_le_device_get_gatt_services_params, services[0] );
+        struct winebth_le_device_get_gatt_services_params *services = irp->AssociatedIrp.SystemBuffer;
+        struct bluetooth_gatt_service *svc;
+        SIZE_T rem;
+        BOOL need_connect = FALSE;
+        BOOL connected = FALSE, resolved;
+
+        if (!services || outsize < min_size)
+        {
+            status = STATUS_INVALID_USER_BUFFER;
+            break;
+        }
+
+        rem = (outsize - min_size)/sizeof( *services->services );
+        status = STATUS_SUCCESS;
+        services->count = 0;
+
+        device_list_lock();
+        if (ext->macos_invalidated || ext->state != BLUETOOTH_STATE_ACTIVE)
+        {
+            device_list_unlock();
+            status = STATUS_DEVICE_NOT_CONNECTED;
+            break;
+        }
+        device_list_unlock();
+
+        device_props_lock( ext );
+        connected = ext->props.connected;
+        resolved = ext->props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_SERVICES_RESOLVED && ext->props.services_resolved;
+        device_props_unlock( ext );
+
+        bluetooth_radio_lock_shared( ext->radio );
+
+        TRACE( "GET_GATT_SERVICES: device=%p device.handle=%p name='%s' gatt_empty=%d connected=%d\n",
+               ext, (void*)ext->device.handle, ext->props.name,
+               list_empty( &ext->gatt_services ), connected );
+        if (list_empty( &ext->gatt_services ) && !connected)
+        {
+            need_connect = TRUE;
+            TRACE( "GATT services requested but device not connected, triggering connect\n" );
+        }
+        if (!resolved && ext->gatt_db)
+        {
+            services->count = bluetooth_gatt_database_get_services( ext->gatt_db, services->services, rem );
+            rem -= min( rem, services->count );
+        }
+        else LIST_FOR_EACH_ENTRY( svc, &ext->gatt_services, struct bluetooth_gatt_service, entry )
+        {
+            if (!svc->primary)
+                continue;
+            services->count++;
+            if (rem)
+            {
+                BTH_LE_GATT_SERVICE *info;
+
+                info = &services->services[services->count - 1];
+                memset( info, 0, sizeof( *info ) );
+                uuid_to_le( &svc->uuid, &info->ServiceUuid );
+                info->AttributeHandle = svc->handle;
+                rem--;
+            }
+        }
+        bluetooth_radio_unlock( ext->radio );
+
+        if (need_connect)
+        {
+            NTSTATUS pair_status = winebluetooth_device_start_pairing( ext->device, NULL );
+            (void)pair_status;
+        }
+
+        irp->IoStatus.Information = offsetof( struct winebth_le_device_get_gatt_services_params, services[services->count] );
+        if (services->count > rem)
+            status = STATUS_MORE_ENTRIES;
+        break;
+    }
+    case IOCTL_WINEBTH_LE_DEVICE_GET_GATT_DATABASE:
+    {
+        struct winebth_gatt_database *db = irp->AssociatedIrp.SystemBuffer;
+        BOOL resolved;
+
+        if (!db || outsize < WINEBTH_GATT_DATABASE_SIZE( 0, 0 ))
+        {
+            status = STATUS_INVALID_USER_BUFFER;
+            break;
+        }
+
+        device_props_lock( ext );
+        resolved = ext->props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_SERVICES_RESOLVED && ext->props.services_resolved;
+        device_props_unlock( ext );
+
+        bluetooth_radio_lock_shared( ext->radio );
+        status = bluetooth_device_get_gatt_database( ext, resolved, db, outsize, &irp->IoStatus.Information );
+        bluetooth_radio_unlock( ext->radio );
+        break;
+    }
+    case IOCTL_WINEBTH_LE_DEVICE_GET_GATT_CHARACTERISTICS:
+    {
+        const SIZE_T min_size = offsetof( struct winebth_le_device_get_gatt_characteristics_params, characteristics[0] );
+        struct winebth_le_device_get_gatt_characteristics_params *chars = irp->AssociatedIrp.SystemBuffer;
+        const struct winebth_gatt_database_service *db_service = NULL;
+        struct bluetooth_gatt_characteristic *chrc;
+        struct bluetooth_gatt_service *service = NULL;
+        BOOL resolved;
+        SIZE_T rem;
+        GUID uuid;
+
+        if (!chars || outsize < min_size)
+        {
+            status = STATUS_INVALID_USER_BUFFER;
+            break;
+        }
 
         rem = (outsize - min_size)/sizeof( *chars->characteristics );
         status = STATUS_SUCCESS;
         chars->count = 0;
         le_to_uuid( &chars->service.ServiceUuid, &uuid );
 
-        EnterCriticalSection( &device_list_cs );
+        device_list_lock();
         if (ext->macos_invalidated || ext->state != BLUETOOTH_STATE_ACTIVE)
         {
-            LeaveCriticalSection( &device_list_cs );
+            device_list_unlock();
             status = STATUS_DEVICE_NOT_CONNECTED;
             break;
         }
-
-        service = find_gatt_service( &ext->gatt_services, &uuid, chars->service.AttributeHandle );
-        if (!service)
+        device_list_unlock();
+
+        device_props_lock( ext );
+        resolved = ext->props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_SERVICES_RESOLVED && ext->props.services_resolved;
+        device_props_unlock( ext );
+
+        bluetooth_radio_lock_shared( ext->radio );
+        if (!resolved && ext->gatt_db)
+            db_service = bluetooth_gatt_database_find_service( ext->gatt_db, &chars->service );
+        else
+            service = find_gatt_service( &ext->gatt_services, &uuid, chars->service.AttributeHandle );
+        if (!service && !db_service)
+        {
+            bluetooth_radio_unlock( ext->radio );
+            status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        if (db_service)
+        {
+            chars->count = bluetooth_gatt_database_get_characteristics(
+                db_service, bluetooth_gatt_database_characteristics( ext->gatt_db ), chars->characteristics, rem );
+            rem -= min( rem, chars->count );
+        }
+        else LIST_FOR_EACH_ENTRY( chrc, &service->characteristics, struct bluetooth_gatt_characteristic, entry )
+        {
+            chars->count++;
+            if (rem)
+            {
+                chars->characteristics[chars->count - 1] = chrc->props;
+                rem--;
+            }
+        }
+        bluetooth_radio_unlock( ext->radio );
+
+        /* Sort characteristics by UUID - some apps (e.g. Square Golf) stop iterating early
+         * and expect specific characteristics to appear before others. Windows appears to
+         * return characteristics sorted by UUID. */
+        if (chars->count > 1)
+            qsort( chars->characteristics, chars->count, sizeof(chars->characteristics[0]),
+                   compare_characteristics_by_uuid );
+
+        irp->IoStatus.Information = offsetof( struct winebth_le_device_get_gatt_characteristics_params, characteristics[chars->count] );
+        if (chars->count > rem)
+            status = STATUS_MORE_ENTRIES;
+        break;
+    }
+    case IOCTL_WINEBTH_LE_DEVICE_READ_CHARACTERISTIC:
+    case IOCTL_WINEBTH_LE_DEVICE_WRITE_CHARACTERISTIC:
+        status = bluetooth_remote_device_gatt_request( ext, irp, TRUE );
+        if (status == STATUS_PENDING) return status;
+        break;
+    case IOCTL_WINEBTH_LE_DEVICE_SET_NOTIFY:
+    {
+        struct winebth_le_device_set_notify_params *params = irp->AssociatedIrp.SystemBuffer;
+        winebluetooth_gatt_characteristic_t characteristic;
+        struct bluetooth_gatt_characteristic *chrc;
+        ULONG insize = stack->Parameters.DeviceIoControl.InputBufferLength;
+
+        if (!params || insize < sizeof(struct winebth_le_device_set_notify_params))
+        {
+            status = STATUS_INVALID_USER_BUFFER;
+            break;
+        }
+
+        /* device_list_cs guards the pending READ_NOTIFICATION IRPs. */
+        device_list_lock();
+        bluetooth_radio_lock_shared( ext->radio );
+        if (!(chrc = bluetooth_device_find_characteristic( ext, &params->service, &params->characteristic )))
+        {
+            bluetooth_radio_unlock( ext->radio );
+            device_list_unlock();
+            status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+        if (!params->enable)
+            complete_pending_irps( &chrc->notification_irps, STATUS_CANCELLED );
+        winebluetooth_gatt_characteristic_dup(( characteristic = chrc->characteristic ));
+        bluetooth_radio_unlock( ext->radio );
+        device_list_unlock();
+
+        status = winebluetooth_gatt_characteristic_set_notify(
+            characteristic,
+            params->enable,
+            params->overflow_policy );
+        winebluetooth_gatt_characteristic_free( characteristic );
+        break;
+    }
+    case IOCTL_WINEBTH_LE_DEVICE_READ_NOTIFICATION:
+    case IOCTL_WINEBTH_LE_DEVICE_READ_NOTIFICATIONS:
+    {
+        /* Both start with the same service and characteristic fields. */
+        struct winebth_le_device_read_notification_params *params = irp->AssociatedIrp.SystemBuffer;
+        struct bluetooth_gatt_characteristic *chrc;
+        ULONG insize = stack->Parameters.DeviceIoControl.InputBufferLength;
+        ULONG outsize = stack->Parameters.DeviceIoControl.OutputBufferLength;
+        const SIZE_T min_size = code == IOCTL_WINEBTH_LE_DEVICE_READ_NOTIFICATIONS ?
+            offsetof( struct winebth_le_device_read_notifications_params, data[0] ) :
+            offsetof( struct winebth_le_device_read_notification_params, data[0] );
+
+        if (!params || insize < min_size || outsize < min_size)
+        {
+            status = STATUS_INVALID_USER_BUFFER;
+            break;
+        }
+
+        device_list_lock();
+        bluetooth_radio_lock_shared( ext->radio );
+        if (!(chrc = bluetooth_device_find_characteristic( ext, &params->service, &params->characteristic )))
+            status = STATUS_INVALID_PARAMETER;
+        else
+            status = bluetooth_gatt_characteristic_queue_notification_irp( chrc, irp );
+        bluetooth_radio_unlock( ext->radio );
+        device_list_unlock();
+        if (status == STATUS_PENDING) return status;
+        break;
+    }
+    case IOCTL_WINEBTH_LE_DEVICE_WRITE_CHARACTERISTIC_STREAM:
+    {
+        const SIZE_T min_size = offsetof( struct winebth_le_device_write_characteristic_stream_params, data[0] );
+        struct winebth_le_device_write_characteristic_stream_params *params = irp->AssociatedIrp.SystemBuffer;
+        ULONG insize = stack->Parameters.DeviceIoControl.InputBufferLength;
+        struct bluetooth_gatt_characteristic *chrc;
+
+        if (!params || insize < min_size || outsize < min_size || insize - min_size < params->data_size)
+        {
+            status = STATUS_INVALID_USER_BUFFER;
+            break;
+        }
+
+        status = STATUS_INVALID_PARAMETER;
+        bluetooth_radio_lock_shared( ext->radio );
+        if ((chrc = bluetooth_device_find_characteristic( ext, &params->service, &params->characteristic )))
+            status = bluetooth_gatt_characteristic_start_write_stream( chrc, irp, params->data, params->data_size,
+                                                                       &params->result, min_size );
+        bluetooth_radio_unlock( ext->radio );
+        if (status == STATUS_PENDING) return status;
+        break;
+    }
+    case IOCTL_WINEBTH_LE_DEVICE_GET_ATT_MTU:
+    {
+        struct winebth_le_device_get_att_mtu_params *params = irp->AssociatedIrp.SystemBuffer;
+        ULONG insize = stack->Parameters.DeviceIoControl.InputBufferLength;
+
+        if (!params || insize < sizeof( *params ) || outsize < sizeof( *params ))
+        {
+            status = STATUS_INVALID_USER_BUFFER;
+            break;
+        }
+
+        bluetooth_radio_lock_shared( ext->radio );
+        status = bluetooth_device_get_att_mtu( ext->radio, ext, &params->service, &params->characteristic,
+                                               &params->mtu );
+        if (!status)
+            irp->IoStatus.Information = sizeof( *params );
+        break;
+    }
+    case IOCTL_WINEBTH_LE_DEVICE_GET_CONNECTION_STATUS:
+    {
+        BOOL *connected = irp->AssociatedIrp.SystemBuffer;
+
+        if (!connected || outsize < sizeof(BOOL))
+        {
+            status = STATUS_INVALID_USER_BUFFER;
+            break;
+        }
+
+        device_props_lock( ext );
+        *connected = ext->props.connected;
+        TRACE( "GET_CONNECTION_STATUS: returning connected=%d for device=%p\n", *connected, ext );
+        device_props_unlock( ext );
+
+        irp->IoStatus.Information = sizeof(BOOL);
+        status = STATUS_SUCCESS;
+        break;
+    }
+    default:
+        FIXME( "Unimplemented IOCTL code: %#lx\n", code );
+    }
+
+    irp->IoStatus.Status = status;
+    IoCompleteRequest( irp, IO_NO_INCREMENT );
+    return status;
+}
+
+/* GATT requests sent to a radio for a remote device that isn't ready yet are parked on the device's gatt_irps list,
+ * while the backend connects to it. The event loop retries them from a work item once the device has connected or
+ * resolved its services, and gatt_irp_timer does so once gatt_connect_timeout has passed. While parked,
+ * DriverContext[0] holds the IRP's deadline, DriverContext[1] the work item it is retried from, and DriverContext[3]
+ * the device, see bluetooth_device_park_gatt_irp.
+ *
+ * Whether a request can make progress is decided with the device's gatt_cs held, which the event loop takes as well
+ * before retrying the requests after a change, so that no request gets parked right after the retry missed it. */
+
+static NTSTATUS bluetooth_radio_gatt_request( struct bluetooth_radio *radio, IRP *irp, BOOL wait );
+
+static void bluetooth_device_get_gatt_state( struct bluetooth_remote_device *device, BOOL *connected,
+                                             BOOL *resolved )
+{
+    device_props_lock( device );
+    *connected = device->props.connected;
+    *resolved = device->props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_SERVICES_RESOLVED &&
+                device->props.services_resolved;
+    device_props_unlock( device );
+}
+
+static void bluetooth_gatt_irp_timer_start( DWORD timeout )
+{
+    DWORD due = GetTickCount() + timeout;
+    LARGE_INTEGER time;
+
+    /* A timer that is already set to fire earlier picks up the new deadline when it rescans the requests. */
+    EnterCriticalSection( &gatt_irp_timer_cs );
+    if (!gatt_irp_timer_set || (LONG)(due - gatt_irp_timer_due) < 0)
+    {
+        time.QuadPart = (LONGLONG)timeout * -10000;
+        SetThreadpoolTimer( gatt_irp_timer, (FILETIME *)&time, 0, 0 );
+        gatt_irp_timer_set = TRUE;
+        gatt_irp_timer_due = due;
+    }
+    LeaveCriticalSection( &gatt_irp_timer_cs );
+}
+
+/* Parks a GATT request until the device is ready. The caller should ask the backend to connect to the device
+ * afterwards. Caller should hold radio->devices_lock and the device's gatt_cs. */
+static NTSTATUS bluetooth_device_queue_gatt_irp( struct bluetooth_remote_device *device, IRP *irp )
+{
+    NTSTATUS status;
+
+    irp->Tail.Overlay.DriverContext[0] = ULongToPtr( GetTickCount() + gatt_connect_timeout );
+    if ((status = bluetooth_device_park_gatt_irp( device, &device->gatt_irps, irp )) == STATUS_PENDING)
+        bluetooth_gatt_irp_timer_start( gatt_connect_timeout );
+    return status;
+}
+
+static void WINAPI bluetooth_gatt_irp_retry( DEVICE_OBJECT *device_obj, void *context )
+{
+    struct bluetooth_pdo_ext *ext = device_obj->DeviceExtension;
+    IRP *irp = context;
+    PIO_WORKITEM item = irp->Tail.Overlay.DriverContext[1];
+
+    NTSTATUS status;
+
+    /* Reads only get started at this point, and are completed once the backend has performed them. */
+    if (ext->type == BLUETOOTH_PDO_EXT_RADIO)
+        status = bluetooth_radio_gatt_request( &ext->radio, irp, FALSE );
+    else
+        status = bluetooth_remote_device_gatt_request( &ext->remote_device, irp, FALSE );
+    if (status != STATUS_PENDING)
+    {
+        irp->IoStatus.Status = status;
+        IoCompleteRequest( irp, IO_NO_INCREMENT );
+    }
+    IoFreeWorkItem( item );
+}
+
+/* Takes a parked GATT request off its device, and retries it without waiting any longer. The request isn't
+ * completed from the caller's thread, as that would need the radio's devices_lock.
+ * The caller should hold a reference to the device besides the IRP's, as well as its gatt_cs. */
+static void bluetooth_gatt_irp_dequeue( IRP *irp )
+{
+    struct bluetooth_remote_device *device = irp->Tail.Overlay.DriverContext[3];
+    PIO_WORKITEM item;
+
+    if (!bluetooth_device_unpark_gatt_irp( irp ))
+        return;
+    bluetooth_device_decref( device );
+
+    /* The work item belongs to the radio or the remote device the request was sent to. */
+    if (!(item = IoAllocateWorkItem( IoGetCurrentIrpStackLocation( irp )->DeviceObject )))
+    {
+        irp->IoStatus.Status = STATUS_INSUFFICIENT_RESOURCES;
+        irp->IoStatus.Information = 0;
+        IoCompleteRequest( irp, IO_NO_INCREMENT );
+        return;
+    }
+    irp->Tail.Overlay.DriverContext[1] = item;
+    IoQueueWorkItem( item, bluetooth_gatt_irp_retry, DelayedWorkQueue, irp );
+}
+
+/* Caller should hold the device's gatt_cs. */
+static BOOL bluetooth_device_gatt_irp_ready( struct bluetooth_remote_device *device, IRP *irp )
+{
+    IO_STACK_LOCATION *stack = IoGetCurrentIrpStackLocation( irp );
+    BOOL connected, resolved;
+
+    bluetooth_device_get_gatt_state( device, &connected, &resolved );
+    switch (stack->Parameters.DeviceIoControl.IoControlCode)
+    {
+    case IOCTL_WINEBTH_RADIO_READ_CHARACTERISTIC:
+    {
+        const struct winebth_radio_read_characteristic_params *params = irp->AssociatedIrp.SystemBuffer;
+
+        return connected && (resolved || bluetooth_device_find_characteristic( device, &params->service,
+                                                                                &params->characteristic ));
+    }
+    case IOCTL_WINEBTH_LE_DEVICE_READ_CHARACTERISTIC:
+    case IOCTL_WINEBTH_LE_DEVICE_WRITE_CHARACTERISTIC:
+    {
+        /* Both start with the service and the characteristic. */
+        const struct winebth_le_device_read_characteristic_params *params = irp->AssociatedIrp.SystemBuffer;
+
+        return connected && (resolved || bluetooth_device_find_characteristic( device, &params->service,
+                                                                                &params->characteristic ));
+    }
+    default:
+        return resolved;
+    }
+}
+
+/* Retries the GATT requests waiting for the device that can make progress now. Caller should hold device_list_cs. */
+static void bluetooth_device_retry_gatt_irps( struct bluetooth_remote_device *device )
+{
+    LIST_ENTRY *cur, *next;
+
+    EnterCriticalSection( &device->gatt_cs );
+    for (cur = device->gatt_irps.Flink; cur != &device->gatt_irps; cur = next)
+    {
+        IRP *irp = CONTAINING_RECORD( cur, IRP, Tail.Overlay.ListEntry );
+
+        next = cur->Flink;
+        if (bluetooth_device_gatt_irp_ready( device, irp ))
+            bluetooth_gatt_irp_dequeue( irp );
+    }
+    LeaveCriticalSection( &device->gatt_cs );
+}
+
+static void CALLBACK bluetooth_gatt_irp_timeout( TP_CALLBACK_INSTANCE *instance, void *context, TP_TIMER *timer )
+{
+    DWORD now = GetTickCount(), next_timeout = 0;
+    struct bluetooth_radio *radio;
+    BOOL waiting = FALSE;
+
+    EnterCriticalSection( &gatt_irp_timer_cs );
+    gatt_irp_timer_set = FALSE;
+    LeaveCriticalSection( &gatt_irp_timer_cs );
+
+    device_list_lock();
+    LIST_FOR_EACH_ENTRY( radio, &device_list, struct bluetooth_radio, entry )
+    {
+        struct bluetooth_remote_device *device;
+
+        LIST_FOR_EACH_ENTRY( device, &radio->remote_devices, struct bluetooth_remote_device, entry )
+        {
+            LIST_ENTRY *cur, *next;
+
+            EnterCriticalSection( &device->gatt_cs );
+            for (cur = device->gatt_irps.Flink; cur != &device->gatt_irps; cur = next)
+            {
+                IRP *irp = CONTAINING_RECORD( cur, IRP, Tail.Overlay.ListEntry );
+                LONG remaining = PtrToUlong( irp->Tail.Overlay.DriverContext[0] ) - now;
+
+                next = cur->Flink;
+                if (remaining <= 0)
+                    bluetooth_gatt_irp_dequeue( irp );
+                else if (!waiting || remaining < next_timeout)
+                {
+                    next_timeout = remaining;
+                    waiting = TRUE;
+                }
+            }
+            LeaveCriticalSection( &device->gatt_cs );
+        }
+    }
+    device_list_unlock();
+    if (waiting)
+        bluetooth_gatt_irp_timer_start( next_timeout );
+}
+
+static NTSTATUS bluetooth_radio_get_le_device_gatt_services( struct bluetooth_radio *radio, IRP *irp, BOOL wait )
+{
+    const SIZE_T min_size = offsetof( struct winebth_radio_get_le_device_gatt_services_params, services[0] );
+    struct winebth_radio_get_le_device_gatt_services_params *params = irp->AssociatedIrp.SystemBuffer;
+    IO_STACK_LOCATION *stack = IoGetCurrentIrpStackLocation( irp );
+    ULONG insize = stack->Parameters.DeviceIoControl.InputBufferLength;
+    ULONG outsize = stack->Parameters.DeviceIoControl.OutputBufferLength;
+    winebluetooth_device_t device_handle = {0};
+    struct bluetooth_remote_device *device;
+    NTSTATUS status;
+    SIZE_T rem;
+
+    if (!params || outsize < min_size || insize < sizeof( BTH_ADDR ))
+        return STATUS_INVALID_USER_BUFFER;
+
+    rem = (outsize - min_size) / sizeof( *params->services );
+    status = STATUS_DEVICE_NOT_CONNECTED;
+    params->count = 0;
+
+    bluetooth_radio_lock_shared( radio );
+    if ((device = bluetooth_radio_find_device( radio, params->address )))
+    {
+        struct bluetooth_gatt_service *svc;
+        BOOL connected, resolved;
+
+        EnterCriticalSection( &device->gatt_cs );
+        bluetooth_device_get_gatt_state( device, &connected, &resolved );
+        TRACE( "device %p connected %d resolved %d\n", device, connected, resolved );
+        if (!resolved && device->gatt_db)
+        {
+            /* Answer from the table seen last time, while the backend resolves the services again. */
+            status = STATUS_SUCCESS;
+            params->count = bluetooth_gatt_database_get_services( device->gatt_db, params->services, rem );
+            if (!connected)
+                winebluetooth_device_dup(( device_handle = device->device ));
+        }
+        else if (wait && !resolved && list_empty( &device->gatt_services ))
+        {
+            if ((status = bluetooth_device_queue_gatt_irp( device, irp )) == STATUS_PENDING)
+                winebluetooth_device_dup(( device_handle = device->device ));
+        }
+        else
+        {
+            status = STATUS_SUCCESS;
+            LIST_FOR_EACH_ENTRY( svc, &device->gatt_services, struct bluetooth_gatt_service, entry )
+            {
+                if (!svc->primary)
+                    continue;
+                params->count++;
+                if (rem)
+                {
+                    BTH_LE_GATT_SERVICE *info = &params->services[params->count - 1];
+                    memset( info, 0, sizeof( *info ) );
+                    uuid_to_le( &svc->uuid, &info->ServiceUuid );
+                    info->AttributeHandle = svc->handle;
+                    rem--;
+                }
+            }
+        }
+        LeaveCriticalSection( &device->gatt_cs );
+    }
+    bluetooth_radio_unlock( radio );
+
+    if (device_handle.handle)
+    {
+        winebluetooth_device_connect( device_handle );
+        winebluetooth_device_free( device_handle );
+    }
+    if (status == STATUS_SUCCESS)
+        irp->IoStatus.Information = min_size + params->count * sizeof( *params->services );
+    return status;
+}
+
+static NTSTATUS bluetooth_radio_get_le_device_gatt_characteristics( struct bluetooth_radio *radio, IRP *irp,
+                                                                    BOOL wait )
+{
+    const SIZE_T min_size = offsetof( struct winebth_radio_get_le_device_gatt_characteristics_params, characteristics[0] );
+    struct winebth_radio_get_le_device_gatt_characteristics_params *params = irp->AssociatedIrp.SystemBuffer;
+    IO_STACK_LOCATION *stack = IoGetCurrentIrpStackLocation( irp );
+    ULONG insize = stack->Parameters.DeviceIoControl.InputBufferLength;
+    ULONG outsize = stack->Parameters.DeviceIoControl.OutputBufferLength;
+    winebluetooth_device_t device_handle = {0};
+    struct bluetooth_remote_device *device;
+    NTSTATUS status;
+    GUID svc_uuid;
+    SIZE_T rem;
+
+    if (!params || outsize < min_size || insize < min_size)
+        return STATUS_INVALID_USER_BUFFER;
+
+    le_to_uuid( &params->service.ServiceUuid, &svc_uuid );
+    rem = (outsize - min_size) / sizeof( *params->characteristics );
+    status = STATUS_NOT_FOUND;
+    params->count = 0;
+
+    bluetooth_radio_lock_shared( radio );
+    if ((device = bluetooth_radio_find_device( radio, params->address )))
+    {
+        struct bluetooth_gatt_service *svc;
+        BOOL connected, resolved;
+
+        EnterCriticalSection( &device->gatt_cs );
+        svc = find_gatt_service( &device->gatt_services, &svc_uuid, params->service.AttributeHandle );
+        bluetooth_device_get_gatt_state( device, &connected, &resolved );
+        if (!resolved && device->gatt_db)
+        {
+            const struct winebth_gatt_database_service *entry;
+
+            if ((entry = bluetooth_gatt_database_find_service( device->gatt_db, &params->service )))
+            {
+                status = STATUS_SUCCESS;
+                params->count = bluetooth_gatt_database_get_characteristics(
+                    entry, bluetooth_gatt_database_characteristics( device->gatt_db ), params->characteristics, rem );
+            }
+            if (!connected)
+                winebluetooth_device_dup(( device_handle = device->device ));
+        }
+        else if (wait && !resolved && (!svc || list_empty( &svc->characteristics )))
         {
-            LeaveCriticalSection( &device_list_cs );
-            status = STATUS_INVALID_PARAMETER;
-            break;
+            if ((status = bluetooth_device_queue_gatt_irp( device, irp )) == STATUS_PENDING)
+                winebluetooth_device_dup(( device_handle = device->device ));
         }
-
-        bluetooth_gatt_service_incref( service );
-        LeaveCriticalSection( &device_list_cs );
-
-        /* Characteristics are immutable after service discovery - no lock needed for read */
-        LIST_FOR_EACH_ENTRY( chrc, &service->characteristics, struct bluetooth_gatt_characteristic, entry )
+        else if (svc)
         {
-            chars->count++;
-            if (rem)
+            struct bluetooth_gatt_characteristic *chrc;
+
+            status = STATUS_SUCCESS;
+            LIST_FOR_EACH_ENTRY( chrc, &svc->characteristics, struct bluetooth_gatt_characteristic, entry )
             {
-                chars->characteristics[chars->count - 1] = chrc->props;
-                rem--;
+                params->count++;
+                if (rem)
+                {
+                    params->characteristics[params->count - 1] = chrc->props;
+                    rem--;
+                }
             }
         }
+        LeaveCriticalSection( &device->gatt_cs );
+    }
+    bluetooth_radio_unlock( radio );
 
-        bluetooth_gatt_service_decref( service );
+    if (device_handle.handle)
+    {
+        winebluetooth_device_connect( device_handle );
+        winebluetooth_device_free( device_handle );
+    }
+    if (status != STATUS_SUCCESS)
+        return status;
 
-        /* Sort characteristics by UUID - some apps (e.g. Square Golf) stop iterating early
-         * and expect specific characteristics to appear before others. Windows appears to
-         * return characteristics sorted by UUID. */
-        if (chars->count > 1)
-            qsort( chars->characteristics, chars->count, sizeof(chars->characteristics[0]),
-                   compare_characteristics_by_uuid );
+    /* Sort characteristics by UUID - some apps (e.g. Square Golf) stop iterating early
+     * and expect specific characteristics to appear before others. Windows appears to
+     * return characteristics sorted by UUID. */
+    if (params->count > 1)
+        qsort( params->characteristics, params->count, sizeof(params->characteristics[0]),
+               compare_characteristics_by_uuid );
 
-        irp->IoStatus.Information = offsetof( struct winebth_le_device_get_gatt_characteristics_params, characteristics[chars->count] );
-        if (chars->count > rem)
-            status = STATUS_MORE_ENTRIES;
-        break;
-    }
-    case IOCTL_WINEBTH_LE_DEVICE_READ_CHARACTERISTIC:
+    irp->IoStatus.Information = min_size + params->count * sizeof( *params->characteristics );
+    return status;
+}
+
+static NTSTATUS bluetooth_radio_get_le_device_gatt_database( struct bluetooth_radio *radio, IRP *irp, BOOL wait )
+{
+    const SIZE_T header_size = offsetof( struct winebth_radio_get_le_device_gatt_database_params, database );
+    const SIZE_T min_size = header_size + WINEBTH_GATT_DATABASE_SIZE( 0, 0 );
+    struct winebth_radio_get_le_device_gatt_database_params *params = irp->AssociatedIrp.SystemBuffer;
+    IO_STACK_LOCATION *stack = IoGetCurrentIrpStackLocation( irp );
+    ULONG insize = stack->Parameters.DeviceIoControl.InputBufferLength;
+    ULONG outsize = stack->Parameters.DeviceIoControl.OutputBufferLength;
+    winebluetooth_device_t device_handle = {0};
+    struct bluetooth_remote_device *device;
+    NTSTATUS status;
+
+    if (!params || outsize < min_size || insize < sizeof( BTH_ADDR ))
+        return STATUS_INVALID_USER_BUFFER;
+
+    status = STATUS_DEVICE_NOT_CONNECTED;
+
+    bluetooth_radio_lock_shared( radio );
+    if ((device = bluetooth_radio_find_device( radio, params->address )))
     {
-        struct winebth_le_device_read_characteristic_params *params = irp->AssociatedIrp.SystemBuffer;
-        struct bluetooth_gatt_service *service;
-        struct bluetooth_gatt_characteristic *chrc;
-        GUID svc_uuid;
-        unsigned int data_len = 0;
+        BOOL connected, resolved;
 
-        if (!params || outsize < sizeof(struct winebth_le_device_read_characteristic_params))
+        EnterCriticalSection( &device->gatt_cs );
+        bluetooth_device_get_gatt_state( device, &connected, &resolved );
+        if (wait && !resolved && !device->gatt_db && list_empty( &device->gatt_services ))
         {
-            status = STATUS_INVALID_USER_BUFFER;
-            break;
+            if ((status = bluetooth_device_queue_gatt_irp( device, irp )) == STATUS_PENDING)
+                winebluetooth_device_dup(( device_handle = device->device ));
         }
-
-        EnterCriticalSection( &ext->props_cs );
-        le_to_uuid( &params->service.ServiceUuid, &svc_uuid );
-        if (IsEqualGUID( &svc_uuid, &GUID_NULL ))
-            service = find_gatt_service_by_handle( &ext->gatt_services, params->characteristic.ServiceHandle );
         else
-            service = find_gatt_service( &ext->gatt_services, &svc_uuid, params->service.AttributeHandle );
-        if (!service)
         {
-            LeaveCriticalSection( &ext->props_cs );
-            status = STATUS_INVALID_PARAMETER;
-            break;
+            status = bluetooth_device_get_gatt_database( device, resolved, &params->database, outsize - header_size,
+                                                         &irp->IoStatus.Information );
+            irp->IoStatus.Information += header_size;
+            /* A persisted table was returned, have the backend resolve the services again. */
+            if (!resolved && !connected && device->gatt_db)
+                winebluetooth_device_dup(( device_handle = device->device ));
         }
+        LeaveCriticalSection( &device->gatt_cs );
+    }
+    bluetooth_radio_unlock( radio );
 
-        chrc = find_gatt_characteristic( service, &params->characteristic );
-        if (!chrc)
-        {
-            LeaveCriticalSection( &ext->props_cs );
-            status = STATUS_INVALID_PARAMETER;
-            break;
-        }
+    if (device_handle.handle)
+    {
+        winebluetooth_device_connect( device_handle );
+        winebluetooth_device_free( device_handle );
+    }
+    return status;
+}
 
-        status = winebluetooth_gatt_characteristic_read(
-            chrc->characteristic,
-            params->data,
-            outsize - offsetof(struct winebth_le_device_read_characteristic_params, data),
-            &data_len );
-        params->data_size = data_len;
-        irp->IoStatus.Information = offsetof(struct winebth_le_device_read_characteristic_params, data) + data_len;
+/* Looks up the characteristic a READ_CHARACTERISTIC request is for, once its device has connected. Returns
+ * STATUS_PENDING if the device isn't ready yet, unless this is the final attempt.
+ * Caller should hold radio->devices_lock. */
+static NTSTATUS bluetooth_radio_get_read_characteristic( struct bluetooth_radio *radio,
+                                                         const struct winebth_radio_read_characteristic_params *params,
+                                                         BOOL final, struct bluetooth_remote_device **device,
+                                                         struct bluetooth_gatt_characteristic **chrc )
+{
+    BOOL connected, resolved;
 
-        LeaveCriticalSection( &ext->props_cs );
-        break;
+    if (!(*device = bluetooth_radio_find_device( radio, params->address )))
+        return STATUS_NOT_FOUND;
+
+    bluetooth_device_get_gatt_state( *device, &connected, &resolved );
+    if (connected &&
+        (*chrc = bluetooth_device_find_characteristic( *device, &params->service, &params->characteristic )))
+        return STATUS_SUCCESS;
+    if (connected && (resolved || final))
+        return STATUS_INVALID_PARAMETER;
+    return final ? STATUS_DEVICE_NOT_CONNECTED : STATUS_PENDING;
+}
+
+static NTSTATUS bluetooth_radio_read_characteristic( struct bluetooth_radio *radio, IRP *irp, BOOL wait )
+{
+    const SIZE_T min_size = offsetof( struct winebth_radio_read_characteristic_params, data[0] );
+    struct winebth_radio_read_characteristic_params *params = irp->AssociatedIrp.SystemBuffer;
+    IO_STACK_LOCATION *stack = IoGetCurrentIrpStackLocation( irp );
+    ULONG insize = stack->Parameters.DeviceIoControl.InputBufferLength;
+    ULONG outsize = stack->Parameters.DeviceIoControl.OutputBufferLength;
+    winebluetooth_gatt_characteristic_t characteristic = {0};
+    winebluetooth_device_t device_handle = {0};
+    struct bluetooth_gatt_characteristic *chrc;
+    struct bluetooth_remote_device *device;
+    NTSTATUS status;
+
+    if (!params || outsize < min_size || insize < min_size)
+        return STATUS_INVALID_USER_BUFFER;
+
+    bluetooth_radio_lock_shared( radio );
+    if (!(device = bluetooth_radio_find_device( radio, params->address )))
+    {
+        bluetooth_radio_unlock( radio );
+        return STATUS_NOT_FOUND;
     }
-    case IOCTL_WINEBTH_LE_DEVICE_WRITE_CHARACTERISTIC:
+    EnterCriticalSection( &device->gatt_cs );
+    /* Cached values can be returned without waiting for the device to connect. */
+    if ((chrc = bluetooth_device_find_characteristic( device, &params->service, &params->characteristic )) &&
+        (status = bluetooth_gatt_characteristic_read_cached( chrc, irp, params->flags )) != STATUS_PENDING)
     {
-        struct winebth_le_device_write_characteristic_params *params = irp->AssociatedIrp.SystemBuffer;
-        struct bluetooth_gatt_service *service;
-        struct bluetooth_gatt_characteristic *chrc;
-        GUID svc_uuid;
-        ULONG insize = stack->Parameters.DeviceIoControl.InputBufferLength;
+        LeaveCriticalSection( &device->gatt_cs );
+        bluetooth_radio_unlock( radio );
+        return status;
+    }
+    status = bluetooth_radio_get_read_characteristic( radio, params, !wait, &device, &chrc );
+    if (status == STATUS_SUCCESS)
+        status = bluetooth_device_queue_gatt_io_irp( device, chrc, irp, &characteristic );
+    else if (status == STATUS_PENDING && (status = bluetooth_device_queue_gatt_irp( device, irp )) == STATUS_PENDING)
+        winebluetooth_device_dup(( device_handle = device->device ));
+    LeaveCriticalSection( &device->gatt_cs );
+    bluetooth_radio_unlock( radio );
+
+    if (device_handle.handle)
+    {
+        winebluetooth_device_connect( device_handle );
+        winebluetooth_device_free( device_handle );
+    }
+    else if (characteristic.handle)
+        bluetooth_gatt_io_irp_started( device, characteristic, irp,
+                                       winebluetooth_gatt_characteristic_read( characteristic, irp ) );
+    return status;
+}
 
-        if (!params || insize < sizeof(struct winebth_le_device_write_characteristic_params))
-        {
-            status = STATUS_INVALID_USER_BUFFER;
-            break;
-        }
+/* Handles the GATT requests that may have to wait for the remote device. If wait is set, this returns
+ * STATUS_PENDING when the device isn't ready yet, otherwise it completes the request with what is known. Reads
+ * return STATUS_PENDING once started as well, they are completed when the backend reports their result. */
+static NTSTATUS bluetooth_radio_gatt_request( struct bluetooth_radio *radio, IRP *irp, BOOL wait )
+{
+    IO_STACK_LOCATION *stack = IoGetCurrentIrpStackLocation( irp );
 
-        if (insize < offsetof( struct winebth_le_device_write_characteristic_params, data ) + params->data_size)
-        {
-            status = STATUS_INVALID_USER_BUFFER;
-            break;
-        }
+    switch (stack->Parameters.DeviceIoControl.IoControlCode)
+    {
+    case IOCTL_WINEBTH_RADIO_GET_LE_DEVICE_GATT_SERVICES:
+        return bluetooth_radio_get_le_device_gatt_services( radio, irp, wait );
+    case IOCTL_WINEBTH_RADIO_GET_LE_DEVICE_GATT_CHARACTERISTICS:
+        return bluetooth_radio_get_le_device_gatt_characteristics( radio, irp, wait );
+    case IOCTL_WINEBTH_RADIO_GET_LE_DEVICE_GATT_DATABASE:
+        return bluetooth_radio_get_le_device_gatt_database( radio, irp, wait );
+    case IOCTL_WINEBTH_RADIO_READ_CHARACTERISTIC:
+        return bluetooth_radio_read_characteristic( radio, irp, wait );
+    default:
+        return STATUS_NOT_SUPPORTED;
+    }
+}
 
-        EnterCriticalSection( &ext->props_cs );
-        le_to_uuid( &params->service.ServiceUuid, &svc_uuid );
-        if (IsEqualGUID( &svc_uuid, &GUID_NULL ))
-            service = find_gatt_service_by_handle( &ext->gatt_services, params->characteristic.ServiceHandle );
-        else
-            service = find_gatt_service( &ext->gatt_services, &svc_uuid, params->service.AttributeHandle );
-        if (!service)
-        {
-            LeaveCriticalSection( &ext->props_cs );
-            status = STATUS_INVALID_PARAMETER;
-            break;
-        }
+/* Parks a read or write on a characteristic that isn't known to the backend yet, if the device had it the last time
+ * its services were resolved. Caller should hold radio->devices_lock and the device's gatt_cs. */
+static NTSTATUS bluetooth_device_wait_for_characteristic( struct bluetooth_remote_device *device, IRP *irp,
+                                                          const BTH_LE_GATT_SERVICE *service,
+                                                          const BTH_LE_GATT_CHARACTERISTIC *chrc, BOOL wait,
+                                                          winebluetooth_device_t *device_handle )
+{
+    BOOL connected, resolved;
+    NTSTATUS status;
 
-        chrc = find_gatt_characteristic( service, &params->characteristic );
-        if (!chrc)
-        {
-            LeaveCriticalSection( &ext->props_cs );
-            status = STATUS_INVALID_PARAMETER;
-            break;
-        }
+    bluetooth_device_get_gatt_state( device, &connected, &resolved );
+    if (resolved || !device->gatt_db || !bluetooth_gatt_database_has_characteristic( device->gatt_db, service, chrc ))
+        return STATUS_INVALID_PARAMETER;
+    if (!wait)
+        return connected ? STATUS_INVALID_PARAMETER : STATUS_DEVICE_NOT_CONNECTED;
+    if ((status = bluetooth_device_queue_gatt_irp( device, irp )) == STATUS_PENDING && !connected)
+        winebluetooth_device_dup(( *device_handle = device->device ));
+    return status;
+}
+
+static NTSTATUS bluetooth_remote_device_read_characteristic( struct bluetooth_remote_device *ext, IRP *irp,
+                                                             BOOL wait )
+{
+    struct winebth_le_device_read_characteristic_params *params = irp->AssociatedIrp.SystemBuffer;
+    IO_STACK_LOCATION *stack = IoGetCurrentIrpStackLocation( irp );
+    ULONG outsize = stack->Parameters.DeviceIoControl.OutputBufferLength;
+    winebluetooth_gatt_characteristic_t characteristic = {0};
+    winebluetooth_device_t device_handle = {0};
+    struct bluetooth_gatt_characteristic *chrc;
+    NTSTATUS status;
 
-        status = winebluetooth_gatt_characteristic_write(
-            chrc->characteristic,
-            params->data,
-            params->data_size,
-            params->write_type );
+    if (!params || outsize < sizeof(struct winebth_le_device_read_characteristic_params))
+        return STATUS_INVALID_USER_BUFFER;
 
-        LeaveCriticalSection( &ext->props_cs );
-        break;
-    }
-    case IOCTL_WINEBTH_LE_DEVICE_SET_NOTIFY:
+    bluetooth_radio_lock_shared( ext->radio );
+    EnterCriticalSection( &ext->gatt_cs );
+    if (!(chrc = bluetooth_device_find_characteristic( ext, &params->service, &params->characteristic )))
+        status = bluetooth_device_wait_for_characteristic( ext, irp, &params->service, &params->characteristic,
+                                                           wait, &device_handle );
+    else if ((status = bluetooth_gatt_characteristic_read_cached( chrc, irp, params->flags )) == STATUS_PENDING)
+        status = bluetooth_device_queue_gatt_io_irp( ext, chrc, irp, &characteristic );
+    LeaveCriticalSection( &ext->gatt_cs );
+    bluetooth_radio_unlock( ext->radio );
+
+    if (device_handle.handle)
     {
-        struct winebth_le_device_set_notify_params *params = irp->AssociatedIrp.SystemBuffer;
-        struct bluetooth_gatt_service *service;
-        struct bluetooth_gatt_characteristic *chrc;
-        GUID svc_uuid;
-        ULONG insize = stack->Parameters.DeviceIoControl.InputBufferLength;
+        winebluetooth_device_connect( device_handle );
+        winebluetooth_device_free( device_handle );
+    }
+    else if (characteristic.handle)
+        bluetooth_gatt_io_irp_started( ext, characteristic, irp,
+                                       winebluetooth_gatt_characteristic_read( characteristic, irp ) );
+    return status;
+}
 
-        if (!params || insize < sizeof(struct winebth_le_device_set_notify_params))
-        {
-            status = STATUS_INVALID_USER_BUFFER;
-            break;
-        }
+static NTSTATUS bluetooth_remote_device_write_characteristic( struct bluetooth_remote_device *ext, IRP *irp,
+                                                              BOOL wait )
+{
+    struct winebth_le_device_write_characteristic_params *params = irp->AssociatedIrp.SystemBuffer;
+    IO_STACK_LOCATION *stack = IoGetCurrentIrpStackLocation( irp );
+    ULONG insize = stack->Parameters.DeviceIoControl.InputBufferLength;
+    winebluetooth_gatt_characteristic_t characteristic = {0};
+    winebluetooth_device_t device_handle = {0};
+    struct bluetooth_gatt_characteristic *chrc;
+    ULONG size, write_type;
+    unsigned char *data;
+    NTSTATUS status;
 
-        EnterCriticalSection( &ext->props_cs );
-        le_to_uuid( &params->service.ServiceUuid, &svc_uuid );
-        if (IsEqualGUID( &svc_uuid, &GUID_NULL ))
-            service = find_gatt_service_by_handle( &ext->gatt_services, params->characteristic.ServiceHandle );
-        else
-            service = find_gatt_service( &ext->gatt_services, &svc_uuid, params->service.AttributeHandle );
-        if (!service)
-        {
-            LeaveCriticalSection( &ext->props_cs );
-            status = STATUS_INVALID_PARAMETER;
-            break;
-        }
+    if (!params || insize < sizeof(struct winebth_le_device_write_characteristic_params))
+        return STATUS_INVALID_USER_BUFFER;
+    if (insize < offsetof( struct winebth_le_device_write_characteristic_params, data ) + params->data_size)
+        return STATUS_INVALID_USER_BUFFER;
 
-        chrc = find_gatt_characteristic( service, &params->characteristic );
-        if (!chrc)
-        {
-            LeaveCriticalSection( &ext->props_cs );
-            status = STATUS_INVALID_PARAMETER;
-            break;
-        }
+    size = params->data_size;
+    write_type = params->write_type;
+    if (!(data = malloc( max( size, 1 ) )))
+        return STATUS_NO_MEMORY;
+    memcpy( data, params->data, size );
 
-        status = winebluetooth_gatt_characteristic_set_notify(
-            chrc->characteristic,
-            params->enable );
+    bluetooth_radio_lock_shared( ext->radio );
+    EnterCriticalSection( &ext->gatt_cs );
+    if (!(chrc = bluetooth_device_find_characteristic( ext, &params->service, &params->characteristic )))
+        status = bluetooth_device_wait_for_characteristic( ext, irp, &params->service, &params->characteristic,
+                                                           wait, &device_handle );
+    else
+        status = bluetooth_device_queue_gatt_io_irp( ext, chrc, irp, &characteristic );
+    LeaveCriticalSection( &ext->gatt_cs );
+    bluetooth_radio_unlock( ext->radio );
 
-        LeaveCriticalSection( &ext->props_cs );
-        break;
-    }
-    case IOCTL_WINEBTH_LE_DEVICE_READ_NOTIFICATION:
+    if (device_handle.handle)
     {
-        struct winebth_le_device_read_notification_params *params = irp->AssociatedIrp.SystemBuffer;
-        struct bluetooth_gatt_service *service;
-        struct bluetooth_gatt_characteristic *chrc;
-        GUID svc_uuid;
-        ULONG insize = stack->Parameters.DeviceIoControl.InputBufferLength;
-        ULONG outsize = stack->Parameters.DeviceIoControl.OutputBufferLength;
+        winebluetooth_device_connect( device_handle );
+        winebluetooth_device_free( device_handle );
+    }
+    else if (characteristic.handle)
+        bluetooth_gatt_io_irp_started( ext, characteristic, irp,
+                                       winebluetooth_gatt_characteristic_write( characteristic, data, size,
+                                                                                write_type, irp ) );
+    free( data );
+    return status;
+}
 
-        if (!params || insize < sizeof(struct winebth_le_device_read_notification_params))
-        {
-            status = STATUS_INVALID_USER_BUFFER;
-            break;
-        }
+/* Like bluetooth_radio_gatt_request, for the requests sent to a remote device. Reads or writes on a characteristic
+ * from the persisted attribute table wait until the backend has found it again. */
+static NTSTATUS bluetooth_remote_device_gatt_request( struct bluetooth_remote_device *device, IRP *irp, BOOL wait )
+{
+    IO_STACK_LOCATION *stack = IoGetCurrentIrpStackLocation( irp );
 
-        EnterCriticalSection( &ext->props_cs );
-        le_to_uuid( &params->service.ServiceUuid, &svc_uuid );
-        if (IsEqualGUID( &svc_uuid, &GUID_NULL ))
-            service = find_gatt_service_by_handle( &ext->gatt_services, params->characteristic.ServiceHandle );
-        else
-            service = find_gatt_service( &ext->gatt_services, &svc_uuid, params->service.AttributeHandle );
-        if (!service)
-        {
-            LeaveCriticalSection( &ext->props_cs );
-            status = STATUS_INVALID_PARAMETER;
-            break;
-        }
+    switch (stack->Parameters.DeviceIoControl.IoControlCode)
+    {
+    case IOCTL_WINEBTH_LE_DEVICE_READ_CHARACTERISTIC:
+        return bluetooth_remote_device_read_characteristic( device, irp, wait );
+    case IOCTL_WINEBTH_LE_DEVICE_WRITE_CHARACTERISTIC:
+        return bluetooth_remote_device_write_characteristic( device, irp, wait );
+    default:
+        return STATUS_NOT_SUPPORTED;
+    }
+}
 
-        chrc = find_gatt_characteristic( service, &params->characteristic );
-        if (!chrc)
-        {
-            LeaveCriticalSection( &ext->props_cs );
-            status = STATUS_INVALID_PARAMETER;
-            break;
-        }
+struct bluetooth_ioctl_stats
+{
+    LONG64 calls;
+    LONG64 errors;
+    LONG64 pending;
+    LONG64 total_time;
+    LONG64 max_time;
+    LONG64 latency[WINEBTH_STATS_LATENCY_BUCKETS];
+};
 
-        {
-            unsigned int data_size = 0;
-            unsigned int buffer_size = outsize >= sizeof(struct winebth_le_device_read_notification_params) ?
-                (unsigned int)(outsize - sizeof(struct winebth_le_device_read_notification_params)) : 0;
-            winebluetooth_gatt_characteristic_t characteristic = chrc->characteristic;
+/* By function code. These are only updated with interlocked operations, so the IOCTL handlers don't serialize on
+ * them. */
+static struct bluetooth_ioctl_stats ioctl_stats[256];
 
-            winebluetooth_gatt_characteristic_dup( characteristic );
-            LeaveCriticalSection( &ext->props_cs );
+static void bluetooth_ioctl_stats_record( ULONG code, NTSTATUS status, LONG64 time )
+{
+    struct bluetooth_ioctl_stats *stats = &ioctl_stats[(code >> 2) & 0xff];
+    unsigned int bucket = 0;
+
+    InterlockedIncrement64( &stats->calls );
+    if (status == STATUS_PENDING)
+    {
+        InterlockedIncrement64( &stats->pending );
+        return;
+    }
+    if (NT_ERROR( status ))
+        InterlockedIncrement64( &stats->errors );
+    InterlockedExchangeAdd64( &stats->total_time, time );
+    stats_update_max( &stats->max_time, time );
+    while (bucket < WINEBTH_STATS_LATENCY_BUCKETS - 1 && time / 10 >= (1ll << bucket))
+        bucket++;
+    InterlockedIncrement64( &stats->latency[bucket] );
+}
 
-            status = winebluetooth_gatt_characteristic_read_notification(
-                characteristic,
-                params->data,
-                buffer_size,
-                &data_size );
+struct bluetooth_characteristic_stats_entry
+{
+    winebluetooth_gatt_characteristic_t characteristic;
+    struct winebth_characteristic_stats stats;
+};
 
-            winebluetooth_gatt_characteristic_free( characteristic );
+/* Returns new references to the radio's characteristics, or NULL if it has none. */
+static struct bluetooth_characteristic_stats_entry *bluetooth_radio_get_characteristics( struct bluetooth_radio *radio,
+                                                                                         SIZE_T *count )
+{
+    struct bluetooth_characteristic_stats_entry *entries = NULL, *new_entries;
+    struct bluetooth_gatt_characteristic *chrc;
+    struct bluetooth_remote_device *device;
+    struct bluetooth_gatt_service *svc;
+    SIZE_T capacity = 0;
 
-            if (status == STATUS_SUCCESS) {
-                irp->IoStatus.Information = sizeof(struct winebth_le_device_read_notification_params) + data_size;
-            } else {
-                irp->IoStatus.Information = 0;
-            }
-        }
-        break;
-    }
-    case IOCTL_WINEBTH_LE_DEVICE_GET_CONNECTION_STATUS:
+    *count = 0;
+    bluetooth_radio_lock_shared( radio );
+    LIST_FOR_EACH_ENTRY( device, &radio->remote_devices, struct bluetooth_remote_device, entry )
     {
-        BOOL *connected = irp->AssociatedIrp.SystemBuffer;
+        BTH_ADDR address;
 
-        if (!connected || outsize < sizeof(BOOL))
+        device_props_lock( device );
+        address = device->props.address.ullLong;
+        device_props_unlock( device );
+
+        LIST_FOR_EACH_ENTRY( svc, &device->gatt_services, struct bluetooth_gatt_service, entry )
         {
-            status = STATUS_INVALID_USER_BUFFER;
-            break;
+            LIST_FOR_EACH_ENTRY( chrc, &svc->characteristics, struct bluetooth_gatt_characteristic, entry )
+            {
+                if (*count == capacity)
+                {
+                    capacity = max( capacity * 2, 16 );
+                    if (!(new_entries = realloc( entries, capacity * sizeof( *entries ) ))) goto done;
+                    entries = new_entries;
+                }
+                winebluetooth_gatt_characteristic_dup(( entries[*count].characteristic = chrc->characteristic ));
+                entries[*count].stats.address = address;
+                entries[*count].stats.characteristic = chrc->props;
+                (*count)++;
+            }
         }
+    }
+done:
+    bluetooth_radio_unlock( radio );
+    return entries;
+}
 
-        EnterCriticalSection( &ext->props_cs );
-        *connected = ext->props.connected;
-        TRACE( "GET_CONNECTION_STATUS: returning connected=%d for device=%p\n", *connected, ext );
-        LeaveCriticalSection( &ext->props_cs );
-
-        irp->IoStatus.Information = sizeof(BOOL);
-        status = STATUS_SUCCESS;
-        break;
+static NTSTATUS bluetooth_radio_get_stats( struct bluetooth_radio *radio, IRP *irp )
+{
+    struct winebth_stats *stats = irp->AssociatedIrp.SystemBuffer;
+    IO_STACK_LOCATION *stack = IoGetCurrentIrpStackLocation( irp );
+    ULONG outsize = stack->Parameters.DeviceIoControl.OutputBufferLength;
+    struct bluetooth_characteristic_stats_entry *entries;
+    struct winebth_characteristic_stats *chrc_stats;
+    struct bluetooth_event_stats event_stats = {0};
+    SIZE_T count, i, j, chars_count = 0;
+    LARGE_INTEGER now;
+    ULONG code;
+
+    if (!stats || outsize < WINEBTH_STATS_SIZE( 0, 0 ))
+        return STATUS_INVALID_USER_BUFFER;
+
+    /* Query the backend without holding any locks, only the characteristics that got notifications are listed. */
+    entries = bluetooth_radio_get_characteristics( radio, &count );
+    for (i = 0; i < count; i++)
+    {
+        struct bluetooth_gatt_notification_stats notification_stats = {0};
+
+        winebluetooth_gatt_characteristic_get_notification_stats( entries[i].characteristic, &notification_stats );
+        winebluetooth_gatt_characteristic_free( entries[i].characteristic );
+        if (!notification_stats.received) continue;
+        entries[i].stats.received = notification_stats.received;
+        entries[i].stats.queued = notification_stats.queued;
+        entries[i].stats.queued_bytes = notification_stats.queued_bytes;
+        entries[i].stats.max_queued = notification_stats.max_queued;
+        entries[i].stats.overflow_count = notification_stats.overflow_count;
+        entries[chars_count++].stats = entries[i].stats;
     }
-    default:
-        FIXME( "Unimplemented IOCTL code: %#lx\n", code );
+    winebluetooth_get_event_stats( &event_stats );
+    KeQuerySystemTime( &now );
+
+    memset( stats, 0, WINEBTH_STATS_SIZE( 0, 0 ) );
+    stats->version = WINEBTH_STATS_VERSION;
+    stats->timestamp = now.QuadPart;
+    stats->events_queued = event_stats.queued;
+    stats->events_handled = event_stats.delivered;
+    stats->max_event_backlog = event_stats.max_backlog;
+    stats->locks_enabled = lock_stats_enabled;
+    for (i = 0; i < ARRAY_SIZE( event_type_stats ); i++)
+    {
+        const struct bluetooth_event_type_stats *src = &event_type_stats[i];
+        struct winebth_event_stats *dst = &stats->event_types[i];
+
+        dst->count = ReadNoFence64( &src->count );
+        dst->total_time = ReadNoFence64( &src->total_time );
+        dst->max_time = ReadNoFence64( &src->max_time );
+        for (j = 0; j < WINEBTH_STATS_LATENCY_BUCKETS; j++)
+            dst->latency[j] = ReadNoFence64( &src->latency[j] );
+    }
+    for (i = 0; i < ARRAY_SIZE( lock_stats ); i++)
+    {
+        stats->locks[i].acquisitions = ReadNoFence64( &lock_stats[i].acquisitions );
+        stats->locks[i].contentions = ReadNoFence64( &lock_stats[i].contentions );
+        stats->locks[i].wait_time = ReadNoFence64( &lock_stats[i].wait_time );
+        stats->locks[i].hold_time = ReadNoFence64( &lock_stats[i].hold_time );
+        stats->locks[i].max_hold_time = ReadNoFence64( &lock_stats[i].max_hold_time );
+    }
+    stats->relations_invalidated = ReadNoFence64( &relations_invalidated );
+    stats->pdos_created = ReadNoFence64( &pdos_created );
+    stats->pdos_deleted = ReadNoFence64( &pdos_deleted );
+    for (code = 0; code < ARRAY_SIZE( ioctl_stats ); code++)
+        if (ReadNoFence64( &ioctl_stats[code].calls )) stats->ioctls_count++;
+    stats->characteristics_count = chars_count;
+
+    if (outsize < WINEBTH_STATS_SIZE( stats->ioctls_count, stats->characteristics_count ))
+    {
+        free( entries );
+        irp->IoStatus.Information = WINEBTH_STATS_SIZE( 0, 0 );
+        return STATUS_MORE_ENTRIES;
     }
 
-    irp->IoStatus.Status = status;
-    IoCompleteRequest( irp, IO_NO_INCREMENT );
-    return status;
+    /* IOCTLs seen for the first time since ioctls_count was computed are left out. */
+    for (code = 0, i = 0; code < ARRAY_SIZE( ioctl_stats ) && i < stats->ioctls_count; code++)
+    {
+        const struct bluetooth_ioctl_stats *src = &ioctl_stats[code];
+        struct winebth_ioctl_stats *dst = &stats->ioctls[i];
+
+        if (!(dst->calls = ReadNoFence64( &src->calls ))) continue;
+        dst->code = CTL_CODE( FILE_DEVICE_BLUETOOTH, code, METHOD_BUFFERED, FILE_ANY_ACCESS );
+        dst->errors = ReadNoFence64( &src->errors );
+        dst->pending = ReadNoFence64( &src->pending );
+        dst->total_time = ReadNoFence64( &src->total_time );
+        dst->max_time = ReadNoFence64( &src->max_time );
+        for (j = 0; j < WINEBTH_STATS_LATENCY_BUCKETS; j++)
+            dst->latency[j] = ReadNoFence64( &src->latency[j] );
+        i++;
+    }
+    stats->ioctls_count = i;
+
+    chrc_stats = (struct winebth_characteristic_stats *)&stats->ioctls[stats->ioctls_count];
+    for (i = 0; i < chars_count; i++)
+        chrc_stats[i] = entries[i].stats;
+    free( entries );
+
+    irp->IoStatus.Information = WINEBTH_STATS_SIZE( stats->ioctls_count, stats->characteristics_count );
+    return STATUS_SUCCESS;
 }
 
 static NTSTATUS bluetooth_radio_dispatch( DEVICE_OBJECT *device, struct bluetooth_radio *ext, IRP *irp )
@@ -745,9 +3182,6 @@ static NTSTATUS bluetooth_radio_dispatch( DEVICE_OBJECT *device, struct bluetoot
     NTSTATUS status = irp->IoStatus.Status;
 
     TRACE( "device=%p, ext=%p, irp=%p code=%#lx\n", device, ext, irp, code );
-    ERR( "bluetooth_radio_dispatch: IOCTL code received = 0x%lx\n", code );
-    ERR( "bluetooth_radio_dispatch: IOCTL_WINEBTH_RADIO_GET_LE_DEVICE_GATT_SERVICES = 0x%lx\n",
-         (unsigned long)IOCTL_WINEBTH_RADIO_GET_LE_DEVICE_GATT_SERVICES );
 
     switch (code)
     {
@@ -763,7 +3197,7 @@ static NTSTATUS bluetooth_radio_dispatch( DEVICE_OBJECT *device, struct bluetoot
 
         memset( info, 0, sizeof( *info ) );
 
-        EnterCriticalSection( &device_list_cs );
+        device_list_lock();
         if (ext->props_mask & WINEBLUETOOTH_RADIO_PROPERTY_ADDRESS)
         {
             info->localInfo.flags |= BDIF_ADDRESS;
@@ -787,7 +3221,7 @@ static NTSTATUS bluetooth_radio_dispatch( DEVICE_OBJECT *device, struct bluetoot
             info->flags |= LOCAL_RADIO_DISCOVERABLE;
         if (ext->props_mask & WINEBLUETOOTH_RADIO_PROPERTY_MANUFACTURER)
             info->radioInfo.mfg = ext->props.manufacturer;
-        LeaveCriticalSection( &device_list_cs );
+        device_list_unlock();
 
         irp->IoStatus.Information = sizeof( *info );
         status = STATUS_SUCCESS;
@@ -815,7 +3249,7 @@ static NTSTATUS bluetooth_radio_dispatch( DEVICE_OBJECT *device, struct bluetoot
         irp->IoStatus.Information = 0;
         list->numOfDevices = 0;
 
-        EnterCriticalSection( &device_list_cs );
+        bluetooth_radio_lock_shared( ext );
         LIST_FOR_EACH_ENTRY( device, &ext->remote_devices, struct bluetooth_remote_device, entry )
         {
             list->numOfDevices++;
@@ -826,15 +3260,15 @@ static NTSTATUS bluetooth_radio_dispatch( DEVICE_OBJECT *device, struct bluetoot
                 info = &list->deviceList[list->numOfDevices - 1];
                 memset( info, 0, sizeof( *info ) );
 
-                EnterCriticalSection( &device->props_cs );
+                device_props_lock( device );
                 winebluetooth_device_properties_to_info( device->props_mask, &device->props, info );
-                LeaveCriticalSection( &device->props_cs );
+                device_props_unlock( device );
 
                 irp->IoStatus.Information += sizeof( *info );
                 rem_devices--;
             }
         }
-        LeaveCriticalSection( &device_list_cs );
+        bluetooth_radio_unlock( ext );
 
         irp->IoStatus.Information += sizeof( *list );
         if (list->numOfDevices)
@@ -861,21 +3295,14 @@ static NTSTATUS bluetooth_radio_dispatch( DEVICE_OBJECT *device, struct bluetoot
 
         device_addr = RtlUlonglongByteSwap( *param ) >> 16;
         status = STATUS_DEVICE_NOT_CONNECTED;
-
-        EnterCriticalSection( &device_list_cs );
-        LIST_FOR_EACH_ENTRY( device, &ext->remote_devices, struct bluetooth_remote_device, entry )
-        {
-            EnterCriticalSection( &device->props_cs );
-            found = device->props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_ADDRESS &&
-                    device_addr == device->props.address.ullLong;
-            LeaveCriticalSection( &device->props_cs );
-            if (found)
-            {
-                winebluetooth_device_dup(( device_handle = device->device ));
-                break;
-            }
+
+        bluetooth_radio_lock_shared( ext );
+        if ((device = bluetooth_radio_find_device( ext, device_addr )))
+        {
+            winebluetooth_device_dup(( device_handle = device->device ));
+            found = TRUE;
         }
-        LeaveCriticalSection( &device_list_cs );
+        bluetooth_radio_unlock( ext );
         if (found)
         {
             status = winebluetooth_device_disconnect( device_handle );
@@ -904,11 +3331,119 @@ static NTSTATUS bluetooth_radio_dispatch( DEVICE_OBJECT *device, struct bluetoot
         break;
     }
     case IOCTL_WINEBTH_RADIO_START_DISCOVERY:
-        status = winebluetooth_radio_start_discovery( ext->radio );
+    {
+        struct winebluetooth_discovery_filter filter;
+
+        device_list_lock();
+        filter = ext->discovery_filter;
+        device_list_unlock();
+
+        if (!(status = winebluetooth_radio_set_discovery_filter( ext->radio, &filter )))
+            status = winebluetooth_radio_start_discovery( ext->radio );
+        if (!status)
+            bluetooth_radio_begin_advertisements( ext );
         break;
+    }
     case IOCTL_WINEBTH_RADIO_STOP_DISCOVERY:
         status = winebluetooth_radio_stop_discovery( ext->radio );
+        bluetooth_radio_end_advertisements( ext );
+        break;
+    case IOCTL_WINEBTH_RADIO_SET_DISCOVERY_FILTER:
+    {
+        const struct winebth_radio_set_discovery_filter_params *params = irp->AssociatedIrp.SystemBuffer;
+        struct winebluetooth_discovery_filter filter = {0};
+        BOOL discovering;
+
+        if (!params || insize < sizeof( *params ))
+        {
+            status = STATUS_INVALID_USER_BUFFER;
+            break;
+        }
+        if (params->uuids_count > ARRAY_SIZE( params->uuids ))
+        {
+            status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        filter.transport = params->transport;
+        filter.flags = params->flags;
+        filter.rssi = params->rssi;
+        filter.uuids_count = params->uuids_count;
+        memcpy( filter.uuids, params->uuids, params->uuids_count * sizeof( *params->uuids ) );
+
+        device_list_lock();
+        ext->discovery_filter = filter;
+        discovering = ext->discovering;
+        device_list_unlock();
+
+        /* Otherwise, it gets applied by the next IOCTL_WINEBTH_RADIO_START_DISCOVERY. */
+        status = discovering ? winebluetooth_radio_set_discovery_filter( ext->radio, &filter ) : STATUS_SUCCESS;
+        break;
+    }
+    case IOCTL_WINEBTH_RADIO_READ_ADVERTISEMENTS:
+    {
+        if (!irp->AssociatedIrp.SystemBuffer ||
+            outsize < offsetof( struct winebth_radio_read_advertisements_params, data[0] ))
+        {
+            status = STATUS_INVALID_USER_BUFFER;
+            break;
+        }
+
+        /* device_list_cs guards the advertisement queue and the pending READ_ADVERTISEMENTS IRPs. */
+        device_list_lock();
+        status = bluetooth_radio_queue_advertisement_irp( ext, irp );
+        device_list_unlock();
+        break;
+    }
+    case IOCTL_WINEBTH_RADIO_GET_DEVICE_CHANGES:
+    {
+        if (!irp->AssociatedIrp.SystemBuffer ||
+            insize < offsetof( struct winebth_radio_get_device_changes_params, flags ) ||
+            outsize < offsetof( struct winebth_radio_get_device_changes_params, changes[0] ))
+        {
+            status = STATUS_INVALID_USER_BUFFER;
+            break;
+        }
+
+        device_list_lock();
+        bluetooth_radio_get_device_changes( ext, irp );
+        device_list_unlock();
+        status = STATUS_SUCCESS;
+        break;
+    }
+    case IOCTL_WINEBTH_RADIO_GET_STATS:
+        status = bluetooth_radio_get_stats( ext, irp );
+        break;
+    case IOCTL_WINEBTH_RADIO_WAIT_DEVICE_CHANGES:
+    {
+        if (!irp->AssociatedIrp.SystemBuffer ||
+            insize < offsetof( struct winebth_radio_get_device_changes_params, flags ) ||
+            outsize < offsetof( struct winebth_radio_get_device_changes_params, changes[0] ))
+        {
+            status = STATUS_INVALID_USER_BUFFER;
+            break;
+        }
+
+        device_list_lock();
+        status = bluetooth_radio_queue_device_change_irp( ext, irp );
+        device_list_unlock();
         break;
+    }
+    case IOCTL_WINEBTH_RADIO_WAIT_CONNECTION_CHANGES:
+    {
+        if (!irp->AssociatedIrp.SystemBuffer ||
+            insize < offsetof( struct winebth_radio_wait_connection_changes_params, flags ) ||
+            outsize < offsetof( struct winebth_radio_wait_connection_changes_params, changes[0] ))
+        {
+            status = STATUS_INVALID_USER_BUFFER;
+            break;
+        }
+
+        device_list_lock();
+        status = bluetooth_radio_queue_connection_irp( ext, irp );
+        device_list_unlock();
+        break;
+    }
     case IOCTL_WINEBTH_RADIO_SEND_AUTH_RESPONSE:
     {
         struct winebth_radio_send_auth_response_params *params = irp->AssociatedIrp.SystemBuffer;
@@ -931,27 +3466,18 @@ static NTSTATUS bluetooth_radio_dispatch( DEVICE_OBJECT *device, struct bluetoot
         }
 
         status = STATUS_DEVICE_NOT_CONNECTED;
-        EnterCriticalSection( &device_list_cs );
-        LIST_FOR_EACH_ENTRY( device, &ext->remote_devices, struct bluetooth_remote_device, entry )
+        bluetooth_radio_lock_shared( ext );
+        if ((device = bluetooth_radio_find_device( ext, params->address )))
         {
-            BOOL matches;
-            EnterCriticalSection( &device->props_cs );
-            matches = device->props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_ADDRESS &&
-                      device->props.address.ullLong == params->address;
-            LeaveCriticalSection( &device->props_cs );
-            if (matches)
-            {
-                BOOL authenticated = FALSE;
-                status = winebluetooth_auth_send_response( device->device, params->method,
-                                                           params->numeric_value_or_passkey, params->negative,
-                                                           &authenticated );
-                params->authenticated = !!authenticated;
-                break;
-            }
+            BOOL authenticated = FALSE;
+            status = winebluetooth_auth_send_response( device->device, params->method,
+                                                       params->numeric_value_or_passkey, params->negative,
+                                                       &authenticated );
+            params->authenticated = !!authenticated;
         }
+        bluetooth_radio_unlock( ext );
         if (!status)
             irp->IoStatus.Information = sizeof( *params );
-        LeaveCriticalSection( &device_list_cs );
         break;
     }
     case IOCTL_WINEBTH_RADIO_START_AUTH:
@@ -971,38 +3497,32 @@ static NTSTATUS bluetooth_radio_dispatch( DEVICE_OBJECT *device, struct bluetoot
         }
 
         status = STATUS_DEVICE_DOES_NOT_EXIST;
-        EnterCriticalSection( &device_list_cs );
-        LIST_FOR_EACH_ENTRY( device, &ext->remote_devices, struct bluetooth_remote_device, entry )
+        /* device_list_cs guards irp_list. */
+        device_list_lock();
+        bluetooth_radio_lock_shared( ext );
+        if ((device = bluetooth_radio_find_device( ext, params->address )))
         {
-            BOOL matches;
-            EnterCriticalSection( &device->props_cs );
-            matches = device->props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_ADDRESS &&
-                device->props.address.ullLong == params->address;
-            LeaveCriticalSection( &device->props_cs );
-            if (matches)
+            status = winebluetooth_device_start_pairing( device->device, irp );
+            if (status == STATUS_PENDING)
             {
-                status = winebluetooth_device_start_pairing( device->device, irp );
-                if (status == STATUS_PENDING)
-                {
-                    IoSetCancelRoutine( irp, bluetooth_irp_cancel_routine );
-
-                    if (irp->Cancel && IoSetCancelRoutine( irp, NULL ))
-                    {
-                        LeaveCriticalSection( &device_list_cs );
-                        irp->IoStatus.Status = STATUS_CANCELLED;
-                        irp->IoStatus.Information = 0;
-                        IoCompleteRequest( irp, IO_NO_INCREMENT );
-                        status = STATUS_CANCELLED;
-                        break;
-                    }
+                IoSetCancelRoutine( irp, bluetooth_irp_cancel_routine );
 
-                    IoMarkIrpPending( irp );
-                    InsertTailList( &ext->irp_list, &irp->Tail.Overlay.ListEntry );
+                if (irp->Cancel && IoSetCancelRoutine( irp, NULL ))
+                {
+                    bluetooth_radio_unlock( ext );
+                    device_list_unlock();
+                    irp->IoStatus.Status = STATUS_CANCELLED;
+                    irp->IoStatus.Information = 0;
+                    IoCompleteRequest( irp, IO_NO_INCREMENT );
+                    return STATUS_CANCELLED;
                 }
-                break;
+
+                IoMarkIrpPending( irp );
+                InsertTailList( &ext->irp_list, &irp->Tail.Overlay.ListEntry );
             }
         }
-        LeaveCriticalSection( &device_list_cs );
+        bluetooth_radio_unlock( ext );
+        device_list_unlock();
         break;
     }
     case IOCTL_WINEBTH_RADIO_REMOVE_DEVICE:
@@ -1025,22 +3545,20 @@ static NTSTATUS bluetooth_radio_dispatch( DEVICE_OBJECT *device, struct bluetoot
         }
 
         status = STATUS_NOT_FOUND;
-        EnterCriticalSection( &device_list_cs );
-        LIST_FOR_EACH_ENTRY( device, &ext->remote_devices, struct bluetooth_remote_device, entry )
+        bluetooth_radio_lock_shared( ext );
+        if ((device = bluetooth_radio_find_device( ext, *param )))
         {
-            EnterCriticalSection( &device->props_cs );
-            found = device->props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_ADDRESS &&
-                    device->props.address.ullLong == *param && device->props.paired;
-            LeaveCriticalSection( &device->props_cs );
+            device_props_lock( device );
+            found = device->props.paired;
+            device_props_unlock( device );
 
             if (found)
             {
                 winebluetooth_device_dup(( device_handle = device->device ));
                 winebluetooth_radio_dup(( radio_handle = ext->radio ));
-                break;
             }
         }
-        LeaveCriticalSection( &device_list_cs );
+        bluetooth_radio_unlock( ext );
         if (found)
         {
             status = winebluetooth_radio_remove_device( radio_handle, device_handle );
@@ -1050,517 +3568,82 @@ static NTSTATUS bluetooth_radio_dispatch( DEVICE_OBJECT *device, struct bluetoot
         break;
     }
     case IOCTL_WINEBTH_RADIO_GET_LE_DEVICE_GATT_SERVICES:
-    {
-        const SIZE_T min_size = offsetof( struct winebth_radio_get_le_device_gatt_services_params, services[0] );
-        struct winebth_radio_get_le_device_gatt_services_params *params = irp->AssociatedIrp.SystemBuffer;
-        struct bluetooth_remote_device *device;
-        BTH_ADDR device_addr;
-        SIZE_T rem;
-        BOOL found = FALSE;
-        winebluetooth_device_t device_handle = {0};
-        BOOL need_connect = FALSE;
-
-        ERR( "IOCTL_WINEBTH_RADIO_GET_LE_DEVICE_GATT_SERVICES handler called!\n" );
-
-        if (!params || outsize < min_size || insize < sizeof( BTH_ADDR ))
-        {
-            status = STATUS_INVALID_USER_BUFFER;
-            break;
-        }
-
-        device_addr = params->address;
-        rem = (outsize - min_size) / sizeof( *params->services );
-        status = STATUS_DEVICE_NOT_CONNECTED;
-        params->count = 0;
-
-        EnterCriticalSection( &device_list_cs );
-        LIST_FOR_EACH_ENTRY( device, &ext->remote_devices, struct bluetooth_remote_device, entry )
-        {
-            BOOL matches;
-            EnterCriticalSection( &device->props_cs );
-            matches = device->props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_ADDRESS &&
-                      device->props.address.ullLong == device_addr;
-            if (matches)
-            {
-                struct bluetooth_gatt_service *svc;
-
-                TRACE( "RADIO_GET_LE_DEVICE_GATT_SERVICES: found device '%s' with %s gatt_services connected=%d\n",
-                       device->props.name, list_empty( &device->gatt_services ) ? "empty" : "populated",
-                       device->props.connected );
-
-                if (list_empty( &device->gatt_services ) && !device->props.connected)
-                {
-                    need_connect = TRUE;
-                    winebluetooth_device_dup(( device_handle = device->device ));
-                }
-
-                found = TRUE;
-                status = STATUS_SUCCESS;
-                LIST_FOR_EACH_ENTRY( svc, &device->gatt_services, struct bluetooth_gatt_service, entry )
-                {
-                    if (!svc->primary)
-                        continue;
-                    params->count++;
-                    if (rem)
-                    {
-                        BTH_LE_GATT_SERVICE *info = &params->services[params->count - 1];
-                        memset( info, 0, sizeof( *info ) );
-                        uuid_to_le( &svc->uuid, &info->ServiceUuid );
-                        info->AttributeHandle = svc->handle;
-                        rem--;
-                    }
-                }
-            }
-            LeaveCriticalSection( &device->props_cs );
-            if (found)
-                break;
-        }
-        LeaveCriticalSection( &device_list_cs );
-
-        if (need_connect && device_handle.handle)
-        {
-            ERR( "RADIO_GET_LE_DEVICE_GATT_SERVICES: triggering connection and waiting for services...\n" );
-            winebluetooth_device_start_pairing( device_handle, NULL );
-            winebluetooth_device_free( device_handle );
-
-            /* Give event loop time to process GATT_SERVICE_ADDED events */
-            Sleep( 500 );
-
-            /* Re-query services after pairing */
-            params->count = 0;
-            EnterCriticalSection( &device_list_cs );
-            LIST_FOR_EACH_ENTRY( device, &ext->remote_devices, struct bluetooth_remote_device, entry )
-            {
-                BOOL matches;
-                EnterCriticalSection( &device->props_cs );
-                matches = device->props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_ADDRESS &&
-                          device->props.address.ullLong == device_addr;
-                if (matches)
-                {
-                    struct bluetooth_gatt_service *svc;
-                    ERR( "RADIO_GET_LE_DEVICE_GATT_SERVICES: re-query after pairing, checking device '%s' addr=%I64x\n",
-                           device->props.name, device->props.address.ullLong );
-                    LIST_FOR_EACH_ENTRY( svc, &device->gatt_services, struct bluetooth_gatt_service, entry )
-                    {
-                        if (!svc->primary)
-                            continue;
-                        params->count++;
-                        if (rem > params->count - 1)
-                        {
-                            BTH_LE_GATT_SERVICE *info = &params->services[params->count - 1];
-                            memset( info, 0, sizeof( *info ) );
-                            uuid_to_le( &svc->uuid, &info->ServiceUuid );
-                            info->AttributeHandle = svc->handle;
-                        }
-                    }
-                    ERR( "RADIO_GET_LE_DEVICE_GATT_SERVICES: re-query found %lu services\n", params->count );
-                }
-                LeaveCriticalSection( &device->props_cs );
-                if (matches)
-                    break;
-            }
-            LeaveCriticalSection( &device_list_cs );
-        }
-
-        if (status == STATUS_SUCCESS)
-            irp->IoStatus.Information = min_size + params->count * sizeof( *params->services );
-        break;
-    }
-    case IOCTL_WINEBTH_RADIO_GET_DEVICE_CONNECTION_STATUS:
-    {
-        struct winebth_radio_get_device_connection_status_params *params = irp->AssociatedIrp.SystemBuffer;
-        struct bluetooth_remote_device *device;
-        BTH_ADDR device_addr;
-        BOOL found = FALSE;
-
-        if (!params || insize < sizeof( *params ) || outsize < sizeof( *params ))
-        {
-            status = STATUS_INVALID_USER_BUFFER;
-            break;
-        }
-
-        device_addr = params->address;
-        status = STATUS_NOT_FOUND;
-        params->connected = FALSE;
-
-        EnterCriticalSection( &device_list_cs );
-        LIST_FOR_EACH_ENTRY( device, &ext->remote_devices, struct bluetooth_remote_device, entry )
-        {
-            BOOL matches;
-            EnterCriticalSection( &device->props_cs );
-            matches = device->props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_ADDRESS &&
-                      device->props.address.ullLong == device_addr;
-            if (matches)
-            {
-                params->connected = device->props.connected;
-                found = TRUE;
-                status = STATUS_SUCCESS;
-                TRACE( "GET_DEVICE_CONNECTION_STATUS: device %s connected=%d\n",
-                       device->props.name, device->props.connected );
-            }
-            LeaveCriticalSection( &device->props_cs );
-            if (found)
-                break;
-        }
-        LeaveCriticalSection( &device_list_cs );
-
-        if (status == STATUS_SUCCESS)
-            irp->IoStatus.Information = sizeof( *params );
-        break;
-    }
     case IOCTL_WINEBTH_RADIO_GET_LE_DEVICE_GATT_CHARACTERISTICS:
-    {
-        const SIZE_T min_size = offsetof( struct winebth_radio_get_le_device_gatt_characteristics_params, characteristics[0] );
-        struct winebth_radio_get_le_device_gatt_characteristics_params *params = irp->AssociatedIrp.SystemBuffer;
-        struct bluetooth_remote_device *device;
-        BTH_ADDR device_addr;
-        SIZE_T rem;
-        BOOL found = FALSE;
-        GUID svc_uuid;
-        winebluetooth_device_t device_handle = {0};
-        BOOL need_wait = FALSE;
-
-        ERR( "IOCTL_WINEBTH_RADIO_GET_LE_DEVICE_GATT_CHARACTERISTICS handler called!\n" );
-
-        if (!params || outsize < min_size || insize < min_size)
-        {
-            status = STATUS_INVALID_USER_BUFFER;
-            break;
-        }
-
-        device_addr = params->address;
-        le_to_uuid( &params->service.ServiceUuid, &svc_uuid );
-        rem = (outsize - min_size) / sizeof( *params->characteristics );
-        status = STATUS_NOT_FOUND;
-        params->count = 0;
-
-        EnterCriticalSection( &device_list_cs );
-        LIST_FOR_EACH_ENTRY( device, &ext->remote_devices, struct bluetooth_remote_device, entry )
-        {
-            BOOL matches;
-            EnterCriticalSection( &device->props_cs );
-            matches = device->props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_ADDRESS &&
-                      device->props.address.ullLong == device_addr;
-            if (matches)
-            {
-                struct bluetooth_gatt_service *svc;
-
-                TRACE( "RADIO_GET_LE_DEVICE_GATT_CHARACTERISTICS: found device '%s', looking for service\n",
-                       device->props.name );
-
-                found = TRUE;
-                LIST_FOR_EACH_ENTRY( svc, &device->gatt_services, struct bluetooth_gatt_service, entry )
-                {
-                    if (IsEqualGUID( &svc->uuid, &svc_uuid ) && svc->handle == params->service.AttributeHandle)
-                    {
-                        struct bluetooth_gatt_characteristic *chrc;
-
-                        TRACE( "RADIO_GET_LE_DEVICE_GATT_CHARACTERISTICS: found service, enumerating characteristics\n" );
-                        status = STATUS_SUCCESS;
-                        if (list_empty( &svc->characteristics ))
-                        {
-                            need_wait = TRUE;
-                            winebluetooth_device_dup(( device_handle = device->device ));
-                            ERR( "RADIO_GET_LE_DEVICE_GATT_CHARACTERISTICS: characteristics empty, will wait for discovery\n" );
-                        }
-                        else
-                        {
-                            LIST_FOR_EACH_ENTRY( chrc, &svc->characteristics, struct bluetooth_gatt_characteristic, entry )
-                            {
-                                params->count++;
-                                if (rem)
-                                {
-                                    params->characteristics[params->count - 1] = chrc->props;
-                                    rem--;
-                                }
-                            }
-                        }
-                        break;
-                    }
-                }
-            }
-            LeaveCriticalSection( &device->props_cs );
-            if (found)
-                break;
-        }
-        LeaveCriticalSection( &device_list_cs );
-
-        if (need_wait && device_handle.handle)
-        {
-            ERR( "RADIO_GET_LE_DEVICE_GATT_CHARACTERISTICS: waiting for characteristic discovery...\n" );
-            winebluetooth_device_start_pairing( device_handle, NULL );
-            winebluetooth_device_free( device_handle );
-
-            rem = (outsize - min_size) / sizeof( *params->characteristics );
-            params->count = 0;
-            EnterCriticalSection( &device_list_cs );
-            LIST_FOR_EACH_ENTRY( device, &ext->remote_devices, struct bluetooth_remote_device, entry )
-            {
-                BOOL matches;
-                EnterCriticalSection( &device->props_cs );
-                matches = device->props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_ADDRESS &&
-                          device->props.address.ullLong == device_addr;
-                if (matches)
-                {
-                    struct bluetooth_gatt_service *svc;
-                    LIST_FOR_EACH_ENTRY( svc, &device->gatt_services, struct bluetooth_gatt_service, entry )
-                    {
-                        if (IsEqualGUID( &svc->uuid, &svc_uuid ) && svc->handle == params->service.AttributeHandle)
-                        {
-                            struct bluetooth_gatt_characteristic *chrc;
-                            LIST_FOR_EACH_ENTRY( chrc, &svc->characteristics, struct bluetooth_gatt_characteristic, entry )
-                            {
-                                params->count++;
-                                if (rem)
-                                {
-                                    params->characteristics[params->count - 1] = chrc->props;
-                                    rem--;
-                                }
-                            }
-                            ERR( "RADIO_GET_LE_DEVICE_GATT_CHARACTERISTICS: after wait, found %lu characteristics\n", params->count );
-                            break;
-                        }
-                    }
-                }
-                LeaveCriticalSection( &device->props_cs );
-                if (matches)
-                    break;
-            }
-            LeaveCriticalSection( &device_list_cs );
-        }
-
-        /* Sort characteristics by UUID - some apps (e.g. Square Golf) stop iterating early
-         * and expect specific characteristics to appear before others. Windows appears to
-         * return characteristics sorted by UUID. */
-        if (params->count > 1)
-            qsort( params->characteristics, params->count, sizeof(params->characteristics[0]),
-                   compare_characteristics_by_uuid );
-
-        if (status == STATUS_SUCCESS)
-            irp->IoStatus.Information = min_size + params->count * sizeof( *params->characteristics );
-        break;
-    }
-    case IOCTL_WINEBTH_RADIO_READ_NOTIFICATION:
-    {
-        const SIZE_T min_size = offsetof( struct winebth_radio_read_notification_params, data[0] );
-        struct winebth_radio_read_notification_params *params = irp->AssociatedIrp.SystemBuffer;
-        struct bluetooth_remote_device *device;
-        BTH_ADDR device_addr;
-        BOOL found = FALSE;
-        GUID svc_uuid;
-
-        ERR( "IOCTL_WINEBTH_RADIO_READ_NOTIFICATION handler called!\n" );
-
-        if (!params || outsize < min_size || insize < min_size)
-        {
-            status = STATUS_INVALID_USER_BUFFER;
-            break;
-        }
-
-        device_addr = params->address;
-        le_to_uuid( &params->service.ServiceUuid, &svc_uuid );
-        status = STATUS_NOT_FOUND;
-
-        EnterCriticalSection( &device_list_cs );
-        LIST_FOR_EACH_ENTRY( device, &ext->remote_devices, struct bluetooth_remote_device, entry )
-        {
-            BOOL matches;
-            EnterCriticalSection( &device->props_cs );
-            matches = device->props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_ADDRESS &&
-                      device->props.address.ullLong == device_addr;
-            if (matches)
-            {
-                struct bluetooth_gatt_service *svc;
-                found = TRUE;
-                LIST_FOR_EACH_ENTRY( svc, &device->gatt_services, struct bluetooth_gatt_service, entry )
-                {
-                    if ((IsEqualGUID( &svc->uuid, &svc_uuid ) && svc->handle == params->service.AttributeHandle) ||
-                        (IsEqualGUID( &svc_uuid, &GUID_NULL ) && svc->handle == params->characteristic.ServiceHandle))
-                    {
-                        struct bluetooth_gatt_characteristic *chrc;
-                        chrc = find_gatt_characteristic( svc, &params->characteristic );
-                        if (chrc)
-                        {
-                            winebluetooth_gatt_characteristic_t characteristic = chrc->characteristic;
-                            unsigned int data_size = 0;
-                            unsigned int buffer_size = outsize >= min_size ? (unsigned int)(outsize - min_size) : 0;
-
-                            if (!characteristic.handle)
-                            {
-                                ERR( "GATT characteristic handle is NULL!\n" );
-                                status = STATUS_DEVICE_NOT_CONNECTED;
-                                break;
-                            }
-
-                            LeaveCriticalSection( &device->props_cs );
-                            LeaveCriticalSection( &device_list_cs );
-
-                            status = winebluetooth_gatt_characteristic_read_notification(
-                                characteristic,
-                                params->data,
-                                buffer_size,
-                                &data_size );
-
-                            winebluetooth_gatt_characteristic_free( characteristic );
-
-                            if (status == STATUS_SUCCESS)
-                                irp->IoStatus.Information = min_size + data_size;
-                            else
-                                irp->IoStatus.Information = 0;
-
-                            irp->IoStatus.Status = status;
-                            IoCompleteRequest( irp, IO_NO_INCREMENT );
-                            return status;
-                        }
-                        else
-                            status = STATUS_INVALID_PARAMETER;
-                        break;
-                    }
-                }
-            }
-            LeaveCriticalSection( &device->props_cs );
-            if (found)
-                break;
-        }
-        LeaveCriticalSection( &device_list_cs );
-        break;
-    }
+    case IOCTL_WINEBTH_RADIO_GET_LE_DEVICE_GATT_DATABASE:
     case IOCTL_WINEBTH_RADIO_READ_CHARACTERISTIC:
+        status = bluetooth_radio_gatt_request( ext, irp, TRUE );
+        break;
+    case IOCTL_WINEBTH_RADIO_GET_DEVICE_CONNECTION_STATUS:
     {
-        const SIZE_T min_size = offsetof( struct winebth_radio_read_characteristic_params, data[0] );
-        struct winebth_radio_read_characteristic_params *params = irp->AssociatedIrp.SystemBuffer;
+        struct winebth_radio_get_device_connection_status_params *params = irp->AssociatedIrp.SystemBuffer;
         struct bluetooth_remote_device *device;
-        BTH_ADDR device_addr;
-        BOOL found = FALSE;
-        GUID svc_uuid;
-        winebluetooth_device_t device_handle = {0};
-        BOOL need_connect = FALSE;
 
-        ERR( "IOCTL_WINEBTH_RADIO_READ_CHARACTERISTIC: addr=%I64x insize=%u outsize=%u min=%Iu\n",
-             params ? params->address : 0, (unsigned int)insize, (unsigned int)outsize, min_size );
-
-        if (!params || outsize < min_size || insize < min_size)
+        if (!params || insize < sizeof( *params ) || outsize < sizeof( *params ))
         {
-            ERR( "IOCTL_WINEBTH_RADIO_READ_CHARACTERISTIC: invalid buffer\n" );
             status = STATUS_INVALID_USER_BUFFER;
             break;
         }
 
-        device_addr = params->address;
-        le_to_uuid( &params->service.ServiceUuid, &svc_uuid );
-
-    retry:
         status = STATUS_NOT_FOUND;
+        params->connected = FALSE;
 
-        ERR( "IOCTL_WINEBTH_RADIO_READ_CHARACTERISTIC: looking for device addr=%I64x svc=%s char_handle=%u\n",
-             device_addr, debugstr_guid( &svc_uuid ), params->characteristic.AttributeHandle );
-
-        EnterCriticalSection( &device_list_cs );
-        LIST_FOR_EACH_ENTRY( device, &ext->remote_devices, struct bluetooth_remote_device, entry )
+        bluetooth_radio_lock_shared( ext );
+        if ((device = bluetooth_radio_find_device( ext, params->address )))
         {
-            BOOL matches;
-            EnterCriticalSection( &device->props_cs );
-            matches = device->props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_ADDRESS &&
-                      device->props.address.ullLong == device_addr;
-            if (matches)
-            {
-                struct bluetooth_gatt_service *svc;
-
-                if (!device->props.connected && !need_connect)
-                {
-                    ERR( "IOCTL_WINEBTH_RADIO_READ_CHARACTERISTIC: device not connected, triggering connect\n" );
-                    need_connect = TRUE;
-                    winebluetooth_device_dup(( device_handle = device->device ));
-                    LeaveCriticalSection( &device->props_cs );
-                    break;
-                }
-
-                found = TRUE;
-                ERR( "IOCTL_WINEBTH_RADIO_READ_CHARACTERISTIC: found device, scanning %u services\n",
-                     list_count( &device->gatt_services ) );
-                LIST_FOR_EACH_ENTRY( svc, &device->gatt_services, struct bluetooth_gatt_service, entry )
-                {
-                    ERR( "IOCTL_WINEBTH_RADIO_READ_CHARACTERISTIC: checking svc=%s handle=%u\n",
-                         debugstr_guid( &svc->uuid ), svc->handle );
-                    if ((IsEqualGUID( &svc->uuid, &svc_uuid ) && svc->handle == params->service.AttributeHandle) ||
-                        (IsEqualGUID( &svc_uuid, &GUID_NULL ) && svc->handle == params->characteristic.ServiceHandle))
-                    {
-                        struct bluetooth_gatt_characteristic *chrc;
-                        ERR( "IOCTL_WINEBTH_RADIO_READ_CHARACTERISTIC: service match! looking for char\n" );
-                        chrc = find_gatt_characteristic( svc, &params->characteristic );
-                        if (chrc)
-                        {
-                            winebluetooth_gatt_characteristic_t characteristic = chrc->characteristic;
-                            unsigned int data_size = 0;
-                            unsigned int buffer_size = outsize >= min_size ? (unsigned int)(outsize - min_size) : 0;
-
-                            LeaveCriticalSection( &device->props_cs );
-                            LeaveCriticalSection( &device_list_cs );
-
-                            ERR( "IOCTL_WINEBTH_RADIO_READ_CHARACTERISTIC: calling read (blocking) buf_size=%u\n", buffer_size );
-                            status = winebluetooth_gatt_characteristic_read(
-                                characteristic,
-                                params->data,
-                                buffer_size,
-                                &data_size );
-                            ERR( "IOCTL_WINEBTH_RADIO_READ_CHARACTERISTIC: read returned status=0x%x data_size=%u\n",
-                                 (unsigned int)status, data_size );
-
-                            winebluetooth_gatt_characteristic_free( characteristic );
-
-                            if (status == STATUS_SUCCESS)
-                            {
-                                params->data_size = data_size;
-                                irp->IoStatus.Information = min_size + data_size;
-                            }
-                            else
-                                irp->IoStatus.Information = 0;
-
-                            irp->IoStatus.Status = status;
-                            IoCompleteRequest( irp, IO_NO_INCREMENT );
-                            return status;
-                        }
-                        else
-                        {
-                            ERR( "IOCTL_WINEBTH_RADIO_READ_CHARACTERISTIC: char NOT found\n" );
-                            status = STATUS_INVALID_PARAMETER;
-                        }
-                        break;
-                    }
-                }
-            }
-            LeaveCriticalSection( &device->props_cs );
-            if (found)
-                break;
+            device_props_lock( device );
+            params->connected = device->props.connected;
+            TRACE( "GET_DEVICE_CONNECTION_STATUS: device %s connected=%d\n",
+                   device->props.name, device->props.connected );
+            device_props_unlock( device );
+            status = STATUS_SUCCESS;
         }
-        LeaveCriticalSection( &device_list_cs );
+        bluetooth_radio_unlock( ext );
+
+        if (status == STATUS_SUCCESS)
+            irp->IoStatus.Information = sizeof( *params );
         break;
+    }
+    case IOCTL_WINEBTH_RADIO_READ_NOTIFICATION:
+    case IOCTL_WINEBTH_RADIO_READ_NOTIFICATIONS:
+    {
+        const SIZE_T min_size = code == IOCTL_WINEBTH_RADIO_READ_NOTIFICATIONS ?
+            offsetof( struct winebth_radio_read_notifications_params, data[0] ) :
+            offsetof( struct winebth_radio_read_notification_params, data[0] );
+        /* Both start with the same address, service and characteristic fields. */
+        struct winebth_radio_read_notification_params *params = irp->AssociatedIrp.SystemBuffer;
+        struct bluetooth_gatt_characteristic *chrc;
+        struct bluetooth_remote_device *device;
 
-        if (need_connect && device_handle.handle)
+        if (!params || outsize < min_size || insize < min_size)
         {
-            ERR( "IOCTL_WINEBTH_RADIO_READ_CHARACTERISTIC: connecting...\n" );
-            winebluetooth_device_start_pairing( device_handle, NULL );
-            winebluetooth_device_free( device_handle );
-            device_handle.handle = 0;
-            Sleep( 500 );
-            goto retry;
+            status = STATUS_INVALID_USER_BUFFER;
+            break;
         }
 
-        if (!found)
-            ERR( "IOCTL_WINEBTH_RADIO_READ_CHARACTERISTIC: device NOT found\n" );
-        ERR( "IOCTL_WINEBTH_RADIO_READ_CHARACTERISTIC: final status=0x%x\n", (unsigned int)status );
+        status = STATUS_NOT_FOUND;
+        /* device_list_cs guards the pending READ_NOTIFICATION IRPs. */
+        device_list_lock();
+        bluetooth_radio_lock_shared( ext );
+        if ((device = bluetooth_radio_find_device( ext, params->address )))
+        {
+            if ((chrc = bluetooth_device_find_characteristic( device, &params->service, &params->characteristic )))
+                status = bluetooth_gatt_characteristic_queue_notification_irp( chrc, irp );
+            else
+                status = STATUS_INVALID_PARAMETER;
+        }
+        bluetooth_radio_unlock( ext );
+        device_list_unlock();
         break;
     }
     case IOCTL_WINEBTH_RADIO_WRITE_CHARACTERISTIC:
     {
         const SIZE_T min_size = offsetof( struct winebth_radio_write_characteristic_params, data[0] );
         struct winebth_radio_write_characteristic_params *params = irp->AssociatedIrp.SystemBuffer;
+        winebluetooth_gatt_characteristic_t characteristic = {0};
+        struct bluetooth_gatt_characteristic *chrc;
         struct bluetooth_remote_device *device;
-        BTH_ADDR device_addr;
-        BOOL found = FALSE;
-        GUID svc_uuid;
-
-        ERR( "IOCTL_WINEBTH_RADIO_WRITE_CHARACTERISTIC handler called!\n" );
+        ULONG size, write_type;
+        unsigned char *data;
 
         if (!params || insize < min_size)
         {
@@ -1574,74 +3657,92 @@ static NTSTATUS bluetooth_radio_dispatch( DEVICE_OBJECT *device, struct bluetoot
             break;
         }
 
-        device_addr = params->address;
-        le_to_uuid( &params->service.ServiceUuid, &svc_uuid );
-        status = STATUS_NOT_FOUND;
+        size = params->data_size;
+        write_type = params->write_type;
+        if (!(data = malloc( max( size, 1 ) )))
+        {
+            status = STATUS_NO_MEMORY;
+            break;
+        }
+        memcpy( data, params->data, size );
 
-        EnterCriticalSection( &device_list_cs );
-        LIST_FOR_EACH_ENTRY( device, &ext->remote_devices, struct bluetooth_remote_device, entry )
+        status = STATUS_NOT_FOUND;
+        bluetooth_radio_lock_shared( ext );
+        if ((device = bluetooth_radio_find_device( ext, params->address )))
         {
-            BOOL matches;
-            EnterCriticalSection( &device->props_cs );
-            matches = device->props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_ADDRESS &&
-                      device->props.address.ullLong == device_addr;
-            if (matches)
-            {
-                struct bluetooth_gatt_service *svc;
-                found = TRUE;
-                LIST_FOR_EACH_ENTRY( svc, &device->gatt_services, struct bluetooth_gatt_service, entry )
-                {
-                    if ((IsEqualGUID( &svc->uuid, &svc_uuid ) && svc->handle == params->service.AttributeHandle) ||
-                        (IsEqualGUID( &svc_uuid, &GUID_NULL ) && svc->handle == params->characteristic.ServiceHandle))
-                    {
-                        struct bluetooth_gatt_characteristic *chrc;
-                        chrc = find_gatt_characteristic( svc, &params->characteristic );
-                        if (chrc)
-                        {
-                            winebluetooth_gatt_characteristic_t characteristic = chrc->characteristic;
+            EnterCriticalSection( &device->gatt_cs );
+            if ((chrc = bluetooth_device_find_characteristic( device, &params->service, &params->characteristic )))
+                status = bluetooth_device_queue_gatt_io_irp( device, chrc, irp, &characteristic );
+            else
+                status = STATUS_INVALID_PARAMETER;
+            LeaveCriticalSection( &device->gatt_cs );
+        }
+        bluetooth_radio_unlock( ext );
 
-                            LeaveCriticalSection( &device->props_cs );
-                            LeaveCriticalSection( &device_list_cs );
+        if (characteristic.handle)
+            bluetooth_gatt_io_irp_started( device, characteristic, irp,
+                                           winebluetooth_gatt_characteristic_write( characteristic, data, size,
+                                                                                    write_type, irp ) );
+        free( data );
+        break;
+    }
+    case IOCTL_WINEBTH_RADIO_WRITE_CHARACTERISTIC_STREAM:
+    {
+        const SIZE_T min_size = offsetof( struct winebth_radio_write_characteristic_stream_params, data[0] );
+        struct winebth_radio_write_characteristic_stream_params *params = irp->AssociatedIrp.SystemBuffer;
+        struct bluetooth_gatt_characteristic *chrc;
+        struct bluetooth_remote_device *device;
 
-                            status = winebluetooth_gatt_characteristic_write(
-                                characteristic,
-                                params->data,
-                                params->data_size,
-                                params->write_type );
+        if (!params || insize < min_size || outsize < min_size || insize - min_size < params->data_size)
+        {
+            status = STATUS_INVALID_USER_BUFFER;
+            break;
+        }
 
-                            winebluetooth_gatt_characteristic_free( characteristic );
+        status = STATUS_NOT_FOUND;
+        bluetooth_radio_lock_shared( ext );
+        if ((device = bluetooth_radio_find_device( ext, params->address )))
+        {
+            if ((chrc = bluetooth_device_find_characteristic( device, &params->service, &params->characteristic )))
+                status = bluetooth_gatt_characteristic_start_write_stream( chrc, irp, params->data,
+                                                                           params->data_size, &params->result,
+                                                                           min_size );
+            else
+                status = STATUS_INVALID_PARAMETER;
+        }
+        bluetooth_radio_unlock( ext );
+        break;
+    }
+    case IOCTL_WINEBTH_RADIO_GET_LE_DEVICE_ATT_MTU:
+    {
+        struct winebth_radio_get_le_device_att_mtu_params *params = irp->AssociatedIrp.SystemBuffer;
+        struct bluetooth_remote_device *device;
 
-                            if (status == STATUS_SUCCESS)
-                                irp->IoStatus.Information = min_size + params->data_size;
-                            else
-                                irp->IoStatus.Information = 0;
+        if (!params || insize < sizeof( *params ) || outsize < sizeof( *params ))
+        {
+            status = STATUS_INVALID_USER_BUFFER;
+            break;
+        }
 
-                            irp->IoStatus.Status = status;
-                            IoCompleteRequest( irp, IO_NO_INCREMENT );
-                            return status;
-                        }
-                        else
-                            status = STATUS_INVALID_PARAMETER;
-                        break;
-                    }
-                }
-            }
-            LeaveCriticalSection( &device->props_cs );
-            if (found)
-                break;
+        bluetooth_radio_lock_shared( ext );
+        if (!(device = bluetooth_radio_find_device( ext, params->address )))
+        {
+            bluetooth_radio_unlock( ext );
+            status = STATUS_NOT_FOUND;
+            break;
         }
-        LeaveCriticalSection( &device_list_cs );
+        status = bluetooth_device_get_att_mtu( ext, device, &params->service, &params->characteristic,
+                                               &params->mtu );
+        if (!status)
+            irp->IoStatus.Information = sizeof( *params );
         break;
     }
     case IOCTL_WINEBTH_RADIO_SET_NOTIFY:
     {
         struct winebth_radio_set_notify_params *params = irp->AssociatedIrp.SystemBuffer;
+        struct bluetooth_gatt_characteristic *chrc;
         struct bluetooth_remote_device *device;
-        BTH_ADDR device_addr;
-        BOOL found = FALSE;
-        GUID svc_uuid;
-
-        ERR( "IOCTL_WINEBTH_RADIO_SET_NOTIFY handler called!\n" );
+        winebluetooth_gatt_characteristic_t characteristic = {0};
 
         if (!params || insize < sizeof(*params))
         {
@@ -1649,59 +3750,35 @@ static NTSTATUS bluetooth_radio_dispatch( DEVICE_OBJECT *device, struct bluetoot
             break;
         }
 
-        device_addr = params->address;
-        le_to_uuid( &params->service.ServiceUuid, &svc_uuid );
         status = STATUS_NOT_FOUND;
-
-        EnterCriticalSection( &device_list_cs );
-        LIST_FOR_EACH_ENTRY( device, &ext->remote_devices, struct bluetooth_remote_device, entry )
+        /* device_list_cs guards the pending READ_NOTIFICATION IRPs. */
+        device_list_lock();
+        bluetooth_radio_lock_shared( ext );
+        if ((device = bluetooth_radio_find_device( ext, params->address )))
         {
-            BOOL matches;
-            EnterCriticalSection( &device->props_cs );
-            matches = device->props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_ADDRESS &&
-                      device->props.address.ullLong == device_addr;
-            if (matches)
+            if ((chrc = bluetooth_device_find_characteristic( device, &params->service, &params->characteristic )))
             {
-                struct bluetooth_gatt_service *svc;
-                found = TRUE;
-                LIST_FOR_EACH_ENTRY( svc, &device->gatt_services, struct bluetooth_gatt_service, entry )
-                {
-                    if ((IsEqualGUID( &svc->uuid, &svc_uuid ) && svc->handle == params->service.AttributeHandle) ||
-                        (IsEqualGUID( &svc_uuid, &GUID_NULL ) && svc->handle == params->characteristic.ServiceHandle))
-                    {
-                        struct bluetooth_gatt_characteristic *chrc;
-                        chrc = find_gatt_characteristic( svc, &params->characteristic );
-                        if (chrc)
-                        {
-                            winebluetooth_gatt_characteristic_t characteristic = chrc->characteristic;
-                            bluetooth_gatt_service_incref( svc );
-                            LeaveCriticalSection( &device->props_cs );
-                            LeaveCriticalSection( &device_list_cs );
-
-                            status = winebluetooth_gatt_characteristic_set_notify(
-                                characteristic,
-                                params->enable );
-
-                            bluetooth_gatt_service_decref( svc );
-
-                            if (status == STATUS_SUCCESS)
-                                irp->IoStatus.Information = sizeof(*params);
-                            else
-                                irp->IoStatus.Information = 0;
-                            goto set_notify_done;
-                        }
-                        else
-                            status = STATUS_INVALID_PARAMETER;
-                        break;
-                    }
-                }
+                if (!params->enable)
+                    complete_pending_irps( &chrc->notification_irps, STATUS_CANCELLED );
+                winebluetooth_gatt_characteristic_dup(( characteristic = chrc->characteristic ));
             }
-            LeaveCriticalSection( &device->props_cs );
-            if (found)
-                break;
+            else
+                status = STATUS_INVALID_PARAMETER;
+        }
+        bluetooth_radio_unlock( ext );
+        device_list_unlock();
+
+        if (characteristic.handle)
+        {
+            status = winebluetooth_gatt_characteristic_set_notify( characteristic, params->enable,
+                                                                   params->overflow_policy );
+            winebluetooth_gatt_characteristic_free( characteristic );
+
+            if (status == STATUS_SUCCESS)
+                irp->IoStatus.Information = sizeof(*params);
+            else
+                irp->IoStatus.Information = 0;
         }
-        LeaveCriticalSection( &device_list_cs );
-    set_notify_done:
         break;
     }
     default:
@@ -1720,19 +3797,32 @@ static NTSTATUS bluetooth_radio_dispatch( DEVICE_OBJECT *device, struct bluetoot
 static NTSTATUS WINAPI dispatch_bluetooth( DEVICE_OBJECT *device, IRP *irp )
 {
     struct bluetooth_pdo_ext *ext = device->DeviceExtension;
+    ULONG code = IoGetCurrentIrpStackLocation( irp )->Parameters.DeviceIoControl.IoControlCode;
+    LARGE_INTEGER start, end;
+    NTSTATUS status;
+
     TRACE( "(%p, %p)\n", device, irp );
 
+    /* The IRP may be gone once the dispatch routine returns, so only the code and status are used after that. */
+    QueryPerformanceCounter( &start );
     if (device == device_auth)
-        return dispatch_auth( device, irp );
-
-    switch (ext->type)
+        status = dispatch_auth( device, irp );
+    else
     {
-    case BLUETOOTH_PDO_EXT_RADIO:
-        return bluetooth_radio_dispatch( device, &ext->radio, irp );
-    case BLUETOOTH_PDO_EXT_REMOTE_DEVICE:
-        return bluetooth_remote_device_dispatch( device, &ext->remote_device, irp );
-    DEFAULT_UNREACHABLE;
+        switch (ext->type)
+        {
+        case BLUETOOTH_PDO_EXT_RADIO:
+            status = bluetooth_radio_dispatch( device, &ext->radio, irp );
+            break;
+        case BLUETOOTH_PDO_EXT_REMOTE_DEVICE:
+            status = bluetooth_remote_device_dispatch( device, &ext->remote_device, irp );
+            break;
+        DEFAULT_UNREACHABLE;
+        }
     }
+    QueryPerformanceCounter( &end );
+    bluetooth_ioctl_stats_record( code, status, perf_counter_to_100ns( end.QuadPart - start.QuadPart ) );
+    return status;
 }
 
 void WINAPIV append_id( struct string_buffer *buffer, const WCHAR *format, ... )
@@ -1839,6 +3929,8 @@ static void add_bluetooth_radio( struct winebluetooth_watcher_event_radio_added
     WCHAR *hw_name;
     WCHAR *sanitized_hw_name;
     static unsigned int radio_index;
+    LARGE_INTEGER now;
+    unsigned int i;
 
     swprintf( name, ARRAY_SIZE( name ), L"\\Device\\WINEBTH-RADIO-%d", radio_index++ );
     TRACE( "Adding new bluetooth radio %p: %s\n", (void *)event.radio.handle, debugstr_w( name ) );
@@ -1866,6 +3958,7 @@ static void add_bluetooth_radio( struct winebluetooth_watcher_event_radio_added
         ERR( "Failed to create device, status %#lx\n", status );
         return;
     }
+    InterlockedIncrement64( &pdos_created );
 
     ext = device_obj->DeviceExtension;
     ext->type = BLUETOOTH_PDO_EXT_RADIO;
@@ -1884,16 +3977,37 @@ static void add_bluetooth_radio( struct winebluetooth_watcher_event_radio_added
         swprintf( tmp, ARRAY_SIZE( tmp ), L"RADIO%u", ext->radio.index );
         ext->radio.instance_prefix = wcsdup( tmp );
     }
+    ExInitializeResourceLite( &ext->radio.devices_lock );
     list_init( &ext->radio.remote_devices );
+    for (i = 0; i < ARRAY_SIZE( ext->radio.device_index ); i++)
+        list_init( &ext->radio.device_index[i] );
+    for (i = 0; i < ARRAY_SIZE( ext->radio.char_handle_index ); i++)
+        list_init( &ext->radio.char_handle_index[i] );
 
     InitializeListHead( &ext->radio.irp_list );
-
-    EnterCriticalSection( &device_list_cs );
+    ext->radio.discovering = FALSE;
+    bluetooth_discovery_filter_init( &ext->radio.discovery_filter );
+    list_init( &ext->radio.advertisements );
+    ext->radio.advertisements_count = 0;
+    ext->radio.advertisements_overflow = 0;
+    InitializeListHead( &ext->radio.advertisement_irps );
+    KeQuerySystemTime( &now );
+    ext->radio.epoch = now.QuadPart + ext->radio.index;
+    ext->radio.generation = 0;
+    list_init( &ext->radio.changed_devices );
+    list_init( &ext->radio.removed_devices );
+    ext->radio.removed_count = 0;
+    ext->radio.removed_floor = 0;
+    InitializeListHead( &ext->radio.device_change_irps );
+    ext->radio.connection_generation = 0;
+    InitializeListHead( &ext->radio.connection_irps );
+
+    device_list_lock();
     list_add_tail( &device_list, &ext->radio.entry );
     ext->radio.state = BLUETOOTH_STATE_ACTIVE;
-    LeaveCriticalSection( &device_list_cs );
+    device_list_unlock();
 
-    IoInvalidateDeviceRelations( bus_pdo, BusRelations );
+    bluetooth_invalidate_bus_relations( bus_pdo );
 }
 
 static void remove_bluetooth_radio( winebluetooth_radio_t radio )
@@ -1901,7 +4015,7 @@ static void remove_bluetooth_radio( winebluetooth_radio_t radio )
     struct bluetooth_radio *device;
     DEVICE_OBJECT *radio_device_obj = NULL;
 
-    EnterCriticalSection( &device_list_cs );
+    device_list_lock();
     LIST_FOR_EACH_ENTRY( device, &device_list, struct bluetooth_radio, entry )
     {
         if (winebluetooth_radio_equal( radio, device->radio ) && device->state != BLUETOOTH_STATE_REMOVING)
@@ -1913,13 +4027,13 @@ static void remove_bluetooth_radio( winebluetooth_radio_t radio )
             break;
         }
     }
-    LeaveCriticalSection( &device_list_cs );
+    device_list_unlock();
 
     /* External calls outside lock */
     if (radio_device_obj)
-        IoInvalidateDeviceRelations( radio_device_obj, BusRelations );
+        bluetooth_invalidate_bus_relations( radio_device_obj );
 
-    IoInvalidateDeviceRelations( bus_pdo, BusRelations );
+    bluetooth_invalidate_bus_relations( bus_pdo );
     winebluetooth_radio_free( radio );
 }
 
@@ -1932,7 +4046,7 @@ static void update_bluetooth_radio_properties( struct winebluetooth_watcher_even
     struct bluetooth_radio *device;
     winebluetooth_radio_t radio = event.radio;
 
-    EnterCriticalSection( &device_list_cs );
+    device_list_lock();
     LIST_FOR_EACH_ENTRY( device, &device_list, struct bluetooth_radio, entry )
     {
         if (winebluetooth_radio_equal( radio, device->radio ) && device->state != BLUETOOTH_STATE_REMOVING)
@@ -1964,7 +4078,7 @@ static void update_bluetooth_radio_properties( struct winebluetooth_watcher_even
             break;
         }
     }
-    LeaveCriticalSection( &device_list_cs );
+    device_list_unlock();
     winebluetooth_radio_free( radio );
 }
 
@@ -1987,33 +4101,46 @@ static void bluetooth_radio_add_remote_device( struct winebluetooth_watcher_even
     struct bluetooth_radio *radio;
     DEVICE_OBJECT *radio_device_obj = NULL;
 
-    EnterCriticalSection( &device_list_cs );
+    device_list_lock();
     LIST_FOR_EACH_ENTRY( radio, &device_list, struct bluetooth_radio, entry )
     {
         if (winebluetooth_radio_equal( event.radio, radio->radio ))
         {
             struct bluetooth_remote_device *existing;
+            BOOL connection_changed;
             struct bluetooth_pdo_ext *ext;
             DEVICE_OBJECT *device_obj;
             NTSTATUS status;
             UNICODE_STRING dev_name;
             WCHAR name_buf[128];
+            unsigned int i;
 
-            LIST_FOR_EACH_ENTRY( existing, &radio->remote_devices, struct bluetooth_remote_device, entry )
+            bluetooth_radio_lock_exclusive( radio );
+            if (event.known_props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_ADDRESS &&
+                (existing = bluetooth_radio_find_device( radio, event.props.address.ullLong )))
             {
-                if (existing->props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_ADDRESS &&
-                    existing->props.address.ullLong == event.props.address.ullLong &&
-                    existing->state != BLUETOOTH_STATE_REMOVING)
+                TRACE( "Device with address %I64x already exists, updating properties\n", event.props.address.ullLong );
+                device_props_lock( existing );
+                if (!(event.known_props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_SERVICES_RESOLVED))
                 {
-                    TRACE( "Device with address %I64x already exists, updating properties\n", event.props.address.ullLong );
-                    EnterCriticalSection( &existing->props_cs );
-                    existing->props_mask = event.known_props_mask;
-                    existing->props = event.props;
-                    LeaveCriticalSection( &existing->props_cs );
-                    LeaveCriticalSection( &device_list_cs );
-                    winebluetooth_device_free( event.device );
-                    return;
+                    event.known_props_mask |= existing->props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_SERVICES_RESOLVED;
+                    event.props.services_resolved = existing->props.services_resolved;
                 }
+                connection_changed = existing->props.connected != event.props.connected;
+                existing->props_mask = event.known_props_mask;
+                existing->props = event.props;
+                bluetooth_radio_queue_advertisement( radio, existing->props_mask, &existing->props );
+                device_props_unlock( existing );
+                bluetooth_radio_device_changed( radio, existing );
+                bluetooth_radio_unlock( radio );
+                bluetooth_radio_complete_advertisement_irps( radio );
+                if (connection_changed)
+                    bluetooth_radio_device_connection_changed( radio, existing );
+                bluetooth_device_retry_gatt_irps( existing );
+                device_list_unlock();
+                winebluetooth_radio_free( event.radio );
+                winebluetooth_device_free( event.device );
+                return;
             }
 
             /* Create a named PDO similar to Linux's path style for stable instance IDs */
@@ -2027,9 +4154,10 @@ static void bluetooth_radio_add_remote_device( struct winebluetooth_watcher_even
             if (status)
             {
                 ERR( "Failed to create remote device, status %#lx\n", status );
-                winebluetooth_device_free( event.device );
+                bluetooth_radio_unlock( radio );
                 break;
             }
+            InterlockedIncrement64( &pdos_created );
 
             ext = device_obj->DeviceExtension;
             ext->type = BLUETOOTH_PDO_EXT_REMOTE_DEVICE;
@@ -2038,6 +4166,8 @@ static void bluetooth_radio_add_remote_device( struct winebluetooth_watcher_even
             ext->remote_device.device_obj = device_obj;
             InitializeCriticalSectionEx( &ext->remote_device.props_cs, 0, RTL_CRITICAL_SECTION_FLAG_FORCE_DEBUG_INFO );
             ext->remote_device.props_cs.DebugInfo->Spare[0] = (DWORD_PTR)(__FILE__ ": bluetooth_pdo_ext.props_cs");
+            InitializeCriticalSectionEx( &ext->remote_device.gatt_cs, 0, RTL_CRITICAL_SECTION_FLAG_FORCE_DEBUG_INFO );
+            ext->remote_device.gatt_cs.DebugInfo->Spare[0] = (DWORD_PTR)(__FILE__ ": bluetooth_pdo_ext.gatt_cs");
             winebluetooth_device_dup( event.device );
             ext->remote_device.device = event.device;
             TRACE( "Stored device.handle=%p for device '%s' device_obj=%p ext=%p\n",
@@ -2050,7 +4180,14 @@ static void bluetooth_radio_add_remote_device( struct winebluetooth_watcher_even
 
             ext->remote_device.le = TRUE;
             list_init( &ext->remote_device.gatt_services );
+            InitializeListHead( &ext->remote_device.gatt_irps );
+            InitializeListHead( &ext->remote_device.gatt_io_irps );
+            for (i = 0; i < ARRAY_SIZE( ext->remote_device.char_index ); i++)
+                list_init( &ext->remote_device.char_index[i] );
+            ext->remote_device.indexed = FALSE;
             ext->remote_device.bthle_symlink_name.Buffer = NULL;
+            list_init( &ext->remote_device.changed_entry );
+            ext->remote_device.connection_generation = 0;
 
             if (!event.init_entry)
             {
@@ -2066,16 +4203,23 @@ static void bluetooth_radio_add_remote_device( struct winebluetooth_watcher_even
                 list_add_head( &radio->remote_devices, &ext->remote_device.entry );
             else
                 list_add_tail( &radio->remote_devices, &ext->remote_device.entry );
+            bluetooth_radio_index_device( radio, &ext->remote_device );
+            bluetooth_radio_unlock( radio );
+            bluetooth_radio_device_changed( radio, &ext->remote_device );
+            bluetooth_radio_queue_advertisement( radio, event.known_props_mask, &event.props );
+            bluetooth_radio_complete_advertisement_irps( radio );
+            if (event.props.connected)
+                bluetooth_radio_device_connection_changed( radio, &ext->remote_device );
 
             radio_device_obj = radio->device_obj;
             break;
         }
     }
-    LeaveCriticalSection( &device_list_cs );
+    device_list_unlock();
 
     /* External calls outside lock */
     if (radio_device_obj)
-        IoInvalidateDeviceRelations( radio_device_obj, BusRelations );
+        bluetooth_invalidate_bus_relations( radio_device_obj );
 
     /* Device interface will be registered in IRP_MN_START_DEVICE or bluetooth_device_enable_le_iface.
      * Attempting to register here causes deadlocks because IoRegisterDeviceInterface triggers
@@ -2088,7 +4232,7 @@ static void bluetooth_radio_remove_remote_device( struct winebluetooth_watcher_e
 {
     struct bluetooth_radio *radio;
 
-    EnterCriticalSection( &device_list_cs );
+    device_list_lock();
     LIST_FOR_EACH_ENTRY( radio, &device_list, struct bluetooth_radio, entry )
     {
         struct bluetooth_remote_device *device, *next;
@@ -2101,23 +4245,25 @@ static void bluetooth_radio_remove_remote_device( struct winebluetooth_watcher_e
 
                 TRACE( "Removing bluetooth remote device %p\n", (void *)device->device.handle );
 
+                bluetooth_radio_lock_exclusive( radio );
                 device->state = BLUETOOTH_STATE_REMOVING;
-                list_remove( &device->entry );
+                bluetooth_radio_unlink_device( device );
+                bluetooth_radio_unlock( radio );
 
-                EnterCriticalSection( &device->props_cs );
+                device_props_lock( device );
                 has_addr = device->props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_ADDRESS;
-                LeaveCriticalSection( &device->props_cs );
+                device_props_unlock( device );
 
                 /* PnP out-of-range notification skipped for Wine Crossover compatibility */
                 (void)has_addr;
-                LeaveCriticalSection( &device_list_cs );
-                IoInvalidateDeviceRelations( radio->device_obj, BusRelations );
+                device_list_unlock();
+                bluetooth_invalidate_bus_relations( radio->device_obj );
                 winebluetooth_device_free( event.device );
                 return;
             }
         }
     }
-    LeaveCriticalSection( &device_list_cs );
+    device_list_unlock();
     winebluetooth_device_free( event.device );
 }
 
@@ -2209,8 +4355,12 @@ static void bluetooth_radio_update_device_props( struct winebluetooth_watcher_ev
     struct bluetooth_remote_device *target_device = NULL;
     ULONG device_old_flags = 0;
     int device_count = 0;
+    BOOL connection_changed = FALSE, services_resolved = FALSE;
+    /* Changes to the advertisement properties only show up in the advertisement records. */
+    BOOL info_changed = !!((event.changed_props_mask | event.invalid_props_mask) &
+                           ~WINEBLUETOOTH_DEVICE_ADVERTISEMENT_PROPERTIES);
 
-    EnterCriticalSection( &device_list_cs );
+    device_list_lock();
     LIST_FOR_EACH_ENTRY( radio, &device_list, struct bluetooth_radio, entry )
     {
         struct bluetooth_remote_device *device;
@@ -2222,7 +4372,7 @@ static void bluetooth_radio_update_device_props( struct winebluetooth_watcher_ev
             device_count++;
             if (winebluetooth_device_equal( event.device, device->device ))
             {
-                EnterCriticalSection( &device->props_cs );
+                device_props_lock( device );
 
                 device->props_mask |= event.changed_props_mask;
                 device->props_mask &= ~event.invalid_props_mask;
@@ -2232,8 +4382,8 @@ static void bluetooth_radio_update_device_props( struct winebluetooth_watcher_ev
                     device->props.address = event.props.address;
                 if (event.changed_props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_CONNECTED)
                 {
-                    ERR("=== bluetooth_radio_update_device_props: UPDATING device connected: %d -> %d ===\n",
-                        device->props.connected, event.props.connected);
+                    TRACE( "connected: %d -> %d\n", device->props.connected, event.props.connected );
+                    connection_changed = device->props.connected != event.props.connected;
                     device->props.connected = event.props.connected;
                     if (!device->props.connected)
                         device->macos_invalidated = TRUE;
@@ -2246,26 +4396,60 @@ static void bluetooth_radio_update_device_props( struct winebluetooth_watcher_ev
                     device->props.trusted = event.props.trusted;
                 if (event.changed_props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_CLASS)
                     device->props.class = event.props.class;
+                if (event.changed_props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_SERVICES_RESOLVED)
+                {
+                    services_resolved = !device->props.services_resolved && event.props.services_resolved;
+                    device->props.services_resolved = event.props.services_resolved;
+                }
+                if (event.changed_props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_RSSI)
+                    device->props.rssi = event.props.rssi;
+                if (event.changed_props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_MANUFACTURER_DATA)
+                {
+                    device->props.manufacturer_data_size = event.props.manufacturer_data_size;
+                    memcpy( device->props.manufacturer_data, event.props.manufacturer_data,
+                            event.props.manufacturer_data_size );
+                }
+                if (event.changed_props_mask & WINEBLUETOOTH_DEVICE_PROPERTY_SERVICE_DATA)
+                {
+                    device->props.service_data_size = event.props.service_data_size;
+                    memcpy( device->props.service_data, event.props.service_data, event.props.service_data_size );
+                }
                 winebluetooth_device_properties_to_info( device->props_mask, &device->props, &device_new_info );
+                bluetooth_radio_queue_advertisement( radio, device->props_mask, &device->props );
 
                 /* Copy data needed for external call */
                 device_old_flags = old_info.flags;
                 radio_obj = radio->device_obj;
                 bluetooth_device_incref( device );
                 target_device = device;
-                LeaveCriticalSection( &device->props_cs );
+                device_props_unlock( device );
+                if (info_changed)
+                    bluetooth_radio_device_changed( radio, device );
+                bluetooth_radio_complete_advertisement_irps( radio );
+                if (connection_changed)
+                    bluetooth_radio_device_connection_changed( radio, device );
+
+                if ((event.changed_props_mask | event.invalid_props_mask) & WINEBLUETOOTH_DEVICE_PROPERTY_ADDRESS)
+                {
+                    bluetooth_radio_lock_exclusive( radio );
+                    bluetooth_radio_index_device( radio, device );
+                    bluetooth_radio_unlock( radio );
+                }
+                if (event.changed_props_mask & (WINEBLUETOOTH_DEVICE_PROPERTY_CONNECTED |
+                                                WINEBLUETOOTH_DEVICE_PROPERTY_SERVICES_RESOLVED))
+                    bluetooth_device_retry_gatt_irps( device );
 
                 goto done;
             }
         }
     }
 done:
-    LeaveCriticalSection( &device_list_cs );
+    device_list_unlock();
 
     winebluetooth_device_free( event.device );
 
     /* External calls outside lock */
-    if (target_device && radio_obj)
+    if (target_device && radio_obj && info_changed)
     {
         /* NOTE: IoSetDevicePropertyData is called while holding props_cs. This is acceptable because:
          * 1. These are Wine-internal kernel functions with no callbacks
@@ -2286,20 +4470,23 @@ done:
         winebluetooth_device_props_mask_t props_mask_copy;
         BOOL le_copy;
 
-        EnterCriticalSection( &device_list_cs );
+        device_list_lock();
         adapter_addr = target_device->radio->props.address;
-        LeaveCriticalSection( &device_list_cs );
+        device_list_unlock();
 
-        EnterCriticalSection( &target_device->props_cs );
+        device_props_lock( target_device );
         props_copy = target_device->props;
         props_mask_copy = target_device->props_mask;
         le_copy = target_device->le;
         bluetooth_device_set_properties( target_device, adapter_addr.rgBytes, &props_copy, props_mask_copy, le_copy );
-        LeaveCriticalSection( &target_device->props_cs );
+        device_props_unlock( target_device );
 
         bluetooth_radio_report_radio_in_range_event( radio_obj, device_old_flags, &device_new_info );
-        bluetooth_device_decref( target_device );
+        if (services_resolved)
+            bluetooth_device_update_gatt_database( target_device );
     }
+    if (target_device)
+        bluetooth_device_decref( target_device );
 }
 
 static void bluetooth_radio_report_auth_event( struct winebluetooth_auth_event event )
@@ -2324,7 +4511,7 @@ static void bluetooth_radio_report_auth_event( struct winebluetooth_auth_event e
     request->auth_method = event.method;
     request->numeric_value_or_passkey = event.numeric_value_or_passkey;
 
-    EnterCriticalSection( &device_list_cs );
+    device_list_lock();
     LIST_FOR_EACH_ENTRY( radio, &device_list, struct bluetooth_radio, entry )
     {
         struct bluetooth_remote_device *device;
@@ -2335,10 +4522,10 @@ static void bluetooth_radio_report_auth_event( struct winebluetooth_auth_event e
             {
                 NTSTATUS ret;
 
-                EnterCriticalSection( &device->props_cs );
+                device_props_lock( device );
                 winebluetooth_device_properties_to_info( device->props_mask, &device->props, &request->device_info );
-                LeaveCriticalSection( &device->props_cs );
-                LeaveCriticalSection( &device_list_cs );
+                device_props_unlock( device );
+                device_list_unlock();
 
                 /* PnP auth notification skipped for Wine Crossover compatibility */
                 (void)ret;
@@ -2348,7 +4535,7 @@ static void bluetooth_radio_report_auth_event( struct winebluetooth_auth_event e
             }
         }
     }
-    LeaveCriticalSection( &device_list_cs );
+    device_list_unlock();
 
     ExFreePool( notification );
 }
@@ -2358,9 +4545,9 @@ static void WINAPI bluetooth_irp_cancel_routine( DEVICE_OBJECT *device, IRP *irp
 {
     IoReleaseCancelSpinLock( irp->CancelIrql );
 
-    EnterCriticalSection( &device_list_cs );
+    device_list_lock();
     RemoveEntryList( &irp->Tail.Overlay.ListEntry );
-    LeaveCriticalSection( &device_list_cs );
+    device_list_unlock();
 
     irp->IoStatus.Status = STATUS_CANCELLED;
     irp->IoStatus.Information = 0;
@@ -2371,16 +4558,16 @@ static void WINAPI bluetooth_irp_cancel_routine( DEVICE_OBJECT *device, IRP *irp
  * Returns TRUE if we completed it, FALSE if cancel routine will. */
 static BOOL complete_irp( IRP *irp, NTSTATUS result )
 {
-    EnterCriticalSection( &device_list_cs );
+    device_list_lock();
 
     if (IoSetCancelRoutine( irp, NULL ) == NULL)
     {
-        LeaveCriticalSection( &device_list_cs );
+        device_list_unlock();
         return FALSE;
     }
 
     RemoveEntryList( &irp->Tail.Overlay.ListEntry );
-    LeaveCriticalSection( &device_list_cs );
+    device_list_unlock();
 
     irp->IoStatus.Status = result;
     irp->IoStatus.Information = 0;
@@ -2405,23 +4592,23 @@ static void bluetooth_device_enable_le_iface( struct bluetooth_remote_device *de
     if (device_state != BLUETOOTH_STATE_ACTIVE)
     {
         /* Device not yet started, just set the flag. PnP start will register interface. */
-        EnterCriticalSection( &device->props_cs );
+        device_props_lock( device );
         device->le = TRUE;
-        LeaveCriticalSection( &device->props_cs );
+        device_props_unlock( device );
         return;
     }
 
-    EnterCriticalSection( &device->props_cs );
+    device_props_lock( device );
     if (device->le)
     {
         /* Already enabled */
-        LeaveCriticalSection( &device->props_cs );
+        device_props_unlock( device );
         return;
     }
 
     device->le = TRUE;
     should_register = !device->bthle_symlink_name.Buffer;
-    LeaveCriticalSection( &device->props_cs );
+    device_props_unlock( device );
 
     /* External calls outside lock */
     if (should_register)
@@ -2433,12 +4620,12 @@ static void bluetooth_device_enable_le_iface( struct bluetooth_remote_device *de
             IoSetDeviceInterfaceState( &symlink_name, TRUE );
 
             /* Now update the device struct with the symlink */
-            EnterCriticalSection( &device->props_cs );
+            device_props_lock( device );
             if (!device->bthle_symlink_name.Buffer)
                 device->bthle_symlink_name = symlink_name;
             else
                 RtlFreeUnicodeString( &symlink_name );
-            LeaveCriticalSection( &device->props_cs );
+            device_props_unlock( device );
         }
     }
 }
@@ -2447,7 +4634,7 @@ static void bluetooth_device_add_gatt_service( struct winebluetooth_watcher_even
 {
     struct bluetooth_radio *radio;
 
-    EnterCriticalSection( &device_list_cs );
+    device_list_lock();
     LIST_FOR_EACH_ENTRY( radio, &device_list, struct bluetooth_radio, entry )
     {
         struct bluetooth_remote_device *device;
@@ -2458,32 +4645,28 @@ static void bluetooth_device_add_gatt_service( struct winebluetooth_watcher_even
             {
                 struct bluetooth_gatt_service *service;
 
-                EnterCriticalSection( &device->props_cs );
-                LIST_FOR_EACH_ENTRY( service, &device->gatt_services, struct bluetooth_gatt_service, entry )
+                if (find_gatt_service( &device->gatt_services, &event.uuid, event.attr_handle ))
                 {
-                    if (service->handle == event.attr_handle && IsEqualGUID( &service->uuid, &event.uuid ))
-                    {
-                        TRACE( "=== GATT service %s already exists for device %p ===\n", debugstr_guid( &event.uuid ), (void *)event.device.handle );
-                        LeaveCriticalSection( &device->props_cs );
-                        LeaveCriticalSection( &device_list_cs );
-                        winebluetooth_device_free( event.device );
-                        winebluetooth_gatt_service_free( event.service );
-                        return;
-                    }
+                    TRACE( "=== GATT service %s already exists for device %p ===\n", debugstr_guid( &event.uuid ), (void *)event.device.handle );
+                    device_list_unlock();
+                    winebluetooth_device_free( event.device );
+                    winebluetooth_gatt_service_free( event.service );
+                    return;
                 }
-                LeaveCriticalSection( &device->props_cs );
 
-                ERR( "=== Adding GATT service %s for remote device %p name='%s' address=%I64x ===\n", debugstr_guid( &event.uuid ),
-                       (void *)event.device.handle, device->props.name, device->props.address.ullLong );
+                TRACE( "Adding GATT service %s for remote device %p name=%s address=%I64x\n",
+                       debugstr_guid( &event.uuid ), (void *)event.device.handle, debugstr_a( device->props.name ),
+                       device->props.address.ullLong );
 
                 service = calloc( 1, sizeof( *service ) );
                 if (!service)
                 {
-                    ERR( "=== FAILED to allocate service! ===\n" );
-                    LeaveCriticalSection( &device_list_cs );
+                    ERR( "Failed to allocate service.\n" );
+                    device_list_unlock();
                     return;
                 }
 
+                service->device = device;
                 service->service = event.service;
                 service->uuid = event.uuid;
                 service->primary = !!event.is_primary;
@@ -2492,17 +4675,19 @@ static void bluetooth_device_add_gatt_service( struct winebluetooth_watcher_even
                 bluetooth_device_enable_le_iface( device );
                 list_init( &service->characteristics );
 
-                EnterCriticalSection( &device->props_cs );
+                bluetooth_radio_lock_exclusive( radio );
                 list_add_tail( &device->gatt_services, &service->entry );
-                ERR( "=== Service added to gatt_services list! ===\n" );
-                LeaveCriticalSection( &device->props_cs );
-                LeaveCriticalSection( &device_list_cs );
+                bluetooth_radio_unlock( radio );
+                bluetooth_device_incref( device );
+                device_list_unlock();
                 winebluetooth_device_free( event.device );
+                bluetooth_device_gatt_database_changed( device );
+                bluetooth_device_decref( device );
                 return;
             }
         }
     }
-    LeaveCriticalSection( &device_list_cs );
+    device_list_unlock();
 
     winebluetooth_device_free( event.device );
     winebluetooth_gatt_service_free( event.service );
@@ -2511,9 +4696,10 @@ static void bluetooth_device_add_gatt_service( struct winebluetooth_watcher_even
 static void bluetooth_gatt_service_remove( winebluetooth_gatt_service_t service )
 {
     struct bluetooth_gatt_service *found_svc = NULL;
+    struct bluetooth_remote_device *found_device = NULL;
     struct bluetooth_radio *radio;
 
-    EnterCriticalSection( &device_list_cs );
+    device_list_lock();
     LIST_FOR_EACH_ENTRY( radio, &device_list, struct bluetooth_radio, entry )
     {
         struct bluetooth_remote_device *device;
@@ -2522,30 +4708,33 @@ static void bluetooth_gatt_service_remove( winebluetooth_gatt_service_t service
         {
             struct bluetooth_gatt_service *svc;
 
-            EnterCriticalSection( &device->props_cs );
-            if (!device->le)
-            {
-                LeaveCriticalSection( &device->props_cs );
-                continue;
-            }
             LIST_FOR_EACH_ENTRY( svc, &device->gatt_services, struct bluetooth_gatt_service, entry )
             {
                 if (winebluetooth_gatt_service_equal( svc->service, service ))
                 {
+                    bluetooth_radio_lock_exclusive( radio );
                     list_remove( &svc->entry );
+                    bluetooth_radio_unindex_service( svc );
+                    bluetooth_radio_unlock( radio );
+                    bluetooth_device_incref( device );
+                    found_device = device;
                     found_svc = svc;
                     break;
                 }
             }
-            LeaveCriticalSection( &device->props_cs );
             if (found_svc) break;
         }
         if (found_svc) break;
     }
-    LeaveCriticalSection( &device_list_cs );
+    device_list_unlock();
 
     if (found_svc)
         bluetooth_gatt_service_decref( found_svc );
+    if (found_device)
+    {
+        bluetooth_device_gatt_database_changed( found_device );
+        bluetooth_device_decref( found_device );
+    }
 
     winebluetooth_gatt_service_free( service );
 }
@@ -2554,13 +4743,8 @@ static void
 bluetooth_gatt_service_add_characteristic( struct winebluetooth_watcher_event_gatt_characteristic_added characteristic )
 {
     struct bluetooth_radio *radio;
-    GUID char_uuid;
-
-    le_to_uuid( &characteristic.props.CharacteristicUuid, &char_uuid );
 
-    
-
-    EnterCriticalSection( &device_list_cs );
+    device_list_lock();
     LIST_FOR_EACH_ENTRY( radio, &device_list, struct bluetooth_radio, entry )
     {
         struct bluetooth_remote_device *device;
@@ -2569,12 +4753,6 @@ bluetooth_gatt_service_add_characteristic( struct winebluetooth_watcher_event_ga
         {
             struct bluetooth_gatt_service *svc;
 
-            EnterCriticalSection( &device->props_cs );
-            if (!device->le)
-            {
-                LeaveCriticalSection( &device->props_cs );
-                continue;
-            }
             LIST_FOR_EACH_ENTRY( svc, &device->gatt_services, struct bluetooth_gatt_service, entry )
             {
                 if (winebluetooth_gatt_service_equal( svc->service, characteristic.service ))
@@ -2587,8 +4765,7 @@ bluetooth_gatt_service_add_characteristic( struct winebluetooth_watcher_event_ga
                         {
                             TRACE( "=== GATT characteristic %u already exists in service %p ===\n", characteristic.props.AttributeHandle, (void *)svc->service.handle );
 
-                            LeaveCriticalSection( &device->props_cs );
-                            LeaveCriticalSection( &device_list_cs );
+                            device_list_unlock();
 
                             winebluetooth_gatt_service_free( characteristic.service );
                             winebluetooth_gatt_characteristic_free( characteristic.characteristic );
@@ -2597,147 +4774,210 @@ bluetooth_gatt_service_add_characteristic( struct winebluetooth_watcher_event_ga
                     }
 
                     if (!(entry = calloc( 1, sizeof( *entry ) )))
-                    {
-                        LeaveCriticalSection( &device->props_cs );
                         goto failed;
-                    }
 
                     entry->characteristic = characteristic.characteristic;
                     entry->props = characteristic.props;
+                    entry->service = svc;
+                    InitializeListHead( &entry->notification_irps );
+
+                    bluetooth_radio_lock_exclusive( radio );
                     list_add_tail( &svc->characteristics, &entry->entry );
-                    LeaveCriticalSection( &device->props_cs );
-                    LeaveCriticalSection( &device_list_cs );
+                    bluetooth_radio_index_characteristic( radio, device, entry );
+                    bluetooth_radio_unlock( radio );
+                    bluetooth_device_retry_gatt_irps( device );
+                    bluetooth_device_incref( device );
+                    device_list_unlock();
                     winebluetooth_gatt_service_free( characteristic.service );
+                    bluetooth_device_gatt_database_changed( device );
+                    bluetooth_device_decref( device );
                     return;
                 }
             }
-            LeaveCriticalSection( &device->props_cs );
         }
     }
 failed:
-    
-    LeaveCriticalSection( &device_list_cs );
+    device_list_unlock();
     winebluetooth_gatt_characteristic_free( characteristic.characteristic );
     winebluetooth_gatt_service_free( characteristic.service );
 }
 
 static void bluetooth_gatt_characteristic_remove( winebluetooth_gatt_characteristic_t handle )
 {
-     struct bluetooth_radio *radio;
+    struct bluetooth_radio *radio;
 
-    EnterCriticalSection( &device_list_cs );
+    device_list_lock();
     LIST_FOR_EACH_ENTRY( radio, &device_list, struct bluetooth_radio, entry )
     {
         struct bluetooth_remote_device *device;
+        struct bluetooth_gatt_characteristic *chrc;
 
-        LIST_FOR_EACH_ENTRY( device, &radio->remote_devices, struct bluetooth_remote_device, entry )
+        if (!(chrc = bluetooth_radio_find_characteristic( radio, handle ))) continue;
+
+        bluetooth_radio_lock_exclusive( radio );
+        list_remove( &chrc->entry );
+        list_remove( &chrc->index_entry );
+        list_remove( &chrc->handle_entry );
+        bluetooth_radio_unlock( radio );
+        complete_pending_irps( &chrc->notification_irps, STATUS_DELETE_PENDING );
+        bluetooth_gatt_characteristic_cancel_io( chrc, STATUS_DELETE_PENDING );
+        device = chrc->service->device;
+        bluetooth_device_incref( device );
+        device_list_unlock();
+
+        winebluetooth_gatt_characteristic_free( chrc->characteristic );
+        winebluetooth_gatt_characteristic_free( handle );
+        free( chrc->cached_value );
+        free( chrc );
+        bluetooth_device_gatt_database_changed( device );
+        bluetooth_device_decref( device );
+        return;
+    }
+    device_list_unlock();
+    winebluetooth_gatt_characteristic_free( handle );
+}
+
+static void bluetooth_gatt_characteristic_value_changed( winebluetooth_gatt_characteristic_t handle )
+{
+    struct bluetooth_radio *radio;
+
+    device_list_lock();
+    LIST_FOR_EACH_ENTRY( radio, &device_list, struct bluetooth_radio, entry )
+    {
+        struct bluetooth_gatt_characteristic *chrc;
+
+        if (!(chrc = bluetooth_radio_find_characteristic( radio, handle ))) continue;
+
+        /* Until the new values have been delivered, the driver doesn't know what they are. */
+        EnterCriticalSection( &chrc->service->device->gatt_cs );
+        chrc->cached_value_stale = TRUE;
+        LeaveCriticalSection( &chrc->service->device->gatt_cs );
+        /* Hand out queued values to the pending IRPs, oldest first, until the queue runs dry. */
+        while (!IsListEmpty( &chrc->notification_irps ))
         {
-            struct bluetooth_gatt_service *svc;
+            IRP *irp = CONTAINING_RECORD( chrc->notification_irps.Flink, IRP, Tail.Overlay.ListEntry );
+            NTSTATUS status;
 
-            EnterCriticalSection( &device->props_cs );
-            if (!device->le)
+            if (IoSetCancelRoutine( irp, NULL ) == NULL)
             {
-                LeaveCriticalSection( &device->props_cs );
+                /* Being cancelled, the cancel routine will remove it once we release device_list_cs. */
+                RemoveEntryList( &irp->Tail.Overlay.ListEntry );
+                InitializeListHead( &irp->Tail.Overlay.ListEntry );
                 continue;
             }
-            LIST_FOR_EACH_ENTRY( svc, &device->gatt_services, struct bluetooth_gatt_service, entry )
+            if ((status = bluetooth_gatt_characteristic_read_notification( chrc, irp )) == STATUS_TIMEOUT)
+            {
+                IoSetCancelRoutine( irp, bluetooth_irp_cancel_routine );
+                if (!irp->Cancel || IoSetCancelRoutine( irp, NULL ) == NULL) break;
+                status = STATUS_CANCELLED;
+            }
+            RemoveEntryList( &irp->Tail.Overlay.ListEntry );
+            irp->IoStatus.Status = status;
+            IoCompleteRequest( irp, IO_NO_INCREMENT );
+        }
+        break;
+    }
+    device_list_unlock();
+    winebluetooth_gatt_characteristic_free( handle );
+}
+
+static void bluetooth_handle_event( struct winebluetooth_event *result )
+{
+    switch (result->status)
+    {
+        case WINEBLUETOOTH_EVENT_WATCHER_EVENT:
+        {
+            struct winebluetooth_watcher_event *event = &result->data.watcher_event;
+            TRACE("Received watcher event type: %#x\n", event->event_type);
+            switch (event->event_type)
             {
-                struct bluetooth_gatt_characteristic *chrc;
-                LIST_FOR_EACH_ENTRY( chrc, &svc->characteristics, struct bluetooth_gatt_characteristic, entry )
+                case BLUETOOTH_WATCHER_EVENT_TYPE_RADIO_ADDED:
+                    add_bluetooth_radio( event->event_data.radio_added );
+                    break;
+                case BLUETOOTH_WATCHER_EVENT_TYPE_RADIO_REMOVED:
+                    remove_bluetooth_radio( event->event_data.radio_removed );
+                    break;
+                case BLUETOOTH_WATCHER_EVENT_TYPE_RADIO_PROPERTIES_CHANGED:
+                    update_bluetooth_radio_properties( event->event_data.radio_props_changed );
+                    break;
+                case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_ADDED:
+                    bluetooth_radio_add_remote_device( event->event_data.device_added );
+                    break;
+                case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_REMOVED:
+                    bluetooth_radio_remove_remote_device( event->event_data.device_removed );
+                    break;
+                case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_PROPERTIES_CHANGED:
+                    bluetooth_radio_update_device_props( event->event_data.device_props_changed);
+                    break;
+                case BLUETOOTH_WATCHER_EVENT_TYPE_PAIRING_FINISHED:
+                    complete_irp( event->event_data.pairing_finished.irp,
+                                  event->event_data.pairing_finished.result );
+                    break;
+                case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_GATT_SERVICE_ADDED:
+                    bluetooth_device_add_gatt_service( event->event_data.gatt_service_added );
+                    break;
+                case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_GATT_SERVICE_REMOVED:
+                    bluetooth_gatt_service_remove( event->event_data.gatt_service_removed );
+                    break;
+                case BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_ADDED:
+                    bluetooth_gatt_service_add_characteristic( event->event_data.gatt_characteristic_added );
+                    break;
+                case BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_REMOVED:
+                    bluetooth_gatt_characteristic_remove( event->event_data.gatt_characterisic_removed );
+                    break;
+                case BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_VALUE_CHANGED:
+                    bluetooth_gatt_characteristic_value_changed( event->event_data.gatt_characteristic_value_changed );
+                    break;
+                case BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_IO_FINISHED:
                 {
-                    if (winebluetooth_gatt_characteristic_equal( chrc->characteristic, handle ))
-                    {
-                        list_remove( &chrc->entry );
-                        LeaveCriticalSection( &device->props_cs );
-                        LeaveCriticalSection( &device_list_cs );
-
-                        winebluetooth_gatt_characteristic_free( chrc->characteristic );
-                        winebluetooth_gatt_characteristic_free( handle );
-                        free( chrc );
-                        return;
-                    }
+                    struct winebluetooth_watcher_event_gatt_characteristic_io_finished *finished =
+                        &event->event_data.gatt_characteristic_io_finished;
+
+                    bluetooth_gatt_characteristic_io_finished( finished->characteristic, finished->irp,
+                                                               finished->result, finished->value,
+                                                               finished->size );
+                    winebluetooth_gatt_characteristic_free( finished->characteristic );
+                    break;
                 }
+                default:
+                    FIXME( "Unknown bluetooth watcher event code: %#x\n", event->event_type );
             }
-            LeaveCriticalSection( &device->props_cs );
+            break;
         }
+        case WINEBLUETOOTH_EVENT_AUTH_EVENT:
+            bluetooth_radio_report_auth_event( result->data.auth_event);
+            winebluetooth_device_free( result->data.auth_event.device );
+            break;
+        default:
+            FIXME( "Unknown bluetooth event loop status code: %#x\n", result->status );
     }
-    LeaveCriticalSection( &device_list_cs );
-    winebluetooth_gatt_characteristic_free( handle );
 }
 
+/* The number of events fetched from the unix side at once. Discovery and notification bursts queue events much
+ * faster than a unix call per event can keep up with. */
+#define BLUETOOTH_EVENT_BATCH_SIZE 32
+
 static DWORD CALLBACK bluetooth_event_loop_thread_proc( void *arg )
 {
+    struct winebluetooth_event events[BLUETOOTH_EVENT_BATCH_SIZE];
     NTSTATUS status;
+
     while (TRUE)
     {
-        struct winebluetooth_event result = {0};
+        LARGE_INTEGER start, end;
+        UINT32 count, i;
 
-        status = winebluetooth_get_event( &result );
+        status = winebluetooth_get_events( events, ARRAY_SIZE( events ), &count );
         if (status != STATUS_PENDING) break;
 
-        switch (result.status)
+        for (i = 0; i < count; i++)
         {
-            case WINEBLUETOOTH_EVENT_WATCHER_EVENT:
-            {
-                struct winebluetooth_watcher_event *event = &result.data.watcher_event;
-                TRACE("Received watcher event type: %#x\n", event->event_type);
-                switch (event->event_type)
-                {
-                    case BLUETOOTH_WATCHER_EVENT_TYPE_RADIO_ADDED:
-                        add_bluetooth_radio( event->event_data.radio_added );
-                        break;
-                    case BLUETOOTH_WATCHER_EVENT_TYPE_RADIO_REMOVED:
-                        remove_bluetooth_radio( event->event_data.radio_removed );
-                        break;
-                    case BLUETOOTH_WATCHER_EVENT_TYPE_RADIO_PROPERTIES_CHANGED:
-                        update_bluetooth_radio_properties( event->event_data.radio_props_changed );
-                        break;
-                    case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_ADDED:
-                        bluetooth_radio_add_remote_device( event->event_data.device_added );
-                        break;
-                    case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_REMOVED:
-                        bluetooth_radio_remove_remote_device( event->event_data.device_removed );
-                        break;
-                    case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_PROPERTIES_CHANGED:
-                        ERR("=== RECEIVED DEVICE_PROPERTIES_CHANGED event! mask=%#x connected=%d address=%llx ===\n",
-                            event->event_data.device_props_changed.changed_props_mask,
-                            event->event_data.device_props_changed.props.connected,
-                            (unsigned long long)event->event_data.device_props_changed.props.address.ullLong);
-                        bluetooth_radio_update_device_props( event->event_data.device_props_changed);
-                        break;
-                    case BLUETOOTH_WATCHER_EVENT_TYPE_PAIRING_FINISHED:
-                        complete_irp( event->event_data.pairing_finished.irp,
-                                      event->event_data.pairing_finished.result );
-                        break;
-                    case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_GATT_SERVICE_ADDED:
-                        ERR("=== RECEIVED GATT_SERVICE_ADDED event! service_handle=%p uuid=%s ===\n",
-                            (void*)(ULONG_PTR)event->event_data.gatt_service_added.service.handle,
-                            debugstr_guid(&event->event_data.gatt_service_added.uuid));
-                        bluetooth_device_add_gatt_service( event->event_data.gatt_service_added );
-                        break;
-                    case BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_GATT_SERVICE_REMOVED:
-                        bluetooth_gatt_service_remove( event->event_data.gatt_service_removed );
-                        break;
-                    case BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_ADDED:
-                        ERR("=== RECEIVED GATT_CHARACTERISTIC_ADDED event! char_handle=%p svc_handle=%p ===\n",
-                            (void*)(ULONG_PTR)event->event_data.gatt_characteristic_added.characteristic.handle,
-                            (void*)(ULONG_PTR)event->event_data.gatt_characteristic_added.service.handle);
-                        bluetooth_gatt_service_add_characteristic( event->event_data.gatt_characteristic_added );
-                        break;
-                    case BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_REMOVED:
-                        bluetooth_gatt_characteristic_remove( event->event_data.gatt_characterisic_removed );
-                        break;
-                    default:
-                        FIXME( "Unknown bluetooth watcher event code: %#x\n", event->event_type );
-                }
-                break;
-            }
-            case WINEBLUETOOTH_EVENT_AUTH_EVENT:
-                bluetooth_radio_report_auth_event( result.data.auth_event);
-                winebluetooth_device_free( result.data.auth_event.device );
-                break;
-            default:
-                FIXME( "Unknown bluetooth event loop status code: %#x\n", result.status );
+            QueryPerformanceCounter( &start );
+            bluetooth_handle_event( &events[i] );
+            QueryPerformanceCounter( &end );
+            if (events[i].status == WINEBLUETOOTH_EVENT_WATCHER_EVENT)
+                bluetooth_stats_event_handled( events[i].data.watcher_event.event_type,
+                                               perf_counter_to_100ns( end.QuadPart - start.QuadPart ) );
         }
     }
 
@@ -2769,12 +5009,12 @@ static NTSTATUS WINAPI fdo_pnp( DEVICE_OBJECT *device_obj, IRP *irp )
                 break;
             }
 
-            EnterCriticalSection( &device_list_cs );
+            device_list_lock();
             devices = ExAllocatePool(
                 PagedPool, offsetof( DEVICE_RELATIONS, Objects[list_count( &device_list )] ) );
             if (devices == NULL)
             {
-                LeaveCriticalSection( &device_list_cs );
+                device_list_unlock();
                 irp->IoStatus.Status = STATUS_NO_MEMORY;
                 break;
             }
@@ -2784,7 +5024,7 @@ static NTSTATUS WINAPI fdo_pnp( DEVICE_OBJECT *device_obj, IRP *irp )
                 devices->Objects[i++] = radio->device_obj;
                 call_fastcall_func1( ObfReferenceObject, radio->device_obj );
             }
-            LeaveCriticalSection( &device_list_cs );
+            device_list_unlock();
 
             devices->Count = i;
             irp->IoStatus.Information = (ULONG_PTR)devices;
@@ -2808,7 +5048,7 @@ static NTSTATUS WINAPI fdo_pnp( DEVICE_OBJECT *device_obj, IRP *irp )
             winebluetooth_shutdown();
             WaitForSingleObject( event_loop_thread, INFINITE );
             CloseHandle( event_loop_thread );
-            EnterCriticalSection( &device_list_cs );
+            device_list_lock();
             LIST_FOR_EACH_ENTRY_SAFE( device, cur, &device_list, struct bluetooth_radio, entry )
             {
                 if (device->state == BLUETOOTH_STATE_REMOVING)
@@ -2818,9 +5058,11 @@ static NTSTATUS WINAPI fdo_pnp( DEVICE_OBJECT *device_obj, IRP *irp )
                 }
                 winebluetooth_radio_free( device->radio );
                 list_remove( &device->entry );
+                ExDeleteResourceLite( &device->devices_lock );
                 IoDeleteDevice( device->device_obj );
+                InterlockedIncrement64( &pdos_deleted );
             }
-            LeaveCriticalSection( &device_list_cs );
+            device_list_unlock();
             IoSkipCurrentIrpStackLocation( irp );
             ret = IoCallDriver( bus_pdo, irp );
             IoDetachDevice( bus_pdo );
@@ -2854,9 +5096,9 @@ static NTSTATUS remote_device_query_id( struct bluetooth_remote_device *ext, IRP
     {
         BLUETOOTH_ADDRESS addr;
 
-        EnterCriticalSection( &ext->props_cs );
+        device_props_lock( ext );
         addr = ext->props.address;
-        LeaveCriticalSection( &ext->props_cs );
+        device_props_unlock( ext );
 
         if (ext->radio->instance_prefix)
             append_id( &buf, L"%s&%02X%02X%02X%02X%02X%02X", ext->radio->instance_prefix, addr.rgBytes[0], addr.rgBytes[1],
@@ -2941,25 +5183,37 @@ static void bluetooth_radio_set_properties( DEVICE_OBJECT *obj,
 }
 
 /* Caller should hold device_list_cs. */
-/* Caller should hold device_list_cs. */
-static void remove_pending_irps( struct bluetooth_radio *radio )
+static void complete_pending_irps( LIST_ENTRY *irp_list, NTSTATUS result )
 {
     LIST_ENTRY *entry;
     IRP *irp;
 
-    while ((entry = RemoveHeadList( &radio->irp_list )) != &radio->irp_list)
+    while ((entry = RemoveHeadList( irp_list )) != irp_list)
     {
         irp = CONTAINING_RECORD( entry, IRP, Tail.Overlay.ListEntry );
+        /* Keep the entry valid for the cancel routine, in case it is already running. */
+        InitializeListHead( entry );
 
         if (IoSetCancelRoutine( irp, NULL ) == NULL)
             continue;
 
-        irp->IoStatus.Status = STATUS_DELETE_PENDING;
+        irp->IoStatus.Status = result;
         irp->IoStatus.Information = 0;
         IoCompleteRequest( irp, IO_NO_INCREMENT );
     }
 }
 
+/* Caller should hold device_list_cs. */
+static void remove_pending_irps( struct bluetooth_radio *radio )
+{
+    complete_pending_irps( &radio->irp_list, STATUS_DELETE_PENDING );
+    complete_pending_irps( &radio->advertisement_irps, STATUS_DELETE_PENDING );
+    complete_pending_irps( &radio->connection_irps, STATUS_DELETE_PENDING );
+    complete_pending_irps( &radio->device_change_irps, STATUS_DELETE_PENDING );
+    radio->discovering = FALSE;
+    bluetooth_radio_flush_advertisements( radio );
+}
+
 static void remote_device_destroy( struct bluetooth_remote_device *ext )
 {
     struct bluetooth_gatt_service *svc, *next;
@@ -2971,14 +5225,17 @@ static void remote_device_destroy( struct bluetooth_remote_device *ext )
     }
     ext->props_cs.DebugInfo->Spare[0] = 0;
     DeleteCriticalSection( &ext->props_cs );
+    ext->gatt_cs.DebugInfo->Spare[0] = 0;
+    DeleteCriticalSection( &ext->gatt_cs );
     winebluetooth_device_free( ext->device );
     LIST_FOR_EACH_ENTRY_SAFE( svc, next, &ext->gatt_services, struct bluetooth_gatt_service, entry )
     {
-        winebluetooth_gatt_service_free( svc->service );
         list_remove( &svc->entry );
-        free( svc );
+        bluetooth_gatt_service_decref( svc );
     }
+    free( ext->gatt_db );
     IoDeleteDevice( ext->device_obj );
+    InterlockedIncrement64( &pdos_deleted );
 }
 
 static NTSTATUS WINAPI remote_device_pdo_pnp( DEVICE_OBJECT *device_obj, struct bluetooth_remote_device *ext, IRP *irp )
@@ -3009,18 +5266,18 @@ static NTSTATUS WINAPI remote_device_pdo_pnp( DEVICE_OBJECT *device_obj, struct
         BOOL is_le;
         BOOL need_interface_reg;
 
-        EnterCriticalSection( &device_list_cs );
+        device_list_lock();
         adapter_addr = ext->radio->props.address;
         if (ext->state != BLUETOOTH_STATE_INITIALIZING && ext->state != BLUETOOTH_STATE_ACTIVE)
         {
-            LeaveCriticalSection( &device_list_cs );
+            device_list_unlock();
             ret = STATUS_DEVICE_NOT_CONNECTED;
             break;
         }
         already_started = (ext->state == BLUETOOTH_STATE_ACTIVE);
         if (!already_started)
             ext->state = BLUETOOTH_STATE_ACTIVE;
-        LeaveCriticalSection( &device_list_cs );
+        device_list_unlock();
 
         if (already_started)
         {
@@ -3029,14 +5286,22 @@ static NTSTATUS WINAPI remote_device_pdo_pnp( DEVICE_OBJECT *device_obj, struct
             break;
         }
 
-        EnterCriticalSection( &ext->props_cs );
+        if (bluetooth_device_load_gatt_database( ext ))
+        {
+            /* Let applications open the device before its services have been resolved again. */
+            device_props_lock( ext );
+            ext->le = TRUE;
+            device_props_unlock( ext );
+        }
+
+        device_props_lock( ext );
 
         /* Copy data needed for expensive operations, then release lock */
         props_copy = ext->props;
         props_mask_copy = ext->props_mask;
         is_le = ext->le;
         need_interface_reg = ext->le && !ext->bthle_symlink_name.Buffer;
-        LeaveCriticalSection( &ext->props_cs );
+        device_props_unlock( ext );
 
         /* Set properties - this is where FriendlyName gets written to registry.
          * Done outside lock since it does expensive registry operations. */
@@ -3059,12 +5324,12 @@ static NTSTATUS WINAPI remote_device_pdo_pnp( DEVICE_OBJECT *device_obj, struct
                 iface_st = IoSetDeviceInterfaceState( &symlink_name, TRUE );
                 if (iface_st == STATUS_SUCCESS)
                 {
-                    EnterCriticalSection( &ext->props_cs );
+                    device_props_lock( ext );
                     if (!ext->bthle_symlink_name.Buffer)
                         ext->bthle_symlink_name = symlink_name;
                     else
                         RtlFreeUnicodeString( &symlink_name );
-                    LeaveCriticalSection( &ext->props_cs );
+                    device_props_unlock( ext );
                 }
                 else
                 {
@@ -3084,16 +5349,18 @@ static NTSTATUS WINAPI remote_device_pdo_pnp( DEVICE_OBJECT *device_obj, struct
     case IRP_MN_REMOVE_DEVICE:
     {
         BOOL dropped_ref = FALSE;
-        EnterCriticalSection( &device_list_cs );
+        device_list_lock();
         if (ext->state != BLUETOOTH_STATE_REMOVING)
         {
             WARN( "IRP_MN_REMOVE_DEVICE called without prior SURPRISE_REMOVAL for device %s\n", ext->props.name );
+            bluetooth_radio_lock_exclusive( ext->radio );
             ext->state = BLUETOOTH_STATE_REMOVING;
-            list_remove( &ext->entry );
+            bluetooth_radio_unlink_device( ext );
+            bluetooth_radio_unlock( ext->radio );
             ext->macos_invalidated = TRUE;
             dropped_ref = TRUE;
         }
-        LeaveCriticalSection( &device_list_cs );
+        device_list_unlock();
 
         if (dropped_ref)
             bluetooth_device_decref( ext );
@@ -3105,15 +5372,17 @@ static NTSTATUS WINAPI remote_device_pdo_pnp( DEVICE_OBJECT *device_obj, struct
     case IRP_MN_SURPRISE_REMOVAL:
     {
         BOOL dropped_ref = FALSE;
-        EnterCriticalSection( &device_list_cs);
+        device_list_lock();
         if (ext->state != BLUETOOTH_STATE_REMOVING)
         {
+            bluetooth_radio_lock_exclusive( ext->radio );
             ext->state = BLUETOOTH_STATE_REMOVING;
-            list_remove( &ext->entry );
+            bluetooth_radio_unlink_device( ext );
+            bluetooth_radio_unlock( ext->radio );
             ext->macos_invalidated = TRUE;
             dropped_ref = TRUE;
         }
-        LeaveCriticalSection( &device_list_cs );
+        device_list_unlock();
 
         if (dropped_ref)
             bluetooth_device_decref( ext );
@@ -3128,7 +5397,7 @@ static NTSTATUS WINAPI remote_device_pdo_pnp( DEVICE_OBJECT *device_obj, struct
                ext, stack->Parameters.QueryDeviceText.DeviceTextType );
         if (stack->Parameters.QueryDeviceText.DeviceTextType != DeviceTextDescription) break;
 
-        EnterCriticalSection( &ext->props_cs );
+        device_props_lock( ext );
         TRACE( "Device name from props: '%s'\n", ext->props.name );
         if (ext->props.name[0])
         {
@@ -3142,7 +5411,7 @@ static NTSTATUS WINAPI remote_device_pdo_pnp( DEVICE_OBJECT *device_obj, struct
             }
             else ret = STATUS_NO_MEMORY;
         }
-        LeaveCriticalSection( &ext->props_cs );
+        device_props_unlock( ext );
         break;
     }
 
@@ -3176,12 +5445,12 @@ static NTSTATUS WINAPI radio_pdo_pnp( DEVICE_OBJECT *device_obj, struct bluetoot
                 break;
             }
 
-            EnterCriticalSection( &device_list_cs );
+            device_list_lock();
             devices = ExAllocatePool( PagedPool,
                                       offsetof( DEVICE_RELATIONS, Objects[list_count( &device->remote_devices )] ) );
             if (!devices)
             {
-                LeaveCriticalSection( &device_list_cs );
+                device_list_unlock();
                 irp->IoStatus.Status = STATUS_NO_MEMORY;
                 break;
             }
@@ -3190,7 +5459,7 @@ static NTSTATUS WINAPI radio_pdo_pnp( DEVICE_OBJECT *device_obj, struct bluetoot
                 devices->Objects[i++] = remote_device->device_obj;
                 call_fastcall_func1( ObfReferenceObject, remote_device->device_obj );
             }
-            LeaveCriticalSection( &device_list_cs );
+            device_list_unlock();
 
             devices->Count = i;
             irp->IoStatus.Information = (ULONG_PTR)devices;
@@ -3210,10 +5479,10 @@ static NTSTATUS WINAPI radio_pdo_pnp( DEVICE_OBJECT *device_obj, struct bluetoot
             break;
         }
         case IRP_MN_START_DEVICE:
-            EnterCriticalSection( &device_list_cs );
+            device_list_lock();
             bluetooth_radio_set_properties( device_obj, device->props_mask, &device->props );
             device->state = BLUETOOTH_STATE_ACTIVE;
-            LeaveCriticalSection( &device_list_cs );
+            device_list_unlock();
 
             if (IoRegisterDeviceInterface( device_obj, &GUID_BTHPORT_DEVICE_INTERFACE, NULL,
                                           &device->bthport_symlink_name ) == STATUS_SUCCESS)
@@ -3225,7 +5494,7 @@ static NTSTATUS WINAPI radio_pdo_pnp( DEVICE_OBJECT *device_obj, struct bluetoot
             ret = STATUS_SUCCESS;
             break;
         case IRP_MN_REMOVE_DEVICE:
-            EnterCriticalSection( &device_list_cs );
+            device_list_lock();
             if (device->state != BLUETOOTH_STATE_REMOVING)
             {
                 WARN( "IRP_MN_REMOVE_DEVICE called without prior SURPRISE_REMOVAL for radio device\n" );
@@ -3233,7 +5502,8 @@ static NTSTATUS WINAPI radio_pdo_pnp( DEVICE_OBJECT *device_obj, struct bluetoot
                 list_remove( &device->entry );
             }
             remove_pending_irps( device );
-            LeaveCriticalSection( &device_list_cs );
+            bluetooth_radio_free_removed_devices( device );
+            device_list_unlock();
 
             if (device->bthport_symlink_name.Buffer)
             {
@@ -3247,18 +5517,20 @@ static NTSTATUS WINAPI radio_pdo_pnp( DEVICE_OBJECT *device_obj, struct bluetoot
             }
             free( device->hw_name );
             winebluetooth_radio_free( device->radio );
+            ExDeleteResourceLite( &device->devices_lock );
             IoDeleteDevice( device->device_obj );
+            InterlockedIncrement64( &pdos_deleted );
             ret = STATUS_SUCCESS;
             break;
         case IRP_MN_SURPRISE_REMOVAL:
-            EnterCriticalSection( &device_list_cs );
+            device_list_lock();
             remove_pending_irps( device );
             if (device->state != BLUETOOTH_STATE_REMOVING)
             {
                 device->state = BLUETOOTH_STATE_REMOVING;
                 list_remove( &device->entry );
             }
-            LeaveCriticalSection( &device_list_cs );
+            device_list_unlock();
             ret = STATUS_SUCCESS;
             break;
         case IRP_MN_QUERY_DEVICE_TEXT:
@@ -3360,14 +5632,46 @@ static NTSTATUS WINAPI dispatch_close( DEVICE_OBJECT *device, IRP *irp )
     return STATUS_SUCCESS;
 }
 
+static DWORD get_driver_option( HANDLE key, const WCHAR *option, DWORD default_value )
+{
+    char buffer[FIELD_OFFSET( KEY_VALUE_PARTIAL_INFORMATION, Data[sizeof( DWORD )] )];
+    KEY_VALUE_PARTIAL_INFORMATION *info = (KEY_VALUE_PARTIAL_INFORMATION *)buffer;
+    UNICODE_STRING str;
+    DWORD size;
+
+    /* @@ Wine registry key: HKLM\System\CurrentControlSet\Services\winebth */
+    RtlInitUnicodeString( &str, option );
+    if (!NtQueryValueKey( key, &str, KeyValuePartialInformation, info, sizeof( buffer ), &size ) &&
+        info->Type == REG_DWORD)
+        return *(DWORD *)info->Data;
+    return default_value;
+}
+
 NTSTATUS WINAPI DriverEntry( DRIVER_OBJECT *driver, UNICODE_STRING *path )
 {
     UNICODE_STRING device_winebth_auth = RTL_CONSTANT_STRING( L"\\Device\\WINEBTHAUTH" );
     UNICODE_STRING object_winebth_auth = RTL_CONSTANT_STRING( WINEBTH_AUTH_DEVICE_PATH );
+    OBJECT_ATTRIBUTES attr = {0};
+    HANDLE driver_key;
     NTSTATUS status;
 
     TRACE( "(%p, %s)\n", driver, debugstr_w( path->Buffer ) );
 
+    attr.Length = sizeof( attr );
+    attr.ObjectName = path;
+    attr.Attributes = OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE;
+    if (!NtOpenKey( &driver_key, KEY_READ, &attr ))
+    {
+        gatt_connect_timeout = get_driver_option( driver_key, L"GattConnectTimeout", gatt_connect_timeout );
+        lock_stats_enabled = !!get_driver_option( driver_key, L"LockStats", FALSE );
+        NtClose( driver_key );
+    }
+    TRACE( "GATT connect timeout %lu ms\n", gatt_connect_timeout );
+    QueryPerformanceFrequency( &perf_frequency );
+
+    if (!(gatt_irp_timer = CreateThreadpoolTimer( bluetooth_gatt_irp_timeout, NULL, NULL )))
+        return STATUS_NO_MEMORY;
+
     status = winebluetooth_init();
     if (status)
         return status;
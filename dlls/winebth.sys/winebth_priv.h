@@ -131,6 +131,11 @@ DEFINE_BTH_RADIO_DEVPROPKEY( HCIVendorFeatures, 8 );               /* DEVPROP_TY
 DEFINE_BTH_RADIO_DEVPROPKEY( MaximumAdvertisementDataLength, 17 ); /* DEVPROP_TYPE_UINT16 */
 DEFINE_BTH_RADIO_DEVPROPKEY( LELocalSupportedFeatures, 22 );       /* DEVPROP_TYPE_UINT64 */
 
+/* Handles to the Unix side's objects are made of a slot index in the low bits and the generation of the slot above
+ * them, see unixlib.c. */
+#define WINEBLUETOOTH_HANDLE_INDEX_BITS 20
+#define WINEBLUETOOTH_HANDLE_INDEX_MASK ((1 << WINEBLUETOOTH_HANDLE_INDEX_BITS) - 1)
+
 typedef struct
 {
     UINT_PTR handle;
@@ -169,12 +174,22 @@ typedef UINT16 winebluetooth_device_props_mask_t;
 #define WINEBLUETOOTH_DEVICE_PROPERTY_LEGACY_PAIRING (1 << 4)
 #define WINEBLUETOOTH_DEVICE_PROPERTY_TRUSTED        (1 << 5)
 #define WINEBLUETOOTH_DEVICE_PROPERTY_CLASS          (1 << 6)
+#define WINEBLUETOOTH_DEVICE_PROPERTY_SERVICES_RESOLVED (1 << 7)
+#define WINEBLUETOOTH_DEVICE_PROPERTY_RSSI              (1 << 8)
+#define WINEBLUETOOTH_DEVICE_PROPERTY_MANUFACTURER_DATA (1 << 9)
+#define WINEBLUETOOTH_DEVICE_PROPERTY_SERVICE_DATA      (1 << 10)
+
+/* The properties that only come from advertisements, and change with every one of them. */
+#define WINEBLUETOOTH_DEVICE_ADVERTISEMENT_PROPERTIES                                             \
+    (WINEBLUETOOTH_DEVICE_PROPERTY_RSSI | WINEBLUETOOTH_DEVICE_PROPERTY_MANUFACTURER_DATA |      \
+     WINEBLUETOOTH_DEVICE_PROPERTY_SERVICE_DATA)
 
 #define WINEBLUETOOTH_DEVICE_ALL_PROPERTIES                                                 \
     (WINEBLUETOOTH_DEVICE_PROPERTY_NAME | WINEBLUETOOTH_DEVICE_PROPERTY_ADDRESS |           \
      WINEBLUETOOTH_DEVICE_PROPERTY_CONNECTED | WINEBLUETOOTH_DEVICE_PROPERTY_PAIRED |       \
      WINEBLUETOOTH_DEVICE_PROPERTY_LEGACY_PAIRING | WINEBLUETOOTH_DEVICE_PROPERTY_TRUSTED | \
-     WINEBLUETOOTH_DEVICE_PROPERTY_CLASS)
+     WINEBLUETOOTH_DEVICE_PROPERTY_CLASS | WINEBLUETOOTH_DEVICE_PROPERTY_SERVICES_RESOLVED | \
+     WINEBLUETOOTH_DEVICE_ADVERTISEMENT_PROPERTIES)
 
 union winebluetooth_property
 {
@@ -197,6 +212,9 @@ struct winebluetooth_radio_properties
     BYTE version;
 };
 
+/* The most manufacturer or service data kept for a remote device, once encoded. */
+#define WINEBLUETOOTH_MAX_ADVERTISEMENT_DATA_SIZE 256
+
 struct winebluetooth_device_properties
 {
     BLUETOOTH_ADDRESS address;
@@ -206,6 +224,13 @@ struct winebluetooth_device_properties
     BOOL legacy_pairing;
     BOOL trusted;
     UINT32 class;
+    BOOL services_resolved;
+    INT16 rssi;
+    /* Encoded like the data following a struct winebth_advertisement_record. */
+    UINT16 manufacturer_data_size;
+    UINT16 service_data_size;
+    BYTE manufacturer_data[WINEBLUETOOTH_MAX_ADVERTISEMENT_DATA_SIZE];
+    BYTE service_data[WINEBLUETOOTH_MAX_ADVERTISEMENT_DATA_SIZE];
 };
 
 typedef struct
@@ -218,6 +243,58 @@ typedef struct
     UINT_PTR handle;
 } winebluetooth_gatt_characteristic_t;
 
+/* What to do when a value arrives while the notification queue of a characteristic is full. */
+#define BLUETOOTH_GATT_NOTIFICATION_OVERFLOW_DROP_OLDEST 0
+#define BLUETOOTH_GATT_NOTIFICATION_OVERFLOW_DROP_NEWEST 1
+
+#pragma pack(push,1)
+/* Queued notification values are returned as a sequence of these, each followed by size bytes of data. This has the
+ * same layout as struct winebth_gatt_notification_record. */
+struct bluetooth_gatt_notification_record
+{
+    UINT64 timestamp; /* In 100ns intervals since 1601-01-01, UTC. */
+    UINT32 size;
+};
+
+/* The values queued for a characteristic, and how many there were since notifications were first enabled. */
+struct bluetooth_gatt_notification_stats
+{
+    UINT64 received;
+    UINT32 queued;
+    UINT32 queued_bytes;
+    UINT32 max_queued;
+    UINT32 overflow_count;
+};
+
+/* The events queued by the backend for the event loop, and how many of them the event loop has taken. */
+struct bluetooth_event_stats
+{
+    UINT64 queued;
+    UINT64 delivered;
+    UINT32 max_backlog;
+};
+#pragma pack(pop)
+
+#define BLUETOOTH_DISCOVERY_TRANSPORT_AUTO  0
+#define BLUETOOTH_DISCOVERY_TRANSPORT_BREDR 1
+#define BLUETOOTH_DISCOVERY_TRANSPORT_LE    2
+
+#define BLUETOOTH_DISCOVERY_FILTER_RSSI           0x0001
+#define BLUETOOTH_DISCOVERY_FILTER_DUPLICATE_DATA 0x0002
+
+#define BLUETOOTH_DISCOVERY_FILTER_MAX_UUIDS 16
+
+/* Restricts which devices get reported during discovery. The backends apply as much of it as the system's Bluetooth
+ * service supports, so that filtered out devices never reach winebth.sys. */
+struct winebluetooth_discovery_filter
+{
+    UINT32 transport;
+    UINT32 flags;
+    INT16 rssi;         /* The weakest signal to report, if BLUETOOTH_DISCOVERY_FILTER_RSSI is set. */
+    UINT32 uuids_count; /* Only report devices advertising one of these services, if non-zero. */
+    GUID uuids[BLUETOOTH_DISCOVERY_FILTER_MAX_UUIDS];
+};
+
 NTSTATUS winebluetooth_radio_get_unique_name( winebluetooth_radio_t radio, char *name,
                                               SIZE_T *size );
 void winebluetooth_radio_free( winebluetooth_radio_t radio );
@@ -229,6 +306,8 @@ static inline BOOL winebluetooth_radio_equal( winebluetooth_radio_t r1, wineblue
 NTSTATUS winebluetooth_radio_set_property( winebluetooth_radio_t radio,
                                            ULONG prop_flag,
                                            union winebluetooth_property *property );
+NTSTATUS winebluetooth_radio_set_discovery_filter( winebluetooth_radio_t radio,
+                                                   const struct winebluetooth_discovery_filter *filter );
 NTSTATUS winebluetooth_radio_start_discovery( winebluetooth_radio_t radio );
 NTSTATUS winebluetooth_radio_stop_discovery( winebluetooth_radio_t radio );
 NTSTATUS winebluetooth_radio_remove_device( winebluetooth_radio_t radio, winebluetooth_device_t device );
@@ -244,6 +323,8 @@ void winebluetooth_device_properties_to_info( winebluetooth_device_props_mask_t
                                               const struct winebluetooth_device_properties *props,
                                               BTH_DEVICE_INFO *info );
 NTSTATUS winebluetooth_device_disconnect( winebluetooth_device_t device );
+/* Starts connecting to the device and resolving its GATT services, without waiting for either to finish. */
+NTSTATUS winebluetooth_device_connect( winebluetooth_device_t device );
 
 NTSTATUS winebluetooth_auth_send_response( winebluetooth_device_t device, BLUETOOTH_AUTHENTICATION_METHOD method,
                                            UINT32 numeric_or_passkey, BOOL negative, BOOL *authenticated );
@@ -257,17 +338,33 @@ static inline BOOL winebluetooth_gatt_service_equal( winebluetooth_gatt_service_
 
 void winebluetooth_gatt_characteristic_free( winebluetooth_gatt_characteristic_t characteristic );
 void winebluetooth_gatt_characteristic_dup( winebluetooth_gatt_characteristic_t characteristic );
-NTSTATUS winebluetooth_gatt_characteristic_read( winebluetooth_gatt_characteristic_t characteristic,
-                                                  unsigned char *buffer, unsigned int buffer_size,
-                                                  unsigned int *data_len );
+/* Starts reading the characteristic's value. If this returns STATUS_PENDING, the result is reported through a
+ * BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_IO_FINISHED event for irp, otherwise the read failed. */
+NTSTATUS winebluetooth_gatt_characteristic_read( winebluetooth_gatt_characteristic_t characteristic, IRP *irp );
+/* Same as above for writes, except that writes which don't need a response can also succeed right away. The data
+ * is copied before this returns. */
 NTSTATUS winebluetooth_gatt_characteristic_write( winebluetooth_gatt_characteristic_t characteristic,
                                                    const unsigned char *data, unsigned int size,
-                                                   int write_type );
+                                                   int write_type, IRP *irp );
+/* Writes data as a sequence of write commands split at the ATT MTU, pacing them with whatever flow control the
+ * backend offers. Blocks until all of them have been handed to the controller, or *cancel gets set. */
+NTSTATUS winebluetooth_gatt_characteristic_write_stream( winebluetooth_gatt_characteristic_t characteristic,
+                                                          const unsigned char *data, unsigned int size,
+                                                          const volatile BOOLEAN *cancel, unsigned int *mtu,
+                                                          unsigned int *packets, unsigned int *written );
+NTSTATUS winebluetooth_gatt_characteristic_get_mtu( winebluetooth_gatt_characteristic_t characteristic,
+                                                     unsigned int *mtu );
 NTSTATUS winebluetooth_gatt_characteristic_set_notify( winebluetooth_gatt_characteristic_t characteristic,
-                                                        int enable );
+                                                        int enable, UINT32 overflow_policy );
 NTSTATUS winebluetooth_gatt_characteristic_read_notification( winebluetooth_gatt_characteristic_t characteristic,
                                                                unsigned char *buffer, unsigned int buffer_size,
                                                                unsigned int *size );
+NTSTATUS winebluetooth_gatt_characteristic_read_notifications( winebluetooth_gatt_characteristic_t characteristic,
+                                                                unsigned char *buffer, unsigned int buffer_size,
+                                                                unsigned int max_count, unsigned int *count,
+                                                                unsigned int *size, unsigned int *overflow_count );
+NTSTATUS winebluetooth_gatt_characteristic_get_notification_stats( winebluetooth_gatt_characteristic_t characteristic,
+                                                                    struct bluetooth_gatt_notification_stats *stats );
 static inline BOOL winebluetooth_gatt_characteristic_equal( winebluetooth_gatt_characteristic_t c1,
                                                             winebluetooth_gatt_characteristic_t c2)
 {
@@ -287,6 +384,10 @@ enum winebluetooth_watcher_event_type
     BLUETOOTH_WATCHER_EVENT_TYPE_DEVICE_GATT_SERVICE_REMOVED,
     BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_ADDED,
     BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_REMOVED,
+    /* New notification values have been queued for a characteristic. */
+    BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_VALUE_CHANGED,
+    /* A characteristic read or write started with winebluetooth_gatt_characteristic_{read,write} has finished. */
+    BLUETOOTH_WATCHER_EVENT_TYPE_GATT_CHARACTERISTIC_IO_FINISHED,
 };
 
 struct winebluetooth_watcher_event_radio_added
@@ -360,6 +461,18 @@ struct winebluetooth_watcher_event_gatt_characteristic_added
     BTH_LE_GATT_CHARACTERISTIC props;
 };
 
+/* The largest value an attribute can have. */
+#define WINEBLUETOOTH_GATT_MAX_VALUE_SIZE 512
+
+struct winebluetooth_watcher_event_gatt_characteristic_io_finished
+{
+    winebluetooth_gatt_characteristic_t characteristic;
+    IRP *irp;
+    NTSTATUS result;
+    UINT32 size;
+    BYTE value[WINEBLUETOOTH_GATT_MAX_VALUE_SIZE]; /* The value that was read, if this was a read */
+};
+
 union winebluetooth_watcher_event_data
 {
     struct winebluetooth_watcher_event_radio_added radio_added;
@@ -373,6 +486,8 @@ union winebluetooth_watcher_event_data
     winebluetooth_gatt_service_t gatt_service_removed;
     struct winebluetooth_watcher_event_gatt_characteristic_added gatt_characteristic_added;
     winebluetooth_gatt_characteristic_t gatt_characterisic_removed;
+    winebluetooth_gatt_characteristic_t gatt_characteristic_value_changed;
+    struct winebluetooth_watcher_event_gatt_characteristic_io_finished gatt_characteristic_io_finished;
 };
 
 struct winebluetooth_watcher_event
@@ -403,7 +518,8 @@ struct winebluetooth_event
     } data;
 };
 
-NTSTATUS winebluetooth_get_event( struct winebluetooth_event *result );
+NTSTATUS winebluetooth_get_events( struct winebluetooth_event *events, UINT32 max_count, UINT32 *count );
+NTSTATUS winebluetooth_get_event_stats( struct bluetooth_event_stats *stats );
 NTSTATUS winebluetooth_init( void );
 NTSTATUS winebluetooth_shutdown( void );
 
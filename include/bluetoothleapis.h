@@ -28,6 +28,8 @@ HRESULT WINAPI BluetoothGATTGetServices( HANDLE, USHORT, BTH_LE_GATT_SERVICE *,
 HRESULT WINAPI BluetoothGATTGetCharacteristics( HANDLE, BTH_LE_GATT_SERVICE *, USHORT, BTH_LE_GATT_CHARACTERISTIC *, USHORT *, ULONG );
 HRESULT WINAPI BluetoothGATTGetCharacteristicValue( HANDLE, PBTH_LE_GATT_CHARACTERISTIC, ULONG, PBTH_LE_GATT_CHARACTERISTIC_VALUE, USHORT *, ULONG );
 HRESULT WINAPI BluetoothGATTSetCharacteristicValue( HANDLE, PBTH_LE_GATT_CHARACTERISTIC, PBTH_LE_GATT_CHARACTERISTIC_VALUE, BTH_LE_GATT_RELIABLE_WRITE_CONTEXT, ULONG );
+HRESULT WINAPI BluetoothGATTRegisterEvent( HANDLE, BTH_LE_GATT_EVENT_TYPE, PVOID, PFNBLUETOOTH_GATT_EVENT_CALLBACK, PVOID, BLUETOOTH_GATT_EVENT_HANDLE *, ULONG );
+HRESULT WINAPI BluetoothGATTUnregisterEvent( BLUETOOTH_GATT_EVENT_HANDLE, ULONG );
 
 #ifdef __cplusplus
 }
@@ -67,6 +67,28 @@ typedef ULONG64 BTH_LE_GATT_RELIABLE_WRITE_CONTEXT, *PBTH_LE_GATT_RELIABLE_WRITE
 #define BLUETOOTH_GATT_FLAG_WRITE_WITHOUT_RESPONSE     0x00000020
 #define BLUETOOTH_GATT_FLAG_RETURN_ALL                 0x00000040
 
+typedef enum _BTH_LE_GATT_EVENT_TYPE
+{
+    CharacteristicValueChangedEvent,
+} BTH_LE_GATT_EVENT_TYPE;
+
+typedef VOID (CALLBACK *PFNBLUETOOTH_GATT_EVENT_CALLBACK)( BTH_LE_GATT_EVENT_TYPE, PVOID, PVOID );
+
+typedef struct _BLUETOOTH_GATT_VALUE_CHANGED_EVENT_REGISTRATION
+{
+    USHORT NumCharacteristics;
+    BTH_LE_GATT_CHARACTERISTIC Characteristics[1];
+} BLUETOOTH_GATT_VALUE_CHANGED_EVENT_REGISTRATION, *PBLUETOOTH_GATT_VALUE_CHANGED_EVENT_REGISTRATION;
+
+typedef struct _BLUETOOTH_GATT_VALUE_CHANGED_EVENT
+{
+    USHORT ChangedAttributeHandle;
+    size_t CharacteristicValueDataSize;
+    PBTH_LE_GATT_CHARACTERISTIC_VALUE CharacteristicValue;
+} BLUETOOTH_GATT_VALUE_CHANGED_EVENT, *PBLUETOOTH_GATT_VALUE_CHANGED_EVENT;
+
+typedef HANDLE BLUETOOTH_GATT_EVENT_HANDLE;
+
 DEFINE_GUID( GUID_BLUETOOTHLE_DEVICE_INTERFACE, 0x781aee18, 0x7733, 0x4ce4, 0xad, 0xd0, 0x91, 0xf4, 0x1c, 0x67, 0xb5, 0x92 );
 DEFINE_GUID( BTH_LE_ATT_BLUETOOTH_BASE_GUID, 0, 0, 0x1000, 0x80, 0x00, 0x00, 0x80, 0x5f, 0x9b, 0x34, 0xfb );
 #endif
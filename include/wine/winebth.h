@@ -49,6 +49,31 @@
 #define IOCTL_WINEBTH_RADIO_WRITE_CHARACTERISTIC CTL_CODE(FILE_DEVICE_BLUETOOTH, 0xb1, METHOD_BUFFERED, FILE_ANY_ACCESS)
 /* Enable/disable notifications for a characteristic by device address (via radio device) */
 #define IOCTL_WINEBTH_RADIO_SET_NOTIFY CTL_CODE(FILE_DEVICE_BLUETOOTH, 0xb2, METHOD_BUFFERED, FILE_ANY_ACCESS)
+/* Read all pending notifications for a characteristic by device address (via radio device) */
+#define IOCTL_WINEBTH_RADIO_READ_NOTIFICATIONS CTL_CODE(FILE_DEVICE_BLUETOOTH, 0xb3, METHOD_BUFFERED, FILE_ANY_ACCESS)
+/* Set the filter for device inquiry on a local radio. This applies to the inquiry in progress, if any, or else to the
+ * next one. Stopping an inquiry resets the filter. */
+#define IOCTL_WINEBTH_RADIO_SET_DISCOVERY_FILTER CTL_CODE(FILE_DEVICE_BLUETOOTH, 0xb4, METHOD_BUFFERED, FILE_ANY_ACCESS)
+/* Read the devices seen or updated during device inquiry since the last call, as a sequence of
+ * struct winebth_advertisement_record. Stays pending until there is at least one. */
+#define IOCTL_WINEBTH_RADIO_READ_ADVERTISEMENTS CTL_CODE(FILE_DEVICE_BLUETOOTH, 0xb5, METHOD_BUFFERED, FILE_ANY_ACCESS)
+/* Get the remote devices added, changed or removed since an earlier call, as a smaller alternative to
+ * IOCTL_BTH_GET_DEVICE_INFO for callers that keep their own copy of it. */
+#define IOCTL_WINEBTH_RADIO_GET_DEVICE_CHANGES CTL_CODE(FILE_DEVICE_BLUETOOTH, 0xb6, METHOD_BUFFERED, FILE_ANY_ACCESS)
+/* Get the remote devices that connected or disconnected since an earlier call, along with their connection state.
+ * Stays pending until there is at least one. */
+#define IOCTL_WINEBTH_RADIO_WAIT_CONNECTION_CHANGES CTL_CODE(FILE_DEVICE_BLUETOOTH, 0xb7, METHOD_BUFFERED, FILE_ANY_ACCESS)
+/* Get all services and characteristics of a remote LE device at once, as a struct winebth_gatt_database. */
+#define IOCTL_WINEBTH_RADIO_GET_LE_DEVICE_GATT_DATABASE CTL_CODE(FILE_DEVICE_BLUETOOTH, 0xb8, METHOD_BUFFERED, FILE_ANY_ACCESS)
+/* Write a buffer of any size to a characteristic as a stream of write commands (via radio device) */
+#define IOCTL_WINEBTH_RADIO_WRITE_CHARACTERISTIC_STREAM CTL_CODE(FILE_DEVICE_BLUETOOTH, 0xb9, METHOD_BUFFERED, FILE_ANY_ACCESS)
+/* Get the ATT MTU negotiated with a remote LE device (via radio device) */
+#define IOCTL_WINEBTH_RADIO_GET_LE_DEVICE_ATT_MTU CTL_CODE(FILE_DEVICE_BLUETOOTH, 0xba, METHOD_BUFFERED, FILE_ANY_ACCESS)
+/* Like IOCTL_WINEBTH_RADIO_GET_DEVICE_CHANGES, but stays pending until there is at least one change. */
+#define IOCTL_WINEBTH_RADIO_WAIT_DEVICE_CHANGES CTL_CODE(FILE_DEVICE_BLUETOOTH, 0xbb, METHOD_BUFFERED, FILE_ANY_ACCESS)
+/* Get the driver's IOCTL counters, and the notification counters of the radio's characteristics, as a
+ * struct winebth_stats. */
+#define IOCTL_WINEBTH_RADIO_GET_STATS CTL_CODE(FILE_DEVICE_BLUETOOTH, 0xbc, METHOD_BUFFERED, FILE_ANY_ACCESS)
 
 /* Get all primary GATT services for the LE device. */
 #define IOCTL_WINEBTH_LE_DEVICE_GET_GATT_SERVICES CTL_CODE(FILE_DEVICE_BLUETOOTH, 0xc0, METHOD_BUFFERED, FILE_ANY_ACCESS)
@@ -64,6 +89,15 @@
 #define IOCTL_WINEBTH_LE_DEVICE_GET_CONNECTION_STATUS CTL_CODE(FILE_DEVICE_BLUETOOTH, 0xc5, METHOD_BUFFERED, FILE_ANY_ACCESS)
 /* Read pending notifications for a characteristic */
 #define IOCTL_WINEBTH_LE_DEVICE_READ_NOTIFICATION CTL_CODE(FILE_DEVICE_BLUETOOTH, 0xc6, METHOD_BUFFERED, FILE_ANY_ACCESS)
+/* Read all pending notifications for a characteristic, as a sequence of struct winebth_gatt_notification_record */
+#define IOCTL_WINEBTH_LE_DEVICE_READ_NOTIFICATIONS CTL_CODE(FILE_DEVICE_BLUETOOTH, 0xc7, METHOD_BUFFERED, FILE_ANY_ACCESS)
+/* Get all services and characteristics of the LE device at once, as a struct winebth_gatt_database */
+#define IOCTL_WINEBTH_LE_DEVICE_GET_GATT_DATABASE CTL_CODE(FILE_DEVICE_BLUETOOTH, 0xc8, METHOD_BUFFERED, FILE_ANY_ACCESS)
+/* Write a buffer of any size to a characteristic as a stream of write commands, each of them as large as the ATT MTU
+ * allows. Completes once all of them have been handed to the controller. */
+#define IOCTL_WINEBTH_LE_DEVICE_WRITE_CHARACTERISTIC_STREAM CTL_CODE(FILE_DEVICE_BLUETOOTH, 0xc9, METHOD_BUFFERED, FILE_ANY_ACCESS)
+/* Get the ATT MTU negotiated with the LE device */
+#define IOCTL_WINEBTH_LE_DEVICE_GET_ATT_MTU CTL_CODE(FILE_DEVICE_BLUETOOTH, 0xca, METHOD_BUFFERED, FILE_ANY_ACCESS)
 
 DEFINE_GUID( GUID_WINEBTH_AUTHENTICATION_REQUEST, 0xca67235f, 0xf621, 0x4c27, 0x85, 0x65, 0xa4,
              0xd5, 0x5e, 0xa1, 0x26, 0xe8 );
@@ -75,6 +109,34 @@ DEFINE_GUID( GUID_WINEBTH_AUTHENTICATION_REQUEST, 0xca67235f, 0xf621, 0x4c27, 0x
 #define LOCAL_RADIO_DISCOVERABLE 0x0001
 #define LOCAL_RADIO_CONNECTABLE  0x0002
 
+/* What the driver does when a notification arrives while the queue for the characteristic is full. */
+#define WINEBTH_NOTIFICATION_OVERFLOW_DROP_OLDEST 0
+#define WINEBTH_NOTIFICATION_OVERFLOW_DROP_NEWEST 1
+
+#define WINEBTH_DISCOVERY_TRANSPORT_AUTO  0
+#define WINEBTH_DISCOVERY_TRANSPORT_BREDR 1
+#define WINEBTH_DISCOVERY_TRANSPORT_LE    2
+
+#define WINEBTH_DISCOVERY_FILTER_RSSI           0x0001
+#define WINEBTH_DISCOVERY_FILTER_DUPLICATE_DATA 0x0002
+
+#define WINEBTH_DISCOVERY_FILTER_MAX_UUIDS 16
+
+/* Set in info.flags of a struct winebth_advertisement_record if rssi is valid. */
+#define WINEBTH_ADVERTISEMENT_RSSI 0x80000000
+
+/* The caller's copy of the device list is stale, and should be replaced with the returned devices. */
+#define WINEBTH_DEVICE_CHANGES_RESET 0x0001
+/* Not all changes fit in the buffer, call again with the returned generation to get the rest. */
+#define WINEBTH_DEVICE_CHANGES_MORE  0x0002
+
+#define WINEBTH_DEVICE_CHANGE_UPDATED 0
+#define WINEBTH_DEVICE_CHANGE_REMOVED 1
+
+/* Not all changed devices fit in the buffer, the caller should check the connection state of every device it cares
+ * about. */
+#define WINEBTH_CONNECTION_CHANGES_OVERFLOW 0x0001
+
 struct winebth_radio_set_flag_params
 {
     unsigned int flag: 2;
@@ -131,6 +193,38 @@ struct winebth_radio_get_le_device_gatt_characteristics_params
     BTH_LE_GATT_CHARACTERISTIC characteristics[0];
 };
 
+#define WINEBTH_GATT_DATABASE_VERSION 1
+
+struct winebth_gatt_database_service
+{
+    BTH_LE_GATT_SERVICE service;
+    ULONG primary;
+    /* The index of the service's first characteristic in the database, and how many it has. */
+    ULONG first_characteristic;
+    ULONG characteristics_count;
+};
+
+/* If the output buffer is too small, only the header is returned, along with STATUS_MORE_ENTRIES. */
+struct winebth_gatt_database
+{
+    ULONG version;
+    ULONG services_count;
+    ULONG characteristics_count;
+    struct winebth_gatt_database_service services[0];
+    /* Followed by characteristics_count BTH_LE_GATT_CHARACTERISTIC, grouped by service and sorted by UUID within
+     * each service. */
+};
+
+#define WINEBTH_GATT_DATABASE_SIZE( services_count, characteristics_count ) \
+    (offsetof( struct winebth_gatt_database, services[services_count] ) + \
+     (characteristics_count) * sizeof( BTH_LE_GATT_CHARACTERISTIC ))
+
+struct winebth_radio_get_le_device_gatt_database_params
+{
+    BTH_ADDR address;
+    struct winebth_gatt_database database;
+};
+
 struct winebth_radio_read_notification_params
 {
     BTH_ADDR address;
@@ -147,10 +241,17 @@ struct winebth_le_device_get_gatt_characteristics_params
     BTH_LE_GATT_CHARACTERISTIC characteristics[0];
 };
 
+/* Return the last value the driver has seen for the characteristic, if there is one and no newer value has arrived
+ * since, instead of reading it from the device. */
+#define WINEBTH_READ_CHARACTERISTIC_CACHED      0x0001
+/* Only return the last value the driver has seen, even if it may be outdated, and fail if there is none. */
+#define WINEBTH_READ_CHARACTERISTIC_CACHED_ONLY 0x0002
+
 struct winebth_le_device_read_characteristic_params
 {
     BTH_LE_GATT_SERVICE service;
     BTH_LE_GATT_CHARACTERISTIC characteristic;
+    ULONG flags;
     ULONG data_size;
     UCHAR data[0];
 };
@@ -164,11 +265,41 @@ struct winebth_le_device_write_characteristic_params
     UCHAR data[0];
 };
 
+/* What a WRITE_CHARACTERISTIC_STREAM request reports once it has completed. */
+struct winebth_gatt_write_stream_result
+{
+    /* The ATT MTU, every write command carries up to mtu - 3 bytes of the value. */
+    ULONG mtu;
+    ULONG packets;
+    ULONGLONG bytes_written;
+    ULONGLONG elapsed; /* In 100ns intervals. */
+    ULONGLONG bytes_per_second;
+};
+
+struct winebth_le_device_write_characteristic_stream_params
+{
+    BTH_LE_GATT_SERVICE service;
+    BTH_LE_GATT_CHARACTERISTIC characteristic;
+    struct winebth_gatt_write_stream_result result;
+    ULONG data_size;
+    UCHAR data[0];
+};
+
+struct winebth_le_device_get_att_mtu_params
+{
+    /* The MTU is the same for every characteristic of a device, but BlueZ only tells it for a given one. If the
+     * AttributeHandle of the characteristic is 0, any characteristic of the device is used. */
+    BTH_LE_GATT_SERVICE service;
+    BTH_LE_GATT_CHARACTERISTIC characteristic;
+    ULONG mtu;
+};
+
 struct winebth_le_device_set_notify_params
 {
     BTH_LE_GATT_SERVICE service;
     BTH_LE_GATT_CHARACTERISTIC characteristic;
     BOOL enable;
+    ULONG overflow_policy;
 };
 
 struct winebth_le_device_read_notification_params
@@ -179,11 +310,33 @@ struct winebth_le_device_read_notification_params
     UCHAR data[0];
 };
 
+struct winebth_gatt_notification_record
+{
+    ULONGLONG timestamp; /* When the value was received, in 100ns intervals since 1601-01-01, UTC. */
+    ULONG size;
+    UCHAR data[0];
+};
+
+struct winebth_le_device_read_notifications_params
+{
+    BTH_LE_GATT_SERVICE service;
+    BTH_LE_GATT_CHARACTERISTIC characteristic;
+    /* The maximum number of values to return, or 0 to return as many as fit in the buffer. */
+    ULONG max_count;
+
+    ULONG count;
+    /* The number of values dropped so far because the queue was full. */
+    ULONG overflow_count;
+    ULONG data_size;
+    UCHAR data[0];
+};
+
 struct winebth_radio_read_characteristic_params
 {
     BTH_ADDR address;
     BTH_LE_GATT_SERVICE service;
     BTH_LE_GATT_CHARACTERISTIC characteristic;
+    ULONG flags;
     ULONG data_size;
     UCHAR data[0];
 };
@@ -198,12 +351,217 @@ struct winebth_radio_write_characteristic_params
     UCHAR data[0];
 };
 
+struct winebth_radio_write_characteristic_stream_params
+{
+    BTH_ADDR address;
+    BTH_LE_GATT_SERVICE service;
+    BTH_LE_GATT_CHARACTERISTIC characteristic;
+    struct winebth_gatt_write_stream_result result;
+    ULONG data_size;
+    UCHAR data[0];
+};
+
+struct winebth_radio_get_le_device_att_mtu_params
+{
+    BTH_ADDR address;
+    BTH_LE_GATT_SERVICE service;
+    BTH_LE_GATT_CHARACTERISTIC characteristic;
+    ULONG mtu;
+};
+
 struct winebth_radio_set_notify_params
 {
     BTH_ADDR address;
     BTH_LE_GATT_SERVICE service;
     BTH_LE_GATT_CHARACTERISTIC characteristic;
     BOOL enable;
+    ULONG overflow_policy;
+};
+
+struct winebth_radio_read_notifications_params
+{
+    BTH_ADDR address;
+    BTH_LE_GATT_SERVICE service;
+    BTH_LE_GATT_CHARACTERISTIC characteristic;
+    ULONG max_count;
+
+    ULONG count;
+    ULONG overflow_count;
+    ULONG data_size;
+    UCHAR data[0];
+};
+
+struct winebth_radio_set_discovery_filter_params
+{
+    ULONG transport;
+    ULONG flags;
+    /* The weakest signal strength to report, in dBm, if WINEBTH_DISCOVERY_FILTER_RSSI is set. */
+    SHORT rssi;
+    /* Only report devices advertising one of these services. If there are none, all devices get reported. */
+    ULONG uuids_count;
+    GUID uuids[WINEBTH_DISCOVERY_FILTER_MAX_UUIDS];
+};
+
+struct winebth_advertisement_record
+{
+    /* The address and flags are set like the ones returned by IOCTL_BTH_GET_DEVICE_INFO. */
+    BTH_DEVICE_INFO info;
+    SHORT rssi;
+    USHORT manufacturer_data_size;
+    USHORT service_data_size;
+    UCHAR data[0]; /* The manufacturer data, followed by the service data. */
+};
+
+/* The manufacturer data of a struct winebth_advertisement_record is a sequence of these, one per company. */
+struct winebth_advertisement_manufacturer_data
+{
+    USHORT company_id;
+    UCHAR size;
+    UCHAR data[0];
+};
+
+/* The service data of a struct winebth_advertisement_record is a sequence of these, one per service. */
+struct winebth_advertisement_service_data
+{
+    GUID uuid;
+    UCHAR size;
+    UCHAR data[0];
+};
+
+struct winebth_radio_read_advertisements_params
+{
+    ULONG count;
+    /* The number of records dropped so far because the queue was full. */
+    ULONG overflow_count;
+    ULONG data_size;
+    UCHAR data[0];
+};
+
+struct winebth_device_change
+{
+    ULONG type;
+    /* Only the address is set for removed devices. */
+    BTH_DEVICE_INFO info;
+};
+
+struct winebth_radio_get_device_changes_params
+{
+    /* Both come from the previous call, or are 0 for the first one. */
+    ULONGLONG epoch;
+    ULONGLONG generation;
+
+    ULONG flags;
+    ULONG count;
+    struct winebth_device_change changes[0];
+};
+
+#define WINEBTH_STATS_VERSION 2
+
+/* Bucket i counts the requests that took less than 2^i microseconds, the last one all slower requests. */
+#define WINEBTH_STATS_LATENCY_BUCKETS 24
+
+/* Counters for one IOCTL code, shared by every device of the driver. Times are in 100ns units and cover the
+ * dispatch routine only, so requests that stay pending are counted in pending instead of being timed until they
+ * complete. */
+struct winebth_ioctl_stats
+{
+    ULONG code;
+    ULONGLONG calls;
+    ULONGLONG errors;
+    ULONGLONG pending;
+    ULONGLONG total_time;
+    ULONGLONG max_time;
+    ULONGLONG latency[WINEBTH_STATS_LATENCY_BUCKETS];
+};
+
+/* Enough for every event type the Bluetooth service sends to the driver, in the order of
+ * enum winebluetooth_watcher_event_type. */
+#define WINEBTH_STATS_EVENT_TYPES 16
+
+/* How long the driver's event loop took to handle one type of event, in 100ns units. latency is bucketed like it is
+ * for the IOCTLs. */
+struct winebth_event_stats
+{
+    ULONGLONG count;
+    ULONGLONG total_time;
+    ULONGLONG max_time;
+    ULONGLONG latency[WINEBTH_STATS_LATENCY_BUCKETS];
+};
+
+enum winebth_stats_lock
+{
+    WINEBTH_STATS_LOCK_DEVICE_LIST, /* The driver-wide list of radios and their remote devices. */
+    WINEBTH_STATS_LOCK_DEVICE_PROPS, /* The properties of a remote device, summed up over every device. */
+    WINEBTH_STATS_LOCKS_COUNT
+};
+
+/* Recursive acquisitions are not counted. Times are in 100ns units. */
+struct winebth_lock_stats
+{
+    ULONGLONG acquisitions;
+    ULONGLONG contentions;          /* Acquisitions that had to wait for another thread */
+    ULONGLONG wait_time;
+    ULONGLONG hold_time;
+    ULONGLONG max_hold_time;
+};
+
+/* Only characteristics that have received at least one notification are listed. */
+struct winebth_characteristic_stats
+{
+    BTH_ADDR address;
+    BTH_LE_GATT_CHARACTERISTIC characteristic;
+    ULONGLONG received;
+    ULONG queued;
+    ULONG queued_bytes;
+    ULONG max_queued;
+    ULONG overflow_count;
+};
+
+/* If the output buffer is too small, only the header is returned, along with STATUS_MORE_ENTRIES. */
+struct winebth_stats
+{
+    ULONG version;
+    ULONGLONG timestamp;            /* As returned by KeQuerySystemTime */
+
+    /* The events queued by the Bluetooth service for the driver's event loop, and how many were taken by it. */
+    ULONGLONG events_queued;
+    ULONGLONG events_handled;
+    ULONG max_event_backlog;
+    struct winebth_event_stats event_types[WINEBTH_STATS_EVENT_TYPES];
+
+    /* Only gathered if the LockStats driver option is set, zero otherwise. */
+    BOOLEAN locks_enabled;
+    struct winebth_lock_stats locks[WINEBTH_STATS_LOCKS_COUNT];
+
+    /* Plug and Play churn caused by radios and remote devices coming and going. */
+    ULONGLONG relations_invalidated; /* IoInvalidateDeviceRelations calls */
+    ULONGLONG pdos_created;
+    ULONGLONG pdos_deleted;
+
+    ULONG ioctls_count;
+    ULONG characteristics_count;
+    struct winebth_ioctl_stats ioctls[0];
+    /* Followed by characteristics_count struct winebth_characteristic_stats. */
+};
+
+#define WINEBTH_STATS_SIZE( ioctls_count, characteristics_count ) \
+    (offsetof( struct winebth_stats, ioctls[ioctls_count] ) + \
+     (characteristics_count) * sizeof( struct winebth_characteristic_stats ))
+
+struct winebth_connection_change
+{
+    BTH_ADDR address;
+    BOOL connected;
+};
+
+struct winebth_radio_wait_connection_changes_params
+{
+    /* From the previous call, or 0 for the first one. */
+    ULONGLONG generation;
+
+    ULONG flags;
+    ULONG count;
+    struct winebth_connection_change changes[0];
 };
 
 #pragma pack(pop)
@@ -0,0 +1,501 @@
+/*
+ * Bluetooth throughput benchmark
+ *
+ * Copyright 2026 agent
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * Measures discovery time, GATT read and write round trip times and the sustained notification rate through both
+ * bluetoothapis and Windows.Devices.Bluetooth, along with the throughput of streamed write commands. The numbers are only meaningful against a reproducible peripheral,
+ * which is what the simulated winebth.sys backend provides, e.g.:
+ *
+ *     WINEBTH_SIM=devices=8,latency=7500,notify_rate=1000 wine winebthbench --devices 8
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <windef.h>
+#include <winbase.h>
+#include <winuser.h>
+#include <winreg.h>
+#include <winioctl.h>
+#include <setupapi.h>
+
+#include <initguid.h>
+#include <bthsdpdef.h>
+#include <bluetoothapis.h>
+#include <bthledef.h>
+#include <bluetoothleapis.h>
+#include <bthdef.h>
+#include <bthioctl.h>
+#include <ddk/bthguid.h>
+
+#include <wine/winebth.h>
+
+#include "winebthbench.h"
+
+static LARGE_INTEGER frequency;
+
+LONGLONG bench_now( void )
+{
+    LARGE_INTEGER now;
+
+    QueryPerformanceCounter( &now );
+    return now.QuadPart;
+}
+
+static double ticks_to_us( LONGLONG ticks )
+{
+    return (double)ticks * 1000000 / frequency.QuadPart;
+}
+
+void bench_samples_add( struct bench_samples *samples, LONGLONG ticks )
+{
+    if (samples->count == samples->capacity)
+    {
+        SIZE_T capacity = max( samples->capacity * 2, 64 );
+        LONGLONG *values;
+
+        if (!(values = realloc( samples->values, capacity * sizeof( *values ) ))) return;
+        samples->values = values;
+        samples->capacity = capacity;
+    }
+    samples->values[samples->count++] = ticks;
+}
+
+void bench_samples_free( struct bench_samples *samples )
+{
+    free( samples->values );
+    memset( samples, 0, sizeof( *samples ) );
+}
+
+static int __cdecl compare_ticks( const void *a, const void *b )
+{
+    LONGLONG x = *(const LONGLONG *)a, y = *(const LONGLONG *)b;
+    return x < y ? -1 : x > y;
+}
+
+static LONGLONG samples_percentile( const struct bench_samples *samples, unsigned int percent )
+{
+    SIZE_T idx = (samples->count * percent + 99) / 100;
+    return samples->values[idx ? idx - 1 : 0];
+}
+
+void bench_report_time( const WCHAR *api, const WCHAR *name, LONGLONG ticks )
+{
+    printf( "%-7ls %-14ls %10.0f us\n", api, name, ticks_to_us( ticks ) );
+}
+
+void bench_report_samples( const WCHAR *api, const WCHAR *name, struct bench_samples *samples )
+{
+    if (!samples->count)
+    {
+        printf( "%-7ls %-14ls no samples (%u failures)\n", api, name, samples->failures );
+        return;
+    }
+
+    qsort( samples->values, samples->count, sizeof( *samples->values ), compare_ticks );
+    printf( "%-7ls %-14ls p50 %8.0f us  p90 %8.0f us  p99 %8.0f us  max %8.0f us  (%Iu samples, %u failures)\n",
+            api, name, ticks_to_us( samples_percentile( samples, 50 ) ), ticks_to_us( samples_percentile( samples, 90 ) ),
+            ticks_to_us( samples_percentile( samples, 99 ) ), ticks_to_us( samples->values[samples->count - 1] ),
+            samples->count, samples->failures );
+}
+
+void bench_report_notifications( const WCHAR *api, UINT64 received, UINT64 lost, LONGLONG ticks )
+{
+    double seconds = ticks_to_us( ticks ) / 1000000;
+
+    printf( "%-7ls %-14ls %10.1f /s  (%I64u received, %I64u lost in %.1f s)\n", api, L"notifications",
+            seconds > 0 ? received / seconds : 0.0, received, lost, seconds );
+}
+
+void bench_report_cost( const WCHAR *api, const WCHAR *name, UINT64 count, UINT64 allocs, LONGLONG ticks )
+{
+    double us = ticks_to_us( ticks );
+
+    printf( "%-7ls %-14ls %10.1f ns  (%.3f heap allocations per value, %I64u values)\n", api, name,
+            count ? us * 1000 / count : 0.0, count ? (double)allocs / count : 0.0, count );
+}
+
+void bench_error( const WCHAR *api, const WCHAR *format, ... )
+{
+    va_list args;
+
+    printf( "%-7ls ", api );
+    va_start( args, format );
+    vwprintf( format, args );
+    va_end( args );
+    printf( "\n" );
+    fflush( stdout );
+}
+
+UINT64 bench_sequence_gap( UINT32 *expected, const BYTE *data, SIZE_T size )
+{
+    UINT32 sequence;
+    UINT64 gap = 0;
+
+    if (size < sizeof( sequence )) return 0;
+    memcpy( &sequence, data, sizeof( sequence ) );
+    /* The sequence restarts from zero when notifications get enabled again. */
+    if (*expected && sequence > *expected) gap = sequence - *expected;
+    *expected = sequence + 1;
+    return gap;
+}
+
+static const WCHAR win32_api[] = L"win32";
+
+static HANDLE open_first_radio( void )
+{
+    BLUETOOTH_FIND_RADIO_PARAMS params = {.dwSize = sizeof( params )};
+    HBLUETOOTH_RADIO_FIND find;
+    HANDLE radio;
+
+    if (!(find = BluetoothFindFirstRadio( &params, &radio ))) return NULL;
+    BluetoothFindRadioClose( find );
+    return radio;
+}
+
+static unsigned int count_radio_devices( HANDLE radio )
+{
+    BLUETOOTH_DEVICE_SEARCH_PARAMS params = {0};
+    BLUETOOTH_DEVICE_INFO info = {.dwSize = sizeof( info )};
+    HBLUETOOTH_DEVICE_FIND find;
+    unsigned int count = 0;
+
+    params.dwSize = sizeof( params );
+    params.fReturnAuthenticated = TRUE;
+    params.fReturnRemembered = TRUE;
+    params.fReturnUnknown = TRUE;
+    params.fReturnConnected = TRUE;
+    params.hRadio = radio;
+    if (!(find = BluetoothFindFirstDevice( &params, &info ))) return 0;
+    do count++;
+    while (BluetoothFindNextDevice( find, &info ));
+    BluetoothFindDeviceClose( find );
+    return count;
+}
+
+static void win32_discovery( const struct bench_options *options, HANDLE radio )
+{
+    LONGLONG start = bench_now(), deadline = start + frequency.QuadPart * options->timeout / 1000;
+    unsigned int found = 0;
+    DWORD bytes;
+
+    if (!DeviceIoControl( radio, IOCTL_WINEBTH_RADIO_START_DISCOVERY, NULL, 0, NULL, 0, &bytes, NULL ))
+    {
+        bench_error( win32_api, L"Starting discovery failed: %lu", GetLastError() );
+        return;
+    }
+    while ((found = count_radio_devices( radio )) < options->devices && bench_now() < deadline)
+        Sleep( 1 );
+    if (found >= options->devices)
+        bench_report_time( win32_api, L"discovery", bench_now() - start );
+    else
+        bench_error( win32_api, L"Only %u of %u devices were discovered.", found, options->devices );
+    DeviceIoControl( radio, IOCTL_WINEBTH_RADIO_STOP_DISCOVERY, NULL, 0, NULL, 0, &bytes, NULL );
+}
+
+static WCHAR *find_le_device_path( void )
+{
+    char buffer[sizeof( SP_DEVICE_INTERFACE_DETAIL_DATA_W ) + MAX_PATH * sizeof( WCHAR )];
+    SP_DEVICE_INTERFACE_DETAIL_DATA_W *iface_detail = (SP_DEVICE_INTERFACE_DETAIL_DATA_W *)buffer;
+    SP_DEVICE_INTERFACE_DATA iface_data;
+    WCHAR *path = NULL;
+    HDEVINFO devinfo;
+
+    devinfo = SetupDiGetClassDevsW( &GUID_BLUETOOTHLE_DEVICE_INTERFACE, NULL, NULL,
+                                    DIGCF_PRESENT | DIGCF_DEVICEINTERFACE );
+    if (devinfo == INVALID_HANDLE_VALUE) return NULL;
+
+    iface_detail->cbSize = sizeof( *iface_detail );
+    iface_data.cbSize = sizeof( iface_data );
+    if (SetupDiEnumDeviceInterfaces( devinfo, NULL, &GUID_BLUETOOTHLE_DEVICE_INTERFACE, 0, &iface_data ) &&
+        SetupDiGetDeviceInterfaceDetailW( devinfo, &iface_data, iface_detail, sizeof( buffer ), NULL, NULL ))
+        path = wcsdup( iface_detail->DevicePath );
+    SetupDiDestroyDeviceInfoList( devinfo );
+    return path;
+}
+
+static BOOL find_characteristic( HANDLE device, BTH_LE_GATT_SERVICE *service, BTH_LE_GATT_CHARACTERISTIC *chrc )
+{
+    BTH_LE_GATT_CHARACTERISTIC chrcs[16];
+    BTH_LE_GATT_SERVICE services[16];
+    USHORT services_count, chrcs_count, i, j;
+    HRESULT hr;
+
+    hr = BluetoothGATTGetServices( device, ARRAY_SIZE( services ), services, &services_count, 0 );
+    if (FAILED( hr ))
+    {
+        bench_error( win32_api, L"BluetoothGATTGetServices failed: %#lx", hr );
+        return FALSE;
+    }
+    for (i = 0; i < min( services_count, ARRAY_SIZE( services ) ); i++)
+    {
+        hr = BluetoothGATTGetCharacteristics( device, &services[i], ARRAY_SIZE( chrcs ), chrcs, &chrcs_count, 0 );
+        if (FAILED( hr )) continue;
+        for (j = 0; j < min( chrcs_count, ARRAY_SIZE( chrcs ) ); j++)
+        {
+            if (!chrcs[j].IsReadable || !chrcs[j].IsWritable || !chrcs[j].IsNotifiable) continue;
+            *service = services[i];
+            *chrc = chrcs[j];
+            return TRUE;
+        }
+    }
+    bench_error( win32_api, L"No readable, writable and notifiable characteristic was found." );
+    return FALSE;
+}
+
+static void win32_read_write( const struct bench_options *options, HANDLE device, BTH_LE_GATT_CHARACTERISTIC *chrc )
+{
+    struct bench_samples reads = {0}, cached_reads = {0}, writes = {0};
+    BYTE buffer[offsetof( BTH_LE_GATT_CHARACTERISTIC_VALUE, Data[512] )];
+    BTH_LE_GATT_CHARACTERISTIC_VALUE *value = (BTH_LE_GATT_CHARACTERISTIC_VALUE *)buffer;
+    unsigned int i;
+
+    for (i = 0; i < options->iterations; i++)
+    {
+        LONGLONG start = bench_now();
+        USHORT size;
+
+        if (SUCCEEDED( BluetoothGATTGetCharacteristicValue( device, chrc, sizeof( buffer ), value, &size,
+                                                            BLUETOOTH_GATT_FLAG_FORCE_READ_FROM_DEVICE ) ))
+            bench_samples_add( &reads, bench_now() - start );
+        else
+            reads.failures++;
+    }
+    bench_report_samples( win32_api, L"read", &reads );
+
+    /* The reads above leave the value in the driver's cache. */
+    for (i = 0; i < options->iterations; i++)
+    {
+        LONGLONG start = bench_now();
+        USHORT size;
+
+        if (SUCCEEDED( BluetoothGATTGetCharacteristicValue( device, chrc, sizeof( buffer ), value, &size,
+                                                            BLUETOOTH_GATT_FLAG_NONE ) ))
+            bench_samples_add( &cached_reads, bench_now() - start );
+        else
+            cached_reads.failures++;
+    }
+    bench_report_samples( win32_api, L"cached read", &cached_reads );
+
+    value->DataSize = 20;
+    memset( value->Data, 0x5a, value->DataSize );
+    for (i = 0; i < options->iterations; i++)
+    {
+        LONGLONG start = bench_now();
+
+        if (SUCCEEDED( BluetoothGATTSetCharacteristicValue( device, chrc, value, 0, BLUETOOTH_GATT_FLAG_NONE ) ))
+            bench_samples_add( &writes, bench_now() - start );
+        else
+            writes.failures++;
+    }
+    bench_report_samples( win32_api, L"write", &writes );
+
+    bench_samples_free( &reads );
+    bench_samples_free( &cached_reads );
+    bench_samples_free( &writes );
+}
+
+/* Writes one large buffer through IOCTL_WINEBTH_LE_DEVICE_WRITE_CHARACTERISTIC_STREAM, which splits it into write
+ * commands at the ATT MTU. */
+static void win32_write_stream( HANDLE device, const BTH_LE_GATT_SERVICE *service,
+                                const BTH_LE_GATT_CHARACTERISTIC *chrc )
+{
+    static const SIZE_T data_size = 0x40000;
+    struct winebth_le_device_write_characteristic_stream_params *params;
+    SIZE_T size = offsetof( struct winebth_le_device_write_characteristic_stream_params, data[data_size] );
+    LONGLONG start;
+    DWORD bytes;
+
+    if (!chrc->IsWritableWithoutResponse)
+    {
+        bench_error( win32_api, L"The characteristic doesn't take write commands." );
+        return;
+    }
+    if (!(params = calloc( 1, size ))) return;
+    params->service = *service;
+    params->characteristic = *chrc;
+    params->data_size = data_size;
+    memset( params->data, 0x5a, data_size );
+
+    start = bench_now();
+    if (DeviceIoControl( device, IOCTL_WINEBTH_LE_DEVICE_WRITE_CHARACTERISTIC_STREAM, params, size, params,
+                         offsetof( struct winebth_le_device_write_characteristic_stream_params, data[0] ), &bytes,
+                         NULL ))
+        printf( "%-7ls %-14ls %10.1f KiB/s  (%I64u bytes in %lu packets, MTU %lu, %.0f us)\n", win32_api,
+                L"write stream", params->result.bytes_per_second / 1024.0, params->result.bytes_written,
+                params->result.packets, params->result.mtu, ticks_to_us( bench_now() - start ) );
+    else
+        bench_error( win32_api, L"Streaming writes failed: %lu", GetLastError() );
+    free( params );
+}
+
+struct win32_notification_state
+{
+    struct bench_samples latency;
+    UINT64 received, lost;
+    UINT32 sequence;
+};
+
+static void CALLBACK win32_notification_callback( BTH_LE_GATT_EVENT_TYPE type, void *param, void *context )
+{
+    const BLUETOOTH_GATT_VALUE_CHANGED_EVENT *event = param;
+    const BTH_LE_GATT_CHARACTERISTIC_VALUE *value = event->CharacteristicValue;
+    const struct winebth_gatt_notification_record *record;
+    struct win32_notification_state *state = context;
+    ULONGLONG received_at;
+    FILETIME now;
+
+    GetSystemTimePreciseAsFileTime( &now );
+    received_at = ((ULONGLONG)now.dwHighDateTime << 32) | now.dwLowDateTime;
+
+    /* bluetoothapis hands the values to the callback straight from the records winebth.sys returned, so the time
+     * the value was received is right in front of it. */
+    record = (const void *)((const BYTE *)value - offsetof( struct winebth_gatt_notification_record, size ));
+    state->lost += bench_sequence_gap( &state->sequence, value->Data, value->DataSize );
+    if (received_at > record->timestamp)
+        bench_samples_add( &state->latency, (received_at - record->timestamp) * frequency.QuadPart / 10000000 );
+    state->received++;
+}
+
+static void win32_notifications( const struct bench_options *options, HANDLE device,
+                                 const BTH_LE_GATT_SERVICE *service, const BTH_LE_GATT_CHARACTERISTIC *chrc )
+{
+    BLUETOOTH_GATT_VALUE_CHANGED_EVENT_REGISTRATION registration;
+    struct winebth_le_device_set_notify_params notify = {0};
+    struct win32_notification_state state = {0};
+    BLUETOOTH_GATT_EVENT_HANDLE handle;
+    LONGLONG start;
+    DWORD bytes;
+    HRESULT hr;
+
+    registration.NumCharacteristics = 1;
+    registration.Characteristics[0] = *chrc;
+    start = bench_now();
+    /* The characteristic only has one request pending at a time, so the callback never runs concurrently with
+     * itself, and BluetoothGATTUnregisterEvent waits for it to return. */
+    if (FAILED( hr = BluetoothGATTRegisterEvent( device, CharacteristicValueChangedEvent, &registration,
+                                                 win32_notification_callback, &state, &handle,
+                                                 BLUETOOTH_GATT_FLAG_NONE ) ))
+    {
+        bench_error( win32_api, L"Registering for notifications failed: %#lx", hr );
+        return;
+    }
+    Sleep( options->duration );
+    BluetoothGATTUnregisterEvent( handle, BLUETOOTH_GATT_FLAG_NONE );
+    bench_report_notifications( win32_api, state.received, state.lost, bench_now() - start );
+    bench_report_samples( win32_api, L"callback", &state.latency );
+
+    /* Notifications stay enabled once the registration is gone. */
+    notify.service = *service;
+    notify.characteristic = *chrc;
+    notify.enable = FALSE;
+    DeviceIoControl( device, IOCTL_WINEBTH_LE_DEVICE_SET_NOTIFY, &notify, sizeof( notify ), NULL, 0, &bytes, NULL );
+
+    bench_samples_free( &state.latency );
+}
+
+static void bench_win32( const struct bench_options *options )
+{
+    BTH_LE_GATT_CHARACTERISTIC chrc;
+    BTH_LE_GATT_SERVICE service;
+    HANDLE radio, device;
+    WCHAR *path;
+
+    if (!(radio = open_first_radio()))
+    {
+        bench_error( win32_api, L"No radio found." );
+        return;
+    }
+    win32_discovery( options, radio );
+    CloseHandle( radio );
+
+    if (!(path = find_le_device_path()))
+    {
+        bench_error( win32_api, L"No LE device found." );
+        return;
+    }
+    device = CreateFileW( path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+                          0, NULL );
+    if (device == INVALID_HANDLE_VALUE)
+    {
+        bench_error( win32_api, L"Opening the device failed: %lu", GetLastError() );
+        free( path );
+        return;
+    }
+    if (find_characteristic( device, &service, &chrc ))
+    {
+        win32_read_write( options, device, &chrc );
+        win32_write_stream( device, &service, &chrc );
+        win32_notifications( options, device, &service, &chrc );
+    }
+    CloseHandle( device );
+    free( path );
+}
+
+static void usage( void )
+{
+    printf( "Usage: winebthbench [--api win32|winrt|pool|all] [--devices N] [--iterations N] [--duration MS]"
+            " [--timeout MS]\n" );
+}
+
+int __cdecl wmain( int argc, WCHAR *argv[] )
+{
+    struct bench_options options = {TRUE, TRUE, TRUE, 1, 1000, 5000, 10000};
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        const WCHAR *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (!wcscmp( argv[i], L"--help" ) || !wcscmp( argv[i], L"/?" ))
+        {
+            usage();
+            return 0;
+        }
+        if (!value)
+        {
+            usage();
+            return 1;
+        }
+        if (!wcscmp( argv[i], L"--api" ))
+        {
+            options.win32 = !wcscmp( value, L"win32" ) || !wcscmp( value, L"all" );
+            options.winrt = !wcscmp( value, L"winrt" ) || !wcscmp( value, L"all" );
+            options.pool = !wcscmp( value, L"pool" ) || !wcscmp( value, L"all" );
+        }
+        else if (!wcscmp( argv[i], L"--devices" )) options.devices = max( wcstoul( value, NULL, 10 ), 1 );
+        else if (!wcscmp( argv[i], L"--iterations" )) options.iterations = wcstoul( value, NULL, 10 );
+        else if (!wcscmp( argv[i], L"--duration" )) options.duration = wcstoul( value, NULL, 10 );
+        else if (!wcscmp( argv[i], L"--timeout" )) options.timeout = wcstoul( value, NULL, 10 );
+        else
+        {
+            usage();
+            return 1;
+        }
+        i++;
+    }
+
+    QueryPerformanceFrequency( &frequency );
+    if (options.win32) bench_win32( &options );
+    if (options.winrt) bench_winrt( &options );
+    if (options.pool) bench_pool( &options );
+    return 0;
+}
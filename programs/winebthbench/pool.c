@@ -0,0 +1,152 @@
+/*
+ * Bluetooth throughput benchmark, notification object allocation
+ *
+ * Copyright 2026 agent
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * Replays what Windows.Devices.Bluetooth does for every batch of notifications it gets from the driver, without a
+ * driver: one output buffer per request, and an IBuffer and event args object per value. This compares copying each
+ * value into its own heap block against handing out pooled objects that point into the request buffer.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <windef.h>
+#include <winbase.h>
+
+#include "objpool.h"
+#include "winebthbench.h"
+
+static const WCHAR pool_api[] = L"pool";
+
+#define BATCH_SIZE 16384
+#define VALUE_SIZE 20   /* A typical sensor value */
+#define VALUES_PER_BATCH (BATCH_SIZE / (VALUE_SIZE + 12))
+
+/* Roughly the sizes of struct gatt_buffer and struct gatt_value_changed_event_args. */
+struct bench_buffer
+{
+    void *vtbl[2];
+    LONG ref;
+    UINT32 length;
+    BYTE *data;
+    void *batch;
+    BYTE inline_data[];
+};
+
+struct bench_event_args
+{
+    void *vtbl;
+    LONG ref;
+    struct bench_buffer *value;
+    ULONGLONG timestamp;
+};
+
+/* Keeps the compiler from optimizing the delivery away. */
+static volatile BYTE sink;
+
+static void deliver( struct bench_event_args *args )
+{
+    sink ^= args->value->data[0];
+}
+
+static void run_heap( const BYTE *batch, unsigned int count, LONGLONG *ticks, UINT64 *allocs )
+{
+    LONGLONG start = bench_now();
+    unsigned int i, j;
+
+    for (i = 0; i < count; i++)
+    {
+        BYTE *params = malloc( BATCH_SIZE );
+
+        memcpy( params, batch, BATCH_SIZE );
+        for (j = 0; j < VALUES_PER_BATCH; j++)
+        {
+            struct bench_buffer *buffer = malloc( offsetof( struct bench_buffer, inline_data[VALUE_SIZE] ) );
+            struct bench_event_args *args = calloc( 1, sizeof(*args) );
+
+            buffer->data = buffer->inline_data;
+            buffer->length = VALUE_SIZE;
+            memcpy( buffer->data, params + j * VALUE_SIZE, VALUE_SIZE );
+            args->value = buffer;
+            deliver( args );
+            free( args );
+            free( buffer );
+        }
+        free( params );
+    }
+    *ticks = bench_now() - start;
+    *allocs = (UINT64)count * (1 + 2 * VALUES_PER_BATCH);
+}
+
+static void run_pool( const BYTE *batch, unsigned int count, LONGLONG *ticks, UINT64 *allocs )
+{
+    struct object_pool_stats before, after;
+    LONGLONG start;
+    unsigned int i, j;
+
+    object_pool_get_stats( &before );
+    start = bench_now();
+    for (i = 0; i < count; i++)
+    {
+        BYTE *params = object_pool_alloc( BATCH_SIZE );
+
+        memcpy( params, batch, BATCH_SIZE );
+        for (j = 0; j < VALUES_PER_BATCH; j++)
+        {
+            struct bench_buffer *buffer = object_pool_alloc( sizeof(*buffer) );
+            struct bench_event_args *args = object_pool_alloc( sizeof(*args) );
+
+            memset( args, 0, sizeof(*args) );
+            buffer->data = params + j * VALUE_SIZE;
+            buffer->length = VALUE_SIZE;
+            buffer->batch = params;
+            args->value = buffer;
+            deliver( args );
+            object_pool_free( args );
+            object_pool_free( buffer );
+        }
+        object_pool_free( params );
+    }
+    *ticks = bench_now() - start;
+    object_pool_get_stats( &after );
+    *allocs = after.heap_allocs - before.heap_allocs;
+}
+
+void bench_pool( const struct bench_options *options )
+{
+    unsigned int batches = max( options->iterations, 1 );
+    LONGLONG ticks;
+    UINT64 allocs;
+    BYTE *batch;
+
+    if (!(batch = calloc( 1, BATCH_SIZE )))
+    {
+        bench_error( pool_api, L"Out of memory." );
+        return;
+    }
+    /* The copy stands in for the driver filling the buffer, which both variants pay for. */
+    run_heap( batch, batches, &ticks, &allocs );
+    bench_report_cost( pool_api, L"heap", (UINT64)batches * VALUES_PER_BATCH, allocs, ticks );
+    run_pool( batch, batches, &ticks, &allocs );
+    bench_report_cost( pool_api, L"pooled", (UINT64)batches * VALUES_PER_BATCH, allocs, ticks );
+    free( batch );
+}
@@ -0,0 +1,68 @@
+/*
+ * Bluetooth throughput benchmark
+ *
+ * Copyright 2026 agent
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __WINEBTHBENCH_H
+#define __WINEBTHBENCH_H
+
+#include <windef.h>
+#include <winbase.h>
+
+struct bench_options
+{
+    BOOL win32;
+    BOOL winrt;
+    BOOL pool;
+    /* How many peripherals discovery has to find. */
+    unsigned int devices;
+    unsigned int iterations;
+    /* How long to count notifications for, in milliseconds. */
+    unsigned int duration;
+    /* How long to wait for discovery or a request before giving up, in milliseconds. */
+    unsigned int timeout;
+};
+
+/* Round trip times of one kind of request, in QueryPerformanceCounter ticks. */
+struct bench_samples
+{
+    LONGLONG *values;
+    SIZE_T count;
+    SIZE_T capacity;
+    unsigned int failures;
+};
+
+extern LONGLONG bench_now( void );
+extern void bench_samples_add( struct bench_samples *samples, LONGLONG ticks );
+extern void bench_samples_free( struct bench_samples *samples );
+
+extern void bench_report_time( const WCHAR *api, const WCHAR *name, LONGLONG ticks );
+extern void bench_report_samples( const WCHAR *api, const WCHAR *name, struct bench_samples *samples );
+extern void bench_report_notifications( const WCHAR *api, UINT64 received, UINT64 lost, LONGLONG ticks );
+/* Reports the cost of delivering each of count values, and the number of heap allocations it took. */
+extern void bench_report_cost( const WCHAR *api, const WCHAR *name, UINT64 count, UINT64 allocs, LONGLONG ticks );
+extern void bench_error( const WCHAR *api, const WCHAR *format, ... );
+
+/* The first value of every notification sent by the simulated backend is a 32-bit sequence number. Returns the number
+ * of values that went missing before this one. */
+extern UINT64 bench_sequence_gap( UINT32 *expected, const BYTE *data, SIZE_T size );
+
+extern void bench_winrt( const struct bench_options *options );
+extern void bench_pool( const struct bench_options *options );
+
+#endif /* __WINEBTHBENCH_H */
@@ -0,0 +1,777 @@
+/*
+ * Bluetooth throughput benchmark, Windows.Devices.Bluetooth runs
+ *
+ * Copyright 2026 agent
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <stdarg.h>
+#include <stdlib.h>
+
+#define COBJMACROS
+#include <windef.h>
+#include <winbase.h>
+#include <winstring.h>
+
+#include <initguid.h>
+#include <roapi.h>
+
+#define WIDL_using_Windows_Foundation
+#define WIDL_using_Windows_Foundation_Collections
+#define WIDL_using_Windows_Storage_Streams
+#define WIDL_using_Windows_Devices_Bluetooth
+#define WIDL_using_Windows_Devices_Bluetooth_Advertisement
+#define WIDL_using_Windows_Devices_Bluetooth_GenericAttributeProfile
+#include <windows.foundation.h>
+#include <windows.storage.streams.h>
+#include <robuffer.h>
+#include <windows.devices.bluetooth.h>
+#include <windows.devices.bluetooth.advertisement.h>
+#include <windows.devices.bluetooth.genericattributeprofile.h>
+
+#include "winebthbench.h"
+
+static const WCHAR winrt_api[] = L"winrt";
+
+/* All IAsyncOperation<T> interfaces share the layout of IAsyncOperation<IInspectable *> up to GetResults, so a single
+ * completion handler that answers to the right IID can wait on any of them. */
+struct async_handler
+{
+    IAsyncOperationCompletedHandler_IInspectable IAsyncOperationCompletedHandler_IInspectable_iface;
+    const GUID *iid;
+    HANDLE event;
+    LONG ref;
+};
+
+static inline struct async_handler *impl_from_IAsyncOperationCompletedHandler_IInspectable( IAsyncOperationCompletedHandler_IInspectable *iface )
+{
+    return CONTAINING_RECORD( iface, struct async_handler, IAsyncOperationCompletedHandler_IInspectable_iface );
+}
+
+static HRESULT WINAPI async_handler_QueryInterface( IAsyncOperationCompletedHandler_IInspectable *iface, REFIID iid, void **out )
+{
+    struct async_handler *impl = impl_from_IAsyncOperationCompletedHandler_IInspectable( iface );
+
+    if (IsEqualGUID( iid, &IID_IUnknown ) || IsEqualGUID( iid, &IID_IAgileObject ) || IsEqualGUID( iid, impl->iid ))
+    {
+        IAsyncOperationCompletedHandler_IInspectable_AddRef( (*out = iface) );
+        return S_OK;
+    }
+    *out = NULL;
+    return E_NOINTERFACE;
+}
+
+static ULONG WINAPI async_handler_AddRef( IAsyncOperationCompletedHandler_IInspectable *iface )
+{
+    struct async_handler *impl = impl_from_IAsyncOperationCompletedHandler_IInspectable( iface );
+    return InterlockedIncrement( &impl->ref );
+}
+
+static ULONG WINAPI async_handler_Release( IAsyncOperationCompletedHandler_IInspectable *iface )
+{
+    struct async_handler *impl = impl_from_IAsyncOperationCompletedHandler_IInspectable( iface );
+    ULONG ref = InterlockedDecrement( &impl->ref );
+
+    if (!ref)
+    {
+        CloseHandle( impl->event );
+        free( impl );
+    }
+    return ref;
+}
+
+static HRESULT WINAPI async_handler_Invoke( IAsyncOperationCompletedHandler_IInspectable *iface,
+                                            IAsyncOperation_IInspectable *async, AsyncStatus status )
+{
+    struct async_handler *impl = impl_from_IAsyncOperationCompletedHandler_IInspectable( iface );
+    SetEvent( impl->event );
+    return S_OK;
+}
+
+static const IAsyncOperationCompletedHandler_IInspectableVtbl async_handler_vtbl =
+{
+    /* IUnknown */
+    async_handler_QueryInterface,
+    async_handler_AddRef,
+    async_handler_Release,
+    /* IAsyncOperationCompletedHandler<IInspectable> */
+    async_handler_Invoke
+};
+
+/* Waits for async to complete, and releases it if it didn't. */
+static BOOL await_async( void *async, const GUID *handler_iid, DWORD timeout )
+{
+    IAsyncOperation_IInspectable *operation = async;
+    struct async_handler *impl;
+    DWORD ret = WAIT_FAILED;
+
+    if (!(impl = calloc( 1, sizeof( *impl ) ))) goto failed;
+    impl->IAsyncOperationCompletedHandler_IInspectable_iface.lpVtbl = &async_handler_vtbl;
+    impl->iid = handler_iid;
+    impl->ref = 1;
+    if (!(impl->event = CreateEventW( NULL, TRUE, FALSE, NULL )))
+    {
+        free( impl );
+        goto failed;
+    }
+
+    if (SUCCEEDED( IAsyncOperation_IInspectable_put_Completed( operation, &impl->IAsyncOperationCompletedHandler_IInspectable_iface ) ))
+        ret = WaitForSingleObject( impl->event, timeout );
+    IAsyncOperationCompletedHandler_IInspectable_Release( &impl->IAsyncOperationCompletedHandler_IInspectable_iface );
+    if (!ret) return TRUE;
+
+failed:
+    IAsyncOperation_IInspectable_Release( operation );
+    return FALSE;
+}
+
+struct event_handler
+{
+    ITypedEventHandler_IInspectable_IInspectable ITypedEventHandler_IInspectable_IInspectable_iface;
+    const GUID *iid;
+    void (*callback)( IInspectable *sender, IInspectable *args, void *data );
+    void *data;
+    LONG ref;
+};
+
+static inline struct event_handler *impl_from_ITypedEventHandler_IInspectable_IInspectable( ITypedEventHandler_IInspectable_IInspectable *iface )
+{
+    return CONTAINING_RECORD( iface, struct event_handler, ITypedEventHandler_IInspectable_IInspectable_iface );
+}
+
+static HRESULT WINAPI event_handler_QueryInterface( ITypedEventHandler_IInspectable_IInspectable *iface, REFIID iid, void **out )
+{
+    struct event_handler *impl = impl_from_ITypedEventHandler_IInspectable_IInspectable( iface );
+
+    if (IsEqualGUID( iid, &IID_IUnknown ) || IsEqualGUID( iid, &IID_IAgileObject ) || IsEqualGUID( iid, impl->iid ))
+    {
+        ITypedEventHandler_IInspectable_IInspectable_AddRef( (*out = iface) );
+        return S_OK;
+    }
+    *out = NULL;
+    return E_NOINTERFACE;
+}
+
+static ULONG WINAPI event_handler_AddRef( ITypedEventHandler_IInspectable_IInspectable *iface )
+{
+    struct event_handler *impl = impl_from_ITypedEventHandler_IInspectable_IInspectable( iface );
+    return InterlockedIncrement( &impl->ref );
+}
+
+static ULONG WINAPI event_handler_Release( ITypedEventHandler_IInspectable_IInspectable *iface )
+{
+    struct event_handler *impl = impl_from_ITypedEventHandler_IInspectable_IInspectable( iface );
+    ULONG ref = InterlockedDecrement( &impl->ref );
+
+    if (!ref) free( impl );
+    return ref;
+}
+
+static HRESULT WINAPI event_handler_Invoke( ITypedEventHandler_IInspectable_IInspectable *iface, IInspectable *sender,
+                                            IInspectable *args )
+{
+    struct event_handler *impl = impl_from_ITypedEventHandler_IInspectable_IInspectable( iface );
+    impl->callback( sender, args, impl->data );
+    return S_OK;
+}
+
+static const ITypedEventHandler_IInspectable_IInspectableVtbl event_handler_vtbl =
+{
+    /* IUnknown */
+    event_handler_QueryInterface,
+    event_handler_AddRef,
+    event_handler_Release,
+    /* ITypedEventHandler<IInspectable *, IInspectable *> */
+    event_handler_Invoke
+};
+
+static ITypedEventHandler_IInspectable_IInspectable *event_handler_create( const GUID *iid,
+                                                                           void (*callback)( IInspectable *, IInspectable *, void * ),
+                                                                           void *data )
+{
+    struct event_handler *impl;
+
+    if (!(impl = calloc( 1, sizeof( *impl ) ))) return NULL;
+    impl->ITypedEventHandler_IInspectable_IInspectable_iface.lpVtbl = &event_handler_vtbl;
+    impl->iid = iid;
+    impl->callback = callback;
+    impl->data = data;
+    impl->ref = 1;
+    return &impl->ITypedEventHandler_IInspectable_IInspectable_iface;
+}
+
+/* A fixed size IBuffer for WriteValueAsync. */
+struct write_buffer
+{
+    IBuffer IBuffer_iface;
+    IBufferByteAccess IBufferByteAccess_iface;
+    UINT32 length;
+    BYTE data[20];
+    LONG ref;
+};
+
+static inline struct write_buffer *impl_from_IBuffer( IBuffer *iface )
+{
+    return CONTAINING_RECORD( iface, struct write_buffer, IBuffer_iface );
+}
+
+static HRESULT WINAPI write_buffer_QueryInterface( IBuffer *iface, REFIID iid, void **out )
+{
+    struct write_buffer *impl = impl_from_IBuffer( iface );
+
+    if (IsEqualGUID( iid, &IID_IUnknown ) || IsEqualGUID( iid, &IID_IInspectable ) ||
+        IsEqualGUID( iid, &IID_IAgileObject ) || IsEqualGUID( iid, &IID_IBuffer ))
+    {
+        IBuffer_AddRef( (*out = &impl->IBuffer_iface) );
+        return S_OK;
+    }
+    if (IsEqualGUID( iid, &IID_IBufferByteAccess ))
+    {
+        IBufferByteAccess_AddRef( (*out = &impl->IBufferByteAccess_iface) );
+        return S_OK;
+    }
+    *out = NULL;
+    return E_NOINTERFACE;
+}
+
+static ULONG WINAPI write_buffer_AddRef( IBuffer *iface )
+{
+    struct write_buffer *impl = impl_from_IBuffer( iface );
+    return InterlockedIncrement( &impl->ref );
+}
+
+static ULONG WINAPI write_buffer_Release( IBuffer *iface )
+{
+    struct write_buffer *impl = impl_from_IBuffer( iface );
+    ULONG ref = InterlockedDecrement( &impl->ref );
+
+    if (!ref) free( impl );
+    return ref;
+}
+
+static HRESULT WINAPI write_buffer_GetIids( IBuffer *iface, ULONG *iid_count, IID **iids )
+{
+    return E_NOTIMPL;
+}
+
+static HRESULT WINAPI write_buffer_GetRuntimeClassName( IBuffer *iface, HSTRING *class_name )
+{
+    return E_NOTIMPL;
+}
+
+static HRESULT WINAPI write_buffer_GetTrustLevel( IBuffer *iface, TrustLevel *trust_level )
+{
+    return E_NOTIMPL;
+}
+
+static HRESULT WINAPI write_buffer_get_Capacity( IBuffer *iface, UINT32 *value )
+{
+    struct write_buffer *impl = impl_from_IBuffer( iface );
+    *value = sizeof( impl->data );
+    return S_OK;
+}
+
+static HRESULT WINAPI write_buffer_get_Length( IBuffer *iface, UINT32 *value )
+{
+    struct write_buffer *impl = impl_from_IBuffer( iface );
+    *value = impl->length;
+    return S_OK;
+}
+
+static HRESULT WINAPI write_buffer_put_Length( IBuffer *iface, UINT32 value )
+{
+    struct write_buffer *impl = impl_from_IBuffer( iface );
+
+    if (value > sizeof( impl->data )) return E_INVALIDARG;
+    impl->length = value;
+    return S_OK;
+}
+
+static const IBufferVtbl write_buffer_vtbl =
+{
+    /* IUnknown */
+    write_buffer_QueryInterface,
+    write_buffer_AddRef,
+    write_buffer_Release,
+    /* IInspectable */
+    write_buffer_GetIids,
+    write_buffer_GetRuntimeClassName,
+    write_buffer_GetTrustLevel,
+    /* IBuffer */
+    write_buffer_get_Capacity,
+    write_buffer_get_Length,
+    write_buffer_put_Length
+};
+
+static inline struct write_buffer *impl_from_IBufferByteAccess( IBufferByteAccess *iface )
+{
+    return CONTAINING_RECORD( iface, struct write_buffer, IBufferByteAccess_iface );
+}
+
+static HRESULT WINAPI write_buffer_byte_access_QueryInterface( IBufferByteAccess *iface, REFIID iid, void **out )
+{
+    struct write_buffer *impl = impl_from_IBufferByteAccess( iface );
+    return IBuffer_QueryInterface( &impl->IBuffer_iface, iid, out );
+}
+
+static ULONG WINAPI write_buffer_byte_access_AddRef( IBufferByteAccess *iface )
+{
+    struct write_buffer *impl = impl_from_IBufferByteAccess( iface );
+    return IBuffer_AddRef( &impl->IBuffer_iface );
+}
+
+static ULONG WINAPI write_buffer_byte_access_Release( IBufferByteAccess *iface )
+{
+    struct write_buffer *impl = impl_from_IBufferByteAccess( iface );
+    return IBuffer_Release( &impl->IBuffer_iface );
+}
+
+static HRESULT WINAPI write_buffer_byte_access_Buffer( IBufferByteAccess *iface, byte **value )
+{
+    struct write_buffer *impl = impl_from_IBufferByteAccess( iface );
+    *value = impl->data;
+    return S_OK;
+}
+
+static const IBufferByteAccessVtbl write_buffer_byte_access_vtbl =
+{
+    /* IUnknown */
+    write_buffer_byte_access_QueryInterface,
+    write_buffer_byte_access_AddRef,
+    write_buffer_byte_access_Release,
+    /* IBufferByteAccess */
+    write_buffer_byte_access_Buffer
+};
+
+static IBuffer *write_buffer_create( void )
+{
+    struct write_buffer *impl;
+
+    if (!(impl = calloc( 1, sizeof( *impl ) ))) return NULL;
+    impl->IBuffer_iface.lpVtbl = &write_buffer_vtbl;
+    impl->IBufferByteAccess_iface.lpVtbl = &write_buffer_byte_access_vtbl;
+    impl->length = sizeof( impl->data );
+    memset( impl->data, 0x5a, sizeof( impl->data ) );
+    impl->ref = 1;
+    return &impl->IBuffer_iface;
+}
+
+static HRESULT activation_factory( const WCHAR *class_name, const GUID *iid, void **out )
+{
+    HSTRING str;
+    HRESULT hr;
+
+    if (FAILED( hr = WindowsCreateString( class_name, wcslen( class_name ), &str ) )) return hr;
+    hr = RoGetActivationFactory( str, iid, out );
+    WindowsDeleteString( str );
+    return hr;
+}
+
+struct discovery
+{
+    CRITICAL_SECTION cs;
+    HANDLE done;
+    UINT64 addresses[256];
+    unsigned int count;
+    unsigned int wanted;
+};
+
+static void discovery_received( IInspectable *sender, IInspectable *args, void *data )
+{
+    IBluetoothLEAdvertisementReceivedEventArgs *event_args;
+    struct discovery *discovery = data;
+    UINT64 address;
+    unsigned int i;
+
+    if (FAILED( IInspectable_QueryInterface( args, &IID_IBluetoothLEAdvertisementReceivedEventArgs,
+                                             (void **)&event_args ) ))
+        return;
+    if (SUCCEEDED( IBluetoothLEAdvertisementReceivedEventArgs_get_BluetoothAddress( event_args, &address ) ))
+    {
+        EnterCriticalSection( &discovery->cs );
+        for (i = 0; i < discovery->count; i++)
+            if (discovery->addresses[i] == address) break;
+        if (i == discovery->count && discovery->count < ARRAY_SIZE( discovery->addresses ))
+        {
+            discovery->addresses[discovery->count++] = address;
+            if (discovery->count == discovery->wanted) SetEvent( discovery->done );
+        }
+        LeaveCriticalSection( &discovery->cs );
+    }
+    IBluetoothLEAdvertisementReceivedEventArgs_Release( event_args );
+}
+
+/* Returns the address of the first device that was discovered, or 0 if there was none. */
+static UINT64 winrt_discovery( const struct bench_options *options )
+{
+    const WCHAR *class_name = RuntimeClass_Windows_Devices_Bluetooth_Advertisement_BluetoothLEAdvertisementWatcher;
+    ITypedEventHandler_IInspectable_IInspectable *handler;
+    IBluetoothLEAdvertisementWatcher *watcher;
+    struct discovery discovery = {0};
+    EventRegistrationToken token;
+    IInspectable *inspectable;
+    UINT64 address = 0;
+    LONGLONG start;
+    HSTRING str;
+    HRESULT hr;
+
+    WindowsCreateString( class_name, wcslen( class_name ), &str );
+    hr = RoActivateInstance( str, &inspectable );
+    WindowsDeleteString( str );
+    if (FAILED( hr ))
+    {
+        bench_error( winrt_api, L"Creating the advertisement watcher failed: %#lx", hr );
+        return 0;
+    }
+    hr = IInspectable_QueryInterface( inspectable, &IID_IBluetoothLEAdvertisementWatcher, (void **)&watcher );
+    IInspectable_Release( inspectable );
+    if (FAILED( hr )) return 0;
+
+    InitializeCriticalSection( &discovery.cs );
+    discovery.done = CreateEventW( NULL, TRUE, FALSE, NULL );
+    discovery.wanted = min( options->devices, ARRAY_SIZE( discovery.addresses ) );
+
+    handler = event_handler_create( &IID_ITypedEventHandler_BluetoothLEAdvertisementWatcher_BluetoothLEAdvertisementReceivedEventArgs,
+                                    discovery_received, &discovery );
+    if (!handler) goto done;
+    hr = IBluetoothLEAdvertisementWatcher_add_Received( watcher,
+                                                        (ITypedEventHandler_BluetoothLEAdvertisementWatcher_BluetoothLEAdvertisementReceivedEventArgs *)handler,
+                                                        &token );
+    ITypedEventHandler_IInspectable_IInspectable_Release( handler );
+    if (FAILED( hr ))
+    {
+        bench_error( winrt_api, L"Registering the Received handler failed: %#lx", hr );
+        goto done;
+    }
+
+    start = bench_now();
+    if (FAILED( hr = IBluetoothLEAdvertisementWatcher_Start( watcher ) ))
+        bench_error( winrt_api, L"Starting the advertisement watcher failed: %#lx", hr );
+    else
+    {
+        if (!WaitForSingleObject( discovery.done, options->timeout ))
+            bench_report_time( winrt_api, L"discovery", bench_now() - start );
+        IBluetoothLEAdvertisementWatcher_Stop( watcher );
+    }
+    IBluetoothLEAdvertisementWatcher_remove_Received( watcher, token );
+
+    EnterCriticalSection( &discovery.cs );
+    if (discovery.count < discovery.wanted)
+        bench_error( winrt_api, L"Only %u of %u devices were discovered.", discovery.count, discovery.wanted );
+    if (discovery.count) address = discovery.addresses[0];
+    LeaveCriticalSection( &discovery.cs );
+
+done:
+    IBluetoothLEAdvertisementWatcher_Release( watcher );
+    CloseHandle( discovery.done );
+    DeleteCriticalSection( &discovery.cs );
+    return address;
+}
+
+static IGattCharacteristic *find_characteristic( const struct bench_options *options, IBluetoothLEDevice *device )
+{
+    const GattCharacteristicProperties wanted = GattCharacteristicProperties_Read | GattCharacteristicProperties_Write |
+                                                GattCharacteristicProperties_Notify;
+    IAsyncOperation_GattDeviceServicesResult *services_async;
+    IGattDeviceServicesResult *services_result = NULL;
+    IVectorView_GattDeviceService *services = NULL;
+    IGattCharacteristic *found = NULL;
+    IBluetoothLEDevice3 *device3;
+    UINT32 services_count, i;
+
+    if (FAILED( IBluetoothLEDevice_QueryInterface( device, &IID_IBluetoothLEDevice3, (void **)&device3 ) )) return NULL;
+    if (SUCCEEDED( IBluetoothLEDevice3_GetGattServicesAsync( device3, &services_async ) ) &&
+        await_async( services_async, &IID_IAsyncOperationCompletedHandler_GattDeviceServicesResult, options->timeout ))
+    {
+        IAsyncOperation_GattDeviceServicesResult_GetResults( services_async, &services_result );
+        IAsyncOperation_GattDeviceServicesResult_Release( services_async );
+    }
+    IBluetoothLEDevice3_Release( device3 );
+    if (!services_result)
+    {
+        bench_error( winrt_api, L"GetGattServicesAsync failed." );
+        return NULL;
+    }
+    IGattDeviceServicesResult_get_Services( services_result, &services );
+    IGattDeviceServicesResult_Release( services_result );
+    if (!services) return NULL;
+
+    if (FAILED( IVectorView_GattDeviceService_get_Size( services, &services_count ) )) services_count = 0;
+    for (i = 0; i < services_count && !found; i++)
+    {
+        IAsyncOperation_GattCharacteristicsResult *chrcs_async;
+        IGattCharacteristicsResult *chrcs_result = NULL;
+        IVectorView_GattCharacteristic *chrcs = NULL;
+        IGattDeviceService3 *service3;
+        IGattDeviceService *service;
+        UINT32 chrcs_count, j;
+
+        if (FAILED( IVectorView_GattDeviceService_GetAt( services, i, &service ) )) continue;
+        if (SUCCEEDED( IGattDeviceService_QueryInterface( service, &IID_IGattDeviceService3, (void **)&service3 ) ))
+        {
+            if (SUCCEEDED( IGattDeviceService3_GetCharacteristicsAsync( service3, &chrcs_async ) ) &&
+                await_async( chrcs_async, &IID_IAsyncOperationCompletedHandler_GattCharacteristicsResult, options->timeout ))
+            {
+                IAsyncOperation_GattCharacteristicsResult_GetResults( chrcs_async, &chrcs_result );
+                IAsyncOperation_GattCharacteristicsResult_Release( chrcs_async );
+            }
+            IGattDeviceService3_Release( service3 );
+        }
+        IGattDeviceService_Release( service );
+        if (!chrcs_result) continue;
+        IGattCharacteristicsResult_get_Characteristics( chrcs_result, &chrcs );
+        IGattCharacteristicsResult_Release( chrcs_result );
+        if (!chrcs) continue;
+
+        if (FAILED( IVectorView_GattCharacteristic_get_Size( chrcs, &chrcs_count ) )) chrcs_count = 0;
+        for (j = 0; j < chrcs_count && !found; j++)
+        {
+            GattCharacteristicProperties props = 0;
+            IGattCharacteristic *chrc;
+
+            if (FAILED( IVectorView_GattCharacteristic_GetAt( chrcs, j, &chrc ) )) continue;
+            IGattCharacteristic_get_CharacteristicProperties( chrc, &props );
+            if ((props & wanted) == wanted) found = chrc;
+            else IGattCharacteristic_Release( chrc );
+        }
+        IVectorView_GattCharacteristic_Release( chrcs );
+    }
+    IVectorView_GattDeviceService_Release( services );
+
+    if (!found) bench_error( winrt_api, L"No readable, writable and notifiable characteristic was found." );
+    return found;
+}
+
+static void winrt_read_write( const struct bench_options *options, IGattCharacteristic *chrc )
+{
+    struct bench_samples reads = {0}, writes = {0};
+    IBuffer *buffer;
+    unsigned int i;
+
+    for (i = 0; i < options->iterations; i++)
+    {
+        GattCommunicationStatus status = GattCommunicationStatus_Unreachable;
+        IAsyncOperation_GattReadResult *async;
+        IGattReadResult *result = NULL;
+        LONGLONG start = bench_now();
+
+        if (SUCCEEDED( IGattCharacteristic_ReadValueWithCacheModeAsync( chrc, BluetoothCacheMode_Uncached, &async ) ) &&
+            await_async( async, &IID_IAsyncOperationCompletedHandler_GattReadResult, options->timeout ))
+        {
+            IAsyncOperation_GattReadResult_GetResults( async, &result );
+            IAsyncOperation_GattReadResult_Release( async );
+        }
+        if (result)
+        {
+            IGattReadResult_get_Status( result, &status );
+            IGattReadResult_Release( result );
+        }
+        if (status == GattCommunicationStatus_Success)
+            bench_samples_add( &reads, bench_now() - start );
+        else
+            reads.failures++;
+    }
+    bench_report_samples( winrt_api, L"read", &reads );
+
+    if ((buffer = write_buffer_create()))
+    {
+        for (i = 0; i < options->iterations; i++)
+        {
+            GattCommunicationStatus status = GattCommunicationStatus_Unreachable;
+            IAsyncOperation_GattCommunicationStatus *async;
+            LONGLONG start = bench_now();
+
+            if (SUCCEEDED( IGattCharacteristic_WriteValueAsync( chrc, buffer, &async ) ) &&
+                await_async( async, &IID_IAsyncOperationCompletedHandler_GattCommunicationStatus, options->timeout ))
+            {
+                IAsyncOperation_GattCommunicationStatus_GetResults( async, &status );
+                IAsyncOperation_GattCommunicationStatus_Release( async );
+            }
+            if (status == GattCommunicationStatus_Success)
+                bench_samples_add( &writes, bench_now() - start );
+            else
+                writes.failures++;
+        }
+        IBuffer_Release( buffer );
+    }
+    bench_report_samples( winrt_api, L"write", &writes );
+
+    bench_samples_free( &reads );
+    bench_samples_free( &writes );
+}
+
+struct notifications
+{
+    CRITICAL_SECTION cs;
+    struct bench_samples latency;
+    UINT64 received;
+    UINT64 lost;
+    UINT32 sequence;
+};
+
+static void notification_received( IInspectable *sender, IInspectable *args, void *data )
+{
+    struct notifications *notifications = data;
+    IGattValueChangedEventArgs *event_args;
+    IBufferByteAccess *byte_access;
+    IBuffer *value = NULL;
+    DateTime timestamp = {0};
+    UINT32 length = 0;
+    BYTE *bytes = NULL;
+    FILETIME now;
+
+    GetSystemTimePreciseAsFileTime( &now );
+    if (FAILED( IInspectable_QueryInterface( args, &IID_IGattValueChangedEventArgs, (void **)&event_args ) )) return;
+    IGattValueChangedEventArgs_get_Timestamp( event_args, &timestamp );
+    IGattValueChangedEventArgs_get_CharacteristicValue( event_args, &value );
+    IGattValueChangedEventArgs_Release( event_args );
+
+    if (value)
+    {
+        IBuffer_get_Length( value, &length );
+        if (SUCCEEDED( IBuffer_QueryInterface( value, &IID_IBufferByteAccess, (void **)&byte_access ) ))
+        {
+            IBufferByteAccess_Buffer( byte_access, &bytes );
+            IBufferByteAccess_Release( byte_access );
+        }
+    }
+
+    EnterCriticalSection( &notifications->cs );
+    notifications->received++;
+    if (bytes) notifications->lost += bench_sequence_gap( &notifications->sequence, bytes, length );
+    if (timestamp.UniversalTime)
+    {
+        LONGLONG received_at = ((ULONGLONG)now.dwHighDateTime << 32) | now.dwLowDateTime;
+        LARGE_INTEGER frequency;
+
+        QueryPerformanceFrequency( &frequency );
+        if (received_at > timestamp.UniversalTime)
+            bench_samples_add( &notifications->latency,
+                               (received_at - timestamp.UniversalTime) * frequency.QuadPart / 10000000 );
+    }
+    LeaveCriticalSection( &notifications->cs );
+
+    if (value) IBuffer_Release( value );
+}
+
+static BOOL write_cccd( const struct bench_options *options, IGattCharacteristic *chrc,
+                        GattClientCharacteristicConfigurationDescriptorValue value )
+{
+    GattCommunicationStatus status = GattCommunicationStatus_Unreachable;
+    IAsyncOperation_GattCommunicationStatus *async;
+
+    if (SUCCEEDED( IGattCharacteristic_WriteClientCharacteristicConfigurationDescriptorAsync( chrc, value, &async ) ) &&
+        await_async( async, &IID_IAsyncOperationCompletedHandler_GattCommunicationStatus, options->timeout ))
+    {
+        IAsyncOperation_GattCommunicationStatus_GetResults( async, &status );
+        IAsyncOperation_GattCommunicationStatus_Release( async );
+    }
+    return status == GattCommunicationStatus_Success;
+}
+
+static void winrt_notifications( const struct bench_options *options, IGattCharacteristic *chrc )
+{
+    ITypedEventHandler_IInspectable_IInspectable *handler;
+    struct notifications notifications = {0};
+    EventRegistrationToken token;
+    LONGLONG start, elapsed;
+    HRESULT hr;
+
+    InitializeCriticalSection( &notifications.cs );
+    handler = event_handler_create( &IID_ITypedEventHandler_GattCharacteristic_GattValueChangedEventArgs,
+                                    notification_received, &notifications );
+    if (!handler)
+    {
+        DeleteCriticalSection( &notifications.cs );
+        return;
+    }
+    hr = IGattCharacteristic_add_ValueChanged( chrc,
+                                               (ITypedEventHandler_GattCharacteristic_GattValueChangedEventArgs *)handler,
+                                               &token );
+    ITypedEventHandler_IInspectable_IInspectable_Release( handler );
+    if (FAILED( hr ))
+    {
+        bench_error( winrt_api, L"Registering the ValueChanged handler failed: %#lx", hr );
+        DeleteCriticalSection( &notifications.cs );
+        return;
+    }
+
+    start = bench_now();
+    if (!write_cccd( options, chrc, GattClientCharacteristicConfigurationDescriptorValue_Notify ))
+        bench_error( winrt_api, L"Enabling notifications failed." );
+    else
+    {
+        Sleep( options->duration );
+        write_cccd( options, chrc, GattClientCharacteristicConfigurationDescriptorValue_None );
+    }
+    elapsed = bench_now() - start;
+    IGattCharacteristic_remove_ValueChanged( chrc, token );
+
+    EnterCriticalSection( &notifications.cs );
+    bench_report_notifications( winrt_api, notifications.received, notifications.lost, elapsed );
+    bench_report_samples( winrt_api, L"delivery", &notifications.latency );
+    bench_samples_free( &notifications.latency );
+    LeaveCriticalSection( &notifications.cs );
+    DeleteCriticalSection( &notifications.cs );
+}
+
+void bench_winrt( const struct bench_options *options )
+{
+    IAsyncOperation_BluetoothLEDevice *device_async;
+    IBluetoothLEDeviceStatics *statics;
+    IBluetoothLEDevice *device = NULL;
+    IGattCharacteristic *chrc;
+    UINT64 address;
+    HRESULT hr;
+
+    if (FAILED( hr = RoInitialize( RO_INIT_MULTITHREADED ) ))
+    {
+        bench_error( winrt_api, L"RoInitialize failed: %#lx", hr );
+        return;
+    }
+    if (!(address = winrt_discovery( options ))) goto done;
+
+    hr = activation_factory( RuntimeClass_Windows_Devices_Bluetooth_BluetoothLEDevice, &IID_IBluetoothLEDeviceStatics,
+                             (void **)&statics );
+    if (FAILED( hr ))
+    {
+        bench_error( winrt_api, L"Getting the BluetoothLEDevice statics failed: %#lx", hr );
+        goto done;
+    }
+    if (SUCCEEDED( IBluetoothLEDeviceStatics_FromBluetoothAddressAsync( statics, address, &device_async ) ) &&
+        await_async( device_async, &IID_IAsyncOperationCompletedHandler_BluetoothLEDevice, options->timeout ))
+    {
+        IAsyncOperation_BluetoothLEDevice_GetResults( device_async, &device );
+        IAsyncOperation_BluetoothLEDevice_Release( device_async );
+    }
+    IBluetoothLEDeviceStatics_Release( statics );
+    if (!device)
+    {
+        bench_error( winrt_api, L"No BluetoothLEDevice for %I64x.", address );
+        goto done;
+    }
+
+    if ((chrc = find_characteristic( options, device )))
+    {
+        winrt_read_write( options, chrc );
+        winrt_notifications( options, chrc );
+        IGattCharacteristic_Release( chrc );
+    }
+    IBluetoothLEDevice_Release( device );
+
+done:
+    RoUninitialize();
+}
@@ -0,0 +1,384 @@
+/*
+ * Bluetooth driver statistics
+ *
+ * Copyright 2026 agent
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * Dumps the counters winebth.sys keeps for its IOCTLs, its event loop, its locks, the PnP churn it causes and the
+ * notifications queued for each characteristic. With --interval, two snapshots are taken and only what happened in
+ * between is shown, e.g.:
+ *
+ *     wine winebthstat --interval 5000
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <windef.h>
+#include <winbase.h>
+#include <winioctl.h>
+
+#include <bthsdpdef.h>
+#include <bluetoothapis.h>
+#include <bthledef.h>
+#include <bthdef.h>
+#include <bthioctl.h>
+
+#include <wine/winebth.h>
+
+static const struct
+{
+    ULONG code;
+    const char *name;
+} ioctl_names[] =
+{
+#define X(code) {code, #code}
+    X(IOCTL_BTH_GET_LOCAL_INFO),
+    X(IOCTL_BTH_GET_DEVICE_INFO),
+    X(IOCTL_BTH_DISCONNECT_DEVICE),
+    X(IOCTL_WINEBTH_RADIO_SET_FLAG),
+    X(IOCTL_WINEBTH_RADIO_START_DISCOVERY),
+    X(IOCTL_WINEBTH_RADIO_STOP_DISCOVERY),
+    X(IOCTL_WINEBTH_AUTH_REGISTER),
+    X(IOCTL_WINEBTH_RADIO_SEND_AUTH_RESPONSE),
+    X(IOCTL_WINEBTH_RADIO_START_AUTH),
+    X(IOCTL_WINEBTH_RADIO_REMOVE_DEVICE),
+    X(IOCTL_WINEBTH_RADIO_GET_LE_DEVICE_GATT_SERVICES),
+    X(IOCTL_WINEBTH_RADIO_GET_DEVICE_CONNECTION_STATUS),
+    X(IOCTL_WINEBTH_RADIO_GET_LE_DEVICE_GATT_CHARACTERISTICS),
+    X(IOCTL_WINEBTH_RADIO_READ_NOTIFICATION),
+    X(IOCTL_WINEBTH_RADIO_READ_CHARACTERISTIC),
+    X(IOCTL_WINEBTH_RADIO_WRITE_CHARACTERISTIC),
+    X(IOCTL_WINEBTH_RADIO_SET_NOTIFY),
+    X(IOCTL_WINEBTH_RADIO_READ_NOTIFICATIONS),
+    X(IOCTL_WINEBTH_RADIO_SET_DISCOVERY_FILTER),
+    X(IOCTL_WINEBTH_RADIO_READ_ADVERTISEMENTS),
+    X(IOCTL_WINEBTH_RADIO_GET_DEVICE_CHANGES),
+    X(IOCTL_WINEBTH_RADIO_WAIT_CONNECTION_CHANGES),
+    X(IOCTL_WINEBTH_RADIO_GET_LE_DEVICE_GATT_DATABASE),
+    X(IOCTL_WINEBTH_RADIO_WRITE_CHARACTERISTIC_STREAM),
+    X(IOCTL_WINEBTH_RADIO_GET_LE_DEVICE_ATT_MTU),
+    X(IOCTL_WINEBTH_RADIO_WAIT_DEVICE_CHANGES),
+    X(IOCTL_WINEBTH_RADIO_GET_STATS),
+    X(IOCTL_WINEBTH_LE_DEVICE_GET_GATT_SERVICES),
+    X(IOCTL_WINEBTH_LE_DEVICE_GET_GATT_CHARACTERISTICS),
+    X(IOCTL_WINEBTH_LE_DEVICE_READ_CHARACTERISTIC),
+    X(IOCTL_WINEBTH_LE_DEVICE_WRITE_CHARACTERISTIC),
+    X(IOCTL_WINEBTH_LE_DEVICE_SET_NOTIFY),
+    X(IOCTL_WINEBTH_LE_DEVICE_GET_CONNECTION_STATUS),
+    X(IOCTL_WINEBTH_LE_DEVICE_READ_NOTIFICATION),
+    X(IOCTL_WINEBTH_LE_DEVICE_READ_NOTIFICATIONS),
+    X(IOCTL_WINEBTH_LE_DEVICE_GET_GATT_DATABASE),
+    X(IOCTL_WINEBTH_LE_DEVICE_WRITE_CHARACTERISTIC_STREAM),
+    X(IOCTL_WINEBTH_LE_DEVICE_GET_ATT_MTU),
+#undef X
+};
+
+/* In the order of the driver's event types. */
+static const char *event_type_names[] =
+{
+    "radio added",
+    "radio removed",
+    "radio properties changed",
+    "device added",
+    "device removed",
+    "device properties changed",
+    "pairing finished",
+    "service added",
+    "service removed",
+    "characteristic added",
+    "characteristic removed",
+    "characteristic value changed",
+    "characteristic I/O finished",
+};
+
+static const char *lock_names[WINEBTH_STATS_LOCKS_COUNT] =
+{
+    "device_list_cs",
+    "props_cs",
+};
+
+static const char *ioctl_name( ULONG code )
+{
+    static char buffer[16];
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE( ioctl_names ); i++)
+        if (ioctl_names[i].code == code) return ioctl_names[i].name + sizeof( "IOCTL_" ) - 1;
+    sprintf( buffer, "%#lx", code );
+    return buffer;
+}
+
+static struct winebth_stats *get_stats( HANDLE radio )
+{
+    DWORD size = WINEBTH_STATS_SIZE( 0, 0 ), bytes;
+    struct winebth_stats *stats = NULL, *new_stats;
+
+    for (;;)
+    {
+        if (!(new_stats = realloc( stats, size ))) break;
+        stats = new_stats;
+        if (DeviceIoControl( radio, IOCTL_WINEBTH_RADIO_GET_STATS, NULL, 0, stats, size, &bytes, NULL ))
+        {
+            if (stats->version == WINEBTH_STATS_VERSION) return stats;
+            SetLastError( ERROR_REVISION_MISMATCH );
+            break;
+        }
+        if (GetLastError() != ERROR_MORE_DATA) break;
+        /* Leave some room for IOCTLs and characteristics that show up in the meantime. */
+        size = WINEBTH_STATS_SIZE( stats->ioctls_count + 4, stats->characteristics_count + 16 );
+    }
+    free( stats );
+    return NULL;
+}
+
+static const struct winebth_characteristic_stats *stats_characteristics( const struct winebth_stats *stats )
+{
+    return (const struct winebth_characteristic_stats *)&stats->ioctls[stats->ioctls_count];
+}
+
+static const struct winebth_ioctl_stats *find_ioctl( const struct winebth_stats *stats, ULONG code )
+{
+    ULONG i;
+
+    if (!stats) return NULL;
+    for (i = 0; i < stats->ioctls_count; i++)
+        if (stats->ioctls[i].code == code) return &stats->ioctls[i];
+    return NULL;
+}
+
+static const struct winebth_characteristic_stats *find_characteristic( const struct winebth_stats *stats,
+                                                                       const struct winebth_characteristic_stats *chrc )
+{
+    const struct winebth_characteristic_stats *chars;
+    ULONG i;
+
+    if (!stats) return NULL;
+    chars = stats_characteristics( stats );
+    for (i = 0; i < stats->characteristics_count; i++)
+        if (chars[i].address == chrc->address &&
+            chars[i].characteristic.ServiceHandle == chrc->characteristic.ServiceHandle &&
+            chars[i].characteristic.AttributeHandle == chrc->characteristic.AttributeHandle)
+            return &chars[i];
+    return NULL;
+}
+
+/* Returns the upper bound of the latency bucket the given percentile falls in, in microseconds. */
+static double latency_percentile( const ULONGLONG *latency, ULONGLONG count, unsigned int percent )
+{
+    ULONGLONG target = (count * percent + 99) / 100, seen = 0;
+    unsigned int i;
+
+    for (i = 0; i < WINEBTH_STATS_LATENCY_BUCKETS; i++)
+        if ((seen += latency[i]) >= target && seen) return (double)(1ull << i);
+    return (double)(1ull << (WINEBTH_STATS_LATENCY_BUCKETS - 1));
+}
+
+static void print_ioctls( const struct winebth_stats *stats, const struct winebth_stats *prev )
+{
+    ULONG i, j;
+
+    printf( "%-48s %10s %8s %8s %10s %8s %8s %8s %10s\n", "IOCTL", "calls", "errors", "pending", "avg us",
+            "p50 <us", "p90 <us", "p99 <us", "max us" );
+    for (i = 0; i < stats->ioctls_count; i++)
+    {
+        const struct winebth_ioctl_stats *cur = &stats->ioctls[i], *old = find_ioctl( prev, cur->code );
+        ULONGLONG latency[WINEBTH_STATS_LATENCY_BUCKETS], calls, errors, pending, timed, total_time;
+
+        calls = cur->calls - (old ? old->calls : 0);
+        if (!calls) continue;
+        errors = cur->errors - (old ? old->errors : 0);
+        pending = cur->pending - (old ? old->pending : 0);
+        total_time = cur->total_time - (old ? old->total_time : 0);
+        for (j = 0; j < WINEBTH_STATS_LATENCY_BUCKETS; j++)
+            latency[j] = cur->latency[j] - (old ? old->latency[j] : 0);
+        timed = calls - pending;
+
+        /* The maximum can't be diffed, it is always the one since the driver started. */
+        printf( "%-48s %10I64u %8I64u %8I64u %10.1f %8.0f %8.0f %8.0f %10.1f\n", ioctl_name( cur->code ), calls,
+                errors, pending, timed ? total_time / 10.0 / timed : 0.0, latency_percentile( latency, timed, 50 ),
+                latency_percentile( latency, timed, 90 ), latency_percentile( latency, timed, 99 ),
+                cur->max_time / 10.0 );
+    }
+}
+
+static void print_event_types( const struct winebth_stats *stats, const struct winebth_stats *prev )
+{
+    ULONG i, j;
+
+    printf( "%-48s %10s %10s %8s %8s %8s %10s\n", "Event", "count", "avg us", "p50 <us", "p90 <us", "p99 <us",
+            "max us" );
+    for (i = 0; i < WINEBTH_STATS_EVENT_TYPES; i++)
+    {
+        const struct winebth_event_stats *cur = &stats->event_types[i], *old = prev ? &prev->event_types[i] : NULL;
+        ULONGLONG latency[WINEBTH_STATS_LATENCY_BUCKETS], count, total_time;
+        char buffer[16];
+
+        if (!(count = cur->count - (old ? old->count : 0))) continue;
+        total_time = cur->total_time - (old ? old->total_time : 0);
+        for (j = 0; j < WINEBTH_STATS_LATENCY_BUCKETS; j++)
+            latency[j] = cur->latency[j] - (old ? old->latency[j] : 0);
+        if (i >= ARRAY_SIZE( event_type_names )) sprintf( buffer, "%lu", i );
+        printf( "%-48s %10I64u %10.1f %8.0f %8.0f %8.0f %10.1f\n",
+                i < ARRAY_SIZE( event_type_names ) ? event_type_names[i] : buffer, count, total_time / 10.0 / count,
+                latency_percentile( latency, count, 50 ), latency_percentile( latency, count, 90 ),
+                latency_percentile( latency, count, 99 ), cur->max_time / 10.0 );
+    }
+}
+
+static void print_locks( const struct winebth_stats *stats, const struct winebth_stats *prev )
+{
+    ULONG i;
+
+    if (!stats->locks_enabled)
+    {
+        printf( "Lock statistics are disabled, set the LockStats driver option to gather them.\n" );
+        return;
+    }
+    printf( "%-48s %10s %10s %10s %10s %10s\n", "Lock", "acquired", "contended", "avg wait us", "avg hold us",
+            "max hold us" );
+    for (i = 0; i < WINEBTH_STATS_LOCKS_COUNT; i++)
+    {
+        const struct winebth_lock_stats *cur = &stats->locks[i], *old = prev ? &prev->locks[i] : NULL;
+        ULONGLONG acquisitions = cur->acquisitions - (old ? old->acquisitions : 0);
+        ULONGLONG contentions = cur->contentions - (old ? old->contentions : 0);
+        ULONGLONG wait_time = cur->wait_time - (old ? old->wait_time : 0);
+        ULONGLONG hold_time = cur->hold_time - (old ? old->hold_time : 0);
+
+        printf( "%-48s %10I64u %10I64u %10.1f %10.1f %10.1f\n", lock_names[i], acquisitions, contentions,
+                contentions ? wait_time / 10.0 / contentions : 0.0,
+                acquisitions ? hold_time / 10.0 / acquisitions : 0.0, cur->max_hold_time / 10.0 );
+    }
+}
+
+static void print_characteristics( const struct winebth_stats *stats, const struct winebth_stats *prev,
+                                   double seconds )
+{
+    const struct winebth_characteristic_stats *chars = stats_characteristics( stats );
+    ULONG i;
+
+    if (!stats->characteristics_count) return;
+    printf( "%-17s %6s %6s %12s %10s %8s %8s %10s %10s\n", "device", "svc", "attr", "received", "rate/s", "queued",
+            "bytes", "max queued", "overflows" );
+    for (i = 0; i < stats->characteristics_count; i++)
+    {
+        const struct winebth_characteristic_stats *cur = &chars[i], *old = find_characteristic( prev, cur );
+        ULONGLONG received = cur->received - (old ? old->received : 0);
+        BTH_ADDR addr = cur->address;
+
+        printf( "%02x:%02x:%02x:%02x:%02x:%02x %6u %6u %12I64u %10.1f %8lu %8lu %10lu %10lu\n",
+                (UINT)(addr >> 40) & 0xff, (UINT)(addr >> 32) & 0xff, (UINT)(addr >> 24) & 0xff,
+                (UINT)(addr >> 16) & 0xff, (UINT)(addr >> 8) & 0xff, (UINT)addr & 0xff,
+                cur->characteristic.ServiceHandle, cur->characteristic.AttributeHandle, received,
+                seconds > 0 ? received / seconds : 0.0, cur->queued, cur->queued_bytes, cur->max_queued,
+                cur->overflow_count - (old ? old->overflow_count : 0) );
+    }
+}
+
+static void print_stats( unsigned int index, const struct winebth_stats *stats, const struct winebth_stats *prev )
+{
+    double seconds = prev ? (stats->timestamp - prev->timestamp) / 10000000.0 : 0;
+    ULONGLONG queued = stats->events_queued - (prev ? prev->events_queued : 0);
+    ULONGLONG handled = stats->events_handled - (prev ? prev->events_handled : 0);
+
+    /* The IOCTL and event loop counters are shared by all radios, only print them once. */
+    if (!index)
+    {
+        if (prev) printf( "Interval: %.1f s\n\n", seconds );
+        printf( "Events: %I64u queued, %I64u handled, %I64u waiting, %lu at most\n\n", queued, handled,
+                stats->events_queued - stats->events_handled, stats->max_event_backlog );
+        print_event_types( stats, prev );
+        printf( "\n" );
+        print_locks( stats, prev );
+        printf( "\nPnP: %I64u device relations invalidated, %I64u PDOs created, %I64u PDOs deleted\n\n",
+                stats->relations_invalidated - (prev ? prev->relations_invalidated : 0),
+                stats->pdos_created - (prev ? prev->pdos_created : 0),
+                stats->pdos_deleted - (prev ? prev->pdos_deleted : 0) );
+        print_ioctls( stats, prev );
+    }
+    printf( "\nRadio %u:\n", index );
+    print_characteristics( stats, prev, seconds );
+}
+
+static void usage( void )
+{
+    printf( "Usage: winebthstat [--interval MS]\n" );
+}
+
+int __cdecl wmain( int argc, WCHAR *argv[] )
+{
+    BLUETOOTH_FIND_RADIO_PARAMS params = {.dwSize = sizeof( params )};
+    struct winebth_stats **first = NULL, *stats;
+    HANDLE *radios = NULL, radio, *new_radios;
+    HBLUETOOTH_RADIO_FIND find;
+    unsigned int i, count = 0;
+    DWORD interval = 0;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (!wcscmp( argv[i], L"--help" ) || !wcscmp( argv[i], L"/?" ))
+        {
+            usage();
+            return 0;
+        }
+        if (!wcscmp( argv[i], L"--interval" ) && i + 1 < argc) interval = wcstoul( argv[++i], NULL, 10 );
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    if (!(find = BluetoothFindFirstRadio( &params, &radio )))
+    {
+        printf( "No Bluetooth radios found.\n" );
+        return 1;
+    }
+    do
+    {
+        if (!(new_radios = realloc( radios, (count + 1) * sizeof( *radios ) )))
+        {
+            CloseHandle( radio );
+            break;
+        }
+        radios = new_radios;
+        radios[count++] = radio;
+    } while (BluetoothFindNextRadio( find, &radio ));
+    BluetoothFindRadioClose( find );
+
+    if (interval && (first = calloc( count, sizeof( *first ) )))
+    {
+        for (i = 0; i < count; i++) first[i] = get_stats( radios[i] );
+        Sleep( interval );
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if ((stats = get_stats( radios[i] )))
+            print_stats( i, stats, first ? first[i] : NULL );
+        else
+            printf( "Radio %u: failed to get statistics: %lu\n", i, GetLastError() );
+        free( stats );
+        if (first) free( first[i] );
+        CloseHandle( radios[i] );
+    }
+    free( first );
+    free( radios );
+    return 0;
+}
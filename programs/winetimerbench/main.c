@@ -0,0 +1,188 @@
+/*
+ * wineserver timeout queue benchmark
+ *
+ * Copyright 2026 agent
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * Measures how long the server takes to queue and expire timeouts as the number of pending ones grows, up to
+ * --pending. Every pending timeout belongs to a waitable timer due at a random time between one and two hours from
+ * now, so they never expire while the benchmark runs. At each step:
+ *
+ *   - a probe timer is re-armed --samples times, each time to another random due time in the same range, which
+ *     removes one timeout from the server's queue and inserts another one among the pending ones;
+ *   - as many 1 ms timed waits are done, and the time they overshoot 1 ms by is reported, which covers queueing the
+ *     wait's timeout, expiring it and waking the thread up.
+ *
+ * If the queue scales, both columns stay flat as the pending count grows, e.g.:
+ *
+ *     wine winetimerbench --pending 100000
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <windef.h>
+#include <winbase.h>
+
+static LARGE_INTEGER frequency;
+static unsigned int random_state = 1;
+
+static double ticks_to_us( LONGLONG ticks )
+{
+    return (double)ticks * 1000000 / frequency.QuadPart;
+}
+
+/* A due time between one and two hours from now, in the relative format SetWaitableTimer takes. */
+static LARGE_INTEGER random_due_time( void )
+{
+    LARGE_INTEGER due;
+
+    random_state = random_state * 1103515245 + 12345;
+    due.QuadPart = -(3600 * (LONGLONG)10000000 + (LONGLONG)(random_state >> 1) % (3600 * (LONGLONG)10000000));
+    return due;
+}
+
+static int __cdecl compare_ticks( const void *a, const void *b )
+{
+    LONGLONG x = *(const LONGLONG *)a, y = *(const LONGLONG *)b;
+    return x < y ? -1 : x > y;
+}
+
+struct summary
+{
+    double avg;
+    double p50;
+    double p99;
+};
+
+static void summarize( LONGLONG *values, unsigned int count, struct summary *summary )
+{
+    LONGLONG total = 0;
+    unsigned int i;
+
+    qsort( values, count, sizeof( *values ), compare_ticks );
+    for (i = 0; i < count; i++) total += values[i];
+    summary->avg = ticks_to_us( total ) / count;
+    summary->p50 = ticks_to_us( values[count / 2] );
+    summary->p99 = ticks_to_us( values[(count * 99ull) / 100] );
+}
+
+static void measure_rearm( HANDLE timer, LONGLONG *values, unsigned int count )
+{
+    LARGE_INTEGER start, end, due;
+    unsigned int i;
+
+    for (i = 0; i < count; i++)
+    {
+        due = random_due_time();
+        QueryPerformanceCounter( &start );
+        SetWaitableTimer( timer, &due, 0, NULL, NULL, FALSE );
+        QueryPerformanceCounter( &end );
+        values[i] = end.QuadPart - start.QuadPart;
+    }
+}
+
+static void measure_wait( HANDLE event, LONGLONG *values, unsigned int count )
+{
+    LONGLONG one_ms = frequency.QuadPart / 1000;
+    LARGE_INTEGER start, end;
+    unsigned int i;
+
+    for (i = 0; i < count; i++)
+    {
+        QueryPerformanceCounter( &start );
+        WaitForSingleObject( event, 1 );
+        QueryPerformanceCounter( &end );
+        values[i] = max( end.QuadPart - start.QuadPart - one_ms, 0 );
+    }
+}
+
+static void usage( void )
+{
+    printf( "Usage: winetimerbench [--pending COUNT] [--samples COUNT]\n" );
+}
+
+int __cdecl wmain( int argc, WCHAR *argv[] )
+{
+    unsigned int i, max_pending = 100000, samples = 10000, pending = 0, step;
+    HANDLE *timers, probe, event;
+    LONGLONG *values;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (!wcscmp( argv[i], L"--help" ) || !wcscmp( argv[i], L"/?" ))
+        {
+            usage();
+            return 0;
+        }
+        if (!wcscmp( argv[i], L"--pending" ) && i + 1 < argc) max_pending = wcstoul( argv[++i], NULL, 10 );
+        else if (!wcscmp( argv[i], L"--samples" ) && i + 1 < argc) samples = max( wcstoul( argv[++i], NULL, 10 ), 1 );
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    QueryPerformanceFrequency( &frequency );
+    if (!(timers = malloc( max( max_pending, 1 ) * sizeof( *timers ) )) ||
+        !(values = malloc( samples * sizeof( *values ) )))
+    {
+        printf( "Out of memory.\n" );
+        return 1;
+    }
+    probe = CreateWaitableTimerW( NULL, TRUE, NULL );
+    event = CreateEventW( NULL, TRUE, FALSE, NULL );
+
+    printf( "%10s %12s %10s %10s %12s %10s %10s\n", "pending", "rearm avg us", "p50 us", "p99 us",
+            "wait over us", "p50 us", "p99 us" );
+    for (step = 0; pending <= max_pending; step = step ? step * 10 : 100)
+    {
+        struct summary rearm, wait;
+
+        for (; pending < min( step, max_pending ); pending++)
+        {
+            LARGE_INTEGER due = random_due_time();
+
+            if (!(timers[pending] = CreateWaitableTimerW( NULL, TRUE, NULL )) ||
+                !SetWaitableTimer( timers[pending], &due, 0, NULL, NULL, FALSE ))
+            {
+                printf( "Failed to set up pending timer %u, error %lu.\n", pending, GetLastError() );
+                if (timers[pending]) CloseHandle( timers[pending] );
+                max_pending = pending;
+                break;
+            }
+        }
+
+        measure_rearm( probe, values, samples );
+        summarize( values, samples, &rearm );
+        measure_wait( event, values, samples );
+        summarize( values, samples, &wait );
+        printf( "%10u %12.2f %10.2f %10.2f %12.2f %10.2f %10.2f\n", pending, rearm.avg, rearm.p50, rearm.p99,
+                wait.avg, wait.p50, wait.p99 );
+        if (pending == max_pending) break;
+    }
+
+    for (i = 0; i < pending; i++) CloseHandle( timers[i] );
+    CloseHandle( probe );
+    CloseHandle( event );
+    free( timers );
+    free( values );
+    return 0;
+}